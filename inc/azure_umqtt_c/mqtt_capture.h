@@ -0,0 +1,92 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_CAPTURE_H
+#define MQTT_CAPTURE_H
+
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_trace_ring.h"
+#include "umock_c/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct MQTT_CAPTURE_TAG* MQTT_CAPTURE_HANDLE;
+typedef struct MQTT_CAPTURE_READER_TAG* MQTT_CAPTURE_READER_HANDLE;
+
+#define MQTT_CAPTURE_READ_RESULT_VALUES \
+    MQTT_CAPTURE_READ_OK,               \
+    MQTT_CAPTURE_READ_END,              \
+    MQTT_CAPTURE_READ_ERROR
+
+MU_DEFINE_ENUM(MQTT_CAPTURE_READ_RESULT, MQTT_CAPTURE_READ_RESULT_VALUES);
+
+typedef struct MQTT_CAPTURE_PACKET_TAG
+{
+    uint64_t timestampMs;           // Tick counter time of the client that sent or received the packet
+    MQTT_TRACE_DIRECTION direction;
+    const uint8_t* data;            // The whole packet, fixed header included, valid until the next read
+    size_t length;
+} MQTT_CAPTURE_PACKET;
+
+/*
+*    @brief    Creates a capture file that keeps the bytes of the packets a client sends and receives, each framed with
+*              its time, direction and length. A capture is written from one thread.
+*    @param    path    File to write, replaced if it exists.
+*    @return   return    The capture, or NULL if path is NULL or the file cannot be created.
+*/
+MOCKABLE_FUNCTION(, MQTT_CAPTURE_HANDLE, mqtt_capture_create, const char*, path);
+
+/*
+*    @brief    Closes the file, filling the rest of a packet that was not appended in full with zeros.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_capture_destroy, MQTT_CAPTURE_HANDLE, handle);
+
+/*
+*    @brief    Starts a packet of length bytes, which mqtt_capture_append then writes in one or more parts.
+*    @param    timestampMs    Tick counter time of the client that sent or received the packet.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_capture_begin_packet, MQTT_CAPTURE_HANDLE, handle, MQTT_TRACE_DIRECTION, direction, uint64_t, timestampMs, size_t, length);
+
+/*
+*    @brief    Writes the next length bytes of the packet started by mqtt_capture_begin_packet.
+*    @return   return    0 on success, non-zero if the packet has fewer bytes left or a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_capture_append, MQTT_CAPTURE_HANDLE, handle, const uint8_t*, data, size_t, length);
+
+/*
+*    @brief    Returns the number of bytes the packet started last still waits for, 0 once it is complete.
+*/
+MOCKABLE_FUNCTION(, size_t, mqtt_capture_get_pending, MQTT_CAPTURE_HANDLE, handle);
+
+/*
+*    @brief    Opens a capture file written by mqtt_capture_create to read its packets in order.
+*    @return   return    The reader, or NULL if path is NULL or the file is not a capture file.
+*/
+MOCKABLE_FUNCTION(, MQTT_CAPTURE_READER_HANDLE, mqtt_capture_reader_open, const char*, path);
+
+/*
+*    @brief    Closes the file and frees the reader.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_capture_reader_close, MQTT_CAPTURE_READER_HANDLE, handle);
+
+/*
+*    @brief    Reads the next packet of the capture into a buffer the reader keeps.
+*    @param    packet    Gets the packet, its data stays valid until the next call.
+*    @return   return    MQTT_CAPTURE_READ_OK with a packet, MQTT_CAPTURE_READ_END after the last packet, or
+*                        MQTT_CAPTURE_READ_ERROR if the file is cut short, not valid or cannot be read.
+*/
+MOCKABLE_FUNCTION(, MQTT_CAPTURE_READ_RESULT, mqtt_capture_reader_next, MQTT_CAPTURE_READER_HANDLE, handle, MQTT_CAPTURE_PACKET*, packet);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_CAPTURE_H
@@ -7,7 +7,13 @@
 #include "azure_c_shared_utility/xio.h"
 #include "macro_utils/macro_utils.h"
 #include "azure_umqtt_c/mqttconst.h"
+#include "azure_umqtt_c/mqtt_codec.h"
 #include "azure_umqtt_c/mqtt_message.h"
+#include "azure_umqtt_c/mqtt_session_store.h"
+#include "azure_umqtt_c/mqtt_offline_queue.h"
+#include "azure_umqtt_c/mqtt_timer_wheel.h"
+#include "azure_umqtt_c/mqtt_trace_ring.h"
+#include "azure_umqtt_c/mqtt_capture.h"
 #include "umock_c/umock_c_prod.h"
 
 #ifdef __cplusplus
@@ -39,7 +45,8 @@ MU_DEFINE_ENUM(MQTT_CLIENT_EVENT_RESULT, MQTT_CLIENT_EVENT_VALUES);
     MQTT_CLIENT_MEMORY_ERROR,              \
     MQTT_CLIENT_COMMUNICATION_ERROR,       \
     MQTT_CLIENT_NO_PING_RESPONSE,          \
-    MQTT_CLIENT_UNKNOWN_ERROR
+    MQTT_CLIENT_UNKNOWN_ERROR,             \
+    MQTT_CLIENT_RECONNECT_FAILED
 
 MU_DEFINE_ENUM(MQTT_CLIENT_EVENT_ERROR, MQTT_CLIENT_EVENT_ERROR_VALUES);
 
@@ -50,10 +57,67 @@ MU_DEFINE_ENUM(MQTT_CLIENT_EVENT_ERROR, MQTT_CLIENT_EVENT_ERROR_VALUES);
 
 MU_DEFINE_ENUM(MQTT_CLIENT_ACK_OPTION, MQTT_CLIENT_ACK_OPTION_VALUES);
 
+typedef struct MQTT_CLIENT_RECONNECT_OPTIONS_TAG
+{
+    uint32_t initialDelayMs;    // Upper bound of the random wait before the first reconnect, doubled for every failed attempt
+    uint32_t maxDelayMs;        // Cap of the doubled wait
+    uint32_t maxRetryWindowMs;  // Time after the connection was lost when the client gives up, 0 means never
+    bool resubscribe;           // Send the acknowledged subscriptions again when the broker has no session
+} MQTT_CLIENT_RECONNECT_OPTIONS;
+
 typedef void(*ON_MQTT_OPERATION_CALLBACK)(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx);
 typedef void(*ON_MQTT_ERROR_CALLBACK)(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx);
 typedef MQTT_CLIENT_ACK_OPTION(*ON_MQTT_MESSAGE_RECV_CALLBACK)(MQTT_MESSAGE_HANDLE msgHandle, void* callbackCtx);
 typedef void(*ON_MQTT_DISCONNECTED_CALLBACK)(void* callbackCtx);
+typedef void(*ON_MQTT_PAYLOAD_RELEASED_CALLBACK)(void* callbackCtx, IO_SEND_RESULT send_result);
+typedef void(*ON_MQTT_CLIENT_WAKEUP)(void* context);
+
+typedef struct MQTT_PAYLOAD_SEGMENT_TAG
+{
+    const uint8_t* data;
+    size_t length;
+} MQTT_PAYLOAD_SEGMENT;
+
+typedef struct MQTT_CLIENT_WAIT_INFO_TAG
+{
+    uint32_t timeoutMs;         // Time until mqtt_client_dowork has timed work, 0 if it has work now, UINT32_MAX if none is scheduled
+    bool waitRead;              // Input on the connection should end the wait, false while every receive credit is used
+    bool waitWrite;             // The connection is being opened, being able to write to it should end the wait
+} MQTT_CLIENT_WAIT_INFO;
+
+typedef struct MQTT_CLIENT_RAW_TRACE_OPTIONS_TAG
+{
+    size_t maxBytes;            // Bytes of a packet written to the raw trace log record, 0 means the whole packet
+} MQTT_CLIENT_RAW_TRACE_OPTIONS;
+
+#define MQTT_CLIENT_PACKET_TYPE_COUNT       16
+#define MQTT_CLIENT_LATENCY_BUCKET_COUNT    64
+
+// Latencies in ms. Bucket n holds n ms below 4 ms, above that every power of two is split into 4 buckets of equal
+// width, so a bucket is at most a quarter of its lower bound wide. The last bucket also holds every longer latency.
+typedef struct MQTT_CLIENT_LATENCY_HISTOGRAM_TAG
+{
+    uint64_t count;
+    uint64_t totalMs;
+    uint64_t maxMs;
+    uint64_t buckets[MQTT_CLIENT_LATENCY_BUCKET_COUNT];
+} MQTT_CLIENT_LATENCY_HISTOGRAM;
+
+typedef struct MQTT_CLIENT_STATS_TAG
+{
+    uint64_t packetsSent[MQTT_CLIENT_PACKET_TYPE_COUNT];        // By control packet type shifted right by 4, queued packets included
+    uint64_t packetsReceived[MQTT_CLIENT_PACKET_TYPE_COUNT];
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint64_t parseErrors;
+    uint64_t reconnects;                // Times the transport was reopened to reconnect
+    uint64_t keepAliveTimeouts;         // PINGREQs without a PINGRESP in time
+    uint64_t latencyDropped;            // Acks not timed because too many PUBLISH and SUBSCRIBE packets waited at once
+    MQTT_CLIENT_LATENCY_HISTOGRAM publishToPuback;      // From the first send of a QoS 1 PUBLISH
+    MQTT_CLIENT_LATENCY_HISTOGRAM publishToPubcomp;     // From the first send of a QoS 2 PUBLISH
+    MQTT_CLIENT_LATENCY_HISTOGRAM subscribeToSuback;
+    MQTT_CLIENT_LATENCY_HISTOGRAM pingreqToPingresp;
+} MQTT_CLIENT_STATS;
 
 MOCKABLE_FUNCTION(, void, mqtt_client_clear_xio, MQTT_CLIENT_HANDLE, handle);
 MOCKABLE_FUNCTION(, MQTT_CLIENT_HANDLE, mqtt_client_init, ON_MQTT_MESSAGE_RECV_CALLBACK, msgRecv, ON_MQTT_OPERATION_CALLBACK, opCallback, void*, opCallbackCtx, ON_MQTT_ERROR_CALLBACK, onErrorCallBack, void*, errorCBCtx);
@@ -69,10 +133,190 @@ MOCKABLE_FUNCTION(, int, mqtt_client_send_message_response, MQTT_CLIENT_HANDLE,
 
 MOCKABLE_FUNCTION(, int, mqtt_client_publish, MQTT_CLIENT_HANDLE, handle, MQTT_MESSAGE_HANDLE, msgHandle);
 
+/*
+*    @brief    Publishes a message whose payload is sent straight from caller owned segments, the payload of msgHandle is ignored.
+*              The message is not tracked, stored or queued: QoS 1 and QoS 2 messages fail while the in-flight window is on,
+*              and every message fails while the offline queue holds messages or the client is not connected.
+*    @param    segments             Payload segments, sent in order without being copied.
+*    @param    onPayloadReleased    Called once the transport no longer needs the segments. Not called if the function fails.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_publish_iov, MQTT_CLIENT_HANDLE, handle, MQTT_MESSAGE_HANDLE, msgHandle, const MQTT_PAYLOAD_SEGMENT*, segments, size_t, segmentCount, ON_MQTT_PAYLOAD_RELEASED_CALLBACK, onPayloadReleased, void*, releasedCtx);
+
 MOCKABLE_FUNCTION(, void, mqtt_client_dowork, MQTT_CLIENT_HANDLE, handle);
 
 MOCKABLE_FUNCTION(, void, mqtt_client_set_trace, MQTT_CLIENT_HANDLE, handle, bool, traceOn, bool, rawBytesOn);
 
+/*
+*    @brief    Queues outgoing control packets and writes them with a single xio_send per mqtt_client_dowork.
+*    @param    maxBytes        Size of the outbound queue, the queue is sent when it fills up. Zero turns coalescing off.
+*    @param    maxLatencyMs    Longest time a queued packet may wait when packets keep arriving between mqtt_client_dowork calls.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_send_coalescing, MQTT_CLIENT_HANDLE, handle, size_t, maxBytes, uint32_t, maxLatencyMs);
+
+/*
+*    @brief    Lets the client own the packet ids of QoS 1 and QoS 2 publishes and resend them until they are acknowledged.
+*              mqtt_client_publish sets the packet id of the message, read it back with mqttmessage_getPacketId.
+*    @param    maxInflight       Most unacknowledged publishes at a time, mqtt_client_publish fails once they are reached. Zero turns tracking off.
+*    @param    retryTimeoutMs    Time to wait for an acknowledgement before resending with the DUP flag, zero never resends.
+*    @return   return    Zero if no failures occur, or non-zero otherwise. Fails while messages are in flight.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_inflight_window, MQTT_CLIENT_HANDLE, handle, size_t, maxInflight, uint32_t, retryTimeoutMs);
+
+/*
+*    @brief    Keeps the in-flight messages and the received QoS 2 packet ids in sessionStore so they survive a restart.
+*              Restores what sessionStore already holds, those messages are resent once connected. The store is not owned.
+*    @param    sessionStore    Store to use, or NULL to stop using one. Needs mqtt_client_set_inflight_window first.
+*    @return   return    Zero if no failures occur, or non-zero otherwise. Fails while messages are in flight.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_session_store, MQTT_CLIENT_HANDLE, handle, MQTT_SESSION_STORE_HANDLE, sessionStore);
+
+/*
+*    @brief    Queues publishes made while the client is not connected and sends them once CONNACK is received.
+*              Queued QoS 1 and QoS 2 messages get their packet id from the in-flight window when they are sent.
+*    @param    options    Memory budget, segment file and drop policy of the queue, or NULL to stop queueing.
+*    @return   return    Zero if no failures occur, or non-zero otherwise. Fails while publishes are queued.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_offline_queue, MQTT_CLIENT_HANDLE, handle, const MQTT_OFFLINE_QUEUE_OPTIONS*, options);
+
+/*
+*    @brief    Reopens the XIO_HANDLE given to mqtt_client_connect from mqtt_client_dowork after the connection fails,
+*              waiting a jittered, exponentially growing time between attempts.
+*              Until the SUBACK of a resubscribe comes, mqtt_client_subscribe and mqtt_client_unsubscribe fail for its packet id.
+*    @param    options    Backoff and resubscribe settings, or NULL to stop reconnecting.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_reconnect, MQTT_CLIENT_HANDLE, handle, const MQTT_CLIENT_RECONNECT_OPTIONS*, options);
+
+/*
+*    @brief    Routes received messages whose topic matches topicFilter to handler instead of the ON_MQTT_MESSAGE_RECV_CALLBACK.
+*              Filters are kept in a trie, so finding the handlers costs the number of topic levels, not the number of filters.
+*              Messages no filter matches still go to the ON_MQTT_MESSAGE_RECV_CALLBACK. Called from a handler, the change
+*              is made once the message was passed to every matching handler, and errors are only logged.
+*    @param    topicFilter    Filter as given in SUBSCRIBE_PAYLOAD, + and # are supported. Replaces the handler set before for it.
+*    @param    handler        Called for every matching message, or NULL to remove the handler of topicFilter.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_topic_handler, MQTT_CLIENT_HANDLE, handle, const char*, topicFilter, ON_MQTT_MESSAGE_RECV_CALLBACK, handler, void*, context);
+
+/*
+*    @brief    Interns a topic name the client publishes to repeatedly. Messages created on the returned topic with
+*              mqttmessage_create_with_topic are published from its stored encoding without copying or measuring the name.
+*              The topic stays valid until mqtt_client_deinit, so messages on it must be destroyed before that.
+*    @param    topicName    Topic name to publish to, without wildcards.
+*    @return   return    The same topic for every call with the same name, or NULL if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_TOPIC_HANDLE, mqtt_client_intern_topic, MQTT_CLIENT_HANDLE, handle, const char*, topicName);
+
+/*
+*    @brief    Limits how many received QoS 1 and QoS 2 messages answered with MQTT_CLIENT_ACK_ASYNC may wait for
+*              mqtt_client_send_message_response. Once the credit is used up further publishes are held, and delivered by
+*              mqtt_client_dowork as acknowledgements are sent, while pings and other packets are still processed. A DUP
+*              redelivery of a message still waiting is not delivered again.
+*              On MQTT 5 the credit is also sent as the receive maximum of the next CONNECT.
+*    @param    credit    Number of unacknowledged messages, at most 65535, or 0 for no limit.
+*    @return   return    0 on success, non-zero if messages are waiting for their acknowledgement or a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_receive_credit, MQTT_CLIENT_HANDLE, handle, size_t, credit);
+
+/*
+*    @brief    Creates the queue mqtt_client_submit_publish pushes into. Must be called before other threads submit.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_enable_submit_queue, MQTT_CLIENT_HANDLE, handle);
+
+/*
+*    @brief    Publishes a message from any thread. The message is encoded on the calling thread and the packet is
+*              handed to mqtt_client_dowork without a lock, which sends it the way an offline queued publish is sent:
+*              through the offline queue when one is set, otherwise once connected. When the in-flight window is on
+*              mqtt_client_dowork gives QoS 1 and QoS 2 packets their packet id. Every other function of the client,
+*              including mqtt_client_deinit, must still be called from the thread that calls mqtt_client_dowork.
+*    @param    msgHandle    The message to publish, it is not used after the call returns.
+*    @return   return    0 if the message was queued, non-zero if the submit queue is not enabled or a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_submit_publish, MQTT_CLIENT_HANDLE, handle, MQTT_MESSAGE_HANDLE, msgHandle);
+
+/*
+*    @brief    Sets a callback mqtt_client_submit_publish calls after queueing a message, so an event loop waiting for the
+*              client can wake up. It runs on the submitting thread. It may be replaced while other threads submit, and
+*              this call returns only once no thread still runs the previous callback, yielding while it waits. Called
+*              from the callback itself it would wait forever, so it fails instead.
+*    @param    onWakeup    The callback, NULL to remove it.
+*    @return   return    0 on success, non-zero if handle is NULL or it is called from the wakeup callback.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_wakeup_callback, MQTT_CLIENT_HANDLE, handle, ON_MQTT_CLIENT_WAKEUP, onWakeup, void*, context);
+
+/*
+*    @brief    Tells an event loop how long it can wait before calling mqtt_client_dowork again and which readiness of the
+*              connection should end the wait early. Input the transport buffered without the loop seeing it is not known
+*              to the client, the loop has to bound its wait if the transport does that.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_get_wait_info, MQTT_CLIENT_HANDLE, handle, MQTT_CLIENT_WAIT_INFO*, waitInfo);
+
+/*
+*    @brief    Makes the client take its receive buffers from a pool it shares with other clients driven from the same
+*              thread, see mqtt_codec_recv_pool_create. It is called on the thread that runs mqtt_client_dowork.
+*    @param    pool    The pool, NULL to go back to the pool of the client.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_recv_pool, MQTT_CLIENT_HANDLE, handle, MQTT_CODEC_RECV_POOL_HANDLE, pool);
+
+/*
+*    @brief    Makes the client tell time from a timer wheel instead of reading its tick counter, and keeps a timer on
+*              the wheel at the earliest keep alive ping, ping response timeout, in-flight retry or reconnect, which
+*              mqtt_client_dowork moves after its work. Many clients driven from one thread can share a wheel, so
+*              advancing it once replaces a clock read per client. It is called on the thread that runs
+*              mqtt_client_dowork and advances the wheel.
+*    @param    timerWheel    The wheel, NULL to go back to the tick counter of the client.
+*    @param    onDue    Called from mqtt_timer_wheel_advance once mqtt_client_dowork has timed work to do.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_timer_wheel, MQTT_CLIENT_HANDLE, handle, MQTT_TIMER_WHEEL_HANDLE, timerWheel, ON_MQTT_CLIENT_WAKEUP, onDue, void*, context);
+
+/*
+*    @brief    Records every packet the client sends or receives into a binary trace ring, a far cheaper trace than
+*              mqtt_client_set_trace that can stay on in production. One ring can be shared by many clients.
+*    @param    traceRing    The ring, not owned by the client, NULL to stop recording.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_trace_ring, MQTT_CLIENT_HANDLE, handle, MQTT_TRACE_RING_HANDLE, traceRing);
+
+/*
+*    @brief    Sets how the raw bytes trace of mqtt_client_set_trace is written in a build with ENABLE_RAW_TRACE. Every
+*              packet is written as one log record of hex bytes.
+*    @param    options    Byte cap of a log record, copied by the client.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_raw_trace_options, MQTT_CLIENT_HANDLE, handle, const MQTT_CLIENT_RAW_TRACE_OPTIONS*, options);
+
+/*
+*    @brief    Writes the bytes of every packet the client sends or receives to a capture file, with its time and
+*              direction, in every build. mqtt_capture_reader_open reads the file back, and the mqtt_capture_replay
+*              sample replays its received packets into a client.
+*    @param    capture    The capture, not owned by the client, NULL to stop writing.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_capture, MQTT_CLIENT_HANDLE, handle, MQTT_CAPTURE_HANDLE, capture);
+
+/*
+*    @brief    Copies the packet and byte counters and the latency histograms the client keeps from mqtt_client_init on.
+*              They are always on and cost no allocation. The thread that runs mqtt_client_dowork updates them and any
+*              thread can read them, every value is read on its own, so values updated meanwhile may not add up.
+*    @param    stats    Gets the statistics.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_get_stats, MQTT_CLIENT_HANDLE, handle, MQTT_CLIENT_STATS*, stats);
+
+/*
+*    @brief    Reads a percentile off a latency histogram of mqtt_client_get_stats.
+*    @param    percentile    From 0 to 100.
+*    @return   return    The upper bound in ms of the bucket the percentile falls in, no more than the largest latency,
+*                        or 0 if histogram is NULL or empty.
+*/
+MOCKABLE_FUNCTION(, uint64_t, mqtt_client_get_latency_percentile, const MQTT_CLIENT_LATENCY_HISTOGRAM*, histogram, double, percentile);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
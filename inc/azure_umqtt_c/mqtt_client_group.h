@@ -0,0 +1,96 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_CLIENT_GROUP_H
+#define MQTT_CLIENT_GROUP_H
+
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_client_run.h"
+#include "macro_utils/macro_utils.h"
+#include "umock_c/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct MQTT_CLIENT_GROUP_TAG* MQTT_CLIENT_GROUP_HANDLE;
+typedef struct MQTT_CLIENT_GROUP_MEMBER_TAG* MQTT_CLIENT_GROUP_MEMBER_HANDLE;
+
+// Runs on the worker thread of the member the client was added as
+typedef void(*ON_MQTT_CLIENT_GROUP_WORK)(MQTT_CLIENT_HANDLE client, void* context);
+
+typedef struct MQTT_CLIENT_GROUP_OPTIONS_TAG
+{
+    size_t workerCount;             // Number of worker threads, each with its own epoll set
+    uint32_t maxWaitMs;             // Longest wait of a worker, 0 for none. Without a socket it is how often input is polled.
+    size_t recvPoolHighWaterMark;   // Idle receive buffer bytes the clients of a worker share, 0 leaves every client its own pool
+} MQTT_CLIENT_GROUP_OPTIONS;
+
+/*
+*    @brief    Creates a group that drives many clients from a few worker threads instead of one mqtt_client_dowork loop
+*              per client. Every worker waits with epoll on the sockets of its clients and calls mqtt_client_dowork only
+*              for the clients that have work. Only available on Linux.
+*    @return   return    The group, or NULL if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_CLIENT_GROUP_HANDLE, mqtt_client_group_create, const MQTT_CLIENT_GROUP_OPTIONS*, options);
+
+/*
+*    @brief    Stops the workers, runs the work that was posted but not run yet and detaches the remaining clients
+*              before freeing the group. The clients themselves stay with the caller.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_client_group_destroy, MQTT_CLIENT_GROUP_HANDLE, handle);
+
+/*
+*    @brief    Starts one thread per worker that runs mqtt_client_group_run_worker_once until mqtt_client_group_stop.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_group_start, MQTT_CLIENT_GROUP_HANDLE, handle);
+
+/*
+*    @brief    Stops the worker threads and waits for them to exit. Must not be called from a worker thread.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_group_stop, MQTT_CLIENT_GROUP_HANDLE, handle);
+
+/*
+*    @brief    Runs one wait of a worker and the mqtt_client_dowork calls that follow it on the calling thread, for
+*              callers that drive the group from their own threads. Must not be called while the group is started.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_group_run_worker_once, MQTT_CLIENT_GROUP_HANDLE, handle, size_t, workerIndex);
+
+/*
+*    @brief    Adds client to the worker with the fewest clients, which drives it until it is removed. From then on the
+*              client may only be used from that worker: through mqtt_client_group_post, its callbacks, or
+*              mqtt_client_submit_publish from any thread. Can be called from any thread.
+*    @param    getSocket    Asked for the socket of the client after each of its mqtt_client_dowork calls, NULL when the
+*                           socket of the transport is not known and the group has a non-zero maxWaitMs.
+*    @return   return    The member, or NULL if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_CLIENT_GROUP_MEMBER_HANDLE, mqtt_client_group_add, MQTT_CLIENT_GROUP_HANDLE, handle, MQTT_CLIENT_HANDLE, client, ON_MQTT_CLIENT_RUN_GET_SOCKET, getSocket, void*, getSocketContext);
+
+/*
+*    @brief    Runs work on the worker of member, followed by mqtt_client_dowork of its client. Can be called from any
+*              thread until mqtt_client_group_remove.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_group_post, MQTT_CLIENT_GROUP_MEMBER_HANDLE, member, ON_MQTT_CLIENT_GROUP_WORK, work, void*, context);
+
+/*
+*    @brief    Removes member from its worker. onRemoved, if not NULL, runs on the worker once the worker is done with the
+*              client, which may then be used or deinitialized from any thread. Messages submitted to the client while
+*              it is being removed wait in its submit queue for the next mqtt_client_dowork. Can be called from any
+*              thread, member is freed by the group.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_group_remove, MQTT_CLIENT_GROUP_MEMBER_HANDLE, member, ON_MQTT_CLIENT_GROUP_WORK, onRemoved, void*, context);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_CLIENT_GROUP_H
@@ -0,0 +1,72 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_CLIENT_RUN_H
+#define MQTT_CLIENT_RUN_H
+
+#include "azure_umqtt_c/mqtt_client.h"
+#include "macro_utils/macro_utils.h"
+#include "umock_c/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+extern "C" {
+#else
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct MQTT_CLIENT_RUN_TAG* MQTT_CLIENT_RUN_HANDLE;
+
+// Returns the socket the XIO_HANDLE of the client reads from, or -1 when there is none yet
+typedef int(*ON_MQTT_CLIENT_RUN_GET_SOCKET)(void* context);
+
+typedef struct MQTT_CLIENT_RUN_OPTIONS_TAG
+{
+    ON_MQTT_CLIENT_RUN_GET_SOCKET getSocket;    // NULL when the socket of the transport is not known
+    void* getSocketContext;
+    uint32_t maxWaitMs;                         // Longest wait, 0 for none. Without a socket it is how often input is polled.
+} MQTT_CLIENT_RUN_OPTIONS;
+
+/*
+*    @brief    Creates a run loop for client that sleeps until the client has work instead of polling it. Only available
+*              on Linux, where it waits with epoll on the socket of the client and an eventfd other threads can signal.
+*    @param    options    The socket getter is asked for the socket before every wait, so it can change when the
+*                         client reconnects. A socket that is not given needs a non-zero maxWaitMs.
+*    @return   return    The run loop, or NULL if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_CLIENT_RUN_HANDLE, mqtt_client_run_create, MQTT_CLIENT_HANDLE, client, const MQTT_CLIENT_RUN_OPTIONS*, options);
+
+/*
+*    @brief    Frees the run loop, which must not be running. The client is left as it was before mqtt_client_run_create.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_client_run_destroy, MQTT_CLIENT_RUN_HANDLE, handle);
+
+/*
+*    @brief    Waits until the client has work, a wakeup or the socket ends the wait, and then calls mqtt_client_dowork once.
+*              It can take the place of mqtt_client_dowork in an existing loop.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_run_once, MQTT_CLIENT_RUN_HANDLE, handle);
+
+/*
+*    @brief    Calls mqtt_client_run_once until mqtt_client_run_stop is called.
+*    @return   return    0 once stopped, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_run, MQTT_CLIENT_RUN_HANDLE, handle);
+
+/*
+*    @brief    Ends the current wait of the run loop. Can be called from any thread.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_run_wakeup, MQTT_CLIENT_RUN_HANDLE, handle);
+
+/*
+*    @brief    Makes mqtt_client_run return after its current mqtt_client_dowork. Can be called from any thread,
+*              including the callbacks of the client.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_run_stop, MQTT_CLIENT_RUN_HANDLE, handle);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_CLIENT_RUN_H
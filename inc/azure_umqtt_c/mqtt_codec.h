@@ -24,21 +24,127 @@ typedef struct MQTTCODEC_INSTANCE_TAG* MQTTCODEC_HANDLE;
 
 typedef void(*ON_PACKET_COMPLETE_CALLBACK)(void* context, CONTROL_PACKET_TYPE packet, int flags, BUFFER_HANDLE headerData);
 
+/*
+*    @brief    Called for every complete packet with the variable header and payload of the packet.
+*              packetData is only valid for the duration of the call.  When the whole packet was
+*              contained in the buffer given to mqtt_codec_bytesReceived it points into that buffer,
+*              otherwise it points into the buffer the codec assembled the packet in.
+*/
+typedef void(*ON_PACKET_VIEW_CALLBACK)(void* context, CONTROL_PACKET_TYPE packet, int flags, const uint8_t* packetData, size_t packetLength);
+
+typedef struct MQTT_CODEC_POOL_STATS_TAG
+{
+    size_t hits;
+    size_t misses;
+    size_t cachedBytes;
+    size_t peakBytes;
+} MQTT_CODEC_POOL_STATS;
+
+typedef struct RECV_POOL_TAG* MQTT_CODEC_RECV_POOL_HANDLE;
+
+// Sizes of the packets the mqtt_codec_encode_* functions write
+#define MQTT_CODEC_PUBLISH_REPLY_SIZE   4
+#define MQTT_CODEC_EMPTY_PACKET_SIZE    2
+
 MOCKABLE_FUNCTION(, MQTTCODEC_HANDLE, mqtt_codec_create, ON_PACKET_COMPLETE_CALLBACK, packetComplete, void*, callbackCtx);
+MOCKABLE_FUNCTION(, MQTTCODEC_HANDLE, mqtt_codec_create_with_view, ON_PACKET_VIEW_CALLBACK, packetView, void*, callbackCtx);
 MOCKABLE_FUNCTION(, void, mqtt_codec_destroy, MQTTCODEC_HANDLE, handle);
 
 MOCKABLE_FUNCTION(, void, mqtt_codec_reset, MQTTCODEC_HANDLE, handle);
+
+/*
+*    @brief    Sets how many bytes of idle receive buffers the codec keeps for reuse, idle buffers above the mark are freed.
+*    @param    handle           Handle to the codec.
+*    @param    highWaterMark    Maximum number of bytes of idle receive buffers, zero disables caching.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_codec_set_pool_high_water_mark, MQTTCODEC_HANDLE, handle, size_t, highWaterMark);
+MOCKABLE_FUNCTION(, int, mqtt_codec_get_pool_stats, MQTTCODEC_HANDLE, handle, MQTT_CODEC_POOL_STATS*, poolStats);
+
+/*
+*    @brief    Creates a receive buffer pool that several codecs driven from the same thread can share, so buffers freed
+*              by one connection are reused by the next instead of each codec caching its own.
+*    @param    highWaterMark    Maximum number of bytes of idle receive buffers, zero disables caching.
+*    @return   return    The pool, or NULL if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_CODEC_RECV_POOL_HANDLE, mqtt_codec_recv_pool_create, size_t, highWaterMark);
+
+/*
+*    @brief    Frees the pool and its idle buffers. No codec may still use it.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_codec_recv_pool_destroy, MQTT_CODEC_RECV_POOL_HANDLE, pool);
+
+/*
+*    @brief    Makes the codec take its receive buffers from pool, or from its own pool again when pool is NULL. A packet
+*              being assembled keeps its buffer, which is returned to pool once the packet is complete.
+*              mqtt_codec_set_pool_high_water_mark and mqtt_codec_get_pool_stats then apply to pool.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_codec_set_recv_pool, MQTTCODEC_HANDLE, handle, MQTT_CODEC_RECV_POOL_HANDLE, pool);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_connect, const MQTT_CLIENT_OPTIONS*, mqttOptions, STRING_HANDLE, trace_log);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_disconnect);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publish, QOS_VALUE, qosValue, bool, duplicateMsg, bool, serverRetain, uint16_t, packetId, const char*, topicName, const uint8_t*, msgBuffer, size_t, buffLen, STRING_HANDLE, trace_log);
+
+/*
+*    @brief    Encodes only the fixed header, topic name and packet id of a PUBLISH packet so the payload can be sent from caller memory.
+*    @param    payloadLen       Number of payload bytes that will follow the header on the wire.
+*    @param    headerBuffer     Buffer that receives the header.
+*    @param    headerLength     In: size of headerBuffer. Out: number of bytes written, or the size required if headerBuffer is too small.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_codec_publish_header, QOS_VALUE, qosValue, bool, duplicateMsg, bool, serverRetain, uint16_t, packetId, const char*, topicName, size_t, payloadLen, uint8_t*, headerBuffer, size_t*, headerLength, STRING_HANDLE, trace_log);
+
+/*
+*    @brief    Same as mqtt_codec_publish and mqtt_codec_publish_header for a topic name that is already encoded, such as
+*              the bytes returned by mqtt_topic_get_encoded. The name is copied as is instead of being measured and encoded.
+*    @param    encodedTopic       Topic name length as two bytes, most significant first, followed by the name.
+*    @param    encodedTopicLen    Number of bytes in encodedTopic, including the two length bytes.
+*/
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publish_encoded_topic, QOS_VALUE, qosValue, bool, duplicateMsg, bool, serverRetain, uint16_t, packetId, const uint8_t*, encodedTopic, size_t, encodedTopicLen, const uint8_t*, msgBuffer, size_t, buffLen, STRING_HANDLE, trace_log);
+MOCKABLE_FUNCTION(, int, mqtt_codec_publish_header_encoded_topic, QOS_VALUE, qosValue, bool, duplicateMsg, bool, serverRetain, uint16_t, packetId, const uint8_t*, encodedTopic, size_t, encodedTopicLen, size_t, payloadLen, uint8_t*, headerBuffer, size_t*, headerLength, STRING_HANDLE, trace_log);
+
+/*
+*    @brief    Same as mqtt_codec_publish and mqtt_codec_publish_header for an MQTT 5 connection, the packet id is followed by a
+*              property block that carries topicAlias when it is not zero.
+*    @param    topicName          Topic name, it does not need to be zero terminated. Can be NULL when topicNameLength is zero.
+*    @param    topicNameLength    Number of bytes in topicName, zero to publish by topicAlias alone.
+*    @param    topicAlias         Topic alias to send, zero for none. An alias is set up by sending it once with the topic name.
+*/
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publish_v5, QOS_VALUE, qosValue, bool, duplicateMsg, bool, serverRetain, uint16_t, packetId, const char*, topicName, size_t, topicNameLength, uint16_t, topicAlias, const uint8_t*, msgBuffer, size_t, buffLen, STRING_HANDLE, trace_log);
+MOCKABLE_FUNCTION(, int, mqtt_codec_publish_header_v5, QOS_VALUE, qosValue, bool, duplicateMsg, bool, serverRetain, uint16_t, packetId, const char*, topicName, size_t, topicNameLength, uint16_t, topicAlias, size_t, payloadLen, uint8_t*, headerBuffer, size_t*, headerLength, STRING_HANDLE, trace_log);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publishAck, uint16_t, packetId);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publishReceived, uint16_t, packetId);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publishRelease, uint16_t, packetId);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publishComplete, uint16_t, packetId);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_ping);
+
+/*
+*    @brief    Write a PUBACK, PUBREC, PUBREL or PUBCOMP packet into caller memory instead of allocating a BUFFER_HANDLE,
+*              so acknowledging a message costs no allocation.
+*    @param    packet    Buffer of at least MQTT_CODEC_PUBLISH_REPLY_SIZE bytes that receives the packet.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_codec_encode_puback, uint16_t, packetId, uint8_t*, packet);
+MOCKABLE_FUNCTION(, int, mqtt_codec_encode_pubrec, uint16_t, packetId, uint8_t*, packet);
+MOCKABLE_FUNCTION(, int, mqtt_codec_encode_pubrel, uint16_t, packetId, uint8_t*, packet);
+MOCKABLE_FUNCTION(, int, mqtt_codec_encode_pubcomp, uint16_t, packetId, uint8_t*, packet);
+
+/*
+*    @brief    Write a PINGREQ or DISCONNECT packet into caller memory instead of allocating a BUFFER_HANDLE.
+*    @param    packet    Buffer of at least MQTT_CODEC_EMPTY_PACKET_SIZE bytes that receives the packet.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_codec_encode_pingreq, uint8_t*, packet);
+MOCKABLE_FUNCTION(, int, mqtt_codec_encode_disconnect, uint8_t*, packet);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_subscribe, uint16_t, packetId, SUBSCRIBE_PAYLOAD*, subscribeList, size_t, count, STRING_HANDLE, trace_log);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_unsubscribe, uint16_t, packetId, const char**, unsubscribeList, size_t, count, STRING_HANDLE, trace_log);
 
+/*
+*    @brief    Same as mqtt_codec_subscribe and mqtt_codec_unsubscribe for an MQTT 5 connection, with an empty property block.
+*/
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_subscribe_v5, uint16_t, packetId, SUBSCRIBE_PAYLOAD*, subscribeList, size_t, count, STRING_HANDLE, trace_log);
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_unsubscribe_v5, uint16_t, packetId, const char**, unsubscribeList, size_t, count, STRING_HANDLE, trace_log);
+
 MOCKABLE_FUNCTION(, int, mqtt_codec_bytesReceived, MQTTCODEC_HANDLE, handle, const unsigned char*, buffer, size_t, size);
 
 #ifdef __cplusplus
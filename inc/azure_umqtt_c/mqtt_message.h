@@ -5,6 +5,7 @@
 #define MQTT_MESSAGE_H
 
 #include "azure_umqtt_c/mqttconst.h"
+#include "azure_umqtt_c/mqtt_topic_table.h"
 #include "umock_c/umock_c_prod.h"
 
 #ifdef __cplusplus
@@ -19,13 +20,41 @@ extern "C" {
 
 typedef struct MQTT_MESSAGE_TAG* MQTT_MESSAGE_HANDLE;
 
+typedef struct MQTT_TOPIC_LEVEL_TAG
+{
+    size_t offset;
+    size_t length;
+} MQTT_TOPIC_LEVEL;
+
 MOCKABLE_FUNCTION(, MQTT_MESSAGE_HANDLE, mqttmessage_create_in_place, uint16_t, packetId, const char*, topicName, QOS_VALUE, qosValue, const uint8_t*, appMsg, size_t, appMsgLength);
+/*
+*    @brief    Creates a message that borrows topicName and appMsg, topicName does not need to be NULL terminated.
+*    @param    topicNameLength    Number of bytes in topicName.
+*    @return   return    Handle to the MQTT message, or NULL on failure.
+*/
+MOCKABLE_FUNCTION(, MQTT_MESSAGE_HANDLE, mqttmessage_create_in_place_n, uint16_t, packetId, const char*, topicName, size_t, topicNameLength, QOS_VALUE, qosValue, const uint8_t*, appMsg, size_t, appMsgLength);
 MOCKABLE_FUNCTION(, MQTT_MESSAGE_HANDLE, mqttmessage_create, uint16_t, packetId, const char*, topicName, QOS_VALUE, qosValue, const uint8_t*, appMsg, size_t, appMsgLength);
+/*
+*    @brief    Creates a message on an interned topic that borrows appMsg. Neither the message nor its clones copy
+*              the topic name, so the topic table must outlive them.
+*    @param    topic    Topic returned by mqtt_topic_table_intern.
+*    @return   return    Handle to the MQTT message, or NULL on failure.
+*/
+MOCKABLE_FUNCTION(, MQTT_MESSAGE_HANDLE, mqttmessage_create_with_topic, uint16_t, packetId, MQTT_TOPIC_HANDLE, topic, QOS_VALUE, qosValue, const uint8_t*, appMsg, size_t, appMsgLength);
 MOCKABLE_FUNCTION(,void, mqttmessage_destroy, MQTT_MESSAGE_HANDLE, handle);
 MOCKABLE_FUNCTION(,MQTT_MESSAGE_HANDLE, mqttmessage_clone, MQTT_MESSAGE_HANDLE, handle);
 
 MOCKABLE_FUNCTION(, uint16_t, mqttmessage_getPacketId, MQTT_MESSAGE_HANDLE, handle);
 MOCKABLE_FUNCTION(, const char*, mqttmessage_getTopicName, MQTT_MESSAGE_HANDLE, handle);
+MOCKABLE_FUNCTION(, MQTT_TOPIC_HANDLE, mqttmessage_getInternedTopic, MQTT_MESSAGE_HANDLE, handle);
+
+/*
+*    @brief    Gets the topic name without copying it, the returned value may not be NULL terminated.
+*    @param    handle             Handle to the MQTT message.
+*    @param    topicNameLength    Pointer the variable where to store the length of the topic name.
+*    @return   return    Pointer to the topic name, or NULL on failure.
+*/
+MOCKABLE_FUNCTION(, const char*, mqttmessage_getTopicNameView, MQTT_MESSAGE_HANDLE, handle, size_t*, topicNameLength);
 
 /*
 *    @brief    Gets the individual names of the MQTT topic levels, in the original order.
@@ -36,11 +65,29 @@ MOCKABLE_FUNCTION(, const char*, mqttmessage_getTopicName, MQTT_MESSAGE_HANDLE,
 */
 MOCKABLE_FUNCTION(, int, mqttmessage_getTopicLevels, MQTT_MESSAGE_HANDLE, handle, char***, levels, size_t*, count);
 
+/*
+*    @brief    Gets the same levels as mqttmessage_getTopicLevels without allocating, as offsets into the topic name returned by mqttmessage_getTopicNameView.
+*    @param    handle       Handle to the MQTT message.
+*    @param    levels       Caller array where to store the levels, can be NULL if maxLevels is 0.
+*    @param    maxLevels    Number of entries in levels.
+*    @param    count        Pointer the variable where to store the number of levels in the topic name, also when they do not all fit.
+*    @return   return    Zero if every level was stored, or non-zero if a failure occurred or the topic has more than maxLevels levels.
+*/
+MOCKABLE_FUNCTION(, int, mqttmessage_getTopicLevelSpans, MQTT_MESSAGE_HANDLE, handle, MQTT_TOPIC_LEVEL*, levels, size_t, maxLevels, size_t*, count);
+
 MOCKABLE_FUNCTION(, QOS_VALUE, mqttmessage_getQosType, MQTT_MESSAGE_HANDLE, handle);
 MOCKABLE_FUNCTION(, bool, mqttmessage_getIsDuplicateMsg, MQTT_MESSAGE_HANDLE, handle);
 MOCKABLE_FUNCTION(, bool, mqttmessage_getIsRetained, MQTT_MESSAGE_HANDLE, handle);
 MOCKABLE_FUNCTION(, int, mqttmessage_setIsDuplicateMsg, MQTT_MESSAGE_HANDLE, handle, bool, duplicateMsg);
 MOCKABLE_FUNCTION(, int, mqttmessage_setIsRetained, MQTT_MESSAGE_HANDLE, handle, bool, retainMsg);
+
+/*
+*    @brief    Changes the packet id of the message, used when the client allocates the id at publish time.
+*    @param    handle      Handle to the MQTT message.
+*    @param    packetId    New packet id of the message.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqttmessage_setPacketId, MQTT_MESSAGE_HANDLE, handle, uint16_t, packetId);
 MOCKABLE_FUNCTION(, const APP_PAYLOAD*, mqttmessage_getApplicationMsg, MQTT_MESSAGE_HANDLE, handle);
 
 #ifdef __cplusplus
@@ -0,0 +1,69 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_OFFLINE_QUEUE_H
+#define MQTT_OFFLINE_QUEUE_H
+
+#include "azure_c_shared_utility/buffer_.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqttconst.h"
+#include "umock_c/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+extern "C" {
+#else
+#include <stddef.h>
+#endif // __cplusplus
+
+typedef struct MQTT_OFFLINE_QUEUE_TAG* MQTT_OFFLINE_QUEUE_HANDLE;
+
+#define MQTT_OFFLINE_DROP_POLICY_VALUES  \
+    MQTT_OFFLINE_DROP_OLDEST,            \
+    MQTT_OFFLINE_DROP_NEWEST,            \
+    MQTT_OFFLINE_DROP_LOWEST_QOS
+
+MU_DEFINE_ENUM(MQTT_OFFLINE_DROP_POLICY, MQTT_OFFLINE_DROP_POLICY_VALUES);
+
+typedef struct MQTT_OFFLINE_QUEUE_OPTIONS_TAG
+{
+    size_t maxMemoryBytes;                  // Encoded bytes kept in memory, newer packets go to spillPath
+    const char* spillPath;                  // Segment file for packets over maxMemoryBytes, NULL applies dropPolicy instead
+    size_t maxSpillBytes;                   // Bytes of packets the segment file may hold, 0 means no limit
+    MQTT_OFFLINE_DROP_POLICY dropPolicy;    // Which packet is dropped once memory and segment file are full
+    size_t drainPerDowork;                  // Queued publishes mqtt_client_dowork sends per call once connected, 0 sends them all
+} MQTT_OFFLINE_QUEUE_OPTIONS;
+
+typedef struct MQTT_OFFLINE_QUEUE_STATS_TAG
+{
+    size_t count;
+    size_t memoryBytes;
+    size_t spillBytes;
+    size_t dropped;
+} MQTT_OFFLINE_QUEUE_STATS;
+
+MOCKABLE_FUNCTION(, MQTT_OFFLINE_QUEUE_HANDLE, mqtt_offline_queue_create, const MQTT_OFFLINE_QUEUE_OPTIONS*, options);
+MOCKABLE_FUNCTION(, void, mqtt_offline_queue_destroy, MQTT_OFFLINE_QUEUE_HANDLE, handle);
+
+/*
+*    @brief    Appends an encoded PUBLISH packet, dropping queued packets as the drop policy says when there is no room.
+*    @param    packet    Encoded packet, owned by the queue on success.
+*    @param    qos       QoS of the packet, used by MQTT_OFFLINE_DROP_LOWEST_QOS, which also drops spilled packets.
+*    @return   return    Zero if the packet was queued, or non-zero if it was dropped or a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_offline_queue_push, MQTT_OFFLINE_QUEUE_HANDLE, handle, BUFFER_HANDLE, packet, QOS_VALUE, qos);
+
+/*
+*    @brief    Returns the oldest packet without removing it, reading it back from the segment file if needed.
+*    @return   return    The packet, still owned by the queue, or NULL if the queue is empty or a failure occurred.
+*/
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_offline_queue_peek, MQTT_OFFLINE_QUEUE_HANDLE, handle);
+MOCKABLE_FUNCTION(, void, mqtt_offline_queue_pop, MQTT_OFFLINE_QUEUE_HANDLE, handle);
+MOCKABLE_FUNCTION(, size_t, mqtt_offline_queue_count, MQTT_OFFLINE_QUEUE_HANDLE, handle);
+MOCKABLE_FUNCTION(, int, mqtt_offline_queue_get_stats, MQTT_OFFLINE_QUEUE_HANDLE, handle, MQTT_OFFLINE_QUEUE_STATS*, stats);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_OFFLINE_QUEUE_H
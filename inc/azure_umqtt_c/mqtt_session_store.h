@@ -0,0 +1,89 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_SESSION_STORE_H
+#define MQTT_SESSION_STORE_H
+
+#include "umock_c/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+extern "C" {
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#endif // __cplusplus
+
+typedef struct MQTT_SESSION_STORE_INSTANCE_TAG* MQTT_SESSION_STORE_HANDLE;
+typedef void* CONCRETE_SESSION_STORE_HANDLE;
+
+// PUBLISH and PUBREL records of a packet id replace each other, PUBREC records use their own packet id space
+typedef enum MQTT_SESSION_RECORD_TYPE_TAG
+{
+    MQTT_SESSION_RECORD_PUBLISH = 1,    // Outgoing QoS 1 or QoS 2 PUBLISH waiting for PUBACK or PUBREC, the data is the encoded packet
+    MQTT_SESSION_RECORD_PUBREL = 2,     // Outgoing QoS 2 publish waiting for PUBCOMP
+    MQTT_SESSION_RECORD_PUBREC = 3      // Incoming QoS 2 publish waiting for PUBREL
+} MQTT_SESSION_RECORD_TYPE;
+
+typedef void(*ON_SESSION_RECORD_LOADED)(void* context, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId, const uint8_t* data, size_t length);
+
+typedef CONCRETE_SESSION_STORE_HANDLE(*SESSION_STORE_CREATE)(const void* parameters);
+typedef void(*SESSION_STORE_DESTROY)(CONCRETE_SESSION_STORE_HANDLE concrete_store);
+typedef int(*SESSION_STORE_SAVE)(CONCRETE_SESSION_STORE_HANDLE concrete_store, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId, const uint8_t* data, size_t length);
+typedef int(*SESSION_STORE_REMOVE)(CONCRETE_SESSION_STORE_HANDLE concrete_store, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId);
+typedef int(*SESSION_STORE_LOAD)(CONCRETE_SESSION_STORE_HANDLE concrete_store, ON_SESSION_RECORD_LOADED onRecordLoaded, void* context);
+typedef int(*SESSION_STORE_CLEAR)(CONCRETE_SESSION_STORE_HANDLE concrete_store);
+
+typedef struct MQTT_SESSION_STORE_INTERFACE_DESCRIPTION_TAG
+{
+    SESSION_STORE_CREATE concrete_store_create;
+    SESSION_STORE_DESTROY concrete_store_destroy;
+    SESSION_STORE_SAVE concrete_store_save;
+    SESSION_STORE_REMOVE concrete_store_remove;
+    SESSION_STORE_LOAD concrete_store_load;
+    SESSION_STORE_CLEAR concrete_store_clear;
+} MQTT_SESSION_STORE_INTERFACE_DESCRIPTION;
+
+typedef struct MQTT_SESSION_STORE_FILE_OPTIONS_TAG
+{
+    const char* path;           // Created when missing, a file that is not a session store makes the create fail
+    size_t compactMinBytes;     // Stale bytes the log may carry before it is rewritten, 0 uses a 1 MB default
+    bool syncOnWrite;           // Flush every record to disk before returning instead of leaving it to the OS
+} MQTT_SESSION_STORE_FILE_OPTIONS;
+
+MOCKABLE_FUNCTION(, MQTT_SESSION_STORE_HANDLE, mqtt_session_store_create, const MQTT_SESSION_STORE_INTERFACE_DESCRIPTION*, interfaceDescription, const void*, parameters);
+MOCKABLE_FUNCTION(, void, mqtt_session_store_destroy, MQTT_SESSION_STORE_HANDLE, handle);
+
+/*
+*    @brief    Stores a record, replacing the record already stored for the same packet id.
+*    @param    data      Bytes to keep with the record, may be NULL when length is zero.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_session_store_save, MQTT_SESSION_STORE_HANDLE, handle, MQTT_SESSION_RECORD_TYPE, recordType, uint16_t, packetId, const uint8_t*, data, size_t, length);
+MOCKABLE_FUNCTION(, int, mqtt_session_store_remove, MQTT_SESSION_STORE_HANDLE, handle, MQTT_SESSION_RECORD_TYPE, recordType, uint16_t, packetId);
+
+/*
+*    @brief    Calls onRecordLoaded for every stored record, oldest first. The data is only valid during the call.
+*    @return   return    Zero if no failures occur, or non-zero otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_session_store_load, MQTT_SESSION_STORE_HANDLE, handle, ON_SESSION_RECORD_LOADED, onRecordLoaded, void*, context);
+MOCKABLE_FUNCTION(, int, mqtt_session_store_clear, MQTT_SESSION_STORE_HANDLE, handle);
+
+/*
+*    @brief    Store kept in process memory, it does not survive a restart. Takes no parameters.
+*/
+MOCKABLE_FUNCTION(, const MQTT_SESSION_STORE_INTERFACE_DESCRIPTION*, mqtt_session_store_memory_get_interface_description);
+
+/*
+*    @brief    Append only log in a memory mapped file, rewritten once stale records outweigh the live ones.
+*              Takes a MQTT_SESSION_STORE_FILE_OPTIONS. Returns NULL on platforms without mmap.
+*/
+MOCKABLE_FUNCTION(, const MQTT_SESSION_STORE_INTERFACE_DESCRIPTION*, mqtt_session_store_file_get_interface_description);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_SESSION_STORE_H
@@ -0,0 +1,47 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_SUBMIT_QUEUE_H
+#define MQTT_SUBMIT_QUEUE_H
+
+#include "azure_c_shared_utility/buffer_.h"
+#include "macro_utils/macro_utils.h"
+#include "umock_c/umock_c_prod.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+typedef struct MQTT_SUBMIT_QUEUE_TAG* MQTT_SUBMIT_QUEUE_HANDLE;
+
+/*
+*    @brief    Creates an empty queue that any number of threads push encoded packets into and one thread pops from.
+*    @return   return    The queue, or NULL if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_SUBMIT_QUEUE_HANDLE, mqtt_submit_queue_create);
+
+/*
+*    @brief    Frees the queue and every packet still in it. No thread may push or pop while or after it runs.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_submit_queue_destroy, MQTT_SUBMIT_QUEUE_HANDLE, handle);
+
+/*
+*    @brief    Appends an encoded packet without taking a lock, can be called from any thread.
+*    @param    packet    Encoded packet, owned by the queue on success.
+*    @return   return    Zero if the packet was queued, or non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_submit_queue_push, MQTT_SUBMIT_QUEUE_HANDLE, handle, BUFFER_HANDLE, packet);
+
+/*
+*    @brief    Removes the oldest packet. Must only be called from one thread at a time. Packets pushed by one thread
+*              come out in the order they were pushed, a push that is still in progress can hide the packets after it
+*              until it completes.
+*    @return   return    The packet, now owned by the caller, or NULL if no packet is ready.
+*/
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_submit_queue_pop, MQTT_SUBMIT_QUEUE_HANDLE, handle);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_SUBMIT_QUEUE_H
@@ -0,0 +1,87 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_TIMER_WHEEL_H
+#define MQTT_TIMER_WHEEL_H
+
+#include "azure_c_shared_utility/tickcounter.h"
+#include "macro_utils/macro_utils.h"
+#include "umock_c/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct MQTT_TIMER_WHEEL_TAG* MQTT_TIMER_WHEEL_HANDLE;
+
+typedef void(*ON_MQTT_TIMER_EXPIRED)(void* context);
+
+// Lives in the object it times, so scheduling never allocates. A zeroed timer is not scheduled, the
+// fields belong to the wheel while it is.
+typedef struct MQTT_TIMER_TAG
+{
+    struct MQTT_TIMER_TAG* next;
+    struct MQTT_TIMER_TAG* prev;
+    tickcounter_ms_t dueMs;
+    size_t slot;
+    ON_MQTT_TIMER_EXPIRED onExpired;
+    void* context;
+} MQTT_TIMER;
+
+/*
+*    @brief    Creates an empty hierarchical timer wheel. Scheduling and cancelling a timer take constant time whatever
+*              the number of timers, and timers expire to the millisecond. The wheel does not read a clock, its time
+*              only moves when it is advanced. Only one thread may use a wheel and its timers at a time.
+*    @param    currentMs    Current time of the wheel, usually read from a tick counter.
+*    @return   return    The wheel, or NULL if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_TIMER_WHEEL_HANDLE, mqtt_timer_wheel_create, tickcounter_ms_t, currentMs);
+
+/*
+*    @brief    Frees the wheel. Timers still scheduled on it are left unscheduled and are not called.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_timer_wheel_destroy, MQTT_TIMER_WHEEL_HANDLE, handle);
+
+/*
+*    @brief    Schedules timer to call onExpired once the wheel is advanced to dueMs, or moves it there if it is
+*              already scheduled. A timer that is already due expires on the next mqtt_timer_wheel_advance.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_timer_wheel_schedule, MQTT_TIMER_WHEEL_HANDLE, handle, MQTT_TIMER*, timer, tickcounter_ms_t, dueMs, ON_MQTT_TIMER_EXPIRED, onExpired, void*, context);
+
+/*
+*    @brief    Unschedules timer without calling it, a timer that is not scheduled is left as it is.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_timer_wheel_cancel, MQTT_TIMER_WHEEL_HANDLE, handle, MQTT_TIMER*, timer);
+
+/*
+*    @brief    Moves the time of the wheel to currentMs and calls the timers that are due by then, earliest first. The
+*              callbacks may schedule and cancel timers, but must not advance or destroy the wheel.
+*    @return   return    The number of timers that expired.
+*/
+MOCKABLE_FUNCTION(, size_t, mqtt_timer_wheel_advance, MQTT_TIMER_WHEEL_HANDLE, handle, tickcounter_ms_t, currentMs);
+
+/*
+*    @brief    Tells how long a caller can sleep before it has to advance the wheel. Timers more than 64 milliseconds
+*              away can make the wheel ask to be advanced before they are due, to move them closer.
+*    @return   return    Milliseconds from currentMs, 0 when the wheel has work now, or UINT32_MAX when no timer is
+*                        scheduled.
+*/
+MOCKABLE_FUNCTION(, uint32_t, mqtt_timer_wheel_get_timeout, MQTT_TIMER_WHEEL_HANDLE, handle, tickcounter_ms_t, currentMs);
+
+/*
+*    @brief    Returns the time the wheel was created with or last advanced to, which lets the code that owns the
+*              timers tell time without reading a clock.
+*/
+MOCKABLE_FUNCTION(, tickcounter_ms_t, mqtt_timer_wheel_get_current_ms, MQTT_TIMER_WHEEL_HANDLE, handle);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_TIMER_WHEEL_H
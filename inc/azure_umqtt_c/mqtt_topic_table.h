@@ -0,0 +1,69 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_TOPIC_TABLE_H
+#define MQTT_TOPIC_TABLE_H
+
+#include "macro_utils/macro_utils.h"
+#include "umock_c/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct MQTT_TOPIC_TABLE_TAG* MQTT_TOPIC_TABLE_HANDLE;
+typedef struct MQTT_TOPIC_TAG* MQTT_TOPIC_HANDLE;
+
+/*
+*    @brief    Creates an empty table of interned topic names.
+*    @return   return    The table, or NULL if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_TOPIC_TABLE_HANDLE, mqtt_topic_table_create);
+
+/*
+*    @brief    Frees the table and every topic interned in it. No topic handle or message using one may be used afterwards.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_topic_table_destroy, MQTT_TOPIC_TABLE_HANDLE, handle);
+
+/*
+*    @brief    Returns the topic stored for topicName, adding it the first time the name is seen. The topic keeps the
+*              name together with its length prefixed UTF-8 encoding and lives as long as the table.
+*    @param    topicName    Topic name to publish to, must not be empty, longer than 65535 bytes or contain wildcards.
+*    @return   return    The topic, or NULL if topicName is invalid or a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_TOPIC_HANDLE, mqtt_topic_table_intern, MQTT_TOPIC_TABLE_HANDLE, handle, const char*, topicName);
+MOCKABLE_FUNCTION(, size_t, mqtt_topic_table_count, MQTT_TOPIC_TABLE_HANDLE, handle);
+
+/*
+*    @brief    Returns the zero terminated name of topic and stores its length in nameLength, which can be NULL.
+*/
+MOCKABLE_FUNCTION(, const char*, mqtt_topic_get_name, MQTT_TOPIC_HANDLE, topic, size_t*, nameLength);
+
+/*
+*    @brief    Returns the name of topic as it is written in a PUBLISH packet, two length bytes followed by the name.
+*    @param    encodedLength    Receives the number of encoded bytes.
+*    @return   return    The encoded bytes, or NULL if topic or encodedLength is NULL.
+*/
+MOCKABLE_FUNCTION(, const uint8_t*, mqtt_topic_get_encoded, MQTT_TOPIC_HANDLE, topic, size_t*, encodedLength);
+
+/*
+*    @brief    The MQTT 5 topic alias the client set up for topic on the current connection, 0 for none.
+*/
+MOCKABLE_FUNCTION(, uint16_t, mqtt_topic_get_alias, MQTT_TOPIC_HANDLE, topic);
+MOCKABLE_FUNCTION(, int, mqtt_topic_set_alias, MQTT_TOPIC_HANDLE, topic, uint16_t, alias);
+
+/*
+*    @brief    Forgets the alias of every topic in the table, aliases only last as long as the connection they were sent on.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_topic_table_clear_aliases, MQTT_TOPIC_TABLE_HANDLE, handle);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_TOPIC_TABLE_H
@@ -0,0 +1,52 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_TOPIC_TRIE_H
+#define MQTT_TOPIC_TRIE_H
+
+#include "macro_utils/macro_utils.h"
+#include "umock_c/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+extern "C" {
+#else
+#include <stddef.h>
+#endif // __cplusplus
+
+typedef struct MQTT_TOPIC_TRIE_TAG* MQTT_TOPIC_TRIE_HANDLE;
+
+typedef void(*ON_MQTT_TOPIC_TRIE_VALUE_DESTROY)(void* value);
+typedef void(*ON_MQTT_TOPIC_TRIE_MATCH)(void* context, void* value);
+
+/*
+*    @brief    Creates an empty trie of MQTT topic filters.
+*    @param    valueDestroy    Called for every value the trie drops, replaces or still holds when destroyed, can be NULL.
+*    @return   return    The trie, or NULL if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_TOPIC_TRIE_HANDLE, mqtt_topic_trie_create, ON_MQTT_TOPIC_TRIE_VALUE_DESTROY, valueDestroy);
+MOCKABLE_FUNCTION(, void, mqtt_topic_trie_destroy, MQTT_TOPIC_TRIE_HANDLE, handle);
+
+/*
+*    @brief    Stores value under topicFilter, replacing the value stored before for the same filter.
+*    @param    topicFilter    Filter that may use + for one level and # as its last level.
+*    @return   return    Zero if value was stored and is owned by the trie, or non-zero if the filter is invalid or a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_topic_trie_insert, MQTT_TOPIC_TRIE_HANDLE, handle, const char*, topicFilter, void*, value);
+MOCKABLE_FUNCTION(, int, mqtt_topic_trie_remove, MQTT_TOPIC_TRIE_HANDLE, handle, const char*, topicFilter);
+
+/*
+*    @brief    Calls onMatch with the value of every filter matching topicName. The cost depends on the number of
+*              levels in topicName, not on the number of filters. The trie must not be changed from onMatch.
+*    @param    topicName      Topic of a received PUBLISH, does not have to be zero terminated.
+*    @param    topicLength    Number of characters in topicName.
+*    @return   return    The number of matching filters.
+*/
+MOCKABLE_FUNCTION(, size_t, mqtt_topic_trie_match, MQTT_TOPIC_TRIE_HANDLE, handle, const char*, topicName, size_t, topicLength, ON_MQTT_TOPIC_TRIE_MATCH, onMatch, void*, context);
+MOCKABLE_FUNCTION(, size_t, mqtt_topic_trie_count, MQTT_TOPIC_TRIE_HANDLE, handle);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_TOPIC_TRIE_H
@@ -0,0 +1,88 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_TRACE_RING_H
+#define MQTT_TRACE_RING_H
+
+#include "macro_utils/macro_utils.h"
+#include "umock_c/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+extern "C" {
+#else
+#include <stddef.h>
+#include <stdint.h>
+#endif // __cplusplus
+
+typedef struct MQTT_TRACE_RING_TAG* MQTT_TRACE_RING_HANDLE;
+
+#define MQTT_TRACE_DIRECTION_VALUES \
+    MQTT_TRACE_OUTGOING,            \
+    MQTT_TRACE_INCOMING
+
+MU_DEFINE_ENUM(MQTT_TRACE_DIRECTION, MQTT_TRACE_DIRECTION_VALUES);
+
+// One packet sent or received. packetId is 0 for packets without one, topicHash is the 32 bit FNV-1a hash
+// of the topic name of a PUBLISH and 0 for other packets or a PUBLISH that only carries a topic alias.
+typedef struct MQTT_TRACE_RECORD_TAG
+{
+    uint64_t timestampMs;       // Tick counter of the client that recorded the packet
+    uint32_t topicHash;
+    uint32_t length;            // Whole packet, fixed header included
+    uint16_t packetId;
+    uint8_t packetType;         // CONTROL_PACKET_TYPE, the high 4 bits of the first byte
+    uint8_t flags;              // The low 4 bits of the first byte
+    uint8_t direction;          // MQTT_TRACE_DIRECTION
+} MQTT_TRACE_RECORD;
+
+/*
+*    @brief    Creates a ring that keeps the most recent packet records, for one client or shared by many.
+*    @param    capacity    Number of records kept, rounded up to a power of two.
+*    @return   return    The ring, or NULL if capacity is 0 or a failure occurred.
+*/
+MOCKABLE_FUNCTION(, MQTT_TRACE_RING_HANDLE, mqtt_trace_ring_create, size_t, capacity);
+
+/*
+*    @brief    Frees the ring. No thread may record into or read from it while or after it runs.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_trace_ring_destroy, MQTT_TRACE_RING_HANDLE, handle);
+
+/*
+*    @brief    Copies record over the oldest one without taking a lock or allocating, can be called from any thread.
+*              A record that meets another thread still writing the same slot is dropped and counted instead.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_trace_ring_record, MQTT_TRACE_RING_HANDLE, handle, const MQTT_TRACE_RECORD*, record);
+
+/*
+*    @brief    Copies the most recent records, oldest first, while threads keep recording. Records being written
+*              are skipped.
+*    @param    records    Receives up to count records.
+*    @return   return    The number of records copied.
+*/
+MOCKABLE_FUNCTION(, size_t, mqtt_trace_ring_read, MQTT_TRACE_RING_HANDLE, handle, MQTT_TRACE_RECORD*, records, size_t, count);
+
+/*
+*    @brief    Returns the number of records dropped because their slot was being written.
+*/
+MOCKABLE_FUNCTION(, uint64_t, mqtt_trace_ring_get_dropped, MQTT_TRACE_RING_HANDLE, handle);
+
+/*
+*    @brief    Writes the records the ring holds, oldest first, to a file mqtt_trace_ring_load reads on any platform.
+*    @return   return    0 on success, non-zero if a failure occurred.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_trace_ring_save, MQTT_TRACE_RING_HANDLE, handle, const char*, path);
+
+/*
+*    @brief    Creates a ring holding the records of a file written by mqtt_trace_ring_save, to be read back with
+*              mqtt_trace_ring_read.
+*    @return   return    The ring, or NULL if the file cannot be read or is not a trace file.
+*/
+MOCKABLE_FUNCTION(, MQTT_TRACE_RING_HANDLE, mqtt_trace_ring_load, const char*, path);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_TRACE_RING_H
@@ -86,6 +86,43 @@ typedef struct APP_PAYLOAD_TAG
     size_t length;
 } APP_PAYLOAD;
 
+typedef enum MQTT_PROTOCOL_VERSION_TAG
+{
+    MQTT_PROTOCOL_V3_1_1 = 0x04,
+    MQTT_PROTOCOL_V5 = 0x05
+} MQTT_PROTOCOL_VERSION;
+
+typedef enum MQTT_PROPERTY_ID_TAG
+{
+    MQTT_PROPERTY_PAYLOAD_FORMAT_INDICATOR = 0x01,
+    MQTT_PROPERTY_MESSAGE_EXPIRY_INTERVAL = 0x02,
+    MQTT_PROPERTY_CONTENT_TYPE = 0x03,
+    MQTT_PROPERTY_RESPONSE_TOPIC = 0x08,
+    MQTT_PROPERTY_CORRELATION_DATA = 0x09,
+    MQTT_PROPERTY_SUBSCRIPTION_IDENTIFIER = 0x0B,
+    MQTT_PROPERTY_SESSION_EXPIRY_INTERVAL = 0x11,
+    MQTT_PROPERTY_ASSIGNED_CLIENT_IDENTIFIER = 0x12,
+    MQTT_PROPERTY_SERVER_KEEP_ALIVE = 0x13,
+    MQTT_PROPERTY_AUTHENTICATION_METHOD = 0x15,
+    MQTT_PROPERTY_AUTHENTICATION_DATA = 0x16,
+    MQTT_PROPERTY_REQUEST_PROBLEM_INFORMATION = 0x17,
+    MQTT_PROPERTY_WILL_DELAY_INTERVAL = 0x18,
+    MQTT_PROPERTY_REQUEST_RESPONSE_INFORMATION = 0x19,
+    MQTT_PROPERTY_RESPONSE_INFORMATION = 0x1A,
+    MQTT_PROPERTY_SERVER_REFERENCE = 0x1C,
+    MQTT_PROPERTY_REASON_STRING = 0x1F,
+    MQTT_PROPERTY_RECEIVE_MAXIMUM = 0x21,
+    MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM = 0x22,
+    MQTT_PROPERTY_TOPIC_ALIAS = 0x23,
+    MQTT_PROPERTY_MAXIMUM_QOS = 0x24,
+    MQTT_PROPERTY_RETAIN_AVAILABLE = 0x25,
+    MQTT_PROPERTY_USER_PROPERTY = 0x26,
+    MQTT_PROPERTY_MAXIMUM_PACKET_SIZE = 0x27,
+    MQTT_PROPERTY_WILDCARD_SUBSCRIPTION_AVAILABLE = 0x28,
+    MQTT_PROPERTY_SUBSCRIPTION_IDENTIFIER_AVAILABLE = 0x29,
+    MQTT_PROPERTY_SHARED_SUBSCRIPTION_AVAILABLE = 0x2A
+} MQTT_PROPERTY_ID;
+
 typedef struct MQTT_CLIENT_OPTIONS_TAG
 {
     char* clientId;
@@ -98,6 +135,12 @@ typedef struct MQTT_CLIENT_OPTIONS_TAG
     bool useCleanSession;
     QOS_VALUE qualityOfServiceValue;
     bool log_trace;
+    // MQTT_PROTOCOL_V5 connects with MQTT 5, any other value with MQTT 3.1.1.
+    // The fields below are only sent with MQTT 5, zero leaves them out.
+    MQTT_PROTOCOL_VERSION protocolVersion;
+    uint32_t sessionExpiryInterval;
+    uint16_t receiveMaximum;
+    uint32_t maximumPacketSize;
 } MQTT_CLIENT_OPTIONS;
 
 typedef enum CONNECT_RETURN_CODE_TAG
@@ -115,6 +158,18 @@ typedef struct CONNECT_ACK_TAG
 {
     bool isSessionPresent;
     CONNECT_RETURN_CODE returnCode;
+    // MQTT 5 only, zero for MQTT 3.1.1. Limits the server did not send hold the
+    // values the specification defaults them to.
+    uint8_t reasonCode;
+    uint32_t sessionExpiryInterval;
+    uint16_t receiveMaximum;
+    uint32_t maximumPacketSize;
+    uint16_t topicAliasMaximum;
+    uint16_t serverKeepAlive;
+    QOS_VALUE maximumQos;
+    bool retainAvailable;
+    bool wildcardSubscriptionAvailable;
+    bool sharedSubscriptionAvailable;
 } CONNECT_ACK;
 
 typedef struct SUBSCRIBE_PAYLOAD_TAG
@@ -128,16 +183,23 @@ typedef struct SUBSCRIBE_ACK_TAG
     uint16_t packetId;
     QOS_VALUE* qosReturn;
     size_t qosCount;
+    // Return code of each topic as received, the MQTT 5 reason code or the MQTT 3.1.1 granted QoS
+    const uint8_t* reasonCodes;
 } SUBSCRIBE_ACK;
 
 typedef struct UNSUBSCRIBE_ACK_TAG
 {
     uint16_t packetId;
+    // MQTT 5 only, the reason code of each topic
+    const uint8_t* reasonCodes;
+    size_t reasonCodeCount;
 } UNSUBSCRIBE_ACK;
 
 typedef struct PUBLISH_ACK_TAG
 {
     uint16_t packetId;
+    // MQTT 5 only, zero (success) when the server left it out
+    uint8_t reasonCode;
 } PUBLISH_ACK;
 
 #ifdef __cplusplus
@@ -0,0 +1,442 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Replays the packets a client received, from a capture written through mqtt_client_set_capture, to reproduce
+// its traffic locally and profile how much parsing and dispatching it costs, without a broker:
+//     mqtt_capture_replay <capture file> [-paced] [-repeat <count>]
+//
+// The received packets are loaded into memory first. They are fed through mqtt_codec_bytesReceived on its own,
+// which is the parse cost, and then through a client connected to a replay xio, which adds the dispatch to the
+// client and its callbacks. The packets the client sent are not replayed, the client sends its own packets to
+// the replay xio, which drops them. With -paced the client gets every packet at the time it was received,
+// relative to the first one, instead of as fast as it can take them.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "azure_c_shared_utility/xio.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_codec.h"
+#include "azure_umqtt_c/mqtt_capture.h"
+
+#define PACKET_TYPE_COUNT           16
+#define CONNECT_PROTOCOL_LEVEL      6   // Offset of the protocol level after the fixed header of a CONNECT
+
+typedef struct REPLAY_PACKET_TAG
+{
+    uint64_t timestampMs;
+    uint8_t* data;
+    size_t length;
+} REPLAY_PACKET;
+
+typedef struct REPLAY_CAPTURE_TAG
+{
+    REPLAY_PACKET* packets;
+    size_t count;
+    size_t capacity;
+    size_t bytes;
+    size_t sentCount;
+    MQTT_PROTOCOL_VERSION protocolVersion;
+} REPLAY_CAPTURE;
+
+typedef struct REPLAY_IO_TAG
+{
+    ON_BYTES_RECEIVED on_bytes_received;
+    void* on_bytes_received_context;
+    size_t sends;
+} REPLAY_IO;
+
+typedef struct REPLAY_COUNTS_TAG
+{
+    size_t packets[PACKET_TYPE_COUNT];
+    size_t messages;
+    size_t operations;
+    size_t errors;
+} REPLAY_COUNTS;
+
+static REPLAY_IO g_replay_io;
+static REPLAY_COUNTS g_client_counts;
+
+static CONCRETE_IO_HANDLE replay_io_create(void* io_create_parameters)
+{
+    (void)io_create_parameters;
+    memset(&g_replay_io, 0, sizeof(g_replay_io));
+    return &g_replay_io;
+}
+
+static void replay_io_destroy(CONCRETE_IO_HANDLE concrete_io)
+{
+    (void)concrete_io;
+}
+
+static int replay_io_open(CONCRETE_IO_HANDLE concrete_io, ON_IO_OPEN_COMPLETE on_io_open_complete, void* on_io_open_complete_context, ON_BYTES_RECEIVED on_bytes_received, void* on_bytes_received_context, ON_IO_ERROR on_io_error, void* on_io_error_context)
+{
+    REPLAY_IO* replay_io = (REPLAY_IO*)concrete_io;
+    (void)on_io_error;
+    (void)on_io_error_context;
+    replay_io->on_bytes_received = on_bytes_received;
+    replay_io->on_bytes_received_context = on_bytes_received_context;
+    on_io_open_complete(on_io_open_complete_context, IO_OPEN_OK);
+    return 0;
+}
+
+static int replay_io_close(CONCRETE_IO_HANDLE concrete_io, ON_IO_CLOSE_COMPLETE on_io_close_complete, void* callback_context)
+{
+    (void)concrete_io;
+    if (on_io_close_complete != NULL)
+    {
+        on_io_close_complete(callback_context);
+    }
+    return 0;
+}
+
+static int replay_io_send(CONCRETE_IO_HANDLE concrete_io, const void* buffer, size_t size, ON_SEND_COMPLETE on_send_complete, void* callback_context)
+{
+    REPLAY_IO* replay_io = (REPLAY_IO*)concrete_io;
+    (void)buffer;
+    (void)size;
+    replay_io->sends++;
+    if (on_send_complete != NULL)
+    {
+        on_send_complete(callback_context, IO_SEND_OK);
+    }
+    return 0;
+}
+
+static void replay_io_dowork(CONCRETE_IO_HANDLE concrete_io)
+{
+    (void)concrete_io;
+}
+
+static int replay_io_setoption(CONCRETE_IO_HANDLE concrete_io, const char* optionName, const void* value)
+{
+    (void)concrete_io;
+    (void)optionName;
+    (void)value;
+    return 0;
+}
+
+static const IO_INTERFACE_DESCRIPTION replay_io_interface =
+{
+    NULL,
+    replay_io_create,
+    replay_io_destroy,
+    replay_io_open,
+    replay_io_close,
+    replay_io_send,
+    replay_io_dowork,
+    replay_io_setoption
+};
+
+static MQTT_CLIENT_ACK_OPTION on_message_recv(MQTT_MESSAGE_HANDLE msgHandle, void* context)
+{
+    (void)msgHandle;
+    (void)context;
+    g_client_counts.messages++;
+    return MQTT_CLIENT_ACK_SYNC;
+}
+
+static void on_operation_complete(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx)
+{
+    (void)handle;
+    (void)actionResult;
+    (void)msgInfo;
+    (void)callbackCtx;
+    g_client_counts.operations++;
+}
+
+static void on_error(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+{
+    (void)handle;
+    (void)error;
+    (void)callbackCtx;
+    g_client_counts.errors++;
+}
+
+static void on_packet_view(void* context, CONTROL_PACKET_TYPE packet, int flags, const uint8_t* packetData, size_t packetLength)
+{
+    REPLAY_COUNTS* counts = (REPLAY_COUNTS*)context;
+    (void)flags;
+    (void)packetData;
+    (void)packetLength;
+    counts->packets[((unsigned int)packet >> 4) & (PACKET_TYPE_COUNT - 1)]++;
+}
+
+static void free_capture(REPLAY_CAPTURE* capture)
+{
+    size_t index;
+    for (index = 0; index < capture->count; index++)
+    {
+        free(capture->packets[index].data);
+    }
+    free(capture->packets);
+}
+
+// The CONNECT the client sent tells which protocol version the received packets are in
+static void check_sent_packet(REPLAY_CAPTURE* capture, const MQTT_CAPTURE_PACKET* packet)
+{
+    capture->sentCount++;
+    if (packet->length > 0 && (packet->data[0] & 0xF0) == CONNECT_TYPE)
+    {
+        size_t headerLength = 2;
+        while (headerLength < 5 && headerLength < packet->length && (packet->data[headerLength - 1] & 0x80) != 0)
+        {
+            headerLength++;
+        }
+        if (headerLength + CONNECT_PROTOCOL_LEVEL < packet->length)
+        {
+            capture->protocolVersion = (packet->data[headerLength + CONNECT_PROTOCOL_LEVEL] == MQTT_PROTOCOL_V5) ? MQTT_PROTOCOL_V5 : MQTT_PROTOCOL_V3_1_1;
+        }
+    }
+}
+
+static int load_capture(const char* path, REPLAY_CAPTURE* capture)
+{
+    int result = 0;
+    MQTT_CAPTURE_READER_HANDLE reader = mqtt_capture_reader_open(path);
+    memset(capture, 0, sizeof(REPLAY_CAPTURE));
+    capture->protocolVersion = MQTT_PROTOCOL_V3_1_1;
+    if (reader == NULL)
+    {
+        (void)printf("%s is not a capture file\n", path);
+        result = __LINE__;
+    }
+    else
+    {
+        MQTT_CAPTURE_PACKET packet;
+        MQTT_CAPTURE_READ_RESULT readResult;
+        while (result == 0 && (readResult = mqtt_capture_reader_next(reader, &packet)) == MQTT_CAPTURE_READ_OK)
+        {
+            if (packet.direction == MQTT_TRACE_OUTGOING)
+            {
+                check_sent_packet(capture, &packet);
+            }
+            else
+            {
+                if (capture->count == capture->capacity)
+                {
+                    size_t capacity = (capture->capacity == 0) ? 1024 : capture->capacity * 2;
+                    REPLAY_PACKET* packets = (REPLAY_PACKET*)realloc(capture->packets, capacity * sizeof(REPLAY_PACKET));
+                    if (packets == NULL)
+                    {
+                        result = __LINE__;
+                        break;
+                    }
+                    capture->packets = packets;
+                    capture->capacity = capacity;
+                }
+                if ((capture->packets[capture->count].data = (uint8_t*)malloc(packet.length + 1)) == NULL)
+                {
+                    result = __LINE__;
+                }
+                else
+                {
+                    (void)memcpy(capture->packets[capture->count].data, packet.data, packet.length);
+                    capture->packets[capture->count].length = packet.length;
+                    capture->packets[capture->count].timestampMs = packet.timestampMs;
+                    capture->bytes += packet.length;
+                    capture->count++;
+                }
+            }
+        }
+        if (result != 0 || readResult != MQTT_CAPTURE_READ_END)
+        {
+            (void)printf("Failure reading %s after %lu packets\n", path, (unsigned long)(capture->count + capture->sentCount));
+            result = (result != 0) ? result : __LINE__;
+        }
+        mqtt_capture_reader_close(reader);
+    }
+    return result;
+}
+
+static int replay_codec(const REPLAY_CAPTURE* capture, size_t repeat, REPLAY_COUNTS* counts, double* elapsed)
+{
+    int result = 0;
+    MQTTCODEC_HANDLE codec = mqtt_codec_create_with_view(on_packet_view, counts);
+    if (codec == NULL)
+    {
+        (void)printf("Failed creating the codec\n");
+        result = __LINE__;
+    }
+    else
+    {
+        size_t pass;
+        clock_t start = clock();
+        for (pass = 0; pass < repeat && result == 0; pass++)
+        {
+            size_t index;
+            for (index = 0; index < capture->count; index++)
+            {
+                if (mqtt_codec_bytesReceived(codec, capture->packets[index].data, capture->packets[index].length) != 0)
+                {
+                    (void)printf("Codec failed parsing packet %lu\n", (unsigned long)index);
+                    result = __LINE__;
+                    break;
+                }
+            }
+        }
+        *elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        mqtt_codec_destroy(codec);
+    }
+    return result;
+}
+
+static void wait_for_packet(TICK_COUNTER_HANDLE tickCounter, tickcounter_ms_t startMs, uint64_t offsetMs)
+{
+    tickcounter_ms_t nowMs;
+    if (tickcounter_get_current_ms(tickCounter, &nowMs) == 0 && nowMs - startMs < offsetMs)
+    {
+        ThreadAPI_Sleep((unsigned int)(offsetMs - (nowMs - startMs)));
+    }
+}
+
+static int replay_client(const REPLAY_CAPTURE* capture, bool paced, double* elapsed, size_t* sends)
+{
+    int result = 0;
+    XIO_HANDLE xio = xio_create(&replay_io_interface, NULL);
+    MQTT_CLIENT_HANDLE client = mqtt_client_init(on_message_recv, on_operation_complete, NULL, on_error, NULL);
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    MQTT_CLIENT_OPTIONS options;
+
+    memset(&options, 0, sizeof(options));
+    options.clientId = "replay";
+    options.keepAliveInterval = 240;
+    options.useCleanSession = true;
+    options.protocolVersion = capture->protocolVersion;
+
+    if (xio == NULL || client == NULL || tickCounter == NULL || mqtt_client_connect(client, xio, &options) != 0)
+    {
+        (void)printf("Failed connecting the client\n");
+        result = __LINE__;
+    }
+    else
+    {
+        size_t index;
+        tickcounter_ms_t startMs = 0;
+        clock_t start;
+        *elapsed = 0.0;
+        g_replay_io.sends = 0;
+        (void)tickcounter_get_current_ms(tickCounter, &startMs);
+        start = clock();
+        for (index = 0; index < capture->count; index++)
+        {
+            if (paced)
+            {
+                // Only the time spent in the client counts, not the wait for the next packet
+                *elapsed += (double)(clock() - start) / CLOCKS_PER_SEC;
+                mqtt_client_dowork(client);
+                wait_for_packet(tickCounter, startMs, capture->packets[index].timestampMs - capture->packets[0].timestampMs);
+                start = clock();
+            }
+            g_replay_io.on_bytes_received(g_replay_io.on_bytes_received_context, capture->packets[index].data, capture->packets[index].length);
+        }
+        mqtt_client_dowork(client);
+        *elapsed += (double)(clock() - start) / CLOCKS_PER_SEC;
+        *sends += g_replay_io.sends;
+    }
+    mqtt_client_deinit(client);
+    xio_destroy(xio);
+    tickcounter_destroy(tickCounter);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int result = 0;
+    const char* path = NULL;
+    bool paced = false;
+    size_t repeat = 1;
+    int argIndex;
+    REPLAY_CAPTURE capture;
+
+    for (argIndex = 1; argIndex < argc && result == 0; argIndex++)
+    {
+        if (strcmp(argv[argIndex], "-paced") == 0)
+        {
+            paced = true;
+        }
+        else if (strcmp(argv[argIndex], "-repeat") == 0 && argIndex + 1 < argc && atoi(argv[argIndex + 1]) > 0)
+        {
+            repeat = (size_t)atoi(argv[++argIndex]);
+        }
+        else if (path == NULL && argv[argIndex][0] != '-')
+        {
+            path = argv[argIndex];
+        }
+        else
+        {
+            result = __LINE__;
+        }
+    }
+
+    if (result != 0 || path == NULL)
+    {
+        (void)printf("Usage: %s <capture file> [-paced] [-repeat <count>]\n", argv[0]);
+        result = 1;
+    }
+    else if (load_capture(path, &capture) != 0)
+    {
+        result = 1;
+    }
+    else
+    {
+        REPLAY_COUNTS codecCounts;
+        double codecTime = 0.0;
+        double clientTime = 0.0;
+        size_t clientSends = 0;
+        size_t pass;
+        size_t type;
+        double replayed = (double)capture.count * repeat;
+
+        memset(&codecCounts, 0, sizeof(codecCounts));
+        memset(&g_client_counts, 0, sizeof(g_client_counts));
+        (void)printf("%lu received packets, %lu bytes, %lu sent packets not replayed, MQTT %s\n", (unsigned long)capture.count,
+            (unsigned long)capture.bytes, (unsigned long)capture.sentCount, (capture.protocolVersion == MQTT_PROTOCOL_V5) ? "5" : "3.1.1");
+
+        if (capture.count == 0)
+        {
+            result = 0;
+        }
+        else if (replay_codec(&capture, repeat, &codecCounts, &codecTime) != 0)
+        {
+            result = 1;
+        }
+        else
+        {
+            for (pass = 0; pass < repeat && result == 0; pass++)
+            {
+                double passTime = 0.0;
+                if (replay_client(&capture, paced, &passTime, &clientSends) != 0)
+                {
+                    result = 1;
+                }
+                clientTime += passTime;
+            }
+
+            (void)printf("\n%-14s %10s\n", "packet", "received");
+            for (type = 0; type < PACKET_TYPE_COUNT; type++)
+            {
+                if (codecCounts.packets[type] != 0)
+                {
+                    (void)printf("%-14s %10lu\n", MU_ENUM_TO_STRING(CONTROL_PACKET_TYPE, (CONTROL_PACKET_TYPE)(type << 4)), (unsigned long)(codecCounts.packets[type] / repeat));
+                }
+            }
+
+            (void)printf("\n%-10s %8s %12s %10s\n", "pass", "repeats", "ns/packet", "MB/s");
+            (void)printf("%-10s %8lu %12.1f %10.1f\n", "codec", (unsigned long)repeat, codecTime * 1e9 / replayed,
+                (codecTime > 0.0) ? (double)capture.bytes * repeat / codecTime / 1e6 : 0.0);
+            (void)printf("%-10s %8lu %12.1f %10.1f\n", "client", (unsigned long)repeat, clientTime * 1e9 / replayed,
+                (clientTime > 0.0) ? (double)capture.bytes * repeat / clientTime / 1e6 : 0.0);
+            (void)printf("%-10s %8s %12.1f\n", "dispatch", "", (clientTime - codecTime) * 1e9 / replayed);
+            (void)printf("\nclient: %lu messages, %lu operation callbacks, %lu errors, %lu xio_send calls\n",
+                (unsigned long)(g_client_counts.messages / repeat), (unsigned long)(g_client_counts.operations / repeat),
+                (unsigned long)(g_client_counts.errors / repeat), (unsigned long)(clientSends / repeat));
+        }
+        free_capture(&capture);
+    }
+    return result;
+}
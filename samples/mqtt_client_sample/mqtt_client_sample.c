@@ -10,6 +10,9 @@
 #include "azure_umqtt_c/mqtt_client.h"
 #include "azure_c_shared_utility/socketio.h"
 #include "azure_c_shared_utility/platform.h"
+#ifdef __linux__
+#include "azure_umqtt_c/mqtt_client_run.h"
+#endif
 
 static const char* TOPIC_NAME_A = "msgA";
 static const char* TOPIC_NAME_B = "msgB";
@@ -25,6 +28,9 @@ static bool g_close_complete = true;
 
 #define DEFAULT_MSG_TO_SEND         1
 
+// socketio does not expose its socket, so the run loop looks for input this often and sleeps in between
+#define SAMPLE_POLL_INTERVAL_MS     10
+
 static const char* QosToString(QOS_VALUE qosValue)
 {
     return MU_ENUM_TO_STRING(QOS_VALUE, qosValue);
@@ -153,6 +159,49 @@ static void OnErrorComplete(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR e
     }
 }
 
+#ifdef __linux__
+typedef MQTT_CLIENT_RUN_HANDLE SAMPLE_RUN_HANDLE;
+
+static SAMPLE_RUN_HANDLE CreateRunLoop(MQTT_CLIENT_HANDLE mqttHandle)
+{
+    MQTT_CLIENT_RUN_OPTIONS runOptions = { NULL, NULL, SAMPLE_POLL_INTERVAL_MS };
+    return mqtt_client_run_create(mqttHandle, &runOptions);
+}
+
+// Sleeps until the client has work instead of spinning on mqtt_client_dowork
+static void DoWork(MQTT_CLIENT_HANDLE mqttHandle, SAMPLE_RUN_HANDLE run)
+{
+    if (run == NULL || mqtt_client_run_once(run) != 0)
+    {
+        mqtt_client_dowork(mqttHandle);
+    }
+}
+
+static void DestroyRunLoop(SAMPLE_RUN_HANDLE run)
+{
+    mqtt_client_run_destroy(run);
+}
+#else
+typedef void* SAMPLE_RUN_HANDLE;
+
+static SAMPLE_RUN_HANDLE CreateRunLoop(MQTT_CLIENT_HANDLE mqttHandle)
+{
+    (void)mqttHandle;
+    return NULL;
+}
+
+static void DoWork(MQTT_CLIENT_HANDLE mqttHandle, SAMPLE_RUN_HANDLE run)
+{
+    (void)run;
+    mqtt_client_dowork(mqttHandle);
+}
+
+static void DestroyRunLoop(SAMPLE_RUN_HANDLE run)
+{
+    (void)run;
+}
+#endif
+
 void mqtt_client_sample_run()
 {
     if (platform_init() != 0)
@@ -188,6 +237,7 @@ void mqtt_client_sample_run()
             }
             else
             {
+                SAMPLE_RUN_HANDLE run = CreateRunLoop(mqttHandle);
                 if (mqtt_client_connect(mqttHandle, xio, &options) != 0)
                 {
                     (void)printf("mqtt_client_connect failed\r\n");
@@ -196,7 +246,7 @@ void mqtt_client_sample_run()
                 {
                     do
                     {
-                        mqtt_client_dowork(mqttHandle);
+                        DoWork(mqttHandle, run);
                     } while (g_continue);
                 }
                 xio_close(xio, OnCloseComplete, NULL);
@@ -204,8 +254,9 @@ void mqtt_client_sample_run()
                 // Wait for the close connection gets called
                 do
                 {
-                    mqtt_client_dowork(mqttHandle);
+                    DoWork(mqttHandle, run);
                 } while (g_close_complete);
+                DestroyRunLoop(run);
                 xio_destroy(xio);
             }
             mqtt_client_deinit(mqttHandle);
@@ -0,0 +1,104 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Prints a trace file written by mqtt_trace_ring_save, one packet per line:
+//     mqtt_trace_decode <trace file>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "azure_umqtt_c/mqttconst.h"
+#include "azure_umqtt_c/mqtt_trace_ring.h"
+
+#define INITIAL_RECORD_COUNT        1024
+
+// The loaded ring does not change, so reading as many records as fit until fewer come back gets all of them
+static MQTT_TRACE_RECORD* read_all_records(MQTT_TRACE_RING_HANDLE ring, size_t* count)
+{
+    MQTT_TRACE_RECORD* result = NULL;
+    size_t capacity = INITIAL_RECORD_COUNT;
+    for (;;)
+    {
+        MQTT_TRACE_RECORD* records = (MQTT_TRACE_RECORD*)realloc(result, capacity * sizeof(MQTT_TRACE_RECORD));
+        if (records == NULL)
+        {
+            free(result);
+            result = NULL;
+            break;
+        }
+        result = records;
+        *count = mqtt_trace_ring_read(ring, result, capacity);
+        if (*count < capacity)
+        {
+            break;
+        }
+        capacity *= 2;
+    }
+    return result;
+}
+
+static void print_record(const MQTT_TRACE_RECORD* record, uint64_t startMs)
+{
+    uint64_t elapsedMs = record->timestampMs - startMs;
+    (void)printf("%8" PRIu64 ".%03u %s %-16s", elapsedMs / 1000, (unsigned int)(elapsedMs % 1000),
+        (record->direction == MQTT_TRACE_OUTGOING) ? "-->" : "<--", MU_ENUM_TO_STRING(CONTROL_PACKET_TYPE, (CONTROL_PACKET_TYPE)record->packetType));
+    if (record->packetType == PUBLISH_TYPE)
+    {
+        (void)printf(" qos=%u dup=%u retain=%u", (unsigned int)((record->flags >> 1) & 0x3), (unsigned int)((record->flags >> 3) & 0x1), (unsigned int)(record->flags & 0x1));
+    }
+    else if (record->flags != 0)
+    {
+        (void)printf(" flags=0x%x", (unsigned int)record->flags);
+    }
+    if (record->packetId != 0)
+    {
+        (void)printf(" id=%u", (unsigned int)record->packetId);
+    }
+    (void)printf(" len=%" PRIu32, record->length);
+    if (record->topicHash != 0)
+    {
+        (void)printf(" topic=%08" PRIx32, record->topicHash);
+    }
+    (void)printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    int result;
+    MQTT_TRACE_RING_HANDLE ring;
+    if (argc != 2)
+    {
+        (void)printf("Usage: %s <trace file>\n", argv[0]);
+        result = 1;
+    }
+    else if ((ring = mqtt_trace_ring_load(argv[1])) == NULL)
+    {
+        (void)printf("%s is not a trace file\n", argv[1]);
+        result = 1;
+    }
+    else
+    {
+        size_t count = 0;
+        MQTT_TRACE_RECORD* records = read_all_records(ring, &count);
+        if (records == NULL)
+        {
+            (void)printf("Failure reading %s\n", argv[1]);
+            result = 1;
+        }
+        else
+        {
+            size_t index;
+            // Times are the tick counter of the client, printed as seconds since the first record
+            for (index = 0; index < count; index++)
+            {
+                print_record(&records[index], records[0].timestampMs);
+            }
+            (void)printf("%lu packets, %" PRIu64 " dropped\n", (unsigned long)count, mqtt_trace_ring_get_dropped(ring));
+            free(records);
+            result = 0;
+        }
+        mqtt_trace_ring_destroy(ring);
+    }
+    return result;
+}
@@ -0,0 +1,354 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_capture.h"
+
+// Capture file: an 8 byte magic, then every packet as timestampMs uint64, length uint32, direction uint8 and
+// 3 reserved bytes, followed by the length bytes of the packet. Every number is little endian.
+#define CAPTURE_FILE_MAGIC          "MQTTCAP1"
+#define CAPTURE_FILE_MAGIC_SIZE     8
+#define CAPTURE_FRAME_HEADER_SIZE   16
+// Largest remaining length of an MQTT packet and the longest fixed header
+#define CAPTURE_MAX_PACKET_SIZE     (268435455 + 5)
+
+typedef struct MQTT_CAPTURE_TAG
+{
+    FILE* file;
+    size_t pending;
+    bool failed;
+} MQTT_CAPTURE;
+
+typedef struct MQTT_CAPTURE_READER_TAG
+{
+    FILE* file;
+    uint8_t* buffer;
+    size_t bufferSize;
+} MQTT_CAPTURE_READER;
+
+static void write_uint32(uint8_t* target, uint32_t value)
+{
+    target[0] = (uint8_t)value;
+    target[1] = (uint8_t)(value >> 8);
+    target[2] = (uint8_t)(value >> 16);
+    target[3] = (uint8_t)(value >> 24);
+}
+
+static void write_uint64(uint8_t* target, uint64_t value)
+{
+    write_uint32(target, (uint32_t)value);
+    write_uint32(target + 4, (uint32_t)(value >> 32));
+}
+
+static uint32_t read_uint32(const uint8_t* source)
+{
+    return (uint32_t)source[0] | ((uint32_t)source[1] << 8) | ((uint32_t)source[2] << 16) | ((uint32_t)source[3] << 24);
+}
+
+static uint64_t read_uint64(const uint8_t* source)
+{
+    return (uint64_t)read_uint32(source) | ((uint64_t)read_uint32(source + 4) << 32);
+}
+
+static int write_bytes(MQTT_CAPTURE* capture, const void* data, size_t length)
+{
+    int result;
+    if (capture->failed || (length > 0 && fwrite(data, 1, length, capture->file) != length))
+    {
+        // A short write leaves the framing broken, nothing written after it could be read back
+        capture->failed = true;
+        result = MU_FAILURE;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+// Keeps the framing of a packet that was not appended in full
+static int fill_pending(MQTT_CAPTURE* capture)
+{
+    static const uint8_t zeros[64] = { 0 };
+    int result = 0;
+    if (capture->pending > 0)
+    {
+        LogError("Capture packet cut short by %lu bytes", (unsigned long)capture->pending);
+        while (capture->pending > 0 && result == 0)
+        {
+            size_t length = (capture->pending < sizeof(zeros)) ? capture->pending : sizeof(zeros);
+            result = write_bytes(capture, zeros, length);
+            capture->pending -= length;
+        }
+    }
+    return result;
+}
+
+MQTT_CAPTURE_HANDLE mqtt_capture_create(const char* path)
+{
+    MQTT_CAPTURE* result;
+    if (path == NULL)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_001: [If path is NULL then mqtt_capture_create shall return NULL.] */
+        LogError("Invalid parameter specified path: NULL");
+        result = NULL;
+    }
+    else if ((result = (MQTT_CAPTURE*)malloc(sizeof(MQTT_CAPTURE))) == NULL)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_003: [If any failure is encountered then mqtt_capture_create shall return NULL.] */
+        LogError("Failure allocating capture");
+    }
+    else if ((result->file = fopen(path, "wb")) == NULL)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_003: [If any failure is encountered then mqtt_capture_create shall return NULL.] */
+        LogError("Failure opening capture file %s", path);
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_002: [mqtt_capture_create shall create the file at path, replacing a file that exists, and write the capture file magic to it.] */
+        result->pending = 0;
+        result->failed = false;
+        if (write_bytes(result, CAPTURE_FILE_MAGIC, CAPTURE_FILE_MAGIC_SIZE) != 0)
+        {
+            /* Codes_SRS_MQTT_CAPTURE_07_003: [If any failure is encountered then mqtt_capture_create shall return NULL.] */
+            LogError("Failure writing capture file %s", path);
+            (void)fclose(result->file);
+            free(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+void mqtt_capture_destroy(MQTT_CAPTURE_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_CAPTURE_07_004: [If handle is NULL then mqtt_capture_destroy shall do nothing.] */
+    if (handle != NULL)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_005: [mqtt_capture_destroy shall fill the bytes the last packet still waits for with zeros, close the file and free the capture.] */
+        (void)fill_pending(handle);
+        if (fclose(handle->file) != 0)
+        {
+            LogError("Failure closing capture file");
+        }
+        free(handle);
+    }
+}
+
+int mqtt_capture_begin_packet(MQTT_CAPTURE_HANDLE handle, MQTT_TRACE_DIRECTION direction, uint64_t timestampMs, size_t length)
+{
+    int result;
+    if (handle == NULL || length > UINT32_MAX)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_006: [If handle is NULL or length does not fit in 32 bits then mqtt_capture_begin_packet shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, length: %lu", handle, (unsigned long)length);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        uint8_t header[CAPTURE_FRAME_HEADER_SIZE] = { 0 };
+        write_uint64(header, timestampMs);
+        write_uint32(header + 8, (uint32_t)length);
+        header[12] = (uint8_t)direction;
+
+        /* Codes_SRS_MQTT_CAPTURE_07_007: [mqtt_capture_begin_packet shall fill the bytes the previous packet still waits for with zeros.] */
+        /* Codes_SRS_MQTT_CAPTURE_07_008: [mqtt_capture_begin_packet shall write the time, length and direction of the packet and wait for length bytes.] */
+        if (fill_pending(handle) != 0 || write_bytes(handle, header, sizeof(header)) != 0)
+        {
+            /* Codes_SRS_MQTT_CAPTURE_07_009: [If writing the file fails then mqtt_capture_begin_packet and every later call shall return a non-zero value.] */
+            LogError("Failure writing capture packet header");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            handle->pending = length;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+int mqtt_capture_append(MQTT_CAPTURE_HANDLE handle, const uint8_t* data, size_t length)
+{
+    int result;
+    if (handle == NULL || (data == NULL && length > 0))
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_010: [If handle is NULL, or data is NULL and length is not 0, then mqtt_capture_append shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, data: %p", handle, data);
+        result = MU_FAILURE;
+    }
+    else if (length > handle->pending)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_011: [If the packet waits for fewer than length bytes then mqtt_capture_append shall write nothing and return a non-zero value.] */
+        LogError("Capture packet waits for %lu bytes, not %lu", (unsigned long)handle->pending, (unsigned long)length);
+        result = MU_FAILURE;
+    }
+    else if (write_bytes(handle, data, length) != 0)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_009: [If writing the file fails then mqtt_capture_begin_packet and every later call shall return a non-zero value.] */
+        LogError("Failure writing %lu capture bytes", (unsigned long)length);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_012: [mqtt_capture_append shall write length bytes of data as the next bytes of the packet and return 0.] */
+        handle->pending -= length;
+        result = 0;
+    }
+    return result;
+}
+
+size_t mqtt_capture_get_pending(MQTT_CAPTURE_HANDLE handle)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_013: [If handle is NULL then mqtt_capture_get_pending shall return 0.] */
+        LogError("Invalid parameter specified handle: NULL");
+        result = 0;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_014: [mqtt_capture_get_pending shall return the number of bytes the packet started last still waits for.] */
+        result = handle->pending;
+    }
+    return result;
+}
+
+MQTT_CAPTURE_READER_HANDLE mqtt_capture_reader_open(const char* path)
+{
+    MQTT_CAPTURE_READER* result;
+    if (path == NULL)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_015: [If path is NULL then mqtt_capture_reader_open shall return NULL.] */
+        LogError("Invalid parameter specified path: NULL");
+        result = NULL;
+    }
+    else if ((result = (MQTT_CAPTURE_READER*)malloc(sizeof(MQTT_CAPTURE_READER))) == NULL)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_017: [If the file cannot be opened or does not start with the capture file magic then mqtt_capture_reader_open shall return NULL.] */
+        LogError("Failure allocating capture reader");
+    }
+    else if ((result->file = fopen(path, "rb")) == NULL)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_017: [If the file cannot be opened or does not start with the capture file magic then mqtt_capture_reader_open shall return NULL.] */
+        LogError("Failure opening capture file %s", path);
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_016: [mqtt_capture_reader_open shall open the file at path and check that it starts with the capture file magic.] */
+        char magic[CAPTURE_FILE_MAGIC_SIZE];
+        if (fread(magic, 1, sizeof(magic), result->file) != sizeof(magic) || memcmp(magic, CAPTURE_FILE_MAGIC, sizeof(magic)) != 0)
+        {
+            /* Codes_SRS_MQTT_CAPTURE_07_017: [If the file cannot be opened or does not start with the capture file magic then mqtt_capture_reader_open shall return NULL.] */
+            LogError("%s is not a capture file", path);
+            (void)fclose(result->file);
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            result->buffer = NULL;
+            result->bufferSize = 0;
+        }
+    }
+    return result;
+}
+
+void mqtt_capture_reader_close(MQTT_CAPTURE_READER_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_CAPTURE_07_018: [If handle is NULL then mqtt_capture_reader_close shall do nothing.] */
+    if (handle != NULL)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_019: [mqtt_capture_reader_close shall close the file and free the reader and its buffer.] */
+        (void)fclose(handle->file);
+        if (handle->buffer != NULL)
+        {
+            free(handle->buffer);
+        }
+        free(handle);
+    }
+}
+
+MQTT_CAPTURE_READ_RESULT mqtt_capture_reader_next(MQTT_CAPTURE_READER_HANDLE handle, MQTT_CAPTURE_PACKET* packet)
+{
+    MQTT_CAPTURE_READ_RESULT result;
+    if (handle == NULL || packet == NULL)
+    {
+        /* Codes_SRS_MQTT_CAPTURE_07_020: [If handle or packet is NULL then mqtt_capture_reader_next shall return MQTT_CAPTURE_READ_ERROR.] */
+        LogError("Invalid parameter specified handle: %p, packet: %p", handle, packet);
+        result = MQTT_CAPTURE_READ_ERROR;
+    }
+    else
+    {
+        uint8_t header[CAPTURE_FRAME_HEADER_SIZE];
+        size_t headerRead = fread(header, 1, sizeof(header), handle->file);
+        if (headerRead == 0 && feof(handle->file))
+        {
+            /* Codes_SRS_MQTT_CAPTURE_07_022: [If the file ends after the last whole packet then mqtt_capture_reader_next shall return MQTT_CAPTURE_READ_END.] */
+            result = MQTT_CAPTURE_READ_END;
+        }
+        else if (headerRead != sizeof(header))
+        {
+            /* Codes_SRS_MQTT_CAPTURE_07_023: [If the file is cut short in a packet, a packet has an unknown direction or is longer than an MQTT packet can be, or reading fails, then mqtt_capture_reader_next shall return MQTT_CAPTURE_READ_ERROR.] */
+            LogError("Capture file cut short in a packet header");
+            result = MQTT_CAPTURE_READ_ERROR;
+        }
+        else
+        {
+            uint32_t length = read_uint32(header + 8);
+            if ((header[12] != MQTT_TRACE_OUTGOING && header[12] != MQTT_TRACE_INCOMING) || length > CAPTURE_MAX_PACKET_SIZE)
+            {
+                /* Codes_SRS_MQTT_CAPTURE_07_023: [If the file is cut short in a packet, a packet has an unknown direction or is longer than an MQTT packet can be, or reading fails, then mqtt_capture_reader_next shall return MQTT_CAPTURE_READ_ERROR.] */
+                LogError("Invalid capture packet, direction: %u, length: %lu", (unsigned int)header[12], (unsigned long)length);
+                result = MQTT_CAPTURE_READ_ERROR;
+            }
+            else
+            {
+                if (length > handle->bufferSize)
+                {
+                    uint8_t* buffer = (uint8_t*)realloc(handle->buffer, length);
+                    if (buffer != NULL)
+                    {
+                        handle->buffer = buffer;
+                        handle->bufferSize = length;
+                    }
+                }
+
+                if (length > handle->bufferSize)
+                {
+                    /* Codes_SRS_MQTT_CAPTURE_07_023: [If the file is cut short in a packet, a packet has an unknown direction or is longer than an MQTT packet can be, or reading fails, then mqtt_capture_reader_next shall return MQTT_CAPTURE_READ_ERROR.] */
+                    LogError("Failure allocating %lu bytes for a capture packet", (unsigned long)length);
+                    result = MQTT_CAPTURE_READ_ERROR;
+                }
+                else if (length > 0 && fread(handle->buffer, 1, length, handle->file) != length)
+                {
+                    /* Codes_SRS_MQTT_CAPTURE_07_023: [If the file is cut short in a packet, a packet has an unknown direction or is longer than an MQTT packet can be, or reading fails, then mqtt_capture_reader_next shall return MQTT_CAPTURE_READ_ERROR.] */
+                    LogError("Capture file cut short in a packet of %lu bytes", (unsigned long)length);
+                    result = MQTT_CAPTURE_READ_ERROR;
+                }
+                else
+                {
+                    /* Codes_SRS_MQTT_CAPTURE_07_021: [mqtt_capture_reader_next shall read the next packet into a buffer kept by the reader, set its time, direction, data and length in packet and return MQTT_CAPTURE_READ_OK.] */
+                    packet->timestampMs = read_uint64(header);
+                    packet->direction = (MQTT_TRACE_DIRECTION)header[12];
+                    packet->data = handle->buffer;
+                    packet->length = length;
+                    result = MQTT_CAPTURE_READ_OK;
+                }
+            }
+        }
+    }
+    return result;
+}
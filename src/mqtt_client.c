@@ -11,13 +11,18 @@
 #include "macro_utils/macro_utils.h"
 #include "azure_c_shared_utility/platform.h"
 #include "azure_c_shared_utility/strings.h"
-#include "azure_c_shared_utility/threadapi.h"
 #include "azure_c_shared_utility/tickcounter.h"
 #include "azure_c_shared_utility/xlogging.h"
 #include "azure_c_shared_utility/safe_math.h"
+#include "azure_c_shared_utility/threadapi.h"
 
 #include "azure_umqtt_c/mqtt_client.h"
 #include "azure_umqtt_c/mqtt_codec.h"
+#include "azure_umqtt_c/mqtt_topic_trie.h"
+#include "azure_umqtt_c/mqtt_topic_table.h"
+#include "azure_umqtt_c/mqtt_submit_queue.h"
+#include "azure_umqtt_c/mqtt_timer_wheel.h"
+#include "azure_umqtt_c/mqtt_trace_ring.h"
 #include <inttypes.h>
 
 #define VARIABLE_HEADER_OFFSET          2
@@ -28,7 +33,52 @@
 #define CONNECT_PACKET_MASK             0xf0
 #define TIME_MAX_BUFFER                 16
 #define DEFAULT_MAX_PING_RESPONSE_TIME  80  // % of time to send pings
-#define MAX_CLOSE_RETRIES               20
+#define CLOSE_TIMEOUT_MS                1000
+#define PUBLISH_HEADER_STACK_SIZE       256
+#define PACKET_ID_BITMAP_WORDS          ((UINT16_MAX + 1) / 32)
+#define MAX_INFLIGHT_MESSAGES           (UINT16_MAX - 1)
+#define INFLIGHT_NO_SLOT                SIZE_MAX
+#define REASON_CODE_FAILURE             0x80
+#define SHARED_SUBSCRIPTION_PREFIX      "$share/"
+#define RAW_TRACE_INITIAL_BUFFER_SIZE   1024
+#define RAW_TRACE_BYTE_WIDTH            5   // "0x" and two hex digits and a space
+#define RAW_TRACE_SUFFIX_SIZE           48
+#define LATENCY_PENDING_SLOTS           128
+#define LATENCY_PROBE_SLOTS             8
+#define LATENCY_SUB_BUCKETS             4
+#define LATENCY_TOP_BIT_LIMIT           (MQTT_CLIENT_LATENCY_BUCKET_COUNT / LATENCY_SUB_BUCKETS + 1)
+
+// Only the thread working the client updates its statistics, any thread may read them with mqtt_client_get_stats
+#if defined(_MSC_VER)
+#define STATS_LOAD(target)              (*(volatile uint64_t*)(target))
+#define STATS_STORE(target, value)      (*(volatile uint64_t*)(target) = (value))
+#else
+#define STATS_LOAD(target)              __atomic_load_n((target), __ATOMIC_RELAXED)
+#define STATS_STORE(target, value)      __atomic_store_n((target), (value), __ATOMIC_RELAXED)
+#endif
+#define STATS_ADD(target, value)        STATS_STORE((target), STATS_LOAD(target) + (uint64_t)(value))
+
+// Submitting threads and mqtt_client_set_wakeup_callback share the wakeup, the store of one and the load of the
+// other have to be ordered the same way for both so they are sequentially consistent
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define WAKEUP_LOAD_PTR(target)             _InterlockedCompareExchangePointer((void* volatile*)(target), NULL, NULL)
+#define WAKEUP_STORE_PTR(target, value)     (void)_InterlockedExchangePointer((void* volatile*)(target), (value))
+#define WAKEUP_LOAD(target)                 _InterlockedCompareExchange((volatile long*)(target), 0, 0)
+#define WAKEUP_INCREMENT(target)            (void)_InterlockedIncrement((volatile long*)(target))
+#define WAKEUP_DECREMENT(target)            (void)_InterlockedDecrement((volatile long*)(target))
+#define WAKEUP_THREAD_LOCAL                 __declspec(thread)
+#else
+#define WAKEUP_LOAD_PTR(target)             __atomic_load_n((target), __ATOMIC_SEQ_CST)
+#define WAKEUP_STORE_PTR(target, value)     __atomic_store_n((target), (value), __ATOMIC_SEQ_CST)
+#define WAKEUP_LOAD(target)                 __atomic_load_n((target), __ATOMIC_SEQ_CST)
+#define WAKEUP_INCREMENT(target)            (void)__atomic_add_fetch((target), 1, __ATOMIC_SEQ_CST)
+#define WAKEUP_DECREMENT(target)            (void)__atomic_sub_fetch((target), 1, __ATOMIC_SEQ_CST)
+#define WAKEUP_THREAD_LOCAL                 __thread
+#endif
+
+// The client whose wakeup callback this thread runs, that callback can't wait for itself to return
+static WAKEUP_THREAD_LOCAL const void* wakeupCallingClient;
 
 #ifndef NO_LOGGING
 static const char* const TRUE_CONST = "true";
@@ -81,6 +131,185 @@ const char* MU_CONTROL_PACKET_TYPE_ToString(CONTROL_PACKET_TYPE value)
 #define MQTT_FLAGS_LOG_TRACE           0x0001
 #define MQTT_FLAGS_RAW_TRACE           0x0002
 
+// Packets waiting to be written to the xio in a single send, capacity is zero when coalescing is off
+typedef struct OUTBOUND_QUEUE_TAG
+{
+    uint8_t* buffer;
+    size_t capacity;
+    size_t length;
+    uint32_t maxLatencyMs;
+    tickcounter_ms_t firstQueuedMs;
+} OUTBOUND_QUEUE;
+
+// Unacknowledged QoS 1 and QoS 2 publishes kept in send order, oldest first. msgHandle
+// is NULL once PUBREC arrived, from then on the PUBREL is what gets resent.
+typedef struct INFLIGHT_ENTRY_TAG
+{
+    MQTT_MESSAGE_HANDLE msgHandle;
+    tickcounter_ms_t sentMs;
+    uint16_t packetId;
+    size_t prev;
+    size_t next;
+} INFLIGHT_ENTRY;
+
+// Client owned packet ids and in-flight publishes, maxInflight is zero when the store is off.
+// usedIds is a bitmap over the whole packet id space and slotIndex an open addressed table
+// from packet id to entry slot + 1, so allocation and ack lookup don't depend on the count.
+typedef struct INFLIGHT_STORE_TAG
+{
+    INFLIGHT_ENTRY* entries;
+    size_t* slotIndex;
+    size_t slotIndexMask;
+    uint32_t* usedIds;
+    size_t maxInflight;
+    size_t count;
+    size_t freeSlot;
+    size_t oldest;
+    size_t newest;
+    uint16_t nextPacketId;
+    uint32_t retryTimeoutMs;
+    bool resendAll;
+} INFLIGHT_STORE;
+
+// A subscription of the application, acked once its SUBACK granted it. pendingId is the packet id
+// of a SUBSCRIBE still waiting for its SUBACK and pendingIndex the position of the topic in it.
+typedef struct SUBSCRIPTION_ENTRY_TAG
+{
+    struct SUBSCRIPTION_ENTRY_TAG* next;
+    char* topic;
+    QOS_VALUE qos;
+    bool acked;
+    uint16_t pendingId;
+    size_t pendingIndex;
+    QOS_VALUE pendingQos;
+} SUBSCRIPTION_ENTRY;
+
+// Automatic reconnect, xioHandle is the transport given to mqtt_client_connect and NULL once
+// the application disconnected. While pending the client waits for nextAttemptMs to reopen it.
+typedef struct RECONNECT_STATE_TAG
+{
+    bool enabled;
+    bool resubscribe;
+    uint32_t initialDelayMs;
+    uint32_t maxDelayMs;
+    uint32_t maxRetryWindowMs;
+    XIO_HANDLE xioHandle;
+    bool pending;
+    bool reopened;
+    uint32_t attempt;
+    tickcounter_ms_t firstFailureMs;
+    tickcounter_ms_t nextAttemptMs;
+    uint32_t randomState;
+    uint16_t resubscribeId;
+    SUBSCRIPTION_ENTRY* subscriptions;
+} RECONNECT_STATE;
+
+typedef struct WAKEUP_REGISTRATION_TAG
+{
+    ON_MQTT_CLIENT_WAKEUP fnWakeup;
+    void* context;
+} WAKEUP_REGISTRATION;
+
+// A transport being closed, mqtt_client_dowork works it until it reports the close or deadlineMs passes.
+// xioHandle is NULL when no close is in progress. callbacksPending counts the closes whose callback has not
+// come yet, a close that timed out included, and released is set by mqtt_client_deinit so the last of them frees the client.
+// reportDisconnect is false for a transport that failed to open, its failure was reported already.
+typedef struct CLOSE_STATE_TAG
+{
+    XIO_HANDLE xioHandle;
+    tickcounter_ms_t deadlineMs;
+    size_t callbacksPending;
+    bool released;
+    bool reportDisconnect;
+} CLOSE_STATE;
+
+// Value stored in the topic trie for every filter given to mqtt_client_set_topic_handler
+typedef struct TOPIC_HANDLER_TAG
+{
+    ON_MQTT_MESSAGE_RECV_CALLBACK handler;
+    void* context;
+} TOPIC_HANDLER;
+
+// A change a handler asked mqtt_client_set_topic_handler for, made once the trie is no longer walked
+typedef struct PENDING_TOPIC_HANDLER_TAG
+{
+    char* topicFilter;
+    ON_MQTT_MESSAGE_RECV_CALLBACK handler;
+    void* context;
+    struct PENDING_TOPIC_HANDLER_TAG* next;
+} PENDING_TOPIC_HANDLER;
+
+typedef struct TOPIC_DISPATCH_TAG
+{
+    MQTT_MESSAGE_HANDLE msgHandle;
+    MQTT_CLIENT_ACK_OPTION ackOption;
+} TOPIC_DISPATCH;
+
+// A PUBLISH read while every receive credit was used, data holds its length bytes after the fixed header
+typedef struct HELD_PUBLISH_TAG
+{
+    struct HELD_PUBLISH_TAG* next;
+    int flags;
+    size_t length;
+    uint8_t data[1];
+} HELD_PUBLISH;
+
+// Received QoS 1 and 2 publishes the application answered with MQTT_CLIENT_ACK_ASYNC and has not acknowledged yet.
+// awaitingIds is a bitmap over the packet id space, NULL while credit is zero and nothing is limited.
+// Publishes read while the credit is used up wait in order from heldHead until an acknowledgement returns one.
+typedef struct RECEIVE_CREDIT_TAG
+{
+    uint32_t* awaitingIds;
+    size_t credit;
+    size_t outstanding;
+    HELD_PUBLISH* heldHead;
+    HELD_PUBLISH* heldTail;
+} RECEIVE_CREDIT;
+
+// What the server allowed in its MQTT 5 CONNACK, all zero on MQTT 3.1.1 where nothing is limited.
+// Topic aliases are given out in order from nextTopicAlias and only hold for the current connection.
+typedef struct SERVER_LIMITS_TAG
+{
+    uint16_t receiveMaximum;
+    uint32_t maximumPacketSize;
+    uint16_t topicAliasMaximum;
+    uint16_t nextTopicAlias;
+} SERVER_LIMITS;
+
+// Properties of a received MQTT 5 packet the client acts on, the others are skipped
+typedef struct RECEIVED_PROPERTIES_TAG
+{
+    uint32_t sessionExpiryInterval;
+    uint32_t maximumPacketSize;
+    uint16_t receiveMaximum;
+    uint16_t topicAliasMaximum;
+    uint16_t serverKeepAlive;
+    bool hasServerKeepAlive;
+    uint8_t maximumQos;
+    bool retainAvailable;
+    bool wildcardSubscriptionAvailable;
+    bool sharedSubscriptionAvailable;
+    const char* reasonString;
+    size_t reasonStringLength;
+} RECEIVED_PROPERTIES;
+
+// A PUBLISH or SUBSCRIBE waiting for its ack, packetType is 0 once the slot is free
+typedef struct LATENCY_PENDING_TAG
+{
+    uint32_t sentMs;
+    uint16_t packetId;
+    uint8_t packetType;
+} LATENCY_PENDING;
+
+// First send times of the packets the latency histograms wait on, in the first free of the LATENCY_PROBE_SLOTS slots
+// from their packet id. When all of them are taken the oldest wait isn't measured and counts in latencyDropped.
+// lastSentMs is when the last packet was sent or queued.
+typedef struct LATENCY_TRACKER_TAG
+{
+    LATENCY_PENDING pending[LATENCY_PENDING_SLOTS];
+    tickcounter_ms_t lastSentMs;
+} LATENCY_TRACKER;
+
 typedef struct MQTT_CLIENT_TAG
 {
     XIO_HANDLE xioHandle;
@@ -104,8 +333,121 @@ typedef struct MQTT_CLIENT_TAG
 
     tickcounter_ms_t timeSincePing;
     uint16_t maxPingRespTime;
+
+    OUTBOUND_QUEUE outbound;
+    INFLIGHT_STORE inflight;
+
+    // Not owned, receivedIds marks incoming QoS 2 publishes that were delivered and wait for PUBREL
+    MQTT_SESSION_STORE_HANDLE sessionStore;
+    uint32_t* receivedIds;
+
+    // Reading from the xio stops while credit received publishes wait for mqtt_client_send_message_response
+    RECEIVE_CREDIT receiveCredit;
+
+    // Encoded publishes made while disconnected, sent drainPerDowork at a time once connected
+    MQTT_OFFLINE_QUEUE_HANDLE offlineQueue;
+    size_t drainPerDowork;
+
+    RECONNECT_STATE reconnect;
+    CLOSE_STATE closing;
+
+    // Created by the first mqtt_client_set_topic_handler, NULL means every message goes to fnMessageRecv
+    MQTT_TOPIC_TRIE_HANDLE topicHandlers;
+    // Set while mqtt_topic_trie_match walks topicHandlers, changes the handlers make wait in pendingTopicHandlers
+    bool dispatchingTopic;
+    PENDING_TOPIC_HANDLER* pendingTopicHandlers;
+
+    // Created by the first mqtt_client_intern_topic, in-flight copies of messages on these topics point into it
+    MQTT_TOPIC_TABLE_HANDLE topicTable;
+
+    // Publishes encoded by other threads, created by mqtt_client_enable_submit_queue before they start.
+    // submitPending was taken from it and waits for room in the in-flight window.
+    MQTT_SUBMIT_QUEUE_HANDLE submitQueue;
+    BUFFER_HANDLE submitPending;
+    bool submitBacklog;
+
+    // Called from the submitting thread once a publish is in the submit queue. Submitting threads load activeWakeup,
+    // NULL or &wakeup, and count themselves in wakeupCallers while they call it, see mqtt_client_set_wakeup_callback.
+    WAKEUP_REGISTRATION wakeup;
+    WAKEUP_REGISTRATION* activeWakeup;
+    long wakeupCallers;
+
+    // Not owned, once set the client tells time from it instead of packetTickCntr. clockOffsetMs is the time of the
+    // wheel minus the time of packetTickCntr, so times taken before the wheel was set still compare.
+    MQTT_TIMER_WHEEL_HANDLE timerWheel;
+    tickcounter_ms_t clockOffsetMs;
+    MQTT_TIMER deadlineTimer;
+    ON_MQTT_CLIENT_WAKEUP fnDue;
+    void* dueCtx;
+
+    SERVER_LIMITS server;
+
+    // Not owned, gets a record of every packet sent and received when set
+    MQTT_TRACE_RING_HANDLE traceRing;
+
+    // Hex text of the packet in the raw bytes trace, reused from packet to packet
+    char* rawTraceBuffer;
+    size_t rawTraceBufferSize;
+    size_t rawTraceMaxBytes;
+
+    // Not owned, gets the bytes of every packet sent and received when set
+    MQTT_CAPTURE_HANDLE capture;
+
+    // Always on, see mqtt_client_get_stats
+    MQTT_CLIENT_STATS stats;
+    LATENCY_TRACKER latency;
 } MQTT_CLIENT;
 
+typedef struct SESSION_RESTORE_CONTEXT_TAG
+{
+    MQTT_CLIENT* mqtt_client;
+    tickcounter_ms_t current_ms;
+    int result;
+} SESSION_RESTORE_CONTEXT;
+
+typedef struct PUBLISH_IOV_CONTEXT_TAG
+{
+    MQTT_CLIENT* mqtt_client;
+    ON_MQTT_PAYLOAD_RELEASED_CALLBACK onPayloadReleased;
+    void* releasedCtx;
+} PUBLISH_IOV_CONTEXT;
+
+static bool is_client_connected(const MQTT_CLIENT* mqtt_client)
+{
+    return (mqtt_client->mqtt_status & MQTT_STATUS_CLIENT_CONNECTED) && (mqtt_client->mqtt_status & MQTT_STATUS_SOCKET_CONNECTED);
+}
+
+static int getCurrentMs(const MQTT_CLIENT* mqtt_client, tickcounter_ms_t* current_ms)
+{
+    int result;
+    if (mqtt_client->timerWheel != NULL)
+    {
+        *current_ms = mqtt_timer_wheel_get_current_ms(mqtt_client->timerWheel) - mqtt_client->clockOffsetMs;
+        result = 0;
+    }
+    else
+    {
+        result = tickcounter_get_current_ms(mqtt_client->packetTickCntr, current_ms);
+    }
+    return result;
+}
+
+static tickcounter_ms_t getKeepAliveMs(const MQTT_CLIENT* mqtt_client)
+{
+    return (tickcounter_ms_t)mqtt_client->keepAliveInterval * 1000;
+}
+
+// A ping response is late once the whole second after maxPingRespTime has passed
+static tickcounter_ms_t getPingResponseTimeoutMs(const MQTT_CLIENT* mqtt_client)
+{
+    return ((tickcounter_ms_t)mqtt_client->maxPingRespTime + 1) * 1000;
+}
+
+static bool is_protocol_v5(const MQTT_CLIENT* mqtt_client)
+{
+    return mqtt_client->mqttOptions.protocolVersion == MQTT_PROTOCOL_V5;
+}
+
 static bool is_trace_enabled(MQTT_CLIENT* mqtt_client)
 {
     return (mqtt_client->mqtt_flags & MQTT_FLAGS_LOG_TRACE);
@@ -118,54 +460,134 @@ static bool is_raw_trace_enabled(MQTT_CLIENT* mqtt_client)
 }
 #endif // ENABLE_RAW_TRACE
 
+static void complete_close(MQTT_CLIENT* mqtt_client)
+{
+    mqtt_client->closing.xioHandle = NULL;
+    if (mqtt_client->closing.reportDisconnect && mqtt_client->disconnect_cb)
+    {
+        mqtt_client->disconnect_cb(mqtt_client->disconnect_ctx);
+    }
+}
+
 static void on_connection_closed(void* context)
 {
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
     if (mqtt_client != NULL)
     {
-        mqtt_client->mqtt_status &= ~MQTT_STATUS_SOCKET_CONNECTED;
-        if (mqtt_client->disconnect_cb)
+        if (mqtt_client->closing.callbacksPending > 0)
         {
-            mqtt_client->disconnect_cb(mqtt_client->disconnect_ctx);
+            mqtt_client->closing.callbacksPending--;
+        }
+
+        if (mqtt_client->closing.released)
+        {
+            // Only the close state is left of a client that mqtt_client_deinit released
+            if (mqtt_client->closing.callbacksPending == 0)
+            {
+                free(mqtt_client);
+            }
         }
+        // A close that timed out is already complete
+        else if (mqtt_client->closing.xioHandle != NULL)
+        {
+            complete_close(mqtt_client);
+        }
+    }
+}
+
+// Closes xioHandle without waiting, mqtt_client_dowork works the close until it completes
+static void start_close(MQTT_CLIENT* mqtt_client, bool reportDisconnect)
+{
+    mqtt_client->closing.xioHandle = mqtt_client->xioHandle;
+    mqtt_client->closing.reportDisconnect = reportDisconnect;
+    mqtt_client->closing.callbacksPending++;
+    if (xio_close(mqtt_client->xioHandle, on_connection_closed, mqtt_client) != 0)
+    {
+        LogError("Error: xio_close failed");
+        mqtt_client->closing.callbacksPending--;
+        complete_close(mqtt_client);
+    }
+    else if (mqtt_client->closing.xioHandle != NULL)
+    {
+        tickcounter_ms_t current_ms;
+        // Without a clock the close is given up on the next mqtt_client_dowork
+        mqtt_client->closing.deadlineMs = (getCurrentMs(mqtt_client, &current_ms) == 0) ? current_ms + CLOSE_TIMEOUT_MS : 0;
+    }
+    // Clear the handle because we don't use it anymore
+    mqtt_client->xioHandle = NULL;
+    mqtt_client->outbound.length = 0;
+}
+
+// Publishes held for the receive credit belong to the connection, the server sends QoS 1 and 2 again on the next one
+static void clearHeldPublishes(RECEIVE_CREDIT* receiveCredit)
+{
+    while (receiveCredit->heldHead != NULL)
+    {
+        HELD_PUBLISH* held = receiveCredit->heldHead;
+        receiveCredit->heldHead = held->next;
+        free(held);
     }
+    receiveCredit->heldTail = NULL;
 }
 
 static void close_connection(MQTT_CLIENT* mqtt_client)
 {
+    clearHeldPublishes(&mqtt_client->receiveCredit);
     if (mqtt_client->mqtt_status & MQTT_STATUS_SOCKET_CONNECTED)
     {
-        (void)xio_close(mqtt_client->xioHandle, on_connection_closed, mqtt_client);
-        if (mqtt_client->disconnect_cb == NULL)
-        {
-            size_t counter = 0;
-            do
-            {
-                xio_dowork(mqtt_client->xioHandle);
-                counter++;
-                ThreadAPI_Sleep(2);
-            } while (mqtt_client->mqtt_status & MQTT_STATUS_SOCKET_CONNECTED && counter < MAX_CLOSE_RETRIES);
-        }
-        // Clear the handle because we don't use it anymore
-        mqtt_client->xioHandle = NULL;
+        /*Codes_SRS_MQTT_CLIENT_07_132: [When the client closes an open connection it shall call xio_close and return without waiting for the transport to finish closing.]*/
+        mqtt_client->mqtt_status &= ~MQTT_STATUS_SOCKET_CONNECTED;
+        start_close(mqtt_client, true);
     }
     else
     {
         mqtt_client->mqtt_status &= ~MQTT_STATUS_SOCKET_CONNECTED;
-        if (mqtt_client->disconnect_cb)
+        // A close in progress calls disconnect_cb once it completes
+        if (mqtt_client->closing.xioHandle != NULL)
+        {
+            mqtt_client->closing.reportDisconnect = true;
+        }
+        else if (mqtt_client->disconnect_cb)
         {
             mqtt_client->disconnect_cb(mqtt_client->disconnect_ctx);
         }
     }
 }
 
+static void advance_close(MQTT_CLIENT* mqtt_client)
+{
+    tickcounter_ms_t current_ms;
+    /*Codes_SRS_MQTT_CLIENT_07_133: [While a close is in progress mqtt_client_dowork shall call xio_dowork on the XIO_HANDLE being closed, and shall not reconnect until the close completes.]*/
+    xio_dowork(mqtt_client->closing.xioHandle);
+    if (mqtt_client->closing.xioHandle != NULL && (getCurrentMs(mqtt_client, &current_ms) != 0 || current_ms >= mqtt_client->closing.deadlineMs))
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_134: [The client shall call the ON_MQTT_DISCONNECTED_CALLBACK once when the transport reports the close complete, or once CLOSE_TIMEOUT_MS have passed since the close started, whichever comes first.]*/
+        LogError("Error: closing the connection timed out");
+        complete_close(mqtt_client);
+    }
+}
+
+static void scheduleReconnect(MQTT_CLIENT* mqtt_client);
+static void scheduleDeadline(MQTT_CLIENT* mqtt_client);
+
 static void set_error_callback(MQTT_CLIENT* mqtt_client, MQTT_CLIENT_EVENT_ERROR error_type)
 {
+    /*Codes_SRS_MQTT_CLIENT_07_151: [The client shall count the MQTT_CLIENT_PARSE_ERROR and MQTT_CLIENT_NO_PING_RESPONSE errors it reports, and every reopening of the transport for a reconnect.]*/
+    if (error_type == MQTT_CLIENT_PARSE_ERROR)
+    {
+        STATS_ADD(&mqtt_client->stats.parseErrors, 1);
+    }
+    else if (error_type == MQTT_CLIENT_NO_PING_RESPONSE)
+    {
+        STATS_ADD(&mqtt_client->stats.keepAliveTimeouts, 1);
+    }
+
     if (mqtt_client->fnOnErrorCallBack)
     {
         mqtt_client->fnOnErrorCallBack(mqtt_client, error_type, mqtt_client->errorCBCtx);
     }
     close_connection(mqtt_client);
+    scheduleReconnect(mqtt_client);
 }
 
 static STRING_HANDLE construct_trace_log_handle(MQTT_CLIENT* mqtt_client)
@@ -182,7 +604,7 @@ static STRING_HANDLE construct_trace_log_handle(MQTT_CLIENT* mqtt_client)
     return trace_log;
 }
 
-static uint16_t byteutil_read_uint16(uint8_t** buffer, size_t byteLen)
+static uint16_t byteutil_read_uint16(const uint8_t** buffer, size_t byteLen)
 {
     uint16_t result = 0;
     if (buffer != NULL && *buffer != NULL && byteLen >= 2)
@@ -197,9 +619,11 @@ static uint16_t byteutil_read_uint16(uint8_t** buffer, size_t byteLen)
     return result;
 }
 
-static char* byteutil_readUTF(uint8_t** buffer, size_t* byteLen)
+// Returns a pointer to the UTF string inside buffer, the string is not NULL terminated
+// and its length is returned in byteLen.
+static const char* byteutil_readUTF(const uint8_t** buffer, size_t* byteLen)
 {
-    char* result = NULL;
+    const char* result = NULL;
 
     const uint8_t* bufferInitial = *buffer;
     // Get the length of the string
@@ -208,19 +632,9 @@ static char* byteutil_readUTF(uint8_t** buffer, size_t* byteLen)
     // not being asked to read a string longer than buffer passed in.
     if ((stringLen > 0) && ((size_t)(stringLen + (*buffer - bufferInitial)) <= *byteLen))
     {
-        size_t malloc_size = safe_add_size_t((size_t)stringLen, 1);
-        if (malloc_size != SIZE_MAX &&
-            (result = (char*)malloc(malloc_size)) != NULL)
-        {
-            (void)memcpy(result, *buffer, stringLen);
-            result[stringLen] = '\0';
-            *buffer += stringLen;
-            *byteLen = stringLen;
-         }
-        else
-        {
-            LogError("Cannot alloc memory, size:%zu", malloc_size);
-        }
+        result = (const char*)*buffer;
+        *buffer += stringLen;
+        *byteLen = stringLen;
     }
     else
     {
@@ -230,7 +644,7 @@ static char* byteutil_readUTF(uint8_t** buffer, size_t* byteLen)
     return result;
 }
 
-static uint8_t byteutil_readByte(uint8_t** buffer)
+static uint8_t byteutil_readByte(const uint8_t** buffer)
 {
     uint8_t result = 0;
     if (buffer != NULL)
@@ -245,6 +659,214 @@ static uint8_t byteutil_readByte(uint8_t** buffer)
     return result;
 }
 
+// Reads a Variable Byte Integer that must end before end
+static int byteutil_readVariableInt(const uint8_t** buffer, const uint8_t* end, uint32_t* value)
+{
+    int result = MU_FAILURE;
+    uint32_t multiplier = 1;
+    size_t index;
+
+    *value = 0;
+    for (index = 0; index < 4 && *buffer < end; index++)
+    {
+        uint8_t encoded = byteutil_readByte(buffer);
+        *value += (encoded & 0x7F) * multiplier;
+        multiplier *= 128;
+        if ((encoded & 0x80) == 0)
+        {
+            result = 0;
+            break;
+        }
+    }
+    return result;
+}
+
+// Reads a big endian value of size bytes that must end before end
+static int byteutil_readFixed(const uint8_t** buffer, const uint8_t* end, size_t size, uint32_t* value)
+{
+    int result;
+    if ((size_t)(end - *buffer) < size)
+    {
+        result = MU_FAILURE;
+    }
+    else
+    {
+        *value = 0;
+        while (size-- > 0)
+        {
+            *value = (*value << 8) | byteutil_readByte(buffer);
+        }
+        result = 0;
+    }
+    return result;
+}
+
+// Moves buffer past a length prefixed string or binary value that must end before end
+static int byteutil_skipBinary(const uint8_t** buffer, const uint8_t* end, const char** data, size_t* length)
+{
+    int result;
+    uint32_t dataLength;
+    if (byteutil_readFixed(buffer, end, 2, &dataLength) != 0 || dataLength > (size_t)(end - *buffer))
+    {
+        result = MU_FAILURE;
+    }
+    else
+    {
+        *data = (const char*)*buffer;
+        *length = dataLength;
+        *buffer += dataLength;
+        result = 0;
+    }
+    return result;
+}
+
+static void initReceivedProperties(RECEIVED_PROPERTIES* properties, uint32_t sessionExpiryInterval)
+{
+    // The values the server leaves out default to what MQTT 5 specifies
+    memset(properties, 0, sizeof(RECEIVED_PROPERTIES));
+    properties->sessionExpiryInterval = sessionExpiryInterval;
+    properties->receiveMaximum = UINT16_MAX;
+    properties->maximumQos = DELIVER_EXACTLY_ONCE;
+    properties->retainAvailable = true;
+    properties->wildcardSubscriptionAvailable = true;
+    properties->sharedSubscriptionAvailable = true;
+}
+
+// Reads the MQTT 5 property block at buffer, which must end before end, and moves buffer past it
+static int readProperties(const uint8_t** buffer, const uint8_t* end, RECEIVED_PROPERTIES* properties)
+{
+    int result;
+    uint32_t propertyLength;
+    if (byteutil_readVariableInt(buffer, end, &propertyLength) != 0 || propertyLength > (size_t)(end - *buffer))
+    {
+        LogError("Invalid property length");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        const uint8_t* propertyEnd = *buffer + propertyLength;
+        result = 0;
+        while (*buffer < propertyEnd && result == 0)
+        {
+            uint8_t propertyId = byteutil_readByte(buffer);
+            uint32_t value = 0;
+            const char* data;
+            size_t dataLength;
+            switch (propertyId)
+            {
+                case MQTT_PROPERTY_PAYLOAD_FORMAT_INDICATOR:
+                case MQTT_PROPERTY_REQUEST_PROBLEM_INFORMATION:
+                case MQTT_PROPERTY_REQUEST_RESPONSE_INFORMATION:
+                case MQTT_PROPERTY_SUBSCRIPTION_IDENTIFIER_AVAILABLE:
+                    result = byteutil_readFixed(buffer, propertyEnd, 1, &value);
+                    break;
+                case MQTT_PROPERTY_MAXIMUM_QOS:
+                    result = byteutil_readFixed(buffer, propertyEnd, 1, &value);
+                    properties->maximumQos = (uint8_t)value;
+                    break;
+                case MQTT_PROPERTY_RETAIN_AVAILABLE:
+                    result = byteutil_readFixed(buffer, propertyEnd, 1, &value);
+                    properties->retainAvailable = (value != 0);
+                    break;
+                case MQTT_PROPERTY_WILDCARD_SUBSCRIPTION_AVAILABLE:
+                    result = byteutil_readFixed(buffer, propertyEnd, 1, &value);
+                    properties->wildcardSubscriptionAvailable = (value != 0);
+                    break;
+                case MQTT_PROPERTY_SHARED_SUBSCRIPTION_AVAILABLE:
+                    result = byteutil_readFixed(buffer, propertyEnd, 1, &value);
+                    properties->sharedSubscriptionAvailable = (value != 0);
+                    break;
+                case MQTT_PROPERTY_TOPIC_ALIAS:
+                    result = byteutil_readFixed(buffer, propertyEnd, 2, &value);
+                    break;
+                case MQTT_PROPERTY_SERVER_KEEP_ALIVE:
+                    result = byteutil_readFixed(buffer, propertyEnd, 2, &value);
+                    properties->serverKeepAlive = (uint16_t)value;
+                    properties->hasServerKeepAlive = true;
+                    break;
+                case MQTT_PROPERTY_RECEIVE_MAXIMUM:
+                    // Zero is a protocol error
+                    result = (byteutil_readFixed(buffer, propertyEnd, 2, &value) != 0 || value == 0) ? MU_FAILURE : 0;
+                    properties->receiveMaximum = (uint16_t)value;
+                    break;
+                case MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM:
+                    result = byteutil_readFixed(buffer, propertyEnd, 2, &value);
+                    properties->topicAliasMaximum = (uint16_t)value;
+                    break;
+                case MQTT_PROPERTY_MESSAGE_EXPIRY_INTERVAL:
+                case MQTT_PROPERTY_WILL_DELAY_INTERVAL:
+                    result = byteutil_readFixed(buffer, propertyEnd, 4, &value);
+                    break;
+                case MQTT_PROPERTY_SESSION_EXPIRY_INTERVAL:
+                    result = byteutil_readFixed(buffer, propertyEnd, 4, &value);
+                    properties->sessionExpiryInterval = value;
+                    break;
+                case MQTT_PROPERTY_MAXIMUM_PACKET_SIZE:
+                    // Zero is a protocol error
+                    result = (byteutil_readFixed(buffer, propertyEnd, 4, &value) != 0 || value == 0) ? MU_FAILURE : 0;
+                    properties->maximumPacketSize = value;
+                    break;
+                case MQTT_PROPERTY_SUBSCRIPTION_IDENTIFIER:
+                    result = byteutil_readVariableInt(buffer, propertyEnd, &value);
+                    break;
+                case MQTT_PROPERTY_REASON_STRING:
+                    result = byteutil_skipBinary(buffer, propertyEnd, &properties->reasonString, &properties->reasonStringLength);
+                    break;
+                case MQTT_PROPERTY_CONTENT_TYPE:
+                case MQTT_PROPERTY_RESPONSE_TOPIC:
+                case MQTT_PROPERTY_CORRELATION_DATA:
+                case MQTT_PROPERTY_ASSIGNED_CLIENT_IDENTIFIER:
+                case MQTT_PROPERTY_AUTHENTICATION_METHOD:
+                case MQTT_PROPERTY_AUTHENTICATION_DATA:
+                case MQTT_PROPERTY_RESPONSE_INFORMATION:
+                case MQTT_PROPERTY_SERVER_REFERENCE:
+                    result = byteutil_skipBinary(buffer, propertyEnd, &data, &dataLength);
+                    break;
+                case MQTT_PROPERTY_USER_PROPERTY:
+                    // A name and a value
+                    result = (byteutil_skipBinary(buffer, propertyEnd, &data, &dataLength) != 0 ||
+                        byteutil_skipBinary(buffer, propertyEnd, &data, &dataLength) != 0) ? MU_FAILURE : 0;
+                    break;
+                default:
+                    LogError("Unknown property 0x%x", propertyId);
+                    result = MU_FAILURE;
+                    break;
+            }
+        }
+    }
+    return result;
+}
+
+static CONNECT_RETURN_CODE getConnectReturnCode(uint8_t reasonCode)
+{
+    CONNECT_RETURN_CODE result;
+    switch (reasonCode)
+    {
+        case 0x00:
+            result = CONNECTION_ACCEPTED;
+            break;
+        case 0x84: // Unsupported Protocol Version
+            result = CONN_REFUSED_UNACCEPTABLE_VERSION;
+            break;
+        case 0x85: // Client Identifier not valid
+            result = CONN_REFUSED_ID_REJECTED;
+            break;
+        case 0x86: // Bad User Name or Password
+            result = CONN_REFUSED_BAD_USERNAME_PASSWORD;
+            break;
+        case 0x87: // Not authorized
+            result = CONN_REFUSED_NOT_AUTHORIZED;
+            break;
+        case 0x88: // Server unavailable
+            result = CONN_REFUSED_SERVER_UNAVAIL;
+            break;
+        default:
+            result = CONN_REFUSED_UNKNOWN;
+            break;
+    }
+    return result;
+}
+
 static void sendComplete(void* context, IO_SEND_RESULT send_result)
 {
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
@@ -329,20 +951,84 @@ static const char* retrievePacketType(CONTROL_PACKET_TYPE packet)
     }
 }
 
-static void logOutgoingRawTrace(MQTT_CLIENT* mqtt_client, const uint8_t* data, size_t length)
+// Writes the bytes as "0xNN " text from a nibble table into the buffer of the client, which keeps the size of the
+// largest packet traced so far
+static const char* formatRawBytes(MQTT_CLIENT* mqtt_client, const uint8_t* data, size_t length)
 {
-    if (mqtt_client != NULL && data != NULL && length > 0 && is_raw_trace_enabled(mqtt_client))
+    static const char hexDigits[] = "0123456789abcdef";
+    const char* result;
+    size_t shown = (mqtt_client->rawTraceMaxBytes != 0 && length > mqtt_client->rawTraceMaxBytes) ? mqtt_client->rawTraceMaxBytes : length;
+    size_t needed = shown * RAW_TRACE_BYTE_WIDTH + RAW_TRACE_SUFFIX_SIZE;
+    if (needed > mqtt_client->rawTraceBufferSize)
     {
-        char tmBuffer[TIME_MAX_BUFFER];
-        getLogTime(tmBuffer, TIME_MAX_BUFFER);
+        char* buffer = (char*)realloc(mqtt_client->rawTraceBuffer, needed);
+        if (buffer == NULL)
+        {
+            LogError("Failure allocating %lu bytes of raw trace", (unsigned long)needed);
+        }
+        else
+        {
+            mqtt_client->rawTraceBuffer = buffer;
+            mqtt_client->rawTraceBufferSize = needed;
+        }
+    }
 
-        LOG(AZ_LOG_TRACE, 0, "-> %s %s: ", tmBuffer, retrievePacketType((unsigned char)data[0]));
-        size_t index = 0;
-        for (index = 0; index < length; index++)
+    if (needed > mqtt_client->rawTraceBufferSize)
+    {
+        result = NULL;
+    }
+    else
+    {
+        char* target = mqtt_client->rawTraceBuffer;
+        size_t index;
+        for (index = 0; index < shown; index++)
+        {
+            target[0] = '0';
+            target[1] = 'x';
+            target[2] = hexDigits[data[index] >> 4];
+            target[3] = hexDigits[data[index] & 0x0F];
+            target[4] = ' ';
+            target += RAW_TRACE_BYTE_WIDTH;
+        }
+        if (shown < length)
+        {
+            size_t remaining = mqtt_client->rawTraceBufferSize - (size_t)(target - mqtt_client->rawTraceBuffer);
+            (void)snprintf(target, remaining, "... %lu more bytes", (unsigned long)(length - shown));
+        }
+        else
         {
-            LOG(AZ_LOG_TRACE, 0, "0x%02x ", data[index]);
+            *target = '\0';
         }
-        LOG(AZ_LOG_TRACE, LOG_LINE, " ");
+        result = mqtt_client->rawTraceBuffer;
+    }
+    return result;
+}
+
+static void logOutgoingRawBytes(MQTT_CLIENT* mqtt_client, const char* label, const uint8_t* data, size_t length)
+{
+    char tmBuffer[TIME_MAX_BUFFER];
+    const char* hexBytes;
+    getLogTime(tmBuffer, TIME_MAX_BUFFER);
+    /*Codes_SRS_MQTT_CLIENT_07_143: [The raw bytes trace shall write the hex bytes of a packet in one log record.]*/
+    if ((hexBytes = formatRawBytes(mqtt_client, data, length)) != NULL)
+    {
+        LOG(AZ_LOG_TRACE, LOG_LINE, "-> %s %s: %s", tmBuffer, label, hexBytes);
+    }
+}
+
+static void logOutgoingRawTrace(MQTT_CLIENT* mqtt_client, const uint8_t* data, size_t length)
+{
+    if (mqtt_client != NULL && data != NULL && length > 0 && is_raw_trace_enabled(mqtt_client))
+    {
+        logOutgoingRawBytes(mqtt_client, retrievePacketType((unsigned char)data[0]), data, length);
+    }
+}
+
+static void logOutgoingRawPayload(MQTT_CLIENT* mqtt_client, const uint8_t* data, size_t length)
+{
+    if (mqtt_client != NULL && data != NULL && length > 0 && is_raw_trace_enabled(mqtt_client))
+    {
+        logOutgoingRawBytes(mqtt_client, "PUBLISH payload", data, length);
     }
 }
 
@@ -353,15 +1039,13 @@ static void logIncomingRawTrace(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE pa
         if (data != NULL && length > 0)
         {
             char tmBuffer[TIME_MAX_BUFFER];
+            const char* hexBytes;
             getLogTime(tmBuffer, TIME_MAX_BUFFER);
-
-            LOG(AZ_LOG_TRACE, 0, "<- %s %s: 0x%02x 0x%02x ", tmBuffer, retrievePacketType((CONTROL_PACKET_TYPE)packet), (unsigned int)(packet | flags), (unsigned int)length);
-            size_t index = 0;
-            for (index = 0; index < length; index++)
+            /*Codes_SRS_MQTT_CLIENT_07_143: [The raw bytes trace shall write the hex bytes of a packet in one log record.]*/
+            if ((hexBytes = formatRawBytes(mqtt_client, data, length)) != NULL)
             {
-                LOG(AZ_LOG_TRACE, 0, "0x%02x ", data[index]);
+                LOG(AZ_LOG_TRACE, LOG_LINE, "<- %s %s: 0x%02x 0x%02x %s", tmBuffer, retrievePacketType((CONTROL_PACKET_TYPE)packet), (unsigned int)(packet | flags), (unsigned int)length, hexBytes);
             }
-            LOG(AZ_LOG_TRACE, LOG_LINE, " ");
         }
         else if (packet == PINGRESP_TYPE)
         {
@@ -400,10 +1084,17 @@ static void logOutgoingRawTrace(MQTT_CLIENT* mqtt_client, const uint8_t* data, s
     AZURE_UNREFERENCED_PARAMETER(length);
 }
 
-static void log_outgoing_trace(MQTT_CLIENT* mqtt_client, STRING_HANDLE trace_log)
+static void logOutgoingRawPayload(MQTT_CLIENT* mqtt_client, const uint8_t* data, size_t length)
 {
     AZURE_UNREFERENCED_PARAMETER(mqtt_client);
-    AZURE_UNREFERENCED_PARAMETER(trace_log);
+    AZURE_UNREFERENCED_PARAMETER(data);
+    AZURE_UNREFERENCED_PARAMETER(length);
+}
+
+static void log_outgoing_trace(MQTT_CLIENT* mqtt_client, STRING_HANDLE trace_log)
+{
+    AZURE_UNREFERENCED_PARAMETER(mqtt_client);
+    AZURE_UNREFERENCED_PARAMETER(trace_log);
 }
 
 static void log_incoming_trace(MQTT_CLIENT* mqtt_client, STRING_HANDLE trace_log)
@@ -422,1063 +1113,4339 @@ static void logIncomingRawTrace(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE pa
 }
 #endif // NO_LOGGING
 
-static int sendPacketItem(MQTT_CLIENT* mqtt_client, const unsigned char* data, size_t length)
+// 32 bit FNV-1a, enough to tell topics apart in a trace without keeping their names
+static uint32_t hashTopicName(const uint8_t* name, size_t length)
 {
-    int result = xio_send(mqtt_client->xioHandle, (const void*)data, length, sendComplete, mqtt_client);
-
-    if (result != 0)
-    {
-        LogError("Failure sending control packet data");
-        result = MU_FAILURE;
-    }
-    else
+    uint32_t result = 2166136261u;
+    size_t index;
+    for (index = 0; index < length; index++)
     {
-#ifdef ENABLE_RAW_TRACE
-        logOutgoingRawTrace(mqtt_client, (const uint8_t*)data, length);
-#endif
-
-        if (tickcounter_get_current_ms(mqtt_client->packetTickCntr, &mqtt_client->packetSendTimeMs) != 0)
-        {
-            LogError("Failure getting current ms tickcounter");
-            result = MU_FAILURE;
-        }
+        result = (result ^ name[index]) * 16777619u;
     }
-
     return result;
 }
 
-static void onOpenComplete(void* context, IO_OPEN_RESULT open_result)
+// variableHeader holds the first available bytes after the fixed header, packetLength is the size of the whole packet
+static void tracePacket(MQTT_CLIENT* mqtt_client, MQTT_TRACE_DIRECTION direction, tickcounter_ms_t current_ms, uint8_t firstByte, const uint8_t* variableHeader, size_t available, size_t packetLength)
 {
-    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
-    if (mqtt_client != NULL)
-    {
-        if (open_result == IO_OPEN_OK && !(mqtt_client->mqtt_status & MQTT_STATUS_SOCKET_CONNECTED))
-        {
-            mqtt_client->packetState = CONNECT_TYPE;
-            mqtt_client->mqtt_status |= MQTT_STATUS_SOCKET_CONNECTED;
+    MQTT_TRACE_RECORD record;
+    const uint8_t* iterator = variableHeader;
+    const uint8_t* end = variableHeader + available;
+    uint32_t value;
 
-            STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
+    record.timestampMs = current_ms;
+    record.topicHash = 0;
+    record.length = (uint32_t)packetLength;
+    record.packetId = 0;
+    record.packetType = (uint8_t)(firstByte & 0xF0);
+    record.flags = (uint8_t)(firstByte & 0x0F);
+    record.direction = (uint8_t)direction;
 
-            // Send the Connect packet
-            BUFFER_HANDLE connPacket = mqtt_codec_connect(&mqtt_client->mqttOptions, trace_log);
-            if (connPacket == NULL)
-            {
-                LogError("Error: mqtt_codec_connect failed");
-            }
-            else
+    switch (record.packetType)
+    {
+        case PUBLISH_TYPE:
+            // A topic name of length 0 is an MQTT 5 publish that only carries a topic alias
+            if (byteutil_readFixed(&iterator, end, 2, &value) == 0 && value <= (size_t)(end - iterator))
             {
-                size_t size = BUFFER_length(connPacket);
-                /*Codes_SRS_MQTT_CLIENT_07_009: [On success mqtt_client_connect shall send the MQTT CONNECT to the endpoint.]*/
-                if (sendPacketItem(mqtt_client, BUFFER_u_char(connPacket), size) != 0)
-                {
-                    LogError("Error: failure sending connect packet");
-                    // Set the status to pending close because we connot continue
-                    // with CONN failing to send
-                    if (mqtt_client->fnOnErrorCallBack)
-                    {
-                        mqtt_client->fnOnErrorCallBack(mqtt_client, MQTT_CLIENT_CONNECTION_ERROR, mqtt_client->errorCBCtx);
-                    }
-                    mqtt_client->mqtt_status |= MQTT_STATUS_PENDING_CLOSE;
-                }
-                else
+                record.topicHash = (value == 0) ? 0 : hashTopicName(iterator, value);
+                iterator += value;
+                if ((record.flags & 0x06) != 0 && byteutil_readFixed(&iterator, end, 2, &value) == 0)
                 {
-                    log_outgoing_trace(mqtt_client, trace_log);
+                    record.packetId = (uint16_t)value;
                 }
-                BUFFER_delete(connPacket);
             }
-            if (trace_log != NULL)
-            {
-                STRING_delete(trace_log);
-            }
-        }
-        else
-        {
-            LogError("Error: failure opening connection to endpoint");
-            if (!(mqtt_client->mqtt_status & MQTT_STATUS_SOCKET_CONNECTED) && mqtt_client->fnOnErrorCallBack)
+            break;
+        case PUBACK_TYPE:
+        case PUBREC_TYPE:
+        case PUBREL_TYPE:
+        case PUBCOMP_TYPE:
+        case SUBSCRIBE_TYPE:
+        case SUBACK_TYPE:
+        case UNSUBSCRIBE_TYPE:
+        case UNSUBACK_TYPE:
+            if (byteutil_readFixed(&iterator, end, 2, &value) == 0)
             {
-                mqtt_client->fnOnErrorCallBack(mqtt_client, MQTT_CLIENT_CONNECTION_ERROR, mqtt_client->errorCBCtx);
+                record.packetId = (uint16_t)value;
             }
-            mqtt_client->mqtt_status |= MQTT_STATUS_PENDING_CLOSE;
-        }
+            break;
+        default:
+            break;
     }
-    else
+    mqtt_trace_ring_record(mqtt_client->traceRing, &record);
+}
+
+// data starts with the fixed header, a PUBLISH header sent ahead of its payload segments is traced as the whole packet
+static void traceOutgoingPacket(MQTT_CLIENT* mqtt_client, const uint8_t* data, size_t length, tickcounter_ms_t current_ms)
+{
+    const uint8_t* iterator = data + 1;
+    uint32_t remainingLength;
+    if (length > 0 && byteutil_readVariableInt(&iterator, data + length, &remainingLength) == 0)
     {
-        LogError("Error: mqtt_client is NULL");
+        size_t headerLength = (size_t)(iterator - data);
+        /*Codes_SRS_MQTT_CLIENT_07_137: [Once a trace ring is set the client shall record every control packet it sends or queues with its tick counter time, type, flags, packet id, topic hash and length.]*/
+        tracePacket(mqtt_client, MQTT_TRACE_OUTGOING, current_ms, data[0], iterator, length - headerLength, headerLength + remainingLength);
     }
 }
 
-static void onBytesReceived(void* context, const unsigned char* buffer, size_t size)
+static void traceIncomingPacket(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE packet, int flags, const uint8_t* packetData, size_t packetLength, tickcounter_ms_t current_ms)
 {
-    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
-    if (mqtt_client != NULL)
+    size_t headerLength = (packetLength < 128) ? 2 : (packetLength < 16384) ? 3 : (packetLength < 2097152) ? 4 : 5;
+    /*Codes_SRS_MQTT_CLIENT_07_138: [Once a trace ring is set the client shall record every control packet it receives the same way.]*/
+    tracePacket(mqtt_client, MQTT_TRACE_INCOMING, current_ms, (uint8_t)((uint8_t)packet | (flags & 0x0F)), packetData, (packetData == NULL) ? 0 : packetLength, headerLength + packetLength);
+}
+
+// data starts with the fixed header, the payload segments of a PUBLISH sent after its header go into the same frame
+static void captureOutgoingPacket(MQTT_CLIENT* mqtt_client, const uint8_t* data, size_t length, tickcounter_ms_t current_ms)
+{
+    const uint8_t* iterator = data + 1;
+    uint32_t remainingLength;
+    /*Codes_SRS_MQTT_CLIENT_07_142: [Once a capture is set the client shall write every control packet it sends or queues to the capture with its tick counter time.]*/
+    if (length == 0 || byteutil_readVariableInt(&iterator, data + length, &remainingLength) != 0 ||
+        mqtt_capture_begin_packet(mqtt_client->capture, MQTT_TRACE_OUTGOING, current_ms, (size_t)(iterator - data) + remainingLength) != 0 ||
+        mqtt_capture_append(mqtt_client->capture, data, length) != 0)
     {
-        if (mqtt_codec_bytesReceived(mqtt_client->codec_handle, buffer, size) != 0)
+        LogError("Failure capturing %lu sent bytes", (unsigned long)length);
+    }
+}
+
+static void captureOutgoingPayload(MQTT_CLIENT* mqtt_client, const uint8_t* data, size_t length)
+{
+    if (mqtt_capture_append(mqtt_client->capture, data, length) != 0)
+    {
+        LogError("Failure capturing %lu sent payload bytes", (unsigned long)length);
+    }
+}
+
+static void captureIncomingPacket(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE packet, int flags, const uint8_t* packetData, size_t packetLength, tickcounter_ms_t current_ms)
+{
+    // The codec hands over the packet without its fixed header, which is put back for the capture
+    uint8_t header[5];
+    size_t headerLength = 1;
+    size_t dataLength = (packetData == NULL) ? 0 : packetLength;
+    size_t remaining = dataLength;
+    header[0] = (uint8_t)((uint8_t)packet | (flags & 0x0F));
+    do
+    {
+        header[headerLength] = (uint8_t)(remaining & 0x7F);
+        remaining >>= 7;
+        if (remaining > 0)
         {
-            mqtt_codec_reset(mqtt_client->codec_handle);
-            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+            header[headerLength] |= 0x80;
         }
+        headerLength++;
+    } while (remaining > 0 && headerLength < sizeof(header));
+
+    /*Codes_SRS_MQTT_CLIENT_07_146: [Once a capture is set the client shall write every control packet it receives to the capture the same way.]*/
+    if (mqtt_capture_begin_packet(mqtt_client->capture, MQTT_TRACE_INCOMING, current_ms, headerLength + dataLength) != 0 ||
+        mqtt_capture_append(mqtt_client->capture, header, headerLength) != 0 ||
+        mqtt_capture_append(mqtt_client->capture, packetData, dataLength) != 0)
+    {
+        LogError("Failure capturing %lu received bytes", (unsigned long)dataLength);
+    }
+}
+
+static size_t getLatencyBucket(uint64_t latencyMs)
+{
+    size_t result;
+    if (latencyMs < LATENCY_SUB_BUCKETS)
+    {
+        result = (size_t)latencyMs;
     }
     else
     {
-        LogError("Error: mqtt_client is NULL");
+        // The bucket is chosen by the top bit and the two bits below it
+        size_t topBit = 2;
+        while (topBit < LATENCY_TOP_BIT_LIMIT && (latencyMs >> (topBit + 1)) != 0)
+        {
+            topBit++;
+        }
+        result = (topBit - 1) * LATENCY_SUB_BUCKETS + (size_t)((latencyMs >> (topBit - 2)) & (LATENCY_SUB_BUCKETS - 1));
+        if (result >= MQTT_CLIENT_LATENCY_BUCKET_COUNT)
+        {
+            result = MQTT_CLIENT_LATENCY_BUCKET_COUNT - 1;
+        }
     }
+    return result;
 }
 
-static void onIoError(void* context)
+// The largest latency that falls in bucket
+static uint64_t getLatencyBucketMaxMs(size_t bucket)
 {
-    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
-    if (mqtt_client != NULL && mqtt_client->fnOperationCallback)
+    uint64_t result;
+    if (bucket < LATENCY_SUB_BUCKETS)
     {
-        /*Codes_SRS_MQTT_CLIENT_07_032: [If the actionResult parameter is of type MQTT_CLIENT_ON_DISCONNECT the the msgInfo value shall be NULL.]*/
-        /* Codes_SRS_MQTT_CLIENT_07_036: [ If an error is encountered by the ioHandle the mqtt_client shall call xio_close. ] */
-        set_error_callback(mqtt_client, MQTT_CLIENT_CONNECTION_ERROR);
+        result = bucket;
     }
     else
     {
-        LogError("Error invalid parameter: mqtt_client: %p", mqtt_client);
+        size_t topBit = bucket / LATENCY_SUB_BUCKETS + 1;
+        result = ((uint64_t)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS + 1) << (topBit - 2)) - 1;
     }
+    return result;
 }
 
-static void clear_mqtt_options(MQTT_CLIENT* mqtt_client)
+static void recordLatency(MQTT_CLIENT_LATENCY_HISTOGRAM* histogram, uint64_t latencyMs)
 {
-    if (mqtt_client->mqttOptions.clientId != NULL)
+    STATS_ADD(&histogram->buckets[getLatencyBucket(latencyMs)], 1);
+    STATS_ADD(&histogram->totalMs, latencyMs);
+    if (latencyMs > STATS_LOAD(&histogram->maxMs))
     {
-        free(mqtt_client->mqttOptions.clientId);
-        mqtt_client->mqttOptions.clientId = NULL;
+        STATS_STORE(&histogram->maxMs, latencyMs);
     }
+    STATS_ADD(&histogram->count, 1);
+}
 
-    if (mqtt_client->mqttOptions.willTopic != NULL)
+// The slot timing packetId, or NULL if none of the slots it may use does
+static LATENCY_PENDING* findLatency(LATENCY_TRACKER* latency, CONTROL_PACKET_TYPE packetType, uint16_t packetId)
+{
+    LATENCY_PENDING* result = NULL;
+    size_t probe;
+    for (probe = 0; probe < LATENCY_PROBE_SLOTS && result == NULL; probe++)
     {
-        free(mqtt_client->mqttOptions.willTopic);
-        mqtt_client->mqttOptions.willTopic = NULL;
+        LATENCY_PENDING* slot = &latency->pending[(packetId + probe) & (LATENCY_PENDING_SLOTS - 1)];
+        if (slot->packetType == (uint8_t)packetType && slot->packetId == packetId)
+        {
+            result = slot;
+        }
     }
+    return result;
+}
 
-    if (mqtt_client->mqttOptions.willMessage != NULL)
+// A PUBLISH sent again keeps the time it was first sent at
+static void startLatency(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE packetType, uint16_t packetId, bool isResend)
+{
+    uint32_t sentMs = (uint32_t)mqtt_client->latency.lastSentMs;
+    LATENCY_PENDING* pending = findLatency(&mqtt_client->latency, packetType, packetId);
+    if (pending == NULL)
     {
-        free(mqtt_client->mqttOptions.willMessage);
-        mqtt_client->mqttOptions.willMessage = NULL;
+        size_t probe;
+        // The first free slot, else the one that has waited longest
+        for (probe = 0; probe < LATENCY_PROBE_SLOTS && (pending == NULL || pending->packetType != 0); probe++)
+        {
+            LATENCY_PENDING* slot = &mqtt_client->latency.pending[(packetId + probe) & (LATENCY_PENDING_SLOTS - 1)];
+            if (pending == NULL || slot->packetType == 0 || (uint32_t)(sentMs - slot->sentMs) > (uint32_t)(sentMs - pending->sentMs))
+            {
+                pending = slot;
+            }
+        }
+        if (pending->packetType != 0)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_168: [When more packets wait for their ack than the client can time, the one that has waited longest shall not be measured and shall be counted in latencyDropped.]*/
+            STATS_ADD(&mqtt_client->stats.latencyDropped, 1);
+        }
+        pending->packetId = packetId;
+        pending->packetType = (uint8_t)packetType;
+        pending->sentMs = sentMs;
     }
-
-    if (mqtt_client->mqttOptions.username != NULL)
+    else if (!isResend)
     {
-        free(mqtt_client->mqttOptions.username);
-        mqtt_client->mqttOptions.username = NULL;
+        pending->sentMs = sentMs;
     }
+}
 
-    if (mqtt_client->mqttOptions.password != NULL)
+static void endLatency(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE packetType, uint16_t packetId, MQTT_CLIENT_LATENCY_HISTOGRAM* histogram)
+{
+    LATENCY_PENDING* pending = findLatency(&mqtt_client->latency, packetType, packetId);
+    tickcounter_ms_t current_ms;
+    if (pending != NULL && getCurrentMs(mqtt_client, &current_ms) == 0)
     {
-        free(mqtt_client->mqttOptions.password);
-        mqtt_client->mqttOptions.password = NULL;
+        /*Codes_SRS_MQTT_CLIENT_07_152: [On a PUBACK, PUBCOMP or SUBACK the client shall add the time since it first sent the PUBLISH or SUBSCRIBE with that packet id to publishToPuback, publishToPubcomp or subscribeToSuback.]*/
+        recordLatency(histogram, (uint32_t)((uint32_t)current_ms - pending->sentMs));
+        pending->packetType = 0;
     }
 }
 
-static int cloneMqttOptions(MQTT_CLIENT* mqtt_client, const MQTT_CLIENT_OPTIONS* mqttOptions)
+static void countOutgoingPacket(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE packetType, size_t length, tickcounter_ms_t current_ms)
 {
-    int result = 0;
-    char* temp_option;
+    /*Codes_SRS_MQTT_CLIENT_07_149: [The client shall count every control packet it sends or queues by its type, and the bytes it sends or queues.]*/
+    STATS_ADD(&mqtt_client->stats.packetsSent[((uint8_t)packetType >> 4) & (MQTT_CLIENT_PACKET_TYPE_COUNT - 1)], 1);
+    STATS_ADD(&mqtt_client->stats.bytesSent, length);
+    mqtt_client->latency.lastSentMs = current_ms;
+}
 
-    if (mqttOptions->clientId != NULL)
+static void countIncomingPacket(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE packet, const uint8_t* packetData, size_t packetLength)
+{
+    /*Codes_SRS_MQTT_CLIENT_07_150: [The client shall count every control packet it receives by its type, and the bytes the transport hands to it.]*/
+    STATS_ADD(&mqtt_client->stats.packetsReceived[((uint8_t)packet >> 4) & (MQTT_CLIENT_PACKET_TYPE_COUNT - 1)], 1);
+    if (packet == PINGRESP_TYPE)
     {
-        if (mallocAndStrcpy_s(&temp_option, mqttOptions->clientId) != 0)
-        {
-            result = MU_FAILURE;
-            LogError("mallocAndStrcpy_s clientId");
-        }
-        else
+        tickcounter_ms_t current_ms;
+        if (mqtt_client->timeSincePing > 0 && getCurrentMs(mqtt_client, &current_ms) == 0)
         {
-            if (mqtt_client->mqttOptions.clientId != NULL)
-            {
-                free(mqtt_client->mqttOptions.clientId);
-            }
-            mqtt_client->mqttOptions.clientId = temp_option;
+            /*Codes_SRS_MQTT_CLIENT_07_153: [On a PINGRESP the client shall add the time since it sent the PINGREQ to pingreqToPingresp.]*/
+            recordLatency(&mqtt_client->stats.pingreqToPingresp, current_ms - mqtt_client->timeSincePing);
         }
     }
-    if (result == 0 && mqttOptions->willTopic != NULL)
+    else if ((packet == PUBACK_TYPE || packet == PUBCOMP_TYPE || packet == SUBACK_TYPE) && packetData != NULL && packetLength >= 2)
     {
-        temp_option = NULL;
-        if (mallocAndStrcpy_s(&temp_option, mqttOptions->willTopic) != 0)
+        uint16_t packetId = (uint16_t)(((uint16_t)packetData[0] << 8) | packetData[1]);
+        endLatency(mqtt_client, (packet == SUBACK_TYPE) ? SUBSCRIBE_TYPE : PUBLISH_TYPE, packetId,
+            (packet == PUBACK_TYPE) ? &mqtt_client->stats.publishToPuback :
+            (packet == PUBCOMP_TYPE) ? &mqtt_client->stats.publishToPubcomp : &mqtt_client->stats.subscribeToSuback);
+    }
+}
+
+static int flushOutboundQueue(MQTT_CLIENT* mqtt_client)
+{
+    int result = 0;
+    size_t length = mqtt_client->outbound.length;
+    if (length > 0)
+    {
+        mqtt_client->outbound.length = 0;
+        if (xio_send(mqtt_client->xioHandle, (const void*)mqtt_client->outbound.buffer, length, sendComplete, mqtt_client) != 0)
         {
+            LogError("Failure sending %lu bytes of queued control packets", (unsigned long)length);
             result = MU_FAILURE;
-            LogError("mallocAndStrcpy_s willTopic");
         }
-        else
+        else if (getCurrentMs(mqtt_client, &mqtt_client->packetSendTimeMs) != 0)
         {
-            if (mqtt_client->mqttOptions.willTopic != NULL)
-            {
-                free(mqtt_client->mqttOptions.willTopic);
-            }
-            mqtt_client->mqttOptions.willTopic = temp_option;
+            LogError("Failure getting current ms tickcounter");
+            result = MU_FAILURE;
         }
     }
-    if (result == 0 && mqttOptions->willMessage != NULL)
+    return result;
+}
+
+static int sendPacketItem(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE packetType, const unsigned char* data, size_t length)
+{
+    int result;
+
+    // Anything already queued has to reach the wire first
+    if (flushOutboundQueue(mqtt_client) != 0)
     {
-        temp_option = NULL;
-        if (mallocAndStrcpy_s(&temp_option, mqttOptions->willMessage) != 0)
+        result = MU_FAILURE;
+    }
+    else
+    {
+        result = xio_send(mqtt_client->xioHandle, (const void*)data, length, sendComplete, mqtt_client);
+    }
+
+    if (result != 0)
+    {
+        LogError("Failure sending control packet data");
+        result = MU_FAILURE;
+    }
+    else
+    {
+#ifdef ENABLE_RAW_TRACE
+        logOutgoingRawTrace(mqtt_client, (const uint8_t*)data, length);
+#endif
+
+        if (getCurrentMs(mqtt_client, &mqtt_client->packetSendTimeMs) != 0)
         {
-            LogError("mallocAndStrcpy_s willMessage");
+            LogError("Failure getting current ms tickcounter");
             result = MU_FAILURE;
         }
         else
         {
-            if (mqtt_client->mqttOptions.willMessage != NULL)
+            countOutgoingPacket(mqtt_client, packetType, length, mqtt_client->packetSendTimeMs);
+            if (mqtt_client->traceRing != NULL)
             {
-                free(mqtt_client->mqttOptions.willMessage);
+                traceOutgoingPacket(mqtt_client, (const uint8_t*)data, length, mqtt_client->packetSendTimeMs);
+            }
+            if (mqtt_client->capture != NULL)
+            {
+                captureOutgoingPacket(mqtt_client, (const uint8_t*)data, length, mqtt_client->packetSendTimeMs);
             }
-            mqtt_client->mqttOptions.willMessage = temp_option;
         }
     }
-    if (result == 0 && mqttOptions->username != NULL)
+
+    return result;
+}
+
+static int queuePacketItem(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE packetType, const unsigned char* data, size_t length)
+{
+    int result;
+    OUTBOUND_QUEUE* outbound = &mqtt_client->outbound;
+    tickcounter_ms_t current_ms;
+
+    if (outbound->capacity == 0 || length > outbound->capacity || !(mqtt_client->mqtt_status & MQTT_STATUS_CLIENT_CONNECTED))
     {
-        temp_option = NULL;
-        if (mallocAndStrcpy_s(&temp_option, mqttOptions->username) != 0)
+        result = sendPacketItem(mqtt_client, packetType, data, length);
+    }
+    else if (outbound->length + length > outbound->capacity && flushOutboundQueue(mqtt_client) != 0)
+    {
+        result = MU_FAILURE;
+    }
+    else if (getCurrentMs(mqtt_client, &current_ms) != 0)
+    {
+        LogError("Failure getting current ms tickcounter");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_046: [When send coalescing is on and the client is connected, control packets shall be appended to the outbound queue instead of being sent on their own.]*/
+        (void)memcpy(outbound->buffer + outbound->length, data, length);
+        if (outbound->length == 0)
         {
-            LogError("mallocAndStrcpy_s username");
-            result = MU_FAILURE;
+            outbound->firstQueuedMs = current_ms;
         }
-        else
+        outbound->length += length;
+        countOutgoingPacket(mqtt_client, packetType, length, current_ms);
+        if (mqtt_client->traceRing != NULL)
         {
-            if (mqtt_client->mqttOptions.username != NULL)
-            {
-                free(mqtt_client->mqttOptions.username);
-            }
-            mqtt_client->mqttOptions.username = temp_option;
+            traceOutgoingPacket(mqtt_client, (const uint8_t*)data, length, current_ms);
         }
-    }
-    if (result == 0 && mqttOptions->password != NULL)
-    {
-        temp_option = NULL;
-        if (mallocAndStrcpy_s(&temp_option, mqttOptions->password) != 0)
+        if (mqtt_client->capture != NULL)
         {
-            LogError("mallocAndStrcpy_s password");
-            result = MU_FAILURE;
+            captureOutgoingPacket(mqtt_client, (const uint8_t*)data, length, current_ms);
+        }
+#ifdef ENABLE_RAW_TRACE
+        logOutgoingRawTrace(mqtt_client, (const uint8_t*)data, length);
+#endif
+
+        /*Codes_SRS_MQTT_CLIENT_07_047: [The outbound queue shall be sent in a single xio_send once it is full or once its oldest packet has waited maxLatencyMs.]*/
+        if (outbound->length == outbound->capacity || (current_ms - outbound->firstQueuedMs) >= outbound->maxLatencyMs)
+        {
+            result = flushOutboundQueue(mqtt_client);
         }
         else
         {
-            if (mqtt_client->mqttOptions.password != NULL)
-            {
-                free(mqtt_client->mqttOptions.password);
-            }
-            mqtt_client->mqttOptions.password = temp_option;
+            result = 0;
         }
     }
-    if (result == 0)
+    return result;
+}
+
+static void setPacketIdUsed(INFLIGHT_STORE* store, uint16_t packetId, bool used)
+{
+    if (used)
     {
-        mqtt_client->mqttOptions.keepAliveInterval = mqttOptions->keepAliveInterval;
-        mqtt_client->mqttOptions.messageRetain = mqttOptions->messageRetain;
-        mqtt_client->mqttOptions.useCleanSession = mqttOptions->useCleanSession;
-        mqtt_client->mqttOptions.qualityOfServiceValue = mqttOptions->qualityOfServiceValue;
+        store->usedIds[packetId / 32] |= ((uint32_t)1 << (packetId % 32));
     }
     else
     {
-        clear_mqtt_options(mqtt_client);
+        store->usedIds[packetId / 32] &= ~((uint32_t)1 << (packetId % 32));
+    }
+}
+
+// Finds the first free id at or after nextPacketId, a word at a time. With the window
+// far below the id space the first word almost always has a free bit.
+static int allocatePacketId(INFLIGHT_STORE* store, uint16_t* packetId)
+{
+    int result = MU_FAILURE;
+    size_t word = store->nextPacketId / 32;
+    uint32_t freeBits = ~store->usedIds[word] & ~(((uint32_t)1 << (store->nextPacketId % 32)) - 1);
+    size_t index;
+
+    for (index = 0; index <= PACKET_ID_BITMAP_WORDS; index++)
+    {
+        if (freeBits != 0)
+        {
+            uint16_t bit = 0;
+            while ((freeBits & ((uint32_t)1 << bit)) == 0)
+            {
+                bit++;
+            }
+            *packetId = (uint16_t)(word * 32 + bit);
+            setPacketIdUsed(store, *packetId, true);
+            store->nextPacketId = (*packetId == UINT16_MAX) ? 1 : (uint16_t)(*packetId + 1);
+            result = 0;
+            break;
+        }
+        word = (word + 1) % PACKET_ID_BITMAP_WORDS;
+        freeBits = ~store->usedIds[word];
     }
     return result;
 }
 
-static void SendMessageAck(MQTT_CLIENT* mqtt_client, uint16_t packetId, QOS_VALUE qosValue)
+static size_t findInflightSlot(INFLIGHT_STORE* store, uint16_t packetId)
 {
-    CONTROL_PACKET_TYPE response_packet_type = UNKNOWN_TYPE;
-    BUFFER_HANDLE pubRel = NULL;
-    (void)response_packet_type;
-    if (qosValue == DELIVER_EXACTLY_ONCE)
+    size_t result = INFLIGHT_NO_SLOT;
+    size_t bucket = packetId & store->slotIndexMask;
+    while (store->slotIndex[bucket] != 0)
     {
-        pubRel = mqtt_codec_publishReceived(packetId);
-        if (pubRel == NULL)
+        if (store->entries[store->slotIndex[bucket] - 1].packetId == packetId)
         {
-            LogError("Failed to allocate publish receive message.");
-            set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+            result = store->slotIndex[bucket] - 1;
+            break;
         }
+        bucket = (bucket + 1) & store->slotIndexMask;
+    }
+    return result;
+}
 
-        response_packet_type = PUBREC_TYPE;
+static void unlinkInflightSlot(INFLIGHT_STORE* store, size_t slot)
+{
+    INFLIGHT_ENTRY* entry = &store->entries[slot];
+    if (entry->prev == INFLIGHT_NO_SLOT)
+    {
+        store->oldest = entry->next;
     }
-    else if (qosValue == DELIVER_AT_LEAST_ONCE)
+    else
+    {
+        store->entries[entry->prev].next = entry->next;
+    }
+    if (entry->next == INFLIGHT_NO_SLOT)
+    {
+        store->newest = entry->prev;
+    }
+    else
+    {
+        store->entries[entry->next].prev = entry->prev;
+    }
+}
+
+static void appendInflightSlot(INFLIGHT_STORE* store, size_t slot)
+{
+    store->entries[slot].prev = store->newest;
+    store->entries[slot].next = INFLIGHT_NO_SLOT;
+    if (store->newest == INFLIGHT_NO_SLOT)
+    {
+        store->oldest = slot;
+    }
+    else
+    {
+        store->entries[store->newest].next = slot;
+    }
+    store->newest = slot;
+}
+
+static void removeInflightSlot(INFLIGHT_STORE* store, size_t slot)
+{
+    size_t bucket = store->entries[slot].packetId & store->slotIndexMask;
+    size_t next;
+
+    while (store->slotIndex[bucket] != slot + 1)
     {
-        pubRel = mqtt_codec_publishAck(packetId);
-        if (pubRel == NULL)
+        bucket = (bucket + 1) & store->slotIndexMask;
+    }
+
+    // Backward shift deletion keeps every probe sequence free of holes
+    store->slotIndex[bucket] = 0;
+    next = (bucket + 1) & store->slotIndexMask;
+    while (store->slotIndex[next] != 0)
+    {
+        size_t home = store->entries[store->slotIndex[next] - 1].packetId & store->slotIndexMask;
+        if (((next - home) & store->slotIndexMask) >= ((next - bucket) & store->slotIndexMask))
         {
-            LogError("Failed to allocate publish ack message.");
-            set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+            store->slotIndex[bucket] = store->slotIndex[next];
+            store->slotIndex[next] = 0;
+            bucket = next;
         }
+        next = (next + 1) & store->slotIndexMask;
+    }
 
-        response_packet_type = PUBACK_TYPE;
+    if (store->entries[slot].msgHandle != NULL)
+    {
+        mqttmessage_destroy(store->entries[slot].msgHandle);
+        store->entries[slot].msgHandle = NULL;
+    }
+    setPacketIdUsed(store, store->entries[slot].packetId, false);
+    unlinkInflightSlot(store, slot);
+    store->entries[slot].next = store->freeSlot;
+    store->freeSlot = slot;
+    store->count--;
+}
+
+static size_t insertInflightMessage(INFLIGHT_STORE* store, MQTT_MESSAGE_HANDLE stored, uint16_t packetId, tickcounter_ms_t sentMs)
+{
+    size_t result = store->freeSlot;
+    size_t bucket = packetId & store->slotIndexMask;
+
+    setPacketIdUsed(store, packetId, true);
+    store->freeSlot = store->entries[result].next;
+    store->entries[result].msgHandle = stored;
+    store->entries[result].packetId = packetId;
+    store->entries[result].sentMs = sentMs;
+    appendInflightSlot(store, result);
+    while (store->slotIndex[bucket] != 0)
+    {
+        bucket = (bucket + 1) & store->slotIndexMask;
+    }
+    store->slotIndex[bucket] = result + 1;
+    store->count++;
+    return result;
+}
+
+// maxInflight, or the receive maximum of an MQTT 5 server when that is smaller
+static size_t getInflightLimit(const MQTT_CLIENT* mqtt_client)
+{
+    size_t result = mqtt_client->inflight.maxInflight;
+    /*Codes_SRS_MQTT_CLIENT_07_094: [The in-flight window shall be limited to the receive maximum of the server when it is smaller than maxInflight.]*/
+    if (mqtt_client->server.receiveMaximum != 0 && mqtt_client->server.receiveMaximum < result)
+    {
+        result = mqtt_client->server.receiveMaximum;
     }
+    return result;
+}
+
+// Gives msgHandle a free packet id and keeps a copy of it until the publish is acknowledged
+static size_t addInflightMessage(MQTT_CLIENT* mqtt_client, MQTT_MESSAGE_HANDLE msgHandle, uint16_t* packetId)
+{
+    size_t result = INFLIGHT_NO_SLOT;
+    INFLIGHT_STORE* store = &mqtt_client->inflight;
+    tickcounter_ms_t current_ms;
 
-    if (pubRel != NULL)
+    if (store->count >= getInflightLimit(mqtt_client))
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_055: [If maxInflight messages are already in flight then mqtt_client_publish shall return a non-zero value.]*/
+        LogError("In-flight window of %lu messages is full", (unsigned long)getInflightLimit(mqtt_client));
+    }
+    else if (getCurrentMs(mqtt_client, &current_ms) != 0)
+    {
+        LogError("Failure getting current ms tickcounter");
+    }
+    else if (allocatePacketId(store, packetId) != 0)
+    {
+        LogError("No free packet id");
+    }
+    else
     {
-        size_t size = BUFFER_length(pubRel);
-        if (sendPacketItem(mqtt_client, BUFFER_u_char(pubRel), size) != 0)
+        MQTT_MESSAGE_HANDLE stored;
+        if (mqttmessage_setPacketId(msgHandle, *packetId) != 0 || (stored = mqttmessage_clone(msgHandle)) == NULL)
         {
-            LogError("Failed sending publish reply.");
-            set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+            LogError("Failure storing in-flight message");
+            setPacketIdUsed(store, *packetId, false);
         }
-#ifndef NO_LOGGING
-        else if (is_trace_enabled(mqtt_client))
+        else
         {
-            STRING_HANDLE ack_trace_log = STRING_construct_sprintf("%s | PACKET_ID: %"PRIu16, 
-                response_packet_type == PUBACK_TYPE ? "PUBACK" : ((response_packet_type == PUBREC_TYPE) ? "PUBREC" : "UNDEFINED"),
-                packetId);
+            result = insertInflightMessage(store, stored, *packetId, current_ms);
+        }
+    }
+    return result;
+}
 
-            log_outgoing_trace(mqtt_client, ack_trace_log);
-            STRING_delete(ack_trace_log);
+static void clearInflightStore(INFLIGHT_STORE* store)
+{
+    while (store->count > 0)
+    {
+        removeInflightSlot(store, store->oldest);
+    }
+    if (store->entries != NULL)
+    {
+        free(store->entries);
+    }
+    memset(store, 0, sizeof(INFLIGHT_STORE));
+    store->oldest = INFLIGHT_NO_SLOT;
+    store->newest = INFLIGHT_NO_SLOT;
+}
+
+static void acknowledgeInflightMessage(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE packet, uint16_t packetId)
+{
+    INFLIGHT_STORE* store = &mqtt_client->inflight;
+    size_t slot = findInflightSlot(store, packetId);
+    if (slot != INFLIGHT_NO_SLOT)
+    {
+        if (packet == PUBREC_TYPE)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_057: [On PUBREC the in-flight message shall be released and its PUBREL shall be resent in its place until PUBCOMP is received.]*/
+            /*Codes_SRS_MQTT_CLIENT_07_064: [When a session store is set, the stored PUBLISH shall be replaced by a PUBREL record on PUBREC and removed on PUBACK or PUBCOMP.]*/
+            if (mqtt_client->sessionStore != NULL && mqtt_session_store_save(mqtt_client->sessionStore, MQTT_SESSION_RECORD_PUBREL, packetId, NULL, 0) != 0)
+            {
+                LogError("Failure storing PUBREL %" PRIu16, packetId);
+            }
+            if (store->entries[slot].msgHandle != NULL)
+            {
+                mqttmessage_destroy(store->entries[slot].msgHandle);
+                store->entries[slot].msgHandle = NULL;
+            }
+            if (getCurrentMs(mqtt_client, &store->entries[slot].sentMs) != 0)
+            {
+                LogError("Failure getting current ms tickcounter");
+            }
+            unlinkInflightSlot(store, slot);
+            appendInflightSlot(store, slot);
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_056: [On PUBACK or PUBCOMP the in-flight message with that packet id shall be removed and the packet id freed.]*/
+            /*Codes_SRS_MQTT_CLIENT_07_064: [When a session store is set, the stored PUBLISH shall be replaced by a PUBREL record on PUBREC and removed on PUBACK or PUBCOMP.]*/
+            if (mqtt_client->sessionStore != NULL && mqtt_session_store_remove(mqtt_client->sessionStore, MQTT_SESSION_RECORD_PUBLISH, packetId) != 0)
+            {
+                LogError("Failure removing stored message %" PRIu16, packetId);
+            }
+            removeInflightSlot(store, slot);
         }
-#endif
-        BUFFER_delete(pubRel);
     }
 }
 
-static void ProcessPublishMessage(MQTT_CLIENT* mqtt_client, uint8_t* initialPos, size_t packetLength, int flags)
+// The alias topic is sent with on this connection, *isNewAlias when the server hasn't been told about it yet.
+// Zero once the server's topic alias maximum is used up or for a topic that isn't interned.
+static uint16_t getTopicAlias(const MQTT_CLIENT* mqtt_client, MQTT_TOPIC_HANDLE topic, bool* isNewAlias)
 {
-    bool isDuplicateMsg = (flags & DUPLICATE_FLAG_MASK) ? true : false;
-    bool isRetainMsg = (flags & RETAIN_FLAG_MASK) ? true : false;
-    QOS_VALUE qosValue = (flags == 0) ? DELIVER_AT_MOST_ONCE : (flags & QOS_LEAST_ONCE_FLAG_MASK) ? DELIVER_AT_LEAST_ONCE : DELIVER_EXACTLY_ONCE;
+    uint16_t result = 0;
+    *isNewAlias = false;
+    if (topic != NULL && mqtt_client->server.topicAliasMaximum > 0)
+    {
+        result = mqtt_topic_get_alias(topic);
+        if (result == 0 && mqtt_client->server.nextTopicAlias <= mqtt_client->server.topicAliasMaximum)
+        {
+            result = mqtt_client->server.nextTopicAlias;
+            *isNewAlias = true;
+        }
+    }
+    return result;
+}
 
-    uint8_t* iterator = initialPos;
-    size_t numberOfBytesToBeRead = packetLength;
-    size_t lengthOfTopicName = numberOfBytesToBeRead;
-    char* topicName = byteutil_readUTF(&iterator, &lengthOfTopicName);
-    if (topicName == NULL)
+// Records the alias getTopicAlias gave topic once the packet that sets it up was sent
+static void commitTopicAlias(MQTT_CLIENT* mqtt_client, MQTT_TOPIC_HANDLE topic)
+{
+    bool isNewAlias;
+    uint16_t alias = getTopicAlias(mqtt_client, topic, &isNewAlias);
+    if (isNewAlias && mqtt_topic_set_alias(topic, alias) == 0)
     {
-        LogError("Publish MSG: failure reading topic name");
-        set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+        mqtt_client->server.nextTopicAlias++;
+    }
+}
+
+static bool exceedsMaximumPacketSize(const MQTT_CLIENT* mqtt_client, BUFFER_HANDLE packet)
+{
+    return mqtt_client->server.maximumPacketSize != 0 && BUFFER_length(packet) > mqtt_client->server.maximumPacketSize;
+}
+
+// Encodes a PUBLISH for an MQTT 5 connection, with a topic alias when the topic has one
+static BUFFER_HANDLE encodePublishPacketV5(const MQTT_CLIENT* mqtt_client, MQTT_TOPIC_HANDLE topic, const char* topicName, QOS_VALUE qos, bool isDuplicate, bool isRetained, uint16_t packetId, const APP_PAYLOAD* payload, STRING_HANDLE trace_log)
+{
+    BUFFER_HANDLE result;
+    bool isNewAlias;
+    uint16_t alias = getTopicAlias(mqtt_client, topic, &isNewAlias);
+    size_t nameLength = 0;
+
+    if (topic != NULL)
+    {
+        topicName = mqtt_topic_get_name(topic, &nameLength);
+    }
+    else if (topicName != NULL)
+    {
+        nameLength = strlen(topicName);
+    }
+
+    /*Codes_SRS_MQTT_CLIENT_07_093: [While the server's topic alias maximum allows, a message on an interned topic shall get the next topic alias the first time it is sent on the connection, sent with its topic name, and be sent with the alias alone afterwards.]*/
+    if (alias != 0 && !isNewAlias)
+    {
+        topicName = NULL;
+        nameLength = 0;
+    }
+    result = mqtt_codec_publish_v5(qos, isDuplicate, isRetained, packetId, topicName, nameLength, alias, payload->message, payload->length, trace_log);
+    /*Codes_SRS_MQTT_CLIENT_07_095: [If the server set a maximum packet size and the PUBLISH packet is larger then mqtt_client_publish and mqtt_client_publish_iov shall return a non-zero value.]*/
+    if (result != NULL && exceedsMaximumPacketSize(mqtt_client, result))
+    {
+        LogError("PUBLISH packet is larger than the server maximum of %" PRIu32 " bytes", mqtt_client->server.maximumPacketSize);
+        BUFFER_delete(result);
+        result = NULL;
+    }
+    return result;
+}
+
+// topic is the interned topic of the message, or NULL to encode topicName
+static BUFFER_HANDLE encodePublishPacket(MQTT_TOPIC_HANDLE topic, const char* topicName, QOS_VALUE qos, bool isDuplicate, bool isRetained, uint16_t packetId, const APP_PAYLOAD* payload, STRING_HANDLE trace_log)
+{
+    BUFFER_HANDLE result;
+    if (topic != NULL)
+    {
+        size_t encodedLength;
+        const uint8_t* encodedTopic = mqtt_topic_get_encoded(topic, &encodedLength);
+        result = mqtt_codec_publish_encoded_topic(qos, isDuplicate, isRetained, packetId, encodedTopic, encodedLength, payload->message, payload->length, trace_log);
     }
     else
     {
-        STRING_HANDLE trace_log = NULL;
+        result = mqtt_codec_publish(qos, isDuplicate, isRetained, packetId, topicName, payload->message, payload->length, trace_log);
+    }
+    return result;
+}
 
-#ifndef NO_LOGGING
-        if (is_trace_enabled(mqtt_client))
+static void resendInflightMessages(MQTT_CLIENT* mqtt_client, tickcounter_ms_t current_ms)
+{
+    INFLIGHT_STORE* store = &mqtt_client->inflight;
+    size_t remaining = store->count;
+
+    /*Codes_SRS_MQTT_CLIENT_07_058: [mqtt_client_dowork shall resend every in-flight message that has waited retryTimeoutMs, with the DUP flag set through mqttmessage_setIsDuplicateMsg, or its PUBREL once PUBREC was received.]*/
+    /*Codes_SRS_MQTT_CLIENT_07_066: [After a CONNACK accepting the connection or a session restore, mqtt_client_dowork shall resend every in-flight message once whatever retryTimeoutMs is.]*/
+    while (remaining > 0 && (store->resendAll || (current_ms - store->entries[store->oldest].sentMs) >= store->retryTimeoutMs))
+    {
+        size_t slot = store->oldest;
+        INFLIGHT_ENTRY* entry = &store->entries[slot];
+        BUFFER_HANDLE packet = NULL;
+        uint8_t pubRel[MQTT_CODEC_PUBLISH_REPLY_SIZE];
+        bool isPubRel = false;
+
+        if (entry->msgHandle == NULL)
         {
-            trace_log = STRING_construct_sprintf("PUBLISH | IS_DUP: %s | RETAIN: %d | QOS: %s | TOPIC_NAME: %s", isDuplicateMsg ? TRUE_CONST : FALSE_CONST,
-                isRetainMsg ? 1 : 0, MU_ENUM_TO_STRING(QOS_VALUE, qosValue), topicName);
+            isPubRel = (mqtt_codec_encode_pubrel(entry->packetId, pubRel) == 0);
         }
-#endif
-        uint16_t packetId = 0;
-        numberOfBytesToBeRead = packetLength - (iterator - initialPos);
-        if (qosValue != DELIVER_AT_MOST_ONCE)
+        else
         {
-            packetId = byteutil_read_uint16(&iterator, numberOfBytesToBeRead);
-#ifndef NO_LOGGING
-            if (is_trace_enabled(mqtt_client))
+            const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(entry->msgHandle);
+            if (payload == NULL || mqttmessage_setIsDuplicateMsg(entry->msgHandle, true) != 0)
             {
-                STRING_sprintf(trace_log, " | PACKET_ID: %"PRIu16, packetId);
+                packet = NULL;
+            }
+            else
+            {
+                QOS_VALUE qos = mqttmessage_getQosType(entry->msgHandle);
+                bool isRetained = mqttmessage_getIsRetained(entry->msgHandle);
+                MQTT_TOPIC_HANDLE topic = mqttmessage_getInternedTopic(entry->msgHandle);
+                const char* topicName = (topic == NULL) ? mqttmessage_getTopicName(entry->msgHandle) : NULL;
+                packet = is_protocol_v5(mqtt_client) ?
+                    encodePublishPacketV5(mqtt_client, topic, topicName, qos, true, isRetained, entry->packetId, payload, NULL) :
+                    encodePublishPacket(topic, topicName, qos, true, isRetained, entry->packetId, payload, NULL);
             }
-#endif
         }
-        if ((qosValue != DELIVER_AT_MOST_ONCE) && (packetId == 0))
+
+        if (packet == NULL && !isPubRel)
         {
-            LogError("Publish MSG: packetId=0, invalid");
-            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+            LogError("Failure encoding in-flight message %" PRIu16, entry->packetId);
+            set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+            break;
         }
         else
         {
-            numberOfBytesToBeRead = packetLength - (iterator - initialPos);
-
-            MQTT_MESSAGE_HANDLE msgHandle = mqttmessage_create_in_place(packetId, topicName, qosValue, iterator, numberOfBytesToBeRead);
-            if (msgHandle == NULL)
+            int send_result;
+            if (isPubRel)
             {
-                LogError("failure in mqttmessage_create");
-                set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
-            }
-            else if (mqttmessage_setIsDuplicateMsg(msgHandle, isDuplicateMsg) != 0 ||
-                     mqttmessage_setIsRetained(msgHandle, isRetainMsg) != 0)
-            {
-                LogError("failure setting mqtt message property");
-                set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+                send_result = queuePacketItem(mqtt_client, PUBREL_TYPE, pubRel, MQTT_CODEC_PUBLISH_REPLY_SIZE);
             }
             else
             {
-#ifndef NO_LOGGING
-                if (is_trace_enabled(mqtt_client))
-                {
-                    STRING_sprintf(trace_log, " | PAYLOAD_LEN: %lu", (unsigned long)numberOfBytesToBeRead);
-                    log_incoming_trace(mqtt_client, trace_log);
-                }
-#endif
-                MQTT_CLIENT_ACK_OPTION ack_option = mqtt_client->fnMessageRecv(msgHandle, mqtt_client->ctx);
-
-                if (ack_option == MQTT_CLIENT_ACK_SYNC)
+                size_t size = BUFFER_length(packet);
+                send_result = queuePacketItem(mqtt_client, PUBLISH_TYPE, BUFFER_u_char(packet), size);
+                BUFFER_delete(packet);
+                if (send_result == 0)
                 {
-                    SendMessageAck(mqtt_client, packetId, qosValue);
+                    startLatency(mqtt_client, PUBLISH_TYPE, entry->packetId, true);
                 }
             }
-            mqttmessage_destroy(msgHandle);
+            if (send_result != 0)
+            {
+                LogError("Failure resending in-flight message %" PRIu16, entry->packetId);
+                set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                break;
+            }
+            if (entry->msgHandle != NULL && is_protocol_v5(mqtt_client))
+            {
+                commitTopicAlias(mqtt_client, mqttmessage_getInternedTopic(entry->msgHandle));
+            }
+            entry->sentMs = current_ms;
+            unlinkInflightSlot(store, slot);
+            appendInflightSlot(store, slot);
+            remaining--;
         }
+    }
+    store->resendAll = false;
+}
 
-        if (trace_log != NULL)
+static bool isAwaitingAck(const RECEIVE_CREDIT* receiveCredit, uint16_t packetId)
+{
+    return receiveCredit->awaitingIds != NULL && (receiveCredit->awaitingIds[packetId / 32] & ((uint32_t)1 << (packetId % 32))) != 0;
+}
+
+static void setAwaitingAck(RECEIVE_CREDIT* receiveCredit, uint16_t packetId, bool awaiting)
+{
+    if (receiveCredit->awaitingIds != NULL && isAwaitingAck(receiveCredit, packetId) != awaiting)
+    {
+        if (awaiting)
         {
-            STRING_delete(trace_log);
+            receiveCredit->awaitingIds[packetId / 32] |= ((uint32_t)1 << (packetId % 32));
+            receiveCredit->outstanding++;
+        }
+        else
+        {
+            receiveCredit->awaitingIds[packetId / 32] &= ~((uint32_t)1 << (packetId % 32));
+            receiveCredit->outstanding--;
         }
+    }
+}
 
-        free(topicName);
+static void forgetAwaitingAcks(RECEIVE_CREDIT* receiveCredit)
+{
+    if (receiveCredit->awaitingIds != NULL)
+    {
+        (void)memset(receiveCredit->awaitingIds, 0, PACKET_ID_BITMAP_WORDS * sizeof(uint32_t));
     }
+    receiveCredit->outstanding = 0;
 }
 
-static void recvCompleteCallback(void* context, CONTROL_PACKET_TYPE packet, int flags, BUFFER_HANDLE headerData)
+static bool isReceivePaused(const MQTT_CLIENT* mqtt_client)
 {
-    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
-    if (mqtt_client != NULL)
+    return mqtt_client->receiveCredit.credit > 0 && mqtt_client->receiveCredit.outstanding >= mqtt_client->receiveCredit.credit;
+}
+
+static bool isReceivedId(const MQTT_CLIENT* mqtt_client, uint16_t packetId)
+{
+    return (mqtt_client->receivedIds[packetId / 32] & ((uint32_t)1 << (packetId % 32))) != 0;
+}
+
+static void recordReceivedPublish(MQTT_CLIENT* mqtt_client, uint16_t packetId)
+{
+    /*Codes_SRS_MQTT_CLIENT_07_065: [When a session store is set, an incoming QoS 2 publish shall be stored as a PUBREC record before PUBREC is sent and removed when its PUBREL is received, a publish with a stored PUBREC shall only be acknowledged again and not delivered.]*/
+    if (!isReceivedId(mqtt_client, packetId))
     {
-        size_t packetLength = 0;
-        uint8_t* iterator = NULL;
-        if (headerData != NULL)
+        mqtt_client->receivedIds[packetId / 32] |= ((uint32_t)1 << (packetId % 32));
+        if (mqtt_session_store_save(mqtt_client->sessionStore, MQTT_SESSION_RECORD_PUBREC, packetId, NULL, 0) != 0)
         {
-            packetLength = BUFFER_length(headerData);
-            iterator = BUFFER_u_char(headerData);
+            LogError("Failure storing PUBREC %" PRIu16, packetId);
         }
+    }
+}
 
-#ifdef ENABLE_RAW_TRACE
-        logIncomingRawTrace(mqtt_client, packet, (uint8_t)flags, iterator, packetLength);
-#endif
-        if ((iterator != NULL && packetLength > 0) || packet == PINGRESP_TYPE)
+static void releaseReceivedPublish(MQTT_CLIENT* mqtt_client, uint16_t packetId)
+{
+    /*Codes_SRS_MQTT_CLIENT_07_065: [When a session store is set, an incoming QoS 2 publish shall be stored as a PUBREC record before PUBREC is sent and removed when its PUBREL is received, a publish with a stored PUBREC shall only be acknowledged again and not delivered.]*/
+    if (isReceivedId(mqtt_client, packetId))
+    {
+        mqtt_client->receivedIds[packetId / 32] &= ~((uint32_t)1 << (packetId % 32));
+        if (mqtt_session_store_remove(mqtt_client->sessionStore, MQTT_SESSION_RECORD_PUBREC, packetId) != 0)
         {
-            switch (packet)
-            {
-                case CONNACK_TYPE:
-                {
-                    /*Codes_SRS_MQTT_CLIENT_07_028: [If the actionResult parameter is of type CONNECT_ACK then the msgInfo value shall be a CONNECT_ACK structure.]*/
-                    CONNECT_ACK connack = { 0 };
-                    if (packetLength != 2) // CONNACK payload must be only 2 bytes
-                    {
-                        LogError("Invalid CONNACK packet.");
-                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
-                        break;
-                    }
+            LogError("Failure removing PUBREC %" PRIu16, packetId);
+        }
+    }
+}
+
+// A PUBLISH packet as the session store and the offline queue keep it, always in the MQTT 3.1.1 layout
+typedef struct STORED_PUBLISH_TAG
+{
+    QOS_VALUE qos;
+    bool isDuplicate;
+    bool isRetained;
+    const char* topicName;
+    size_t topicLength;
+    uint16_t packetId;
+    const uint8_t* payload;
+    size_t payloadLength;
+} STORED_PUBLISH;
+
+static int parseStoredPublish(const uint8_t* data, size_t length, STORED_PUBLISH* publish)
+{
+    int result;
+    size_t remainingLength = 0;
+    size_t multiplier = 1;
+    size_t offset = 1;
+
+    while (offset < length && offset <= 4)
+    {
+        remainingLength += (data[offset] & 0x7f) * multiplier;
+        multiplier *= 128;
+        if ((data[offset++] & 0x80) == 0)
+        {
+            break;
+        }
+    }
+
+    if (length < 2 || offset + remainingLength != length || remainingLength < 2)
+    {
+        result = MU_FAILURE;
+    }
+    else
+    {
+        size_t topicLength = ((size_t)data[offset] << 8) | data[offset + 1];
+        size_t packetIdLength = (data[0] & (QOS_LEAST_ONCE_FLAG_MASK | QOS_EXACTLY_ONCE_FLAG_MASK)) ? 2 : 0;
+        if (topicLength + 2 + packetIdLength > remainingLength)
+        {
+            result = MU_FAILURE;
+        }
+        else
+        {
+            publish->qos = (data[0] & QOS_EXACTLY_ONCE_FLAG_MASK) ? DELIVER_EXACTLY_ONCE : (data[0] & QOS_LEAST_ONCE_FLAG_MASK) ? DELIVER_AT_LEAST_ONCE : DELIVER_AT_MOST_ONCE;
+            publish->isDuplicate = (data[0] & DUPLICATE_FLAG_MASK) != 0;
+            publish->isRetained = (data[0] & RETAIN_FLAG_MASK) != 0;
+            publish->topicName = (const char*)(data + offset + 2);
+            publish->topicLength = topicLength;
+            publish->packetId = (packetIdLength == 0) ? 0 : (uint16_t)((data[offset + 2 + topicLength] << 8) | data[offset + 3 + topicLength]);
+            publish->payload = data + offset + 2 + topicLength + packetIdLength;
+            publish->payloadLength = (size_t)((data + length) - publish->payload);
+            result = 0;
+        }
+    }
+    return result;
+}
+
+// Rebuilds an in-flight message from the PUBLISH packet it was stored as
+static MQTT_MESSAGE_HANDLE restorePublishMessage(uint16_t packetId, const uint8_t* data, size_t length)
+{
+    MQTT_MESSAGE_HANDLE result = NULL;
+    STORED_PUBLISH publish;
+
+    if (parseStoredPublish(data, length, &publish) != 0 || publish.qos == DELIVER_AT_MOST_ONCE)
+    {
+        LogError("Invalid stored message %" PRIu16, packetId);
+    }
+    else
+    {
+        MQTT_MESSAGE_HANDLE view = mqttmessage_create_in_place_n(packetId, publish.topicName, publish.topicLength, publish.qos, publish.payload, publish.payloadLength);
+        if (view == NULL)
+        {
+            LogError("Failure creating stored message %" PRIu16, packetId);
+        }
+        else
+        {
+            if (mqttmessage_setIsRetained(view, publish.isRetained) != 0 ||
+                (result = mqttmessage_clone(view)) == NULL)
+            {
+                LogError("Failure copying stored message %" PRIu16, packetId);
+            }
+            mqttmessage_destroy(view);
+        }
+    }
+    return result;
+}
+
+// Encodes a stored PUBLISH packet again for an MQTT 5 connection
+static BUFFER_HANDLE encodeStoredPublishV5(const MQTT_CLIENT* mqtt_client, const uint8_t* data, size_t length)
+{
+    BUFFER_HANDLE result;
+    STORED_PUBLISH publish;
+
+    if (parseStoredPublish(data, length, &publish) != 0)
+    {
+        LogError("Invalid queued message");
+        result = NULL;
+    }
+    /*Codes_SRS_MQTT_CLIENT_07_096: [Publishes shall be kept in the session store and the offline queue as MQTT 3.1.1 packets whatever the protocol version, and a queued publish shall be encoded again with mqtt_codec_publish_v5 when it is sent on an MQTT 5 connection.]*/
+    else if ((result = mqtt_codec_publish_v5(publish.qos, publish.isDuplicate, publish.isRetained, publish.packetId, publish.topicName, publish.topicLength, 0, publish.payload, publish.payloadLength, NULL)) != NULL &&
+        exceedsMaximumPacketSize(mqtt_client, result))
+    {
+        LogError("Queued PUBLISH packet is larger than the server maximum of %" PRIu32 " bytes", mqtt_client->server.maximumPacketSize);
+        BUFFER_delete(result);
+        result = NULL;
+    }
+    return result;
+}
+
+static void onSessionRecordLoaded(void* context, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId, const uint8_t* data, size_t length)
+{
+    SESSION_RESTORE_CONTEXT* restore = (SESSION_RESTORE_CONTEXT*)context;
+    MQTT_CLIENT* mqtt_client = restore->mqtt_client;
+    INFLIGHT_STORE* store = &mqtt_client->inflight;
+
+    if (restore->result != 0 || packetId == 0)
+    {
+        restore->result = MU_FAILURE;
+    }
+    else if (recordType == MQTT_SESSION_RECORD_PUBREC)
+    {
+        mqtt_client->receivedIds[packetId / 32] |= ((uint32_t)1 << (packetId % 32));
+    }
+    else if (store->count >= store->maxInflight || findInflightSlot(store, packetId) != INFLIGHT_NO_SLOT)
+    {
+        LogError("Stored message %" PRIu16 " does not fit the in-flight window of %lu messages", packetId, (unsigned long)store->maxInflight);
+        restore->result = MU_FAILURE;
+    }
+    else if (recordType == MQTT_SESSION_RECORD_PUBREL)
+    {
+        (void)insertInflightMessage(store, NULL, packetId, restore->current_ms);
+    }
+    else
+    {
+        MQTT_MESSAGE_HANDLE stored = restorePublishMessage(packetId, data, length);
+        if (stored == NULL)
+        {
+            restore->result = MU_FAILURE;
+        }
+        else
+        {
+            (void)insertInflightMessage(store, stored, packetId, restore->current_ms);
+        }
+    }
+}
+
+// Offset of the packet id in an encoded QoS 1 or QoS 2 PUBLISH packet
+static size_t getPublishPacketIdOffset(const uint8_t* data)
+{
+    size_t offset = 1;
+    while ((data[offset++] & 0x80) != 0)
+    {
+    }
+    return offset + 2 + (((size_t)data[offset] << 8) | data[offset + 1]);
+}
+
+// Gives a queued PUBLISH packet a free packet id and keeps it in flight, the id is written into the packet
+static int trackOfflinePublish(MQTT_CLIENT* mqtt_client, uint8_t* data, size_t length)
+{
+    int result;
+    INFLIGHT_STORE* store = &mqtt_client->inflight;
+    tickcounter_ms_t current_ms;
+    uint16_t packetId;
+
+    if (getCurrentMs(mqtt_client, &current_ms) != 0)
+    {
+        LogError("Failure getting current ms tickcounter");
+        result = MU_FAILURE;
+    }
+    else if (allocatePacketId(store, &packetId) != 0)
+    {
+        LogError("No free packet id");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        MQTT_MESSAGE_HANDLE stored = restorePublishMessage(packetId, data, length);
+        if (stored == NULL)
+        {
+            setPacketIdUsed(store, packetId, false);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            size_t offset = getPublishPacketIdOffset(data);
+            data[offset] = (uint8_t)(packetId >> 8);
+            data[offset + 1] = (uint8_t)(packetId & 0xff);
+            (void)insertInflightMessage(store, stored, packetId, current_ms);
+            if (mqtt_client->sessionStore != NULL && mqtt_session_store_save(mqtt_client->sessionStore, MQTT_SESSION_RECORD_PUBLISH, packetId, data, length) != 0)
+            {
+                LogError("Failure storing in-flight message %" PRIu16, packetId);
+            }
+            result = 0;
+        }
+    }
+    return result;
+}
+
+// Releases the in-flight entry trackOfflinePublish made for a queued PUBLISH packet that is not sent
+static void untrackQueuedPublish(MQTT_CLIENT* mqtt_client, const uint8_t* data, size_t length)
+{
+    size_t offset = getPublishPacketIdOffset(data);
+    if (offset + 2 <= length)
+    {
+        uint16_t packetId = (uint16_t)(((uint16_t)data[offset] << 8) | data[offset + 1]);
+        size_t slot = findInflightSlot(&mqtt_client->inflight, packetId);
+        if (slot != INFLIGHT_NO_SLOT)
+        {
+            if (mqtt_client->sessionStore != NULL && mqtt_session_store_remove(mqtt_client->sessionStore, MQTT_SESSION_RECORD_PUBLISH, packetId) != 0)
+            {
+                LogError("Failure removing stored message %" PRIu16, packetId);
+            }
+            removeInflightSlot(&mqtt_client->inflight, slot);
+        }
+    }
+}
+
+// Stores an in-flight publish, whose packet is encoded again as MQTT 3.1.1 on an MQTT 5 connection
+static int storeInflightPublish(MQTT_CLIENT* mqtt_client, MQTT_MESSAGE_HANDLE msgHandle, uint16_t packetId, const APP_PAYLOAD* payload, BUFFER_HANDLE publishPacket)
+{
+    int result;
+    if (!is_protocol_v5(mqtt_client))
+    {
+        result = mqtt_session_store_save(mqtt_client->sessionStore, MQTT_SESSION_RECORD_PUBLISH, packetId, BUFFER_u_char(publishPacket), BUFFER_length(publishPacket));
+    }
+    else
+    {
+        MQTT_TOPIC_HANDLE topic = mqttmessage_getInternedTopic(msgHandle);
+        const char* topicName = (topic == NULL) ? mqttmessage_getTopicName(msgHandle) : NULL;
+        /*Codes_SRS_MQTT_CLIENT_07_096: [Publishes shall be kept in the session store and the offline queue as MQTT 3.1.1 packets whatever the protocol version, and a queued publish shall be encoded again with mqtt_codec_publish_v5 when it is sent on an MQTT 5 connection.]*/
+        BUFFER_HANDLE storedPacket = encodePublishPacket(topic, topicName, mqttmessage_getQosType(msgHandle), mqttmessage_getIsDuplicateMsg(msgHandle), mqttmessage_getIsRetained(msgHandle), packetId, payload, NULL);
+        if (storedPacket == NULL)
+        {
+            result = MU_FAILURE;
+        }
+        else
+        {
+            result = mqtt_session_store_save(mqtt_client->sessionStore, MQTT_SESSION_RECORD_PUBLISH, packetId, BUFFER_u_char(storedPacket), BUFFER_length(storedPacket));
+            BUFFER_delete(storedPacket);
+        }
+    }
+    return result;
+}
+
+static int queueOfflinePublish(MQTT_CLIENT* mqtt_client, MQTT_MESSAGE_HANDLE msgHandle, const APP_PAYLOAD* payload)
+{
+    int result;
+    QOS_VALUE qos = mqttmessage_getQosType(msgHandle);
+    bool isDuplicate = mqttmessage_getIsDuplicateMsg(msgHandle);
+    bool isRetained = mqttmessage_getIsRetained(msgHandle);
+    uint16_t packetId = mqttmessage_getPacketId(msgHandle);
+    MQTT_TOPIC_HANDLE topic = mqttmessage_getInternedTopic(msgHandle);
+    const char* topicName = (topic == NULL) ? mqttmessage_getTopicName(msgHandle) : NULL;
+    BUFFER_HANDLE publishPacket = encodePublishPacket(topic, topicName, qos, isDuplicate, isRetained, packetId, payload, NULL);
+
+    if (publishPacket == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+        LogError("Error: mqtt_codec_publish failed");
+        result = MU_FAILURE;
+    }
+    else if (mqtt_offline_queue_push(mqtt_client->offlineQueue, publishPacket, qos) != 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_070: [If the offline queue drops the message then mqtt_client_publish shall return a non-zero value.]*/
+        LogError("Error: message dropped by the offline queue");
+        BUFFER_delete(publishPacket);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+// What became of an encoded PUBLISH packet taken from the offline or submit queue
+typedef enum QUEUED_PUBLISH_RESULT_TAG
+{
+    QUEUED_PUBLISH_SENT,
+    QUEUED_PUBLISH_DROPPED,
+    QUEUED_PUBLISH_WAITING,
+    QUEUED_PUBLISH_LOST
+} QUEUED_PUBLISH_RESULT;
+
+// A waiting packet stays queued and nothing more is sent on this dowork, a lost packet was tracked and is resent from the in-flight store
+static QUEUED_PUBLISH_RESULT sendQueuedPublish(MQTT_CLIENT* mqtt_client, BUFFER_HANDLE packet)
+{
+    QUEUED_PUBLISH_RESULT result;
+    uint8_t* data = BUFFER_u_char(packet);
+    size_t size = BUFFER_length(packet);
+    bool isTracked = (((data[0] >> 1) & 0x03) != DELIVER_AT_MOST_ONCE && mqtt_client->inflight.maxInflight > 0);
+    BUFFER_HANDLE packetV5 = NULL;
+
+    /*Codes_SRS_MQTT_CLIENT_07_072: [When the in-flight store is on, a queued QoS 1 or QoS 2 publish shall get its packet id when it is sent and stay queued while the in-flight window is full.]*/
+    if (isTracked && mqtt_client->inflight.count >= getInflightLimit(mqtt_client))
+    {
+        result = QUEUED_PUBLISH_WAITING;
+    }
+    else if (isTracked && trackOfflinePublish(mqtt_client, data, size) != 0)
+    {
+        LogError("Failure tracking queued message");
+        set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+        result = QUEUED_PUBLISH_WAITING;
+    }
+    else if (is_protocol_v5(mqtt_client) && (packetV5 = encodeStoredPublishV5(mqtt_client, data, size)) == NULL)
+    {
+        LogError("Dropping queued message that can not be sent on this connection");
+        if (isTracked)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_165: [When a queued publish is dropped because it can not be sent on this connection, its in-flight entry and packet id shall be released.]*/
+            untrackQueuedPublish(mqtt_client, data, size);
+        }
+        result = QUEUED_PUBLISH_DROPPED;
+    }
+    else if (queuePacketItem(mqtt_client, PUBLISH_TYPE, (packetV5 == NULL) ? data : BUFFER_u_char(packetV5), (packetV5 == NULL) ? size : BUFFER_length(packetV5)) != 0)
+    {
+        // A tracked message is resent from the in-flight store after reconnecting
+        LogError("Failure sending queued message");
+        BUFFER_delete(packetV5);
+        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+        result = isTracked ? QUEUED_PUBLISH_LOST : QUEUED_PUBLISH_WAITING;
+    }
+    else
+    {
+        size_t packetIdOffset;
+        if (((data[0] >> 1) & 0x03) != DELIVER_AT_MOST_ONCE && (packetIdOffset = getPublishPacketIdOffset(data)) + 2 <= size)
+        {
+            startLatency(mqtt_client, PUBLISH_TYPE, (uint16_t)(((uint16_t)data[packetIdOffset] << 8) | data[packetIdOffset + 1]), (data[0] & DUPLICATE_FLAG_MASK) != 0);
+        }
+        BUFFER_delete(packetV5);
+        result = QUEUED_PUBLISH_SENT;
+    }
+    return result;
+}
+
+static void drainOfflineQueue(MQTT_CLIENT* mqtt_client)
+{
+    size_t sent = 0;
+    bool isDraining = true;
+    BUFFER_HANDLE packet;
+
+    /*Codes_SRS_MQTT_CLIENT_07_071: [Once connected, mqtt_client_dowork shall send up to drainPerDowork queued publishes in the order they were made, all of them if drainPerDowork is 0.]*/
+    while (isDraining && (mqtt_client->drainPerDowork == 0 || sent < mqtt_client->drainPerDowork) &&
+        (packet = mqtt_offline_queue_peek(mqtt_client->offlineQueue)) != NULL)
+    {
+        switch (sendQueuedPublish(mqtt_client, packet))
+        {
+            case QUEUED_PUBLISH_SENT:
+                mqtt_offline_queue_pop(mqtt_client->offlineQueue);
+                sent++;
+                break;
+            case QUEUED_PUBLISH_DROPPED:
+                mqtt_offline_queue_pop(mqtt_client->offlineQueue);
+                break;
+            case QUEUED_PUBLISH_LOST:
+                mqtt_offline_queue_pop(mqtt_client->offlineQueue);
+                isDraining = false;
+                break;
+            default:
+                isDraining = false;
+                break;
+        }
+    }
+}
+
+// Packets pushed while this runs can keep it going, so it stops after drainPerDowork of them like the offline queue
+static void drainSubmitQueue(MQTT_CLIENT* mqtt_client)
+{
+    size_t drained = 0;
+    bool isDraining = true;
+    BUFFER_HANDLE packet;
+
+    while (isDraining && (mqtt_client->drainPerDowork == 0 || drained < mqtt_client->drainPerDowork) &&
+        (packet = (mqtt_client->submitPending != NULL) ? mqtt_client->submitPending : mqtt_submit_queue_pop(mqtt_client->submitQueue)) != NULL)
+    {
+        mqtt_client->submitPending = NULL;
+        if (mqtt_client->offlineQueue != NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_113: [mqtt_client_dowork shall move submitted publishes into the offline queue when one is set, and otherwise send them once connected the way queued publishes are sent, up to drainPerDowork of them per call.]*/
+            if (mqtt_offline_queue_push(mqtt_client->offlineQueue, packet, (QOS_VALUE)((BUFFER_u_char(packet)[0] >> 1) & 0x03)) != 0)
+            {
+                LogError("Submitted message dropped by the offline queue");
+                BUFFER_delete(packet);
+            }
+            drained++;
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_113: [mqtt_client_dowork shall move submitted publishes into the offline queue when one is set, and otherwise send them once connected the way queued publishes are sent, up to drainPerDowork of them per call.]*/
+            switch (sendQueuedPublish(mqtt_client, packet))
+            {
+                case QUEUED_PUBLISH_SENT:
+                    BUFFER_delete(packet);
+                    drained++;
+                    break;
+                case QUEUED_PUBLISH_DROPPED:
+                    BUFFER_delete(packet);
+                    break;
+                case QUEUED_PUBLISH_LOST:
+                    BUFFER_delete(packet);
+                    isDraining = false;
+                    break;
+                default:
+                    mqtt_client->submitPending = packet;
+                    isDraining = false;
+                    break;
+            }
+        }
+    }
+    // Stopping on the limit may leave packets behind that no wakeup will announce again
+    mqtt_client->submitBacklog = isDraining && mqtt_client->drainPerDowork != 0 && drained >= mqtt_client->drainPerDowork;
+}
+
+static SUBSCRIPTION_ENTRY* findSubscription(RECONNECT_STATE* reconnect, const char* topic, SUBSCRIPTION_ENTRY** previous)
+{
+    SUBSCRIPTION_ENTRY* result = reconnect->subscriptions;
+    *previous = NULL;
+    while (result != NULL && strcmp(result->topic, topic) != 0)
+    {
+        *previous = result;
+        result = result->next;
+    }
+    return result;
+}
+
+static void removeSubscription(RECONNECT_STATE* reconnect, SUBSCRIPTION_ENTRY* previous, SUBSCRIPTION_ENTRY* entry)
+{
+    if (previous == NULL)
+    {
+        reconnect->subscriptions = entry->next;
+    }
+    else
+    {
+        previous->next = entry->next;
+    }
+    free(entry->topic);
+    free(entry);
+}
+
+static void clearSubscriptions(RECONNECT_STATE* reconnect)
+{
+    while (reconnect->subscriptions != NULL)
+    {
+        removeSubscription(reconnect, NULL, reconnect->subscriptions);
+    }
+}
+
+// Forgets the subscriptions that were never granted, their SUBACK can't arrive on a new connection
+static void clearPendingSubscriptions(RECONNECT_STATE* reconnect)
+{
+    SUBSCRIPTION_ENTRY* previous = NULL;
+    SUBSCRIPTION_ENTRY* entry = reconnect->subscriptions;
+    while (entry != NULL)
+    {
+        SUBSCRIPTION_ENTRY* next = entry->next;
+        entry->pendingId = 0;
+        if (!entry->acked)
+        {
+            removeSubscription(reconnect, previous, entry);
+        }
+        else
+        {
+            previous = entry;
+        }
+        entry = next;
+    }
+}
+
+static int recordSubscribe(RECONNECT_STATE* reconnect, uint16_t packetId, const SUBSCRIBE_PAYLOAD* subscribeList, size_t count)
+{
+    int result = 0;
+    size_t index;
+    for (index = 0; index < count && result == 0; index++)
+    {
+        SUBSCRIPTION_ENTRY* previous;
+        SUBSCRIPTION_ENTRY* entry = findSubscription(reconnect, subscribeList[index].subscribeTopic, &previous);
+        if (entry == NULL)
+        {
+            if ((entry = (SUBSCRIPTION_ENTRY*)malloc(sizeof(SUBSCRIPTION_ENTRY))) == NULL)
+            {
+                LogError("Failure allocating subscription");
+                result = MU_FAILURE;
+            }
+            else if (mallocAndStrcpy_s(&entry->topic, subscribeList[index].subscribeTopic) != 0)
+            {
+                LogError("Failure copying subscription topic");
+                free(entry);
+                result = MU_FAILURE;
+            }
+            else
+            {
+                entry->next = NULL;
+                entry->qos = subscribeList[index].qosReturn;
+                entry->acked = false;
+                if (previous == NULL)
+                {
+                    reconnect->subscriptions = entry;
+                }
+                else
+                {
+                    previous->next = entry;
+                }
+            }
+        }
+        if (result == 0)
+        {
+            entry->pendingId = packetId;
+            entry->pendingIndex = index;
+            entry->pendingQos = subscribeList[index].qosReturn;
+        }
+    }
+    return result;
+}
+
+static void recordSubscribeAck(RECONNECT_STATE* reconnect, const SUBSCRIBE_ACK* suback)
+{
+    SUBSCRIPTION_ENTRY* previous = NULL;
+    SUBSCRIPTION_ENTRY* entry = reconnect->subscriptions;
+    while (entry != NULL)
+    {
+        SUBSCRIPTION_ENTRY* next = entry->next;
+        if (entry->pendingId == suback->packetId && entry->pendingId != 0)
+        {
+            entry->pendingId = 0;
+            if (entry->pendingIndex < suback->qosCount && suback->qosReturn[entry->pendingIndex] != DELIVER_FAILURE)
+            {
+                entry->acked = true;
+                entry->qos = entry->pendingQos;
+            }
+            else if (!entry->acked)
+            {
+                removeSubscription(reconnect, previous, entry);
+                entry = NULL;
+            }
+        }
+        if (entry != NULL)
+        {
+            previous = entry;
+        }
+        entry = next;
+    }
+}
+
+static void recordUnsubscribe(RECONNECT_STATE* reconnect, const char** unsubscribeList, size_t count)
+{
+    size_t index;
+    for (index = 0; index < count; index++)
+    {
+        SUBSCRIPTION_ENTRY* previous;
+        SUBSCRIPTION_ENTRY* entry = findSubscription(reconnect, unsubscribeList[index], &previous);
+        if (entry != NULL)
+        {
+            removeSubscription(reconnect, previous, entry);
+        }
+    }
+}
+
+// The in-flight window owns the packet ids when it is on. Otherwise the application does, so the id is one that no
+// SUBSCRIBE waiting for its SUBACK holds, and mqtt_client_subscribe and mqtt_client_unsubscribe refuse it until its SUBACK.
+static int allocateResubscribeId(MQTT_CLIENT* mqtt_client, uint16_t* packetId)
+{
+    int result;
+    if (mqtt_client->inflight.maxInflight > 0)
+    {
+        result = allocatePacketId(&mqtt_client->inflight, packetId);
+    }
+    else
+    {
+        const SUBSCRIPTION_ENTRY* entry = mqtt_client->reconnect.subscriptions;
+        *packetId = UINT16_MAX;
+        while (entry != NULL && *packetId != 0)
+        {
+            if (entry->pendingId == *packetId)
+            {
+                (*packetId)--;
+                entry = mqtt_client->reconnect.subscriptions;
+            }
+            else
+            {
+                entry = entry->next;
+            }
+        }
+        result = (*packetId == 0) ? MU_FAILURE : 0;
+    }
+    return result;
+}
+
+static void resubscribe(MQTT_CLIENT* mqtt_client)
+{
+    RECONNECT_STATE* reconnect = &mqtt_client->reconnect;
+    SUBSCRIPTION_ENTRY* entry;
+    size_t count = 0;
+
+    for (entry = reconnect->subscriptions; entry != NULL; entry = entry->next)
+    {
+        count++;
+    }
+    if (count > 0)
+    {
+        SUBSCRIBE_PAYLOAD* subscribeList = (SUBSCRIBE_PAYLOAD*)malloc(count * sizeof(SUBSCRIBE_PAYLOAD));
+        uint16_t packetId;
+        if (subscribeList == NULL)
+        {
+            LogError("Failure allocating re-subscribe list");
+            set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+        }
+        /*Codes_SRS_MQTT_CLIENT_07_162: [The client shall send the SUBSCRIBE that restores the subscriptions with a packet id taken from the in-flight window when it is on, and otherwise with one that no SUBSCRIBE waiting for its SUBACK uses.]*/
+        else if (allocateResubscribeId(mqtt_client, &packetId) != 0)
+        {
+            LogError("No free packet id to re-subscribe");
+            free(subscribeList);
+            set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+        }
+        else
+        {
+            BUFFER_HANDLE subPacket;
+            size_t index = 0;
+            for (entry = reconnect->subscriptions; entry != NULL; entry = entry->next)
+            {
+                subscribeList[index].subscribeTopic = entry->topic;
+                subscribeList[index].qosReturn = entry->qos;
+                index++;
+            }
+            reconnect->resubscribeId = packetId;
+
+            if ((subPacket = is_protocol_v5(mqtt_client) ? mqtt_codec_subscribe_v5(packetId, subscribeList, count, NULL) : mqtt_codec_subscribe(packetId, subscribeList, count, NULL)) == NULL)
+            {
+                LogError("Error: mqtt_codec_subscribe failed");
+                free(subscribeList);
+                set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+            }
+            else
+            {
+                size_t size = BUFFER_length(subPacket);
+                int sendResult = queuePacketItem(mqtt_client, SUBSCRIBE_TYPE, BUFFER_u_char(subPacket), size);
+                BUFFER_delete(subPacket);
+                free(subscribeList);
+                if (sendResult != 0)
+                {
+                    LogError("Error: re-subscribe send failed");
+                    set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                }
+                else
+                {
+                    startLatency(mqtt_client, SUBSCRIBE_TYPE, packetId, false);
+                }
+            }
+        }
+    }
+}
+
+static void releaseResubscribeId(MQTT_CLIENT* mqtt_client)
+{
+    if (mqtt_client->reconnect.resubscribeId != 0)
+    {
+        if (mqtt_client->inflight.maxInflight > 0)
+        {
+            setPacketIdUsed(&mqtt_client->inflight, mqtt_client->reconnect.resubscribeId, false);
+        }
+        mqtt_client->reconnect.resubscribeId = 0;
+    }
+}
+
+// xorshift32, seeded per client so a fleet that lost the same broker doesn't retry in lockstep
+static uint32_t nextReconnectRandom(MQTT_CLIENT* mqtt_client, tickcounter_ms_t current_ms)
+{
+    RECONNECT_STATE* reconnect = &mqtt_client->reconnect;
+    uint32_t value = reconnect->randomState;
+    if (value == 0)
+    {
+        const char* iterator = mqtt_client->mqttOptions.clientId;
+        value = 2166136261u;
+        while (iterator != NULL && *iterator != '\0')
+        {
+            value = (value ^ (uint8_t)*iterator++) * 16777619u;
+        }
+        value ^= (uint32_t)current_ms ^ (uint32_t)(uintptr_t)mqtt_client;
+        if (value == 0)
+        {
+            value = 1;
+        }
+    }
+    value ^= value << 13;
+    value ^= value >> 17;
+    value ^= value << 5;
+    reconnect->randomState = value;
+    return value;
+}
+
+static void scheduleReconnect(MQTT_CLIENT* mqtt_client)
+{
+    RECONNECT_STATE* reconnect = &mqtt_client->reconnect;
+    if (reconnect->enabled && reconnect->xioHandle != NULL && !reconnect->pending)
+    {
+        tickcounter_ms_t current_ms;
+
+        // A transport that failed to open is still in its error state, close it so it can be opened again.
+        // The next attempt waits for the close to complete.
+        if (mqtt_client->xioHandle != NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_163: [Before it waits to reconnect, the client shall close a transport that failed to open with xio_close and reopen it only once the close completes or CLOSE_TIMEOUT_MS have passed.]*/
+            start_close(mqtt_client, false);
+        }
+        // The transport stays closed until the next attempt
+        mqtt_client->xioHandle = NULL;
+        mqtt_client->mqtt_status &= ~(MQTT_STATUS_CLIENT_CONNECTED | MQTT_STATUS_SOCKET_CONNECTED | MQTT_STATUS_PENDING_CLOSE);
+        mqtt_client->outbound.length = 0;
+        reconnect->reopened = false;
+        releaseResubscribeId(mqtt_client);
+        clearPendingSubscriptions(reconnect);
+
+        if (getCurrentMs(mqtt_client, &current_ms) != 0)
+        {
+            LogError("Failure getting current ms tickcounter, reconnecting stopped");
+            reconnect->xioHandle = NULL;
+        }
+        else
+        {
+            if (reconnect->attempt == 0)
+            {
+                reconnect->firstFailureMs = current_ms;
+            }
+
+            if (reconnect->maxRetryWindowMs > 0 && (current_ms - reconnect->firstFailureMs) >= reconnect->maxRetryWindowMs)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_079: [Once maxRetryWindowMs has passed since the connection was lost, the client shall stop reconnecting and call the ON_MQTT_ERROR_CALLBACK with MQTT_CLIENT_RECONNECT_FAILED.]*/
+                LogError("Reconnect failed after %" PRIu32 " attempts", reconnect->attempt);
+                reconnect->xioHandle = NULL;
+                reconnect->attempt = 0;
+                if (mqtt_client->fnOnErrorCallBack)
+                {
+                    mqtt_client->fnOnErrorCallBack(mqtt_client, MQTT_CLIENT_RECONNECT_FAILED, mqtt_client->errorCBCtx);
+                }
+            }
+            else
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_077: [After a connection failure the client shall wait a random time between zero and initialDelayMs doubled for every failed attempt, capped at maxDelayMs, before it reconnects.]*/
+                uint64_t ceiling = (reconnect->attempt < 32) ? ((uint64_t)reconnect->initialDelayMs << reconnect->attempt) : reconnect->maxDelayMs;
+                if (ceiling > reconnect->maxDelayMs)
+                {
+                    ceiling = reconnect->maxDelayMs;
+                }
+                reconnect->nextAttemptMs = current_ms + (nextReconnectRandom(mqtt_client, current_ms) % (ceiling + 1));
+                reconnect->attempt++;
+                reconnect->pending = true;
+            }
+        }
+    }
+}
+
+static void sendPayloadComplete(void* context, IO_SEND_RESULT send_result)
+{
+    PUBLISH_IOV_CONTEXT* iov_context = (PUBLISH_IOV_CONTEXT*)context;
+    if (iov_context == NULL)
+    {
+        LogError("MQTT Send Payload Complete Failure with NULL context");
+    }
+    else
+    {
+        sendComplete(iov_context->mqtt_client, send_result);
+        /*Codes_SRS_MQTT_CLIENT_07_042: [Once the transport has completed sending the last segment mqtt_client_publish_iov shall call onPayloadReleased with the send result, after which the caller may reuse the payload memory.]*/
+        if (iov_context->onPayloadReleased != NULL)
+        {
+            iov_context->onPayloadReleased(iov_context->releasedCtx, send_result);
+        }
+        free(iov_context);
+    }
+}
+
+static int encodePublishHeader(const MQTT_CLIENT* mqtt_client, MQTT_TOPIC_HANDLE topic, const char* topicName, QOS_VALUE qos, bool isDuplicate, bool isRetained, uint16_t packetId, size_t payloadLen, uint8_t* headerBuffer, size_t* headerLength, STRING_HANDLE trace_log)
+{
+    int result;
+    if (is_protocol_v5(mqtt_client))
+    {
+        bool isNewAlias;
+        uint16_t alias = getTopicAlias(mqtt_client, topic, &isNewAlias);
+        size_t nameLength = 0;
+
+        if (topic != NULL)
+        {
+            topicName = mqtt_topic_get_name(topic, &nameLength);
+        }
+        else if (topicName != NULL)
+        {
+            nameLength = strlen(topicName);
+        }
+
+        if (alias != 0 && !isNewAlias)
+        {
+            topicName = NULL;
+            nameLength = 0;
+        }
+        result = mqtt_codec_publish_header_v5(qos, isDuplicate, isRetained, packetId, topicName, nameLength, alias, payloadLen, headerBuffer, headerLength, trace_log);
+        /*Codes_SRS_MQTT_CLIENT_07_095: [If the server set a maximum packet size and the PUBLISH packet is larger then mqtt_client_publish and mqtt_client_publish_iov shall return a non-zero value.]*/
+        if (result == 0 && mqtt_client->server.maximumPacketSize != 0 && *headerLength + payloadLen > mqtt_client->server.maximumPacketSize)
+        {
+            LogError("PUBLISH packet of %lu bytes is larger than the server maximum of %" PRIu32, (unsigned long)(*headerLength + payloadLen), mqtt_client->server.maximumPacketSize);
+            result = MU_FAILURE;
+        }
+    }
+    else if (topic != NULL)
+    {
+        size_t encodedLength;
+        const uint8_t* encodedTopic = mqtt_topic_get_encoded(topic, &encodedLength);
+        result = mqtt_codec_publish_header_encoded_topic(qos, isDuplicate, isRetained, packetId, encodedTopic, encodedLength, payloadLen, headerBuffer, headerLength, trace_log);
+    }
+    else
+    {
+        result = mqtt_codec_publish_header(qos, isDuplicate, isRetained, packetId, topicName, payloadLen, headerBuffer, headerLength, trace_log);
+    }
+    return result;
+}
+
+static int sendPayloadSegments(MQTT_CLIENT* mqtt_client, const MQTT_PAYLOAD_SEGMENT* segments, size_t segmentCount, PUBLISH_IOV_CONTEXT* iov_context)
+{
+    int result = 0;
+    size_t index;
+    size_t lastIndex = segmentCount;
+
+    // A send of no bytes is not passed to the transport, the last non-empty segment completes the payload
+    while (lastIndex > 0 && segments[lastIndex - 1].length == 0)
+    {
+        lastIndex--;
+    }
+    for (index = 0; index < lastIndex && result == 0; index++)
+    {
+        bool isLast = (index + 1 == lastIndex);
+        if (segments[index].length > 0)
+        {
+            if (xio_send(mqtt_client->xioHandle, (const void*)segments[index].data, segments[index].length, isLast ? sendPayloadComplete : sendComplete, isLast ? (void*)iov_context : (void*)mqtt_client) != 0)
+            {
+                LogError("Failure sending payload segment %lu", (unsigned long)index);
+                result = MU_FAILURE;
+            }
+            else
+            {
+                if (mqtt_client->capture != NULL)
+                {
+                    captureOutgoingPayload(mqtt_client, segments[index].data, segments[index].length);
+                }
+#ifdef ENABLE_RAW_TRACE
+                logOutgoingRawPayload(mqtt_client, segments[index].data, segments[index].length);
+#endif
+            }
+        }
+    }
+    return result;
+}
+
+static void onOpenComplete(void* context, IO_OPEN_RESULT open_result)
+{
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
+    if (mqtt_client != NULL)
+    {
+        if (open_result == IO_OPEN_OK && !(mqtt_client->mqtt_status & MQTT_STATUS_SOCKET_CONNECTED))
+        {
+            mqtt_client->packetState = CONNECT_TYPE;
+            mqtt_client->mqtt_status |= MQTT_STATUS_SOCKET_CONNECTED;
+
+            STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
+
+            // Send the Connect packet
+            BUFFER_HANDLE connPacket = mqtt_codec_connect(&mqtt_client->mqttOptions, trace_log);
+            if (connPacket == NULL)
+            {
+                LogError("Error: mqtt_codec_connect failed");
+            }
+            else
+            {
+                size_t size = BUFFER_length(connPacket);
+                /*Codes_SRS_MQTT_CLIENT_07_009: [On success mqtt_client_connect shall send the MQTT CONNECT to the endpoint.]*/
+                if (sendPacketItem(mqtt_client, CONNECT_TYPE, BUFFER_u_char(connPacket), size) != 0)
+                {
+                    LogError("Error: failure sending connect packet");
+                    // Set the status to pending close because we connot continue
+                    // with CONN failing to send
+                    if (mqtt_client->fnOnErrorCallBack)
+                    {
+                        mqtt_client->fnOnErrorCallBack(mqtt_client, MQTT_CLIENT_CONNECTION_ERROR, mqtt_client->errorCBCtx);
+                    }
+                    mqtt_client->mqtt_status |= MQTT_STATUS_PENDING_CLOSE;
+                }
+                else
+                {
+                    log_outgoing_trace(mqtt_client, trace_log);
+                }
+                BUFFER_delete(connPacket);
+            }
+            if (trace_log != NULL)
+            {
+                STRING_delete(trace_log);
+            }
+        }
+        else
+        {
+            LogError("Error: failure opening connection to endpoint");
+            if (!(mqtt_client->mqtt_status & MQTT_STATUS_SOCKET_CONNECTED) && mqtt_client->fnOnErrorCallBack)
+            {
+                mqtt_client->fnOnErrorCallBack(mqtt_client, MQTT_CLIENT_CONNECTION_ERROR, mqtt_client->errorCBCtx);
+            }
+            mqtt_client->mqtt_status |= MQTT_STATUS_PENDING_CLOSE;
+        }
+    }
+    else
+    {
+        LogError("Error: mqtt_client is NULL");
+    }
+}
+
+static void onBytesReceived(void* context, const unsigned char* buffer, size_t size)
+{
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
+    if (mqtt_client != NULL)
+    {
+        STATS_ADD(&mqtt_client->stats.bytesReceived, size);
+        if (mqtt_codec_bytesReceived(mqtt_client->codec_handle, buffer, size) != 0)
+        {
+            mqtt_codec_reset(mqtt_client->codec_handle);
+            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+        }
+    }
+    else
+    {
+        LogError("Error: mqtt_client is NULL");
+    }
+}
+
+static void onIoError(void* context)
+{
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
+    if (mqtt_client != NULL && mqtt_client->fnOperationCallback)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_032: [If the actionResult parameter is of type MQTT_CLIENT_ON_DISCONNECT the the msgInfo value shall be NULL.]*/
+        /* Codes_SRS_MQTT_CLIENT_07_036: [ If an error is encountered by the ioHandle the mqtt_client shall call xio_close. ] */
+        set_error_callback(mqtt_client, MQTT_CLIENT_CONNECTION_ERROR);
+    }
+    else
+    {
+        LogError("Error invalid parameter: mqtt_client: %p", mqtt_client);
+    }
+}
+
+static void reconnectIfDue(MQTT_CLIENT* mqtt_client)
+{
+    RECONNECT_STATE* reconnect = &mqtt_client->reconnect;
+    tickcounter_ms_t current_ms;
+    if (getCurrentMs(mqtt_client, &current_ms) != 0)
+    {
+        LogError("Error: tickcounter_get_current_ms failed");
+    }
+    else if (current_ms >= reconnect->nextAttemptMs)
+    {
+        reconnect->pending = false;
+        reconnect->reopened = true;
+        mqtt_codec_reset(mqtt_client->codec_handle);
+        mqtt_client->xioHandle = reconnect->xioHandle;
+        mqtt_client->packetState = UNKNOWN_TYPE;
+        mqtt_client->timeSincePing = 0;
+        STATS_ADD(&mqtt_client->stats.reconnects, 1);
+        if (xio_open(mqtt_client->xioHandle, onOpenComplete, mqtt_client, onBytesReceived, mqtt_client, onIoError, mqtt_client) != 0)
+        {
+            LogError("Error: io_open failed");
+            scheduleReconnect(mqtt_client);
+        }
+    }
+}
+
+static void clear_mqtt_options(MQTT_CLIENT* mqtt_client)
+{
+    if (mqtt_client->mqttOptions.clientId != NULL)
+    {
+        free(mqtt_client->mqttOptions.clientId);
+        mqtt_client->mqttOptions.clientId = NULL;
+    }
+
+    if (mqtt_client->mqttOptions.willTopic != NULL)
+    {
+        free(mqtt_client->mqttOptions.willTopic);
+        mqtt_client->mqttOptions.willTopic = NULL;
+    }
+
+    if (mqtt_client->mqttOptions.willMessage != NULL)
+    {
+        free(mqtt_client->mqttOptions.willMessage);
+        mqtt_client->mqttOptions.willMessage = NULL;
+    }
+
+    if (mqtt_client->mqttOptions.username != NULL)
+    {
+        free(mqtt_client->mqttOptions.username);
+        mqtt_client->mqttOptions.username = NULL;
+    }
+
+    if (mqtt_client->mqttOptions.password != NULL)
+    {
+        free(mqtt_client->mqttOptions.password);
+        mqtt_client->mqttOptions.password = NULL;
+    }
+}
+
+static int cloneMqttOptions(MQTT_CLIENT* mqtt_client, const MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    int result = 0;
+    char* temp_option;
+
+    if (mqttOptions->clientId != NULL)
+    {
+        if (mallocAndStrcpy_s(&temp_option, mqttOptions->clientId) != 0)
+        {
+            result = MU_FAILURE;
+            LogError("mallocAndStrcpy_s clientId");
+        }
+        else
+        {
+            if (mqtt_client->mqttOptions.clientId != NULL)
+            {
+                free(mqtt_client->mqttOptions.clientId);
+            }
+            mqtt_client->mqttOptions.clientId = temp_option;
+        }
+    }
+    if (result == 0 && mqttOptions->willTopic != NULL)
+    {
+        temp_option = NULL;
+        if (mallocAndStrcpy_s(&temp_option, mqttOptions->willTopic) != 0)
+        {
+            result = MU_FAILURE;
+            LogError("mallocAndStrcpy_s willTopic");
+        }
+        else
+        {
+            if (mqtt_client->mqttOptions.willTopic != NULL)
+            {
+                free(mqtt_client->mqttOptions.willTopic);
+            }
+            mqtt_client->mqttOptions.willTopic = temp_option;
+        }
+    }
+    if (result == 0 && mqttOptions->willMessage != NULL)
+    {
+        temp_option = NULL;
+        if (mallocAndStrcpy_s(&temp_option, mqttOptions->willMessage) != 0)
+        {
+            LogError("mallocAndStrcpy_s willMessage");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            if (mqtt_client->mqttOptions.willMessage != NULL)
+            {
+                free(mqtt_client->mqttOptions.willMessage);
+            }
+            mqtt_client->mqttOptions.willMessage = temp_option;
+        }
+    }
+    if (result == 0 && mqttOptions->username != NULL)
+    {
+        temp_option = NULL;
+        if (mallocAndStrcpy_s(&temp_option, mqttOptions->username) != 0)
+        {
+            LogError("mallocAndStrcpy_s username");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            if (mqtt_client->mqttOptions.username != NULL)
+            {
+                free(mqtt_client->mqttOptions.username);
+            }
+            mqtt_client->mqttOptions.username = temp_option;
+        }
+    }
+    if (result == 0 && mqttOptions->password != NULL)
+    {
+        temp_option = NULL;
+        if (mallocAndStrcpy_s(&temp_option, mqttOptions->password) != 0)
+        {
+            LogError("mallocAndStrcpy_s password");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            if (mqtt_client->mqttOptions.password != NULL)
+            {
+                free(mqtt_client->mqttOptions.password);
+            }
+            mqtt_client->mqttOptions.password = temp_option;
+        }
+    }
+    if (result == 0)
+    {
+        mqtt_client->mqttOptions.keepAliveInterval = mqttOptions->keepAliveInterval;
+        mqtt_client->mqttOptions.messageRetain = mqttOptions->messageRetain;
+        mqtt_client->mqttOptions.useCleanSession = mqttOptions->useCleanSession;
+        mqtt_client->mqttOptions.qualityOfServiceValue = mqttOptions->qualityOfServiceValue;
+        mqtt_client->mqttOptions.protocolVersion = mqttOptions->protocolVersion;
+        mqtt_client->mqttOptions.sessionExpiryInterval = mqttOptions->sessionExpiryInterval;
+        /*Codes_SRS_MQTT_CLIENT_07_103: [On MQTT 5 the receive credit shall be sent as the receive maximum of CONNECT when mqttOptions->receiveMaximum is zero or larger.]*/
+        mqtt_client->mqttOptions.receiveMaximum = (mqtt_client->receiveCredit.credit > 0 && (mqttOptions->receiveMaximum == 0 || mqttOptions->receiveMaximum > mqtt_client->receiveCredit.credit)) ?
+            (uint16_t)mqtt_client->receiveCredit.credit : mqttOptions->receiveMaximum;
+        mqtt_client->mqttOptions.maximumPacketSize = mqttOptions->maximumPacketSize;
+    }
+    else
+    {
+        clear_mqtt_options(mqtt_client);
+    }
+    return result;
+}
+
+static void SendMessageAck(MQTT_CLIENT* mqtt_client, uint16_t packetId, QOS_VALUE qosValue)
+{
+    CONTROL_PACKET_TYPE response_packet_type = UNKNOWN_TYPE;
+    uint8_t pubRel[MQTT_CODEC_PUBLISH_REPLY_SIZE];
+    bool hasReply = false;
+    /*Codes_SRS_MQTT_CLIENT_07_131: [The client shall encode the PINGREQ, DISCONNECT, PUBACK, PUBREC, PUBREL and PUBCOMP packets it sends into its own stack memory with the mqtt_codec_encode functions instead of allocating a buffer for each.]*/
+    if (qosValue == DELIVER_EXACTLY_ONCE)
+    {
+        if (mqtt_client->sessionStore != NULL)
+        {
+            recordReceivedPublish(mqtt_client, packetId);
+        }
+        if (mqtt_codec_encode_pubrec(packetId, pubRel) != 0)
+        {
+            LogError("Failed to encode publish receive message.");
+            set_error_callback(mqtt_client, MQTT_CLIENT_UNKNOWN_ERROR);
+        }
+        else
+        {
+            hasReply = true;
+        }
+
+        response_packet_type = PUBREC_TYPE;
+    }
+    else if (qosValue == DELIVER_AT_LEAST_ONCE)
+    {
+        if (mqtt_codec_encode_puback(packetId, pubRel) != 0)
+        {
+            LogError("Failed to encode publish ack message.");
+            set_error_callback(mqtt_client, MQTT_CLIENT_UNKNOWN_ERROR);
+        }
+        else
+        {
+            hasReply = true;
+        }
+
+        response_packet_type = PUBACK_TYPE;
+    }
+
+    if (hasReply)
+    {
+        if (queuePacketItem(mqtt_client, response_packet_type, pubRel, MQTT_CODEC_PUBLISH_REPLY_SIZE) != 0)
+        {
+            LogError("Failed sending publish reply.");
+            set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+        }
+#ifndef NO_LOGGING
+        else if (is_trace_enabled(mqtt_client))
+        {
+            STRING_HANDLE ack_trace_log = STRING_construct_sprintf("%s | PACKET_ID: %"PRIu16, 
+                response_packet_type == PUBACK_TYPE ? "PUBACK" : ((response_packet_type == PUBREC_TYPE) ? "PUBREC" : "UNDEFINED"),
+                packetId);
+
+            log_outgoing_trace(mqtt_client, ack_trace_log);
+            STRING_delete(ack_trace_log);
+        }
+#endif
+    }
+}
+
+static void destroyTopicHandler(void* value)
+{
+    free(value);
+}
+
+static void onTopicMatch(void* context, void* value)
+{
+    TOPIC_DISPATCH* dispatch = (TOPIC_DISPATCH*)context;
+    TOPIC_HANDLER* topicHandler = (TOPIC_HANDLER*)value;
+    MQTT_CLIENT_ACK_OPTION ackOption = topicHandler->handler(dispatch->msgHandle, topicHandler->context);
+
+    /*Codes_SRS_MQTT_CLIENT_07_086: [When several handlers match, the message shall be acknowledged later if any of them returned MQTT_CLIENT_ACK_ASYNC, right away if any returned MQTT_CLIENT_ACK_SYNC and not at all otherwise.]*/
+    if (ackOption == MQTT_CLIENT_ACK_ASYNC || (ackOption == MQTT_CLIENT_ACK_SYNC && dispatch->ackOption == MQTT_CLIENT_ACK_NONE))
+    {
+        dispatch->ackOption = ackOption;
+    }
+}
+
+static int deferTopicHandler(MQTT_CLIENT* mqtt_client, const char* topicFilter, ON_MQTT_MESSAGE_RECV_CALLBACK handler, void* context)
+{
+    int result;
+    PENDING_TOPIC_HANDLER* pending = (PENDING_TOPIC_HANDLER*)malloc(sizeof(PENDING_TOPIC_HANDLER));
+    if (pending == NULL)
+    {
+        LogError("Failure allocating topic handler change");
+        result = MU_FAILURE;
+    }
+    else if (mallocAndStrcpy_s(&pending->topicFilter, topicFilter) != 0)
+    {
+        LogError("Failure copying topic filter");
+        free(pending);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        PENDING_TOPIC_HANDLER** last = &mqtt_client->pendingTopicHandlers;
+        while (*last != NULL)
+        {
+            last = &(*last)->next;
+        }
+        pending->handler = handler;
+        pending->context = context;
+        pending->next = NULL;
+        *last = pending;
+        result = 0;
+    }
+    return result;
+}
+
+static void clearPendingTopicHandlers(MQTT_CLIENT* mqtt_client)
+{
+    while (mqtt_client->pendingTopicHandlers != NULL)
+    {
+        PENDING_TOPIC_HANDLER* pending = mqtt_client->pendingTopicHandlers;
+        mqtt_client->pendingTopicHandlers = pending->next;
+        free(pending->topicFilter);
+        free(pending);
+    }
+}
+
+// Passes a message to every matching handler, then makes the handler changes they asked for in order
+static size_t dispatchTopicHandlers(MQTT_CLIENT* mqtt_client, const char* topicName, size_t topicLength, TOPIC_DISPATCH* dispatch)
+{
+    size_t result;
+    mqtt_client->dispatchingTopic = true;
+    result = mqtt_topic_trie_match(mqtt_client->topicHandlers, topicName, topicLength, onTopicMatch, dispatch);
+    mqtt_client->dispatchingTopic = false;
+
+    while (mqtt_client->pendingTopicHandlers != NULL)
+    {
+        PENDING_TOPIC_HANDLER* pending = mqtt_client->pendingTopicHandlers;
+        mqtt_client->pendingTopicHandlers = pending->next;
+        /*Codes_SRS_MQTT_CLIENT_07_161: [When called from a topic handler, mqtt_client_set_topic_handler shall copy topicFilter, return 0 and make the change once the message has been passed to every matching handler.]*/
+        (void)mqtt_client_set_topic_handler(mqtt_client, pending->topicFilter, pending->handler, pending->context);
+        free(pending->topicFilter);
+        free(pending);
+    }
+    return result;
+}
+
+static void ProcessPublishMessage(MQTT_CLIENT* mqtt_client, const uint8_t* initialPos, size_t packetLength, int flags)
+{
+    bool isDuplicateMsg = (flags & DUPLICATE_FLAG_MASK) ? true : false;
+    bool isRetainMsg = (flags & RETAIN_FLAG_MASK) ? true : false;
+    QOS_VALUE qosValue = (flags == 0) ? DELIVER_AT_MOST_ONCE : (flags & QOS_LEAST_ONCE_FLAG_MASK) ? DELIVER_AT_LEAST_ONCE : DELIVER_EXACTLY_ONCE;
+
+    const uint8_t* iterator = initialPos;
+    size_t numberOfBytesToBeRead = packetLength;
+    size_t lengthOfTopicName = numberOfBytesToBeRead;
+    const char* topicName = byteutil_readUTF(&iterator, &lengthOfTopicName);
+    if (topicName == NULL)
+    {
+        LogError("Publish MSG: failure reading topic name");
+        set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+    }
+    else
+    {
+        STRING_HANDLE trace_log = NULL;
+
+#ifndef NO_LOGGING
+        if (is_trace_enabled(mqtt_client))
+        {
+            trace_log = STRING_construct_sprintf("PUBLISH | IS_DUP: %s | RETAIN: %d | QOS: %s | TOPIC_NAME: %.*s", isDuplicateMsg ? TRUE_CONST : FALSE_CONST,
+                isRetainMsg ? 1 : 0, MU_ENUM_TO_STRING(QOS_VALUE, qosValue), (int)lengthOfTopicName, topicName);
+        }
+#endif
+        uint16_t packetId = 0;
+        numberOfBytesToBeRead = packetLength - (iterator - initialPos);
+        if (qosValue != DELIVER_AT_MOST_ONCE)
+        {
+            packetId = byteutil_read_uint16(&iterator, numberOfBytesToBeRead);
+#ifndef NO_LOGGING
+            if (is_trace_enabled(mqtt_client))
+            {
+                STRING_sprintf(trace_log, " | PACKET_ID: %"PRIu16, packetId);
+            }
+#endif
+        }
+        RECEIVED_PROPERTIES properties;
+        initReceivedProperties(&properties, 0);
+        if ((qosValue != DELIVER_AT_MOST_ONCE) && (packetId == 0))
+        {
+            LogError("Publish MSG: packetId=0, invalid");
+            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+        }
+        else if (is_protocol_v5(mqtt_client) && readProperties(&iterator, initialPos + packetLength, &properties) != 0)
+        {
+            LogError("Publish MSG: invalid properties");
+            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+        }
+        else
+        {
+            numberOfBytesToBeRead = packetLength - (iterator - initialPos);
+
+            // The message borrows the topic and payload from the receive buffer, no copy is made
+            MQTT_MESSAGE_HANDLE msgHandle = mqttmessage_create_in_place_n(packetId, topicName, lengthOfTopicName, qosValue, iterator, numberOfBytesToBeRead);
+            if (msgHandle == NULL)
+            {
+                LogError("failure in mqttmessage_create");
+                set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+            }
+            else if (mqttmessage_setIsDuplicateMsg(msgHandle, isDuplicateMsg) != 0 ||
+                     mqttmessage_setIsRetained(msgHandle, isRetainMsg) != 0)
+            {
+                LogError("failure setting mqtt message property");
+                set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+            }
+            else
+            {
+#ifndef NO_LOGGING
+                if (is_trace_enabled(mqtt_client))
+                {
+                    STRING_sprintf(trace_log, " | PAYLOAD_LEN: %lu", (unsigned long)numberOfBytesToBeRead);
+                    log_incoming_trace(mqtt_client, trace_log);
+                }
+#endif
+                if (qosValue == DELIVER_EXACTLY_ONCE && mqtt_client->receivedIds != NULL && isReceivedId(mqtt_client, packetId))
+                {
+                    // Delivered before the PUBREC got through, possibly before a restart
+                    SendMessageAck(mqtt_client, packetId, qosValue);
+                }
+                else if (isDuplicateMsg && qosValue != DELIVER_AT_MOST_ONCE && isAwaitingAck(&mqtt_client->receiveCredit, packetId))
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_107: [A PUBLISH with the DUP flag set for a packet id still waiting for mqtt_client_send_message_response shall not be delivered again, the pending acknowledgement answers both.]*/
+                    LogInfo("Dropping redelivered packet id %" PRIu16 " that is waiting for its acknowledgement", packetId);
+                }
+                else
+                {
+                    MQTT_CLIENT_ACK_OPTION ack_option;
+                    TOPIC_DISPATCH dispatch;
+                    dispatch.msgHandle = msgHandle;
+                    dispatch.ackOption = MQTT_CLIENT_ACK_NONE;
+
+                    /*Codes_SRS_MQTT_CLIENT_07_085: [When topic handlers are set, a received message shall be passed to the handler of every filter matching its topic with mqtt_topic_trie_match, and to the ON_MQTT_MESSAGE_RECV_CALLBACK only if no filter matches.]*/
+                    if (mqtt_client->topicHandlers != NULL &&
+                        dispatchTopicHandlers(mqtt_client, topicName, lengthOfTopicName, &dispatch) > 0)
+                    {
+                        ack_option = dispatch.ackOption;
+                    }
+                    else
+                    {
+                        ack_option = mqtt_client->fnMessageRecv(msgHandle, mqtt_client->ctx);
+                    }
+
+                    if (ack_option == MQTT_CLIENT_ACK_SYNC)
+                    {
+                        SendMessageAck(mqtt_client, packetId, qosValue);
+                    }
+                    else if (ack_option == MQTT_CLIENT_ACK_ASYNC && qosValue != DELIVER_AT_MOST_ONCE)
+                    {
+                        /*Codes_SRS_MQTT_CLIENT_07_106: [A QoS 1 or QoS 2 message answered with MQTT_CLIENT_ACK_ASYNC shall use one receive credit until mqtt_client_send_message_response is called for its packet id.]*/
+                        setAwaitingAck(&mqtt_client->receiveCredit, packetId, true);
+                    }
+                }
+            }
+            mqttmessage_destroy(msgHandle);
+        }
+
+        if (trace_log != NULL)
+        {
+            STRING_delete(trace_log);
+        }
+    }
+}
+
+// Takes on the limits an MQTT 5 server sent in an accepting CONNACK
+static void applyServerLimits(MQTT_CLIENT* mqtt_client, const RECEIVED_PROPERTIES* properties)
+{
+    mqtt_client->server.receiveMaximum = properties->receiveMaximum;
+    mqtt_client->server.maximumPacketSize = properties->maximumPacketSize;
+    mqtt_client->server.topicAliasMaximum = properties->topicAliasMaximum;
+    mqtt_client->server.nextTopicAlias = 1;
+    if (mqtt_client->topicTable != NULL)
+    {
+        mqtt_topic_table_clear_aliases(mqtt_client->topicTable);
+    }
+    if (properties->hasServerKeepAlive)
+    {
+        mqtt_client->keepAliveInterval = properties->serverKeepAlive;
+        mqtt_client->maxPingRespTime = (DEFAULT_MAX_PING_RESPONSE_TIME < properties->serverKeepAlive / 2) ? DEFAULT_MAX_PING_RESPONSE_TIME : properties->serverKeepAlive / 2;
+    }
+}
+
+// Copies a PUBLISH read while the receive credit is used up, the codec reuses packetData for the next packet
+static void holdPublish(MQTT_CLIENT* mqtt_client, const uint8_t* packetData, size_t packetLength, int flags)
+{
+    HELD_PUBLISH* held = (HELD_PUBLISH*)malloc(sizeof(HELD_PUBLISH) + packetLength);
+    if (held == NULL)
+    {
+        LogError("Failure allocating a held publish of %lu bytes", (unsigned long)packetLength);
+        set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+    }
+    else
+    {
+        held->next = NULL;
+        held->flags = flags;
+        held->length = packetLength;
+        if (packetLength > 0)
+        {
+            (void)memcpy(held->data, packetData, packetLength);
+        }
+        if (mqtt_client->receiveCredit.heldTail == NULL)
+        {
+            mqtt_client->receiveCredit.heldHead = held;
+        }
+        else
+        {
+            mqtt_client->receiveCredit.heldTail->next = held;
+        }
+        mqtt_client->receiveCredit.heldTail = held;
+    }
+}
+
+// Delivers held publishes in order for as long as the receive credit allows
+static void deliverHeldPublishes(MQTT_CLIENT* mqtt_client)
+{
+    while (mqtt_client->receiveCredit.heldHead != NULL && !isReceivePaused(mqtt_client))
+    {
+        HELD_PUBLISH* held = mqtt_client->receiveCredit.heldHead;
+        mqtt_client->receiveCredit.heldHead = held->next;
+        if (mqtt_client->receiveCredit.heldHead == NULL)
+        {
+            mqtt_client->receiveCredit.heldTail = NULL;
+        }
+        ProcessPublishMessage(mqtt_client, held->data, held->length, held->flags);
+        free(held);
+    }
+}
+
+static void recvCompleteCallback(void* context, CONTROL_PACKET_TYPE packet, int flags, const uint8_t* packetData, size_t packetLength)
+{
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
+    if (mqtt_client != NULL)
+    {
+        const uint8_t* iterator = packetData;
+
+        countIncomingPacket(mqtt_client, packet, packetData, packetLength);
+        if (mqtt_client->traceRing != NULL || mqtt_client->capture != NULL)
+        {
+            tickcounter_ms_t current_ms;
+            if (getCurrentMs(mqtt_client, &current_ms) == 0)
+            {
+                if (mqtt_client->traceRing != NULL)
+                {
+                    traceIncomingPacket(mqtt_client, packet, flags, packetData, packetLength, current_ms);
+                }
+                if (mqtt_client->capture != NULL)
+                {
+                    captureIncomingPacket(mqtt_client, packet, flags, packetData, packetLength, current_ms);
+                }
+            }
+        }
+#ifdef ENABLE_RAW_TRACE
+        logIncomingRawTrace(mqtt_client, packet, (uint8_t)flags, iterator, packetLength);
+#endif
+        const uint8_t* packetEnd = (iterator == NULL) ? NULL : iterator + packetLength;
+        bool isV5 = is_protocol_v5(mqtt_client);
+        RECEIVED_PROPERTIES properties;
+
+        initReceivedProperties(&properties, mqtt_client->mqttOptions.sessionExpiryInterval);
+        if ((iterator != NULL && packetLength > 0) || packet == PINGRESP_TYPE || packet == DISCONNECT_TYPE)
+        {
+            switch (packet)
+            {
+                case CONNACK_TYPE:
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_028: [If the actionResult parameter is of type CONNECT_ACK then the msgInfo value shall be a CONNECT_ACK structure.]*/
+                    CONNECT_ACK connack = { 0 };
+                    if (isV5 ? (packetLength < 2) : (packetLength != 2)) // CONNACK payload must be only 2 bytes before MQTT 5
+                    {
+                        LogError("Invalid CONNACK packet.");
+                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                        break;
+                    }
+
+                    uint8_t connect_acknowledge_flags = byteutil_readByte(&iterator);
+                    if (connect_acknowledge_flags & 0xFE) // bits 7-1 must be zero
+                    {
+                        LogError("Invalid CONNACK packet.");
+                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                        break;
+                    }
+
+                    connack.isSessionPresent = (connect_acknowledge_flags == 0x1) ? true : false;
+                    uint8_t rc = byteutil_readByte(&iterator);
+                    if (!isV5)
+                    {
+                        connack.returnCode =
+                            (rc < ((uint8_t)CONN_REFUSED_UNKNOWN)) ?
+                            (CONNECT_RETURN_CODE)rc : CONN_REFUSED_UNKNOWN;
+                    }
+                    /*Codes_SRS_MQTT_CLIENT_07_091: [On an MQTT 5 connection the reason codes and properties of CONNACK, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBACK and UNSUBACK shall be read into the acknowledgement passed to the ON_MQTT_OPERATION_CALLBACK, with the CONNACK reason code mapped to the closest CONNECT_RETURN_CODE, and a malformed property block shall raise MQTT_CLIENT_COMMUNICATION_ERROR.]*/
+                    else if (iterator < packetEnd && readProperties(&iterator, packetEnd, &properties) != 0)
+                    {
+                        LogError("Invalid CONNACK properties.");
+                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                        break;
+                    }
+                    else
+                    {
+                        connack.reasonCode = rc;
+                        connack.returnCode = getConnectReturnCode(rc);
+                        connack.sessionExpiryInterval = properties.sessionExpiryInterval;
+                        connack.receiveMaximum = properties.receiveMaximum;
+                        connack.maximumPacketSize = properties.maximumPacketSize;
+                        connack.topicAliasMaximum = properties.topicAliasMaximum;
+                        connack.serverKeepAlive = properties.hasServerKeepAlive ? properties.serverKeepAlive : mqtt_client->keepAliveInterval;
+                        connack.maximumQos = (properties.maximumQos <= (uint8_t)DELIVER_EXACTLY_ONCE) ? (QOS_VALUE)properties.maximumQos : DELIVER_EXACTLY_ONCE;
+                        connack.retainAvailable = properties.retainAvailable;
+                        connack.wildcardSubscriptionAvailable = properties.wildcardSubscriptionAvailable;
+                        connack.sharedSubscriptionAvailable = properties.sharedSubscriptionAvailable;
+                        if (connack.returnCode == CONNECTION_ACCEPTED)
+                        {
+                            applyServerLimits(mqtt_client, &properties);
+                        }
+                    }
+
+#ifndef NO_LOGGING
+                    if (is_trace_enabled(mqtt_client))
+                    {
+                        STRING_HANDLE trace_log = STRING_construct_sprintf("CONNACK | SESSION_PRESENT: %s | RETURN_CODE: 0x%x", connack.isSessionPresent ? TRUE_CONST : FALSE_CONST, connack.returnCode);
+                        log_incoming_trace(mqtt_client, trace_log);
+                        STRING_delete(trace_log);
+                    }
+#endif
+                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_CONNACK, (void*)&connack, mqtt_client->ctx);
+
+                    if (connack.returnCode == CONNECTION_ACCEPTED)
+                    {
+                        mqtt_client->mqtt_status |= MQTT_STATUS_CLIENT_CONNECTED;
+                        mqtt_client->inflight.resendAll = (mqtt_client->inflight.count > 0);
+                        mqtt_client->reconnect.attempt = 0;
+                        if (!connack.isSessionPresent)
+                        {
+                            /*Codes_SRS_MQTT_CLIENT_07_104: [A CONNACK without a session present shall return every receive credit, the server will not redeliver the messages waiting for their acknowledgement.]*/
+                            forgetAwaitingAcks(&mqtt_client->receiveCredit);
+                        }
+                        if (mqtt_client->reconnect.reopened)
+                        {
+                            mqtt_client->reconnect.reopened = false;
+                            /*Codes_SRS_MQTT_CLIENT_07_080: [When resubscribe is set, after a CONNACK without a session present that follows a reconnect, the client shall send one SUBSCRIBE for every subscription acknowledged before.]*/
+                            if (mqtt_client->reconnect.resubscribe && !connack.isSessionPresent)
+                            {
+                                resubscribe(mqtt_client);
+                            }
+                        }
+                    }
+                    break;
+                }
+                case PUBLISH_TYPE:
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_166: [A PUBLISH received while every receive credit is used, or while earlier publishes are still held, shall be held in order and delivered by mqtt_client_dowork once an acknowledgement returns a credit.]*/
+                    if (isReceivePaused(mqtt_client) || mqtt_client->receiveCredit.heldHead != NULL)
+                    {
+                        holdPublish(mqtt_client, iterator, packetLength, flags);
+                    }
+                    else
+                    {
+                        ProcessPublishMessage(mqtt_client, iterator, packetLength, flags);
+                    }
+                    break;
+                }
+                case PUBACK_TYPE:
+                case PUBREC_TYPE:
+                case PUBREL_TYPE:
+                case PUBCOMP_TYPE:
+                {
+                    if (isV5 ? (packetLength < 2) : (packetLength != 2)) // PUBXXX payload must be only 2 bytes before MQTT 5
+                    {
+                        LogError("Invalid packet length.");
+                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                        break;
+                    }
+
+                    /*Codes_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+                    MQTT_CLIENT_EVENT_RESULT action = (packet == PUBACK_TYPE) ? MQTT_CLIENT_ON_PUBLISH_ACK :
+                        (packet == PUBREC_TYPE) ? MQTT_CLIENT_ON_PUBLISH_RECV :
+                        (packet == PUBREL_TYPE) ? MQTT_CLIENT_ON_PUBLISH_REL : MQTT_CLIENT_ON_PUBLISH_COMP;
+
+                    PUBLISH_ACK publish_ack = { 0 };
+                    publish_ack.packetId = byteutil_read_uint16(&iterator, packetLength);
+                    if (isV5 && iterator < packetEnd)
+                    {
+                        // The reason code and properties are left out when the reason is success
+                        publish_ack.reasonCode = byteutil_readByte(&iterator);
+                        if (iterator < packetEnd && readProperties(&iterator, packetEnd, &properties) != 0)
+                        {
+                            LogError("Invalid acknowledgement properties.");
+                            set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                            break;
+                        }
+                    }
+                    // A PUBREC that fails the publish ends its exchange, there is nothing to release
+                    bool isRejected = (packet == PUBREC_TYPE && publish_ack.reasonCode >= REASON_CODE_FAILURE);
+
+#ifndef NO_LOGGING
+                    if (is_trace_enabled(mqtt_client))
+                    {
+                        STRING_HANDLE trace_log = STRING_construct_sprintf("%s | PACKET_ID: %"PRIu16, packet == PUBACK_TYPE ? "PUBACK" : (packet == PUBREC_TYPE) ? "PUBREC" : (packet == PUBREL_TYPE) ? "PUBREL" : "PUBCOMP",
+                            publish_ack.packetId);
+                        if (publish_ack.reasonCode != 0)
+                        {
+                            STRING_sprintf(trace_log, " | REASON_CODE: 0x%x", publish_ack.reasonCode);
+                        }
+
+                        log_incoming_trace(mqtt_client, trace_log);
+                        STRING_delete(trace_log);
+                    }
+#endif
+                    uint8_t pubRel[MQTT_CODEC_PUBLISH_REPLY_SIZE];
+                    bool hasReply = false;
+                    // Free the window slot first so the callback can publish again straight away
+                    if (mqtt_client->inflight.count > 0 && packet != PUBREL_TYPE)
+                    {
+                        acknowledgeInflightMessage(mqtt_client, isRejected ? PUBCOMP_TYPE : packet, publish_ack.packetId);
+                    }
+                    mqtt_client->fnOperationCallback(mqtt_client, action, (void*)&publish_ack, mqtt_client->ctx);
+                    if (packet == PUBREC_TYPE && !isRejected)
+                    {
+                        if (mqtt_codec_encode_pubrel(publish_ack.packetId, pubRel) != 0)
+                        {
+                            LogError("Failed to encode publish release message.");
+                            set_error_callback(mqtt_client, MQTT_CLIENT_UNKNOWN_ERROR);
+                        }
+                        else
+                        {
+                            hasReply = true;
+                        }
+                    }
+                    else if (packet == PUBREL_TYPE)
+                    {
+                        if (mqtt_client->sessionStore != NULL)
+                        {
+                            releaseReceivedPublish(mqtt_client, publish_ack.packetId);
+                        }
+                        if (mqtt_codec_encode_pubcomp(publish_ack.packetId, pubRel) != 0)
+                        {
+                            LogError("Failed to encode publish complete message.");
+                            set_error_callback(mqtt_client, MQTT_CLIENT_UNKNOWN_ERROR);
+                        }
+                        else
+                        {
+                            hasReply = true;
+                        }
+                    }
+                    if (hasReply)
+                    {
+                        if (queuePacketItem(mqtt_client, (packet == PUBREC_TYPE) ? PUBREL_TYPE : PUBCOMP_TYPE, pubRel, MQTT_CODEC_PUBLISH_REPLY_SIZE) != 0)
+                        {
+                            LogError("Failed sending publish reply.");
+                            set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                        }
+                    }
+                    break;
+                }
+                case SUBACK_TYPE:
+                {
+
+                    /*Codes_SRS_MQTT_CLIENT_07_030: [If the actionResult parameter is of type SUBACK_TYPE then the msgInfo value shall be a SUBSCRIBE_ACK structure.]*/
+                    SUBSCRIBE_ACK suback = { 0 };
+
+                    if (packetLength < 2)
+                    {
+                        LogError("Invalid SUBACK packet length.");
+                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                        break;
+                    }
+                    suback.packetId = byteutil_read_uint16(&iterator, packetLength);
+                    if (isV5 && readProperties(&iterator, packetEnd, &properties) != 0)
+                    {
+                        LogError("Invalid SUBACK properties.");
+                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                        break;
+                    }
+                    size_t remainLen = (size_t)(packetEnd - iterator);
+                    suback.reasonCodes = iterator;
+
+#ifndef NO_LOGGING
+                    STRING_HANDLE trace_log = NULL;
+                    if (is_trace_enabled(mqtt_client))
+                    {
+                        trace_log = STRING_construct_sprintf("SUBACK | PACKET_ID: %"PRIu16, suback.packetId);
+                    }
+#endif
+                    // Allocate the remaining len
+                    size_t malloc_size = safe_multiply_size_t(sizeof(QOS_VALUE), remainLen);
+                    if (malloc_size != SIZE_MAX && 
+                        (suback.qosReturn = (QOS_VALUE*)malloc(malloc_size)) != NULL)
+                    {
+                        while (remainLen > 0)
+                        {
+                            uint8_t qosRet = byteutil_readByte(&iterator);
+                            if (isV5 ? (qosRet > (uint8_t)DELIVER_EXACTLY_ONCE && qosRet < REASON_CODE_FAILURE) : (qosRet & 0x7C)) // SUBACK QOS bits 6-2 must be zero before MQTT 5
+                            {
+                                LogError("Invalid SUBACK_TYPE packet.");
+                                set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                                break;
+                            }
+                            suback.qosReturn[suback.qosCount++] =
+                                (qosRet <= ((uint8_t)DELIVER_EXACTLY_ONCE)) ?
+                                (QOS_VALUE)qosRet :  DELIVER_FAILURE;
+                            remainLen--;
+#ifndef NO_LOGGING
+                            if (is_trace_enabled(mqtt_client))
+                            {
+                                STRING_sprintf(trace_log, " | RETURN_CODE: %"PRIu16, suback.qosReturn[suback.qosCount-1]);
+                            }
+#endif
+                        }
+
+#ifndef NO_LOGGING
+                        if (is_trace_enabled(mqtt_client))
+                        {
+                            log_incoming_trace(mqtt_client, trace_log);
+                            STRING_delete(trace_log);
+                        }
+#endif
+                        if (mqtt_client->reconnect.resubscribeId != 0 && suback.packetId == mqtt_client->reconnect.resubscribeId)
+                        {
+                            // The application didn't send this SUBSCRIBE, so its SUBACK isn't passed on
+                            releaseResubscribeId(mqtt_client);
+                        }
+                        else
+                        {
+                            recordSubscribeAck(&mqtt_client->reconnect, &suback);
+                            mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_SUBSCRIBE_ACK, (void*)&suback, mqtt_client->ctx);
+                        }
+                        free(suback.qosReturn);
+                    }
+                    else
+                    {
+                        LogError("allocation of quality of service value failed, size:%zu", malloc_size);
+                        set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+                    }
+                    break;
+                }
+                case UNSUBACK_TYPE:
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_031: [If the actionResult parameter is of type UNSUBACK_TYPE then the msgInfo value shall be a UNSUBSCRIBE_ACK structure.]*/
+                    UNSUBSCRIBE_ACK unsuback = { 0 };
+                    if (isV5 ? (packetLength < 2) : (packetLength != 2)) // UNSUBACK_TYPE payload must be only 2 bytes before MQTT 5
+                    {
+                        LogError("Invalid UNSUBACK packet length.");
+                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                        break;
+                    }
+
+                    unsuback.packetId = byteutil_read_uint16(&iterator, packetLength);
+                    if (isV5)
+                    {
+                        if (readProperties(&iterator, packetEnd, &properties) != 0)
+                        {
+                            LogError("Invalid UNSUBACK properties.");
+                            set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                            break;
+                        }
+                        unsuback.reasonCodes = iterator;
+                        unsuback.reasonCodeCount = (size_t)(packetEnd - iterator);
+                    }
+
+#ifndef NO_LOGGING
+                    if (is_trace_enabled(mqtt_client))
+                    {
+                        STRING_HANDLE trace_log = STRING_construct_sprintf("UNSUBACK | PACKET_ID: %"PRIu16, unsuback.packetId);
+                        log_incoming_trace(mqtt_client, trace_log);
+                        STRING_delete(trace_log);
+                    }
+#endif
+                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_UNSUBSCRIBE_ACK, (void*)&unsuback, mqtt_client->ctx);
+                    break;
+                }
+                case PINGRESP_TYPE:
+                    mqtt_client->timeSincePing = 0;
+#ifndef NO_LOGGING
+                    if (is_trace_enabled(mqtt_client))
+                    {
+                        STRING_HANDLE trace_log = STRING_construct_sprintf("PINGRESP");
+                        log_incoming_trace(mqtt_client, trace_log);
+                        STRING_delete(trace_log);
+                    }
+#endif
+                    // Forward ping response to operation callback
+                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_PING_RESPONSE, NULL, mqtt_client->ctx);
+                    break;
+                case DISCONNECT_TYPE:
+                {
+                    // Only an MQTT 5 server sends DISCONNECT, no reason code means a normal disconnection
+                    uint8_t reasonCode = (iterator != NULL && packetLength > 0) ? byteutil_readByte(&iterator) : 0;
+                    LogError("Server sent DISCONNECT with reason code 0x%x", reasonCode);
+#ifndef NO_LOGGING
+                    if (is_trace_enabled(mqtt_client))
+                    {
+                        STRING_HANDLE trace_log = STRING_construct_sprintf("DISCONNECT | REASON_CODE: 0x%x", reasonCode);
+                        log_incoming_trace(mqtt_client, trace_log);
+                        STRING_delete(trace_log);
+                    }
+#endif
+                    /*Codes_SRS_MQTT_CLIENT_07_098: [When the server sends DISCONNECT the client shall consider itself disconnected and call the ON_MQTT_ERROR_CALLBACK with MQTT_CLIENT_CONNECTION_ERROR.]*/
+                    mqtt_client->mqtt_status &= ~MQTT_STATUS_CLIENT_CONNECTED;
+                    set_error_callback(mqtt_client, MQTT_CLIENT_CONNECTION_ERROR);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+    else
+    {
+        LogError("recvCompleteCallback context failed.");
+    }
+}
+
+void mqtt_client_clear_xio(MQTT_CLIENT_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        MQTT_CLIENT *mqtt_client = (MQTT_CLIENT *)handle;
 
-                    uint8_t connect_acknowledge_flags = byteutil_readByte(&iterator);
-                    if (connect_acknowledge_flags & 0xFE) // bits 7-1 must be zero
+        // The upstream transport handle allocates and deallocates the xio handle.
+        // The reference to that xio handle is shared between this layer (mqtt layer)
+        // and the upstream layer. The clearing done here is to signal to this layer
+        // that the handle is no longer available to be used. This is different from
+        // deiniting the mqtt client in that we do not want an entire teardown, but
+        // only a possible re-upping of the xio in the future.
+        mqtt_client->xioHandle = NULL;
+        /*Codes_SRS_MQTT_CLIENT_07_081: [mqtt_client_disconnect and mqtt_client_clear_xio shall stop reconnecting.]*/
+        mqtt_client->reconnect.xioHandle = NULL;
+        mqtt_client->reconnect.pending = false;
+    }
+}
+
+MQTT_CLIENT_HANDLE mqtt_client_init(ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, ON_MQTT_OPERATION_CALLBACK operation_cb, void* opCallbackCtx, ON_MQTT_ERROR_CALLBACK onErrorCallBack, void* errorCBCtx)
+{
+    MQTT_CLIENT* result;
+    /*Codes_SRS_MQTT_CLIENT_07_001: [If the parameters ON_MQTT_MESSAGE_RECV_CALLBACK is NULL then mqttclient_init shall return NULL.]*/
+    if (msgRecv == NULL || operation_cb == NULL)
+    {
+        LogError("Invalid parameter specified msgRecv: %p, operation_cb: %p", msgRecv, operation_cb);
+        result = NULL;
+    }
+    else
+    {
+        result = malloc(sizeof(MQTT_CLIENT));
+        if (result == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
+            LogError("mqtt_client_init failure: Allocation Failure");
+        }
+        else
+        {
+            memset(result, 0, sizeof(MQTT_CLIENT));
+            /*Codes_SRS_MQTT_CLIENT_07_003: [mqttclient_init shall allocate MQTTCLIENT_DATA_INSTANCE and return the MQTTCLIENT_HANDLE on success.]*/
+            result->packetState = UNKNOWN_TYPE;
+            result->fnOperationCallback = operation_cb;
+            result->ctx = opCallbackCtx;
+            result->fnMessageRecv = msgRecv;
+            result->fnOnErrorCallBack = onErrorCallBack;
+            result->errorCBCtx = errorCBCtx;
+            result->qosValue = DELIVER_AT_MOST_ONCE;
+            result->packetTickCntr = tickcounter_create();
+            result->maxPingRespTime = DEFAULT_MAX_PING_RESPONSE_TIME;
+            if (result->packetTickCntr == NULL)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
+                LogError("mqtt_client_init failure: tickcounter_create failure");
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                result->codec_handle = mqtt_codec_create_with_view(recvCompleteCallback, result);
+                if (result->codec_handle == NULL)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
+                    LogError("mqtt_client_init failure: mqtt_codec_create_with_view failure");
+                    tickcounter_destroy(result->packetTickCntr);
+                    free(result);
+                    result = NULL;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void mqtt_client_deinit(MQTT_CLIENT_HANDLE handle)
+{
+    /*Codes_SRS_MQTT_CLIENT_07_004: [If the parameter handle is NULL then function mqtt_client_deinit shall do nothing.]*/
+    if (handle != NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_005: [mqtt_client_deinit shall deallocate all memory allocated in this unit.]*/
+        MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+        if (mqtt_client->timerWheel != NULL)
+        {
+            mqtt_timer_wheel_cancel(mqtt_client->timerWheel, &mqtt_client->deadlineTimer);
+        }
+        tickcounter_destroy(mqtt_client->packetTickCntr);
+        mqtt_codec_destroy(mqtt_client->codec_handle);
+        clear_mqtt_options(mqtt_client);
+        if (mqtt_client->outbound.buffer != NULL)
+        {
+            free(mqtt_client->outbound.buffer);
+        }
+        if (mqtt_client->rawTraceBuffer != NULL)
+        {
+            free(mqtt_client->rawTraceBuffer);
+        }
+        clearInflightStore(&mqtt_client->inflight);
+        if (mqtt_client->receivedIds != NULL)
+        {
+            free(mqtt_client->receivedIds);
+        }
+        if (mqtt_client->receiveCredit.awaitingIds != NULL)
+        {
+            free(mqtt_client->receiveCredit.awaitingIds);
+        }
+        clearHeldPublishes(&mqtt_client->receiveCredit);
+        if (mqtt_client->offlineQueue != NULL)
+        {
+            mqtt_offline_queue_destroy(mqtt_client->offlineQueue);
+        }
+        if (mqtt_client->submitQueue != NULL)
+        {
+            mqtt_submit_queue_destroy(mqtt_client->submitQueue);
+        }
+        if (mqtt_client->submitPending != NULL)
+        {
+            BUFFER_delete(mqtt_client->submitPending);
+        }
+        clearSubscriptions(&mqtt_client->reconnect);
+        clearPendingTopicHandlers(mqtt_client);
+        if (mqtt_client->topicHandlers != NULL)
+        {
+            mqtt_topic_trie_destroy(mqtt_client->topicHandlers);
+        }
+        if (mqtt_client->topicTable != NULL)
+        {
+            mqtt_topic_table_destroy(mqtt_client->topicTable);
+        }
+        if (mqtt_client->closing.callbacksPending > 0)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_156: [If the transport has not reported a close yet, mqtt_client_deinit shall not call the ON_MQTT_DISCONNECTED_CALLBACK and shall leave the client to be freed by the close callback.]*/
+            mqtt_client->closing.xioHandle = NULL;
+            mqtt_client->closing.released = true;
+        }
+        else
+        {
+            free(mqtt_client);
+        }
+    }
+}
+
+int mqtt_client_connect(MQTT_CLIENT_HANDLE handle, XIO_HANDLE xioHandle, MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    int result;
+    /*SRS_MQTT_CLIENT_07_006: [If any of the parameters handle, ioHandle, or mqttOptions are NULL then mqtt_client_connect shall return a non-zero value.]*/
+    if (handle == NULL || mqttOptions == NULL || xioHandle == NULL)
+    {
+        LogError("mqtt_client_connect: NULL argument (handle = %p, mqttOptions = %p, xioHandle: %p)", handle, mqttOptions, xioHandle);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+        if (mqtt_client->closing.xioHandle != NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_157: [If a close is still in progress mqtt_client_connect shall return a non-zero value without calling xio_open or the ON_MQTT_DISCONNECTED_CALLBACK.]*/
+            LogError("Error: the previous connection is still closing");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            mqtt_client->xioHandle = xioHandle;
+            mqtt_client->reconnect.xioHandle = xioHandle;
+            mqtt_client->reconnect.pending = false;
+            mqtt_client->reconnect.reopened = false;
+            mqtt_client->reconnect.attempt = 0;
+            mqtt_client->packetState = UNKNOWN_TYPE;
+            // Nothing is sent on the new connection before its CONNACK
+            mqtt_client->mqtt_status &= ~MQTT_STATUS_CLIENT_CONNECTED;
+            mqtt_client->qosValue = mqttOptions->qualityOfServiceValue;
+            mqtt_client->keepAliveInterval = mqttOptions->keepAliveInterval;
+            mqtt_client->maxPingRespTime = (DEFAULT_MAX_PING_RESPONSE_TIME < mqttOptions->keepAliveInterval/2) ? DEFAULT_MAX_PING_RESPONSE_TIME : mqttOptions->keepAliveInterval/2;
+            mqtt_client->timeSincePing = 0;
+            // The server sends its limits again in the CONNACK of the new connection
+            memset(&mqtt_client->server, 0, sizeof(SERVER_LIMITS));
+            if (cloneMqttOptions(mqtt_client, mqttOptions) != 0)
+            {
+                LogError("Error: Clone Mqtt Options failed");
+                result = MU_FAILURE;
+            }
+            /*Codes_SRS_MQTT_CLIENT_07_008: [mqtt_client_connect shall open the XIO_HANDLE by calling into the xio_open interface.]*/
+            else if (xio_open(xioHandle, onOpenComplete, mqtt_client, onBytesReceived, mqtt_client, onIoError, mqtt_client) != 0)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_007: [If any failure is encountered then mqtt_client_connect shall return a non-zero value.]*/
+                LogError("Error: io_open failed");
+                result = MU_FAILURE;
+                mqtt_client->xioHandle = NULL;
+                mqtt_client->reconnect.xioHandle = NULL;
+                // Remove cloned options
+                clear_mqtt_options(mqtt_client);
+            }
+            else
+            {
+                result = 0;
+            }
+        }
+    }
+    return result;
+}
+
+int mqtt_client_publish(MQTT_CLIENT_HANDLE handle, MQTT_MESSAGE_HANDLE msgHandle)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || msgHandle == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_019: [If one of the parameters handle or msgHandle is NULL then mqtt_client_publish shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, msgHandle: %p", mqtt_client, msgHandle);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_021: [mqtt_client_publish shall get the message information from the MQTT_MESSAGE_HANDLE.]*/
+        const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(msgHandle);
+        if (payload == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+            LogError("Error: mqttmessage_getApplicationMsg failed");
+            result = MU_FAILURE;
+        }
+        else if (mqtt_client->offlineQueue != NULL &&
+            (!is_client_connected(mqtt_client) || mqtt_offline_queue_count(mqtt_client->offlineQueue) > 0))
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_069: [When an offline queue is set and the client is not connected, or queued publishes are still waiting, mqtt_client_publish shall encode the message with mqtt_codec_publish and queue it with mqtt_offline_queue_push.]*/
+            result = queueOfflinePublish(mqtt_client, msgHandle, payload);
+        }
+        else
+        {
+            STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
+
+            QOS_VALUE qos = mqttmessage_getQosType(msgHandle);
+            bool isDuplicate = mqttmessage_getIsDuplicateMsg(msgHandle);
+            bool isRetained = mqttmessage_getIsRetained(msgHandle);
+            uint16_t packetId = mqttmessage_getPacketId(msgHandle);
+            MQTT_TOPIC_HANDLE topic = mqttmessage_getInternedTopic(msgHandle);
+            const char* topicName = (topic == NULL) ? mqttmessage_getTopicName(msgHandle) : NULL;
+            size_t inflightSlot = INFLIGHT_NO_SLOT;
+            BUFFER_HANDLE publishPacket;
+
+            /*Codes_SRS_MQTT_CLIENT_07_054: [When the in-flight store is on, mqtt_client_publish shall give a QoS 1 or QoS 2 message a free packet id through mqttmessage_setPacketId and keep a copy of the message until it is acknowledged.]*/
+            if (qos != DELIVER_AT_MOST_ONCE && mqtt_client->inflight.maxInflight > 0 &&
+                (inflightSlot = addInflightMessage(mqtt_client, msgHandle, &packetId)) == INFLIGHT_NO_SLOT)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+                LogError("Error: failure tracking in-flight message");
+                result = MU_FAILURE;
+            }
+            /*Codes_SRS_MQTT_CLIENT_07_089: [If msgHandle was created on an interned topic then mqtt_client_publish shall encode it with mqtt_codec_publish_encoded_topic and the bytes returned by mqtt_topic_get_encoded instead of mqtt_codec_publish.]*/
+            /*Codes_SRS_MQTT_CLIENT_07_092: [When mqttOptions->protocolVersion is MQTT_PROTOCOL_V5, mqtt_client_publish, mqtt_client_publish_iov, mqtt_client_subscribe and mqtt_client_unsubscribe shall encode with mqtt_codec_publish_v5, mqtt_codec_publish_header_v5, mqtt_codec_subscribe_v5 and mqtt_codec_unsubscribe_v5.]*/
+            else if ((publishPacket = is_protocol_v5(mqtt_client) ?
+                encodePublishPacketV5(mqtt_client, topic, topicName, qos, isDuplicate, isRetained, packetId, payload, trace_log) :
+                encodePublishPacket(topic, topicName, qos, isDuplicate, isRetained, packetId, payload, trace_log)) == NULL)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+                LogError("Error: mqtt_codec_publish failed");
+                result = MU_FAILURE;
+            }
+            else
+            {
+                mqtt_client->packetState = PUBLISH_TYPE;
+
+                /*Codes_SRS_MQTT_CLIENT_07_022: [On success mqtt_client_publish shall send the MQTT SUBCRIBE packet to the endpoint.]*/
+                size_t size = BUFFER_length(publishPacket);
+                /*Codes_SRS_MQTT_CLIENT_07_063: [When a session store is set, mqtt_client_publish shall store an in-flight message as its encoded PUBLISH packet before sending it.]*/
+                if (inflightSlot != INFLIGHT_NO_SLOT && mqtt_client->sessionStore != NULL &&
+                    storeInflightPublish(mqtt_client, msgHandle, packetId, payload, publishPacket) != 0)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+                    LogError("Error: failure storing in-flight message");
+                    result = MU_FAILURE;
+                }
+                else if (queuePacketItem(mqtt_client, PUBLISH_TYPE, BUFFER_u_char(publishPacket), size) != 0)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+                    LogError("Error: mqtt_client_publish send failed");
+                    result = MU_FAILURE;
+                }
+                else
+                {
+                    if (qos != DELIVER_AT_MOST_ONCE)
                     {
-                        LogError("Invalid CONNACK packet.");
-                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
-                        break;
+                        startLatency(mqtt_client, PUBLISH_TYPE, packetId, isDuplicate);
+                    }
+                    if (is_protocol_v5(mqtt_client))
+                    {
+                        commitTopicAlias(mqtt_client, topic);
                     }
+                    log_outgoing_trace(mqtt_client, trace_log);
+                    result = 0;
+                }
+                BUFFER_delete(publishPacket);
+            }
+
+            if (result != 0 && inflightSlot != INFLIGHT_NO_SLOT)
+            {
+                if (mqtt_client->sessionStore != NULL)
+                {
+                    (void)mqtt_session_store_remove(mqtt_client->sessionStore, MQTT_SESSION_RECORD_PUBLISH, packetId);
+                }
+                removeInflightSlot(&mqtt_client->inflight, inflightSlot);
+            }
+            if (trace_log != NULL)
+            {
+                STRING_delete(trace_log);
+            }
+        }
+    }
+    return result;
+}
+
+int mqtt_client_publish_iov(MQTT_CLIENT_HANDLE handle, MQTT_MESSAGE_HANDLE msgHandle, const MQTT_PAYLOAD_SEGMENT* segments, size_t segmentCount, ON_MQTT_PAYLOAD_RELEASED_CALLBACK onPayloadReleased, void* releasedCtx)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    size_t payloadLen = 0;
+    size_t index;
+
+    for (index = 0; segments != NULL && index < segmentCount && payloadLen != SIZE_MAX; index++)
+    {
+        payloadLen = (segments[index].data == NULL && segments[index].length > 0) ? SIZE_MAX : safe_add_size_t(payloadLen, segments[index].length);
+    }
+
+    if (mqtt_client == NULL || msgHandle == NULL || (segments == NULL && segmentCount > 0) || payloadLen == SIZE_MAX)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_038: [If handle or msgHandle is NULL, or segments is NULL while segmentCount is not zero, or a segment with a non-zero length has NULL data then mqtt_client_publish_iov shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, msgHandle: %p, segments: %p", mqtt_client, msgHandle, segments);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        PUBLISH_IOV_CONTEXT* iov_context = (PUBLISH_IOV_CONTEXT*)malloc(sizeof(PUBLISH_IOV_CONTEXT));
+        if (iov_context == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_039: [If any failure is encountered then mqtt_client_publish_iov shall return a non-zero value and shall not call onPayloadReleased.]*/
+            LogError("Failure allocating publish context");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
+            uint8_t stackHeader[PUBLISH_HEADER_STACK_SIZE];
+            uint8_t* publishHeader = stackHeader;
+            size_t headerLen = sizeof(stackHeader);
+
+            iov_context->mqtt_client = mqtt_client;
+            iov_context->onPayloadReleased = onPayloadReleased;
+            iov_context->releasedCtx = releasedCtx;
+
+            /*Codes_SRS_MQTT_CLIENT_07_040: [mqtt_client_publish_iov shall get the message information from the MQTT_MESSAGE_HANDLE and encode only the PUBLISH header, into a stack buffer unless the topic name does not fit.]*/
+            QOS_VALUE qos = mqttmessage_getQosType(msgHandle);
+            bool isDuplicate = mqttmessage_getIsDuplicateMsg(msgHandle);
+            bool isRetained = mqttmessage_getIsRetained(msgHandle);
+            uint16_t packetId = mqttmessage_getPacketId(msgHandle);
+            MQTT_TOPIC_HANDLE topic = mqttmessage_getInternedTopic(msgHandle);
+            const char* topicName = (topic == NULL) ? mqttmessage_getTopicName(msgHandle) : NULL;
+            if (qos != DELIVER_AT_MOST_ONCE && mqtt_client->inflight.maxInflight > 0)
+            {
+                // The in-flight store keeps a copy of the message to resend, the borrowed segments can't be kept
+                /*Codes_SRS_MQTT_CLIENT_07_159: [If the in-flight window is on and msgHandle is QoS 1 or QoS 2 then mqtt_client_publish_iov shall return a non-zero value.]*/
+                LogError("Error: mqtt_client_publish_iov can't track a QoS %d message, use mqtt_client_publish while the in-flight window is on", (int)qos);
+                result = MU_FAILURE;
+            }
+            else if (mqtt_client->offlineQueue != NULL &&
+                (!is_client_connected(mqtt_client) || mqtt_offline_queue_count(mqtt_client->offlineQueue) > 0))
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_160: [When an offline queue is set and the client is not connected, or queued publishes are still waiting, mqtt_client_publish_iov shall return a non-zero value.]*/
+                LogError("Error: mqtt_client_publish_iov can't queue a message, use mqtt_client_publish while the client is offline");
+                result = MU_FAILURE;
+            }
+            /*Codes_SRS_MQTT_CLIENT_07_090: [If msgHandle was created on an interned topic then mqtt_client_publish_iov shall encode the header with mqtt_codec_publish_header_encoded_topic instead of mqtt_codec_publish_header.]*/
+            else if (encodePublishHeader(mqtt_client, topic, topicName, qos, isDuplicate, isRetained, packetId, payloadLen, publishHeader, &headerLen, trace_log) != 0)
+            {
+                if (headerLen > sizeof(stackHeader) && (publishHeader = (uint8_t*)malloc(headerLen)) != NULL &&
+                    encodePublishHeader(mqtt_client, topic, topicName, qos, isDuplicate, isRetained, packetId, payloadLen, publishHeader, &headerLen, trace_log) == 0)
+                {
+                    result = 0;
+                }
+                else
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_039: [If any failure is encountered then mqtt_client_publish_iov shall return a non-zero value and shall not call onPayloadReleased.]*/
+                    LogError("Error: mqtt_codec_publish_header failed");
+                    result = MU_FAILURE;
+                }
+            }
+            else
+            {
+                result = 0;
+            }
 
-                    connack.isSessionPresent = (connect_acknowledge_flags == 0x1) ? true : false;
-                    uint8_t rc = byteutil_readByte(&iterator);
-                    connack.returnCode =
-                        (rc < ((uint8_t)CONN_REFUSED_UNKNOWN)) ?
-                        (CONNECT_RETURN_CODE)rc : CONN_REFUSED_UNKNOWN;
+            if (result == 0)
+            {
+                mqtt_client->packetState = PUBLISH_TYPE;
 
-#ifndef NO_LOGGING
-                    if (is_trace_enabled(mqtt_client))
+                /*Codes_SRS_MQTT_CLIENT_07_041: [mqtt_client_publish_iov shall send the header and then each payload segment to the transport without copying the payload.]*/
+                if (sendPacketItem(mqtt_client, PUBLISH_TYPE, publishHeader, headerLen) != 0)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_039: [If any failure is encountered then mqtt_client_publish_iov shall return a non-zero value and shall not call onPayloadReleased.]*/
+                    LogError("Error: mqtt_client_publish_iov header send failed");
+                    result = MU_FAILURE;
+                }
+                else if (payloadLen == 0)
+                {
+                    // Nothing was borrowed from the caller
+                    /*Codes_SRS_MQTT_CLIENT_07_167: [mqtt_client_publish_iov shall not send segments with a zero length, and if every segment is empty it shall call onPayloadReleased with IO_SEND_OK once the header is sent.]*/
+                    if (onPayloadReleased != NULL)
                     {
-                        STRING_HANDLE trace_log = STRING_construct_sprintf("CONNACK | SESSION_PRESENT: %s | RETURN_CODE: 0x%x", connack.isSessionPresent ? TRUE_CONST : FALSE_CONST, connack.returnCode);
-                        log_incoming_trace(mqtt_client, trace_log);
-                        STRING_delete(trace_log);
+                        onPayloadReleased(releasedCtx, IO_SEND_OK);
                     }
-#endif
-                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_CONNACK, (void*)&connack, mqtt_client->ctx);
+                    free(iov_context);
+                    iov_context = NULL;
+                    log_outgoing_trace(mqtt_client, trace_log);
+                }
+                else if (sendPayloadSegments(mqtt_client, segments, segmentCount, iov_context) != 0)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_043: [If a payload segment fails to send after the header was sent then mqtt_client_publish_iov shall call the ON_MQTT_ERROR_CALLBACK with MQTT_CLIENT_COMMUNICATION_ERROR.]*/
+                    LogError("Error: mqtt_client_publish_iov payload send failed");
+                    set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+                    result = MU_FAILURE;
+                }
+                else
+                {
+                    // The transport owns the context until the last segment completes
+                    iov_context = NULL;
+                    log_outgoing_trace(mqtt_client, trace_log);
+                }
 
-                    if (connack.returnCode == CONNECTION_ACCEPTED)
-                    {
-                        mqtt_client->mqtt_status |= MQTT_STATUS_CLIENT_CONNECTED;
-                    }
-                    break;
+                if (result == 0 && is_protocol_v5(mqtt_client))
+                {
+                    commitTopicAlias(mqtt_client, topic);
                 }
-                case PUBLISH_TYPE:
+                if (result == 0 && qos != DELIVER_AT_MOST_ONCE)
                 {
-                    ProcessPublishMessage(mqtt_client, iterator, packetLength, flags);
-                    break;
+                    startLatency(mqtt_client, PUBLISH_TYPE, packetId, isDuplicate);
                 }
-                case PUBACK_TYPE:
-                case PUBREC_TYPE:
-                case PUBREL_TYPE:
-                case PUBCOMP_TYPE:
+            }
+
+            if (publishHeader != stackHeader)
+            {
+                free(publishHeader);
+            }
+            if (iov_context != NULL)
+            {
+                free(iov_context);
+            }
+            if (trace_log != NULL)
+            {
+                STRING_delete(trace_log);
+            }
+        }
+    }
+    return result;
+}
+
+int mqtt_client_subscribe(MQTT_CLIENT_HANDLE handle, uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || subscribeList == NULL || count == 0 || packetId == 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_013: [If any of the parameters handle, subscribeList is NULL or count is 0 then mqtt_client_subscribe shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, subscribeList: %p, count: %lu, packetId: %d", mqtt_client, subscribeList, (unsigned long)count, packetId);
+        result = MU_FAILURE;
+    }
+    else if (mqtt_client->reconnect.resubscribeId != 0 && packetId == mqtt_client->reconnect.resubscribeId)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_164: [If packetId is the packet id of the SUBSCRIBE the client sent to restore the subscriptions and its SUBACK has not come yet then mqtt_client_subscribe and mqtt_client_unsubscribe shall return a non-zero value.]*/
+        LogError("Packet id %" PRIu16 " is in use by the re-subscribe", packetId);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
+
+        /*Codes_SRS_MQTT_CLIENT_07_092: [When mqttOptions->protocolVersion is MQTT_PROTOCOL_V5, mqtt_client_publish, mqtt_client_publish_iov, mqtt_client_subscribe and mqtt_client_unsubscribe shall encode with mqtt_codec_publish_v5, mqtt_codec_publish_header_v5, mqtt_codec_subscribe_v5 and mqtt_codec_unsubscribe_v5.]*/
+        BUFFER_HANDLE subPacket = is_protocol_v5(mqtt_client) ? mqtt_codec_subscribe_v5(packetId, subscribeList, count, trace_log) : mqtt_codec_subscribe(packetId, subscribeList, count, trace_log);
+        if (subPacket == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_014: [If any failure is encountered then mqtt_client_subscribe shall return a non-zero value.]*/
+            LogError("Error: mqtt_codec_subscribe failed");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            mqtt_client->packetState = SUBSCRIBE_TYPE;
+
+            size_t size = BUFFER_length(subPacket);
+            /*Codes_SRS_MQTT_CLIENT_07_015: [On success mqtt_client_subscribe shall send the MQTT SUBCRIBE packet to the endpoint.]*/
+            if (queuePacketItem(mqtt_client, SUBSCRIBE_TYPE, BUFFER_u_char(subPacket), size) != 0)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_014: [If any failure is encountered then mqtt_client_subscribe shall return a non-zero value.]*/
+                LogError("Error: mqtt_client_subscribe send failed");
+                result = MU_FAILURE;
+            }
+            else
+            {
+                startLatency(mqtt_client, SUBSCRIBE_TYPE, packetId, false);
+                log_outgoing_trace(mqtt_client, trace_log);
+                if (mqtt_client->reconnect.resubscribe && recordSubscribe(&mqtt_client->reconnect, packetId, subscribeList, count) != 0)
                 {
-                    if (packetLength != 2) // PUBXXX payload must be only 2 bytes
-                    {
-                        LogError("Invalid packet length.");
-                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
-                        break;
-                    }
+                    LogError("Failure recording subscription, it will not be restored after a reconnect");
+                }
+                result = 0;
+            }
+            BUFFER_delete(subPacket);
+        }
+        if (trace_log != NULL)
+        {
+            STRING_delete(trace_log);
+        }
+    }
+    return result;
+}
 
-                    /*Codes_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-                    MQTT_CLIENT_EVENT_RESULT action = (packet == PUBACK_TYPE) ? MQTT_CLIENT_ON_PUBLISH_ACK :
-                        (packet == PUBREC_TYPE) ? MQTT_CLIENT_ON_PUBLISH_RECV :
-                        (packet == PUBREL_TYPE) ? MQTT_CLIENT_ON_PUBLISH_REL : MQTT_CLIENT_ON_PUBLISH_COMP;
+int mqtt_client_unsubscribe(MQTT_CLIENT_HANDLE handle, uint16_t packetId, const char** unsubscribeList, size_t count)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || unsubscribeList == NULL || count == 0 || packetId == 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_016: [If any of the parameters handle, unsubscribeList is NULL or count is 0 then mqtt_client_unsubscribe shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, unsubscribeList: %p, count: %lu, packetId: %d", mqtt_client, unsubscribeList, (unsigned long)count, packetId);
+        result = MU_FAILURE;
+    }
+    else if (mqtt_client->reconnect.resubscribeId != 0 && packetId == mqtt_client->reconnect.resubscribeId)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_164: [If packetId is the packet id of the SUBSCRIBE the client sent to restore the subscriptions and its SUBACK has not come yet then mqtt_client_subscribe and mqtt_client_unsubscribe shall return a non-zero value.]*/
+        LogError("Packet id %" PRIu16 " is in use by the re-subscribe", packetId);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
 
-                    PUBLISH_ACK publish_ack = { 0 };
-                    publish_ack.packetId = byteutil_read_uint16(&iterator, packetLength);
+        /*Codes_SRS_MQTT_CLIENT_07_092: [When mqttOptions->protocolVersion is MQTT_PROTOCOL_V5, mqtt_client_publish, mqtt_client_publish_iov, mqtt_client_subscribe and mqtt_client_unsubscribe shall encode with mqtt_codec_publish_v5, mqtt_codec_publish_header_v5, mqtt_codec_subscribe_v5 and mqtt_codec_unsubscribe_v5.]*/
+        BUFFER_HANDLE unsubPacket = is_protocol_v5(mqtt_client) ? mqtt_codec_unsubscribe_v5(packetId, unsubscribeList, count, trace_log) : mqtt_codec_unsubscribe(packetId, unsubscribeList, count, trace_log);
+        if (unsubPacket == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_017: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+            LogError("Error: mqtt_codec_unsubscribe failed");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            mqtt_client->packetState = UNSUBSCRIBE_TYPE;
 
-#ifndef NO_LOGGING
+            size_t size = BUFFER_length(unsubPacket);
+            /*Codes_SRS_MQTT_CLIENT_07_018: [On success mqtt_client_unsubscribe shall send the MQTT SUBCRIBE packet to the endpoint.]*/
+            if (queuePacketItem(mqtt_client, UNSUBSCRIBE_TYPE, BUFFER_u_char(unsubPacket), size) != 0)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_017: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.].]*/
+                LogError("Error: mqtt_client_unsubscribe send failed");
+                result = MU_FAILURE;
+            }
+            else
+            {
+                log_outgoing_trace(mqtt_client, trace_log);
+                recordUnsubscribe(&mqtt_client->reconnect, unsubscribeList, count);
+                result = 0;
+            }
+            BUFFER_delete(unsubPacket);
+        }
+        if (trace_log != NULL)
+        {
+            STRING_delete(trace_log);
+        }
+    }
+    return result;
+}
+
+int mqtt_client_send_message_response(MQTT_CLIENT_HANDLE handle, uint16_t packetId, QOS_VALUE qosValue)
+{
+    int result;
+
+    if (handle == NULL || packetId == 0)
+    {
+        LogError("Invalid parameter specified mqtt_client: %p, packetId: %d", handle, packetId);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+        /*Codes_SRS_MQTT_CLIENT_07_106: [A QoS 1 or QoS 2 message answered with MQTT_CLIENT_ACK_ASYNC shall use one receive credit until mqtt_client_send_message_response is called for its packet id.]*/
+        setAwaitingAck(&mqtt_client->receiveCredit, packetId, false);
+        SendMessageAck(mqtt_client, packetId, qosValue);
+        result = 0;
+    }
+
+    return result;
+}
+
+int mqtt_client_disconnect(MQTT_CLIENT_HANDLE handle, ON_MQTT_DISCONNECTED_CALLBACK callback, void* ctx)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_010: [If the parameters handle is NULL then mqtt_client_disconnect shall return a non-zero value.]*/
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_081: [mqtt_client_disconnect and mqtt_client_clear_xio shall stop reconnecting.]*/
+        mqtt_client->reconnect.xioHandle = NULL;
+        mqtt_client->reconnect.pending = false;
+        if (mqtt_client->mqtt_status & MQTT_STATUS_CLIENT_CONNECTED)
+        {
+            uint8_t disconnectPacket[MQTT_CODEC_EMPTY_PACKET_SIZE];
+            if (mqtt_codec_encode_disconnect(disconnectPacket) != 0)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_011: [If any failure is encountered then mqtt_client_disconnect shall return a non-zero value.]*/
+                LogError("Error: mqtt_client_disconnect failed");
+                mqtt_client->packetState = PACKET_TYPE_ERROR;
+                result = MU_FAILURE;
+            }
+            else
+            {
+                /* Codes_SRS_MQTT_CLIENT_07_037: [ if callback is not NULL callback shall be called once the mqtt connection has been disconnected ] */
+                mqtt_client->disconnect_cb = callback;
+                mqtt_client->disconnect_ctx = ctx;
+                mqtt_client->packetState = DISCONNECT_TYPE;
+
+                /*Codes_SRS_MQTT_CLIENT_07_012: [On success mqtt_client_disconnect shall send the MQTT DISCONNECT packet to the endpoint.]*/
+                if (sendPacketItem(mqtt_client, DISCONNECT_TYPE, disconnectPacket, MQTT_CODEC_EMPTY_PACKET_SIZE) != 0)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_011: [If any failure is encountered then mqtt_client_disconnect shall return a non-zero value.]*/
+                    LogError("Error: mqtt_client_disconnect send failed");
+                    result = MU_FAILURE;
+                }
+                else
+                {
                     if (is_trace_enabled(mqtt_client))
                     {
-                        STRING_HANDLE trace_log = STRING_construct_sprintf("%s | PACKET_ID: %"PRIu16, packet == PUBACK_TYPE ? "PUBACK" : (packet == PUBREC_TYPE) ? "PUBREC" : (packet == PUBREL_TYPE) ? "PUBREL" : "PUBCOMP",
-                            publish_ack.packetId);
-
-                        log_incoming_trace(mqtt_client, trace_log);
+                        STRING_HANDLE trace_log = STRING_construct("DISCONNECT");
+                        log_outgoing_trace(mqtt_client, trace_log);
                         STRING_delete(trace_log);
                     }
-#endif
-                    BUFFER_HANDLE pubRel = NULL;
-                    mqtt_client->fnOperationCallback(mqtt_client, action, (void*)&publish_ack, mqtt_client->ctx);
-                    if (packet == PUBREC_TYPE)
-                    {
-                        pubRel = mqtt_codec_publishRelease(publish_ack.packetId);
-                        if (pubRel == NULL)
-                        {
-                            LogError("Failed to allocate publish release message.");
-                            set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
-                        }
-                    }
-                    else if (packet == PUBREL_TYPE)
-                    {
-                        pubRel = mqtt_codec_publishComplete(publish_ack.packetId);
-                        if (pubRel == NULL)
-                        {
-                            LogError("Failed to allocate publish complete message.");
-                            set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
-                        }
-                    }
-                    if (pubRel != NULL)
-                    {
-                        size_t size = BUFFER_length(pubRel);
-                        if (sendPacketItem(mqtt_client, BUFFER_u_char(pubRel), size) != 0)
-                        {
-                            LogError("Failed sending publish reply.");
-                            set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
-                        }
-                        BUFFER_delete(pubRel);
-                    }
-                    break;
+                    result = 0;
                 }
-                case SUBACK_TYPE:
-                {
+            }
+            clear_mqtt_options(mqtt_client);
+        }
+        else
+        {
+            // If the client is not connected then just close the underlying socket
+            mqtt_client->disconnect_cb = callback;
+            mqtt_client->disconnect_ctx = ctx;
+
+            close_connection(mqtt_client);
+            clear_mqtt_options(mqtt_client);
+            result = 0;
+        }
+    }
+    return result;
+}
 
-                    /*Codes_SRS_MQTT_CLIENT_07_030: [If the actionResult parameter is of type SUBACK_TYPE then the msgInfo value shall be a SUBSCRIBE_ACK structure.]*/
-                    SUBSCRIBE_ACK suback = { 0 };
+void mqtt_client_dowork(MQTT_CLIENT_HANDLE handle)
+{
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client != NULL && mqtt_client->closing.xioHandle != NULL)
+    {
+        advance_close(mqtt_client);
+    }
 
-                    size_t remainLen = packetLength;
-                    suback.packetId = byteutil_read_uint16(&iterator, packetLength);
-                    remainLen -= 2;
+    if (mqtt_client != NULL && mqtt_client->xioHandle == NULL && mqtt_client->reconnect.pending && mqtt_client->closing.xioHandle == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_078: [When a reconnect is due mqtt_client_dowork shall reopen the XIO_HANDLE given to mqtt_client_connect, which sends CONNECT again once it is open.]*/
+        reconnectIfDue(mqtt_client);
+    }
+    /*Codes_SRS_MQTT_CLIENT_18_001: [If the client is disconnected, mqtt_client_dowork shall do nothing.]*/
+    /*Codes_SRS_MQTT_CLIENT_07_023: [If the parameter handle is NULL then mqtt_client_dowork shall do nothing.]*/
+    else if (mqtt_client != NULL && mqtt_client->xioHandle != NULL)
+    {
+        if (mqtt_client->mqtt_status & MQTT_STATUS_PENDING_CLOSE)
+        {
+            close_connection(mqtt_client);
+            // turn off pending close
+            mqtt_client->mqtt_status &= ~MQTT_STATUS_PENDING_CLOSE;
+            scheduleReconnect(mqtt_client);
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_024: [mqtt_client_dowork shall call the xio_dowork function to complete operations.]*/
+            /*Codes_SRS_MQTT_CLIENT_07_105: [While every receive credit is used, mqtt_client_dowork shall still call xio_dowork and supervise the keep alive, only publishes are held.]*/
+            xio_dowork(mqtt_client->xioHandle);
+            if (mqtt_client->receiveCredit.heldHead != NULL && mqtt_client->xioHandle != NULL)
+            {
+                deliverHeldPublishes(mqtt_client);
+            }
 
-#ifndef NO_LOGGING
-                    STRING_HANDLE trace_log = NULL;
-                    if (is_trace_enabled(mqtt_client))
+            /*Codes_SRS_MQTT_CLIENT_07_025: [mqtt_client_dowork shall retrieve the the last packet send value and ...]*/
+            if (mqtt_client->mqtt_status & MQTT_STATUS_SOCKET_CONNECTED &&
+                mqtt_client->mqtt_status & MQTT_STATUS_CLIENT_CONNECTED &&
+                mqtt_client->keepAliveInterval > 0)
+            {
+                tickcounter_ms_t current_ms;
+                if (getCurrentMs(mqtt_client, &current_ms) != 0)
+                {
+                    LogError("Error: tickcounter_get_current_ms failed");
+                }
+                else
+                {
+                    /* Codes_SRS_MQTT_CLIENT_07_035: [If the timeSincePing has expired past the maxPingRespTime then mqtt_client_dowork shall call the Error Callback function with the message MQTT_CLIENT_NO_PING_RESPONSE] */
+                    if (mqtt_client->timeSincePing > 0 && (current_ms - mqtt_client->timeSincePing) >= getPingResponseTimeoutMs(mqtt_client))
                     {
-                        trace_log = STRING_construct_sprintf("SUBACK | PACKET_ID: %"PRIu16, suback.packetId);
+                        // We haven't gotten a ping response in the alloted time
+                        set_error_callback(mqtt_client, MQTT_CLIENT_NO_PING_RESPONSE);
+                        mqtt_client->timeSincePing = 0;
+                        mqtt_client->packetSendTimeMs = 0;
+                        mqtt_client->packetState = UNKNOWN_TYPE;
                     }
-#endif
-                    // Allocate the remaining len
-                    size_t malloc_size = safe_multiply_size_t(sizeof(QOS_VALUE), remainLen);
-                    if (malloc_size != SIZE_MAX && 
-                        (suback.qosReturn = (QOS_VALUE*)malloc(malloc_size)) != NULL)
+                    else if ((current_ms - mqtt_client->packetSendTimeMs) >= getKeepAliveMs(mqtt_client))
                     {
-                        while (remainLen > 0)
+                        /*Codes_SRS_MQTT_CLIENT_07_026: [if keepAliveInternal is > 0 and the send time is greater than the MQTT KeepAliveInterval then it shall construct an MQTT PINGREQ packet.]*/
+                        uint8_t pingPacket[MQTT_CODEC_EMPTY_PACKET_SIZE];
+                        if (mqtt_codec_encode_pingreq(pingPacket) == 0)
                         {
-                            uint8_t qosRet = byteutil_readByte(&iterator);
-                            if (qosRet & 0x7C) // SUBACK QOS bits 6-2 must be zero
-                            {
-                                LogError("Invalid SUBACK_TYPE packet.");
-                                set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
-                                break;
-                            }
-                            suback.qosReturn[suback.qosCount++] =
-                                (qosRet <= ((uint8_t)DELIVER_EXACTLY_ONCE)) ?
-                                (QOS_VALUE)qosRet :  DELIVER_FAILURE;
-                            remainLen--;
-#ifndef NO_LOGGING
+                            (void)queuePacketItem(mqtt_client, PINGREQ_TYPE, pingPacket, MQTT_CODEC_EMPTY_PACKET_SIZE);
+                            (void)getCurrentMs(mqtt_client, &mqtt_client->timeSincePing);
+
                             if (is_trace_enabled(mqtt_client))
                             {
-                                STRING_sprintf(trace_log, " | RETURN_CODE: %"PRIu16, suback.qosReturn[suback.qosCount-1]);
+                                STRING_HANDLE trace_log = STRING_construct("PINGREQ");
+                                log_outgoing_trace(mqtt_client, trace_log);
+                                STRING_delete(trace_log);
                             }
-#endif
-                        }
-
-#ifndef NO_LOGGING
-                        if (is_trace_enabled(mqtt_client))
-                        {
-                            log_incoming_trace(mqtt_client, trace_log);
-                            STRING_delete(trace_log);
                         }
-#endif
-                        mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_SUBSCRIBE_ACK, (void*)&suback, mqtt_client->ctx);
-                        free(suback.qosReturn);
                     }
-                    else
-                    {
-                        LogError("allocation of quality of service value failed, size:%zu", malloc_size);
-                        set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
-                    }
-                    break;
                 }
-                case UNSUBACK_TYPE:
+            }
+
+            if (mqtt_client->inflight.count > 0 && (mqtt_client->inflight.retryTimeoutMs > 0 || mqtt_client->inflight.resendAll) &&
+                mqtt_client->mqtt_status & MQTT_STATUS_CLIENT_CONNECTED)
+            {
+                tickcounter_ms_t current_ms;
+                if (getCurrentMs(mqtt_client, &current_ms) != 0)
                 {
-                    /*Codes_SRS_MQTT_CLIENT_07_031: [If the actionResult parameter is of type UNSUBACK_TYPE then the msgInfo value shall be a UNSUBSCRIBE_ACK structure.]*/
-                    UNSUBSCRIBE_ACK unsuback = { 0 };
-                    if (packetLength != 2) // UNSUBACK_TYPE payload must be only 2 bytes
-                    {
-                        LogError("Invalid UNSUBACK packet length.");
-                        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
-                        break;
-                    }
+                    LogError("Error: tickcounter_get_current_ms failed");
+                }
+                else
+                {
+                    resendInflightMessages(mqtt_client, current_ms);
+                }
+            }
 
-                    unsuback.packetId = byteutil_read_uint16(&iterator, packetLength);
+            if (mqtt_client->submitQueue != NULL && (mqtt_client->offlineQueue != NULL || is_client_connected(mqtt_client)))
+            {
+                drainSubmitQueue(mqtt_client);
+            }
 
-#ifndef NO_LOGGING
-                    if (is_trace_enabled(mqtt_client))
-                    {
-                        STRING_HANDLE trace_log = STRING_construct_sprintf("UNSUBACK | PACKET_ID: %"PRIu16, unsuback.packetId);
-                        log_incoming_trace(mqtt_client, trace_log);
-                        STRING_delete(trace_log);
-                    }
-#endif
-                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_UNSUBSCRIBE_ACK, (void*)&unsuback, mqtt_client->ctx);
-                    break;
+            if (mqtt_client->offlineQueue != NULL && is_client_connected(mqtt_client))
+            {
+                drainOfflineQueue(mqtt_client);
+            }
+
+            /*Codes_SRS_MQTT_CLIENT_07_048: [mqtt_client_dowork shall send any queued control packets in a single xio_send.]*/
+            if (mqtt_client->outbound.length > 0 && flushOutboundQueue(mqtt_client) != 0)
+            {
+                set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+            }
+        }
+    }
+
+    if (mqtt_client != NULL && mqtt_client->timerWheel != NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_130: [With a timer wheel set mqtt_client_dowork shall move the timer of the client to the earliest keep alive ping, ping response timeout, in-flight retry, close timeout or pending reconnect left after its work, or cancel it if none is scheduled.]*/
+        scheduleDeadline(mqtt_client);
+    }
+}
+
+int mqtt_client_set_send_coalescing(MQTT_CLIENT_HANDLE handle, size_t maxBytes, uint32_t maxLatencyMs)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_044: [If handle is NULL then mqtt_client_set_send_coalescing shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = MU_FAILURE;
+    }
+    else if (flushOutboundQueue(mqtt_client) != 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_049: [If any failure is encountered then mqtt_client_set_send_coalescing shall return a non-zero value.]*/
+        LogError("Failure sending queued control packets");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        uint8_t* buffer = NULL;
+        if (maxBytes > 0 && (buffer = (uint8_t*)malloc(maxBytes)) == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_049: [If any failure is encountered then mqtt_client_set_send_coalescing shall return a non-zero value.]*/
+            LogError("Failure allocating outbound queue of %lu bytes", (unsigned long)maxBytes);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_045: [mqtt_client_set_send_coalescing shall send anything already queued and then queue up to maxBytes of control packets for at most maxLatencyMs, a maxBytes of zero turns coalescing off.]*/
+            if (mqtt_client->outbound.buffer != NULL)
+            {
+                free(mqtt_client->outbound.buffer);
+            }
+            mqtt_client->outbound.buffer = buffer;
+            mqtt_client->outbound.capacity = maxBytes;
+            mqtt_client->outbound.maxLatencyMs = maxLatencyMs;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+int mqtt_client_set_inflight_window(MQTT_CLIENT_HANDLE handle, size_t maxInflight, uint32_t retryTimeoutMs)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || maxInflight > MAX_INFLIGHT_MESSAGES)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_050: [If handle is NULL or maxInflight is greater than 65534 then mqtt_client_set_inflight_window shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, maxInflight: %lu", mqtt_client, (unsigned long)maxInflight);
+        result = MU_FAILURE;
+    }
+    else if (mqtt_client->inflight.count > 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_051: [If messages are in flight then mqtt_client_set_inflight_window shall return a non-zero value.]*/
+        LogError("Cannot change the in-flight window with %lu messages in flight", (unsigned long)mqtt_client->inflight.count);
+        result = MU_FAILURE;
+    }
+    else if (maxInflight == 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_052: [mqtt_client_set_inflight_window shall make the client allocate the packet ids of QoS 1 and QoS 2 publishes and track up to maxInflight of them until they are acknowledged, a maxInflight of zero turns tracking off.]*/
+        clearInflightStore(&mqtt_client->inflight);
+        result = 0;
+    }
+    else
+    {
+        size_t indexSize = 1;
+        size_t entriesSize;
+        size_t malloc_size;
+        uint8_t* storage;
+
+        while (indexSize < maxInflight * 2)
+        {
+            indexSize *= 2;
+        }
+        entriesSize = maxInflight * sizeof(INFLIGHT_ENTRY);
+        malloc_size = entriesSize + (indexSize * sizeof(size_t)) + (PACKET_ID_BITMAP_WORDS * sizeof(uint32_t));
+        if ((storage = (uint8_t*)malloc(malloc_size)) == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_053: [If any failure is encountered then mqtt_client_set_inflight_window shall return a non-zero value.]*/
+            LogError("Failure allocating in-flight store of %lu messages", (unsigned long)maxInflight);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            INFLIGHT_STORE* store = &mqtt_client->inflight;
+            size_t index;
+
+            /*Codes_SRS_MQTT_CLIENT_07_052: [mqtt_client_set_inflight_window shall make the client allocate the packet ids of QoS 1 and QoS 2 publishes and track up to maxInflight of them until they are acknowledged, a maxInflight of zero turns tracking off.]*/
+            clearInflightStore(store);
+            store->entries = (INFLIGHT_ENTRY*)storage;
+            store->slotIndex = (size_t*)(storage + entriesSize);
+            store->slotIndexMask = indexSize - 1;
+            store->usedIds = (uint32_t*)(storage + entriesSize + (indexSize * sizeof(size_t)));
+            (void)memset(store->slotIndex, 0, indexSize * sizeof(size_t));
+            (void)memset(store->usedIds, 0, PACKET_ID_BITMAP_WORDS * sizeof(uint32_t));
+            // Packet id 0 is not valid on the wire
+            setPacketIdUsed(store, 0, true);
+            for (index = 0; index < maxInflight; index++)
+            {
+                store->entries[index].msgHandle = NULL;
+                store->entries[index].next = (index + 1 < maxInflight) ? index + 1 : INFLIGHT_NO_SLOT;
+            }
+            store->freeSlot = 0;
+            store->maxInflight = maxInflight;
+            store->nextPacketId = 1;
+            store->retryTimeoutMs = retryTimeoutMs;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+int mqtt_client_set_session_store(MQTT_CLIENT_HANDLE handle, MQTT_SESSION_STORE_HANDLE sessionStore)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_059: [If handle is NULL then mqtt_client_set_session_store shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = MU_FAILURE;
+    }
+    else if (mqtt_client->inflight.count > 0 || (sessionStore != NULL && mqtt_client->inflight.maxInflight == 0))
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_060: [If messages are in flight, or sessionStore is not NULL and the in-flight window is off, then mqtt_client_set_session_store shall return a non-zero value.]*/
+        LogError("A session store needs an in-flight window with no messages in flight");
+        result = MU_FAILURE;
+    }
+    else if (sessionStore == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_061: [mqtt_client_set_session_store shall restore the in-flight messages and received QoS 2 packet ids kept in sessionStore and keep them in it from then on, a NULL sessionStore detaches the current one.]*/
+        if (mqtt_client->receivedIds != NULL)
+        {
+            free(mqtt_client->receivedIds);
+            mqtt_client->receivedIds = NULL;
+        }
+        mqtt_client->sessionStore = NULL;
+        result = 0;
+    }
+    else
+    {
+        SESSION_RESTORE_CONTEXT restore;
+        uint32_t* receivedIds;
+
+        restore.mqtt_client = mqtt_client;
+        restore.result = 0;
+        if ((receivedIds = (uint32_t*)malloc(PACKET_ID_BITMAP_WORDS * sizeof(uint32_t))) == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_062: [If any failure is encountered then mqtt_client_set_session_store shall return a non-zero value and leave no messages in flight.]*/
+            LogError("Failure allocating received packet ids");
+            result = MU_FAILURE;
+        }
+        else if (getCurrentMs(mqtt_client, &restore.current_ms) != 0)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_062: [If any failure is encountered then mqtt_client_set_session_store shall return a non-zero value and leave no messages in flight.]*/
+            LogError("Failure getting current ms tickcounter");
+            free(receivedIds);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            (void)memset(receivedIds, 0, PACKET_ID_BITMAP_WORDS * sizeof(uint32_t));
+            if (mqtt_client->receivedIds != NULL)
+            {
+                free(mqtt_client->receivedIds);
+            }
+            mqtt_client->receivedIds = receivedIds;
+
+            /*Codes_SRS_MQTT_CLIENT_07_061: [mqtt_client_set_session_store shall restore the in-flight messages and received QoS 2 packet ids kept in sessionStore and keep them in it from then on, a NULL sessionStore detaches the current one.]*/
+            if (mqtt_session_store_load(sessionStore, onSessionRecordLoaded, &restore) != 0 || restore.result != 0)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_062: [If any failure is encountered then mqtt_client_set_session_store shall return a non-zero value and leave no messages in flight.]*/
+                LogError("Failure restoring the session");
+                while (mqtt_client->inflight.count > 0)
+                {
+                    removeInflightSlot(&mqtt_client->inflight, mqtt_client->inflight.oldest);
                 }
-                case PINGRESP_TYPE:
-                    mqtt_client->timeSincePing = 0;
-#ifndef NO_LOGGING
-                    if (is_trace_enabled(mqtt_client))
-                    {
-                        STRING_HANDLE trace_log = STRING_construct_sprintf("PINGRESP");
-                        log_incoming_trace(mqtt_client, trace_log);
-                        STRING_delete(trace_log);
-                    }
-#endif
-                    // Forward ping response to operation callback
-                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_PING_RESPONSE, NULL, mqtt_client->ctx);
-                    break;
-                default:
-                    break;
+                free(mqtt_client->receivedIds);
+                mqtt_client->receivedIds = NULL;
+                mqtt_client->sessionStore = NULL;
+                result = MU_FAILURE;
+            }
+            else
+            {
+                mqtt_client->sessionStore = sessionStore;
+                mqtt_client->inflight.resendAll = (mqtt_client->inflight.count > 0);
+                result = 0;
+            }
+        }
+    }
+    return result;
+}
+
+int mqtt_client_set_offline_queue(MQTT_CLIENT_HANDLE handle, const MQTT_OFFLINE_QUEUE_OPTIONS* options)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_067: [If handle is NULL then mqtt_client_set_offline_queue shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = MU_FAILURE;
+    }
+    else if (mqtt_client->offlineQueue != NULL && mqtt_offline_queue_count(mqtt_client->offlineQueue) > 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_073: [If publishes are queued then mqtt_client_set_offline_queue shall return a non-zero value.]*/
+        LogError("Cannot change the offline queue while messages are queued");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        MQTT_OFFLINE_QUEUE_HANDLE offlineQueue = NULL;
+        if (options != NULL && (offlineQueue = mqtt_offline_queue_create(options)) == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_074: [If any failure is encountered then mqtt_client_set_offline_queue shall return a non-zero value.]*/
+            LogError("Failure creating the offline queue");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_068: [mqtt_client_set_offline_queue shall create the offline queue from options, a NULL options turns queueing off.]*/
+            if (mqtt_client->offlineQueue != NULL)
+            {
+                mqtt_offline_queue_destroy(mqtt_client->offlineQueue);
             }
+            mqtt_client->offlineQueue = offlineQueue;
+            mqtt_client->drainPerDowork = (options == NULL) ? 0 : options->drainPerDowork;
+            result = 0;
         }
     }
+    return result;
+}
+
+int mqtt_client_set_reconnect(MQTT_CLIENT_HANDLE handle, const MQTT_CLIENT_RECONNECT_OPTIONS* options)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || (options != NULL && (options->initialDelayMs == 0 || options->maxDelayMs < options->initialDelayMs)))
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_075: [If handle is NULL or options has an initialDelayMs of 0 or a maxDelayMs below initialDelayMs then mqtt_client_set_reconnect shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, options: %p", mqtt_client, options);
+        result = MU_FAILURE;
+    }
     else
     {
-        LogError("recvCompleteCallback context failed.");
+        /*Codes_SRS_MQTT_CLIENT_07_076: [mqtt_client_set_reconnect shall make the client reopen its connection on its own after a connection failure, a NULL options turns reconnecting off.]*/
+        RECONNECT_STATE* reconnect = &mqtt_client->reconnect;
+        if (options == NULL)
+        {
+            reconnect->enabled = false;
+            reconnect->resubscribe = false;
+            reconnect->pending = false;
+        }
+        else
+        {
+            reconnect->enabled = true;
+            reconnect->resubscribe = options->resubscribe;
+            reconnect->initialDelayMs = options->initialDelayMs;
+            reconnect->maxDelayMs = options->maxDelayMs;
+            reconnect->maxRetryWindowMs = options->maxRetryWindowMs;
+        }
+        if (!reconnect->resubscribe)
+        {
+            clearSubscriptions(reconnect);
+        }
+        result = 0;
     }
+    return result;
 }
 
-void mqtt_client_clear_xio(MQTT_CLIENT_HANDLE handle)
+// Messages of a shared subscription arrive on the topic filter that follows $share/<group>/
+static const char* getSubscriptionTopicFilter(const char* topicFilter)
 {
-    if (handle != NULL)
+    const char* result = topicFilter;
+    if (strncmp(topicFilter, SHARED_SUBSCRIPTION_PREFIX, sizeof(SHARED_SUBSCRIPTION_PREFIX) - 1) == 0)
     {
-        MQTT_CLIENT *mqtt_client = (MQTT_CLIENT *)handle;
-
-        // The upstream transport handle allocates and deallocates the xio handle.
-        // The reference to that xio handle is shared between this layer (mqtt layer)
-        // and the upstream layer. The clearing done here is to signal to this layer
-        // that the handle is no longer available to be used. This is different from
-        // deiniting the mqtt client in that we do not want an entire teardown, but
-        // only a possible re-upping of the xio in the future.
-        mqtt_client->xioHandle = NULL;
+        const char* group = topicFilter + sizeof(SHARED_SUBSCRIPTION_PREFIX) - 1;
+        const char* groupEnd = strchr(group, '/');
+        if (groupEnd != NULL && groupEnd != group)
+        {
+            result = groupEnd + 1;
+        }
     }
+    return result;
 }
 
-MQTT_CLIENT_HANDLE mqtt_client_init(ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, ON_MQTT_OPERATION_CALLBACK operation_cb, void* opCallbackCtx, ON_MQTT_ERROR_CALLBACK onErrorCallBack, void* errorCBCtx)
+int mqtt_client_set_topic_handler(MQTT_CLIENT_HANDLE handle, const char* topicFilter, ON_MQTT_MESSAGE_RECV_CALLBACK handler, void* context)
 {
-    MQTT_CLIENT* result;
-    /*Codes_SRS_MQTT_CLIENT_07_001: [If the parameters ON_MQTT_MESSAGE_RECV_CALLBACK is NULL then mqttclient_init shall return NULL.]*/
-    if (msgRecv == NULL || operation_cb == NULL)
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (topicFilter != NULL)
     {
-        LogError("Invalid parameter specified msgRecv: %p, operation_cb: %p", msgRecv, operation_cb);
-        result = NULL;
+        /*Codes_SRS_MQTT_CLIENT_07_097: [mqtt_client_set_topic_handler shall store the handler of a $share/<group>/<filter> shared subscription under <filter>.]*/
+        topicFilter = getSubscriptionTopicFilter(topicFilter);
+    }
+
+    if (mqtt_client == NULL || topicFilter == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_082: [If handle or topicFilter is NULL then mqtt_client_set_topic_handler shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, topicFilter: %p", mqtt_client, topicFilter);
+        result = MU_FAILURE;
+    }
+    else if (mqtt_client->dispatchingTopic)
+    {
+        // Changing the trie while mqtt_topic_trie_match walks it would free nodes and handlers still in use
+        /*Codes_SRS_MQTT_CLIENT_07_161: [When called from a topic handler, mqtt_client_set_topic_handler shall copy topicFilter, return 0 and make the change once the message has been passed to every matching handler.]*/
+        result = deferTopicHandler(mqtt_client, topicFilter, handler, context);
+    }
+    else if (handler == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_083: [mqtt_client_set_topic_handler shall store handler and context under topicFilter with mqtt_topic_trie_insert, a NULL handler removes the handler of topicFilter.]*/
+        if (mqtt_client->topicHandlers == NULL || mqtt_topic_trie_remove(mqtt_client->topicHandlers, topicFilter) != 0)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_084: [If topicFilter is not a valid topic filter or any failure is encountered then mqtt_client_set_topic_handler shall return a non-zero value.]*/
+            LogError("No topic handler set for %s", topicFilter);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+    else if (mqtt_client->topicHandlers == NULL && (mqtt_client->topicHandlers = mqtt_topic_trie_create(destroyTopicHandler)) == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_084: [If topicFilter is not a valid topic filter or any failure is encountered then mqtt_client_set_topic_handler shall return a non-zero value.]*/
+        LogError("Failure creating topic trie");
+        result = MU_FAILURE;
     }
     else
     {
-        result = malloc(sizeof(MQTT_CLIENT));
-        if (result == NULL)
+        TOPIC_HANDLER* topicHandler = (TOPIC_HANDLER*)malloc(sizeof(TOPIC_HANDLER));
+        if (topicHandler == NULL)
         {
-            /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
-            LogError("mqtt_client_init failure: Allocation Failure");
+            /*Codes_SRS_MQTT_CLIENT_07_084: [If topicFilter is not a valid topic filter or any failure is encountered then mqtt_client_set_topic_handler shall return a non-zero value.]*/
+            LogError("Failure allocating topic handler");
+            result = MU_FAILURE;
         }
         else
         {
-            memset(result, 0, sizeof(MQTT_CLIENT));
-            /*Codes_SRS_MQTT_CLIENT_07_003: [mqttclient_init shall allocate MQTTCLIENT_DATA_INSTANCE and return the MQTTCLIENT_HANDLE on success.]*/
-            result->packetState = UNKNOWN_TYPE;
-            result->fnOperationCallback = operation_cb;
-            result->ctx = opCallbackCtx;
-            result->fnMessageRecv = msgRecv;
-            result->fnOnErrorCallBack = onErrorCallBack;
-            result->errorCBCtx = errorCBCtx;
-            result->qosValue = DELIVER_AT_MOST_ONCE;
-            result->packetTickCntr = tickcounter_create();
-            result->maxPingRespTime = DEFAULT_MAX_PING_RESPONSE_TIME;
-            if (result->packetTickCntr == NULL)
+            topicHandler->handler = handler;
+            topicHandler->context = context;
+            /*Codes_SRS_MQTT_CLIENT_07_083: [mqtt_client_set_topic_handler shall store handler and context under topicFilter with mqtt_topic_trie_insert, a NULL handler removes the handler of topicFilter.]*/
+            if (mqtt_topic_trie_insert(mqtt_client->topicHandlers, topicFilter, topicHandler) != 0)
             {
-                /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
-                LogError("mqtt_client_init failure: tickcounter_create failure");
-                free(result);
-                result = NULL;
+                /*Codes_SRS_MQTT_CLIENT_07_084: [If topicFilter is not a valid topic filter or any failure is encountered then mqtt_client_set_topic_handler shall return a non-zero value.]*/
+                LogError("Failure setting topic handler for %s", topicFilter);
+                free(topicHandler);
+                result = MU_FAILURE;
             }
             else
             {
-                result->codec_handle = mqtt_codec_create(recvCompleteCallback, result);
-                if (result->codec_handle == NULL)
-                {
-                    /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
-                    LogError("mqtt_client_init failure: mqtt_codec_create failure");
-                    tickcounter_destroy(result->packetTickCntr);
-                    free(result);
-                    result = NULL;
-                }
+                result = 0;
             }
         }
     }
     return result;
 }
 
-void mqtt_client_deinit(MQTT_CLIENT_HANDLE handle)
+MQTT_TOPIC_HANDLE mqtt_client_intern_topic(MQTT_CLIENT_HANDLE handle, const char* topicName)
 {
-    /*Codes_SRS_MQTT_CLIENT_07_004: [If the parameter handle is NULL then function mqtt_client_deinit shall do nothing.]*/
-    if (handle != NULL)
+    MQTT_TOPIC_HANDLE result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || topicName == NULL)
     {
-        /*Codes_SRS_MQTT_CLIENT_07_005: [mqtt_client_deinit shall deallocate all memory allocated in this unit.]*/
-        MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-        tickcounter_destroy(mqtt_client->packetTickCntr);
-        mqtt_codec_destroy(mqtt_client->codec_handle);
-        clear_mqtt_options(mqtt_client);
-        free(mqtt_client);
+        /*Codes_SRS_MQTT_CLIENT_07_087: [If handle or topicName is NULL then mqtt_client_intern_topic shall return NULL.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, topicName: %p", mqtt_client, topicName);
+        result = NULL;
+    }
+    else if (mqtt_client->topicTable == NULL && (mqtt_client->topicTable = mqtt_topic_table_create()) == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_088: [mqtt_client_intern_topic shall return the topic interned for topicName with mqtt_topic_table_intern, creating the topic table of the client on the first call, or NULL if any failure is encountered.]*/
+        LogError("Failure creating topic table");
+        result = NULL;
     }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_088: [mqtt_client_intern_topic shall return the topic interned for topicName with mqtt_topic_table_intern, creating the topic table of the client on the first call, or NULL if any failure is encountered.]*/
+        result = mqtt_topic_table_intern(mqtt_client->topicTable, topicName);
+    }
+    return result;
 }
 
-int mqtt_client_connect(MQTT_CLIENT_HANDLE handle, XIO_HANDLE xioHandle, MQTT_CLIENT_OPTIONS* mqttOptions)
+// Reads only msgHandle, so it can run on the thread that submits the message
+static BUFFER_HANDLE encodeSubmittedPublish(MQTT_MESSAGE_HANDLE msgHandle, const APP_PAYLOAD* payload)
+{
+    QOS_VALUE qos = mqttmessage_getQosType(msgHandle);
+    bool isDuplicate = mqttmessage_getIsDuplicateMsg(msgHandle);
+    bool isRetained = mqttmessage_getIsRetained(msgHandle);
+    uint16_t packetId = mqttmessage_getPacketId(msgHandle);
+    MQTT_TOPIC_HANDLE topic = mqttmessage_getInternedTopic(msgHandle);
+    const char* topicName = (topic == NULL) ? mqttmessage_getTopicName(msgHandle) : NULL;
+    return encodePublishPacket(topic, topicName, qos, isDuplicate, isRetained, packetId, payload, NULL);
+}
+
+int mqtt_client_enable_submit_queue(MQTT_CLIENT_HANDLE handle)
 {
     int result;
-    /*SRS_MQTT_CLIENT_07_006: [If any of the parameters handle, ioHandle, or mqttOptions are NULL then mqtt_client_connect shall return a non-zero value.]*/
-    if (handle == NULL || mqttOptions == NULL || xioHandle == NULL)
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_108: [If handle is NULL then mqtt_client_enable_submit_queue shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = MU_FAILURE;
+    }
+    else if (mqtt_client->submitQueue == NULL && (mqtt_client->submitQueue = mqtt_submit_queue_create()) == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_109: [mqtt_client_enable_submit_queue shall create the submit queue of the client with mqtt_submit_queue_create once, or return a non-zero value if any failure is encountered.]*/
+        LogError("Failure creating submit queue");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_109: [mqtt_client_enable_submit_queue shall create the submit queue of the client with mqtt_submit_queue_create once, or return a non-zero value if any failure is encountered.]*/
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_submit_publish(MQTT_CLIENT_HANDLE handle, MQTT_MESSAGE_HANDLE msgHandle)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    // Only the submit queue is touched here, this can run on any thread
+    if (mqtt_client == NULL || msgHandle == NULL || mqtt_client->submitQueue == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_110: [If handle or msgHandle is NULL, or mqtt_client_enable_submit_queue was not called, then mqtt_client_submit_publish shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, msgHandle: %p", mqtt_client, msgHandle);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(msgHandle);
+        BUFFER_HANDLE publishPacket;
+
+        if (payload == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_112: [If any failure is encountered then mqtt_client_submit_publish shall return a non-zero value.]*/
+            LogError("Error: mqttmessage_getApplicationMsg failed");
+            result = MU_FAILURE;
+        }
+        /*Codes_SRS_MQTT_CLIENT_07_111: [mqtt_client_submit_publish shall encode the message with mqtt_codec_publish on the calling thread and push the packet with mqtt_submit_queue_push, leaving the packet id to the in-flight store when it is on.]*/
+        else if ((publishPacket = encodeSubmittedPublish(msgHandle, payload)) == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_112: [If any failure is encountered then mqtt_client_submit_publish shall return a non-zero value.]*/
+            LogError("Error: mqtt_codec_publish failed");
+            result = MU_FAILURE;
+        }
+        else if (mqtt_submit_queue_push(mqtt_client->submitQueue, publishPacket) != 0)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_112: [If any failure is encountered then mqtt_client_submit_publish shall return a non-zero value.]*/
+            LogError("Error: failure submitting message");
+            BUFFER_delete(publishPacket);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            const WAKEUP_REGISTRATION* wakeup;
+            WAKEUP_INCREMENT(&mqtt_client->wakeupCallers);
+            wakeup = WAKEUP_LOAD_PTR(&mqtt_client->activeWakeup);
+            if (wakeup != NULL)
+            {
+                const void* previousCallingClient = wakeupCallingClient;
+                wakeupCallingClient = mqtt_client;
+                /*Codes_SRS_MQTT_CLIENT_07_114: [After pushing the packet mqtt_client_submit_publish shall call the callback set with mqtt_client_set_wakeup_callback on the calling thread.]*/
+                wakeup->fnWakeup(wakeup->context);
+                wakeupCallingClient = previousCallingClient;
+            }
+            WAKEUP_DECREMENT(&mqtt_client->wakeupCallers);
+            result = 0;
+        }
+    }
+    return result;
+}
+
+int mqtt_client_set_receive_credit(MQTT_CLIENT_HANDLE handle, size_t credit)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || credit > UINT16_MAX)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_099: [If handle is NULL or credit is larger than 65535 then mqtt_client_set_receive_credit shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, credit: %lu", mqtt_client, (unsigned long)credit);
+        result = MU_FAILURE;
+    }
+    else if (mqtt_client->receiveCredit.outstanding > 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_100: [If received messages are waiting for their acknowledgement then mqtt_client_set_receive_credit shall return a non-zero value.]*/
+        LogError("Cannot change the receive credit while %lu messages wait for their acknowledgement", (unsigned long)mqtt_client->receiveCredit.outstanding);
+        result = MU_FAILURE;
+    }
+    else if (credit == 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_101: [mqtt_client_set_receive_credit shall limit the received QoS 1 and QoS 2 messages waiting for mqtt_client_send_message_response to credit, 0 removes the limit.]*/
+        if (mqtt_client->receiveCredit.awaitingIds != NULL)
+        {
+            free(mqtt_client->receiveCredit.awaitingIds);
+            mqtt_client->receiveCredit.awaitingIds = NULL;
+        }
+        mqtt_client->receiveCredit.credit = 0;
+        result = 0;
+    }
+    else if (mqtt_client->receiveCredit.awaitingIds == NULL &&
+        (mqtt_client->receiveCredit.awaitingIds = (uint32_t*)malloc(PACKET_ID_BITMAP_WORDS * sizeof(uint32_t))) == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_102: [If any failure is encountered then mqtt_client_set_receive_credit shall return a non-zero value.]*/
+        LogError("Failure allocating the receive credit");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_101: [mqtt_client_set_receive_credit shall limit the received QoS 1 and QoS 2 messages waiting for mqtt_client_send_message_response to credit, 0 removes the limit.]*/
+        (void)memset(mqtt_client->receiveCredit.awaitingIds, 0, PACKET_ID_BITMAP_WORDS * sizeof(uint32_t));
+        mqtt_client->receiveCredit.credit = credit;
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_set_wakeup_callback(MQTT_CLIENT_HANDLE handle, ON_MQTT_CLIENT_WAKEUP onWakeup, void* context)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_115: [If handle is NULL then mqtt_client_set_wakeup_callback shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = MU_FAILURE;
+    }
+    else if (wakeupCallingClient == mqtt_client)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_169: [If it is called from the wakeup callback of the same client then mqtt_client_set_wakeup_callback shall return a non-zero value.]*/
+        LogError("mqtt_client_set_wakeup_callback can't be called from the wakeup callback it would wait for");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        // A submitting thread that loaded the previous callback before it was taken away is counted in wakeupCallers
+        // until the call returns, so once the count drops to 0 no thread still uses the previous callback or context
+        WAKEUP_STORE_PTR(&mqtt_client->activeWakeup, (WAKEUP_REGISTRATION*)NULL);
+        /*Codes_SRS_MQTT_CLIENT_07_158: [mqtt_client_set_wakeup_callback shall return only once no call of the previous callback by mqtt_client_submit_publish is still running.]*/
+        while (WAKEUP_LOAD(&mqtt_client->wakeupCallers) != 0)
+        {
+            // Held only around the call of the callback, let a preempted caller finish it
+            ThreadAPI_Sleep(0);
+        }
+        /*Codes_SRS_MQTT_CLIENT_07_116: [mqtt_client_set_wakeup_callback shall store onWakeup and context, a NULL onWakeup removes the callback.]*/
+        if (onWakeup != NULL)
+        {
+            mqtt_client->wakeup.fnWakeup = onWakeup;
+            mqtt_client->wakeup.context = context;
+            WAKEUP_STORE_PTR(&mqtt_client->activeWakeup, &mqtt_client->wakeup);
+        }
+        result = 0;
+    }
+    return result;
+}
+
+// Milliseconds from current_ms until dueMs, 0 once it is due
+static uint32_t getTimeUntil(tickcounter_ms_t current_ms, tickcounter_ms_t dueMs)
+{
+    uint32_t result;
+    if (dueMs <= current_ms)
+    {
+        result = 0;
+    }
+    else if (dueMs - current_ms >= UINT32_MAX)
+    {
+        result = UINT32_MAX - 1;
+    }
+    else
+    {
+        result = (uint32_t)(dueMs - current_ms);
+    }
+    return result;
+}
+
+// Work mqtt_client_dowork does on its next call whatever the time, a full in-flight window waits for an acknowledgement
+static bool hasWorkNow(const MQTT_CLIENT* mqtt_client)
+{
+    bool isConnected = is_client_connected(mqtt_client);
+    bool hasInflightRoom = mqtt_client->inflight.maxInflight == 0 || mqtt_client->inflight.count < getInflightLimit(mqtt_client);
+    return (mqtt_client->mqtt_status & MQTT_STATUS_PENDING_CLOSE) ||
+        mqtt_client->outbound.length > 0 ||
+        (mqtt_client->inflight.count > 0 && mqtt_client->inflight.resendAll && (mqtt_client->mqtt_status & MQTT_STATUS_CLIENT_CONNECTED)) ||
+        (mqtt_client->submitBacklog && (mqtt_client->offlineQueue != NULL || isConnected)) ||
+        (mqtt_client->submitPending != NULL && isConnected && hasInflightRoom) ||
+        (mqtt_client->offlineQueue != NULL && isConnected && hasInflightRoom && mqtt_offline_queue_count(mqtt_client->offlineQueue) > 0) ||
+        (mqtt_client->receiveCredit.heldHead != NULL && !isReceivePaused(mqtt_client));
+}
+
+// The earliest keep alive ping, ping response timeout or in-flight retry, UINT32_MAX when none is scheduled
+static uint32_t getTimedWork(const MQTT_CLIENT* mqtt_client, tickcounter_ms_t current_ms)
+{
+    uint32_t result = UINT32_MAX;
+    uint32_t timeout;
+    if (is_client_connected(mqtt_client) && mqtt_client->keepAliveInterval > 0)
+    {
+        result = getTimeUntil(current_ms, mqtt_client->packetSendTimeMs + getKeepAliveMs(mqtt_client));
+        if (mqtt_client->timeSincePing > 0 &&
+            (timeout = getTimeUntil(current_ms, mqtt_client->timeSincePing + getPingResponseTimeoutMs(mqtt_client))) < result)
+        {
+            result = timeout;
+        }
+    }
+    if (mqtt_client->inflight.count > 0 && mqtt_client->inflight.retryTimeoutMs > 0 && (mqtt_client->mqtt_status & MQTT_STATUS_CLIENT_CONNECTED) &&
+        (timeout = getTimeUntil(current_ms, mqtt_client->inflight.entries[mqtt_client->inflight.oldest].sentMs + mqtt_client->inflight.retryTimeoutMs)) < result)
+    {
+        result = timeout;
+    }
+    return result;
+}
+
+static void scheduleDeadline(MQTT_CLIENT* mqtt_client)
+{
+    tickcounter_ms_t wheel_ms = mqtt_timer_wheel_get_current_ms(mqtt_client->timerWheel);
+    tickcounter_ms_t current_ms = wheel_ms - mqtt_client->clockOffsetMs;
+    uint32_t timeout;
+    if (mqtt_client->closing.xioHandle != NULL)
+    {
+        timeout = getTimeUntil(current_ms, mqtt_client->closing.deadlineMs);
+    }
+    else if (mqtt_client->xioHandle == NULL)
+    {
+        timeout = mqtt_client->reconnect.pending ? getTimeUntil(current_ms, mqtt_client->reconnect.nextAttemptMs) : UINT32_MAX;
+    }
+    else
+    {
+        timeout = getTimedWork(mqtt_client, current_ms);
+    }
+
+    if (timeout == UINT32_MAX)
+    {
+        mqtt_timer_wheel_cancel(mqtt_client->timerWheel, &mqtt_client->deadlineTimer);
+    }
+    else if (mqtt_timer_wheel_schedule(mqtt_client->timerWheel, &mqtt_client->deadlineTimer, wheel_ms + timeout, mqtt_client->fnDue, mqtt_client->dueCtx) != 0)
+    {
+        LogError("Error: mqtt_timer_wheel_schedule failed");
+    }
+}
+
+int mqtt_client_get_wait_info(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_WAIT_INFO* waitInfo)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    tickcounter_ms_t current_ms;
+    if (mqtt_client == NULL || waitInfo == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_117: [If handle or waitInfo is NULL then mqtt_client_get_wait_info shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, waitInfo: %p", mqtt_client, waitInfo);
+        result = MU_FAILURE;
+    }
+    else if (getCurrentMs(mqtt_client, &current_ms) != 0)
     {
-        LogError("mqtt_client_connect: NULL argument (handle = %p, mqttOptions = %p, xioHandle: %p)", handle, mqttOptions, xioHandle);
+        /*Codes_SRS_MQTT_CLIENT_07_120: [If any failure is encountered then mqtt_client_get_wait_info shall return a non-zero value.]*/
+        LogError("Error: tickcounter_get_current_ms failed");
         result = MU_FAILURE;
     }
     else
     {
-        MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-        mqtt_client->xioHandle = xioHandle;
-        mqtt_client->packetState = UNKNOWN_TYPE;
-        mqtt_client->qosValue = mqttOptions->qualityOfServiceValue;
-        mqtt_client->keepAliveInterval = mqttOptions->keepAliveInterval;
-        mqtt_client->maxPingRespTime = (DEFAULT_MAX_PING_RESPONSE_TIME < mqttOptions->keepAliveInterval/2) ? DEFAULT_MAX_PING_RESPONSE_TIME : mqttOptions->keepAliveInterval/2;
-        mqtt_client->timeSincePing = 0;
-        if (cloneMqttOptions(mqtt_client, mqttOptions) != 0)
+        if (mqtt_client->closing.xioHandle != NULL)
         {
-            LogError("Error: Clone Mqtt Options failed");
-            result = MU_FAILURE;
+            /*Codes_SRS_MQTT_CLIENT_07_135: [While a close is in progress timeoutMs shall be the time left until the close times out, waitRead shall be true and waitWrite shall be false.]*/
+            waitInfo->timeoutMs = getTimeUntil(current_ms, mqtt_client->closing.deadlineMs);
+            waitInfo->waitRead = true;
+            waitInfo->waitWrite = false;
         }
-        /*Codes_SRS_MQTT_CLIENT_07_008: [mqtt_client_connect shall open the XIO_HANDLE by calling into the xio_open interface.]*/
-        else if (xio_open(xioHandle, onOpenComplete, mqtt_client, onBytesReceived, mqtt_client, onIoError, mqtt_client) != 0)
+        else if (mqtt_client->xioHandle == NULL)
         {
-            /*Codes_SRS_MQTT_CLIENT_07_007: [If any failure is encountered then mqtt_client_connect shall return a non-zero value.]*/
-            LogError("Error: io_open failed");
-            result = MU_FAILURE;
-            mqtt_client->xioHandle = NULL;
-            // Remove cloned options
-            clear_mqtt_options(mqtt_client);
+            /*Codes_SRS_MQTT_CLIENT_07_118: [Without a connection timeoutMs shall be the time left until a pending reconnect is due, or UINT32_MAX, and waitRead and waitWrite shall be false.]*/
+            waitInfo->timeoutMs = mqtt_client->reconnect.pending ? getTimeUntil(current_ms, mqtt_client->reconnect.nextAttemptMs) : UINT32_MAX;
+            waitInfo->waitRead = false;
+            waitInfo->waitWrite = false;
         }
         else
         {
-            result = 0;
+            /*Codes_SRS_MQTT_CLIENT_07_119: [With a connection timeoutMs shall be 0 if mqtt_client_dowork has work it can do right away, else the time left until the earliest keep alive ping, ping response timeout or in-flight retry, or UINT32_MAX if none is scheduled.]*/
+            waitInfo->timeoutMs = hasWorkNow(mqtt_client) ? 0 : getTimedWork(mqtt_client, current_ms);
+            /*Codes_SRS_MQTT_CLIENT_07_121: [With a connection waitRead shall be true, and waitWrite shall be true until the connection is open.]*/
+            waitInfo->waitRead = true;
+            waitInfo->waitWrite = (mqtt_client->mqtt_status & MQTT_STATUS_SOCKET_CONNECTED) == 0;
         }
+        result = 0;
     }
     return result;
 }
 
-int mqtt_client_publish(MQTT_CLIENT_HANDLE handle, MQTT_MESSAGE_HANDLE msgHandle)
+int mqtt_client_set_timer_wheel(MQTT_CLIENT_HANDLE handle, MQTT_TIMER_WHEEL_HANDLE timerWheel, ON_MQTT_CLIENT_WAKEUP onDue, void* context)
 {
     int result;
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-    if (mqtt_client == NULL || msgHandle == NULL)
+    tickcounter_ms_t current_ms;
+    if (mqtt_client == NULL || (timerWheel != NULL && onDue == NULL))
     {
-        /*Codes_SRS_MQTT_CLIENT_07_019: [If one of the parameters handle or msgHandle is NULL then mqtt_client_publish shall return a non-zero value.]*/
-        LogError("Invalid parameter specified mqtt_client: %p, msgHandle: %p", mqtt_client, msgHandle);
+        /*Codes_SRS_MQTT_CLIENT_07_125: [If handle is NULL, or timerWheel is not NULL and onDue is NULL, then mqtt_client_set_timer_wheel shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, timerWheel: %p, onDue: %p", mqtt_client, timerWheel, onDue);
+        result = MU_FAILURE;
+    }
+    else if (timerWheel != NULL && tickcounter_get_current_ms(mqtt_client->packetTickCntr, &current_ms) != 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_129: [If any failure is encountered then mqtt_client_set_timer_wheel shall return a non-zero value and keep the clock and the timer the client had.]*/
+        LogError("Error: tickcounter_get_current_ms failed");
         result = MU_FAILURE;
     }
     else
     {
-        /*Codes_SRS_MQTT_CLIENT_07_021: [mqtt_client_publish shall get the message information from the MQTT_MESSAGE_HANDLE.]*/
-        const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(msgHandle);
-        if (payload == NULL)
+        if (mqtt_client->timerWheel != NULL)
         {
-            /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
-            LogError("Error: mqttmessage_getApplicationMsg failed");
-            result = MU_FAILURE;
+            /*Codes_SRS_MQTT_CLIENT_07_128: [mqtt_client_set_timer_wheel shall cancel the timer the client has on the wheel set before, and a NULL timerWheel shall make the client read its tick counter again.]*/
+            mqtt_timer_wheel_cancel(mqtt_client->timerWheel, &mqtt_client->deadlineTimer);
         }
-        else
+        mqtt_client->timerWheel = timerWheel;
+        mqtt_client->fnDue = onDue;
+        mqtt_client->dueCtx = (onDue == NULL) ? NULL : context;
+        if (timerWheel != NULL)
         {
-            STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
-
-            QOS_VALUE qos = mqttmessage_getQosType(msgHandle);
-            bool isDuplicate = mqttmessage_getIsDuplicateMsg(msgHandle);
-            bool isRetained = mqttmessage_getIsRetained(msgHandle);
-            uint16_t packetId = mqttmessage_getPacketId(msgHandle);
-            const char* topicName = mqttmessage_getTopicName(msgHandle);
-            BUFFER_HANDLE publishPacket = mqtt_codec_publish(qos, isDuplicate, isRetained, packetId, topicName, payload->message, payload->length, trace_log);
-            if (publishPacket == NULL)
-            {
-                /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
-                LogError("Error: mqtt_codec_publish failed");
-                result = MU_FAILURE;
-            }
-            else
-            {
-                mqtt_client->packetState = PUBLISH_TYPE;
-
-                /*Codes_SRS_MQTT_CLIENT_07_022: [On success mqtt_client_publish shall send the MQTT SUBCRIBE packet to the endpoint.]*/
-                size_t size = BUFFER_length(publishPacket);
-                if (sendPacketItem(mqtt_client, BUFFER_u_char(publishPacket), size) != 0)
-                {
-                    /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
-                    LogError("Error: mqtt_client_publish send failed");
-                    result = MU_FAILURE;
-                }
-                else
-                {
-                    log_outgoing_trace(mqtt_client, trace_log);
-                    result = 0;
-                }
-                BUFFER_delete(publishPacket);
-            }
-            if (trace_log != NULL)
-            {
-                STRING_delete(trace_log);
-            }
+            /*Codes_SRS_MQTT_CLIENT_07_126: [mqtt_client_set_timer_wheel shall read the tick counter of the client once and from then on take the time from mqtt_timer_wheel_get_current_ms, offset to go on from the time of the tick counter.]*/
+            mqtt_client->clockOffsetMs = mqtt_timer_wheel_get_current_ms(timerWheel) - current_ms;
+            /*Codes_SRS_MQTT_CLIENT_07_127: [mqtt_client_set_timer_wheel shall schedule a timer on timerWheel at the earliest keep alive ping, ping response timeout, in-flight retry or pending reconnect that calls onDue with context when it expires, and return 0.]*/
+            scheduleDeadline(mqtt_client);
         }
+        result = 0;
     }
     return result;
 }
 
-int mqtt_client_subscribe(MQTT_CLIENT_HANDLE handle, uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count)
+int mqtt_client_set_recv_pool(MQTT_CLIENT_HANDLE handle, MQTT_CODEC_RECV_POOL_HANDLE pool)
 {
     int result;
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-    if (mqtt_client == NULL || subscribeList == NULL || count == 0 || packetId == 0)
+    if (mqtt_client == NULL)
     {
-        /*Codes_SRS_MQTT_CLIENT_07_013: [If any of the parameters handle, subscribeList is NULL or count is 0 then mqtt_client_subscribe shall return a non-zero value.]*/
-        LogError("Invalid parameter specified mqtt_client: %p, subscribeList: %p, count: %lu, packetId: %d", mqtt_client, subscribeList, (unsigned long)count, packetId);
+        /*Codes_SRS_MQTT_CLIENT_07_122: [If handle is NULL then mqtt_client_set_recv_pool shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: NULL");
+        result = MU_FAILURE;
+    }
+    /*Codes_SRS_MQTT_CLIENT_07_123: [mqtt_client_set_recv_pool shall pass pool to mqtt_codec_set_recv_pool of the codec of the client.]*/
+    else if (mqtt_codec_set_recv_pool(mqtt_client->codec_handle, pool) != 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_124: [If mqtt_codec_set_recv_pool fails then mqtt_client_set_recv_pool shall return a non-zero value.]*/
+        LogError("Error: mqtt_codec_set_recv_pool failed");
         result = MU_FAILURE;
     }
     else
     {
-        STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
-
-        BUFFER_HANDLE subPacket = mqtt_codec_subscribe(packetId, subscribeList, count, trace_log);
-        if (subPacket == NULL)
-        {
-            /*Codes_SRS_MQTT_CLIENT_07_014: [If any failure is encountered then mqtt_client_subscribe shall return a non-zero value.]*/
-            LogError("Error: mqtt_codec_subscribe failed");
-            result = MU_FAILURE;
-        }
-        else
-        {
-            mqtt_client->packetState = SUBSCRIBE_TYPE;
-
-            size_t size = BUFFER_length(subPacket);
-            /*Codes_SRS_MQTT_CLIENT_07_015: [On success mqtt_client_subscribe shall send the MQTT SUBCRIBE packet to the endpoint.]*/
-            if (sendPacketItem(mqtt_client, BUFFER_u_char(subPacket), size) != 0)
-            {
-                /*Codes_SRS_MQTT_CLIENT_07_014: [If any failure is encountered then mqtt_client_subscribe shall return a non-zero value.]*/
-                LogError("Error: mqtt_client_subscribe send failed");
-                result = MU_FAILURE;
-            }
-            else
-            {
-                log_outgoing_trace(mqtt_client, trace_log);
-                result = 0;
-            }
-            BUFFER_delete(subPacket);
-        }
-        if (trace_log != NULL)
-        {
-            STRING_delete(trace_log);
-        }
+        result = 0;
     }
     return result;
 }
 
-int mqtt_client_unsubscribe(MQTT_CLIENT_HANDLE handle, uint16_t packetId, const char** unsubscribeList, size_t count)
+int mqtt_client_set_trace_ring(MQTT_CLIENT_HANDLE handle, MQTT_TRACE_RING_HANDLE traceRing)
 {
     int result;
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-    if (mqtt_client == NULL || unsubscribeList == NULL || count == 0 || packetId == 0)
+    if (mqtt_client == NULL)
     {
-        /*Codes_SRS_MQTT_CLIENT_07_016: [If any of the parameters handle, unsubscribeList is NULL or count is 0 then mqtt_client_unsubscribe shall return a non-zero value.]*/
-        LogError("Invalid parameter specified mqtt_client: %p, unsubscribeList: %p, count: %lu, packetId: %d", mqtt_client, unsubscribeList, (unsigned long)count, packetId);
+        /*Codes_SRS_MQTT_CLIENT_07_136: [If handle is NULL then mqtt_client_set_trace_ring shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: NULL");
         result = MU_FAILURE;
     }
     else
     {
-        STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
-
-        BUFFER_HANDLE unsubPacket = mqtt_codec_unsubscribe(packetId, unsubscribeList, count, trace_log);
-        if (unsubPacket == NULL)
-        {
-            /*Codes_SRS_MQTT_CLIENT_07_017: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
-            LogError("Error: mqtt_codec_unsubscribe failed");
-            result = MU_FAILURE;
-        }
-        else
-        {
-            mqtt_client->packetState = UNSUBSCRIBE_TYPE;
-
-            size_t size = BUFFER_length(unsubPacket);
-            /*Codes_SRS_MQTT_CLIENT_07_018: [On success mqtt_client_unsubscribe shall send the MQTT SUBCRIBE packet to the endpoint.]*/
-            if (sendPacketItem(mqtt_client, BUFFER_u_char(unsubPacket), size) != 0)
-            {
-                /*Codes_SRS_MQTT_CLIENT_07_017: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.].]*/
-                LogError("Error: mqtt_client_unsubscribe send failed");
-                result = MU_FAILURE;
-            }
-            else
-            {
-                log_outgoing_trace(mqtt_client, trace_log);
-                result = 0;
-            }
-            BUFFER_delete(unsubPacket);
-        }
-        if (trace_log != NULL)
-        {
-            STRING_delete(trace_log);
-        }
+        /*Codes_SRS_MQTT_CLIENT_07_139: [mqtt_client_set_trace_ring shall make the client record packets into traceRing, or stop recording if traceRing is NULL, and return 0.]*/
+        mqtt_client->traceRing = traceRing;
+        result = 0;
     }
     return result;
 }
 
-int mqtt_client_send_message_response(MQTT_CLIENT_HANDLE handle, uint16_t packetId, QOS_VALUE qosValue)
+int mqtt_client_set_raw_trace_options(MQTT_CLIENT_HANDLE handle, const MQTT_CLIENT_RAW_TRACE_OPTIONS* options)
 {
     int result;
-
-    if (handle == NULL || packetId == 0)
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || options == NULL)
     {
-        LogError("Invalid parameter specified mqtt_client: %p, packetId: %d", handle, packetId);
+        /*Codes_SRS_MQTT_CLIENT_07_140: [If handle or options is NULL then mqtt_client_set_raw_trace_options shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, options: %p", mqtt_client, options);
         result = MU_FAILURE;
     }
     else
     {
-        MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-        SendMessageAck(mqtt_client, packetId, qosValue);
+        /*Codes_SRS_MQTT_CLIENT_07_141: [mqtt_client_set_raw_trace_options shall make the raw bytes trace log at most maxBytes bytes of a packet, or the whole packet if maxBytes is 0, and return 0.]*/
+        mqtt_client->rawTraceMaxBytes = options->maxBytes;
         result = 0;
     }
-
     return result;
 }
 
-int mqtt_client_disconnect(MQTT_CLIENT_HANDLE handle, ON_MQTT_DISCONNECTED_CALLBACK callback, void* ctx)
+int mqtt_client_set_capture(MQTT_CLIENT_HANDLE handle, MQTT_CAPTURE_HANDLE capture)
 {
     int result;
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
     if (mqtt_client == NULL)
     {
-        /*Codes_SRS_MQTT_CLIENT_07_010: [If the parameters handle is NULL then mqtt_client_disconnect shall return a non-zero value.]*/
+        /*Codes_SRS_MQTT_CLIENT_07_144: [If handle is NULL then mqtt_client_set_capture shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: NULL");
         result = MU_FAILURE;
     }
     else
     {
-        if (mqtt_client->mqtt_status & MQTT_STATUS_CLIENT_CONNECTED)
-        {
-            BUFFER_HANDLE disconnectPacket = mqtt_codec_disconnect();
-            if (disconnectPacket == NULL)
-            {
-                /*Codes_SRS_MQTT_CLIENT_07_011: [If any failure is encountered then mqtt_client_disconnect shall return a non-zero value.]*/
-                LogError("Error: mqtt_client_disconnect failed");
-                mqtt_client->packetState = PACKET_TYPE_ERROR;
-                result = MU_FAILURE;
-            }
-            else
-            {
-                /* Codes_SRS_MQTT_CLIENT_07_037: [ if callback is not NULL callback shall be called once the mqtt connection has been disconnected ] */
-                mqtt_client->disconnect_cb = callback;
-                mqtt_client->disconnect_ctx = ctx;
-                mqtt_client->packetState = DISCONNECT_TYPE;
+        /*Codes_SRS_MQTT_CLIENT_07_145: [mqtt_client_set_capture shall make the client write packets to capture, or stop writing if capture is NULL, and return 0.]*/
+        mqtt_client->capture = capture;
+        result = 0;
+    }
+    return result;
+}
 
-                size_t size = BUFFER_length(disconnectPacket);
-                /*Codes_SRS_MQTT_CLIENT_07_012: [On success mqtt_client_disconnect shall send the MQTT DISCONNECT packet to the endpoint.]*/
-                if (sendPacketItem(mqtt_client, BUFFER_u_char(disconnectPacket), size) != 0)
-                {
-                    /*Codes_SRS_MQTT_CLIENT_07_011: [If any failure is encountered then mqtt_client_disconnect shall return a non-zero value.]*/
-                    LogError("Error: mqtt_client_disconnect send failed");
-                    result = MU_FAILURE;
-                }
-                else
-                {
-                    if (is_trace_enabled(mqtt_client))
-                    {
-                        STRING_HANDLE trace_log = STRING_construct("DISCONNECT");
-                        log_outgoing_trace(mqtt_client, trace_log);
-                        STRING_delete(trace_log);
-                    }
-                    result = 0;
-                }
-                BUFFER_delete(disconnectPacket);
-            }
-            clear_mqtt_options(mqtt_client);
-        }
-        else
+int mqtt_client_get_stats(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_STATS* stats)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || stats == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_147: [If handle or stats is NULL then mqtt_client_get_stats shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, stats: %p", mqtt_client, stats);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        // MQTT_CLIENT_STATS holds nothing but uint64_t values
+        const uint64_t* source = (const uint64_t*)&mqtt_client->stats;
+        uint64_t* target = (uint64_t*)stats;
+        size_t index;
+        /*Codes_SRS_MQTT_CLIENT_07_148: [mqtt_client_get_stats shall copy every counter and histogram of the client into stats and return 0.]*/
+        for (index = 0; index < sizeof(MQTT_CLIENT_STATS) / sizeof(uint64_t); index++)
         {
-            // If the client is not connected then just close the underlying socket
-            mqtt_client->disconnect_cb = callback;
-            mqtt_client->disconnect_ctx = ctx;
-
-            close_connection(mqtt_client);
-            clear_mqtt_options(mqtt_client);
-            result = 0;
+            target[index] = STATS_LOAD(&source[index]);
         }
+        result = 0;
     }
     return result;
 }
 
-void mqtt_client_dowork(MQTT_CLIENT_HANDLE handle)
+uint64_t mqtt_client_get_latency_percentile(const MQTT_CLIENT_LATENCY_HISTOGRAM* histogram, double percentile)
 {
-    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-    /*Codes_SRS_MQTT_CLIENT_18_001: [If the client is disconnected, mqtt_client_dowork shall do nothing.]*/
-    /*Codes_SRS_MQTT_CLIENT_07_023: [If the parameter handle is NULL then mqtt_client_dowork shall do nothing.]*/
-    if (mqtt_client != NULL && mqtt_client->xioHandle != NULL)
+    uint64_t result;
+    if (histogram == NULL || histogram->count == 0)
     {
-        if (mqtt_client->mqtt_status & MQTT_STATUS_PENDING_CLOSE)
+        /*Codes_SRS_MQTT_CLIENT_07_154: [If histogram is NULL or holds no latency then mqtt_client_get_latency_percentile shall return 0.]*/
+        result = 0;
+    }
+    else
+    {
+        // Latencies are counted from 1 up to the one the percentile falls on
+        double exactRank = (percentile <= 0.0) ? 1.0 : (percentile >= 100.0) ? (double)histogram->count : percentile * (double)histogram->count / 100.0;
+        uint64_t rank = (uint64_t)exactRank;
+        uint64_t counted = 0;
+        size_t bucket = 0;
+        if ((double)rank < exactRank || rank == 0)
         {
-            close_connection(mqtt_client);
-            // turn off pending close
-            mqtt_client->mqtt_status &= ~MQTT_STATUS_PENDING_CLOSE;
+            rank++;
         }
-        else
+        while (bucket < MQTT_CLIENT_LATENCY_BUCKET_COUNT - 1 && (counted += histogram->buckets[bucket]) < rank)
         {
-            /*Codes_SRS_MQTT_CLIENT_07_024: [mqtt_client_dowork shall call the xio_dowork function to complete operations.]*/
-            xio_dowork(mqtt_client->xioHandle);
-
-            /*Codes_SRS_MQTT_CLIENT_07_025: [mqtt_client_dowork shall retrieve the the last packet send value and ...]*/
-            if (mqtt_client->mqtt_status & MQTT_STATUS_SOCKET_CONNECTED &&
-                mqtt_client->mqtt_status & MQTT_STATUS_CLIENT_CONNECTED &&
-                mqtt_client->keepAliveInterval > 0)
-            {
-                tickcounter_ms_t current_ms;
-                if (tickcounter_get_current_ms(mqtt_client->packetTickCntr, &current_ms) != 0)
-                {
-                    LogError("Error: tickcounter_get_current_ms failed");
-                }
-                else
-                {
-                    /* Codes_SRS_MQTT_CLIENT_07_035: [If the timeSincePing has expired past the maxPingRespTime then mqtt_client_dowork shall call the Error Callback function with the message MQTT_CLIENT_NO_PING_RESPONSE] */
-                    if (mqtt_client->timeSincePing > 0 && ((current_ms - mqtt_client->timeSincePing)/1000) > mqtt_client->maxPingRespTime)
-                    {
-                        // We haven't gotten a ping response in the alloted time
-                        set_error_callback(mqtt_client, MQTT_CLIENT_NO_PING_RESPONSE);
-                        mqtt_client->timeSincePing = 0;
-                        mqtt_client->packetSendTimeMs = 0;
-                        mqtt_client->packetState = UNKNOWN_TYPE;
-                    }
-                    else if (((current_ms - mqtt_client->packetSendTimeMs) / 1000) >= mqtt_client->keepAliveInterval)
-                    {
-                        /*Codes_SRS_MQTT_CLIENT_07_026: [if keepAliveInternal is > 0 and the send time is greater than the MQTT KeepAliveInterval then it shall construct an MQTT PINGREQ packet.]*/
-                        BUFFER_HANDLE pingPacket = mqtt_codec_ping();
-                        if (pingPacket != NULL)
-                        {
-                            size_t size = BUFFER_length(pingPacket);
-                            (void)sendPacketItem(mqtt_client, BUFFER_u_char(pingPacket), size);
-                            BUFFER_delete(pingPacket);
-                            (void)tickcounter_get_current_ms(mqtt_client->packetTickCntr, &mqtt_client->timeSincePing);
-
-                            if (is_trace_enabled(mqtt_client))
-                            {
-                                STRING_HANDLE trace_log = STRING_construct("PINGREQ");
-                                log_outgoing_trace(mqtt_client, trace_log);
-                                STRING_delete(trace_log);
-                            }
-                        }
-                    }
-                }
-            }
+            bucket++;
+        }
+        /*Codes_SRS_MQTT_CLIENT_07_155: [mqtt_client_get_latency_percentile shall return the largest latency of the bucket the percentile falls in, or maxMs if that is less.]*/
+        result = getLatencyBucketMaxMs(bucket);
+        if (result > histogram->maxMs)
+        {
+            result = histogram->maxMs;
         }
     }
+    return result;
 }
 
 void mqtt_client_set_trace(MQTT_CLIENT_HANDLE handle, bool traceOn, bool rawBytesOn)
@@ -1501,6 +5468,18 @@ void mqtt_client_set_trace(MQTT_CLIENT_HANDLE handle, bool traceOn, bool rawByte
         if (rawBytesOn)
         {
             handle->mqtt_flags |= MQTT_FLAGS_RAW_TRACE;
+            if (handle->rawTraceBuffer == NULL)
+            {
+                // Fits the usual control packet, formatRawBytes grows it for a larger one
+                if ((handle->rawTraceBuffer = (char*)malloc(RAW_TRACE_INITIAL_BUFFER_SIZE)) == NULL)
+                {
+                    LogError("Failure allocating raw trace buffer");
+                }
+                else
+                {
+                    handle->rawTraceBufferSize = RAW_TRACE_INITIAL_BUFFER_SIZE;
+                }
+            }
         }
         else
         {
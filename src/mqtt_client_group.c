@@ -0,0 +1,853 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_codec.h"
+#include "azure_umqtt_c/mqtt_timer_wheel.h"
+#include "azure_umqtt_c/mqtt_client_group.h"
+
+#define GROUP_LOAD(target)                      __atomic_load_n((target), __ATOMIC_ACQUIRE)
+#define GROUP_STORE(target, value)              __atomic_store_n((target), (value), __ATOMIC_RELEASE)
+#define GROUP_EXCHANGE(target, value)           __atomic_exchange_n((target), (value), __ATOMIC_ACQ_REL)
+#define GROUP_CAS(target, expected, desired)    __atomic_compare_exchange_n((target), (expected), (desired), true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#define GROUP_INCREMENT(target)                 __atomic_add_fetch((target), 1, __ATOMIC_RELAXED)
+#define GROUP_DECREMENT(target)                 __atomic_sub_fetch((target), 1, __ATOMIC_RELAXED)
+
+#define GROUP_EVENT_COUNT   64
+// How often a client is polled whose socket is not known while the group has no maxWaitMs
+#define GROUP_POLL_MS       100
+
+typedef enum GROUP_COMMAND_TYPE_TAG
+{
+    GROUP_COMMAND_ADD,
+    GROUP_COMMAND_POST,
+    GROUP_COMMAND_REMOVE
+} GROUP_COMMAND_TYPE;
+
+typedef struct GROUP_COMMAND_TAG
+{
+    struct GROUP_COMMAND_TAG* next;
+    GROUP_COMMAND_TYPE type;
+    struct MQTT_CLIENT_GROUP_MEMBER_TAG* member;
+    ON_MQTT_CLIENT_GROUP_WORK work;
+    void* context;
+} GROUP_COMMAND;
+
+// The commands and ready stacks are pushed by any thread and taken whole by the worker, every
+// other field is only touched by the thread that runs the worker. The clients of the worker tell
+// time from its timer wheel, which is advanced once per run.
+typedef struct GROUP_WORKER_TAG
+{
+    struct MQTT_CLIENT_GROUP_TAG* group;
+    int epollFd;
+    int eventFd;
+    TICK_COUNTER_HANDLE tickCounter;
+    MQTT_TIMER_WHEEL_HANDLE timerWheel;
+    MQTT_CODEC_RECV_POOL_HANDLE recvPool;
+    THREAD_HANDLE thread;
+    GROUP_COMMAND* commands;
+    struct MQTT_CLIENT_GROUP_MEMBER_TAG* ready;
+    struct MQTT_CLIENT_GROUP_MEMBER_TAG* members;
+    struct MQTT_CLIENT_GROUP_MEMBER_TAG* pending;
+    size_t memberCount;
+} GROUP_WORKER;
+
+// The add and remove commands live in the member so neither can fail once the member exists.
+// pollTimer works the member when the group bounds the wait rather than its client, or when the
+// client could not take the timer wheel and keeps its own clock.
+typedef struct MQTT_CLIENT_GROUP_MEMBER_TAG
+{
+    struct MQTT_CLIENT_GROUP_MEMBER_TAG* prev;
+    struct MQTT_CLIENT_GROUP_MEMBER_TAG* next;
+    struct MQTT_CLIENT_GROUP_MEMBER_TAG* readyNext;
+    struct MQTT_CLIENT_GROUP_MEMBER_TAG* pendingNext;
+    GROUP_WORKER* worker;
+    MQTT_CLIENT_HANDLE client;
+    ON_MQTT_CLIENT_RUN_GET_SOCKET getSocket;
+    void* getSocketContext;
+    int socketFd;
+    bool workPending;
+    bool hasOwnClock;
+    MQTT_TIMER pollTimer;
+    int wakeQueued;
+    GROUP_COMMAND addCommand;
+    GROUP_COMMAND removeCommand;
+} MQTT_CLIENT_GROUP_MEMBER;
+
+typedef struct MQTT_CLIENT_GROUP_TAG
+{
+    GROUP_WORKER* workers;
+    size_t workerCount;
+    uint32_t maxWaitMs;
+    bool started;
+    int stopRequested;
+} MQTT_CLIENT_GROUP;
+
+static void signal_worker(GROUP_WORKER* worker)
+{
+    uint64_t one = 1;
+    // A wakeup that is already pending leaves the eventfd readable, which is all that is needed
+    if (write(worker->eventFd, &one, sizeof(one)) != (ssize_t)sizeof(one) && errno != EAGAIN)
+    {
+        LogError("Failure signaling the eventfd of a worker, errno %d", errno);
+    }
+}
+
+static void drain_worker_signal(GROUP_WORKER* worker)
+{
+    uint64_t count;
+    (void)read(worker->eventFd, &count, sizeof(count));
+}
+
+static void push_command(GROUP_WORKER* worker, GROUP_COMMAND* command)
+{
+    GROUP_COMMAND* head = GROUP_LOAD(&worker->commands);
+    do
+    {
+        command->next = head;
+    } while (!GROUP_CAS(&worker->commands, &head, command));
+    signal_worker(worker);
+}
+
+// Queues the member for mqtt_client_dowork in this run of its worker, only called on the worker
+static void mark_pending(MQTT_CLIENT_GROUP_MEMBER* member)
+{
+    if (!member->workPending)
+    {
+        GROUP_WORKER* worker = member->worker;
+        member->workPending = true;
+        member->pendingNext = worker->pending;
+        worker->pending = member;
+    }
+}
+
+static void unmark_pending(GROUP_WORKER* worker, MQTT_CLIENT_GROUP_MEMBER* member)
+{
+    if (member->workPending)
+    {
+        MQTT_CLIENT_GROUP_MEMBER** link = &worker->pending;
+        while (*link != member)
+        {
+            link = &(*link)->pendingNext;
+        }
+        *link = member->pendingNext;
+        member->workPending = false;
+    }
+}
+
+static void on_member_due(void* context)
+{
+    mark_pending((MQTT_CLIENT_GROUP_MEMBER*)context);
+}
+
+static void on_member_wakeup(void* context)
+{
+    MQTT_CLIENT_GROUP_MEMBER* member = (MQTT_CLIENT_GROUP_MEMBER*)context;
+    // Only the first wakeup queues the member, the rest find it queued until the worker takes it
+    if (GROUP_EXCHANGE(&member->wakeQueued, 1) == 0)
+    {
+        GROUP_WORKER* worker = member->worker;
+        MQTT_CLIENT_GROUP_MEMBER* head = GROUP_LOAD(&worker->ready);
+        do
+        {
+            member->readyNext = head;
+        } while (!GROUP_CAS(&worker->ready, &head, member));
+        signal_worker(worker);
+    }
+}
+
+static void take_wakeups(GROUP_WORKER* worker)
+{
+    MQTT_CLIENT_GROUP_MEMBER* member = GROUP_EXCHANGE(&worker->ready, (MQTT_CLIENT_GROUP_MEMBER*)NULL);
+    while (member != NULL)
+    {
+        // Read before the member can be queued again
+        MQTT_CLIENT_GROUP_MEMBER* next = member->readyNext;
+        mark_pending(member);
+        GROUP_STORE(&member->wakeQueued, 0);
+        member = next;
+    }
+}
+
+static void update_member_socket(GROUP_WORKER* worker, MQTT_CLIENT_GROUP_MEMBER* member, int socketFd, uint32_t events)
+{
+    if (member->socketFd != -1 && (socketFd != member->socketFd || events == 0))
+    {
+        // A socket that changed was closed by the transport, which took it out of the epoll set. Its number
+        // may already belong to the socket of another client, so it is only deleted while it is still ours.
+        if (socketFd == member->socketFd)
+        {
+            (void)epoll_ctl(worker->epollFd, EPOLL_CTL_DEL, member->socketFd, NULL);
+        }
+        member->socketFd = -1;
+    }
+
+    // Modified even when nothing changed, see mqtt_client_run
+    if (socketFd != -1 && events != 0)
+    {
+        struct epoll_event event;
+        event.events = events;
+        event.data.ptr = member;
+        if (epoll_ctl(worker->epollFd, member->socketFd == socketFd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, socketFd, &event) != 0 &&
+            (errno != ENOENT || epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, socketFd, &event) != 0))
+        {
+            // The member is polled instead, and no registration is left behind that could outlive it
+            LogError("Failure adding socket %d to the epoll set, errno %d", socketFd, errno);
+            if (member->socketFd == socketFd)
+            {
+                (void)epoll_ctl(worker->epollFd, EPOLL_CTL_DEL, socketFd, NULL);
+                member->socketFd = -1;
+            }
+        }
+        else
+        {
+            member->socketFd = socketFd;
+        }
+    }
+}
+
+static void schedule_member(GROUP_WORKER* worker, MQTT_CLIENT_GROUP_MEMBER* member)
+{
+    MQTT_CLIENT_WAIT_INFO waitInfo;
+    int socketFd;
+    uint32_t maxWaitMs = worker->group->maxWaitMs;
+    bool isPolled = member->hasOwnClock;
+
+    if (mqtt_client_get_wait_info(member->client, &waitInfo) != 0)
+    {
+        LogError("Failure getting the wait info of client %p", member->client);
+        waitInfo.timeoutMs = GROUP_POLL_MS;
+        waitInfo.waitRead = true;
+        waitInfo.waitWrite = false;
+        isPolled = true;
+    }
+
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_022: [ After mqtt_client_dowork the worker shall wait on the socket the getter of the member returns for input if waitRead is true and for output if waitWrite is true, and shall not wait on a socket of -1. ] */
+    socketFd = member->getSocket == NULL ? -1 : member->getSocket(member->getSocketContext);
+    update_member_socket(worker, member, socketFd, socketFd == -1 ? 0 : ((waitInfo.waitRead ? EPOLLIN : 0) | (waitInfo.waitWrite ? EPOLLOUT : 0)));
+
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_023: [ The member shall be worked again right away when timeoutMs of mqtt_client_get_wait_info is 0, when the timer of its client on the timer wheel of the worker expires, after at most maxWaitMs when it is not 0, and after at most maxWaitMs or 100 milliseconds while its client waits for a socket the worker does not know. ] */
+    if (member->socketFd == -1 && (waitInfo.waitRead || waitInfo.waitWrite) && maxWaitMs == 0)
+    {
+        maxWaitMs = GROUP_POLL_MS;
+    }
+    if (maxWaitMs != 0 && waitInfo.timeoutMs > maxWaitMs)
+    {
+        waitInfo.timeoutMs = maxWaitMs;
+        isPolled = true;
+    }
+
+    if (waitInfo.timeoutMs == 0)
+    {
+        mqtt_timer_wheel_cancel(worker->timerWheel, &member->pollTimer);
+        mark_pending(member);
+    }
+    else if (isPolled && waitInfo.timeoutMs != UINT32_MAX)
+    {
+        (void)mqtt_timer_wheel_schedule(worker->timerWheel, &member->pollTimer, mqtt_timer_wheel_get_current_ms(worker->timerWheel) + waitInfo.timeoutMs, on_member_due, member);
+    }
+    else
+    {
+        mqtt_timer_wheel_cancel(worker->timerWheel, &member->pollTimer);
+    }
+}
+
+static void link_member(GROUP_WORKER* worker, MQTT_CLIENT_GROUP_MEMBER* member)
+{
+    member->prev = NULL;
+    member->next = worker->members;
+    if (worker->members != NULL)
+    {
+        worker->members->prev = member;
+    }
+    worker->members = member;
+}
+
+static void unlink_member(GROUP_WORKER* worker, MQTT_CLIENT_GROUP_MEMBER* member)
+{
+    if (member->prev != NULL)
+    {
+        member->prev->next = member->next;
+    }
+    else
+    {
+        worker->members = member->next;
+    }
+    if (member->next != NULL)
+    {
+        member->next->prev = member->prev;
+    }
+}
+
+static void attach_member(GROUP_WORKER* worker, MQTT_CLIENT_GROUP_MEMBER* member)
+{
+    link_member(worker, member);
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_016: [ The worker shall set a wakeup callback on the client that queues the member for mqtt_client_dowork and signals the eventfd of the worker. ] */
+    if (mqtt_client_set_wakeup_callback(member->client, on_member_wakeup, member) != 0)
+    {
+        LogError("Failure setting the wakeup callback of client %p", member->client);
+    }
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_017: [ If the group was created with a recvPoolHighWaterMark the worker shall make the client take its receive buffers from the pool of the worker with mqtt_client_set_recv_pool. ] */
+    if (worker->recvPool != NULL && mqtt_client_set_recv_pool(member->client, worker->recvPool) != 0)
+    {
+        LogError("Failure setting the receive buffer pool of client %p", member->client);
+    }
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_032: [ The worker shall make the client tell time from the timer wheel of the worker and keep its timer there with mqtt_client_set_timer_wheel, with a callback that queues the member for mqtt_client_dowork. ] */
+    if (mqtt_client_set_timer_wheel(member->client, worker->timerWheel, on_member_due, member) != 0)
+    {
+        // The client keeps reading its own clock and the worker polls it at the times it asks for
+        LogError("Failure setting the timer wheel of client %p", member->client);
+        member->hasOwnClock = true;
+    }
+    mark_pending(member);
+}
+
+static void detach_member(GROUP_WORKER* worker, MQTT_CLIENT_GROUP_MEMBER* member)
+{
+    // Returns once no submitting thread still runs on_member_wakeup for the member, and a wakeup queued before
+    // that must not outlive the member
+    (void)mqtt_client_set_wakeup_callback(member->client, NULL, NULL);
+    take_wakeups(worker);
+    if (worker->recvPool != NULL)
+    {
+        (void)mqtt_client_set_recv_pool(member->client, NULL);
+    }
+    if (!member->hasOwnClock)
+    {
+        (void)mqtt_client_set_timer_wheel(member->client, NULL, NULL, NULL);
+    }
+    mqtt_timer_wheel_cancel(worker->timerWheel, &member->pollTimer);
+    unmark_pending(worker, member);
+    if (member->socketFd != -1 && member->getSocket != NULL && member->getSocket(member->getSocketContext) == member->socketFd)
+    {
+        (void)epoll_ctl(worker->epollFd, EPOLL_CTL_DEL, member->socketFd, NULL);
+    }
+    unlink_member(worker, member);
+    (void)GROUP_DECREMENT(&worker->memberCount);
+}
+
+static void apply_commands(GROUP_WORKER* worker)
+{
+    GROUP_COMMAND* command = GROUP_EXCHANGE(&worker->commands, (GROUP_COMMAND*)NULL);
+    GROUP_COMMAND* ordered = NULL;
+
+    // The stack holds the newest command first
+    while (command != NULL)
+    {
+        GROUP_COMMAND* next = command->next;
+        command->next = ordered;
+        ordered = command;
+        command = next;
+    }
+
+    while (ordered != NULL)
+    {
+        GROUP_COMMAND* next = ordered->next;
+        MQTT_CLIENT_GROUP_MEMBER* member = ordered->member;
+        switch (ordered->type)
+        {
+            case GROUP_COMMAND_ADD:
+                attach_member(worker, member);
+                break;
+            case GROUP_COMMAND_POST:
+                /* Codes_SRS_MQTT_CLIENT_GROUP_07_027: [ The worker shall call work with the client and context and then call mqtt_client_dowork for the client. ] */
+                ordered->work(member->client, ordered->context);
+                mark_pending(member);
+                free(ordered);
+                break;
+            case GROUP_COMMAND_REMOVE:
+                /* Codes_SRS_MQTT_CLIENT_GROUP_07_031: [ The worker shall remove the wakeup callback, the receive buffer pool and the timer wheel it set on the client, stop waiting on its socket, call onRemoved with the client and context if onRemoved is not NULL and free the member. ] */
+                detach_member(worker, member);
+                if (ordered->work != NULL)
+                {
+                    ordered->work(member->client, ordered->context);
+                }
+                free(member);
+                break;
+        }
+        ordered = next;
+    }
+}
+
+static int get_wait_timeout(const GROUP_WORKER* worker, tickcounter_ms_t now)
+{
+    int result;
+    if (worker->pending != NULL)
+    {
+        result = 0;
+    }
+    else
+    {
+        uint32_t timeout = mqtt_timer_wheel_get_timeout(worker->timerWheel, now);
+        if (timeout == UINT32_MAX)
+        {
+            result = -1;
+        }
+        else
+        {
+            result = (timeout > INT32_MAX) ? INT32_MAX : (int)timeout;
+        }
+    }
+    return result;
+}
+
+static int run_worker_once(GROUP_WORKER* worker)
+{
+    int result;
+    tickcounter_ms_t now;
+
+    if (tickcounter_get_current_ms(worker->tickCounter, &now) != 0)
+    {
+        LogError("Failure getting the current time of a worker");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        struct epoll_event ready[GROUP_EVENT_COUNT];
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_020: [ mqtt_client_group_run_worker_once shall wait until the timer wheel of the worker has timers to expire, without limit if it has none, or until a socket of a member or the eventfd of the worker ends the wait, and then advance the wheel to the current time. ] */
+        int readyCount = epoll_wait(worker->epollFd, ready, GROUP_EVENT_COUNT, get_wait_timeout(worker, now));
+        if (readyCount == -1 && errno != EINTR)
+        {
+            /* Codes_SRS_MQTT_CLIENT_GROUP_07_024: [ If any failure is encountered then mqtt_client_group_run_worker_once shall return a non-zero value. ] */
+            LogError("Failure waiting on the epoll set of a worker, errno %d", errno);
+            result = MU_FAILURE;
+        }
+        else if (tickcounter_get_current_ms(worker->tickCounter, &now) != 0)
+        {
+            LogError("Failure getting the current time of a worker");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            int index;
+            MQTT_CLIENT_GROUP_MEMBER* member;
+
+            // Marked before the commands run, a member they remove is taken off the pending list
+            for (index = 0; index < readyCount; index++)
+            {
+                if (ready[index].data.ptr == NULL)
+                {
+                    drain_worker_signal(worker);
+                }
+                else
+                {
+                    mark_pending((MQTT_CLIENT_GROUP_MEMBER*)ready[index].data.ptr);
+                }
+            }
+            (void)mqtt_timer_wheel_advance(worker->timerWheel, now);
+            take_wakeups(worker);
+            apply_commands(worker);
+
+            /* Codes_SRS_MQTT_CLIENT_GROUP_07_021: [ After the wait mqtt_client_group_run_worker_once shall call mqtt_client_dowork once for every member of the worker whose socket ended the wait, that was woken up, posted to or added, or whose timer expired, and return 0. ] */
+            member = worker->pending;
+            worker->pending = NULL;
+            while (member != NULL)
+            {
+                // Read before schedule_member can queue the member for the next run
+                MQTT_CLIENT_GROUP_MEMBER* next = member->pendingNext;
+                member->workPending = false;
+                mqtt_client_dowork(member->client);
+                schedule_member(worker, member);
+                member = next;
+            }
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static int worker_thread(void* arg)
+{
+    int result = 0;
+    GROUP_WORKER* worker = (GROUP_WORKER*)arg;
+    while (result == 0 && !GROUP_LOAD(&worker->group->stopRequested))
+    {
+        result = run_worker_once(worker);
+    }
+    return result;
+}
+
+static void deinit_worker(GROUP_WORKER* worker)
+{
+    if (worker->eventFd != -1)
+    {
+        (void)close(worker->eventFd);
+    }
+    if (worker->epollFd != -1)
+    {
+        (void)close(worker->epollFd);
+    }
+    if (worker->tickCounter != NULL)
+    {
+        tickcounter_destroy(worker->tickCounter);
+    }
+    if (worker->timerWheel != NULL)
+    {
+        mqtt_timer_wheel_destroy(worker->timerWheel);
+    }
+    if (worker->recvPool != NULL)
+    {
+        mqtt_codec_recv_pool_destroy(worker->recvPool);
+    }
+}
+
+static int init_worker(MQTT_CLIENT_GROUP* group, GROUP_WORKER* worker, size_t recvPoolHighWaterMark)
+{
+    int result;
+    struct epoll_event event;
+    tickcounter_ms_t now;
+
+    memset(worker, 0, sizeof(GROUP_WORKER));
+    worker->group = group;
+    worker->eventFd = -1;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+
+    if ((worker->epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+    {
+        LogError("Failure creating epoll set, errno %d", errno);
+        result = MU_FAILURE;
+    }
+    else if ((worker->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+    {
+        LogError("Failure creating eventfd, errno %d", errno);
+        result = MU_FAILURE;
+    }
+    else if (epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->eventFd, &event) != 0)
+    {
+        LogError("Failure adding eventfd to the epoll set, errno %d", errno);
+        result = MU_FAILURE;
+    }
+    else if ((worker->tickCounter = tickcounter_create()) == NULL)
+    {
+        LogError("Failure creating tick counter");
+        result = MU_FAILURE;
+    }
+    else if (tickcounter_get_current_ms(worker->tickCounter, &now) != 0)
+    {
+        LogError("Failure getting the current time of a worker");
+        result = MU_FAILURE;
+    }
+    else if ((worker->timerWheel = mqtt_timer_wheel_create(now)) == NULL)
+    {
+        LogError("Failure creating timer wheel");
+        result = MU_FAILURE;
+    }
+    else if (recvPoolHighWaterMark != 0 && (worker->recvPool = mqtt_codec_recv_pool_create(recvPoolHighWaterMark)) == NULL)
+    {
+        LogError("Failure creating receive buffer pool");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        result = 0;
+    }
+
+    if (result != 0)
+    {
+        deinit_worker(worker);
+    }
+    return result;
+}
+
+static void join_workers(MQTT_CLIENT_GROUP* group, size_t count)
+{
+    size_t index;
+    GROUP_STORE(&group->stopRequested, 1);
+    for (index = 0; index < count; index++)
+    {
+        signal_worker(&group->workers[index]);
+    }
+    for (index = 0; index < count; index++)
+    {
+        int threadResult;
+        if (ThreadAPI_Join(group->workers[index].thread, &threadResult) != THREADAPI_OK)
+        {
+            LogError("Failure joining worker %lu", (unsigned long)index);
+        }
+        else if (threadResult != 0)
+        {
+            LogError("Worker %lu stopped on a failure", (unsigned long)index);
+        }
+    }
+    GROUP_STORE(&group->stopRequested, 0);
+}
+
+MQTT_CLIENT_GROUP_HANDLE mqtt_client_group_create(const MQTT_CLIENT_GROUP_OPTIONS* options)
+{
+    MQTT_CLIENT_GROUP* result;
+
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_001: [ If options is NULL or its workerCount is 0 then mqtt_client_group_create shall return NULL. ] */
+    if (options == NULL || options->workerCount == 0)
+    {
+        LogError("Invalid parameter specified options: %p", options);
+        result = NULL;
+    }
+    else if ((result = (MQTT_CLIENT_GROUP*)malloc(sizeof(MQTT_CLIENT_GROUP))) == NULL)
+    {
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_003: [ If any failure is encountered then mqtt_client_group_create shall return NULL. ] */
+        LogError("Failure allocating client group");
+    }
+    else if ((result->workers = (GROUP_WORKER*)malloc(options->workerCount * sizeof(GROUP_WORKER))) == NULL)
+    {
+        LogError("Failure allocating %lu workers", (unsigned long)options->workerCount);
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        size_t index;
+
+        result->maxWaitMs = options->maxWaitMs;
+        result->started = false;
+        result->stopRequested = 0;
+
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_002: [ mqtt_client_group_create shall create workerCount workers, each with an epoll set, a non-blocking eventfd in the set, a tick counter, a timer wheel and, if recvPoolHighWaterMark is not 0, a receive buffer pool with that high water mark. ] */
+        for (index = 0; index < options->workerCount; index++)
+        {
+            if (init_worker(result, &result->workers[index], options->recvPoolHighWaterMark) != 0)
+            {
+                break;
+            }
+        }
+        result->workerCount = index;
+
+        if (index < options->workerCount)
+        {
+            /* Codes_SRS_MQTT_CLIENT_GROUP_07_003: [ If any failure is encountered then mqtt_client_group_create shall return NULL. ] */
+            for (index = 0; index < result->workerCount; index++)
+            {
+                deinit_worker(&result->workers[index]);
+            }
+            free(result->workers);
+            free(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+void mqtt_client_group_destroy(MQTT_CLIENT_GROUP_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_004: [ If handle is NULL then mqtt_client_group_destroy shall do nothing. ] */
+    if (handle != NULL)
+    {
+        size_t index;
+
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_005: [ mqtt_client_group_destroy shall stop the worker threads if the group is started. ] */
+        if (handle->started)
+        {
+            join_workers(handle, handle->workerCount);
+        }
+        for (index = 0; index < handle->workerCount; index++)
+        {
+            GROUP_WORKER* worker = &handle->workers[index];
+
+            /* Codes_SRS_MQTT_CLIENT_GROUP_07_006: [ mqtt_client_group_destroy shall apply the adds, posts and removes that are still queued, detach the remaining clients as mqtt_client_group_remove does without calling mqtt_client_dowork, and free the workers and the group. ] */
+            apply_commands(worker);
+            while (worker->members != NULL)
+            {
+                MQTT_CLIENT_GROUP_MEMBER* member = worker->members;
+                detach_member(worker, member);
+                free(member);
+            }
+            deinit_worker(worker);
+        }
+        free(handle->workers);
+        free(handle);
+    }
+}
+
+int mqtt_client_group_start(MQTT_CLIENT_GROUP_HANDLE handle)
+{
+    int result;
+
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_007: [ If handle is NULL or the group is already started then mqtt_client_group_start shall return a non-zero value. ] */
+    if (handle == NULL || handle->started)
+    {
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        size_t index;
+
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_008: [ mqtt_client_group_start shall start one thread per worker that calls mqtt_client_group_run_worker_once for it until mqtt_client_group_stop is called. ] */
+        for (index = 0; index < handle->workerCount; index++)
+        {
+            if (ThreadAPI_Create(&handle->workers[index].thread, worker_thread, &handle->workers[index]) != THREADAPI_OK)
+            {
+                LogError("Failure starting worker %lu", (unsigned long)index);
+                break;
+            }
+        }
+
+        if (index < handle->workerCount)
+        {
+            /* Codes_SRS_MQTT_CLIENT_GROUP_07_009: [ If a thread cannot be started then mqtt_client_group_start shall stop the threads it started and return a non-zero value. ] */
+            join_workers(handle, index);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            handle->started = true;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+int mqtt_client_group_stop(MQTT_CLIENT_GROUP_HANDLE handle)
+{
+    int result;
+
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_010: [ If handle is NULL then mqtt_client_group_stop shall return a non-zero value. ] */
+    if (handle == NULL)
+    {
+        LogError("Invalid parameter specified handle: NULL");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_011: [ mqtt_client_group_stop shall wake every worker, wait for the worker threads to exit and return 0, also when the group is not started. ] */
+        if (handle->started)
+        {
+            join_workers(handle, handle->workerCount);
+            handle->started = false;
+        }
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_group_run_worker_once(MQTT_CLIENT_GROUP_HANDLE handle, size_t workerIndex)
+{
+    int result;
+
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_018: [ If handle is NULL, workerIndex is not below the worker count or the group is started then mqtt_client_group_run_worker_once shall return a non-zero value. ] */
+    if (handle == NULL || workerIndex >= handle->workerCount || handle->started)
+    {
+        LogError("Invalid parameter specified handle: %p, workerIndex: %lu", handle, (unsigned long)workerIndex);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_019: [ mqtt_client_group_run_worker_once shall run the worker on the calling thread once: wait, then apply the queued adds, posts and removes, then call mqtt_client_dowork for the members that have work. ] */
+        result = run_worker_once(&handle->workers[workerIndex]);
+    }
+    return result;
+}
+
+MQTT_CLIENT_GROUP_MEMBER_HANDLE mqtt_client_group_add(MQTT_CLIENT_GROUP_HANDLE handle, MQTT_CLIENT_HANDLE client, ON_MQTT_CLIENT_RUN_GET_SOCKET getSocket, void* getSocketContext)
+{
+    MQTT_CLIENT_GROUP_MEMBER* result;
+
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_012: [ If handle or client is NULL, or getSocket is NULL while the group has a maxWaitMs of 0, then mqtt_client_group_add shall return NULL. ] */
+    if (handle == NULL || client == NULL || (getSocket == NULL && handle->maxWaitMs == 0))
+    {
+        LogError("Invalid parameter specified handle: %p, client: %p", handle, client);
+        result = NULL;
+    }
+    else if ((result = (MQTT_CLIENT_GROUP_MEMBER*)malloc(sizeof(MQTT_CLIENT_GROUP_MEMBER))) == NULL)
+    {
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_013: [ If any failure is encountered then mqtt_client_group_add shall return NULL. ] */
+        LogError("Failure allocating client group member");
+    }
+    else
+    {
+        size_t index;
+        size_t lowestCount = SIZE_MAX;
+        GROUP_WORKER* worker = NULL;
+
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_014: [ mqtt_client_group_add shall assign the client to the worker with the fewest members, which drives it until it is removed. ] */
+        for (index = 0; index < handle->workerCount; index++)
+        {
+            size_t count = GROUP_LOAD(&handle->workers[index].memberCount);
+            if (count < lowestCount)
+            {
+                lowestCount = count;
+                worker = &handle->workers[index];
+            }
+        }
+        (void)GROUP_INCREMENT(&worker->memberCount);
+
+        memset(result, 0, sizeof(MQTT_CLIENT_GROUP_MEMBER));
+        result->worker = worker;
+        result->client = client;
+        result->getSocket = getSocket;
+        result->getSocketContext = getSocketContext;
+        result->socketFd = -1;
+
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_015: [ mqtt_client_group_add shall queue the member for its worker and signal the eventfd of the worker. ] */
+        result->addCommand.type = GROUP_COMMAND_ADD;
+        result->addCommand.member = result;
+        push_command(worker, &result->addCommand);
+    }
+    return result;
+}
+
+int mqtt_client_group_post(MQTT_CLIENT_GROUP_MEMBER_HANDLE member, ON_MQTT_CLIENT_GROUP_WORK work, void* context)
+{
+    int result;
+    GROUP_COMMAND* command;
+
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_025: [ If member or work is NULL then mqtt_client_group_post shall return a non-zero value. ] */
+    if (member == NULL || work == NULL)
+    {
+        LogError("Invalid parameter specified member: %p, work: %p", member, work);
+        result = MU_FAILURE;
+    }
+    else if ((command = (GROUP_COMMAND*)malloc(sizeof(GROUP_COMMAND))) == NULL)
+    {
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_028: [ If any failure is encountered then mqtt_client_group_post shall return a non-zero value. ] */
+        LogError("Failure allocating client group command");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_026: [ mqtt_client_group_post shall queue work and context for the worker of member, signal its eventfd and return 0. ] */
+        command->type = GROUP_COMMAND_POST;
+        command->member = member;
+        command->work = work;
+        command->context = context;
+        push_command(member->worker, command);
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_group_remove(MQTT_CLIENT_GROUP_MEMBER_HANDLE member, ON_MQTT_CLIENT_GROUP_WORK onRemoved, void* context)
+{
+    int result;
+
+    /* Codes_SRS_MQTT_CLIENT_GROUP_07_029: [ If member is NULL then mqtt_client_group_remove shall return a non-zero value. ] */
+    if (member == NULL)
+    {
+        LogError("Invalid parameter specified member: NULL");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CLIENT_GROUP_07_030: [ mqtt_client_group_remove shall queue the removal of member for its worker, signal its eventfd and return 0. ] */
+        member->removeCommand.type = GROUP_COMMAND_REMOVE;
+        member->removeCommand.member = member;
+        member->removeCommand.work = onRemoved;
+        member->removeCommand.context = context;
+        push_command(member->worker, &member->removeCommand);
+        result = 0;
+    }
+    return result;
+}
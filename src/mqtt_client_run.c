@@ -0,0 +1,305 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_client_run.h"
+
+#define RUN_STOP_LOAD(target)           __atomic_load_n((target), __ATOMIC_ACQUIRE)
+#define RUN_STOP_STORE(target, value)   __atomic_store_n((target), (value), __ATOMIC_RELEASE)
+
+// The eventfd is registered once for input. The socket is registered with the events the client
+// waits for and updated before every wait, it is removed while the client waits for neither.
+typedef struct MQTT_CLIENT_RUN_TAG
+{
+    MQTT_CLIENT_HANDLE client;
+    ON_MQTT_CLIENT_RUN_GET_SOCKET getSocket;
+    void* getSocketContext;
+    uint32_t maxWaitMs;
+
+    int epollFd;
+    int eventFd;
+    int socketFd;
+
+    int stopRequested;
+} MQTT_CLIENT_RUN;
+
+static void on_client_wakeup(void* context)
+{
+    (void)mqtt_client_run_wakeup((MQTT_CLIENT_RUN_HANDLE)context);
+}
+
+static void drain_wakeups(MQTT_CLIENT_RUN* run)
+{
+    uint64_t count;
+    (void)read(run->eventFd, &count, sizeof(count));
+}
+
+static int update_socket(MQTT_CLIENT_RUN* run, int socketFd, uint32_t events)
+{
+    int result = 0;
+
+    if (run->socketFd != -1 && (socketFd != run->socketFd || events == 0))
+    {
+        // The old socket may already be closed and so gone from the epoll set
+        (void)epoll_ctl(run->epollFd, EPOLL_CTL_DEL, run->socketFd, NULL);
+        run->socketFd = -1;
+    }
+
+    // Modified on every wait even when nothing changed, a socket closed and reopened under the same
+    // number has left the epoll set without the run loop seeing it
+    if (socketFd != -1 && events != 0)
+    {
+        struct epoll_event event;
+        event.events = events;
+        event.data.fd = socketFd;
+        if (epoll_ctl(run->epollFd, run->socketFd == socketFd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, socketFd, &event) != 0 &&
+            (errno != ENOENT || epoll_ctl(run->epollFd, EPOLL_CTL_ADD, socketFd, &event) != 0))
+        {
+            LogError("Failure adding socket %d to the epoll set, errno %d", socketFd, errno);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            run->socketFd = socketFd;
+        }
+    }
+    return result;
+}
+
+static int get_wait_timeout(const MQTT_CLIENT_RUN* run, uint32_t timeoutMs, int hasSocket)
+{
+    int result;
+    uint32_t maxWaitMs = run->maxWaitMs;
+
+    if (!hasSocket && maxWaitMs == 0)
+    {
+        // Can not happen through mqtt_client_run_create, kept so input is never left unpolled
+        maxWaitMs = 1;
+    }
+    if (maxWaitMs != 0 && timeoutMs > maxWaitMs)
+    {
+        timeoutMs = maxWaitMs;
+    }
+    if (timeoutMs == UINT32_MAX)
+    {
+        result = -1;
+    }
+    else if (timeoutMs > INT32_MAX)
+    {
+        result = INT32_MAX;
+    }
+    else
+    {
+        result = (int)timeoutMs;
+    }
+    return result;
+}
+
+MQTT_CLIENT_RUN_HANDLE mqtt_client_run_create(MQTT_CLIENT_HANDLE client, const MQTT_CLIENT_RUN_OPTIONS* options)
+{
+    MQTT_CLIENT_RUN* result;
+
+    /* Codes_SRS_MQTT_CLIENT_RUN_07_001: [ If client or options is NULL, or options has no getSocket and a maxWaitMs of 0, then mqtt_client_run_create shall return NULL. ] */
+    if (client == NULL || options == NULL || (options->getSocket == NULL && options->maxWaitMs == 0))
+    {
+        LogError("Invalid parameter specified client: %p, options: %p", client, options);
+        result = NULL;
+    }
+    else if ((result = (MQTT_CLIENT_RUN*)malloc(sizeof(MQTT_CLIENT_RUN))) == NULL)
+    {
+        /* Codes_SRS_MQTT_CLIENT_RUN_07_004: [ If any failure is encountered then mqtt_client_run_create shall return NULL. ] */
+        LogError("Failure allocating run loop");
+    }
+    else
+    {
+        result->client = client;
+        result->getSocket = options->getSocket;
+        result->getSocketContext = options->getSocketContext;
+        result->maxWaitMs = options->maxWaitMs;
+        result->socketFd = -1;
+        result->stopRequested = 0;
+
+        /* Codes_SRS_MQTT_CLIENT_RUN_07_002: [ mqtt_client_run_create shall create an epoll set and a non-blocking eventfd and add the eventfd to the set for input. ] */
+        if ((result->epollFd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+        {
+            /* Codes_SRS_MQTT_CLIENT_RUN_07_004: [ If any failure is encountered then mqtt_client_run_create shall return NULL. ] */
+            LogError("Failure creating epoll set, errno %d", errno);
+            free(result);
+            result = NULL;
+        }
+        else if ((result->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+        {
+            LogError("Failure creating eventfd, errno %d", errno);
+            (void)close(result->epollFd);
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = result->eventFd;
+            if (epoll_ctl(result->epollFd, EPOLL_CTL_ADD, result->eventFd, &event) != 0)
+            {
+                LogError("Failure adding eventfd to the epoll set, errno %d", errno);
+                (void)close(result->eventFd);
+                (void)close(result->epollFd);
+                free(result);
+                result = NULL;
+            }
+            /* Codes_SRS_MQTT_CLIENT_RUN_07_003: [ mqtt_client_run_create shall set a wakeup callback on client with mqtt_client_set_wakeup_callback that signals the eventfd. ] */
+            else if (mqtt_client_set_wakeup_callback(client, on_client_wakeup, result) != 0)
+            {
+                LogError("Failure setting the wakeup callback");
+                (void)close(result->eventFd);
+                (void)close(result->epollFd);
+                free(result);
+                result = NULL;
+            }
+        }
+    }
+    return result;
+}
+
+void mqtt_client_run_destroy(MQTT_CLIENT_RUN_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_CLIENT_RUN_07_005: [ If handle is NULL then mqtt_client_run_destroy shall do nothing. ] */
+    if (handle != NULL)
+    {
+        /* Codes_SRS_MQTT_CLIENT_RUN_07_006: [ mqtt_client_run_destroy shall remove the wakeup callback from the client, close the eventfd and the epoll set and free the run loop. ] */
+        (void)mqtt_client_set_wakeup_callback(handle->client, NULL, NULL);
+        (void)close(handle->eventFd);
+        (void)close(handle->epollFd);
+        free(handle);
+    }
+}
+
+int mqtt_client_run_once(MQTT_CLIENT_RUN_HANDLE handle)
+{
+    int result;
+    MQTT_CLIENT_WAIT_INFO waitInfo;
+
+    /* Codes_SRS_MQTT_CLIENT_RUN_07_007: [ If handle is NULL then mqtt_client_run_once shall return a non-zero value. ] */
+    if (handle == NULL)
+    {
+        LogError("Invalid parameter specified handle: NULL");
+        result = MU_FAILURE;
+    }
+    /* Codes_SRS_MQTT_CLIENT_RUN_07_008: [ mqtt_client_run_once shall get the timeout and the socket events to wait for with mqtt_client_get_wait_info. ] */
+    else if (mqtt_client_get_wait_info(handle->client, &waitInfo) != 0)
+    {
+        /* Codes_SRS_MQTT_CLIENT_RUN_07_013: [ If any failure is encountered then mqtt_client_run_once shall return a non-zero value. ] */
+        LogError("Failure getting the wait info of the client");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CLIENT_RUN_07_009: [ When a socket getter was given, mqtt_client_run_once shall wait on the socket it returns for input if waitRead is true and for output if waitWrite is true, and shall not wait on a socket of -1. ] */
+        int socketFd = handle->getSocket == NULL ? -1 : handle->getSocket(handle->getSocketContext);
+        uint32_t events = (waitInfo.waitRead ? EPOLLIN : 0) | (waitInfo.waitWrite ? EPOLLOUT : 0);
+
+        if (update_socket(handle, socketFd, socketFd == -1 ? 0 : events) != 0)
+        {
+            /* Codes_SRS_MQTT_CLIENT_RUN_07_013: [ If any failure is encountered then mqtt_client_run_once shall return a non-zero value. ] */
+            result = MU_FAILURE;
+        }
+        else
+        {
+            struct epoll_event ready[2];
+            /* Codes_SRS_MQTT_CLIENT_RUN_07_010: [ mqtt_client_run_once shall wait for at most timeoutMs, without limit if it is UINT32_MAX, and for at most maxWaitMs when maxWaitMs is not 0. ] */
+            int timeout = get_wait_timeout(handle, waitInfo.timeoutMs, handle->socketFd != -1);
+
+            if (epoll_wait(handle->epollFd, ready, 2, timeout) == -1 && errno != EINTR)
+            {
+                /* Codes_SRS_MQTT_CLIENT_RUN_07_013: [ If any failure is encountered then mqtt_client_run_once shall return a non-zero value. ] */
+                LogError("Failure waiting on the epoll set, errno %d", errno);
+                result = MU_FAILURE;
+            }
+            else
+            {
+                /* Codes_SRS_MQTT_CLIENT_RUN_07_011: [ A wakeup shall end the wait and shall be cleared before mqtt_client_dowork is called. ] */
+                drain_wakeups(handle);
+                /* Codes_SRS_MQTT_CLIENT_RUN_07_012: [ After the wait mqtt_client_run_once shall call mqtt_client_dowork once and return 0. ] */
+                mqtt_client_dowork(handle->client);
+                result = 0;
+            }
+        }
+    }
+    return result;
+}
+
+int mqtt_client_run(MQTT_CLIENT_RUN_HANDLE handle)
+{
+    int result;
+
+    /* Codes_SRS_MQTT_CLIENT_RUN_07_014: [ If handle is NULL then mqtt_client_run shall return a non-zero value. ] */
+    if (handle == NULL)
+    {
+        LogError("Invalid parameter specified handle: NULL");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        result = 0;
+        /* Codes_SRS_MQTT_CLIENT_RUN_07_015: [ mqtt_client_run shall call mqtt_client_run_once until mqtt_client_run_stop is called, then clear the stop request and return 0. ] */
+        while (result == 0 && !RUN_STOP_LOAD(&handle->stopRequested))
+        {
+            /* Codes_SRS_MQTT_CLIENT_RUN_07_016: [ If mqtt_client_run_once fails then mqtt_client_run shall return a non-zero value. ] */
+            result = mqtt_client_run_once(handle);
+        }
+        RUN_STOP_STORE(&handle->stopRequested, 0);
+    }
+    return result;
+}
+
+int mqtt_client_run_wakeup(MQTT_CLIENT_RUN_HANDLE handle)
+{
+    int result;
+    uint64_t one = 1;
+
+    /* Codes_SRS_MQTT_CLIENT_RUN_07_017: [ If handle is NULL then mqtt_client_run_wakeup shall return a non-zero value. ] */
+    if (handle == NULL)
+    {
+        LogError("Invalid parameter specified handle: NULL");
+        result = MU_FAILURE;
+    }
+    /* Codes_SRS_MQTT_CLIENT_RUN_07_018: [ mqtt_client_run_wakeup shall signal the eventfd and return 0, a wakeup that is already pending is not an error. ] */
+    else if (write(handle->eventFd, &one, sizeof(one)) != (ssize_t)sizeof(one) && errno != EAGAIN)
+    {
+        LogError("Failure signaling the eventfd, errno %d", errno);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_run_stop(MQTT_CLIENT_RUN_HANDLE handle)
+{
+    int result;
+
+    /* Codes_SRS_MQTT_CLIENT_RUN_07_019: [ If handle is NULL then mqtt_client_run_stop shall return a non-zero value. ] */
+    if (handle == NULL)
+    {
+        LogError("Invalid parameter specified handle: NULL");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CLIENT_RUN_07_020: [ mqtt_client_run_stop shall request mqtt_client_run to return and wake it up. ] */
+        RUN_STOP_STORE(&handle->stopRequested, 1);
+        result = mqtt_client_run_wakeup(handle);
+    }
+    return result;
+}
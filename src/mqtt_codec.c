@@ -30,19 +30,32 @@
 #define PUBLISH_QOS_RETAIN                  0x1
 
 #define PROTOCOL_NUMBER                     4
+#define PROTOCOL_NUMBER_V5                  5
 #define CONN_FLAG_BYTE_OFFSET               7
 
 #define CONNECT_FIXED_HEADER_SIZE           2
 #define CONNECT_VARIABLE_HEADER_SIZE        10
+#define TOPIC_ALIAS_PROPERTY_SIZE           3
 #define SUBSCRIBE_FIXED_HEADER_FLAG         0x2
 #define UNSUBSCRIBE_FIXED_HEADER_FLAG       0x2
 
 #define MAX_SEND_SIZE                       0xFFFFFF7F // 268435455
 
+// The Remaining Length is encoded in at most 4 bytes
+#define MAX_REMAINING_LENGTH_BYTES          4
+#define MAX_REMAINING_LENGTH                268435455
+
 // This captures the maximum packet size for 3 digits.
 // If it's above this value then we bail out of the loop
 #define MAX_3_DIGIT_PACKET_SIZE             2097152
 
+// Receive buffers are kept in size classes of up to 64 bytes, 1 KB, 16 KB and
+// a last class for anything larger.  Up to the high water mark worth of idle
+// buffers are cached per codec.
+#define RECV_POOL_CLASS_COUNT               4
+#define RECV_POOL_LARGE_CLASS               (RECV_POOL_CLASS_COUNT - 1)
+#define DEFAULT_RECV_POOL_HIGH_WATER_MARK   (64 * 1024)
+
 #define CODEC_STATE_VALUES      \
     CODEC_STATE_FIXED_HEADER,   \
     CODEC_STATE_VAR_HEADER,     \
@@ -53,6 +66,26 @@ static const char* const FALSE_CONST = "false";
 
 MU_DEFINE_ENUM(CODEC_STATE_RESULT, CODEC_STATE_VALUES);
 
+static const size_t RECV_POOL_CLASS_SIZE[RECV_POOL_LARGE_CLASS] = { 64, 1024, 16 * 1024 };
+
+// The packet bytes follow the block header in the same allocation
+typedef struct RECV_POOL_BLOCK_TAG
+{
+    struct RECV_POOL_BLOCK_TAG* next;
+    size_t capacity;
+} RECV_POOL_BLOCK;
+
+typedef struct RECV_POOL_TAG
+{
+    RECV_POOL_BLOCK* freeList[RECV_POOL_CLASS_COUNT];
+    size_t highWaterMark;
+    size_t cachedBytes;
+    size_t heldBytes;
+    size_t hits;
+    size_t misses;
+    size_t peakBytes;
+} RECV_POOL;
+
 typedef struct MQTTCODEC_INSTANCE_TAG
 {
     CONTROL_PACKET_TYPE currPacket;
@@ -60,18 +93,31 @@ typedef struct MQTTCODEC_INSTANCE_TAG
     size_t bufferOffset;
     int headerFlags;
     BUFFER_HANDLE headerData;
+    uint8_t* packetBytes;
+    size_t packetLength;
+    RECV_POOL_BLOCK* packetBlock;
+    RECV_POOL recvPool;
+    // recvPool unless the codec was given a pool it shares with other codecs
+    RECV_POOL* activePool;
     ON_PACKET_COMPLETE_CALLBACK packetComplete;
+    ON_PACKET_VIEW_CALLBACK packetView;
     void* callContext;
     uint8_t storeRemainLen[4];
     size_t remainLenIndex;
 } MQTTCODEC_INSTANCE;
 
+// encodedTopic is NULL unless the caller passed the topic name already length prefixed,
+// isV5 adds the MQTT 5 property block that carries topicAlias when it is not zero
 typedef struct PUBLISH_HEADER_INFO_TAG
 {
     const char* topicName;
+    size_t topicLength;
+    const uint8_t* encodedTopic;
     uint16_t packetId;
     const char* msgBuffer;
     QOS_VALUE qualityOfServiceValue;
+    bool isV5;
+    uint16_t topicAlias;
 } PUBLISH_HEADER_INFO;
 
 static const char* retrieve_qos_value(QOS_VALUE value)
@@ -108,6 +154,15 @@ static void byteutil_writeInt(uint8_t** buffer, uint16_t value)
     }
 }
 
+static void byteutil_writeUint32(uint8_t** buffer, uint32_t value)
+{
+    if (buffer != NULL)
+    {
+        byteutil_writeInt(buffer, (uint16_t)(value >> 16));
+        byteutil_writeInt(buffer, (uint16_t)(value & 0xFFFF));
+    }
+}
+
 static void byteutil_writeUTF(uint8_t** buffer, const char* stringData, uint16_t len)
 {
     if (buffer != NULL)
@@ -193,10 +248,67 @@ static int addListItemsToSubscribePacket(BUFFER_HANDLE ctrlPacket, SUBSCRIBE_PAY
     return result;
 }
 
+static bool isProtocolV5(const MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    return mqttOptions->protocolVersion == MQTT_PROTOCOL_V5;
+}
+
+// Size of the properties of an MQTT 5 CONNECT, at most 13 bytes so the property length is a single byte
+static size_t getConnectPropertiesLength(const MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    size_t result = 0;
+    if (mqttOptions->sessionExpiryInterval != 0)
+    {
+        result += 5;
+    }
+    if (mqttOptions->receiveMaximum != 0)
+    {
+        result += 3;
+    }
+    if (mqttOptions->maximumPacketSize != 0)
+    {
+        result += 5;
+    }
+    return result;
+}
+
+static void constructConnectProperties(uint8_t** iterator, const MQTT_CLIENT_OPTIONS* mqttOptions, STRING_HANDLE trace_log)
+{
+    byteutil_writeByte(iterator, (uint8_t)getConnectPropertiesLength(mqttOptions));
+    if (mqttOptions->sessionExpiryInterval != 0)
+    {
+        byteutil_writeByte(iterator, MQTT_PROPERTY_SESSION_EXPIRY_INTERVAL);
+        byteutil_writeUint32(iterator, mqttOptions->sessionExpiryInterval);
+        if (trace_log != NULL)
+        {
+            STRING_sprintf(trace_log, " | SESSION_EXPIRY: %"PRIu32, mqttOptions->sessionExpiryInterval);
+        }
+    }
+    if (mqttOptions->receiveMaximum != 0)
+    {
+        byteutil_writeByte(iterator, MQTT_PROPERTY_RECEIVE_MAXIMUM);
+        byteutil_writeInt(iterator, mqttOptions->receiveMaximum);
+        if (trace_log != NULL)
+        {
+            STRING_sprintf(trace_log, " | RECEIVE_MAX: %"PRIu16, mqttOptions->receiveMaximum);
+        }
+    }
+    if (mqttOptions->maximumPacketSize != 0)
+    {
+        byteutil_writeByte(iterator, MQTT_PROPERTY_MAXIMUM_PACKET_SIZE);
+        byteutil_writeUint32(iterator, mqttOptions->maximumPacketSize);
+        if (trace_log != NULL)
+        {
+            STRING_sprintf(trace_log, " | MAX_PACKET_SIZE: %"PRIu32, mqttOptions->maximumPacketSize);
+        }
+    }
+}
+
 static int constructConnectVariableHeader(BUFFER_HANDLE ctrlPacket, const MQTT_CLIENT_OPTIONS* mqttOptions, STRING_HANDLE trace_log)
 {
     int result = 0;
-    if (BUFFER_enlarge(ctrlPacket, CONNECT_VARIABLE_HEADER_SIZE) != 0)
+    bool isV5 = isProtocolV5(mqttOptions);
+    if (BUFFER_enlarge(ctrlPacket, CONNECT_VARIABLE_HEADER_SIZE + (isV5 ? 1 + getConnectPropertiesLength(mqttOptions) : 0)) != 0)
     {
         result = MU_FAILURE;
     }
@@ -211,78 +323,75 @@ static int constructConnectVariableHeader(BUFFER_HANDLE ctrlPacket, const MQTT_C
         {
             if (trace_log != NULL)
             {
-                STRING_sprintf(trace_log, " | VER: %d | KEEPALIVE: %d | FLAGS:", PROTOCOL_NUMBER, mqttOptions->keepAliveInterval);
+                STRING_sprintf(trace_log, " | VER: %d | KEEPALIVE: %d", isV5 ? PROTOCOL_NUMBER_V5 : PROTOCOL_NUMBER, mqttOptions->keepAliveInterval);
             }
             byteutil_writeUTF(&iterator, "MQTT", 4);
-            byteutil_writeByte(&iterator, PROTOCOL_NUMBER);
+            byteutil_writeByte(&iterator, isV5 ? PROTOCOL_NUMBER_V5 : PROTOCOL_NUMBER);
             byteutil_writeByte(&iterator, 0); // Flags will be entered later
             byteutil_writeInt(&iterator, mqttOptions->keepAliveInterval);
+            if (isV5)
+            {
+                /* Codes_SRS_MQTT_CODEC_07_059: [If mqttOptions->protocolVersion is MQTT_PROTOCOL_V5 then mqtt_codec_connect shall write protocol level 5, a property block holding the session expiry interval, receive maximum and maximum packet size that are not zero, and an empty will property block before the will topic.] */
+                constructConnectProperties(&iterator, mqttOptions, trace_log);
+            }
+            if (trace_log != NULL)
+            {
+                STRING_sprintf(trace_log, " | FLAGS:");
+            }
             result = 0;
         }
     }
     return result;
 }
 
-static int constructPublishVariableHeader(BUFFER_HANDLE ctrlPacket, const PUBLISH_HEADER_INFO* publishHeader, STRING_HANDLE trace_log)
+static void constructPublishVariableHeader(uint8_t** iterator, const PUBLISH_HEADER_INFO* publishHeader, STRING_HANDLE trace_log)
 {
-    int result = 0;
-    size_t topicLen = 0;
-    size_t spaceLen = 0;
-    size_t idLen = 0;
-
-    size_t currLen = BUFFER_length(ctrlPacket);
-
-    topicLen = strlen(publishHeader->topicName);
-    spaceLen += 2;
-
-    if (publishHeader->qualityOfServiceValue != DELIVER_AT_MOST_ONCE)
+    /* The Topic Name MUST be present as the first field in the PUBLISH Packet Variable header.It MUST be 792 a UTF-8 encoded string [MQTT-3.3.2-1] as defined in section 1.5.3.*/
+    if (publishHeader->encodedTopic != NULL)
     {
-        // Packet Id is only set if the QOS is not 0
-        idLen = 2;
+        (void)memcpy(*iterator, publishHeader->encodedTopic, 2 + publishHeader->topicLength);
+        *iterator += 2 + publishHeader->topicLength;
     }
-
-    if (topicLen > USHRT_MAX)
+    else
     {
-        result = MU_FAILURE;
+        byteutil_writeUTF(iterator, publishHeader->topicName, (uint16_t)publishHeader->topicLength);
     }
-    else if (BUFFER_enlarge(ctrlPacket, topicLen + idLen + spaceLen) != 0)
+    if (trace_log != NULL)
     {
-        result = MU_FAILURE;
+        STRING_sprintf(trace_log, " | TOPIC_NAME: %.*s", (int)publishHeader->topicLength, publishHeader->topicName);
     }
-    else
+    if (publishHeader->qualityOfServiceValue != DELIVER_AT_MOST_ONCE)
     {
-        uint8_t* iterator = BUFFER_u_char(ctrlPacket);
-        if (iterator == NULL)
+        // Packet Id is only set if the QOS is not 0
+        if (trace_log != NULL)
         {
-            result = MU_FAILURE;
+            STRING_sprintf(trace_log, " | PACKET_ID: %"PRIu16, publishHeader->packetId);
         }
-        else
+        byteutil_writeInt(iterator, publishHeader->packetId);
+    }
+    if (publishHeader->isV5)
+    {
+        if (publishHeader->topicAlias != 0)
         {
-            iterator += currLen;
-            /* The Topic Name MUST be present as the first field in the PUBLISH Packet Variable header.It MUST be 792 a UTF-8 encoded string [MQTT-3.3.2-1] as defined in section 1.5.3.*/
-            byteutil_writeUTF(&iterator, publishHeader->topicName, (uint16_t)topicLen);
             if (trace_log != NULL)
             {
-                STRING_sprintf(trace_log, " | TOPIC_NAME: %s", publishHeader->topicName);
-            }
-            if (idLen > 0)
-            {
-                if (trace_log != NULL)
-                {
-                    STRING_sprintf(trace_log, " | PACKET_ID: %"PRIu16, publishHeader->packetId);
-                }
-                byteutil_writeInt(&iterator, publishHeader->packetId);
+                STRING_sprintf(trace_log, " | TOPIC_ALIAS: %"PRIu16, publishHeader->topicAlias);
             }
-            result = 0;
+            byteutil_writeByte(iterator, TOPIC_ALIAS_PROPERTY_SIZE);
+            byteutil_writeByte(iterator, MQTT_PROPERTY_TOPIC_ALIAS);
+            byteutil_writeInt(iterator, publishHeader->topicAlias);
+        }
+        else
+        {
+            byteutil_writeByte(iterator, 0);
         }
     }
-    return result;
 }
 
-static int constructSubscibeTypeVariableHeader(BUFFER_HANDLE ctrlPacket, uint16_t packetId)
+static int constructSubscibeTypeVariableHeader(BUFFER_HANDLE ctrlPacket, uint16_t packetId, bool isV5)
 {
     int result = 0;
-    if (BUFFER_enlarge(ctrlPacket, 2) != 0)
+    if (BUFFER_enlarge(ctrlPacket, isV5 ? 3 : 2) != 0)
     {
         result = MU_FAILURE;
     }
@@ -296,12 +405,31 @@ static int constructSubscibeTypeVariableHeader(BUFFER_HANDLE ctrlPacket, uint16_
         else
         {
             byteutil_writeInt(&iterator, packetId);
+            if (isV5)
+            {
+                // No properties
+                byteutil_writeByte(&iterator, 0);
+            }
             result = 0;
         }
     }
     return result;
 }
 
+static void writePublishReply(CONTROL_PACKET_TYPE type, uint8_t flags, uint16_t packetId, uint8_t* packet)
+{
+    packet[0] = (uint8_t)type | flags;
+    packet[1] = 0x2;
+    packet += 2;
+    byteutil_writeInt(&packet, packetId);
+}
+
+static void writeEmptyPacket(CONTROL_PACKET_TYPE type, uint8_t* packet)
+{
+    packet[0] = (uint8_t)type;
+    packet[1] = 0;
+}
+
 static BUFFER_HANDLE constructPublishReply(CONTROL_PACKET_TYPE type, uint8_t flags, uint16_t packetId)
 {
     BUFFER_HANDLE result = BUFFER_new();
@@ -322,39 +450,47 @@ static BUFFER_HANDLE constructPublishReply(CONTROL_PACKET_TYPE type, uint8_t fla
             }
             else
             {
-                *iterator = (uint8_t)type | flags;
-                iterator++;
-                *iterator = 0x2;
-                iterator++;
-                byteutil_writeInt(&iterator, packetId);
+                writePublishReply(type, flags, packetId, iterator);
             }
         }
     }
     return result;
 }
 
-static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE packetType, uint8_t flags)
+// Returns the number of bytes written to remainSize, or 0 if packetLen does not fit in the Remaining Length field
+static size_t encodeRemainingLength(uint8_t remainSize[MAX_REMAINING_LENGTH_BYTES], size_t packetLen)
 {
-    int result;
-    size_t packetLen = BUFFER_length(ctrlPacket);
-    uint8_t remainSize[4] ={ 0 };
     size_t index = 0;
-
-    // Calculate the length of packet
-    do
+    if (packetLen <= MAX_REMAINING_LENGTH)
     {
-        uint8_t encode = packetLen % 128;
-        packetLen /= 128;
-        // if there are more data to encode, set the top bit of this byte
-        if (packetLen > 0)
+        // Calculate the length of packet
+        do
         {
-            encode |= NEXT_128_CHUNK;
-        }
-        remainSize[index++] = encode;
-    } while (packetLen > 0);
+            uint8_t encode = packetLen % 128;
+            packetLen /= 128;
+            // if there are more data to encode, set the top bit of this byte
+            if (packetLen > 0)
+            {
+                encode |= NEXT_128_CHUNK;
+            }
+            remainSize[index++] = encode;
+        } while (packetLen > 0);
+    }
+    return index;
+}
+
+static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE packetType, uint8_t flags)
+{
+    int result;
+    uint8_t remainSize[MAX_REMAINING_LENGTH_BYTES] ={ 0 };
+    size_t index = encodeRemainingLength(remainSize, BUFFER_length(ctrlPacket));
 
-    BUFFER_HANDLE fixedHeader = BUFFER_new();
-    if (fixedHeader == NULL)
+    BUFFER_HANDLE fixedHeader;
+    if (index == 0)
+    {
+        result = MU_FAILURE;
+    }
+    else if ((fixedHeader = BUFFER_new()) == NULL)
     {
         result = MU_FAILURE;
     }
@@ -414,6 +550,12 @@ static int constructConnPayload(BUFFER_HANDLE ctrlPacket, const MQTT_CLIENT_OPTI
         willTopicLen = strlen(mqttOptions->willTopic);
     }
 
+    if (willTopicLen > 0 && isProtocolV5(mqttOptions))
+    {
+        // Empty will properties
+        spaceLen += 1;
+    }
+
     currLen = ctrlPacket == NULL ? 0 : BUFFER_length(ctrlPacket);
     totalLen = clientLen + usernameLen + passwordLen + willMessageLen + willTopicLen + spaceLen;
 
@@ -465,6 +607,10 @@ static int constructConnPayload(BUFFER_HANDLE ctrlPacket, const MQTT_CLIENT_OPTI
                     (void)STRING_sprintf(connect_payload_trace, " | WILL_TOPIC: %s", mqttOptions->willTopic);
                 }
                 packet[CONN_FLAG_BYTE_OFFSET] |= WILL_FLAG_FLAG;
+                if (isProtocolV5(mqttOptions))
+                {
+                    byteutil_writeByte(&iterator, 0);
+                }
                 byteutil_writeUTF(&iterator, mqttOptions->willTopic, (uint16_t)willTopicLen);
                 packet[CONN_FLAG_BYTE_OFFSET] |= (mqttOptions->qualityOfServiceValue << 3);
                 if (mqttOptions->messageRetain)
@@ -558,27 +704,8 @@ static int prepareheaderDataInfo(MQTTCODEC_INSTANCE* codecData, uint8_t remainLe
             codecData->remainLenIndex = 0;
             memset(codecData->storeRemainLen, 0, 4 * sizeof(uint8_t));
 
-            if (totalLen > 0)
-            {
-                codecData->bufferOffset = 0;
-                codecData->headerData = BUFFER_new();
-                if (codecData->headerData == NULL)
-                {
-                    /* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
-                    LogError("Failed BUFFER_new");
-                    result = MU_FAILURE;
-                }
-                else
-                {
-                    if (BUFFER_pre_build(codecData->headerData, totalLen) != 0)
-                    {
-                        /* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
-                        LogError("Failed BUFFER_pre_build");
-                        result = MU_FAILURE;
-                    }
-
-                }
-            }
+            codecData->bufferOffset = 0;
+            codecData->packetLength = (size_t)totalLen;
         }
     }
     else if (codecData->remainLenIndex == (sizeof(codecData->storeRemainLen) / sizeof(codecData->storeRemainLen[0])))
@@ -594,9 +721,162 @@ static int prepareheaderDataInfo(MQTTCODEC_INSTANCE* codecData, uint8_t remainLe
     return result;
 }
 
-static void completePacketData(MQTTCODEC_INSTANCE* codecData)
+static size_t recv_pool_class(size_t length)
+{
+    size_t result = 0;
+    while (result < RECV_POOL_LARGE_CLASS && length > RECV_POOL_CLASS_SIZE[result])
+    {
+        result++;
+    }
+    return result;
+}
+
+static RECV_POOL_BLOCK* recv_pool_acquire(RECV_POOL* pool, size_t length)
+{
+    size_t classIndex = recv_pool_class(length);
+    RECV_POOL_BLOCK** iterator = &pool->freeList[classIndex];
+    RECV_POOL_BLOCK* result;
+
+    // Large blocks have differing capacities so look for the first one that fits
+    while (*iterator != NULL && (*iterator)->capacity < length)
+    {
+        iterator = &(*iterator)->next;
+    }
+
+    if (*iterator != NULL)
+    {
+        result = *iterator;
+        *iterator = result->next;
+        pool->cachedBytes -= result->capacity;
+        pool->hits++;
+    }
+    else
+    {
+        size_t capacity = (classIndex == RECV_POOL_LARGE_CLASS) ? length : RECV_POOL_CLASS_SIZE[classIndex];
+        result = (RECV_POOL_BLOCK*)malloc(sizeof(RECV_POOL_BLOCK) + capacity);
+        if (result == NULL)
+        {
+            LogError("Failure allocating receive buffer of %lu bytes", (unsigned long)capacity);
+        }
+        else
+        {
+            result->capacity = capacity;
+            pool->heldBytes += capacity;
+            if (pool->heldBytes > pool->peakBytes)
+            {
+                pool->peakBytes = pool->heldBytes;
+            }
+            pool->misses++;
+        }
+    }
+    return result;
+}
+
+static void recv_pool_release(RECV_POOL* pool, RECV_POOL_BLOCK* block)
+{
+    if (pool->cachedBytes + block->capacity <= pool->highWaterMark)
+    {
+        size_t classIndex = recv_pool_class(block->capacity);
+        block->next = pool->freeList[classIndex];
+        pool->freeList[classIndex] = block;
+        pool->cachedBytes += block->capacity;
+    }
+    else
+    {
+        pool->heldBytes -= block->capacity;
+        free(block);
+    }
+}
+
+static void recv_pool_trim(RECV_POOL* pool)
+{
+    size_t classIndex = RECV_POOL_CLASS_COUNT;
+    // Drop the largest buffers first
+    while (pool->cachedBytes > pool->highWaterMark && classIndex > 0)
+    {
+        RECV_POOL_BLOCK* block = pool->freeList[classIndex - 1];
+        if (block == NULL)
+        {
+            classIndex--;
+        }
+        else
+        {
+            pool->freeList[classIndex - 1] = block->next;
+            pool->cachedBytes -= block->capacity;
+            pool->heldBytes -= block->capacity;
+            free(block);
+        }
+    }
+}
+
+static void releasePacketBuffer(MQTTCODEC_INSTANCE* codecData)
+{
+    if (codecData->packetBlock != NULL)
+    {
+        recv_pool_release(codecData->activePool, codecData->packetBlock);
+        codecData->packetBlock = NULL;
+    }
+    BUFFER_delete(codecData->headerData);
+    codecData->headerData = NULL;
+    codecData->packetBytes = NULL;
+}
+
+static int allocatePacketBuffer(MQTTCODEC_INSTANCE* codecData)
+{
+    int result;
+    if (codecData->packetView != NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_043: [If the codec was created with mqtt_codec_create_with_view and a packet has to be assembled, mqtt_codec_bytesReceived shall take the buffer from the receive buffer pool of the codec.] */
+        codecData->packetBlock = recv_pool_acquire(codecData->activePool, codecData->packetLength);
+        if (codecData->packetBlock == NULL)
+        {
+            /* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
+            result = MU_FAILURE;
+        }
+        else
+        {
+            codecData->packetBytes = (uint8_t*)(codecData->packetBlock + 1);
+            result = 0;
+        }
+    }
+    else if ((codecData->headerData = BUFFER_new()) == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
+        LogError("Failed BUFFER_new");
+        result = MU_FAILURE;
+    }
+    else if (BUFFER_pre_build(codecData->headerData, codecData->packetLength) != 0)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
+        LogError("Failed BUFFER_pre_build");
+        result = MU_FAILURE;
+    }
+    else if ((codecData->packetBytes = BUFFER_u_char(codecData->headerData)) == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
+        LogError("Failed BUFFER_u_char");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        result = 0;
+    }
+
+    if (result != 0 && codecData->headerData != NULL)
+    {
+        BUFFER_delete(codecData->headerData);
+        codecData->headerData = NULL;
+    }
+    return result;
+}
+
+static void completePacketData(MQTTCODEC_INSTANCE* codecData, const uint8_t* packetData)
 {
-    if (codecData->packetComplete != NULL)
+    if (codecData->packetView != NULL)
+    {
+        codecData->packetView(codecData->callContext, codecData->currPacket, codecData->headerFlags, packetData, codecData->packetLength);
+    }
+    else if (codecData->packetComplete != NULL)
     {
         codecData->packetComplete(codecData->callContext, codecData->currPacket, codecData->headerFlags, codecData->headerData);
     }
@@ -605,8 +885,10 @@ static void completePacketData(MQTTCODEC_INSTANCE* codecData)
     codecData->currPacket = UNKNOWN_TYPE;
     codecData->codecState = CODEC_STATE_FIXED_HEADER;
     codecData->headerFlags = 0;
-    BUFFER_delete(codecData->headerData);
-    codecData->headerData = NULL;
+    codecData->bufferOffset = 0;
+    codecData->packetLength = 0;
+    /* Codes_SRS_MQTT_CODEC_07_044: [Once the callback returns the receive buffer shall be returned to the pool if the idle buffers of the pool stay within the high water mark, otherwise it shall be freed.] */
+    releasePacketBuffer(codecData);
 }
 
 static void clear_codec_data(MQTTCODEC_INSTANCE* codec_data)
@@ -617,6 +899,9 @@ static void clear_codec_data(MQTTCODEC_INSTANCE* codec_data)
     codec_data->headerFlags = 0;
     codec_data->bufferOffset = 0;
     codec_data->headerData = NULL;
+    codec_data->packetBytes = NULL;
+    codec_data->packetBlock = NULL;
+    codec_data->packetLength = 0;
     memset(codec_data->storeRemainLen, 0, 4 * sizeof(uint8_t));
     codec_data->remainLenIndex = 0;
 }
@@ -625,6 +910,8 @@ void mqtt_codec_reset(MQTTCODEC_HANDLE handle)
 {
     if (handle != NULL)
     {
+        // Release any partially assembled packet before dropping the state
+        releasePacketBuffer(handle);
         clear_codec_data(handle);
     }
 }
@@ -638,7 +925,30 @@ MQTTCODEC_HANDLE mqtt_codec_create(ON_PACKET_COMPLETE_CALLBACK packetComplete, v
     {
         /* Codes_SRS_MQTT_CODEC_07_002: [On success mqtt_codec_create shall return a MQTTCODEC_HANDLE value.] */
         clear_codec_data(result);
+        memset(&result->recvPool, 0, sizeof(RECV_POOL));
+        result->recvPool.highWaterMark = DEFAULT_RECV_POOL_HIGH_WATER_MARK;
+        result->activePool = &result->recvPool;
         result->packetComplete = packetComplete;
+        result->packetView = NULL;
+        result->callContext = callbackCtx;
+    }
+    return result;
+}
+
+MQTTCODEC_HANDLE mqtt_codec_create_with_view(ON_PACKET_VIEW_CALLBACK packetView, void* callbackCtx)
+{
+    MQTTCODEC_HANDLE result;
+    result = malloc(sizeof(MQTTCODEC_INSTANCE));
+    /* Codes_SRS_MQTT_CODEC_07_040: [If a failure is encountered then mqtt_codec_create_with_view shall return NULL.] */
+    if (result != NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_041: [On success mqtt_codec_create_with_view shall return a MQTTCODEC_HANDLE value that reports complete packets through packetView.] */
+        clear_codec_data(result);
+        memset(&result->recvPool, 0, sizeof(RECV_POOL));
+        result->recvPool.highWaterMark = DEFAULT_RECV_POOL_HIGH_WATER_MARK;
+        result->activePool = &result->recvPool;
+        result->packetComplete = NULL;
+        result->packetView = packetView;
         result->callContext = callbackCtx;
     }
     return result;
@@ -651,51 +961,151 @@ void mqtt_codec_destroy(MQTTCODEC_HANDLE handle)
     {
         MQTTCODEC_INSTANCE* codecData = (MQTTCODEC_INSTANCE*)handle;
         /* Codes_SRS_MQTT_CODEC_07_004: [mqtt_codec_destroy shall deallocate all memory that has been allocated by this object.] */
-        BUFFER_delete(codecData->headerData);
+        releasePacketBuffer(codecData);
+        codecData->recvPool.highWaterMark = 0;
+        recv_pool_trim(&codecData->recvPool);
         free(codecData);
     }
 }
 
-BUFFER_HANDLE mqtt_codec_connect(const MQTT_CLIENT_OPTIONS* mqttOptions, STRING_HANDLE trace_log)
+int mqtt_codec_set_pool_high_water_mark(MQTTCODEC_HANDLE handle, size_t highWaterMark)
 {
-    BUFFER_HANDLE result;
-    /* Codes_SRS_MQTT_CODEC_07_008: [If the parameters mqttOptions is NULL then mqtt_codec_connect shall return a null value.] */
-    if (mqttOptions == NULL)
+    int result;
+    if (handle == NULL)
     {
-        result = NULL;
+        /* Codes_SRS_MQTT_CODEC_07_045: [If handle is NULL then mqtt_codec_set_pool_high_water_mark shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: NULL");
+        result = MU_FAILURE;
     }
     else
     {
-        /* Codes_SRS_MQTT_CODEC_07_009: [mqtt_codec_connect shall construct a BUFFER_HANDLE that represents a MQTT CONNECT packet.] */
-        result = BUFFER_new();
-        if (result != NULL)
-        {
-            STRING_HANDLE varible_header_log = NULL;
-            if (trace_log != NULL)
-            {
-                varible_header_log = STRING_new();
-            }
-            // Add Variable Header Information
-            if (constructConnectVariableHeader(result, mqttOptions, varible_header_log) != 0)
-            {
-                /* Codes_SRS_MQTT_CODEC_07_010: [If any error is encountered then mqtt_codec_connect shall return NULL.] */
-                BUFFER_delete(result);
-                result = NULL;
-            }
-            else
-            {
-                if (constructConnPayload(result, mqttOptions, varible_header_log) != 0)
-                {
-                    /* Codes_SRS_MQTT_CODEC_07_010: [If any error is encountered then mqtt_codec_connect shall return NULL.] */
-                    BUFFER_delete(result);
-                    result = NULL;
-                }
-                else
-                {
-                    if (trace_log != NULL)
-                    {
-                        (void)STRING_copy(trace_log, "CONNECT");
-                    }
+        /* Codes_SRS_MQTT_CODEC_07_046: [mqtt_codec_set_pool_high_water_mark shall store the maximum number of bytes of idle receive buffers the pool keeps and free any idle buffers above it.] */
+        handle->activePool->highWaterMark = highWaterMark;
+        recv_pool_trim(handle->activePool);
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_codec_get_pool_stats(MQTTCODEC_HANDLE handle, MQTT_CODEC_POOL_STATS* poolStats)
+{
+    int result;
+    if (handle == NULL || poolStats == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_047: [If handle or poolStats is NULL then mqtt_codec_get_pool_stats shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, poolStats: %p", handle, poolStats);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_048: [mqtt_codec_get_pool_stats shall report the number of pool hits and misses, the bytes of idle buffers and the peak number of bytes held by the pool.] */
+        poolStats->hits = handle->activePool->hits;
+        poolStats->misses = handle->activePool->misses;
+        poolStats->cachedBytes = handle->activePool->cachedBytes;
+        poolStats->peakBytes = handle->activePool->peakBytes;
+        result = 0;
+    }
+    return result;
+}
+
+MQTT_CODEC_RECV_POOL_HANDLE mqtt_codec_recv_pool_create(size_t highWaterMark)
+{
+    RECV_POOL* result = (RECV_POOL*)malloc(sizeof(RECV_POOL));
+    if (result == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_066: [If a failure is encountered then mqtt_codec_recv_pool_create shall return NULL.] */
+        LogError("Failure allocating receive buffer pool");
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_067: [mqtt_codec_recv_pool_create shall return an empty receive buffer pool that keeps up to highWaterMark bytes of idle buffers.] */
+        memset(result, 0, sizeof(RECV_POOL));
+        result->highWaterMark = highWaterMark;
+    }
+    return result;
+}
+
+void mqtt_codec_recv_pool_destroy(MQTT_CODEC_RECV_POOL_HANDLE pool)
+{
+    /* Codes_SRS_MQTT_CODEC_07_068: [If pool is NULL then mqtt_codec_recv_pool_destroy shall do nothing.] */
+    if (pool != NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_069: [mqtt_codec_recv_pool_destroy shall free every idle buffer of pool and pool itself.] */
+        pool->highWaterMark = 0;
+        recv_pool_trim(pool);
+        free(pool);
+    }
+}
+
+int mqtt_codec_set_recv_pool(MQTTCODEC_HANDLE handle, MQTT_CODEC_RECV_POOL_HANDLE pool)
+{
+    int result;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_070: [If handle is NULL then mqtt_codec_set_recv_pool shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: NULL");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        RECV_POOL* newPool = (pool == NULL) ? &handle->recvPool : pool;
+        if (handle->packetBlock != NULL && newPool != handle->activePool)
+        {
+            /* Codes_SRS_MQTT_CODEC_07_072: [The buffer of a packet that is being assembled shall move to the new pool with the codec.] */
+            handle->activePool->heldBytes -= handle->packetBlock->capacity;
+            newPool->heldBytes += handle->packetBlock->capacity;
+            if (newPool->heldBytes > newPool->peakBytes)
+            {
+                newPool->peakBytes = newPool->heldBytes;
+            }
+        }
+        /* Codes_SRS_MQTT_CODEC_07_071: [mqtt_codec_set_recv_pool shall take receive buffers from pool from then on, or from the pool of the codec if pool is NULL.] */
+        handle->activePool = newPool;
+        result = 0;
+    }
+    return result;
+}
+
+BUFFER_HANDLE mqtt_codec_connect(const MQTT_CLIENT_OPTIONS* mqttOptions, STRING_HANDLE trace_log)
+{
+    BUFFER_HANDLE result;
+    /* Codes_SRS_MQTT_CODEC_07_008: [If the parameters mqttOptions is NULL then mqtt_codec_connect shall return a null value.] */
+    if (mqttOptions == NULL)
+    {
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_009: [mqtt_codec_connect shall construct a BUFFER_HANDLE that represents a MQTT CONNECT packet.] */
+        result = BUFFER_new();
+        if (result != NULL)
+        {
+            STRING_HANDLE varible_header_log = NULL;
+            if (trace_log != NULL)
+            {
+                varible_header_log = STRING_new();
+            }
+            // Add Variable Header Information
+            if (constructConnectVariableHeader(result, mqttOptions, varible_header_log) != 0)
+            {
+                /* Codes_SRS_MQTT_CODEC_07_010: [If any error is encountered then mqtt_codec_connect shall return NULL.] */
+                BUFFER_delete(result);
+                result = NULL;
+            }
+            else
+            {
+                if (constructConnPayload(result, mqttOptions, varible_header_log) != 0)
+                {
+                    /* Codes_SRS_MQTT_CODEC_07_010: [If any error is encountered then mqtt_codec_connect shall return NULL.] */
+                    BUFFER_delete(result);
+                    result = NULL;
+                }
+                else
+                {
+                    if (trace_log != NULL)
+                    {
+                        (void)STRING_copy(trace_log, "CONNECT");
+                    }
                     if (constructFixedHeader(result, CONNECT_TYPE, 0) != 0)
                     {
                         /* Codes_SRS_MQTT_CODEC_07_010: [If any error is encountered then mqtt_codec_connect shall return NULL.] */
@@ -743,14 +1153,197 @@ BUFFER_HANDLE mqtt_codec_disconnect()
             }
             else
             {
-                iterator[0] = DISCONNECT_TYPE;
-                iterator[1] = 0;
+                writeEmptyPacket(DISCONNECT_TYPE, iterator);
             }
         }
     }
     return result;
 }
 
+static uint8_t getPublishHeaderFlags(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain)
+{
+    uint8_t headerFlags = 0;
+    if (duplicateMsg) headerFlags |= PUBLISH_DUP_FLAG;
+    if (serverRetain) headerFlags |= PUBLISH_QOS_RETAIN;
+    if (qosValue != DELIVER_AT_MOST_ONCE)
+    {
+        if (qosValue == DELIVER_AT_LEAST_ONCE)
+        {
+            headerFlags |= PUBLISH_QOS_AT_LEAST_ONCE;
+        }
+        else
+        {
+            headerFlags |= PUBLISH_QOS_EXACTLY_ONCE;
+        }
+    }
+    return headerFlags;
+}
+
+// Returns the number of bytes of the fixed and variable header of the PUBLISH packet, or 0 if the packet can not be encoded
+static size_t getPublishHeaderLength(const PUBLISH_HEADER_INFO* publishHeader, size_t buffLen, uint8_t remainSize[MAX_REMAINING_LENGTH_BYTES], size_t* remainSizeLen)
+{
+    size_t result;
+    size_t topicLen = publishHeader->topicLength;
+    if (topicLen > USHRT_MAX || buffLen > MAX_SEND_SIZE)
+    {
+        result = 0;
+    }
+    else
+    {
+        // Packet Id is only set if the QOS is not 0
+        size_t varHeaderLen = 2 + topicLen + (publishHeader->qualityOfServiceValue != DELIVER_AT_MOST_ONCE ? 2 : 0);
+        if (publishHeader->isV5)
+        {
+            varHeaderLen += 1 + (publishHeader->topicAlias != 0 ? TOPIC_ALIAS_PROPERTY_SIZE : 0);
+        }
+        *remainSizeLen = encodeRemainingLength(remainSize, varHeaderLen + buffLen);
+        result = (*remainSizeLen == 0) ? 0 : 1 + *remainSizeLen + varHeaderLen;
+    }
+    return result;
+}
+
+static void constructPublishHeader(uint8_t** iterator, const PUBLISH_HEADER_INFO* publishHeader, uint8_t headerFlags, const uint8_t* remainSize, size_t remainSizeLen, STRING_HANDLE trace_log)
+{
+    byteutil_writeByte(iterator, (uint8_t)PUBLISH_TYPE | headerFlags);
+    (void)memcpy(*iterator, remainSize, remainSizeLen);
+    *iterator += remainSizeLen;
+    constructPublishVariableHeader(iterator, publishHeader, trace_log);
+}
+
+static STRING_HANDLE construct_publish_trace_log(STRING_HANDLE trace_log, QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain)
+{
+    STRING_HANDLE result = NULL;
+    if (trace_log != NULL)
+    {
+        result = STRING_construct_sprintf(" | IS_DUP: %s | RETAIN: %d | QOS: %s", duplicateMsg ? TRUE_CONST : FALSE_CONST,
+            serverRetain ? 1 : 0,
+            retrieve_qos_value(qosValue) );
+    }
+    return result;
+}
+
+static void complete_publish_trace_log(STRING_HANDLE trace_log, STRING_HANDLE varible_header_log, size_t buffLen)
+{
+    if (trace_log != NULL)
+    {
+        if (buffLen > 0)
+        {
+            STRING_sprintf(varible_header_log, " | PAYLOAD_LEN: %lu", (unsigned long)buffLen);
+        }
+        (void)STRING_copy(trace_log, "PUBLISH");
+        (void)STRING_concat_with_STRING(trace_log, varible_header_log);
+    }
+    if (varible_header_log != NULL)
+    {
+        STRING_delete(varible_header_log);
+    }
+}
+
+// Fills publishInfo from a topic name that starts with its own two byte length, returns false if the prefix does not match encodedTopicLen
+static bool setEncodedTopic(PUBLISH_HEADER_INFO* publishInfo, const uint8_t* encodedTopic, size_t encodedTopicLen)
+{
+    bool result;
+    if (encodedTopic == NULL || encodedTopicLen < 2 || (((size_t)encodedTopic[0] << 8) | encodedTopic[1]) != encodedTopicLen - 2)
+    {
+        result = false;
+    }
+    else
+    {
+        publishInfo->topicName = (const char*)(encodedTopic + 2);
+        publishInfo->topicLength = encodedTopicLen - 2;
+        publishInfo->encodedTopic = encodedTopic;
+        result = true;
+    }
+    return result;
+}
+
+static BUFFER_HANDLE encodePublish(const PUBLISH_HEADER_INFO* publishInfo, bool duplicateMsg, bool serverRetain, const uint8_t* msgBuffer, size_t buffLen, STRING_HANDLE trace_log)
+{
+    BUFFER_HANDLE result;
+    QOS_VALUE qosValue = publishInfo->qualityOfServiceValue;
+    uint8_t remainSize[MAX_REMAINING_LENGTH_BYTES] ={ 0 };
+    size_t remainSizeLen = 0;
+    size_t headerLen = getPublishHeaderLength(publishInfo, buffLen, remainSize, &remainSizeLen);
+
+    if (headerLen == 0)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
+        LogError("Failure: PUBLISH packet is too large");
+        result = NULL;
+    }
+    /* Codes_SRS_MQTT_CODEC_07_007: [mqtt_codec_publish shall return a BUFFER_HANDLE that represents a MQTT PUBLISH message.] */
+    else if ((result = BUFFER_new()) == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
+        LogError("Failure creating PUBLISH buffer");
+    }
+    /* Codes_SRS_MQTT_CODEC_07_049: [mqtt_codec_publish shall compute the Remaining Length first and allocate the exact size of the PUBLISH packet once.] */
+    else if (BUFFER_pre_build(result, headerLen + buffLen) != 0)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
+        LogError("Failure allocating PUBLISH packet");
+        BUFFER_delete(result);
+        result = NULL;
+    }
+    else
+    {
+        uint8_t* iterator = BUFFER_u_char(result);
+        if (iterator == NULL)
+        {
+            /* Codes_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
+            LogError("Failure retrieving PUBLISH buffer");
+            BUFFER_delete(result);
+            result = NULL;
+        }
+        else
+        {
+            STRING_HANDLE varible_header_log = construct_publish_trace_log(trace_log, qosValue, duplicateMsg, serverRetain);
+
+            /* Codes_SRS_MQTT_CODEC_07_050: [mqtt_codec_publish shall write the fixed header, topic name, packet id and payload into the packet in a single pass.] */
+            constructPublishHeader(&iterator, publishInfo, getPublishHeaderFlags(qosValue, duplicateMsg, serverRetain), remainSize, remainSizeLen, varible_header_log);
+            if (buffLen > 0)
+            {
+                // Write Message
+                (void)memcpy(iterator, msgBuffer, buffLen);
+            }
+            complete_publish_trace_log(trace_log, varible_header_log, buffLen);
+        }
+    }
+    return result;
+}
+
+static int encodePublishHeader(const PUBLISH_HEADER_INFO* publishInfo, bool duplicateMsg, bool serverRetain, size_t payloadLen, uint8_t* headerBuffer, size_t* headerLength, STRING_HANDLE trace_log)
+{
+    int result;
+    QOS_VALUE qosValue = publishInfo->qualityOfServiceValue;
+    uint8_t remainSize[MAX_REMAINING_LENGTH_BYTES] ={ 0 };
+    size_t remainSizeLen = 0;
+    size_t headerLen = getPublishHeaderLength(publishInfo, payloadLen, remainSize, &remainSizeLen);
+    if (headerLen == 0)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_052: [If the PUBLISH packet can not be encoded then mqtt_codec_publish_header shall return a non-zero value.] */
+        LogError("Failure: PUBLISH packet is too large");
+        result = MU_FAILURE;
+    }
+    else if (headerBuffer == NULL || *headerLength < headerLen)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_053: [If headerBuffer is NULL or headerLength is smaller than the header then mqtt_codec_publish_header shall set headerLength to the required size and return a non-zero value.] */
+        *headerLength = headerLen;
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_054: [mqtt_codec_publish_header shall write the fixed header, topic name and packet id of a PUBLISH packet carrying payloadLen bytes into headerBuffer, set headerLength to the number of bytes written and return zero.] */
+        STRING_HANDLE varible_header_log = construct_publish_trace_log(trace_log, qosValue, duplicateMsg, serverRetain);
+        uint8_t* iterator = headerBuffer;
+        constructPublishHeader(&iterator, publishInfo, getPublishHeaderFlags(qosValue, duplicateMsg, serverRetain), remainSize, remainSizeLen, varible_header_log);
+        complete_publish_trace_log(trace_log, varible_header_log, payloadLen);
+        *headerLength = headerLen;
+        result = 0;
+    }
+    return result;
+}
+
 BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, const uint8_t* msgBuffer, size_t buffLen, STRING_HANDLE trace_log)
 {
     BUFFER_HANDLE result;
@@ -769,101 +1362,135 @@ BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool ser
     {
         PUBLISH_HEADER_INFO publishInfo ={ 0 };
         publishInfo.topicName = topicName;
+        publishInfo.topicLength = strlen(topicName);
         publishInfo.packetId = packetId;
         publishInfo.qualityOfServiceValue = qosValue;
+        result = encodePublish(&publishInfo, duplicateMsg, serverRetain, msgBuffer, buffLen, trace_log);
+    }
+    return result;
+}
 
-        uint8_t headerFlags = 0;
-        if (duplicateMsg) headerFlags |= PUBLISH_DUP_FLAG;
-        if (serverRetain) headerFlags |= PUBLISH_QOS_RETAIN;
-        if (qosValue != DELIVER_AT_MOST_ONCE)
-        {
-            if (qosValue == DELIVER_AT_LEAST_ONCE)
-            {
-                headerFlags |= PUBLISH_QOS_AT_LEAST_ONCE;
-            }
-            else
-            {
-                headerFlags |= PUBLISH_QOS_EXACTLY_ONCE;
-            }
-        }
+BUFFER_HANDLE mqtt_codec_publish_encoded_topic(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const uint8_t* encodedTopic, size_t encodedTopicLen, const uint8_t* msgBuffer, size_t buffLen, STRING_HANDLE trace_log)
+{
+    BUFFER_HANDLE result;
+    PUBLISH_HEADER_INFO publishInfo ={ 0 };
+    if (!setEncodedTopic(&publishInfo, encodedTopic, encodedTopicLen))
+    {
+        /* Codes_SRS_MQTT_CODEC_07_055: [If encodedTopic is NULL or does not start with its length as two bytes most significant first then mqtt_codec_publish_encoded_topic shall return NULL.] */
+        LogError("Invalid parameter specified encodedTopic: %p, encodedTopicLen: %lu", encodedTopic, (unsigned long)encodedTopicLen);
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_056: [mqtt_codec_publish_encoded_topic shall copy encodedTopic into the PUBLISH packet as its topic name and otherwise encode the packet like mqtt_codec_publish.] */
+        publishInfo.packetId = packetId;
+        publishInfo.qualityOfServiceValue = qosValue;
+        result = encodePublish(&publishInfo, duplicateMsg, serverRetain, msgBuffer, buffLen, trace_log);
+    }
+    return result;
+}
 
-        /* Codes_SRS_MQTT_CODEC_07_007: [mqtt_codec_publish shall return a BUFFER_HANDLE that represents a MQTT PUBLISH message.] */
-        result = BUFFER_new();
-        if (result != NULL)
-        {
-            STRING_HANDLE varible_header_log = NULL;
-            if (trace_log != NULL)
-            {
-                varible_header_log = STRING_construct_sprintf(" | IS_DUP: %s | RETAIN: %d | QOS: %s", duplicateMsg ? TRUE_CONST : FALSE_CONST,
-                    serverRetain ? 1 : 0,
-                    retrieve_qos_value(publishInfo.qualityOfServiceValue) );
-            }
+int mqtt_codec_publish_header(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, size_t payloadLen, uint8_t* headerBuffer, size_t* headerLength, STRING_HANDLE trace_log)
+{
+    int result;
+    /* Codes_SRS_MQTT_CODEC_07_051: [If the parameters topicName or headerLength is NULL then mqtt_codec_publish_header shall return a non-zero value.] */
+    if (topicName == NULL || headerLength == NULL)
+    {
+        LogError("Invalid parameter specified topicName: %p, headerLength: %p", topicName, headerLength);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        PUBLISH_HEADER_INFO publishInfo ={ 0 };
+        publishInfo.topicName = topicName;
+        publishInfo.topicLength = strlen(topicName);
+        publishInfo.packetId = packetId;
+        publishInfo.qualityOfServiceValue = qosValue;
+        result = encodePublishHeader(&publishInfo, duplicateMsg, serverRetain, payloadLen, headerBuffer, headerLength, trace_log);
+    }
+    return result;
+}
 
-            if (constructPublishVariableHeader(result, &publishInfo, varible_header_log) != 0)
-            {
-                /* Codes_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
-                BUFFER_delete(result);
-                result = NULL;
-            }
-            else
-            {
-                size_t payloadOffset = BUFFER_length(result);
-                if (buffLen > 0)
-                {
-                    if (BUFFER_enlarge(result, buffLen) != 0)
-                    {
-                        /* Codes_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
-                        BUFFER_delete(result);
-                        result = NULL;
-                    }
-                    else
-                    {
-                        uint8_t* iterator = BUFFER_u_char(result);
-                        if (iterator == NULL)
-                        {
-                            /* Codes_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
-                            BUFFER_delete(result);
-                            result = NULL;
-                        }
-                        else
-                        {
-                            iterator += payloadOffset;
-                            // Write Message
-                            (void)memcpy(iterator, msgBuffer, buffLen);
-                            if (trace_log)
-                            {
-                                STRING_sprintf(varible_header_log, " | PAYLOAD_LEN: %lu", (unsigned long)buffLen);
-                            }
-                        }
-                    }
-                }
+int mqtt_codec_publish_header_encoded_topic(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const uint8_t* encodedTopic, size_t encodedTopicLen, size_t payloadLen, uint8_t* headerBuffer, size_t* headerLength, STRING_HANDLE trace_log)
+{
+    int result;
+    PUBLISH_HEADER_INFO publishInfo ={ 0 };
+    if (headerLength == NULL || !setEncodedTopic(&publishInfo, encodedTopic, encodedTopicLen))
+    {
+        /* Codes_SRS_MQTT_CODEC_07_057: [If headerLength is NULL, or encodedTopic is NULL or does not start with its length as two bytes most significant first then mqtt_codec_publish_header_encoded_topic shall return a non-zero value.] */
+        LogError("Invalid parameter specified encodedTopic: %p, encodedTopicLen: %lu, headerLength: %p", encodedTopic, (unsigned long)encodedTopicLen, headerLength);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_058: [mqtt_codec_publish_header_encoded_topic shall copy encodedTopic into the header as its topic name and otherwise encode the header like mqtt_codec_publish_header.] */
+        publishInfo.packetId = packetId;
+        publishInfo.qualityOfServiceValue = qosValue;
+        result = encodePublishHeader(&publishInfo, duplicateMsg, serverRetain, payloadLen, headerBuffer, headerLength, trace_log);
+    }
+    return result;
+}
 
-                if (result != NULL)
-                {
-                    if (trace_log != NULL)
-                    {
-                        (void)STRING_copy(trace_log, "PUBLISH");
-                    }
-                    if (constructFixedHeader(result, PUBLISH_TYPE, headerFlags) != 0)
-                    {
-                        /* Codes_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
-                        BUFFER_delete(result);
-                        result = NULL;
-                    }
-                    else
-                    {
-                        if (trace_log != NULL)
-                        {
-                            (void)STRING_concat_with_STRING(trace_log, varible_header_log);
-                        }
-                    }
-                }
-            }
-            if (varible_header_log != NULL)
-            {
-                STRING_delete(varible_header_log);
-            }
-        }
+// Fills publishInfo for an MQTT 5 PUBLISH, returns false if neither a topic name nor a topic alias is given
+static bool setTopicV5(PUBLISH_HEADER_INFO* publishInfo, const char* topicName, size_t topicNameLength, uint16_t topicAlias)
+{
+    bool result;
+    if ((topicName == NULL && topicNameLength != 0) || (topicNameLength == 0 && topicAlias == 0))
+    {
+        result = false;
+    }
+    else
+    {
+        // Once the alias is known to the server the topic name is sent empty
+        publishInfo->topicName = topicName == NULL ? "" : topicName;
+        publishInfo->topicLength = topicNameLength;
+        publishInfo->isV5 = true;
+        publishInfo->topicAlias = topicAlias;
+        result = true;
+    }
+    return result;
+}
+
+BUFFER_HANDLE mqtt_codec_publish_v5(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, size_t topicNameLength, uint16_t topicAlias, const uint8_t* msgBuffer, size_t buffLen, STRING_HANDLE trace_log)
+{
+    BUFFER_HANDLE result;
+    PUBLISH_HEADER_INFO publishInfo ={ 0 };
+    if (!setTopicV5(&publishInfo, topicName, topicNameLength, topicAlias))
+    {
+        /* Codes_SRS_MQTT_CODEC_07_060: [If topicName is NULL while topicNameLength is not zero, or topicNameLength is zero while topicAlias is zero, then mqtt_codec_publish_v5 shall return NULL.] */
+        LogError("Invalid parameter specified topicName: %p, topicNameLength: %lu, topicAlias: %"PRIu16, topicName, (unsigned long)topicNameLength, topicAlias);
+        result = NULL;
+    }
+    else if (buffLen > MAX_SEND_SIZE)
+    {
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_061: [mqtt_codec_publish_v5 shall encode the packet like mqtt_codec_publish followed by a property block after the packet id that holds the topic alias when topicAlias is not zero.] */
+        publishInfo.packetId = packetId;
+        publishInfo.qualityOfServiceValue = qosValue;
+        result = encodePublish(&publishInfo, duplicateMsg, serverRetain, msgBuffer, buffLen, trace_log);
+    }
+    return result;
+}
+
+int mqtt_codec_publish_header_v5(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, size_t topicNameLength, uint16_t topicAlias, size_t payloadLen, uint8_t* headerBuffer, size_t* headerLength, STRING_HANDLE trace_log)
+{
+    int result;
+    PUBLISH_HEADER_INFO publishInfo ={ 0 };
+    if (headerLength == NULL || !setTopicV5(&publishInfo, topicName, topicNameLength, topicAlias))
+    {
+        /* Codes_SRS_MQTT_CODEC_07_062: [If headerLength is NULL, topicName is NULL while topicNameLength is not zero, or topicNameLength is zero while topicAlias is zero, then mqtt_codec_publish_header_v5 shall return a non-zero value.] */
+        LogError("Invalid parameter specified topicName: %p, topicNameLength: %lu, topicAlias: %"PRIu16", headerLength: %p", topicName, (unsigned long)topicNameLength, topicAlias, headerLength);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_063: [mqtt_codec_publish_header_v5 shall encode the header like mqtt_codec_publish_header with the property block of mqtt_codec_publish_v5.] */
+        publishInfo.packetId = packetId;
+        publishInfo.qualityOfServiceValue = qosValue;
+        result = encodePublishHeader(&publishInfo, duplicateMsg, serverRetain, payloadLen, headerBuffer, headerLength, trace_log);
     }
     return result;
 }
@@ -923,15 +1550,80 @@ BUFFER_HANDLE mqtt_codec_ping()
             }
             else
             {
-                iterator[0] = PINGREQ_TYPE;
-                iterator[1] = 0;
+                writeEmptyPacket(PINGREQ_TYPE, iterator);
             }
         }
     }
     return result;
 }
 
-BUFFER_HANDLE mqtt_codec_subscribe(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count, STRING_HANDLE trace_log)
+static int encodePublishReply(CONTROL_PACKET_TYPE type, uint8_t flags, uint16_t packetId, uint8_t* packet)
+{
+    int result;
+    if (packet == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_073: [ If packet is NULL then mqtt_codec_encode_puback, mqtt_codec_encode_pubrec, mqtt_codec_encode_pubrel and mqtt_codec_encode_pubcomp shall return a non-zero value. ] */
+        LogError("Invalid parameter specified packet: NULL");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_074: [ mqtt_codec_encode_puback, mqtt_codec_encode_pubrec, mqtt_codec_encode_pubrel and mqtt_codec_encode_pubcomp shall write the MQTT_CODEC_PUBLISH_REPLY_SIZE bytes of the PUBACK, PUBREC, PUBREL or PUBCOMP packet for packetId into packet without allocating and return 0. ] */
+        writePublishReply(type, flags, packetId, packet);
+        result = 0;
+    }
+    return result;
+}
+
+static int encodeEmptyPacket(CONTROL_PACKET_TYPE type, uint8_t* packet)
+{
+    int result;
+    if (packet == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_075: [ If packet is NULL then mqtt_codec_encode_pingreq and mqtt_codec_encode_disconnect shall return a non-zero value. ] */
+        LogError("Invalid parameter specified packet: NULL");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_076: [ mqtt_codec_encode_pingreq and mqtt_codec_encode_disconnect shall write the MQTT_CODEC_EMPTY_PACKET_SIZE bytes of the PINGREQ or DISCONNECT packet into packet without allocating and return 0. ] */
+        writeEmptyPacket(type, packet);
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_codec_encode_puback(uint16_t packetId, uint8_t* packet)
+{
+    return encodePublishReply(PUBACK_TYPE, 0, packetId, packet);
+}
+
+int mqtt_codec_encode_pubrec(uint16_t packetId, uint8_t* packet)
+{
+    return encodePublishReply(PUBREC_TYPE, 0, packetId, packet);
+}
+
+int mqtt_codec_encode_pubrel(uint16_t packetId, uint8_t* packet)
+{
+    return encodePublishReply(PUBREL_TYPE, 2, packetId, packet);
+}
+
+int mqtt_codec_encode_pubcomp(uint16_t packetId, uint8_t* packet)
+{
+    return encodePublishReply(PUBCOMP_TYPE, 0, packetId, packet);
+}
+
+int mqtt_codec_encode_pingreq(uint8_t* packet)
+{
+    return encodeEmptyPacket(PINGREQ_TYPE, packet);
+}
+
+int mqtt_codec_encode_disconnect(uint8_t* packet)
+{
+    return encodeEmptyPacket(DISCONNECT_TYPE, packet);
+}
+
+static BUFFER_HANDLE encodeSubscribe(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count, bool isV5, STRING_HANDLE trace_log)
 {
     BUFFER_HANDLE result;
     /* Codes_SRS_MQTT_CODEC_07_023: [If the parameters subscribeList is NULL or if count is 0 then mqtt_codec_subscribe shall return NULL.] */
@@ -945,7 +1637,7 @@ BUFFER_HANDLE mqtt_codec_subscribe(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscri
         result = BUFFER_new();
         if (result != NULL)
         {
-            if (constructSubscibeTypeVariableHeader(result, packetId) != 0)
+            if (constructSubscibeTypeVariableHeader(result, packetId, isV5) != 0)
             {
                 /* Codes_SRS_MQTT_CODEC_07_025: [If any error is encountered then mqtt_codec_subscribe shall return NULL.] */
                 BUFFER_delete(result);
@@ -996,7 +1688,18 @@ BUFFER_HANDLE mqtt_codec_subscribe(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscri
     return result;
 }
 
-BUFFER_HANDLE mqtt_codec_unsubscribe(uint16_t packetId, const char** unsubscribeList, size_t count, STRING_HANDLE trace_log)
+BUFFER_HANDLE mqtt_codec_subscribe(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count, STRING_HANDLE trace_log)
+{
+    return encodeSubscribe(packetId, subscribeList, count, false, trace_log);
+}
+
+BUFFER_HANDLE mqtt_codec_subscribe_v5(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count, STRING_HANDLE trace_log)
+{
+    /* Codes_SRS_MQTT_CODEC_07_064: [mqtt_codec_subscribe_v5 shall encode the packet like mqtt_codec_subscribe with an empty property block after the packet id.] */
+    return encodeSubscribe(packetId, subscribeList, count, true, trace_log);
+}
+
+static BUFFER_HANDLE encodeUnsubscribe(uint16_t packetId, const char** unsubscribeList, size_t count, bool isV5, STRING_HANDLE trace_log)
 {
     BUFFER_HANDLE result;
     /* Codes_SRS_MQTT_CODEC_07_027: [If the parameters unsubscribeList is NULL or if count is 0 then mqtt_codec_unsubscribe shall return NULL.] */
@@ -1010,7 +1713,7 @@ BUFFER_HANDLE mqtt_codec_unsubscribe(uint16_t packetId, const char** unsubscribe
         result = BUFFER_new();
         if (result != NULL)
         {
-            if (constructSubscibeTypeVariableHeader(result, packetId) != 0)
+            if (constructSubscibeTypeVariableHeader(result, packetId, isV5) != 0)
             {
                 /* Codes_SRS_MQTT_CODEC_07_029: [If any error is encountered then mqtt_codec_unsubscribe shall return NULL.] */
                 BUFFER_delete(result);
@@ -1060,6 +1763,17 @@ BUFFER_HANDLE mqtt_codec_unsubscribe(uint16_t packetId, const char** unsubscribe
     return result;
 }
 
+BUFFER_HANDLE mqtt_codec_unsubscribe(uint16_t packetId, const char** unsubscribeList, size_t count, STRING_HANDLE trace_log)
+{
+    return encodeUnsubscribe(packetId, unsubscribeList, count, false, trace_log);
+}
+
+BUFFER_HANDLE mqtt_codec_unsubscribe_v5(uint16_t packetId, const char** unsubscribeList, size_t count, STRING_HANDLE trace_log)
+{
+    /* Codes_SRS_MQTT_CODEC_07_065: [mqtt_codec_unsubscribe_v5 shall encode the packet like mqtt_codec_unsubscribe with an empty property block after the packet id.] */
+    return encodeUnsubscribe(packetId, unsubscribeList, count, true, trace_log);
+}
+
 int mqtt_codec_bytesReceived(MQTTCODEC_HANDLE handle, const unsigned char* buffer, size_t size)
 {
     int result;
@@ -1081,11 +1795,11 @@ int mqtt_codec_bytesReceived(MQTTCODEC_HANDLE handle, const unsigned char* buffe
         /* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
         result = 0;
         size_t index = 0;
-        for (index = 0; index < size && result == 0; index++)
+        while (index < size && result == 0)
         {
-            uint8_t iterator = ((int8_t*)buffer)[index];
             if (codec_Data->codecState == CODEC_STATE_FIXED_HEADER)
             {
+                uint8_t iterator = buffer[index++];
                 if (codec_Data->currPacket == UNKNOWN_TYPE)
                 {
                     codec_Data->currPacket = processControlPacketType(iterator, &codec_Data->headerFlags);
@@ -1144,10 +1858,10 @@ int mqtt_codec_bytesReceived(MQTTCODEC_HANDLE handle, const unsigned char* buffe
                     else if (codec_Data->currPacket == PINGRESP_TYPE)
                     {
                         // PINGRESP must not have a payload
-                        if (((int8_t*)buffer)[index] == 0)
+                        if (iterator == 0)
                         {
                             /* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-                            completePacketData(codec_Data);
+                            completePacketData(codec_Data, NULL);
                         }
                         else
                         {
@@ -1155,35 +1869,43 @@ int mqtt_codec_bytesReceived(MQTTCODEC_HANDLE handle, const unsigned char* buffe
                             result = MU_FAILURE;
                         }
                     }
+                    else if (codec_Data->codecState == CODEC_STATE_VAR_HEADER && codec_Data->packetLength == 0)
+                    {
+                        /* Codes_SRS_MQTT_CODEC_07_039: [If the Remaining Length of a packet is zero then mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function with a NULL headerData as soon as the Remaining Length has been decoded.] */
+                        completePacketData(codec_Data, NULL);
+                    }
                 }
             }
             else if (codec_Data->codecState == CODEC_STATE_VAR_HEADER)
             {
-                if (codec_Data->headerData == NULL)
+                size_t available = size - index;
+                if (codec_Data->packetBytes == NULL && codec_Data->packetView != NULL && available >= codec_Data->packetLength)
                 {
-                    codec_Data->codecState = CODEC_STATE_PAYLOAD;
+                    /* Codes_SRS_MQTT_CODEC_07_042: [If the complete packet is contained in buffer mqtt_codec_bytesReceived shall call the ON_PACKET_VIEW_CALLBACK function with a pointer into buffer without copying the packet.] */
+                    const uint8_t* packetData = buffer + index;
+                    index += codec_Data->packetLength;
+                    completePacketData(codec_Data, packetData);
+                }
+                else if (codec_Data->packetBytes == NULL && allocatePacketBuffer(codec_Data) != 0)
+                {
+                    /* Codes_SRS_MQTT_CODEC_07_035: [If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value.] */
+                    codec_Data->currPacket = PACKET_TYPE_ERROR;
+                    result = MU_FAILURE;
                 }
                 else
                 {
-                    uint8_t* dataBytes = BUFFER_u_char(codec_Data->headerData);
-                    if (dataBytes == NULL)
-                    {
-                        /* Codes_SRS_MQTT_CODEC_07_035: [If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value.] */
-                        codec_Data->currPacket = PACKET_TYPE_ERROR;
-                        result = MU_FAILURE;
-                    }
-                    else
-                    {
-                        // Increment the data
-                        dataBytes += codec_Data->bufferOffset++;
-                        *dataBytes = iterator;
+                    /* Codes_SRS_MQTT_CODEC_07_038: [mqtt_codec_bytesReceived shall copy as many bytes of the variable header and payload as are available in buffer in a single operation, up to the Remaining Length of the packet.] */
+                    size_t needed = codec_Data->packetLength - codec_Data->bufferOffset;
+                    size_t copyLen = (available < needed) ? available : needed;
 
-                        size_t totalLen = BUFFER_length(codec_Data->headerData);
-                        if (codec_Data->bufferOffset >= totalLen)
-                        {
-                            /* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-                            completePacketData(codec_Data);
-                        }
+                    (void)memcpy(codec_Data->packetBytes + codec_Data->bufferOffset, buffer + index, copyLen);
+                    codec_Data->bufferOffset += copyLen;
+                    index += copyLen;
+
+                    if (codec_Data->bufferOffset >= codec_Data->packetLength)
+                    {
+                        /* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+                        completePacketData(codec_Data, codec_Data->packetBytes);
                     }
                 }
             }
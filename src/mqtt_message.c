@@ -2,6 +2,7 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <stdlib.h>
+#include <string.h>
 #include "azure_umqtt_c/mqtt_message.h"
 #include "azure_c_shared_utility/optimize_size.h"
 #include "azure_c_shared_utility/gballoc.h"
@@ -16,8 +17,11 @@ typedef struct MQTT_MESSAGE_TAG
 
     char* topicName;
     APP_PAYLOAD appPayload;
+    MQTT_TOPIC_HANDLE internedTopic;
 
     const char* const_topic_name;
+    size_t const_topic_name_length;
+    bool is_topic_name_terminated;
     APP_PAYLOAD const_payload;
 
     bool isDuplicateMsg;
@@ -32,6 +36,7 @@ static MQTT_MESSAGE* create_msg_object(uint16_t packetId, QOS_VALUE qosValue)
     {
         memset(result, 0, sizeof(MQTT_MESSAGE));
         result->packetId = packetId;
+        result->is_topic_name_terminated = true;
         result->isDuplicateMsg = false;
         result->isMessageRetained = false;
         result->qosInfo = qosValue;
@@ -64,6 +69,7 @@ MQTT_MESSAGE_HANDLE mqttmessage_create_in_place(uint16_t packetId, const char* t
         {
             /* Codes_SRS_MQTTMESSAGE_07_027: [mqttmessage_create_in_place shall use the a pointer to topicName or appMsg .] */
             result->const_topic_name = topicName;
+            result->const_topic_name_length = strlen(topicName);
             result->const_payload.length = appMsgLength;
             if (result->const_payload.length > 0)
             {
@@ -75,6 +81,97 @@ MQTT_MESSAGE_HANDLE mqttmessage_create_in_place(uint16_t packetId, const char* t
     return (MQTT_MESSAGE_HANDLE)result;
 }
 
+MQTT_MESSAGE_HANDLE mqttmessage_create_in_place_n(uint16_t packetId, const char* topicName, size_t topicNameLength, QOS_VALUE qosValue, const uint8_t* appMsg, size_t appMsgLength)
+{
+    MQTT_MESSAGE* result;
+    if (topicName == NULL)
+    {
+        /* Codes_SRS_MQTTMESSAGE_07_030: [If the parameter topicName is NULL then mqttmessage_create_in_place_n shall return NULL.] */
+        LogError("Invalid Parameter topicName: %p, packetId: %d.", topicName, packetId);
+        result = NULL;
+    }
+    else
+    {
+        result = create_msg_object(packetId, qosValue);
+        if (result == NULL)
+        {
+            /* Codes_SRS_MQTTMESSAGE_07_032: [If any memory allocation fails mqttmessage_create_in_place_n shall return NULL.] */
+            LogError("Failure creating message object");
+        }
+        else
+        {
+            /* Codes_SRS_MQTTMESSAGE_07_031: [mqttmessage_create_in_place_n shall keep a pointer to topicName and appMsg without copying them, the topicName does not need to be NULL terminated.] */
+            result->const_topic_name = topicName;
+            result->const_topic_name_length = topicNameLength;
+            result->is_topic_name_terminated = false;
+            result->const_payload.length = appMsgLength;
+            if (result->const_payload.length > 0)
+            {
+                result->const_payload.message = (uint8_t*)appMsg;
+            }
+        }
+    }
+    return (MQTT_MESSAGE_HANDLE)result;
+}
+
+MQTT_MESSAGE_HANDLE mqttmessage_create_with_topic(uint16_t packetId, MQTT_TOPIC_HANDLE topic, QOS_VALUE qosValue, const uint8_t* appMsg, size_t appMsgLength)
+{
+    MQTT_MESSAGE* result;
+    const char* topicName;
+    size_t topicNameLength;
+    if (topic == NULL || (topicName = mqtt_topic_get_name(topic, &topicNameLength)) == NULL)
+    {
+        /* Codes_SRS_MQTTMESSAGE_07_042: [If topic is NULL then mqttmessage_create_with_topic shall return NULL.] */
+        LogError("Invalid Parameter topic: %p, packetId: %d.", topic, packetId);
+        result = NULL;
+    }
+    else if ((result = create_msg_object(packetId, qosValue)) == NULL)
+    {
+        /* Codes_SRS_MQTTMESSAGE_07_044: [If any memory allocation fails mqttmessage_create_with_topic shall return NULL.] */
+        LogError("Failure creating message object");
+    }
+    else
+    {
+        /* Codes_SRS_MQTTMESSAGE_07_043: [mqttmessage_create_with_topic shall keep topic and a pointer to appMsg without copying the topic name or appMsg.] */
+        result->internedTopic = topic;
+        result->const_topic_name = topicName;
+        result->const_topic_name_length = topicNameLength;
+        result->const_payload.length = appMsgLength;
+        if (result->const_payload.length > 0)
+        {
+            result->const_payload.message = (uint8_t*)appMsg;
+        }
+    }
+    return (MQTT_MESSAGE_HANDLE)result;
+}
+
+// Clones a message on an interned topic, only the payload is copied
+static MQTT_MESSAGE* clone_with_topic(MQTT_MESSAGE_HANDLE handle, const APP_PAYLOAD* payload)
+{
+    MQTT_MESSAGE* result = create_msg_object(handle->packetId, handle->qosInfo);
+    if (result != NULL)
+    {
+        result->internedTopic = handle->internedTopic;
+        result->const_topic_name = handle->const_topic_name;
+        result->const_topic_name_length = handle->const_topic_name_length;
+        result->appPayload.length = payload->length;
+        if (payload->length > 0)
+        {
+            if ((result->appPayload.message = (uint8_t*)malloc(payload->length)) == NULL)
+            {
+                LogError("Failure allocating message value of %lu", (unsigned long)payload->length);
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                (void)memcpy(result->appPayload.message, payload->message, payload->length);
+            }
+        }
+    }
+    return result;
+}
+
 MQTT_MESSAGE_HANDLE mqttmessage_create(uint16_t packetId, const char* topicName, QOS_VALUE qosValue, const uint8_t* appMsg, size_t appMsgLength)
 {
     /* Codes_SRS_MQTTMESSAGE_07_001:[If the parameters topicName is NULL is zero then mqttmessage_create shall return NULL.] */
@@ -163,7 +260,16 @@ MQTT_MESSAGE_HANDLE mqttmessage_clone(MQTT_MESSAGE_HANDLE handle)
     else
     {
         /* Codes_SRS_MQTTMESSAGE_07_008: [mqttmessage_clone shall create a new MQTT_MESSAGE_HANDLE with data content identical of the handle value.] */
-        result = mqttmessage_create(handle->packetId, handle->topicName, handle->qosInfo, handle->appPayload.message, handle->appPayload.length);
+        const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(handle);
+        if (handle->internedTopic != NULL)
+        {
+            /* Codes_SRS_MQTTMESSAGE_07_045: [If handle was created with mqttmessage_create_with_topic then mqttmessage_clone shall keep the same topic instead of copying the topic name.] */
+            result = clone_with_topic(handle, payload);
+        }
+        else
+        {
+            result = mqttmessage_create(handle->packetId, mqttmessage_getTopicName(handle), handle->qosInfo, payload->message, payload->length);
+        }
         if (result != NULL)
         {
             result->isDuplicateMsg = handle->isDuplicateMsg;
@@ -204,7 +310,23 @@ const char* mqttmessage_getTopicName(MQTT_MESSAGE_HANDLE handle)
         /* Codes_SRS_MQTTMESSAGE_07_013: [mqttmessage_getTopicName shall return the topicName contained in MQTT_MESSAGE_HANDLE handle.] */
         if (handle->topicName == NULL)
         {
-            result = handle->const_topic_name;
+            if (handle->is_topic_name_terminated || handle->const_topic_name == NULL)
+            {
+                result = handle->const_topic_name;
+            }
+            /* Codes_SRS_MQTTMESSAGE_07_033: [If the topic name is not NULL terminated mqttmessage_getTopicName shall allocate a NULL terminated copy of it that is freed by mqttmessage_destroy.] */
+            else if ((handle->topicName = (char*)malloc(handle->const_topic_name_length + 1)) == NULL)
+            {
+                /* Codes_SRS_MQTTMESSAGE_07_034: [If allocating the copy fails mqttmessage_getTopicName shall return NULL.] */
+                LogError("Failure allocating topic name");
+                result = NULL;
+            }
+            else
+            {
+                (void)memcpy(handle->topicName, handle->const_topic_name, handle->const_topic_name_length);
+                handle->topicName[handle->const_topic_name_length] = '\0';
+                result = handle->topicName;
+            }
         }
         else
         {
@@ -214,6 +336,46 @@ const char* mqttmessage_getTopicName(MQTT_MESSAGE_HANDLE handle)
     return result;
 }
 
+MQTT_TOPIC_HANDLE mqttmessage_getInternedTopic(MQTT_MESSAGE_HANDLE handle)
+{
+    MQTT_TOPIC_HANDLE result;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTTMESSAGE_07_046: [If handle is NULL then mqttmessage_getInternedTopic shall return NULL.] */
+        LogError("Invalid Parameter handle: %p.", handle);
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTTMESSAGE_07_047: [mqttmessage_getInternedTopic shall return the topic handle was created with, or NULL if handle was not created with mqttmessage_create_with_topic.] */
+        result = handle->internedTopic;
+    }
+    return result;
+}
+
+const char* mqttmessage_getTopicNameView(MQTT_MESSAGE_HANDLE handle, size_t* topicNameLength)
+{
+    const char* result;
+    if (handle == NULL || topicNameLength == NULL)
+    {
+        /* Codes_SRS_MQTTMESSAGE_07_035: [If handle or topicNameLength is NULL then mqttmessage_getTopicNameView shall return NULL.] */
+        LogError("Invalid Parameter handle: %p, topicNameLength: %p.", handle, topicNameLength);
+        result = NULL;
+    }
+    else if (handle->const_topic_name != NULL)
+    {
+        /* Codes_SRS_MQTTMESSAGE_07_036: [mqttmessage_getTopicNameView shall return the topic name without copying it and store its length in topicNameLength, the returned value may not be NULL terminated.] */
+        result = handle->const_topic_name;
+        *topicNameLength = handle->const_topic_name_length;
+    }
+    else
+    {
+        result = handle->topicName;
+        *topicNameLength = (result == NULL) ? 0 : strlen(result);
+    }
+    return result;
+}
+
 int mqttmessage_getTopicLevels(MQTT_MESSAGE_HANDLE handle, char*** levels, size_t* count)
 {
     int result;
@@ -226,9 +388,8 @@ int mqttmessage_getTopicLevels(MQTT_MESSAGE_HANDLE handle, char*** levels, size_
     }
     else
     {
-        MQTT_MESSAGE* msgInfo = (MQTT_MESSAGE*)handle;
-
-        const char* topic_name = msgInfo->topicName != NULL ? msgInfo->topicName : msgInfo->const_topic_name;
+        size_t topic_name_length = 0;
+        const char* topic_name = mqttmessage_getTopicNameView(handle, &topic_name_length);
 
         if (topic_name == NULL)
         {
@@ -243,7 +404,7 @@ int mqttmessage_getTopicLevels(MQTT_MESSAGE_HANDLE handle, char*** levels, size_
 
             // Codes_SRS_MQTTMESSAGE_09_002: [ The topic name, excluding the property bag, shall be split into individual tokens using "/" as separator ]
             // Codes_SRS_MQTTMESSAGE_09_004: [ The split tokens shall be stored in `levels` and its count in `count` ]
-            if (StringToken_Split(topic_name, strlen(topic_name), delimiters, 1, false, levels, count) != 0)
+            if (StringToken_Split(topic_name, topic_name_length, delimiters, 1, false, levels, count) != 0)
             {
                 // Codes_SRS_MQTTMESSAGE_09_003: [ If splitting fails the function shall return a non-zero value. ]
                 LogError("Failed splitting topic levels");
@@ -260,6 +421,56 @@ int mqttmessage_getTopicLevels(MQTT_MESSAGE_HANDLE handle, char*** levels, size_
     return result;
 }
 
+int mqttmessage_getTopicLevelSpans(MQTT_MESSAGE_HANDLE handle, MQTT_TOPIC_LEVEL* levels, size_t maxLevels, size_t* count)
+{
+    int result;
+    size_t topic_name_length = 0;
+    const char* topic_name = NULL;
+
+    if (handle == NULL || count == NULL || (levels == NULL && maxLevels > 0) ||
+        (topic_name = mqttmessage_getTopicNameView(handle, &topic_name_length)) == NULL)
+    {
+        /* Codes_SRS_MQTTMESSAGE_07_039: [If handle or count is NULL, levels is NULL while maxLevels is not 0 or the message has no topic name then mqttmessage_getTopicLevelSpans shall return a non-zero value.] */
+        LogError("Invalid Parameter handle: %p, levels: %p, count: %p", handle, levels, count);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        const char* iterator = topic_name;
+        const char* topic_end = topic_name + topic_name_length;
+        size_t level_count = 0;
+
+        /* Codes_SRS_MQTTMESSAGE_07_040: [mqttmessage_getTopicLevelSpans shall store the offset and length of every non-empty "/" separated level of the topic name in levels without allocating memory, and the number of levels in count.] */
+        while (iterator < topic_end)
+        {
+            const char* separator = (const char*)memchr(iterator, '/', (size_t)(topic_end - iterator));
+            const char* level_end = (separator == NULL) ? topic_end : separator;
+            if (level_end > iterator)
+            {
+                if (level_count < maxLevels)
+                {
+                    levels[level_count].offset = (size_t)(iterator - topic_name);
+                    levels[level_count].length = (size_t)(level_end - iterator);
+                }
+                level_count++;
+            }
+            iterator = (separator == NULL) ? topic_end : separator + 1;
+        }
+        *count = level_count;
+
+        if (level_count > maxLevels)
+        {
+            /* Codes_SRS_MQTTMESSAGE_07_041: [If the topic name has more than maxLevels levels then mqttmessage_getTopicLevelSpans shall store the first maxLevels of them and return a non-zero value.] */
+            result = MU_FAILURE;
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+    return result;
+}
+
 QOS_VALUE mqttmessage_getQosType(MQTT_MESSAGE_HANDLE handle)
 {
     QOS_VALUE result;
@@ -329,6 +540,24 @@ int mqttmessage_setIsDuplicateMsg(MQTT_MESSAGE_HANDLE handle, bool duplicateMsg)
     return result;
 }
 
+int mqttmessage_setPacketId(MQTT_MESSAGE_HANDLE handle, uint16_t packetId)
+{
+    int result;
+    /* Codes_SRS_MQTTMESSAGE_07_037: [If handle is NULL then mqttmessage_setPacketId shall return a non-zero value.] */
+    if (handle == NULL)
+    {
+        LogError("Invalid Parameter handle: %p.", handle);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTTMESSAGE_07_038: [mqttmessage_setPacketId shall store the packetId value in the MQTT_MESSAGE_HANDLE handle.] */
+        handle->packetId = packetId;
+        result = 0;
+    }
+    return result;
+}
+
 int mqttmessage_setIsRetained(MQTT_MESSAGE_HANDLE handle, bool retainMsg)
 {
     int result;
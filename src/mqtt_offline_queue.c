@@ -0,0 +1,556 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_offline_queue.h"
+
+#define SPILL_RECORD_HEADER_SIZE        4
+#define SPILL_COPY_CHUNK_SIZE           4096
+
+// Packets held in memory, oldest first. Every packet in the segment file is newer than all of these.
+typedef struct OFFLINE_ENTRY_TAG
+{
+    struct OFFLINE_ENTRY_TAG* next;
+    BUFFER_HANDLE packet;
+    QOS_VALUE qos;
+} OFFLINE_ENTRY;
+
+// The segment file holds a length prefixed packet per record between readOffset and writeOffset.
+// Read records are skipped, the file is rewound once it is empty and shifted down once the
+// skipped prefix outgrows the records still in it.
+typedef struct MQTT_OFFLINE_QUEUE_TAG
+{
+    OFFLINE_ENTRY* head;
+    OFFLINE_ENTRY* tail;
+    size_t memoryCount;
+    size_t memoryBytes;
+    size_t maxMemoryBytes;
+    MQTT_OFFLINE_DROP_POLICY dropPolicy;
+
+    char* spillPath;
+    FILE* spillFile;
+    size_t spillCount;
+    long readOffset;
+    long writeOffset;
+    size_t maxSpillBytes;
+
+    size_t dropped;
+} MQTT_OFFLINE_QUEUE;
+
+static size_t get_spill_bytes(const MQTT_OFFLINE_QUEUE* queue)
+{
+    return (size_t)(queue->writeOffset - queue->readOffset);
+}
+
+static QOS_VALUE get_packet_qos(const unsigned char* packet)
+{
+    return (QOS_VALUE)((packet[0] >> 1) & 0x03);
+}
+
+static void append_entry(MQTT_OFFLINE_QUEUE* queue, OFFLINE_ENTRY* entry)
+{
+    entry->next = NULL;
+    if (queue->tail == NULL)
+    {
+        queue->head = entry;
+    }
+    else
+    {
+        queue->tail->next = entry;
+    }
+    queue->tail = entry;
+    queue->memoryCount++;
+    queue->memoryBytes += BUFFER_length(entry->packet);
+}
+
+static void remove_entry(MQTT_OFFLINE_QUEUE* queue, OFFLINE_ENTRY* previous, OFFLINE_ENTRY* entry)
+{
+    if (previous == NULL)
+    {
+        queue->head = entry->next;
+    }
+    else
+    {
+        previous->next = entry->next;
+    }
+    if (queue->tail == entry)
+    {
+        queue->tail = previous;
+    }
+    queue->memoryCount--;
+    queue->memoryBytes -= BUFFER_length(entry->packet);
+    BUFFER_delete(entry->packet);
+    free(entry);
+}
+
+static int open_spill_file(MQTT_OFFLINE_QUEUE* queue)
+{
+    int result;
+    if (queue->spillFile != NULL)
+    {
+        result = 0;
+    }
+    else if ((queue->spillFile = fopen(queue->spillPath, "w+b")) == NULL)
+    {
+        LogError("Failure opening offline segment file %s", queue->spillPath);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        queue->readOffset = 0;
+        queue->writeOffset = 0;
+        result = 0;
+    }
+    return result;
+}
+
+// Copies the records from source up to writeOffset down to target, the copy then ends the file
+static int move_spill_records(MQTT_OFFLINE_QUEUE* queue, long source, long target)
+{
+    int result = 0;
+    unsigned char chunk[SPILL_COPY_CHUNK_SIZE];
+
+    while (source < queue->writeOffset && result == 0)
+    {
+        size_t length = (size_t)(queue->writeOffset - source);
+        if (length > sizeof(chunk))
+        {
+            length = sizeof(chunk);
+        }
+        if (fseek(queue->spillFile, source, SEEK_SET) != 0 || fread(chunk, 1, length, queue->spillFile) != length ||
+            fseek(queue->spillFile, target, SEEK_SET) != 0 || fwrite(chunk, 1, length, queue->spillFile) != length)
+        {
+            LogError("Failure compacting offline segment file %s", queue->spillPath);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            source += (long)length;
+            target += (long)length;
+        }
+    }
+    if (result == 0)
+    {
+        queue->writeOffset = target;
+    }
+    return result;
+}
+
+// Moves the unread records to the start of the file so it doesn't grow while packets flow through it
+static int shift_spill_file(MQTT_OFFLINE_QUEUE* queue)
+{
+    int result = move_spill_records(queue, queue->readOffset, 0);
+    if (result == 0)
+    {
+        queue->readOffset = 0;
+    }
+    return result;
+}
+
+static int spill_packet(MQTT_OFFLINE_QUEUE* queue, BUFFER_HANDLE packet)
+{
+    int result;
+    size_t length = BUFFER_length(packet);
+    unsigned char header[SPILL_RECORD_HEADER_SIZE];
+
+    header[0] = (unsigned char)((length >> 24) & 0xff);
+    header[1] = (unsigned char)((length >> 16) & 0xff);
+    header[2] = (unsigned char)((length >> 8) & 0xff);
+    header[3] = (unsigned char)(length & 0xff);
+
+    if (open_spill_file(queue) != 0)
+    {
+        result = MU_FAILURE;
+    }
+    else if (queue->readOffset > 0 && (size_t)queue->readOffset >= get_spill_bytes(queue) && shift_spill_file(queue) != 0)
+    {
+        result = MU_FAILURE;
+    }
+    else if (fseek(queue->spillFile, queue->writeOffset, SEEK_SET) != 0 ||
+        fwrite(header, 1, sizeof(header), queue->spillFile) != sizeof(header) ||
+        fwrite(BUFFER_u_char(packet), 1, length, queue->spillFile) != length)
+    {
+        LogError("Failure writing %lu bytes to offline segment file %s", (unsigned long)length, queue->spillPath);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        queue->writeOffset += (long)(sizeof(header) + length);
+        queue->spillCount++;
+        BUFFER_delete(packet);
+        result = 0;
+    }
+    return result;
+}
+
+// Reads the oldest spilled record into memory, ignoring the memory budget when nothing else is in memory
+static int promote_spilled_packet(MQTT_OFFLINE_QUEUE* queue, bool* promoted)
+{
+    int result;
+    unsigned char header[SPILL_RECORD_HEADER_SIZE];
+
+    *promoted = false;
+    if (fseek(queue->spillFile, queue->readOffset, SEEK_SET) != 0 ||
+        fread(header, 1, sizeof(header), queue->spillFile) != sizeof(header))
+    {
+        LogError("Failure reading offline segment file %s", queue->spillPath);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        size_t length = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | (size_t)header[3];
+        if (queue->head != NULL && queue->memoryBytes + length > queue->maxMemoryBytes)
+        {
+            result = 0;
+        }
+        else
+        {
+            OFFLINE_ENTRY* entry;
+            BUFFER_HANDLE packet = NULL;
+            if ((entry = (OFFLINE_ENTRY*)malloc(sizeof(OFFLINE_ENTRY))) == NULL ||
+                (packet = BUFFER_new()) == NULL ||
+                BUFFER_pre_build(packet, length) != 0 ||
+                fread(BUFFER_u_char(packet), 1, length, queue->spillFile) != length)
+            {
+                LogError("Failure reading %lu bytes from offline segment file %s", (unsigned long)length, queue->spillPath);
+                BUFFER_delete(packet);
+                free(entry);
+                result = MU_FAILURE;
+            }
+            else
+            {
+                entry->packet = packet;
+                entry->qos = get_packet_qos(BUFFER_u_char(packet));
+                append_entry(queue, entry);
+                queue->readOffset += (long)(sizeof(header) + length);
+                queue->spillCount--;
+                if (queue->spillCount == 0)
+                {
+                    queue->readOffset = 0;
+                    queue->writeOffset = 0;
+                }
+                *promoted = true;
+                result = 0;
+            }
+        }
+    }
+    return result;
+}
+
+static int refill_from_spill(MQTT_OFFLINE_QUEUE* queue)
+{
+    int result = 0;
+    bool promoted = true;
+    while (queue->spillCount > 0 && promoted && result == 0)
+    {
+        result = promote_spilled_packet(queue, &promoted);
+    }
+    return result;
+}
+
+static bool has_room(const MQTT_OFFLINE_QUEUE* queue, size_t length)
+{
+    bool result;
+    if (queue->spillCount == 0 && queue->memoryBytes + length <= queue->maxMemoryBytes)
+    {
+        result = true;
+    }
+    else
+    {
+        result = (queue->spillPath != NULL &&
+            (queue->maxSpillBytes == 0 || get_spill_bytes(queue) + SPILL_RECORD_HEADER_SIZE + length <= queue->maxSpillBytes));
+    }
+    return result;
+}
+
+// Oldest spilled record of the lowest QoS below belowQos, only the header and first byte of each record are read
+static bool find_spilled_victim(MQTT_OFFLINE_QUEUE* queue, int belowQos, long* recordOffset, size_t* recordSize)
+{
+    bool result = false;
+    long offset = queue->readOffset;
+    int lowestQos = belowQos;
+
+    while (offset < queue->writeOffset && lowestQos > DELIVER_AT_MOST_ONCE)
+    {
+        unsigned char header[SPILL_RECORD_HEADER_SIZE + 1];
+        size_t length;
+        if (fseek(queue->spillFile, offset, SEEK_SET) != 0 ||
+            fread(header, 1, sizeof(header), queue->spillFile) != sizeof(header))
+        {
+            LogError("Failure reading offline segment file %s", queue->spillPath);
+            break;
+        }
+        length = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | (size_t)header[3];
+        if ((int)get_packet_qos(header + SPILL_RECORD_HEADER_SIZE) < lowestQos)
+        {
+            lowestQos = (int)get_packet_qos(header + SPILL_RECORD_HEADER_SIZE);
+            *recordOffset = offset;
+            *recordSize = SPILL_RECORD_HEADER_SIZE + length;
+            result = true;
+        }
+        offset += (long)(SPILL_RECORD_HEADER_SIZE + length);
+    }
+    return result;
+}
+
+static int remove_spilled_record(MQTT_OFFLINE_QUEUE* queue, long recordOffset, size_t recordSize)
+{
+    int result = move_spill_records(queue, recordOffset + (long)recordSize, recordOffset);
+    if (result == 0)
+    {
+        queue->spillCount--;
+        if (queue->spillCount == 0)
+        {
+            queue->readOffset = 0;
+            queue->writeOffset = 0;
+        }
+    }
+    return result;
+}
+
+// Drops one queued packet to make room for a packet of the given qos, returns false if the new packet is the one to drop
+static bool drop_queued_packet(MQTT_OFFLINE_QUEUE* queue, QOS_VALUE qos)
+{
+    bool result = false;
+    if (queue->head != NULL && queue->dropPolicy == MQTT_OFFLINE_DROP_OLDEST)
+    {
+        remove_entry(queue, NULL, queue->head);
+        result = true;
+    }
+    else if (queue->dropPolicy == MQTT_OFFLINE_DROP_LOWEST_QOS)
+    {
+        // Oldest of the lowest QoS packets, memory holds the oldest packets so a spilled one only wins with a lower QoS.
+        // The new packet counts as the newest candidate.
+        OFFLINE_ENTRY* previous = NULL;
+        OFFLINE_ENTRY* victimPrevious = NULL;
+        OFFLINE_ENTRY* victim = NULL;
+        OFFLINE_ENTRY* entry;
+        long spilledOffset;
+        size_t spilledSize;
+        for (entry = queue->head; entry != NULL; previous = entry, entry = entry->next)
+        {
+            if (entry->qos <= qos && (victim == NULL || entry->qos < victim->qos))
+            {
+                victim = entry;
+                victimPrevious = previous;
+                if (victim->qos == DELIVER_AT_MOST_ONCE)
+                {
+                    break;
+                }
+            }
+        }
+        if (queue->spillCount > 0 && (victim == NULL || victim->qos > DELIVER_AT_MOST_ONCE) &&
+            find_spilled_victim(queue, (victim == NULL) ? (int)qos + 1 : (int)victim->qos, &spilledOffset, &spilledSize))
+        {
+            if (remove_spilled_record(queue, spilledOffset, spilledSize) != 0)
+            {
+                LogError("Failure dropping spilled offline packet");
+            }
+            else
+            {
+                result = true;
+            }
+        }
+        else if (victim != NULL)
+        {
+            remove_entry(queue, victimPrevious, victim);
+            result = true;
+        }
+    }
+    return result;
+}
+
+MQTT_OFFLINE_QUEUE_HANDLE mqtt_offline_queue_create(const MQTT_OFFLINE_QUEUE_OPTIONS* options)
+{
+    MQTT_OFFLINE_QUEUE* result;
+    if (options == NULL || options->maxMemoryBytes == 0 ||
+        (options->dropPolicy != MQTT_OFFLINE_DROP_OLDEST && options->dropPolicy != MQTT_OFFLINE_DROP_NEWEST && options->dropPolicy != MQTT_OFFLINE_DROP_LOWEST_QOS))
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_001: [If options is NULL, maxMemoryBytes is 0 or dropPolicy is not valid then mqtt_offline_queue_create shall return NULL.] */
+        LogError("Invalid parameter specified options: %p", options);
+        result = NULL;
+    }
+    else if ((result = (MQTT_OFFLINE_QUEUE*)malloc(sizeof(MQTT_OFFLINE_QUEUE))) == NULL)
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_002: [If any failure is encountered then mqtt_offline_queue_create shall return NULL.] */
+        LogError("Failure allocating offline queue");
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_003: [mqtt_offline_queue_create shall return an empty queue, the segment file is only created once a packet spills.] */
+        (void)memset(result, 0, sizeof(MQTT_OFFLINE_QUEUE));
+        result->maxMemoryBytes = options->maxMemoryBytes;
+        result->maxSpillBytes = options->maxSpillBytes;
+        result->dropPolicy = options->dropPolicy;
+        if (options->spillPath != NULL)
+        {
+            size_t pathLength = strlen(options->spillPath);
+            if ((result->spillPath = (char*)malloc(pathLength + 1)) == NULL)
+            {
+                /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_002: [If any failure is encountered then mqtt_offline_queue_create shall return NULL.] */
+                LogError("Failure allocating offline segment file path");
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                (void)memcpy(result->spillPath, options->spillPath, pathLength + 1);
+            }
+        }
+    }
+    return result;
+}
+
+void mqtt_offline_queue_destroy(MQTT_OFFLINE_QUEUE_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_004: [If handle is NULL then mqtt_offline_queue_destroy shall do nothing.] */
+    if (handle != NULL)
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_005: [mqtt_offline_queue_destroy shall free every queued packet and delete the segment file.] */
+        while (handle->head != NULL)
+        {
+            remove_entry(handle, NULL, handle->head);
+        }
+        if (handle->spillFile != NULL)
+        {
+            (void)fclose(handle->spillFile);
+            (void)remove(handle->spillPath);
+        }
+        free(handle->spillPath);
+        free(handle);
+    }
+}
+
+int mqtt_offline_queue_push(MQTT_OFFLINE_QUEUE_HANDLE handle, BUFFER_HANDLE packet, QOS_VALUE qos)
+{
+    int result;
+    size_t length;
+    if (handle == NULL || packet == NULL || (length = BUFFER_length(packet)) == 0)
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_006: [If handle or packet is NULL or packet is empty then mqtt_offline_queue_push shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, packet: %p", handle, packet);
+        result = MU_FAILURE;
+    }
+    else if (length > handle->maxMemoryBytes &&
+        (handle->spillPath == NULL || (handle->maxSpillBytes != 0 && SPILL_RECORD_HEADER_SIZE + length > handle->maxSpillBytes)))
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_010: [If packet can never fit the queue then mqtt_offline_queue_push shall drop it and return a non-zero value.] */
+        LogError("Packet of %lu bytes does not fit the offline queue", (unsigned long)length);
+        handle->dropped++;
+        result = MU_FAILURE;
+    }
+    else
+    {
+        result = 0;
+        while (result == 0 && !has_room(handle, length))
+        {
+            /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_009: [When the queue is full mqtt_offline_queue_push shall drop the oldest packet for MQTT_OFFLINE_DROP_OLDEST, the new packet for MQTT_OFFLINE_DROP_NEWEST, or the oldest packet of the lowest QoS not above qos for MQTT_OFFLINE_DROP_LOWEST_QOS, and return a non-zero value if the new packet was dropped.] */
+            if (!drop_queued_packet(handle, qos))
+            {
+                handle->dropped++;
+                result = MU_FAILURE;
+            }
+            else
+            {
+                handle->dropped++;
+                result = refill_from_spill(handle);
+            }
+        }
+
+        if (result == 0)
+        {
+            if (handle->spillCount == 0 && handle->memoryBytes + length <= handle->maxMemoryBytes)
+            {
+                /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_007: [mqtt_offline_queue_push shall keep packet in memory while the queued packets fit maxMemoryBytes.] */
+                OFFLINE_ENTRY* entry = (OFFLINE_ENTRY*)malloc(sizeof(OFFLINE_ENTRY));
+                if (entry == NULL)
+                {
+                    /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_011: [If any failure is encountered then mqtt_offline_queue_push shall return a non-zero value and leave packet to the caller.] */
+                    LogError("Failure allocating offline queue entry");
+                    result = MU_FAILURE;
+                }
+                else
+                {
+                    entry->packet = packet;
+                    entry->qos = qos;
+                    append_entry(handle, entry);
+                }
+            }
+            /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_008: [Once maxMemoryBytes is reached mqtt_offline_queue_push shall append packet to the segment file at spillPath and free it.] */
+            else if (spill_packet(handle, packet) != 0)
+            {
+                /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_011: [If any failure is encountered then mqtt_offline_queue_push shall return a non-zero value and leave packet to the caller.] */
+                result = MU_FAILURE;
+            }
+        }
+    }
+    return result;
+}
+
+BUFFER_HANDLE mqtt_offline_queue_peek(MQTT_OFFLINE_QUEUE_HANDLE handle)
+{
+    BUFFER_HANDLE result;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_012: [If handle is NULL then mqtt_offline_queue_peek shall return NULL.] */
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_013: [mqtt_offline_queue_peek shall return the oldest queued packet, reading it from the segment file when no packet is in memory.] */
+        if (handle->head == NULL && handle->spillCount > 0 && refill_from_spill(handle) != 0)
+        {
+            LogError("Failure reading the oldest offline packet");
+        }
+        result = (handle->head == NULL) ? NULL : handle->head->packet;
+    }
+    return result;
+}
+
+void mqtt_offline_queue_pop(MQTT_OFFLINE_QUEUE_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_014: [If handle is NULL or the queue is empty then mqtt_offline_queue_pop shall do nothing.] */
+    if (handle != NULL && mqtt_offline_queue_peek(handle) != NULL)
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_015: [mqtt_offline_queue_pop shall free the oldest queued packet and move spilled packets back into memory as room allows.] */
+        remove_entry(handle, NULL, handle->head);
+        if (refill_from_spill(handle) != 0)
+        {
+            LogError("Failure reading spilled offline packets");
+        }
+    }
+}
+
+size_t mqtt_offline_queue_count(MQTT_OFFLINE_QUEUE_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_016: [mqtt_offline_queue_count shall return the number of queued packets, or 0 if handle is NULL.] */
+    return (handle == NULL) ? 0 : handle->memoryCount + handle->spillCount;
+}
+
+int mqtt_offline_queue_get_stats(MQTT_OFFLINE_QUEUE_HANDLE handle, MQTT_OFFLINE_QUEUE_STATS* stats)
+{
+    int result;
+    if (handle == NULL || stats == NULL)
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_017: [If handle or stats is NULL then mqtt_offline_queue_get_stats shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, stats: %p", handle, stats);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_OFFLINE_QUEUE_07_018: [mqtt_offline_queue_get_stats shall report the queued packets, the bytes held in memory and in the segment file and the number of dropped packets.] */
+        stats->count = handle->memoryCount + handle->spillCount;
+        stats->memoryBytes = handle->memoryBytes;
+        stats->spillBytes = get_spill_bytes(handle);
+        stats->dropped = handle->dropped;
+        result = 0;
+    }
+    return result;
+}
@@ -0,0 +1,1042 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_session_store.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define INDEX_INITIAL_SIZE              64
+#define OUTGOING_KEY_SPACE              0x10000
+#define INCOMING_KEY_SPACE              0x20000
+
+typedef struct MQTT_SESSION_STORE_INSTANCE_TAG
+{
+    const MQTT_SESSION_STORE_INTERFACE_DESCRIPTION* interfaceDescription;
+    CONCRETE_SESSION_STORE_HANDLE concreteStore;
+} MQTT_SESSION_STORE_INSTANCE;
+
+// Open addressed map from record key to a backend defined value, keys are never zero
+typedef struct SESSION_INDEX_TAG
+{
+    uint32_t* keys;
+    size_t* values;
+    size_t mask;
+    size_t count;
+} SESSION_INDEX;
+
+static bool is_valid_record_type(MQTT_SESSION_RECORD_TYPE recordType)
+{
+    return (recordType == MQTT_SESSION_RECORD_PUBLISH || recordType == MQTT_SESSION_RECORD_PUBREL || recordType == MQTT_SESSION_RECORD_PUBREC);
+}
+
+static uint32_t get_record_key(MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId)
+{
+    return (uint32_t)((recordType == MQTT_SESSION_RECORD_PUBREC) ? INCOMING_KEY_SPACE : OUTGOING_KEY_SPACE) | packetId;
+}
+
+static int index_init(SESSION_INDEX* index, size_t size)
+{
+    int result;
+    index->keys = (uint32_t*)malloc(size * sizeof(uint32_t));
+    index->values = (size_t*)malloc(size * sizeof(size_t));
+    if (index->keys == NULL || index->values == NULL)
+    {
+        LogError("Failure allocating session index of %lu entries", (unsigned long)size);
+        free(index->keys);
+        free(index->values);
+        index->keys = NULL;
+        index->values = NULL;
+        result = MU_FAILURE;
+    }
+    else
+    {
+        (void)memset(index->keys, 0, size * sizeof(uint32_t));
+        index->mask = size - 1;
+        index->count = 0;
+        result = 0;
+    }
+    return result;
+}
+
+static void index_deinit(SESSION_INDEX* index)
+{
+    free(index->keys);
+    free(index->values);
+    index->keys = NULL;
+    index->values = NULL;
+    index->count = 0;
+}
+
+static size_t index_bucket(const SESSION_INDEX* index, uint32_t key)
+{
+    size_t bucket = (size_t)(key * 2654435761u) & index->mask;
+    while (index->keys[bucket] != 0 && index->keys[bucket] != key)
+    {
+        bucket = (bucket + 1) & index->mask;
+    }
+    return bucket;
+}
+
+static bool index_find(const SESSION_INDEX* index, uint32_t key, size_t* value)
+{
+    size_t bucket = index_bucket(index, key);
+    bool result = (index->keys[bucket] == key);
+    if (result && value != NULL)
+    {
+        *value = index->values[bucket];
+    }
+    return result;
+}
+
+static int index_set(SESSION_INDEX* index, uint32_t key, size_t value)
+{
+    int result = 0;
+    // Keep the load under a half so probe sequences stay short
+    if ((index->count + 1) * 2 > index->mask + 1)
+    {
+        SESSION_INDEX grown;
+        if (index_init(&grown, (index->mask + 1) * 2) != 0)
+        {
+            result = MU_FAILURE;
+        }
+        else
+        {
+            size_t bucket;
+            for (bucket = 0; bucket <= index->mask; bucket++)
+            {
+                if (index->keys[bucket] != 0)
+                {
+                    size_t target = index_bucket(&grown, index->keys[bucket]);
+                    grown.keys[target] = index->keys[bucket];
+                    grown.values[target] = index->values[bucket];
+                }
+            }
+            grown.count = index->count;
+            index_deinit(index);
+            *index = grown;
+        }
+    }
+
+    if (result == 0)
+    {
+        size_t bucket = index_bucket(index, key);
+        if (index->keys[bucket] == 0)
+        {
+            index->keys[bucket] = key;
+            index->count++;
+        }
+        index->values[bucket] = value;
+    }
+    return result;
+}
+
+static bool index_remove(SESSION_INDEX* index, uint32_t key, size_t* value)
+{
+    size_t bucket = index_bucket(index, key);
+    bool result = (index->keys[bucket] == key);
+    if (result)
+    {
+        size_t next = (bucket + 1) & index->mask;
+        if (value != NULL)
+        {
+            *value = index->values[bucket];
+        }
+
+        // Backward shift deletion keeps every probe sequence free of holes
+        index->keys[bucket] = 0;
+        while (index->keys[next] != 0)
+        {
+            size_t home = (size_t)(index->keys[next] * 2654435761u) & index->mask;
+            if (((next - home) & index->mask) >= ((next - bucket) & index->mask))
+            {
+                index->keys[bucket] = index->keys[next];
+                index->values[bucket] = index->values[next];
+                index->keys[next] = 0;
+                bucket = next;
+            }
+            next = (next + 1) & index->mask;
+        }
+        index->count--;
+    }
+    return result;
+}
+
+/* Memory backend: one allocation per record, linked in the order records were saved */
+
+typedef struct MEMORY_RECORD_TAG
+{
+    struct MEMORY_RECORD_TAG* prev;
+    struct MEMORY_RECORD_TAG* next;
+    MQTT_SESSION_RECORD_TYPE recordType;
+    uint16_t packetId;
+    size_t length;
+} MEMORY_RECORD;
+
+typedef struct MEMORY_STORE_TAG
+{
+    SESSION_INDEX index;
+    MEMORY_RECORD* oldest;
+    MEMORY_RECORD* newest;
+} MEMORY_STORE;
+
+static void memory_unlink_record(MEMORY_STORE* store, MEMORY_RECORD* record)
+{
+    if (record->prev == NULL)
+    {
+        store->oldest = record->next;
+    }
+    else
+    {
+        record->prev->next = record->next;
+    }
+    if (record->next == NULL)
+    {
+        store->newest = record->prev;
+    }
+    else
+    {
+        record->next->prev = record->prev;
+    }
+}
+
+static int memory_store_clear(CONCRETE_SESSION_STORE_HANDLE concrete_store)
+{
+    MEMORY_STORE* store = (MEMORY_STORE*)concrete_store;
+    while (store->oldest != NULL)
+    {
+        MEMORY_RECORD* record = store->oldest;
+        store->oldest = record->next;
+        free(record);
+    }
+    store->newest = NULL;
+    store->index.count = 0;
+    (void)memset(store->index.keys, 0, (store->index.mask + 1) * sizeof(uint32_t));
+    return 0;
+}
+
+static CONCRETE_SESSION_STORE_HANDLE memory_store_create(const void* parameters)
+{
+    MEMORY_STORE* result;
+    (void)parameters;
+    if ((result = (MEMORY_STORE*)malloc(sizeof(MEMORY_STORE))) == NULL)
+    {
+        LogError("Failure allocating memory session store");
+    }
+    else
+    {
+        (void)memset(result, 0, sizeof(MEMORY_STORE));
+        if (index_init(&result->index, INDEX_INITIAL_SIZE) != 0)
+        {
+            free(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+static void memory_store_destroy(CONCRETE_SESSION_STORE_HANDLE concrete_store)
+{
+    MEMORY_STORE* store = (MEMORY_STORE*)concrete_store;
+    (void)memory_store_clear(store);
+    index_deinit(&store->index);
+    free(store);
+}
+
+static int memory_store_remove(CONCRETE_SESSION_STORE_HANDLE concrete_store, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId)
+{
+    MEMORY_STORE* store = (MEMORY_STORE*)concrete_store;
+    size_t value;
+    if (index_remove(&store->index, get_record_key(recordType, packetId), &value))
+    {
+        MEMORY_RECORD* record = (MEMORY_RECORD*)value;
+        memory_unlink_record(store, record);
+        free(record);
+    }
+    return 0;
+}
+
+static int memory_store_save(CONCRETE_SESSION_STORE_HANDLE concrete_store, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId, const uint8_t* data, size_t length)
+{
+    int result;
+    MEMORY_STORE* store = (MEMORY_STORE*)concrete_store;
+    MEMORY_RECORD* record = (MEMORY_RECORD*)malloc(sizeof(MEMORY_RECORD) + length);
+    if (record == NULL)
+    {
+        LogError("Failure allocating session record of %lu bytes", (unsigned long)length);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        uint32_t key = get_record_key(recordType, packetId);
+        size_t value;
+        MEMORY_RECORD* replaced = index_find(&store->index, key, &value) ? (MEMORY_RECORD*)value : NULL;
+
+        record->recordType = recordType;
+        record->packetId = packetId;
+        record->length = length;
+        if (length > 0)
+        {
+            (void)memcpy(record + 1, data, length);
+        }
+
+        if (index_set(&store->index, key, (size_t)record) != 0)
+        {
+            free(record);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            // A replaced record is dropped, the new one becomes the newest
+            if (replaced != NULL)
+            {
+                memory_unlink_record(store, replaced);
+                free(replaced);
+            }
+            record->next = NULL;
+            record->prev = store->newest;
+            if (store->newest == NULL)
+            {
+                store->oldest = record;
+            }
+            else
+            {
+                store->newest->next = record;
+            }
+            store->newest = record;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static int memory_store_load(CONCRETE_SESSION_STORE_HANDLE concrete_store, ON_SESSION_RECORD_LOADED onRecordLoaded, void* context)
+{
+    MEMORY_STORE* store = (MEMORY_STORE*)concrete_store;
+    MEMORY_RECORD* record;
+    for (record = store->oldest; record != NULL; record = record->next)
+    {
+        onRecordLoaded(context, record->recordType, record->packetId, (const uint8_t*)(record + 1), record->length);
+    }
+    return 0;
+}
+
+static const MQTT_SESSION_STORE_INTERFACE_DESCRIPTION memory_store_interface_description =
+{
+    memory_store_create,
+    memory_store_destroy,
+    memory_store_save,
+    memory_store_remove,
+    memory_store_load,
+    memory_store_clear
+};
+
+#ifndef _WIN32
+/* File backend: an append only log of fixed header records in a memory mapped file.
+   A record is only trusted when its checksum matches, so a write torn by a crash
+   ends the log instead of corrupting it. */
+
+#define FILE_STORE_MAGIC                "UMQTTSS1"
+#define FILE_STORE_MAGIC_SIZE           8
+#define FILE_STORE_HEADER_SIZE          16
+#define FILE_RECORD_HEADER_SIZE         16
+#define FILE_RECORD_ALIGNMENT           8
+#define FILE_STORE_INITIAL_CAPACITY     (64 * 1024)
+#define FILE_STORE_DEFAULT_COMPACT_SIZE (1024 * 1024)
+#define FILE_RECORD_OP_SAVE             1
+#define FILE_RECORD_OP_REMOVE           2
+#define FNV_OFFSET_BASIS                2166136261u
+#define FNV_PRIME                       16777619u
+
+typedef struct FILE_RECORD_HEADER_TAG
+{
+    uint32_t checksum;
+    uint32_t length;
+    uint16_t packetId;
+    uint8_t op;
+    uint8_t recordType;
+    uint32_t reserved;
+} FILE_RECORD_HEADER;
+
+typedef struct FILE_STORE_TAG
+{
+    char* path;
+    int fd;
+    uint8_t* map;
+    size_t capacity;
+    size_t writeOffset;
+    size_t liveBytes;
+    size_t compactMinBytes;
+    bool syncOnWrite;
+    SESSION_INDEX index;
+} FILE_STORE;
+
+static size_t file_record_size(size_t length)
+{
+    return (FILE_RECORD_HEADER_SIZE + length + FILE_RECORD_ALIGNMENT - 1) & ~((size_t)FILE_RECORD_ALIGNMENT - 1);
+}
+
+static uint32_t file_record_checksum(const FILE_RECORD_HEADER* header, const uint8_t* data)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+    uint8_t fields[8];
+    size_t index;
+
+    fields[0] = (uint8_t)(header->length & 0xff);
+    fields[1] = (uint8_t)((header->length >> 8) & 0xff);
+    fields[2] = (uint8_t)((header->length >> 16) & 0xff);
+    fields[3] = (uint8_t)((header->length >> 24) & 0xff);
+    fields[4] = (uint8_t)(header->packetId & 0xff);
+    fields[5] = (uint8_t)(header->packetId >> 8);
+    fields[6] = header->op;
+    fields[7] = header->recordType;
+    for (index = 0; index < sizeof(fields); index++)
+    {
+        hash = (hash ^ fields[index]) * FNV_PRIME;
+    }
+    for (index = 0; index < header->length; index++)
+    {
+        hash = (hash ^ data[index]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// Reads the record at offset, returns false at the end of the log or at a torn record
+static bool file_read_record(const FILE_STORE* store, size_t offset, FILE_RECORD_HEADER* header, const uint8_t** data)
+{
+    bool result = false;
+    if (offset + FILE_RECORD_HEADER_SIZE <= store->capacity)
+    {
+        (void)memcpy(header, store->map + offset, sizeof(FILE_RECORD_HEADER));
+        if ((header->op == FILE_RECORD_OP_SAVE || header->op == FILE_RECORD_OP_REMOVE) &&
+            is_valid_record_type((MQTT_SESSION_RECORD_TYPE)header->recordType) &&
+            header->length <= store->capacity - offset - FILE_RECORD_HEADER_SIZE)
+        {
+            *data = store->map + offset + FILE_RECORD_HEADER_SIZE;
+            result = (file_record_checksum(header, *data) == header->checksum);
+        }
+    }
+    return result;
+}
+
+static int file_map(FILE_STORE* store, int fd, size_t capacity)
+{
+    int result;
+    void* map = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LogError("Failure mapping %lu bytes of session file, errno: %d", (unsigned long)capacity, errno);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        if (store->map != NULL)
+        {
+            (void)munmap(store->map, store->capacity);
+        }
+        store->map = (uint8_t*)map;
+        store->capacity = capacity;
+        result = 0;
+    }
+    return result;
+}
+
+static int file_ensure_capacity(FILE_STORE* store, size_t required)
+{
+    int result = 0;
+    if (required > store->capacity)
+    {
+        size_t capacity = store->capacity;
+        while (capacity < required)
+        {
+            capacity *= 2;
+        }
+        if (ftruncate(store->fd, (off_t)capacity) != 0)
+        {
+            LogError("Failure growing session file to %lu bytes, errno: %d", (unsigned long)capacity, errno);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            result = file_map(store, store->fd, capacity);
+        }
+    }
+    return result;
+}
+
+static void file_sync_range(FILE_STORE* store, size_t offset, size_t length)
+{
+    if (store->syncOnWrite)
+    {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t start = offset & ~(page - 1);
+        if (msync(store->map + start, offset + length - start, MS_SYNC) != 0)
+        {
+            LogError("Failure syncing session file, errno: %d", errno);
+        }
+    }
+}
+
+static int file_append_record(FILE_STORE* store, uint8_t op, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId, const uint8_t* data, size_t length, size_t* offset)
+{
+    int result;
+    size_t recordSize = file_record_size(length);
+    if (length > UINT32_MAX || file_ensure_capacity(store, store->writeOffset + recordSize) != 0)
+    {
+        result = MU_FAILURE;
+    }
+    else
+    {
+        FILE_RECORD_HEADER header;
+        uint8_t* target = store->map + store->writeOffset;
+
+        header.length = (uint32_t)length;
+        header.packetId = packetId;
+        header.op = op;
+        header.recordType = (uint8_t)recordType;
+        header.reserved = 0;
+        if (length > 0)
+        {
+            (void)memcpy(target + FILE_RECORD_HEADER_SIZE, data, length);
+        }
+        header.checksum = file_record_checksum(&header, target + FILE_RECORD_HEADER_SIZE);
+        (void)memcpy(target, &header, sizeof(header));
+        file_sync_range(store, store->writeOffset, recordSize);
+
+        *offset = store->writeOffset;
+        store->writeOffset += recordSize;
+        result = 0;
+    }
+    return result;
+}
+
+// isFresh empties a file that already exists, so nothing of an older log can be read from it
+static int file_open_log(FILE_STORE* store, const char* path, size_t capacity, bool isFresh)
+{
+    int result;
+    int fd = open(path, O_RDWR | O_CREAT | (isFresh ? O_TRUNC : 0), 0600);
+    if (fd < 0)
+    {
+        LogError("Failure opening session file %s, errno: %d", path, errno);
+        result = MU_FAILURE;
+    }
+    else if (ftruncate(fd, (off_t)capacity) != 0 || file_map(store, fd, capacity) != 0)
+    {
+        LogError("Failure sizing session file %s, errno: %d", path, errno);
+        (void)close(fd);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        if (store->fd >= 0)
+        {
+            (void)close(store->fd);
+        }
+        store->fd = fd;
+        result = 0;
+    }
+    return result;
+}
+
+// Rebuilds the index from the log, the newest record of a key wins and a remove drops it
+static void file_scan_log(FILE_STORE* store)
+{
+    size_t offset = FILE_STORE_HEADER_SIZE;
+    FILE_RECORD_HEADER header;
+    const uint8_t* data;
+
+    store->liveBytes = 0;
+    while (file_read_record(store, offset, &header, &data))
+    {
+        uint32_t key = get_record_key((MQTT_SESSION_RECORD_TYPE)header.recordType, header.packetId);
+        size_t previous;
+        if (index_remove(&store->index, key, &previous))
+        {
+            FILE_RECORD_HEADER previousHeader;
+            (void)memcpy(&previousHeader, store->map + previous, sizeof(previousHeader));
+            store->liveBytes -= file_record_size(previousHeader.length);
+        }
+        if (header.op == FILE_RECORD_OP_SAVE && index_set(&store->index, key, offset) == 0)
+        {
+            store->liveBytes += file_record_size(header.length);
+        }
+        offset += file_record_size(header.length);
+    }
+
+    // Anything after the last good record is a torn write and whatever it cut off, clear all of it
+    // so appends that reach an older record can't bring it back on the next scan
+    if (offset < store->capacity)
+    {
+        size_t dirty = offset;
+        while (dirty < store->capacity && store->map[dirty] == 0)
+        {
+            dirty++;
+        }
+        if (dirty < store->capacity)
+        {
+            LogInfo("Discarding torn session record at offset %lu", (unsigned long)offset);
+            (void)memset(store->map + offset, 0, store->capacity - offset);
+            file_sync_range(store, offset, store->capacity - offset);
+        }
+    }
+    store->writeOffset = offset;
+}
+
+static int file_compact(FILE_STORE* store)
+{
+    int result;
+    size_t pathLength = strlen(store->path);
+    char* tempPath = (char*)malloc(pathLength + 5);
+    if (tempPath == NULL)
+    {
+        LogError("Failure allocating compaction path");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        FILE_STORE compacted;
+        size_t capacity = FILE_STORE_INITIAL_CAPACITY;
+
+        (void)memcpy(tempPath, store->path, pathLength);
+        (void)memcpy(tempPath + pathLength, ".tmp", 5);
+        while (capacity < FILE_STORE_HEADER_SIZE + store->liveBytes)
+        {
+            capacity *= 2;
+        }
+
+        (void)memset(&compacted, 0, sizeof(compacted));
+        compacted.fd = -1;
+        // A path.tmp left by a crashed compaction may hold records past the new end, start it empty
+        if (file_open_log(&compacted, tempPath, capacity, true) != 0)
+        {
+            result = MU_FAILURE;
+        }
+        else
+        {
+            size_t offset = FILE_STORE_HEADER_SIZE;
+            size_t target = FILE_STORE_HEADER_SIZE;
+            FILE_RECORD_HEADER header;
+            const uint8_t* data;
+
+            // Live records are copied in log order, so loading keeps the order they were saved in
+            (void)memcpy(compacted.map, store->map, FILE_STORE_HEADER_SIZE);
+            while (offset < store->writeOffset && file_read_record(store, offset, &header, &data))
+            {
+                size_t recordSize = file_record_size(header.length);
+                uint32_t key = get_record_key((MQTT_SESSION_RECORD_TYPE)header.recordType, header.packetId);
+                size_t live;
+                if (header.op == FILE_RECORD_OP_SAVE && index_find(&store->index, key, &live) && live == offset)
+                {
+                    (void)memcpy(compacted.map + target, store->map + offset, recordSize);
+                    (void)index_set(&store->index, key, target);
+                    target += recordSize;
+                }
+                offset += recordSize;
+            }
+
+            if (msync(compacted.map, target, MS_SYNC) != 0 || rename(tempPath, store->path) != 0)
+            {
+                LogError("Failure replacing session file %s, errno: %d", store->path, errno);
+                (void)munmap(compacted.map, compacted.capacity);
+                (void)close(compacted.fd);
+                (void)unlink(tempPath);
+                // The index now points into the compacted copy, rebuild it from the old log
+                index_deinit(&store->index);
+                if (index_init(&store->index, INDEX_INITIAL_SIZE) == 0)
+                {
+                    file_scan_log(store);
+                }
+                result = MU_FAILURE;
+            }
+            else
+            {
+                (void)munmap(store->map, store->capacity);
+                (void)close(store->fd);
+                store->map = compacted.map;
+                store->capacity = compacted.capacity;
+                store->fd = compacted.fd;
+                store->writeOffset = target;
+                result = 0;
+            }
+        }
+        free(tempPath);
+    }
+    return result;
+}
+
+// True when the file at path starts with the store magic
+static bool file_has_magic(const char* path)
+{
+    bool result = false;
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        char magic[FILE_STORE_MAGIC_SIZE];
+        result = (read(fd, magic, FILE_STORE_MAGIC_SIZE) == FILE_STORE_MAGIC_SIZE && memcmp(magic, FILE_STORE_MAGIC, FILE_STORE_MAGIC_SIZE) == 0);
+        (void)close(fd);
+    }
+    return result;
+}
+
+static void file_compact_if_needed(FILE_STORE* store)
+{
+    size_t staleBytes = store->writeOffset - FILE_STORE_HEADER_SIZE - store->liveBytes;
+    if (staleBytes >= store->compactMinBytes && staleBytes > store->liveBytes)
+    {
+        if (file_compact(store) != 0)
+        {
+            LogError("Failure compacting session file %s", store->path);
+        }
+    }
+}
+
+static CONCRETE_SESSION_STORE_HANDLE file_store_create(const void* parameters)
+{
+    FILE_STORE* result;
+    const MQTT_SESSION_STORE_FILE_OPTIONS* options = (const MQTT_SESSION_STORE_FILE_OPTIONS*)parameters;
+    if (options == NULL || options->path == NULL)
+    {
+        LogError("Invalid parameter specified options: %p", options);
+        result = NULL;
+    }
+    else if ((result = (FILE_STORE*)malloc(sizeof(FILE_STORE))) == NULL)
+    {
+        LogError("Failure allocating file session store");
+    }
+    else
+    {
+        size_t pathLength = strlen(options->path);
+        struct stat fileStat;
+
+        (void)memset(result, 0, sizeof(FILE_STORE));
+        result->fd = -1;
+        result->compactMinBytes = (options->compactMinBytes == 0) ? FILE_STORE_DEFAULT_COMPACT_SIZE : options->compactMinBytes;
+        result->syncOnWrite = options->syncOnWrite;
+
+        if ((result->path = (char*)malloc(pathLength + 1)) == NULL ||
+            index_init(&result->index, INDEX_INITIAL_SIZE) != 0)
+        {
+            LogError("Failure allocating file session store");
+            free(result->path);
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            size_t capacity = FILE_STORE_INITIAL_CAPACITY;
+            bool isExisting = false;
+            (void)memcpy(result->path, options->path, pathLength + 1);
+            if (stat(options->path, &fileStat) == 0)
+            {
+                isExisting = (fileStat.st_size > 0);
+                if ((size_t)fileStat.st_size > capacity)
+                {
+                    capacity = (size_t)fileStat.st_size;
+                }
+            }
+
+            if (isExisting && !file_has_magic(options->path))
+            {
+                /*Codes_SRS_MQTT_SESSION_STORE_07_017: [The file backend shall fail to create when path names a file that is not empty and does not start with the store header, leaving the file untouched.]*/
+                LogError("File %s exists and is not a session store", options->path);
+                index_deinit(&result->index);
+                free(result->path);
+                free(result);
+                result = NULL;
+            }
+            else if (file_open_log(result, options->path, capacity, false) != 0)
+            {
+                index_deinit(&result->index);
+                free(result->path);
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                if (memcmp(result->map, FILE_STORE_MAGIC, FILE_STORE_MAGIC_SIZE) != 0)
+                {
+                    // New file, start an empty log
+                    (void)memset(result->map, 0, result->capacity);
+                    (void)memcpy(result->map, FILE_STORE_MAGIC, FILE_STORE_MAGIC_SIZE);
+                    file_sync_range(result, 0, FILE_STORE_HEADER_SIZE);
+                }
+                file_scan_log(result);
+            }
+        }
+    }
+    return result;
+}
+
+static void file_store_destroy(CONCRETE_SESSION_STORE_HANDLE concrete_store)
+{
+    FILE_STORE* store = (FILE_STORE*)concrete_store;
+    (void)msync(store->map, store->writeOffset, MS_ASYNC);
+    (void)munmap(store->map, store->capacity);
+    (void)close(store->fd);
+    index_deinit(&store->index);
+    free(store->path);
+    free(store);
+}
+
+static int file_store_save(CONCRETE_SESSION_STORE_HANDLE concrete_store, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId, const uint8_t* data, size_t length)
+{
+    int result;
+    FILE_STORE* store = (FILE_STORE*)concrete_store;
+    uint32_t key = get_record_key(recordType, packetId);
+    size_t previous;
+    size_t offset;
+
+    if (file_append_record(store, FILE_RECORD_OP_SAVE, recordType, packetId, data, length, &offset) != 0)
+    {
+        result = MU_FAILURE;
+    }
+    else
+    {
+        if (index_find(&store->index, key, &previous))
+        {
+            FILE_RECORD_HEADER previousHeader;
+            (void)memcpy(&previousHeader, store->map + previous, sizeof(previousHeader));
+            store->liveBytes -= file_record_size(previousHeader.length);
+        }
+
+        if (index_set(&store->index, key, offset) != 0)
+        {
+            // The record is on disk but can't be indexed, drop it so memory and file agree
+            store->writeOffset = offset;
+            (void)memset(store->map + offset, 0, FILE_RECORD_HEADER_SIZE);
+            if (index_find(&store->index, key, &previous))
+            {
+                FILE_RECORD_HEADER previousHeader;
+                (void)memcpy(&previousHeader, store->map + previous, sizeof(previousHeader));
+                store->liveBytes += file_record_size(previousHeader.length);
+            }
+            result = MU_FAILURE;
+        }
+        else
+        {
+            store->liveBytes += file_record_size(length);
+            file_compact_if_needed(store);
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static int file_store_remove(CONCRETE_SESSION_STORE_HANDLE concrete_store, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId)
+{
+    int result;
+    FILE_STORE* store = (FILE_STORE*)concrete_store;
+    uint32_t key = get_record_key(recordType, packetId);
+    size_t previous;
+
+    if (!index_find(&store->index, key, &previous))
+    {
+        result = 0;
+    }
+    else
+    {
+        size_t offset;
+        if (file_append_record(store, FILE_RECORD_OP_REMOVE, recordType, packetId, NULL, 0, &offset) != 0)
+        {
+            result = MU_FAILURE;
+        }
+        else
+        {
+            FILE_RECORD_HEADER previousHeader;
+            (void)memcpy(&previousHeader, store->map + previous, sizeof(previousHeader));
+            store->liveBytes -= file_record_size(previousHeader.length);
+            (void)index_remove(&store->index, key, NULL);
+            file_compact_if_needed(store);
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static int file_store_load(CONCRETE_SESSION_STORE_HANDLE concrete_store, ON_SESSION_RECORD_LOADED onRecordLoaded, void* context)
+{
+    FILE_STORE* store = (FILE_STORE*)concrete_store;
+    size_t offset = FILE_STORE_HEADER_SIZE;
+    FILE_RECORD_HEADER header;
+    const uint8_t* data;
+
+    while (offset < store->writeOffset && file_read_record(store, offset, &header, &data))
+    {
+        size_t live;
+        if (header.op == FILE_RECORD_OP_SAVE &&
+            index_find(&store->index, get_record_key((MQTT_SESSION_RECORD_TYPE)header.recordType, header.packetId), &live) && live == offset)
+        {
+            onRecordLoaded(context, (MQTT_SESSION_RECORD_TYPE)header.recordType, header.packetId, data, header.length);
+        }
+        offset += file_record_size(header.length);
+    }
+    return 0;
+}
+
+static int file_store_clear(CONCRETE_SESSION_STORE_HANDLE concrete_store)
+{
+    FILE_STORE* store = (FILE_STORE*)concrete_store;
+    (void)memset(store->map + FILE_STORE_HEADER_SIZE, 0, store->writeOffset - FILE_STORE_HEADER_SIZE);
+    file_sync_range(store, 0, store->writeOffset);
+    store->writeOffset = FILE_STORE_HEADER_SIZE;
+    store->liveBytes = 0;
+    store->index.count = 0;
+    (void)memset(store->index.keys, 0, (store->index.mask + 1) * sizeof(uint32_t));
+    return 0;
+}
+
+static const MQTT_SESSION_STORE_INTERFACE_DESCRIPTION file_store_interface_description =
+{
+    file_store_create,
+    file_store_destroy,
+    file_store_save,
+    file_store_remove,
+    file_store_load,
+    file_store_clear
+};
+#endif // _WIN32
+
+MQTT_SESSION_STORE_HANDLE mqtt_session_store_create(const MQTT_SESSION_STORE_INTERFACE_DESCRIPTION* interfaceDescription, const void* parameters)
+{
+    MQTT_SESSION_STORE_INSTANCE* result;
+    if (interfaceDescription == NULL ||
+        interfaceDescription->concrete_store_create == NULL ||
+        interfaceDescription->concrete_store_destroy == NULL ||
+        interfaceDescription->concrete_store_save == NULL ||
+        interfaceDescription->concrete_store_remove == NULL ||
+        interfaceDescription->concrete_store_load == NULL ||
+        interfaceDescription->concrete_store_clear == NULL)
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_001: [If interfaceDescription is NULL or any of its functions is NULL then mqtt_session_store_create shall return NULL.] */
+        LogError("Invalid parameter specified interfaceDescription: %p", interfaceDescription);
+        result = NULL;
+    }
+    else if ((result = (MQTT_SESSION_STORE_INSTANCE*)malloc(sizeof(MQTT_SESSION_STORE_INSTANCE))) == NULL)
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_002: [If any failure is encountered then mqtt_session_store_create shall return NULL.] */
+        LogError("Failure allocating session store");
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_003: [mqtt_session_store_create shall create the backend by calling concrete_store_create with parameters.] */
+        result->interfaceDescription = interfaceDescription;
+        result->concreteStore = interfaceDescription->concrete_store_create(parameters);
+        if (result->concreteStore == NULL)
+        {
+            /* Codes_SRS_MQTT_SESSION_STORE_07_002: [If any failure is encountered then mqtt_session_store_create shall return NULL.] */
+            LogError("Failure creating session store backend");
+            free(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+void mqtt_session_store_destroy(MQTT_SESSION_STORE_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_SESSION_STORE_07_004: [If handle is NULL then mqtt_session_store_destroy shall do nothing.] */
+    if (handle != NULL)
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_005: [mqtt_session_store_destroy shall destroy the backend and free the handle, stored records are kept by persistent backends.] */
+        handle->interfaceDescription->concrete_store_destroy(handle->concreteStore);
+        free(handle);
+    }
+}
+
+int mqtt_session_store_save(MQTT_SESSION_STORE_HANDLE handle, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId, const uint8_t* data, size_t length)
+{
+    int result;
+    if (handle == NULL || !is_valid_record_type(recordType) || packetId == 0 || (data == NULL && length > 0))
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_006: [If handle is NULL, recordType is not valid, packetId is 0 or data is NULL while length is not 0 then mqtt_session_store_save shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, recordType: %d, packetId: %d, data: %p", handle, (int)recordType, (int)packetId, data);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_007: [mqtt_session_store_save shall store the record through concrete_store_save, replacing the record of the same packet id.] */
+        result = handle->interfaceDescription->concrete_store_save(handle->concreteStore, recordType, packetId, data, length);
+    }
+    return result;
+}
+
+int mqtt_session_store_remove(MQTT_SESSION_STORE_HANDLE handle, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId)
+{
+    int result;
+    if (handle == NULL || !is_valid_record_type(recordType))
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_008: [If handle is NULL or recordType is not valid then mqtt_session_store_remove shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, recordType: %d", handle, (int)recordType);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_009: [mqtt_session_store_remove shall remove the record of packetId through concrete_store_remove, removing a missing record succeeds.] */
+        result = handle->interfaceDescription->concrete_store_remove(handle->concreteStore, recordType, packetId);
+    }
+    return result;
+}
+
+int mqtt_session_store_load(MQTT_SESSION_STORE_HANDLE handle, ON_SESSION_RECORD_LOADED onRecordLoaded, void* context)
+{
+    int result;
+    if (handle == NULL || onRecordLoaded == NULL)
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_010: [If handle or onRecordLoaded is NULL then mqtt_session_store_load shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, onRecordLoaded: %p", handle, onRecordLoaded);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_011: [mqtt_session_store_load shall call onRecordLoaded for every stored record in the order they were saved.] */
+        result = handle->interfaceDescription->concrete_store_load(handle->concreteStore, onRecordLoaded, context);
+    }
+    return result;
+}
+
+int mqtt_session_store_clear(MQTT_SESSION_STORE_HANDLE handle)
+{
+    int result;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_012: [If handle is NULL then mqtt_session_store_clear shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_SESSION_STORE_07_013: [mqtt_session_store_clear shall remove every stored record through concrete_store_clear.] */
+        result = handle->interfaceDescription->concrete_store_clear(handle->concreteStore);
+    }
+    return result;
+}
+
+const MQTT_SESSION_STORE_INTERFACE_DESCRIPTION* mqtt_session_store_memory_get_interface_description(void)
+{
+    /* Codes_SRS_MQTT_SESSION_STORE_07_014: [mqtt_session_store_memory_get_interface_description shall return the interface of the in-memory backend.] */
+    return &memory_store_interface_description;
+}
+
+const MQTT_SESSION_STORE_INTERFACE_DESCRIPTION* mqtt_session_store_file_get_interface_description(void)
+{
+#ifdef _WIN32
+    /* Codes_SRS_MQTT_SESSION_STORE_07_016: [On platforms without mmap mqtt_session_store_file_get_interface_description shall return NULL.] */
+    LogError("The memory mapped session store is not available on this platform");
+    return NULL;
+#else
+    /* Codes_SRS_MQTT_SESSION_STORE_07_015: [mqtt_session_store_file_get_interface_description shall return the interface of the memory mapped file backend.] */
+    return &file_store_interface_description;
+#endif
+}
@@ -0,0 +1,149 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_submit_queue.h"
+
+// Pointer operations producers and the consumer share, everything else is only touched by one thread
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SUBMIT_EXCHANGE_PTR(target, value)  _InterlockedExchangePointer((void* volatile*)(target), (value))
+#define SUBMIT_LOAD_PTR(target)             _InterlockedCompareExchangePointer((void* volatile*)(target), NULL, NULL)
+#define SUBMIT_STORE_PTR(target, value)     (void)_InterlockedExchangePointer((void* volatile*)(target), (value))
+#else
+#define SUBMIT_EXCHANGE_PTR(target, value)  __atomic_exchange_n((target), (value), __ATOMIC_ACQ_REL)
+#define SUBMIT_LOAD_PTR(target)             __atomic_load_n((target), __ATOMIC_ACQUIRE)
+#define SUBMIT_STORE_PTR(target, value)     __atomic_store_n((target), (value), __ATOMIC_RELEASE)
+#endif
+
+typedef struct SUBMIT_NODE_TAG
+{
+    struct SUBMIT_NODE_TAG* next;
+    BUFFER_HANDLE packet;
+} SUBMIT_NODE;
+
+// Nodes are linked from tail, the oldest, to head, the newest. A producer swaps its node in as head
+// and then links the previous head to it, so pushes never wait on each other or on the consumer.
+// The stub node keeps the list from being empty, which lets the consumer hand out the last node.
+typedef struct MQTT_SUBMIT_QUEUE_TAG
+{
+    SUBMIT_NODE* head;
+    SUBMIT_NODE* tail;
+    SUBMIT_NODE stub;
+} MQTT_SUBMIT_QUEUE;
+
+static void link_node(MQTT_SUBMIT_QUEUE* queue, SUBMIT_NODE* node)
+{
+    SUBMIT_NODE* previous;
+    SUBMIT_STORE_PTR(&node->next, (SUBMIT_NODE*)NULL);
+    previous = (SUBMIT_NODE*)SUBMIT_EXCHANGE_PTR(&queue->head, node);
+    // Until this store the consumer sees previous as the last node
+    SUBMIT_STORE_PTR(&previous->next, node);
+}
+
+MQTT_SUBMIT_QUEUE_HANDLE mqtt_submit_queue_create(void)
+{
+    MQTT_SUBMIT_QUEUE* result;
+    if ((result = (MQTT_SUBMIT_QUEUE*)malloc(sizeof(MQTT_SUBMIT_QUEUE))) == NULL)
+    {
+        /* Codes_SRS_MQTT_SUBMIT_QUEUE_07_001: [If any failure is encountered then mqtt_submit_queue_create shall return NULL.] */
+        LogError("Failure allocating submit queue");
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_SUBMIT_QUEUE_07_002: [mqtt_submit_queue_create shall return an empty queue.] */
+        result->stub.next = NULL;
+        result->stub.packet = NULL;
+        result->head = &result->stub;
+        result->tail = &result->stub;
+    }
+    return result;
+}
+
+void mqtt_submit_queue_destroy(MQTT_SUBMIT_QUEUE_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_SUBMIT_QUEUE_07_003: [If handle is NULL then mqtt_submit_queue_destroy shall do nothing.] */
+    if (handle != NULL)
+    {
+        /* Codes_SRS_MQTT_SUBMIT_QUEUE_07_004: [mqtt_submit_queue_destroy shall free every queued packet.] */
+        BUFFER_HANDLE packet;
+        while ((packet = mqtt_submit_queue_pop(handle)) != NULL)
+        {
+            BUFFER_delete(packet);
+        }
+        free(handle);
+    }
+}
+
+int mqtt_submit_queue_push(MQTT_SUBMIT_QUEUE_HANDLE handle, BUFFER_HANDLE packet)
+{
+    int result;
+    SUBMIT_NODE* node;
+    if (handle == NULL || packet == NULL)
+    {
+        /* Codes_SRS_MQTT_SUBMIT_QUEUE_07_005: [If handle or packet is NULL then mqtt_submit_queue_push shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, packet: %p", handle, packet);
+        result = MU_FAILURE;
+    }
+    else if ((node = (SUBMIT_NODE*)malloc(sizeof(SUBMIT_NODE))) == NULL)
+    {
+        /* Codes_SRS_MQTT_SUBMIT_QUEUE_07_006: [If any failure is encountered then mqtt_submit_queue_push shall return a non-zero value and leave packet to the caller.] */
+        LogError("Failure allocating submit queue node");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_SUBMIT_QUEUE_07_007: [mqtt_submit_queue_push shall append packet without taking a lock, from any number of threads at once.] */
+        node->packet = packet;
+        link_node(handle, node);
+        result = 0;
+    }
+    return result;
+}
+
+BUFFER_HANDLE mqtt_submit_queue_pop(MQTT_SUBMIT_QUEUE_HANDLE handle)
+{
+    BUFFER_HANDLE result = NULL;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_SUBMIT_QUEUE_07_008: [If handle is NULL then mqtt_submit_queue_pop shall return NULL.] */
+        LogError("Invalid parameter specified handle: %p", handle);
+    }
+    else
+    {
+        SUBMIT_NODE* tail = handle->tail;
+        SUBMIT_NODE* next = (SUBMIT_NODE*)SUBMIT_LOAD_PTR(&tail->next);
+
+        if (tail == &handle->stub)
+        {
+            // Skip the stub, it holds no packet
+            tail = next;
+            if (next != NULL)
+            {
+                handle->tail = next;
+                next = (SUBMIT_NODE*)SUBMIT_LOAD_PTR(&next->next);
+            }
+        }
+
+        if (tail != NULL && next == NULL && tail == SUBMIT_LOAD_PTR(&handle->head))
+        {
+            // tail is the newest node, the stub goes behind it so it can be handed out
+            link_node(handle, &handle->stub);
+            next = (SUBMIT_NODE*)SUBMIT_LOAD_PTR(&tail->next);
+        }
+
+        /* Codes_SRS_MQTT_SUBMIT_QUEUE_07_010: [If no packet is ready, including while a push that came first is still linking its packet, mqtt_submit_queue_pop shall return NULL.] */
+        if (tail != NULL && next != NULL)
+        {
+            /* Codes_SRS_MQTT_SUBMIT_QUEUE_07_009: [mqtt_submit_queue_pop shall remove and return the oldest packet, keeping the order in which each thread pushed its packets.] */
+            handle->tail = next;
+            result = tail->packet;
+            free(tail);
+        }
+    }
+    return result;
+}
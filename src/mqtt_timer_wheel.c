@@ -0,0 +1,373 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_timer_wheel.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#pragma intrinsic(_BitScanForward64)
+#endif
+
+// Level n has 64 slots of 64^n milliseconds each, so 4 levels reach 2^24 milliseconds, about 4.6 hours.
+// Timers further out wait in the farthest slot and are placed again when it comes up.
+#define WHEEL_LEVEL_BITS    6
+#define WHEEL_SLOT_COUNT    ((size_t)1 << WHEEL_LEVEL_BITS)
+#define WHEEL_SLOT_MASK     (WHEEL_SLOT_COUNT - 1)
+#define WHEEL_LEVEL_COUNT   4
+#define WHEEL_SPAN_MS       ((tickcounter_ms_t)1 << (WHEEL_LEVEL_BITS * WHEEL_LEVEL_COUNT))
+// Holds the timers that were already due when they were scheduled
+#define WHEEL_EXPIRED_SLOT  (WHEEL_LEVEL_COUNT * WHEEL_SLOT_COUNT)
+
+// Every slot is a circular list whose head is an unused timer. occupied has a bit per slot that is
+// not empty, which lets the wheel skip to the next slot with timers instead of stepping through time.
+typedef struct MQTT_TIMER_WHEEL_TAG
+{
+    tickcounter_ms_t nextMs;
+    uint64_t occupied[WHEEL_LEVEL_COUNT];
+    MQTT_TIMER slots[WHEEL_EXPIRED_SLOT + 1];
+} MQTT_TIMER_WHEEL;
+
+static unsigned int find_first_bit(uint64_t bits)
+{
+#if defined(_MSC_VER)
+    unsigned long result;
+    (void)_BitScanForward64(&result, bits);
+    return (unsigned int)result;
+#else
+    return (unsigned int)__builtin_ctzll(bits);
+#endif
+}
+
+static void init_list(MQTT_TIMER* head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static bool is_list_empty(const MQTT_TIMER* head)
+{
+    return head->next == head;
+}
+
+static void append_timer(MQTT_TIMER* head, MQTT_TIMER* timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void unlink_timer(MQTT_TIMER* timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+// Appends every timer of from to to and leaves from empty
+static void move_list(MQTT_TIMER* from, MQTT_TIMER* to)
+{
+    if (!is_list_empty(from))
+    {
+        from->next->prev = to->prev;
+        to->prev->next = from->next;
+        from->prev->next = to;
+        to->prev = from->prev;
+        init_list(from);
+    }
+}
+
+static void place_timer(MQTT_TIMER_WHEEL* wheel, MQTT_TIMER* timer)
+{
+    size_t slot;
+    if (timer->dueMs < wheel->nextMs)
+    {
+        slot = WHEEL_EXPIRED_SLOT;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_008: [mqtt_timer_wheel_schedule shall place timer in the first of 4 levels of 64 slots that reaches dueMs, where a slot of level n spans 64^n milliseconds, and a timer beyond the last level in its farthest slot.] */
+        tickcounter_ms_t delta = timer->dueMs - wheel->nextMs;
+        tickcounter_ms_t slotMs = (delta < WHEEL_SPAN_MS) ? timer->dueMs : wheel->nextMs + WHEEL_SPAN_MS - 1;
+        size_t level = 0;
+        while (level < WHEEL_LEVEL_COUNT - 1 && (delta >> (WHEEL_LEVEL_BITS * (level + 1))) != 0)
+        {
+            level++;
+        }
+        slot = (size_t)((slotMs >> (WHEEL_LEVEL_BITS * level)) & WHEEL_SLOT_MASK);
+        wheel->occupied[level] |= (uint64_t)1 << slot;
+        slot += level * WHEEL_SLOT_COUNT;
+    }
+    timer->slot = slot;
+    append_timer(&wheel->slots[slot], timer);
+}
+
+// The time of the next slot that has timers to expire or to move to a lower level
+static bool get_next_slot_ms(const MQTT_TIMER_WHEEL* wheel, tickcounter_ms_t* slotMs)
+{
+    bool result = false;
+    size_t level;
+    for (level = 0; level < WHEEL_LEVEL_COUNT; level++)
+    {
+        uint64_t occupied = wheel->occupied[level];
+        if (occupied != 0)
+        {
+            unsigned int shift = (unsigned int)(WHEEL_LEVEL_BITS * level);
+            tickcounter_ms_t units = wheel->nextMs >> shift;
+            unsigned int index = (unsigned int)(units & WHEEL_SLOT_MASK);
+            unsigned int distance;
+            tickcounter_ms_t candidate;
+
+            // Rotated so that bit 0 is the slot of nextMs
+            if (index != 0)
+            {
+                occupied = (occupied >> index) | (occupied << (WHEEL_SLOT_COUNT - index));
+            }
+            // Past the start of its slot the wheel comes back to that slot only after a full turn
+            if ((wheel->nextMs & (((tickcounter_ms_t)1 << shift) - 1)) != 0 && (occupied & 1) != 0)
+            {
+                occupied &= ~(uint64_t)1;
+                distance = (occupied == 0) ? (unsigned int)WHEEL_SLOT_COUNT : find_first_bit(occupied);
+            }
+            else
+            {
+                distance = find_first_bit(occupied);
+            }
+
+            candidate = (units + distance) << shift;
+            if (!result || candidate < *slotMs)
+            {
+                *slotMs = candidate;
+                result = true;
+            }
+        }
+    }
+    return result;
+}
+
+// Runs at the start of a slot of a higher level, whose timers are now close enough for a lower one
+static void cascade_timers(MQTT_TIMER_WHEEL* wheel)
+{
+    size_t level;
+    for (level = WHEEL_LEVEL_COUNT - 1; level > 0; level--)
+    {
+        unsigned int shift = (unsigned int)(WHEEL_LEVEL_BITS * level);
+        if ((wheel->nextMs & (((tickcounter_ms_t)1 << shift) - 1)) == 0)
+        {
+            size_t index = (size_t)((wheel->nextMs >> shift) & WHEEL_SLOT_MASK);
+            if ((wheel->occupied[level] & ((uint64_t)1 << index)) != 0)
+            {
+                MQTT_TIMER cascading;
+                init_list(&cascading);
+                move_list(&wheel->slots[level * WHEEL_SLOT_COUNT + index], &cascading);
+                wheel->occupied[level] &= ~((uint64_t)1 << index);
+                /* Codes_SRS_MQTT_TIMER_WHEEL_07_013: [When the wheel reaches the start of a slot of a higher level mqtt_timer_wheel_advance shall place the timers of that slot again.] */
+                while (!is_list_empty(&cascading))
+                {
+                    MQTT_TIMER* timer = cascading.next;
+                    unlink_timer(timer);
+                    place_timer(wheel, timer);
+                }
+            }
+        }
+    }
+}
+
+// Timers scheduled by the callbacks go back into the wheel, not into expiring
+static size_t expire_timers(MQTT_TIMER* expiring)
+{
+    size_t result = 0;
+    while (!is_list_empty(expiring))
+    {
+        MQTT_TIMER* timer = expiring->next;
+        unlink_timer(timer);
+        timer->onExpired(timer->context);
+        result++;
+    }
+    return result;
+}
+
+MQTT_TIMER_WHEEL_HANDLE mqtt_timer_wheel_create(tickcounter_ms_t currentMs)
+{
+    MQTT_TIMER_WHEEL* result;
+    if ((result = (MQTT_TIMER_WHEEL*)malloc(sizeof(MQTT_TIMER_WHEEL))) == NULL)
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_001: [If any failure is encountered then mqtt_timer_wheel_create shall return NULL.] */
+        LogError("Failure allocating timer wheel");
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_002: [mqtt_timer_wheel_create shall return an empty wheel whose current time is currentMs.] */
+        size_t slot;
+        size_t level;
+        for (slot = 0; slot <= WHEEL_EXPIRED_SLOT; slot++)
+        {
+            init_list(&result->slots[slot]);
+        }
+        for (level = 0; level < WHEEL_LEVEL_COUNT; level++)
+        {
+            result->occupied[level] = 0;
+        }
+        result->nextMs = currentMs + 1;
+    }
+    return result;
+}
+
+void mqtt_timer_wheel_destroy(MQTT_TIMER_WHEEL_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_TIMER_WHEEL_07_003: [If handle is NULL then mqtt_timer_wheel_destroy shall do nothing.] */
+    if (handle != NULL)
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_004: [mqtt_timer_wheel_destroy shall unschedule every timer still on the wheel without calling it and free the wheel.] */
+        size_t slot;
+        for (slot = 0; slot <= WHEEL_EXPIRED_SLOT; slot++)
+        {
+            while (!is_list_empty(&handle->slots[slot]))
+            {
+                unlink_timer(handle->slots[slot].next);
+            }
+        }
+        free(handle);
+    }
+}
+
+int mqtt_timer_wheel_schedule(MQTT_TIMER_WHEEL_HANDLE handle, MQTT_TIMER* timer, tickcounter_ms_t dueMs, ON_MQTT_TIMER_EXPIRED onExpired, void* context)
+{
+    int result;
+    if (handle == NULL || timer == NULL || onExpired == NULL)
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_005: [If handle, timer or onExpired is NULL then mqtt_timer_wheel_schedule shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, timer: %p, onExpired: %p", handle, timer, onExpired);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_006: [mqtt_timer_wheel_schedule shall schedule timer to call onExpired with context once the wheel is advanced to dueMs, moving it if it is already scheduled, and return 0.] */
+        mqtt_timer_wheel_cancel(handle, timer);
+        timer->dueMs = dueMs;
+        timer->onExpired = onExpired;
+        timer->context = context;
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_007: [A timer whose dueMs is not after the current time of the wheel shall expire on the next mqtt_timer_wheel_advance.] */
+        place_timer(handle, timer);
+        result = 0;
+    }
+    return result;
+}
+
+void mqtt_timer_wheel_cancel(MQTT_TIMER_WHEEL_HANDLE handle, MQTT_TIMER* timer)
+{
+    /* Codes_SRS_MQTT_TIMER_WHEEL_07_009: [If handle or timer is NULL, or timer is not scheduled, then mqtt_timer_wheel_cancel shall do nothing.] */
+    if (handle != NULL && timer != NULL && timer->next != NULL)
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_010: [mqtt_timer_wheel_cancel shall unschedule timer without calling it.] */
+        size_t slot = timer->slot;
+        unlink_timer(timer);
+        // A timer that is expiring is no longer in its slot, which may hold other timers by now
+        if (slot < WHEEL_EXPIRED_SLOT && is_list_empty(&handle->slots[slot]))
+        {
+            handle->occupied[slot / WHEEL_SLOT_COUNT] &= ~((uint64_t)1 << (slot % WHEEL_SLOT_COUNT));
+        }
+    }
+}
+
+size_t mqtt_timer_wheel_advance(MQTT_TIMER_WHEEL_HANDLE handle, tickcounter_ms_t currentMs)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_011: [If handle is NULL then mqtt_timer_wheel_advance shall return 0.] */
+        LogError("Invalid parameter specified handle: NULL");
+        result = 0;
+    }
+    else
+    {
+        MQTT_TIMER expiring;
+        tickcounter_ms_t slotMs;
+
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_012: [mqtt_timer_wheel_advance shall unschedule and call onExpired with its context for every timer whose dueMs is not after currentMs, and return the number of timers that expired.] */
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_015: [Timers shall expire in the order of their dueMs, timers that were scheduled when they were already due first.] */
+        init_list(&expiring);
+        move_list(&handle->slots[WHEEL_EXPIRED_SLOT], &expiring);
+        result = expire_timers(&expiring);
+
+        while (get_next_slot_ms(handle, &slotMs) && slotMs <= currentMs)
+        {
+            size_t index = (size_t)(slotMs & WHEEL_SLOT_MASK);
+            handle->nextMs = slotMs;
+            cascade_timers(handle);
+            if ((handle->occupied[0] & ((uint64_t)1 << index)) != 0)
+            {
+                move_list(&handle->slots[index], &expiring);
+                handle->occupied[0] &= ~((uint64_t)1 << index);
+            }
+            handle->nextMs = slotMs + 1;
+            result += expire_timers(&expiring);
+        }
+
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_014: [mqtt_timer_wheel_advance shall set the current time of the wheel to currentMs, a currentMs before the current time leaves it unchanged.] */
+        if (currentMs >= handle->nextMs)
+        {
+            handle->nextMs = currentMs + 1;
+        }
+    }
+    return result;
+}
+
+uint32_t mqtt_timer_wheel_get_timeout(MQTT_TIMER_WHEEL_HANDLE handle, tickcounter_ms_t currentMs)
+{
+    uint32_t result;
+    tickcounter_ms_t slotMs;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_016: [If handle is NULL then mqtt_timer_wheel_get_timeout shall return UINT32_MAX.] */
+        LogError("Invalid parameter specified handle: NULL");
+        result = UINT32_MAX;
+    }
+    /* Codes_SRS_MQTT_TIMER_WHEEL_07_017: [mqtt_timer_wheel_get_timeout shall return the milliseconds from currentMs until mqtt_timer_wheel_advance has timers to expire or to place again, 0 once it has, or UINT32_MAX if no timer is scheduled.] */
+    else if (!is_list_empty(&handle->slots[WHEEL_EXPIRED_SLOT]))
+    {
+        result = 0;
+    }
+    else if (!get_next_slot_ms(handle, &slotMs))
+    {
+        result = UINT32_MAX;
+    }
+    else if (slotMs <= currentMs)
+    {
+        result = 0;
+    }
+    else if (slotMs - currentMs >= UINT32_MAX)
+    {
+        result = UINT32_MAX - 1;
+    }
+    else
+    {
+        result = (uint32_t)(slotMs - currentMs);
+    }
+    return result;
+}
+
+tickcounter_ms_t mqtt_timer_wheel_get_current_ms(MQTT_TIMER_WHEEL_HANDLE handle)
+{
+    tickcounter_ms_t result;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_018: [If handle is NULL then mqtt_timer_wheel_get_current_ms shall return 0.] */
+        LogError("Invalid parameter specified handle: NULL");
+        result = 0;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TIMER_WHEEL_07_019: [mqtt_timer_wheel_get_current_ms shall return the current time of the wheel.] */
+        result = handle->nextMs - 1;
+    }
+    return result;
+}
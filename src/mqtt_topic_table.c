@@ -0,0 +1,308 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_topic_table.h"
+
+#define SINGLE_LEVEL_WILDCARD           '+'
+#define MULTI_LEVEL_WILDCARD            '#'
+#define TOPIC_LENGTH_PREFIX_SIZE        2
+#define MAX_TOPIC_NAME_LENGTH           0xFFFF
+#define TOPIC_TABLE_INITIAL_SIZE        8
+
+// The encoded name is allocated together with the topic, right after it: the two length bytes,
+// the name and a zero terminator so the name can be handed out as a C string.
+typedef struct MQTT_TOPIC_TAG
+{
+    uint32_t hash;
+    size_t nameLength;
+    const char* name;
+    const uint8_t* encoded;
+    uint16_t alias;
+} MQTT_TOPIC;
+
+// Open addressed on the name hash, topics are never removed before the table is destroyed
+typedef struct MQTT_TOPIC_TABLE_TAG
+{
+    MQTT_TOPIC** slots;
+    size_t slotMask;
+    size_t count;
+} MQTT_TOPIC_TABLE;
+
+static uint32_t hash_name(const char* name, size_t length)
+{
+    // FNV-1a
+    uint32_t result = 2166136261u;
+    size_t index;
+    for (index = 0; index < length; index++)
+    {
+        result = (result ^ (uint8_t)name[index]) * 16777619u;
+    }
+    return result;
+}
+
+static bool is_valid_topic_name(const char* topicName, size_t length)
+{
+    return length > 0 && length <= MAX_TOPIC_NAME_LENGTH &&
+        memchr(topicName, SINGLE_LEVEL_WILDCARD, length) == NULL && memchr(topicName, MULTI_LEVEL_WILDCARD, length) == NULL;
+}
+
+static MQTT_TOPIC* create_topic(const char* topicName, size_t length, uint32_t hash)
+{
+    MQTT_TOPIC* result = (MQTT_TOPIC*)malloc(sizeof(MQTT_TOPIC) + TOPIC_LENGTH_PREFIX_SIZE + length + 1);
+    if (result == NULL)
+    {
+        LogError("Failure allocating topic");
+    }
+    else
+    {
+        uint8_t* encoded = (uint8_t*)(result + 1);
+        encoded[0] = (uint8_t)(length >> 8);
+        encoded[1] = (uint8_t)(length & 0xFF);
+        (void)memcpy(encoded + TOPIC_LENGTH_PREFIX_SIZE, topicName, length);
+        encoded[TOPIC_LENGTH_PREFIX_SIZE + length] = '\0';
+        result->hash = hash;
+        result->nameLength = length;
+        result->name = (const char*)(encoded + TOPIC_LENGTH_PREFIX_SIZE);
+        result->encoded = encoded;
+        result->alias = 0;
+    }
+    return result;
+}
+
+static MQTT_TOPIC* find_topic(const MQTT_TOPIC_TABLE* table, const char* topicName, size_t length, uint32_t hash)
+{
+    MQTT_TOPIC* result = NULL;
+    if (table->count > 0)
+    {
+        size_t slot = hash & table->slotMask;
+        MQTT_TOPIC* topic;
+        while ((topic = table->slots[slot]) != NULL)
+        {
+            if (topic->hash == hash && topic->nameLength == length && memcmp(topic->name, topicName, length) == 0)
+            {
+                result = topic;
+                break;
+            }
+            slot = (slot + 1) & table->slotMask;
+        }
+    }
+    return result;
+}
+
+static void place_topic(MQTT_TOPIC** slots, size_t slotMask, MQTT_TOPIC* topic)
+{
+    size_t slot = topic->hash & slotMask;
+    while (slots[slot] != NULL)
+    {
+        slot = (slot + 1) & slotMask;
+    }
+    slots[slot] = topic;
+}
+
+static int add_topic(MQTT_TOPIC_TABLE* table, MQTT_TOPIC* topic)
+{
+    int result;
+    size_t capacity = (table->slots == NULL) ? 0 : table->slotMask + 1;
+
+    // Keep the table at most half full so probe runs stay short
+    if ((table->count + 1) * 2 > capacity)
+    {
+        size_t newCapacity = (capacity == 0) ? TOPIC_TABLE_INITIAL_SIZE : capacity * 2;
+        MQTT_TOPIC** newSlots = (MQTT_TOPIC**)malloc(newCapacity * sizeof(MQTT_TOPIC*));
+        if (newSlots == NULL)
+        {
+            LogError("Failure allocating topic table slots");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            size_t index;
+            (void)memset(newSlots, 0, newCapacity * sizeof(MQTT_TOPIC*));
+            for (index = 0; index < capacity; index++)
+            {
+                if (table->slots[index] != NULL)
+                {
+                    place_topic(newSlots, newCapacity - 1, table->slots[index]);
+                }
+            }
+            if (table->slots != NULL)
+            {
+                free(table->slots);
+            }
+            table->slots = newSlots;
+            table->slotMask = newCapacity - 1;
+            result = 0;
+        }
+    }
+    else
+    {
+        result = 0;
+    }
+
+    if (result == 0)
+    {
+        place_topic(table->slots, table->slotMask, topic);
+        table->count++;
+    }
+    return result;
+}
+
+MQTT_TOPIC_TABLE_HANDLE mqtt_topic_table_create(void)
+{
+    MQTT_TOPIC_TABLE* result = (MQTT_TOPIC_TABLE*)malloc(sizeof(MQTT_TOPIC_TABLE));
+    if (result == NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_002: [If any failure is encountered then mqtt_topic_table_create shall return NULL.] */
+        LogError("Failure allocating topic table");
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_001: [mqtt_topic_table_create shall return an empty table.] */
+        result->slots = NULL;
+        result->slotMask = 0;
+        result->count = 0;
+    }
+    return result;
+}
+
+void mqtt_topic_table_destroy(MQTT_TOPIC_TABLE_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_003: [mqtt_topic_table_destroy shall free every interned topic and the table.] */
+        if (handle->slots != NULL)
+        {
+            size_t index;
+            for (index = 0; index <= handle->slotMask; index++)
+            {
+                if (handle->slots[index] != NULL)
+                {
+                    free(handle->slots[index]);
+                }
+            }
+            free(handle->slots);
+        }
+        free(handle);
+    }
+}
+
+MQTT_TOPIC_HANDLE mqtt_topic_table_intern(MQTT_TOPIC_TABLE_HANDLE handle, const char* topicName)
+{
+    MQTT_TOPIC* result;
+    size_t length = (topicName == NULL) ? 0 : strlen(topicName);
+    if (handle == NULL || topicName == NULL || !is_valid_topic_name(topicName, length))
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_004: [If handle or topicName is NULL, or topicName is empty, longer than 65535 bytes or contains a wildcard then mqtt_topic_table_intern shall return NULL.] */
+        LogError("Invalid parameter specified handle: %p, topicName: %p", handle, topicName);
+        result = NULL;
+    }
+    else
+    {
+        uint32_t hash = hash_name(topicName, length);
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_005: [If topicName was interned before then mqtt_topic_table_intern shall return the same topic.] */
+        if ((result = find_topic(handle, topicName, length, hash)) == NULL)
+        {
+            /* Codes_SRS_MQTT_TOPIC_TABLE_07_006: [Otherwise mqtt_topic_table_intern shall add a topic holding topicName and its encoding, the name length as two bytes most significant first followed by the name.] */
+            if ((result = create_topic(topicName, length, hash)) != NULL && add_topic(handle, result) != 0)
+            {
+                /* Codes_SRS_MQTT_TOPIC_TABLE_07_007: [If any failure is encountered then mqtt_topic_table_intern shall return NULL.] */
+                free(result);
+                result = NULL;
+            }
+        }
+    }
+    return result;
+}
+
+size_t mqtt_topic_table_count(MQTT_TOPIC_TABLE_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_TOPIC_TABLE_07_008: [mqtt_topic_table_count shall return the number of interned topics, 0 if handle is NULL.] */
+    return (handle == NULL) ? 0 : handle->count;
+}
+
+const char* mqtt_topic_get_name(MQTT_TOPIC_HANDLE topic, size_t* nameLength)
+{
+    const char* result;
+    if (topic == NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_009: [If topic is NULL then mqtt_topic_get_name shall return NULL.] */
+        LogError("Invalid parameter specified topic: NULL");
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_010: [mqtt_topic_get_name shall return the zero terminated topic name and store its length in nameLength if nameLength is not NULL.] */
+        if (nameLength != NULL)
+        {
+            *nameLength = topic->nameLength;
+        }
+        result = topic->name;
+    }
+    return result;
+}
+
+const uint8_t* mqtt_topic_get_encoded(MQTT_TOPIC_HANDLE topic, size_t* encodedLength)
+{
+    const uint8_t* result;
+    if (topic == NULL || encodedLength == NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_011: [If topic or encodedLength is NULL then mqtt_topic_get_encoded shall return NULL.] */
+        LogError("Invalid parameter specified topic: %p, encodedLength: %p", topic, encodedLength);
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_012: [mqtt_topic_get_encoded shall return the encoded topic name and store the number of encoded bytes in encodedLength.] */
+        *encodedLength = TOPIC_LENGTH_PREFIX_SIZE + topic->nameLength;
+        result = topic->encoded;
+    }
+    return result;
+}
+
+uint16_t mqtt_topic_get_alias(MQTT_TOPIC_HANDLE topic)
+{
+    /* Codes_SRS_MQTT_TOPIC_TABLE_07_013: [mqtt_topic_get_alias shall return the alias last set on topic, 0 if topic is NULL or has no alias.] */
+    return (topic == NULL) ? 0 : topic->alias;
+}
+
+int mqtt_topic_set_alias(MQTT_TOPIC_HANDLE topic, uint16_t alias)
+{
+    int result;
+    if (topic == NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_014: [If topic is NULL then mqtt_topic_set_alias shall return a non-zero value.] */
+        LogError("Invalid parameter specified topic: NULL");
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_015: [mqtt_topic_set_alias shall store alias on topic and return zero.] */
+        topic->alias = alias;
+        result = 0;
+    }
+    return result;
+}
+
+void mqtt_topic_table_clear_aliases(MQTT_TOPIC_TABLE_HANDLE handle)
+{
+    if (handle != NULL && handle->slots != NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TABLE_07_016: [mqtt_topic_table_clear_aliases shall set the alias of every topic in the table to 0.] */
+        size_t index;
+        for (index = 0; index <= handle->slotMask; index++)
+        {
+            if (handle->slots[index] != NULL)
+            {
+                handle->slots[index]->alias = 0;
+            }
+        }
+    }
+}
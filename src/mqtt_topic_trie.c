@@ -0,0 +1,544 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_topic_trie.h"
+
+#define TOPIC_LEVEL_SEPARATOR           '/'
+#define SINGLE_LEVEL_WILDCARD           '+'
+#define MULTI_LEVEL_WILDCARD            '#'
+#define SYSTEM_TOPIC_PREFIX             '$'
+#define CHILD_TABLE_INITIAL_SIZE        4
+
+// One level of a filter. The exact children live in an open addressed table on levelHash,
+// the + and # children have a slot of their own so matching never compares wildcards.
+// The level text is allocated together with the node, right after it.
+typedef struct TOPIC_NODE_TAG
+{
+    struct TOPIC_NODE_TAG** children;
+    size_t childMask;
+    size_t childCount;
+    struct TOPIC_NODE_TAG* singleLevel;
+    struct TOPIC_NODE_TAG* multiLevel;
+    void* value;
+    bool hasValue;
+    uint32_t levelHash;
+    size_t levelLength;
+    const char* level;
+} TOPIC_NODE;
+
+typedef struct MQTT_TOPIC_TRIE_TAG
+{
+    TOPIC_NODE* root;
+    size_t count;
+    ON_MQTT_TOPIC_TRIE_VALUE_DESTROY valueDestroy;
+} MQTT_TOPIC_TRIE;
+
+typedef struct MATCH_STATE_TAG
+{
+    const char* topicEnd;
+    ON_MQTT_TOPIC_TRIE_MATCH onMatch;
+    void* context;
+    size_t count;
+} MATCH_STATE;
+
+static uint32_t hash_level(const char* level, size_t length)
+{
+    // FNV-1a
+    uint32_t result = 2166136261u;
+    size_t index;
+    for (index = 0; index < length; index++)
+    {
+        result = (result ^ (uint8_t)level[index]) * 16777619u;
+    }
+    return result;
+}
+
+static size_t get_level_length(const char* level)
+{
+    const char* iterator = level;
+    while (*iterator != '\0' && *iterator != TOPIC_LEVEL_SEPARATOR)
+    {
+        iterator++;
+    }
+    return (size_t)(iterator - level);
+}
+
+static bool is_valid_filter(const char* topicFilter)
+{
+    bool result = (*topicFilter != '\0');
+    const char* level = topicFilter;
+    while (result)
+    {
+        size_t length = get_level_length(level);
+        size_t index;
+        for (index = 0; index < length && result; index++)
+        {
+            if (level[index] == SINGLE_LEVEL_WILDCARD || level[index] == MULTI_LEVEL_WILDCARD)
+            {
+                // A wildcard has to be the whole level and # the last one
+                result = (length == 1) && (level[index] == SINGLE_LEVEL_WILDCARD || level[length] == '\0');
+            }
+        }
+        if (level[length] == '\0')
+        {
+            break;
+        }
+        level += length + 1;
+    }
+    return result;
+}
+
+static TOPIC_NODE* create_node(const char* level, size_t length)
+{
+    TOPIC_NODE* result = (TOPIC_NODE*)malloc(sizeof(TOPIC_NODE) + length + 1);
+    if (result == NULL)
+    {
+        LogError("Failure allocating topic trie node");
+    }
+    else
+    {
+        char* text = (char*)(result + 1);
+        (void)memcpy(text, level, length);
+        text[length] = '\0';
+        result->children = NULL;
+        result->childMask = 0;
+        result->childCount = 0;
+        result->singleLevel = NULL;
+        result->multiLevel = NULL;
+        result->value = NULL;
+        result->hasValue = false;
+        result->levelHash = hash_level(level, length);
+        result->levelLength = length;
+        result->level = text;
+    }
+    return result;
+}
+
+static void destroy_node(MQTT_TOPIC_TRIE* trie, TOPIC_NODE* node)
+{
+    size_t index;
+    if (node->hasValue && trie->valueDestroy != NULL)
+    {
+        trie->valueDestroy(node->value);
+    }
+    if (node->children != NULL)
+    {
+        for (index = 0; index <= node->childMask; index++)
+        {
+            if (node->children[index] != NULL)
+            {
+                destroy_node(trie, node->children[index]);
+            }
+        }
+        free(node->children);
+    }
+    if (node->singleLevel != NULL)
+    {
+        destroy_node(trie, node->singleLevel);
+    }
+    if (node->multiLevel != NULL)
+    {
+        destroy_node(trie, node->multiLevel);
+    }
+    free(node);
+}
+
+static bool is_node_empty(const TOPIC_NODE* node)
+{
+    return !node->hasValue && node->childCount == 0 && node->singleLevel == NULL && node->multiLevel == NULL;
+}
+
+static TOPIC_NODE* find_child(const TOPIC_NODE* node, const char* level, size_t length, uint32_t hash)
+{
+    TOPIC_NODE* result = NULL;
+    if (node->childCount > 0)
+    {
+        size_t slot = hash & node->childMask;
+        TOPIC_NODE* child;
+        while ((child = node->children[slot]) != NULL)
+        {
+            if (child->levelHash == hash && child->levelLength == length && memcmp(child->level, level, length) == 0)
+            {
+                result = child;
+                break;
+            }
+            slot = (slot + 1) & node->childMask;
+        }
+    }
+    return result;
+}
+
+static void place_child(TOPIC_NODE** children, size_t childMask, TOPIC_NODE* child)
+{
+    size_t slot = child->levelHash & childMask;
+    while (children[slot] != NULL)
+    {
+        slot = (slot + 1) & childMask;
+    }
+    children[slot] = child;
+}
+
+static int add_child(TOPIC_NODE* node, TOPIC_NODE* child)
+{
+    int result;
+    size_t capacity = (node->children == NULL) ? 0 : node->childMask + 1;
+
+    // Keep the table at most half full so probe runs stay short
+    if ((node->childCount + 1) * 2 > capacity)
+    {
+        size_t newCapacity = (capacity == 0) ? CHILD_TABLE_INITIAL_SIZE : capacity * 2;
+        TOPIC_NODE** newChildren = (TOPIC_NODE**)malloc(newCapacity * sizeof(TOPIC_NODE*));
+        if (newChildren == NULL)
+        {
+            LogError("Failure allocating topic trie child table");
+            result = MU_FAILURE;
+        }
+        else
+        {
+            size_t index;
+            (void)memset(newChildren, 0, newCapacity * sizeof(TOPIC_NODE*));
+            for (index = 0; index < capacity; index++)
+            {
+                if (node->children[index] != NULL)
+                {
+                    place_child(newChildren, newCapacity - 1, node->children[index]);
+                }
+            }
+            if (node->children != NULL)
+            {
+                free(node->children);
+            }
+            node->children = newChildren;
+            node->childMask = newCapacity - 1;
+            result = 0;
+        }
+    }
+    else
+    {
+        result = 0;
+    }
+
+    if (result == 0)
+    {
+        place_child(node->children, node->childMask, child);
+        node->childCount++;
+    }
+    return result;
+}
+
+static void remove_child(TOPIC_NODE* node, const TOPIC_NODE* child)
+{
+    size_t slot = child->levelHash & node->childMask;
+    size_t next;
+    while (node->children[slot] != child)
+    {
+        slot = (slot + 1) & node->childMask;
+    }
+    node->children[slot] = NULL;
+    node->childCount--;
+
+    // Shift the rest of the probe run back so no entry ends up behind the hole
+    next = slot;
+    for (;;)
+    {
+        size_t home;
+        next = (next + 1) & node->childMask;
+        if (node->children[next] == NULL)
+        {
+            break;
+        }
+        home = node->children[next]->levelHash & node->childMask;
+        if ((slot <= next) ? (home <= slot || home > next) : (home <= slot && home > next))
+        {
+            node->children[slot] = node->children[next];
+            node->children[next] = NULL;
+            slot = next;
+        }
+    }
+
+    if (node->childCount == 0)
+    {
+        free(node->children);
+        node->children = NULL;
+        node->childMask = 0;
+    }
+}
+
+static TOPIC_NODE* get_filter_child(const TOPIC_NODE* node, const char* level, size_t length)
+{
+    TOPIC_NODE* result;
+    if (length == 1 && level[0] == SINGLE_LEVEL_WILDCARD)
+    {
+        result = node->singleLevel;
+    }
+    else if (length == 1 && level[0] == MULTI_LEVEL_WILDCARD)
+    {
+        result = node->multiLevel;
+    }
+    else
+    {
+        result = find_child(node, level, length, hash_level(level, length));
+    }
+    return result;
+}
+
+static TOPIC_NODE* get_or_add_filter_child(TOPIC_NODE* node, const char* level, size_t length)
+{
+    TOPIC_NODE* result = get_filter_child(node, level, length);
+    if (result == NULL && (result = create_node(level, length)) != NULL)
+    {
+        if (length == 1 && level[0] == SINGLE_LEVEL_WILDCARD)
+        {
+            node->singleLevel = result;
+        }
+        else if (length == 1 && level[0] == MULTI_LEVEL_WILDCARD)
+        {
+            node->multiLevel = result;
+        }
+        else if (add_child(node, result) != 0)
+        {
+            free(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+static void unlink_child(TOPIC_NODE* node, TOPIC_NODE* child)
+{
+    if (node->singleLevel == child)
+    {
+        node->singleLevel = NULL;
+    }
+    else if (node->multiLevel == child)
+    {
+        node->multiLevel = NULL;
+    }
+    else
+    {
+        remove_child(node, child);
+    }
+    // An empty node has no child table left
+    free(child);
+}
+
+// Removes the value stored under the filter levels below node and frees the nodes left empty on the way back
+static int remove_filter(MQTT_TOPIC_TRIE* trie, TOPIC_NODE* node, const char* level)
+{
+    int result;
+    size_t length = get_level_length(level);
+    TOPIC_NODE* child = get_filter_child(node, level, length);
+    if (child == NULL)
+    {
+        result = MU_FAILURE;
+    }
+    else
+    {
+        if (level[length] != '\0')
+        {
+            result = remove_filter(trie, child, level + length + 1);
+        }
+        else if (!child->hasValue)
+        {
+            result = MU_FAILURE;
+        }
+        else
+        {
+            if (trie->valueDestroy != NULL)
+            {
+                trie->valueDestroy(child->value);
+            }
+            child->value = NULL;
+            child->hasValue = false;
+            trie->count--;
+            result = 0;
+        }
+
+        if (is_node_empty(child))
+        {
+            unlink_child(node, child);
+        }
+    }
+    return result;
+}
+
+static void report_match(MATCH_STATE* state, const TOPIC_NODE* node)
+{
+    state->count++;
+    state->onMatch(state->context, node->value);
+}
+
+// level is the next topic level to match below node, or NULL once every level matched
+static void match_levels(MATCH_STATE* state, const TOPIC_NODE* node, const char* level, bool wildcards)
+{
+    if (wildcards && node->multiLevel != NULL && node->multiLevel->hasValue)
+    {
+        // # also matches the parent level, so it matches whatever is left of the topic
+        report_match(state, node->multiLevel);
+    }
+
+    if (level == NULL)
+    {
+        if (node->hasValue)
+        {
+            report_match(state, node);
+        }
+    }
+    else
+    {
+        const char* separator = (const char*)memchr(level, TOPIC_LEVEL_SEPARATOR, (size_t)(state->topicEnd - level));
+        size_t length = (separator == NULL) ? (size_t)(state->topicEnd - level) : (size_t)(separator - level);
+        const char* next = (separator == NULL) ? NULL : separator + 1;
+        const TOPIC_NODE* child = find_child(node, level, length, hash_level(level, length));
+        if (child != NULL)
+        {
+            match_levels(state, child, next, true);
+        }
+        if (wildcards && node->singleLevel != NULL)
+        {
+            match_levels(state, node->singleLevel, next, true);
+        }
+    }
+}
+
+MQTT_TOPIC_TRIE_HANDLE mqtt_topic_trie_create(ON_MQTT_TOPIC_TRIE_VALUE_DESTROY valueDestroy)
+{
+    MQTT_TOPIC_TRIE* result = (MQTT_TOPIC_TRIE*)malloc(sizeof(MQTT_TOPIC_TRIE));
+    if (result == NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TRIE_07_002: [If any failure is encountered then mqtt_topic_trie_create shall return NULL.] */
+        LogError("Failure allocating topic trie");
+    }
+    else if ((result->root = create_node("", 0)) == NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TRIE_07_002: [If any failure is encountered then mqtt_topic_trie_create shall return NULL.] */
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TOPIC_TRIE_07_001: [mqtt_topic_trie_create shall return an empty trie.] */
+        result->count = 0;
+        result->valueDestroy = valueDestroy;
+    }
+    return result;
+}
+
+void mqtt_topic_trie_destroy(MQTT_TOPIC_TRIE_HANDLE handle)
+{
+    if (handle != NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TRIE_07_011: [mqtt_topic_trie_destroy shall destroy every stored value with valueDestroy and free the trie.] */
+        destroy_node(handle, handle->root);
+        free(handle);
+    }
+}
+
+int mqtt_topic_trie_insert(MQTT_TOPIC_TRIE_HANDLE handle, const char* topicFilter, void* value)
+{
+    int result;
+    if (handle == NULL || topicFilter == NULL || !is_valid_filter(topicFilter))
+    {
+        /* Codes_SRS_MQTT_TOPIC_TRIE_07_003: [If handle or topicFilter is NULL, or topicFilter is not a valid MQTT topic filter then mqtt_topic_trie_insert shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, topicFilter: %s", handle, (topicFilter == NULL) ? "NULL" : topicFilter);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        TOPIC_NODE* node = handle->root;
+        const char* level = topicFilter;
+        for (;;)
+        {
+            size_t length = get_level_length(level);
+            if ((node = get_or_add_filter_child(node, level, length)) == NULL || level[length] == '\0')
+            {
+                break;
+            }
+            level += length + 1;
+        }
+
+        if (node == NULL)
+        {
+            /* Codes_SRS_MQTT_TOPIC_TRIE_07_005: [If any failure is encountered then mqtt_topic_trie_insert shall return a non-zero value and not take ownership of value.] */
+            (void)remove_filter(handle, handle->root, topicFilter);
+            result = MU_FAILURE;
+        }
+        else
+        {
+            /* Codes_SRS_MQTT_TOPIC_TRIE_07_004: [mqtt_topic_trie_insert shall store value under topicFilter, replacing and destroying the value stored before for the same filter.] */
+            if (node->hasValue)
+            {
+                if (handle->valueDestroy != NULL && node->value != value)
+                {
+                    handle->valueDestroy(node->value);
+                }
+            }
+            else
+            {
+                handle->count++;
+            }
+            node->value = value;
+            node->hasValue = true;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+int mqtt_topic_trie_remove(MQTT_TOPIC_TRIE_HANDLE handle, const char* topicFilter)
+{
+    int result;
+    if (handle == NULL || topicFilter == NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TRIE_07_006: [If handle or topicFilter is NULL or no value is stored under topicFilter then mqtt_topic_trie_remove shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, topicFilter: %p", handle, topicFilter);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TOPIC_TRIE_07_007: [mqtt_topic_trie_remove shall destroy the value stored under topicFilter and free the levels no other filter uses.] */
+        result = remove_filter(handle, handle->root, topicFilter);
+    }
+    return result;
+}
+
+size_t mqtt_topic_trie_match(MQTT_TOPIC_TRIE_HANDLE handle, const char* topicName, size_t topicLength, ON_MQTT_TOPIC_TRIE_MATCH onMatch, void* context)
+{
+    size_t result;
+    if (handle == NULL || topicName == NULL || onMatch == NULL)
+    {
+        /* Codes_SRS_MQTT_TOPIC_TRIE_07_008: [If handle, topicName or onMatch is NULL then mqtt_topic_trie_match shall return 0.] */
+        LogError("Invalid parameter specified handle: %p, topicName: %p, onMatch: %p", handle, topicName, onMatch);
+        result = 0;
+    }
+    else
+    {
+        MATCH_STATE state;
+        state.topicEnd = topicName + topicLength;
+        state.onMatch = onMatch;
+        state.context = context;
+        state.count = 0;
+        /* Codes_SRS_MQTT_TOPIC_TRIE_07_009: [mqtt_topic_trie_match shall call onMatch once for every filter matching topicName, where + matches one level and # the parent level and any number of levels below it, and return the number of matches.] */
+        /* Codes_SRS_MQTT_TOPIC_TRIE_07_010: [Filters starting with a wildcard shall not match topic names starting with $.] */
+        if (handle->count > 0)
+        {
+            match_levels(&state, handle->root, topicName, topicLength == 0 || topicName[0] != SYSTEM_TOPIC_PREFIX);
+        }
+        result = state.count;
+    }
+    return result;
+}
+
+size_t mqtt_topic_trie_count(MQTT_TOPIC_TRIE_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_TOPIC_TRIE_07_012: [mqtt_topic_trie_count shall return the number of stored filters, 0 if handle is NULL.] */
+    return (handle == NULL) ? 0 : handle->count;
+}
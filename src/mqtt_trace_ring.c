@@ -0,0 +1,406 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "macro_utils/macro_utils.h"
+#include "azure_umqtt_c/mqtt_trace_ring.h"
+
+// Operations the recording threads and the reader share, everything else is set before the ring is shared
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TRACE_FETCH_INCREMENT(target)           (uint64_t)_InterlockedExchangeAdd64((volatile __int64*)(target), 1)
+#define TRACE_CAS(target, expected, desired)    (_InterlockedCompareExchange64((volatile __int64*)(target), (__int64)(desired), (__int64)(expected)) == (__int64)(expected))
+#define TRACE_LOAD(target)                      (uint64_t)_InterlockedCompareExchange64((volatile __int64*)(target), 0, 0)
+#define TRACE_LOAD_RELAXED(target)              (*(volatile uint64_t*)(target))
+#define TRACE_STORE(target, value)              (void)_InterlockedExchange64((volatile __int64*)(target), (__int64)(value))
+#define TRACE_STORE_RELAXED(target, value)      (*(volatile uint64_t*)(target) = (value))
+#define TRACE_ACQUIRE_FENCE()                   _ReadWriteBarrier()
+#define TRACE_RELEASE_FENCE()                   _ReadWriteBarrier()
+#else
+#define TRACE_FETCH_INCREMENT(target)           __atomic_fetch_add((target), 1, __ATOMIC_RELAXED)
+#define TRACE_CAS(target, expected, desired)    __atomic_compare_exchange_n((target), &(expected), (desired), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+#define TRACE_LOAD(target)                      __atomic_load_n((target), __ATOMIC_ACQUIRE)
+#define TRACE_LOAD_RELAXED(target)              __atomic_load_n((target), __ATOMIC_RELAXED)
+#define TRACE_STORE(target, value)              __atomic_store_n((target), (value), __ATOMIC_RELEASE)
+#define TRACE_STORE_RELAXED(target, value)      __atomic_store_n((target), (value), __ATOMIC_RELAXED)
+#define TRACE_ACQUIRE_FENCE()                   __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define TRACE_RELEASE_FENCE()                   __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+
+#define TRACE_RECORD_WORDS      ((sizeof(MQTT_TRACE_RECORD) + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+
+// Trace file: an 8 byte magic, the record count and reserved word as uint32, the dropped count as uint64,
+// then TRACE_FILE_RECORD_SIZE bytes per record. Every number is little endian.
+#define TRACE_FILE_MAGIC        "MQTTTRC1"
+#define TRACE_FILE_MAGIC_SIZE   8
+#define TRACE_FILE_HEADER_SIZE  24
+#define TRACE_FILE_RECORD_SIZE  24
+
+// sequence is odd while the record at position (sequence - 1) / 2 is written into the slot and
+// becomes position * 2 + 2 once it is complete, so a reader can tell a finished record from a torn one.
+typedef struct TRACE_SLOT_TAG
+{
+    uint64_t sequence;
+    uint64_t words[TRACE_RECORD_WORDS];
+} TRACE_SLOT;
+
+typedef struct MQTT_TRACE_RING_TAG
+{
+    uint64_t nextPosition;
+    uint64_t dropped;
+    size_t mask;
+    TRACE_SLOT* slots;
+} MQTT_TRACE_RING;
+
+static void write_uint16(uint8_t* target, uint16_t value)
+{
+    target[0] = (uint8_t)value;
+    target[1] = (uint8_t)(value >> 8);
+}
+
+static void write_uint32(uint8_t* target, uint32_t value)
+{
+    write_uint16(target, (uint16_t)value);
+    write_uint16(target + 2, (uint16_t)(value >> 16));
+}
+
+static void write_uint64(uint8_t* target, uint64_t value)
+{
+    write_uint32(target, (uint32_t)value);
+    write_uint32(target + 4, (uint32_t)(value >> 32));
+}
+
+static uint16_t read_uint16(const uint8_t* source)
+{
+    return (uint16_t)(source[0] | (source[1] << 8));
+}
+
+static uint32_t read_uint32(const uint8_t* source)
+{
+    return (uint32_t)read_uint16(source) | ((uint32_t)read_uint16(source + 2) << 16);
+}
+
+static uint64_t read_uint64(const uint8_t* source)
+{
+    return (uint64_t)read_uint32(source) | ((uint64_t)read_uint32(source + 4) << 32);
+}
+
+static MQTT_TRACE_RING* create_ring(size_t capacity)
+{
+    MQTT_TRACE_RING* result;
+    size_t slotCount = 1;
+    while (slotCount < capacity && slotCount <= (SIZE_MAX / sizeof(TRACE_SLOT)) / 2)
+    {
+        slotCount <<= 1;
+    }
+
+    if (slotCount < capacity)
+    {
+        LogError("Trace ring capacity %lu is too large", (unsigned long)capacity);
+        result = NULL;
+    }
+    else if ((result = (MQTT_TRACE_RING*)malloc(sizeof(MQTT_TRACE_RING))) == NULL)
+    {
+        LogError("Failure allocating trace ring");
+    }
+    else if ((result->slots = (TRACE_SLOT*)malloc(slotCount * sizeof(TRACE_SLOT))) == NULL)
+    {
+        LogError("Failure allocating %lu trace ring slots", (unsigned long)slotCount);
+        free(result);
+        result = NULL;
+    }
+    else
+    {
+        (void)memset(result->slots, 0, slotCount * sizeof(TRACE_SLOT));
+        result->nextPosition = 0;
+        result->dropped = 0;
+        result->mask = slotCount - 1;
+    }
+    return result;
+}
+
+// Copies the record at position, false if the slot holds another record or is being written
+static bool read_slot(const MQTT_TRACE_RING* ring, uint64_t position, MQTT_TRACE_RECORD* record)
+{
+    bool result;
+    TRACE_SLOT* slot = &ring->slots[position & ring->mask];
+    uint64_t complete = position * 2 + 2;
+    if (TRACE_LOAD(&slot->sequence) != complete)
+    {
+        result = false;
+    }
+    else
+    {
+        uint64_t words[TRACE_RECORD_WORDS];
+        size_t index;
+        for (index = 0; index < TRACE_RECORD_WORDS; index++)
+        {
+            words[index] = TRACE_LOAD_RELAXED(&slot->words[index]);
+        }
+        TRACE_ACQUIRE_FENCE();
+        if (TRACE_LOAD_RELAXED(&slot->sequence) != complete)
+        {
+            result = false;
+        }
+        else
+        {
+            (void)memcpy(record, words, sizeof(MQTT_TRACE_RECORD));
+            result = true;
+        }
+    }
+    return result;
+}
+
+// First position still held by the ring
+static uint64_t get_oldest_position(const MQTT_TRACE_RING* ring, uint64_t end)
+{
+    uint64_t capacity = (uint64_t)ring->mask + 1;
+    return (end > capacity) ? end - capacity : 0;
+}
+
+MQTT_TRACE_RING_HANDLE mqtt_trace_ring_create(size_t capacity)
+{
+    MQTT_TRACE_RING* result;
+    if (capacity == 0)
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_001: [If capacity is 0 then mqtt_trace_ring_create shall return NULL.] */
+        LogError("Invalid parameter specified capacity: 0");
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_003: [mqtt_trace_ring_create shall return an empty ring keeping capacity records rounded up to a power of two.] */
+        /* Codes_SRS_MQTT_TRACE_RING_07_002: [If any failure is encountered then mqtt_trace_ring_create shall return NULL.] */
+        result = create_ring(capacity);
+    }
+    return result;
+}
+
+void mqtt_trace_ring_destroy(MQTT_TRACE_RING_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_TRACE_RING_07_004: [If handle is NULL then mqtt_trace_ring_destroy shall do nothing.] */
+    if (handle != NULL)
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_005: [mqtt_trace_ring_destroy shall free the ring and its records.] */
+        free(handle->slots);
+        free(handle);
+    }
+}
+
+void mqtt_trace_ring_record(MQTT_TRACE_RING_HANDLE handle, const MQTT_TRACE_RECORD* record)
+{
+    /* Codes_SRS_MQTT_TRACE_RING_07_006: [If handle or record is NULL then mqtt_trace_ring_record shall do nothing.] */
+    if (handle != NULL && record != NULL)
+    {
+        uint64_t position = TRACE_FETCH_INCREMENT(&handle->nextPosition);
+        TRACE_SLOT* slot = &handle->slots[position & handle->mask];
+        uint64_t writing = position * 2 + 1;
+        uint64_t expected = TRACE_LOAD_RELAXED(&slot->sequence);
+
+        // The slot is free once the record before it is complete, a later record already in it wins
+        if ((expected & 1) != 0 || expected > writing || !TRACE_CAS(&slot->sequence, expected, writing))
+        {
+            /* Codes_SRS_MQTT_TRACE_RING_07_008: [If another thread is still writing the slot of the record, or already wrote a newer record into it, then mqtt_trace_ring_record shall drop the record and count it.] */
+            (void)TRACE_FETCH_INCREMENT(&handle->dropped);
+        }
+        else
+        {
+            /* Codes_SRS_MQTT_TRACE_RING_07_007: [mqtt_trace_ring_record shall copy record over the oldest record without taking a lock or allocating, from any number of threads at once.] */
+            uint64_t words[TRACE_RECORD_WORDS] = { 0 };
+            size_t index;
+            (void)memcpy(words, record, sizeof(MQTT_TRACE_RECORD));
+            // A reader that sees any of the new words also sees the odd sequence and drops the slot
+            TRACE_RELEASE_FENCE();
+            for (index = 0; index < TRACE_RECORD_WORDS; index++)
+            {
+                TRACE_STORE_RELAXED(&slot->words[index], words[index]);
+            }
+            TRACE_STORE(&slot->sequence, writing + 1);
+        }
+    }
+}
+
+size_t mqtt_trace_ring_read(MQTT_TRACE_RING_HANDLE handle, MQTT_TRACE_RECORD* records, size_t count)
+{
+    size_t result = 0;
+    if (handle == NULL || records == NULL)
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_009: [If handle or records is NULL then mqtt_trace_ring_read shall return 0.] */
+        LogError("Invalid parameter specified handle: %p, records: %p", handle, records);
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_010: [mqtt_trace_ring_read shall copy up to count of the most recent records, oldest first, skipping records that are still being written, and return how many it copied.] */
+        uint64_t end = TRACE_LOAD(&handle->nextPosition);
+        uint64_t position = get_oldest_position(handle, end);
+        if (end - position > count)
+        {
+            position = end - count;
+        }
+        for (; position < end; position++)
+        {
+            if (read_slot(handle, position, &records[result]))
+            {
+                result++;
+            }
+        }
+    }
+    return result;
+}
+
+uint64_t mqtt_trace_ring_get_dropped(MQTT_TRACE_RING_HANDLE handle)
+{
+    uint64_t result;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_011: [If handle is NULL then mqtt_trace_ring_get_dropped shall return 0.] */
+        LogError("Invalid parameter specified handle: NULL");
+        result = 0;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_012: [mqtt_trace_ring_get_dropped shall return the number of records mqtt_trace_ring_record dropped.] */
+        result = TRACE_LOAD(&handle->dropped);
+    }
+    return result;
+}
+
+int mqtt_trace_ring_save(MQTT_TRACE_RING_HANDLE handle, const char* path)
+{
+    int result;
+    FILE* file;
+    if (handle == NULL || path == NULL)
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_013: [If handle or path is NULL then mqtt_trace_ring_save shall return a non-zero value.] */
+        LogError("Invalid parameter specified handle: %p, path: %p", handle, path);
+        result = MU_FAILURE;
+    }
+    else if ((file = fopen(path, "wb")) == NULL)
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_015: [If any failure is encountered then mqtt_trace_ring_save shall return a non-zero value.] */
+        LogError("Failure opening trace file %s", path);
+        result = MU_FAILURE;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_014: [mqtt_trace_ring_save shall write the records the ring holds, oldest first, and the dropped count to path in a little endian format that does not depend on the platform.] */
+        uint8_t header[TRACE_FILE_HEADER_SIZE] = { 0 };
+        uint64_t end = TRACE_LOAD(&handle->nextPosition);
+        uint64_t position;
+        uint32_t count = 0;
+        long countOffset = TRACE_FILE_MAGIC_SIZE;
+
+        (void)memcpy(header, TRACE_FILE_MAGIC, TRACE_FILE_MAGIC_SIZE);
+        write_uint64(header + 16, TRACE_LOAD(&handle->dropped));
+        result = (fwrite(header, 1, sizeof(header), file) == sizeof(header)) ? 0 : MU_FAILURE;
+
+        // Records overwritten or being written while the file is written are left out
+        for (position = get_oldest_position(handle, end); position < end && result == 0; position++)
+        {
+            MQTT_TRACE_RECORD record;
+            if (read_slot(handle, position, &record))
+            {
+                uint8_t encoded[TRACE_FILE_RECORD_SIZE] = { 0 };
+                write_uint64(encoded, record.timestampMs);
+                write_uint32(encoded + 8, record.topicHash);
+                write_uint32(encoded + 12, record.length);
+                write_uint16(encoded + 16, record.packetId);
+                encoded[18] = record.packetType;
+                encoded[19] = record.flags;
+                encoded[20] = record.direction;
+                if (fwrite(encoded, 1, sizeof(encoded), file) != sizeof(encoded))
+                {
+                    result = MU_FAILURE;
+                }
+                else
+                {
+                    count++;
+                }
+            }
+        }
+
+        if (result == 0)
+        {
+            write_uint32(header + countOffset, count);
+            if (fseek(file, countOffset, SEEK_SET) != 0 || fwrite(header + countOffset, 1, sizeof(uint32_t), file) != sizeof(uint32_t))
+            {
+                result = MU_FAILURE;
+            }
+        }
+
+        if (fclose(file) != 0 || result != 0)
+        {
+            /* Codes_SRS_MQTT_TRACE_RING_07_015: [If any failure is encountered then mqtt_trace_ring_save shall return a non-zero value.] */
+            LogError("Failure writing trace file %s", path);
+            result = MU_FAILURE;
+        }
+    }
+    return result;
+}
+
+MQTT_TRACE_RING_HANDLE mqtt_trace_ring_load(const char* path)
+{
+    MQTT_TRACE_RING* result;
+    FILE* file;
+    uint8_t header[TRACE_FILE_HEADER_SIZE];
+    if (path == NULL)
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_016: [If path is NULL then mqtt_trace_ring_load shall return NULL.] */
+        LogError("Invalid parameter specified path: NULL");
+        result = NULL;
+    }
+    else if ((file = fopen(path, "rb")) == NULL)
+    {
+        /* Codes_SRS_MQTT_TRACE_RING_07_018: [If the file cannot be read, is not a trace file or any other failure is encountered then mqtt_trace_ring_load shall return NULL.] */
+        LogError("Failure opening trace file %s", path);
+        result = NULL;
+    }
+    else
+    {
+        if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, TRACE_FILE_MAGIC, TRACE_FILE_MAGIC_SIZE) != 0)
+        {
+            /* Codes_SRS_MQTT_TRACE_RING_07_018: [If the file cannot be read, is not a trace file or any other failure is encountered then mqtt_trace_ring_load shall return NULL.] */
+            LogError("%s is not a trace file", path);
+            result = NULL;
+        }
+        else
+        {
+            uint32_t count = read_uint32(header + TRACE_FILE_MAGIC_SIZE);
+            /* Codes_SRS_MQTT_TRACE_RING_07_017: [mqtt_trace_ring_load shall return a ring holding the records of the file in their order and its dropped count.] */
+            if ((result = create_ring(count == 0 ? 1 : count)) != NULL)
+            {
+                uint32_t index;
+                result->dropped = read_uint64(header + 16);
+                for (index = 0; index < count; index++)
+                {
+                    uint8_t encoded[TRACE_FILE_RECORD_SIZE];
+                    MQTT_TRACE_RECORD record;
+                    if (fread(encoded, 1, sizeof(encoded), file) != sizeof(encoded))
+                    {
+                        LogError("Trace file %s ends after %" PRIu32 " of %" PRIu32 " records", path, index, count);
+                        mqtt_trace_ring_destroy(result);
+                        result = NULL;
+                        break;
+                    }
+                    record.timestampMs = read_uint64(encoded);
+                    record.topicHash = read_uint32(encoded + 8);
+                    record.length = read_uint32(encoded + 12);
+                    record.packetId = read_uint16(encoded + 16);
+                    record.packetType = encoded[18];
+                    record.flags = encoded[19];
+                    record.direction = encoded[20];
+                    mqtt_trace_ring_record(result, &record);
+                }
+            }
+        }
+        (void)fclose(file);
+    }
+    return result;
+}
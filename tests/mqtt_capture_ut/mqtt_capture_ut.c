@@ -0,0 +1,581 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c/umock_c.h"
+#include "umock_c/umock_c_negative_tests.h"
+#include "umock_c/umocktypes_charptr.h"
+#include "umock_c/umocktypes_stdint.h"
+#include "umock_c/umocktypes.h"
+#include "umock_c/umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void* my_gballoc_realloc(void* ptr, size_t size)
+    {
+        return realloc(ptr, size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "umock_c/umock_c_prod.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_capture.h"
+
+#define TEST_CAPTURE_PATH       "mqtt_capture_ut.cap"
+#define TEST_TIMESTAMP          0x0102030405060708ULL
+
+static const uint8_t TEST_PACKET[] = { 0x40, 0x02, 0x12, 0x34 };
+static const uint8_t TEST_PINGRESP[] = { 0xd0, 0x00 };
+
+TEST_DEFINE_ENUM_TYPE(MQTT_CAPTURE_READ_RESULT, MQTT_CAPTURE_READ_RESULT_VALUES);
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+MU_DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    ASSERT_FAIL("umock_c reported error :%s", MU_ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+}
+
+// Reads back the capture file, which has to be closed first
+static size_t read_capture(uint8_t* content, size_t size)
+{
+    size_t result;
+    FILE* file = fopen(TEST_CAPTURE_PATH, "rb");
+    ASSERT_IS_NOT_NULL(file);
+    result = fread(content, 1, size, file);
+    (void)fclose(file);
+    return result;
+}
+
+// Writes a capture file by hand, to read back what mqtt_capture_create would not write
+static void write_capture(const uint8_t* content, size_t size)
+{
+    FILE* file = fopen(TEST_CAPTURE_PATH, "wb");
+    ASSERT_IS_NOT_NULL(file);
+    ASSERT_ARE_EQUAL(size_t, size, fwrite(content, 1, size, file));
+    (void)fclose(file);
+}
+
+BEGIN_TEST_SUITE(mqtt_capture_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_realloc, my_gballoc_realloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    (void)remove(TEST_CAPTURE_PATH);
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    (void)remove(TEST_CAPTURE_PATH);
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_001: [If path is NULL then mqtt_capture_create shall return NULL.] */
+TEST_FUNCTION(mqtt_capture_create_path_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_002: [mqtt_capture_create shall create the file at path, replacing a file that exists, and write the capture file magic to it.] */
+TEST_FUNCTION(mqtt_capture_create_succeed)
+{
+    // arrange
+    uint8_t content[16];
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(TEST_CAPTURE_PATH);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_capture_get_pending(handle));
+
+    // cleanup
+    mqtt_capture_destroy(handle);
+    ASSERT_ARE_EQUAL(size_t, 8, read_capture(content, sizeof(content)));
+    ASSERT_ARE_EQUAL(int, 0, memcmp("MQTTCAP1", content, 8));
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_003: [If any failure is encountered then mqtt_capture_create shall return NULL.] */
+TEST_FUNCTION(mqtt_capture_create_malloc_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(TEST_CAPTURE_PATH);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_003: [If any failure is encountered then mqtt_capture_create shall return NULL.] */
+TEST_FUNCTION(mqtt_capture_create_open_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create("mqtt_capture_ut_missing/capture.cap");
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_004: [If handle is NULL then mqtt_capture_destroy shall do nothing.] */
+TEST_FUNCTION(mqtt_capture_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_capture_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_005: [mqtt_capture_destroy shall fill the bytes the last packet still waits for with zeros, close the file and free the capture.] */
+TEST_FUNCTION(mqtt_capture_destroy_fills_pending_succeed)
+{
+    // arrange
+    uint8_t content[64];
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(TEST_CAPTURE_PATH);
+    (void)mqtt_capture_begin_packet(handle, MQTT_TRACE_OUTGOING, TEST_TIMESTAMP, sizeof(TEST_PACKET));
+    (void)mqtt_capture_append(handle, TEST_PACKET, 1);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_free(handle));
+
+    // act
+    mqtt_capture_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 8 + 16 + sizeof(TEST_PACKET), read_capture(content, sizeof(content)));
+    ASSERT_ARE_EQUAL(uint8_t, TEST_PACKET[0], content[24]);
+    ASSERT_ARE_EQUAL(uint8_t, 0, content[25]);
+    ASSERT_ARE_EQUAL(uint8_t, 0, content[27]);
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_006: [If handle is NULL or length does not fit in 32 bits then mqtt_capture_begin_packet shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_capture_begin_packet_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_capture_begin_packet(NULL, MQTT_TRACE_OUTGOING, TEST_TIMESTAMP, sizeof(TEST_PACKET));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_008: [mqtt_capture_begin_packet shall write the time, length and direction of the packet and wait for length bytes.] */
+/* Tests_SRS_MQTT_CAPTURE_07_012: [mqtt_capture_append shall write length bytes of data as the next bytes of the packet and return 0.] */
+TEST_FUNCTION(mqtt_capture_begin_packet_append_succeed)
+{
+    // arrange
+    static const uint8_t expected[] =
+    {
+        'M', 'Q', 'T', 'T', 'C', 'A', 'P', '1',
+        0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x04, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+        0x40, 0x02, 0x12, 0x34
+    };
+    uint8_t content[64];
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(TEST_CAPTURE_PATH);
+    umock_c_reset_all_calls();
+
+    // act
+    int beginResult = mqtt_capture_begin_packet(handle, MQTT_TRACE_INCOMING, TEST_TIMESTAMP, sizeof(TEST_PACKET));
+    size_t pending = mqtt_capture_get_pending(handle);
+    int firstResult = mqtt_capture_append(handle, TEST_PACKET, 2);
+    int secondResult = mqtt_capture_append(handle, TEST_PACKET + 2, 2);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, beginResult);
+    ASSERT_ARE_EQUAL(size_t, sizeof(TEST_PACKET), pending);
+    ASSERT_ARE_EQUAL(int, 0, firstResult);
+    ASSERT_ARE_EQUAL(int, 0, secondResult);
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_capture_get_pending(handle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_destroy(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(expected), read_capture(content, sizeof(content)));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(expected, content, sizeof(expected)));
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_007: [mqtt_capture_begin_packet shall fill the bytes the previous packet still waits for with zeros.] */
+TEST_FUNCTION(mqtt_capture_begin_packet_fills_previous_succeed)
+{
+    // arrange
+    uint8_t content[64];
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(TEST_CAPTURE_PATH);
+    (void)mqtt_capture_begin_packet(handle, MQTT_TRACE_OUTGOING, TEST_TIMESTAMP, 3);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_capture_begin_packet(handle, MQTT_TRACE_INCOMING, TEST_TIMESTAMP, sizeof(TEST_PACKET));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, sizeof(TEST_PACKET), mqtt_capture_get_pending(handle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    (void)mqtt_capture_append(handle, TEST_PACKET, sizeof(TEST_PACKET));
+    mqtt_capture_destroy(handle);
+    ASSERT_ARE_EQUAL(size_t, 8 + 16 + 3 + 16 + sizeof(TEST_PACKET), read_capture(content, sizeof(content)));
+    ASSERT_ARE_EQUAL(uint8_t, 0, content[26]);
+    ASSERT_ARE_EQUAL(uint8_t, 0x01, content[27 + 12]);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(TEST_PACKET, content + 27 + 16, sizeof(TEST_PACKET)));
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_010: [If handle is NULL, or data is NULL and length is not 0, then mqtt_capture_append shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_capture_append_NULL_fail)
+{
+    // arrange
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(TEST_CAPTURE_PATH);
+    (void)mqtt_capture_begin_packet(handle, MQTT_TRACE_OUTGOING, TEST_TIMESTAMP, sizeof(TEST_PACKET));
+    umock_c_reset_all_calls();
+
+    // act
+    int handleResult = mqtt_capture_append(NULL, TEST_PACKET, sizeof(TEST_PACKET));
+    int dataResult = mqtt_capture_append(handle, NULL, sizeof(TEST_PACKET));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, handleResult);
+    ASSERT_ARE_NOT_EQUAL(int, 0, dataResult);
+    ASSERT_ARE_EQUAL(size_t, sizeof(TEST_PACKET), mqtt_capture_get_pending(handle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_011: [If the packet waits for fewer than length bytes then mqtt_capture_append shall write nothing and return a non-zero value.] */
+TEST_FUNCTION(mqtt_capture_append_too_long_fail)
+{
+    // arrange
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(TEST_CAPTURE_PATH);
+    (void)mqtt_capture_begin_packet(handle, MQTT_TRACE_OUTGOING, TEST_TIMESTAMP, sizeof(TEST_PACKET) - 1);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_capture_append(handle, TEST_PACKET, sizeof(TEST_PACKET));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, sizeof(TEST_PACKET) - 1, mqtt_capture_get_pending(handle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_013: [If handle is NULL then mqtt_capture_get_pending shall return 0.] */
+TEST_FUNCTION(mqtt_capture_get_pending_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    size_t result = mqtt_capture_get_pending(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_015: [If path is NULL then mqtt_capture_reader_open shall return NULL.] */
+TEST_FUNCTION(mqtt_capture_reader_open_path_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_CAPTURE_READER_HANDLE handle = mqtt_capture_reader_open(NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_016: [mqtt_capture_reader_open shall open the file at path and check that it starts with the capture file magic.] */
+TEST_FUNCTION(mqtt_capture_reader_open_succeed)
+{
+    // arrange
+    mqtt_capture_destroy(mqtt_capture_create(TEST_CAPTURE_PATH));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_CAPTURE_READER_HANDLE handle = mqtt_capture_reader_open(TEST_CAPTURE_PATH);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_reader_close(handle);
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_017: [If the file cannot be opened or does not start with the capture file magic then mqtt_capture_reader_open shall return NULL.] */
+TEST_FUNCTION(mqtt_capture_reader_open_missing_file_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_CAPTURE_READER_HANDLE handle = mqtt_capture_reader_open(TEST_CAPTURE_PATH);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_017: [If the file cannot be opened or does not start with the capture file magic then mqtt_capture_reader_open shall return NULL.] */
+TEST_FUNCTION(mqtt_capture_reader_open_not_capture_fail)
+{
+    // arrange
+    static const uint8_t content[] = { 'M', 'Q', 'T', 'T', 'T', 'R', 'C', '1' };
+    write_capture(content, sizeof(content));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_CAPTURE_READER_HANDLE handle = mqtt_capture_reader_open(TEST_CAPTURE_PATH);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_018: [If handle is NULL then mqtt_capture_reader_close shall do nothing.] */
+TEST_FUNCTION(mqtt_capture_reader_close_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_capture_reader_close(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_019: [mqtt_capture_reader_close shall close the file and free the reader and its buffer.] */
+TEST_FUNCTION(mqtt_capture_reader_close_succeed)
+{
+    // arrange
+    MQTT_CAPTURE_PACKET packet;
+    MQTT_CAPTURE_HANDLE capture = mqtt_capture_create(TEST_CAPTURE_PATH);
+    (void)mqtt_capture_begin_packet(capture, MQTT_TRACE_OUTGOING, TEST_TIMESTAMP, sizeof(TEST_PACKET));
+    (void)mqtt_capture_append(capture, TEST_PACKET, sizeof(TEST_PACKET));
+    mqtt_capture_destroy(capture);
+    MQTT_CAPTURE_READER_HANDLE handle = mqtt_capture_reader_open(TEST_CAPTURE_PATH);
+    (void)mqtt_capture_reader_next(handle, &packet);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(handle));
+
+    // act
+    mqtt_capture_reader_close(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_020: [If handle or packet is NULL then mqtt_capture_reader_next shall return MQTT_CAPTURE_READ_ERROR.] */
+TEST_FUNCTION(mqtt_capture_reader_next_NULL_fail)
+{
+    // arrange
+    MQTT_CAPTURE_PACKET packet;
+    mqtt_capture_destroy(mqtt_capture_create(TEST_CAPTURE_PATH));
+    MQTT_CAPTURE_READER_HANDLE handle = mqtt_capture_reader_open(TEST_CAPTURE_PATH);
+    umock_c_reset_all_calls();
+
+    // act
+    MQTT_CAPTURE_READ_RESULT handleResult = mqtt_capture_reader_next(NULL, &packet);
+    MQTT_CAPTURE_READ_RESULT packetResult = mqtt_capture_reader_next(handle, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_CAPTURE_READ_RESULT, MQTT_CAPTURE_READ_ERROR, handleResult);
+    ASSERT_ARE_EQUAL(MQTT_CAPTURE_READ_RESULT, MQTT_CAPTURE_READ_ERROR, packetResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_reader_close(handle);
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_021: [mqtt_capture_reader_next shall read the next packet into a buffer kept by the reader, set its time, direction, data and length in packet and return MQTT_CAPTURE_READ_OK.] */
+/* Tests_SRS_MQTT_CAPTURE_07_022: [If the file ends after the last whole packet then mqtt_capture_reader_next shall return MQTT_CAPTURE_READ_END.] */
+TEST_FUNCTION(mqtt_capture_reader_next_succeed)
+{
+    // arrange
+    MQTT_CAPTURE_PACKET first;
+    MQTT_CAPTURE_PACKET second;
+    MQTT_CAPTURE_HANDLE capture = mqtt_capture_create(TEST_CAPTURE_PATH);
+    (void)mqtt_capture_begin_packet(capture, MQTT_TRACE_OUTGOING, TEST_TIMESTAMP, sizeof(TEST_PACKET));
+    (void)mqtt_capture_append(capture, TEST_PACKET, sizeof(TEST_PACKET));
+    (void)mqtt_capture_begin_packet(capture, MQTT_TRACE_INCOMING, TEST_TIMESTAMP + 1, sizeof(TEST_PINGRESP));
+    (void)mqtt_capture_append(capture, TEST_PINGRESP, sizeof(TEST_PINGRESP));
+    mqtt_capture_destroy(capture);
+    MQTT_CAPTURE_READER_HANDLE handle = mqtt_capture_reader_open(TEST_CAPTURE_PATH);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_realloc(NULL, sizeof(TEST_PACKET)));
+
+    // act
+    MQTT_CAPTURE_READ_RESULT firstResult = mqtt_capture_reader_next(handle, &first);
+    ASSERT_ARE_EQUAL(MQTT_CAPTURE_READ_RESULT, MQTT_CAPTURE_READ_OK, firstResult);
+    ASSERT_ARE_EQUAL(uint64_t, TEST_TIMESTAMP, first.timestampMs);
+    ASSERT_ARE_EQUAL(int, MQTT_TRACE_OUTGOING, first.direction);
+    ASSERT_ARE_EQUAL(size_t, sizeof(TEST_PACKET), first.length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(TEST_PACKET, first.data, sizeof(TEST_PACKET)));
+    MQTT_CAPTURE_READ_RESULT secondResult = mqtt_capture_reader_next(handle, &second);
+    MQTT_CAPTURE_READ_RESULT endResult = mqtt_capture_reader_next(handle, &second);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_CAPTURE_READ_RESULT, MQTT_CAPTURE_READ_OK, secondResult);
+    ASSERT_ARE_EQUAL(uint64_t, TEST_TIMESTAMP + 1, second.timestampMs);
+    ASSERT_ARE_EQUAL(int, MQTT_TRACE_INCOMING, second.direction);
+    ASSERT_ARE_EQUAL(size_t, sizeof(TEST_PINGRESP), second.length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(TEST_PINGRESP, second.data, sizeof(TEST_PINGRESP)));
+    ASSERT_ARE_EQUAL(MQTT_CAPTURE_READ_RESULT, MQTT_CAPTURE_READ_END, endResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_reader_close(handle);
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_023: [If the file is cut short in a packet, a packet has an unknown direction or is longer than an MQTT packet can be, or reading fails, then mqtt_capture_reader_next shall return MQTT_CAPTURE_READ_ERROR.] */
+TEST_FUNCTION(mqtt_capture_reader_next_cut_short_fail)
+{
+    // arrange
+    static const uint8_t content[] =
+    {
+        'M', 'Q', 'T', 'T', 'C', 'A', 'P', '1',
+        0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x04, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00,
+        0x40, 0x02
+    };
+    MQTT_CAPTURE_PACKET packet;
+    write_capture(content, sizeof(content));
+    MQTT_CAPTURE_READER_HANDLE handle = mqtt_capture_reader_open(TEST_CAPTURE_PATH);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_realloc(NULL, 4));
+
+    // act
+    MQTT_CAPTURE_READ_RESULT result = mqtt_capture_reader_next(handle, &packet);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_CAPTURE_READ_RESULT, MQTT_CAPTURE_READ_ERROR, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_reader_close(handle);
+}
+
+/* Tests_SRS_MQTT_CAPTURE_07_023: [If the file is cut short in a packet, a packet has an unknown direction or is longer than an MQTT packet can be, or reading fails, then mqtt_capture_reader_next shall return MQTT_CAPTURE_READ_ERROR.] */
+TEST_FUNCTION(mqtt_capture_reader_next_invalid_direction_fail)
+{
+    // arrange
+    static const uint8_t content[] =
+    {
+        'M', 'Q', 'T', 'T', 'C', 'A', 'P', '1',
+        0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x02, 0x00, 0x00, 0x00, 0x07, 0x00, 0x00, 0x00,
+        0xd0, 0x00
+    };
+    MQTT_CAPTURE_PACKET packet;
+    write_capture(content, sizeof(content));
+    MQTT_CAPTURE_READER_HANDLE handle = mqtt_capture_reader_open(TEST_CAPTURE_PATH);
+    umock_c_reset_all_calls();
+
+    // act
+    MQTT_CAPTURE_READ_RESULT result = mqtt_capture_reader_next(handle, &packet);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_CAPTURE_READ_RESULT, MQTT_CAPTURE_READ_ERROR, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_reader_close(handle);
+}
+
+END_TEST_SUITE(mqtt_capture_ut)
@@ -0,0 +1,1240 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#include <time.h>
+#include <unistd.h>
+
+#include "testrunnerswitcher.h"
+#include "umock_c/umock_c.h"
+#include "umock_c/umock_c_negative_tests.h"
+#include "umock_c/umocktypes_charptr.h"
+#include "umock_c/umocktypes_stdint.h"
+#include "umock_c/umocktypes.h"
+#include "umock_c/umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_umqtt_c/mqtt_codec.h"
+#include "azure_umqtt_c/mqtt_timer_wheel.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "umock_c/umock_c_prod.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_client_group.h"
+
+#define TEST_CLIENT_COUNT   3
+#define TEST_CLIENT(index)  ((MQTT_CLIENT_HANDLE)(uintptr_t)(0x11 + (index)))
+#define TEST_WHEEL_COUNT    2
+#define TEST_TIMER_WHEEL(index) ((MQTT_TIMER_WHEEL_HANDLE)(uintptr_t)(0x31 + (index)))
+#define TEST_TIMER_COUNT    8
+
+static TICK_COUNTER_HANDLE TEST_TICK_COUNTER_HANDLE = (TICK_COUNTER_HANDLE)0x21;
+static MQTT_CODEC_RECV_POOL_HANDLE TEST_RECV_POOL_HANDLE = (MQTT_CODEC_RECV_POOL_HANDLE)0x22;
+static THREAD_HANDLE TEST_THREAD_HANDLE = (THREAD_HANDLE)0x23;
+static void* TEST_WORK_CONTEXT = (void*)0x24;
+static const size_t TEST_RECV_POOL_HIGH_WATER_MARK = 4096;
+static const uint32_t TEST_MAX_WAIT_MS = 1;
+// Long enough that a wait that was not cut short is told apart from one that was
+static const uint32_t TEST_WAIT_MS = 50;
+
+typedef struct TEST_CLIENT_STATE_TAG
+{
+    MQTT_CLIENT_WAIT_INFO waitInfo;
+    ON_MQTT_CLIENT_WAKEUP onWakeup;
+    void* wakeupCtx;
+    MQTT_CODEC_RECV_POOL_HANDLE recvPool;
+    MQTT_TIMER_WHEEL_HANDLE timerWheel;
+    ON_MQTT_CLIENT_WAKEUP onDue;
+    void* dueCtx;
+    MQTT_TIMER timer;
+    int socket;
+    size_t doworkCount;
+} TEST_CLIENT_STATE;
+
+// A timer wheel that keeps its timers in an array, enough to drive the workers
+typedef struct TEST_TIMER_WHEEL_STATE_TAG
+{
+    tickcounter_ms_t currentMs;
+    MQTT_TIMER* timers[TEST_TIMER_COUNT];
+} TEST_TIMER_WHEEL_STATE;
+
+static TEST_CLIENT_STATE g_clients[TEST_CLIENT_COUNT];
+static TEST_TIMER_WHEEL_STATE g_wheels[TEST_WHEEL_COUNT];
+static size_t g_wheelCount;
+static tickcounter_ms_t g_current_ms;
+static size_t g_workCount;
+static MQTT_CLIENT_HANDLE g_workClient;
+static void* g_workContext;
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+MU_DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    ASSERT_FAIL("umock_c reported error :%s", MU_ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+}
+
+static TEST_CLIENT_STATE* get_client_state(MQTT_CLIENT_HANDLE handle)
+{
+    return &g_clients[(uintptr_t)handle - 0x11];
+}
+
+static int my_mqtt_client_set_wakeup_callback(MQTT_CLIENT_HANDLE handle, ON_MQTT_CLIENT_WAKEUP onWakeup, void* context)
+{
+    get_client_state(handle)->onWakeup = onWakeup;
+    get_client_state(handle)->wakeupCtx = context;
+    return 0;
+}
+
+static TEST_TIMER_WHEEL_STATE* get_wheel_state(MQTT_TIMER_WHEEL_HANDLE handle)
+{
+    return &g_wheels[(uintptr_t)handle - 0x31];
+}
+
+static MQTT_TIMER** find_timer(MQTT_TIMER_WHEEL_HANDLE handle, MQTT_TIMER* timer)
+{
+    MQTT_TIMER** result = NULL;
+    size_t index;
+    for (index = 0; index < TEST_TIMER_COUNT && result == NULL; index++)
+    {
+        if (get_wheel_state(handle)->timers[index] == timer)
+        {
+            result = &get_wheel_state(handle)->timers[index];
+        }
+    }
+    return result;
+}
+
+static MQTT_TIMER_WHEEL_HANDLE my_mqtt_timer_wheel_create(tickcounter_ms_t currentMs)
+{
+    MQTT_TIMER_WHEEL_HANDLE result = TEST_TIMER_WHEEL(g_wheelCount++);
+    (void)memset(get_wheel_state(result), 0, sizeof(TEST_TIMER_WHEEL_STATE));
+    get_wheel_state(result)->currentMs = currentMs;
+    return result;
+}
+
+static int my_mqtt_timer_wheel_schedule(MQTT_TIMER_WHEEL_HANDLE handle, MQTT_TIMER* timer, tickcounter_ms_t dueMs, ON_MQTT_TIMER_EXPIRED onExpired, void* context)
+{
+    MQTT_TIMER** slot = find_timer(handle, timer);
+    if (slot == NULL)
+    {
+        slot = find_timer(handle, NULL);
+        ASSERT_IS_NOT_NULL(slot);
+        *slot = timer;
+    }
+    timer->dueMs = dueMs;
+    timer->onExpired = onExpired;
+    timer->context = context;
+    return 0;
+}
+
+static void my_mqtt_timer_wheel_cancel(MQTT_TIMER_WHEEL_HANDLE handle, MQTT_TIMER* timer)
+{
+    MQTT_TIMER** slot = find_timer(handle, timer);
+    if (slot != NULL)
+    {
+        *slot = NULL;
+    }
+}
+
+static size_t my_mqtt_timer_wheel_advance(MQTT_TIMER_WHEEL_HANDLE handle, tickcounter_ms_t currentMs)
+{
+    size_t result = 0;
+    size_t index;
+    get_wheel_state(handle)->currentMs = currentMs;
+    for (index = 0; index < TEST_TIMER_COUNT; index++)
+    {
+        MQTT_TIMER* timer = get_wheel_state(handle)->timers[index];
+        if (timer != NULL && timer->dueMs <= currentMs)
+        {
+            get_wheel_state(handle)->timers[index] = NULL;
+            timer->onExpired(timer->context);
+            result++;
+        }
+    }
+    return result;
+}
+
+static uint32_t my_mqtt_timer_wheel_get_timeout(MQTT_TIMER_WHEEL_HANDLE handle, tickcounter_ms_t currentMs)
+{
+    uint32_t result = UINT32_MAX;
+    size_t index;
+    for (index = 0; index < TEST_TIMER_COUNT; index++)
+    {
+        MQTT_TIMER* timer = get_wheel_state(handle)->timers[index];
+        if (timer != NULL)
+        {
+            uint32_t timeout = (timer->dueMs <= currentMs) ? 0 : (uint32_t)(timer->dueMs - currentMs);
+            if (timeout < result)
+            {
+                result = timeout;
+            }
+        }
+    }
+    return result;
+}
+
+static tickcounter_ms_t my_mqtt_timer_wheel_get_current_ms(MQTT_TIMER_WHEEL_HANDLE handle)
+{
+    return get_wheel_state(handle)->currentMs;
+}
+
+static int my_mqtt_client_set_timer_wheel(MQTT_CLIENT_HANDLE handle, MQTT_TIMER_WHEEL_HANDLE timerWheel, ON_MQTT_CLIENT_WAKEUP onDue, void* context)
+{
+    TEST_CLIENT_STATE* state = get_client_state(handle);
+    if (state->timerWheel != NULL)
+    {
+        my_mqtt_timer_wheel_cancel(state->timerWheel, &state->timer);
+    }
+    state->timerWheel = timerWheel;
+    state->onDue = onDue;
+    state->dueCtx = context;
+    return 0;
+}
+
+static int my_mqtt_client_set_recv_pool(MQTT_CLIENT_HANDLE handle, MQTT_CODEC_RECV_POOL_HANDLE pool)
+{
+    get_client_state(handle)->recvPool = pool;
+    return 0;
+}
+
+static int my_mqtt_client_get_wait_info(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_WAIT_INFO* waitInfo)
+{
+    *waitInfo = get_client_state(handle)->waitInfo;
+    return 0;
+}
+
+// Like the client, keeps its timer on the wheel at timeoutMs of its wait info
+static void my_mqtt_client_dowork(MQTT_CLIENT_HANDLE handle)
+{
+    TEST_CLIENT_STATE* state = get_client_state(handle);
+    state->doworkCount++;
+    if (state->timerWheel != NULL)
+    {
+        if (state->waitInfo.timeoutMs == UINT32_MAX)
+        {
+            my_mqtt_timer_wheel_cancel(state->timerWheel, &state->timer);
+        }
+        else
+        {
+            (void)my_mqtt_timer_wheel_schedule(state->timerWheel, &state->timer, my_mqtt_timer_wheel_get_current_ms(state->timerWheel) + state->waitInfo.timeoutMs, state->onDue, state->dueCtx);
+        }
+    }
+}
+
+static TICK_COUNTER_HANDLE my_tickcounter_create(void)
+{
+    return TEST_TICK_COUNTER_HANDLE;
+}
+
+static int my_tickcounter_get_current_ms(TICK_COUNTER_HANDLE tick_counter, tickcounter_ms_t* current_ms)
+{
+    (void)tick_counter;
+    *current_ms = g_current_ms;
+    return 0;
+}
+
+static MQTT_CODEC_RECV_POOL_HANDLE my_mqtt_codec_recv_pool_create(size_t highWaterMark)
+{
+    (void)highWaterMark;
+    return TEST_RECV_POOL_HANDLE;
+}
+
+// The worker threads are not started, tests drive the workers with mqtt_client_group_run_worker_once
+static THREADAPI_RESULT my_ThreadAPI_Create(THREAD_HANDLE* threadHandle, THREAD_START_FUNC func, void* arg)
+{
+    (void)func;
+    (void)arg;
+    *threadHandle = TEST_THREAD_HANDLE;
+    return THREADAPI_OK;
+}
+
+static THREADAPI_RESULT my_ThreadAPI_Join(THREAD_HANDLE threadHandle, int* res)
+{
+    (void)threadHandle;
+    *res = 0;
+    return THREADAPI_OK;
+}
+
+static int test_get_socket(void* context)
+{
+    return ((TEST_CLIENT_STATE*)context)->socket;
+}
+
+static void test_work(MQTT_CLIENT_HANDLE client, void* context)
+{
+    g_workCount++;
+    g_workClient = client;
+    g_workContext = context;
+}
+
+static MQTT_CLIENT_GROUP_HANDLE create_group(size_t workerCount, uint32_t maxWaitMs)
+{
+    MQTT_CLIENT_GROUP_OPTIONS options;
+    MQTT_CLIENT_GROUP_HANDLE result;
+    options.workerCount = workerCount;
+    options.maxWaitMs = maxWaitMs;
+    options.recvPoolHighWaterMark = TEST_RECV_POOL_HIGH_WATER_MARK;
+    result = mqtt_client_group_create(&options);
+    ASSERT_IS_NOT_NULL(result);
+    umock_c_reset_all_calls();
+    return result;
+}
+
+// Adds the client and runs its worker once so the add is applied
+static MQTT_CLIENT_GROUP_MEMBER_HANDLE add_client(MQTT_CLIENT_GROUP_HANDLE group, size_t index)
+{
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE result = mqtt_client_group_add(group, TEST_CLIENT(index), test_get_socket, &g_clients[index]);
+    ASSERT_IS_NOT_NULL(result);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_group_run_worker_once(group, 0));
+    umock_c_reset_all_calls();
+    return result;
+}
+
+// What the mocked mqtt_client_get_wait_info reports for the client
+static void set_wait_info(size_t index, uint32_t timeoutMs, bool waitRead, bool waitWrite)
+{
+    g_clients[index].waitInfo.timeoutMs = timeoutMs;
+    g_clients[index].waitInfo.waitRead = waitRead;
+    g_clients[index].waitInfo.waitWrite = waitWrite;
+}
+
+static double get_elapsed_ms(const struct timespec* start)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) * 1000.0 + (double)(now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+BEGIN_TEST_SUITE(mqtt_client_group_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CLIENT_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_CLIENT_WAKEUP, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CODEC_RECV_POOL_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(TICK_COUNTER_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_TIMER_WHEEL_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_TIMER_EXPIRED, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(tickcounter_ms_t, uint64_t);
+    REGISTER_UMOCK_ALIAS_TYPE(THREAD_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(THREAD_START_FUNC, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(THREADAPI_RESULT, int);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+
+    REGISTER_GLOBAL_MOCK_HOOK(tickcounter_create, my_tickcounter_create);
+    REGISTER_GLOBAL_MOCK_HOOK(tickcounter_get_current_ms, my_tickcounter_get_current_ms);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_recv_pool_create, my_mqtt_codec_recv_pool_create);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_timer_wheel_create, my_mqtt_timer_wheel_create);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_timer_wheel_schedule, my_mqtt_timer_wheel_schedule);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_timer_wheel_cancel, my_mqtt_timer_wheel_cancel);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_timer_wheel_advance, my_mqtt_timer_wheel_advance);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_timer_wheel_get_timeout, my_mqtt_timer_wheel_get_timeout);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_timer_wheel_get_current_ms, my_mqtt_timer_wheel_get_current_ms);
+    REGISTER_GLOBAL_MOCK_HOOK(ThreadAPI_Create, my_ThreadAPI_Create);
+    REGISTER_GLOBAL_MOCK_HOOK(ThreadAPI_Join, my_ThreadAPI_Join);
+
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_set_wakeup_callback, my_mqtt_client_set_wakeup_callback);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_set_recv_pool, my_mqtt_client_set_recv_pool);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_set_timer_wheel, my_mqtt_client_set_timer_wheel);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_get_wait_info, my_mqtt_client_get_wait_info);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_dowork, my_mqtt_client_dowork);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    size_t index;
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    for (index = 0; index < TEST_CLIENT_COUNT; index++)
+    {
+        set_wait_info(index, UINT32_MAX, false, false);
+        g_clients[index].onWakeup = NULL;
+        g_clients[index].wakeupCtx = NULL;
+        g_clients[index].recvPool = NULL;
+        g_clients[index].timerWheel = NULL;
+        g_clients[index].onDue = NULL;
+        g_clients[index].dueCtx = NULL;
+        (void)memset(&g_clients[index].timer, 0, sizeof(MQTT_TIMER));
+        g_clients[index].socket = -1;
+        g_clients[index].doworkCount = 0;
+    }
+    g_current_ms = 1000;
+    g_wheelCount = 0;
+    g_workCount = 0;
+    g_workClient = NULL;
+    g_workContext = NULL;
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_001: [ If options is NULL or its workerCount is 0 then mqtt_client_group_create shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_group_create_options_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_CLIENT_GROUP_HANDLE handle = mqtt_client_group_create(NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_001: [ If options is NULL or its workerCount is 0 then mqtt_client_group_create shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_group_create_workerCount_0_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_OPTIONS options = { 0, TEST_MAX_WAIT_MS, TEST_RECV_POOL_HIGH_WATER_MARK };
+
+    // act
+    MQTT_CLIENT_GROUP_HANDLE handle = mqtt_client_group_create(&options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_002: [ mqtt_client_group_create shall create workerCount workers, each with an epoll set, a non-blocking eventfd in the set, a tick counter, a timer wheel and, if recvPoolHighWaterMark is not 0, a receive buffer pool with that high water mark. ] */
+TEST_FUNCTION(mqtt_client_group_create_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_OPTIONS options = { 2, TEST_MAX_WAIT_MS, TEST_RECV_POOL_HIGH_WATER_MARK };
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_create());
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_create(1000));
+    STRICT_EXPECTED_CALL(mqtt_codec_recv_pool_create(TEST_RECV_POOL_HIGH_WATER_MARK));
+    STRICT_EXPECTED_CALL(tickcounter_create());
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_create(1000));
+    STRICT_EXPECTED_CALL(mqtt_codec_recv_pool_create(TEST_RECV_POOL_HIGH_WATER_MARK));
+
+    // act
+    MQTT_CLIENT_GROUP_HANDLE handle = mqtt_client_group_create(&options);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_002: [ mqtt_client_group_create shall create workerCount workers, each with an epoll set, a non-blocking eventfd in the set, a tick counter, a timer wheel and, if recvPoolHighWaterMark is not 0, a receive buffer pool with that high water mark. ] */
+TEST_FUNCTION(mqtt_client_group_create_without_recv_pool_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_OPTIONS options = { 1, TEST_MAX_WAIT_MS, 0 };
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_create());
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_create(1000));
+
+    // act
+    MQTT_CLIENT_GROUP_HANDLE handle = mqtt_client_group_create(&options);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_003: [ If any failure is encountered then mqtt_client_group_create shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_group_create_malloc_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_OPTIONS options = { 1, TEST_MAX_WAIT_MS, TEST_RECV_POOL_HIGH_WATER_MARK };
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_CLIENT_GROUP_HANDLE handle = mqtt_client_group_create(&options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_003: [ If any failure is encountered then mqtt_client_group_create shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_group_create_second_worker_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_OPTIONS options = { 2, TEST_MAX_WAIT_MS, TEST_RECV_POOL_HIGH_WATER_MARK };
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_create());
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_create(1000));
+    STRICT_EXPECTED_CALL(mqtt_codec_recv_pool_create(TEST_RECV_POOL_HIGH_WATER_MARK));
+    STRICT_EXPECTED_CALL(tickcounter_create());
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_create(1000));
+    STRICT_EXPECTED_CALL(mqtt_codec_recv_pool_create(TEST_RECV_POOL_HIGH_WATER_MARK)).SetReturn(NULL);
+    STRICT_EXPECTED_CALL(tickcounter_destroy(TEST_TICK_COUNTER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_destroy(TEST_TIMER_WHEEL(1)));
+    STRICT_EXPECTED_CALL(tickcounter_destroy(TEST_TICK_COUNTER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_destroy(TEST_TIMER_WHEEL(0)));
+    STRICT_EXPECTED_CALL(mqtt_codec_recv_pool_destroy(TEST_RECV_POOL_HANDLE));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_CLIENT_GROUP_HANDLE handle = mqtt_client_group_create(&options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_003: [ If any failure is encountered then mqtt_client_group_create shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_group_create_timer_wheel_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_OPTIONS options = { 1, TEST_MAX_WAIT_MS, TEST_RECV_POOL_HIGH_WATER_MARK };
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_create());
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_create(1000)).SetReturn(NULL);
+    STRICT_EXPECTED_CALL(tickcounter_destroy(TEST_TICK_COUNTER_HANDLE));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_CLIENT_GROUP_HANDLE handle = mqtt_client_group_create(&options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_004: [ If handle is NULL then mqtt_client_group_destroy shall do nothing. ] */
+TEST_FUNCTION(mqtt_client_group_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_client_group_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_006: [ mqtt_client_group_destroy shall apply the adds, posts and removes that are still queued, detach the remaining clients as mqtt_client_group_remove does without calling mqtt_client_dowork, and free the workers and the group. ] */
+TEST_FUNCTION(mqtt_client_group_destroy_detaches_clients_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, TEST_MAX_WAIT_MS);
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = add_client(handle, 0);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_group_post(member, test_work, TEST_WORK_CONTEXT));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_client_set_wakeup_callback(TEST_CLIENT(0), NULL, NULL));
+    STRICT_EXPECTED_CALL(mqtt_client_set_recv_pool(TEST_CLIENT(0), NULL));
+    STRICT_EXPECTED_CALL(mqtt_client_set_timer_wheel(TEST_CLIENT(0), NULL, NULL, NULL));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_cancel(TEST_TIMER_WHEEL(0), IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_destroy(TEST_TICK_COUNTER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_destroy(TEST_TIMER_WHEEL(0)));
+    STRICT_EXPECTED_CALL(mqtt_codec_recv_pool_destroy(TEST_RECV_POOL_HANDLE));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    mqtt_client_group_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_workCount);
+    ASSERT_ARE_EQUAL(size_t, 1, g_clients[0].doworkCount);
+    ASSERT_IS_NULL(g_clients[0].onWakeup);
+    ASSERT_IS_NULL(g_clients[0].recvPool);
+    ASSERT_IS_NULL(g_clients[0].timerWheel);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_005: [ mqtt_client_group_destroy shall stop the worker threads if the group is started. ] */
+TEST_FUNCTION(mqtt_client_group_destroy_started_joins_workers_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(2, TEST_MAX_WAIT_MS);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_group_start(handle));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(ThreadAPI_Join(TEST_THREAD_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(ThreadAPI_Join(TEST_THREAD_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_destroy(TEST_TICK_COUNTER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_destroy(TEST_TIMER_WHEEL(0)));
+    STRICT_EXPECTED_CALL(mqtt_codec_recv_pool_destroy(TEST_RECV_POOL_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_destroy(TEST_TICK_COUNTER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_destroy(TEST_TIMER_WHEEL(1)));
+    STRICT_EXPECTED_CALL(mqtt_codec_recv_pool_destroy(TEST_RECV_POOL_HANDLE));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    mqtt_client_group_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_007: [ If handle is NULL or the group is already started then mqtt_client_group_start shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_start_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_group_start(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_007: [ If handle is NULL or the group is already started then mqtt_client_group_start shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_start_twice_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, TEST_MAX_WAIT_MS);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_group_start(handle));
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_group_start(handle);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_008: [ mqtt_client_group_start shall start one thread per worker that calls mqtt_client_group_run_worker_once for it until mqtt_client_group_stop is called. ] */
+TEST_FUNCTION(mqtt_client_group_start_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(2, TEST_MAX_WAIT_MS);
+
+    STRICT_EXPECTED_CALL(ThreadAPI_Create(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(ThreadAPI_Create(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_group_start(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_NOT_EQUAL(int, 0, mqtt_client_group_run_worker_once(handle, 0));
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_009: [ If a thread cannot be started then mqtt_client_group_start shall stop the threads it started and return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_start_thread_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(2, TEST_MAX_WAIT_MS);
+
+    STRICT_EXPECTED_CALL(ThreadAPI_Create(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(ThreadAPI_Create(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG)).SetReturn(THREADAPI_ERROR);
+    STRICT_EXPECTED_CALL(ThreadAPI_Join(TEST_THREAD_HANDLE, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_group_start(handle);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_010: [ If handle is NULL then mqtt_client_group_stop shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_stop_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_group_stop(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_011: [ mqtt_client_group_stop shall wake every worker, wait for the worker threads to exit and return 0, also when the group is not started. ] */
+TEST_FUNCTION(mqtt_client_group_stop_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(2, TEST_MAX_WAIT_MS);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_group_start(handle));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(ThreadAPI_Join(TEST_THREAD_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(ThreadAPI_Join(TEST_THREAD_HANDLE, IGNORED_ARG));
+
+    // act
+    int result_1 = mqtt_client_group_stop(handle);
+    int result_2 = mqtt_client_group_stop(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result_1);
+    ASSERT_ARE_EQUAL(int, 0, result_2);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_012: [ If handle or client is NULL, or getSocket is NULL while the group has a maxWaitMs of 0, then mqtt_client_group_add shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_group_add_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = mqtt_client_group_add(NULL, TEST_CLIENT(0), test_get_socket, &g_clients[0]);
+
+    // assert
+    ASSERT_IS_NULL(member);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_012: [ If handle or client is NULL, or getSocket is NULL while the group has a maxWaitMs of 0, then mqtt_client_group_add shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_group_add_client_NULL_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, TEST_MAX_WAIT_MS);
+
+    // act
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = mqtt_client_group_add(handle, NULL, test_get_socket, &g_clients[0]);
+
+    // assert
+    ASSERT_IS_NULL(member);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_012: [ If handle or client is NULL, or getSocket is NULL while the group has a maxWaitMs of 0, then mqtt_client_group_add shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_group_add_no_socket_no_max_wait_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, 0);
+
+    // act
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = mqtt_client_group_add(handle, TEST_CLIENT(0), NULL, NULL);
+
+    // assert
+    ASSERT_IS_NULL(member);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_013: [ If any failure is encountered then mqtt_client_group_add shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_group_add_malloc_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, TEST_MAX_WAIT_MS);
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = mqtt_client_group_add(handle, TEST_CLIENT(0), test_get_socket, &g_clients[0]);
+
+    // assert
+    ASSERT_IS_NULL(member);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_015: [ mqtt_client_group_add shall queue the member for its worker and signal the eventfd of the worker. ] */
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_016: [ The worker shall set a wakeup callback on the client that queues the member for mqtt_client_dowork and signals the eventfd of the worker. ] */
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_017: [ If the group was created with a recvPoolHighWaterMark the worker shall make the client take its receive buffers from the pool of the worker with mqtt_client_set_recv_pool. ] */
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_032: [ The worker shall make the client tell time from the timer wheel of the worker and keep its timer there with mqtt_client_set_timer_wheel, with a callback that queues the member for mqtt_client_dowork. ] */
+TEST_FUNCTION(mqtt_client_group_run_worker_once_applies_add_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, TEST_MAX_WAIT_MS);
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = mqtt_client_group_add(handle, TEST_CLIENT(0), test_get_socket, &g_clients[0]);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_timeout(TEST_TIMER_WHEEL(0), 1000));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_advance(TEST_TIMER_WHEEL(0), 1000));
+    STRICT_EXPECTED_CALL(mqtt_client_set_wakeup_callback(TEST_CLIENT(0), IGNORED_ARG, member));
+    STRICT_EXPECTED_CALL(mqtt_client_set_recv_pool(TEST_CLIENT(0), TEST_RECV_POOL_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_client_set_timer_wheel(TEST_CLIENT(0), TEST_TIMER_WHEEL(0), IGNORED_ARG, member));
+    STRICT_EXPECTED_CALL(mqtt_client_dowork(TEST_CLIENT(0)));
+    STRICT_EXPECTED_CALL(mqtt_client_get_wait_info(TEST_CLIENT(0), IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_current_ms(TEST_TIMER_WHEEL(0)));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_schedule(TEST_TIMER_WHEEL(0), IGNORED_ARG, 1000 + TEST_MAX_WAIT_MS, IGNORED_ARG, member));
+
+    // act
+    int result = mqtt_client_group_run_worker_once(handle, 0);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NOT_NULL(g_clients[0].onWakeup);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_RECV_POOL_HANDLE, g_clients[0].recvPool);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_TIMER_WHEEL(0), g_clients[0].timerWheel);
+    ASSERT_ARE_EQUAL(size_t, 1, g_clients[0].doworkCount);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_014: [ mqtt_client_group_add shall assign the client to the worker with the fewest members, which drives it until it is removed. ] */
+TEST_FUNCTION(mqtt_client_group_add_assigns_worker_with_fewest_members_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(2, TEST_MAX_WAIT_MS);
+    size_t index;
+    for (index = 0; index < TEST_CLIENT_COUNT; index++)
+    {
+        ASSERT_IS_NOT_NULL(mqtt_client_group_add(handle, TEST_CLIENT(index), test_get_socket, &g_clients[index]));
+    }
+
+    // act
+    int result = mqtt_client_group_run_worker_once(handle, 0);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, g_clients[0].doworkCount);
+    ASSERT_ARE_EQUAL(size_t, 0, g_clients[1].doworkCount);
+    ASSERT_ARE_EQUAL(size_t, 1, g_clients[2].doworkCount);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_group_run_worker_once(handle, 1));
+    ASSERT_ARE_EQUAL(size_t, 1, g_clients[1].doworkCount);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_018: [ If handle is NULL, workerIndex is not below the worker count or the group is started then mqtt_client_group_run_worker_once shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_run_worker_once_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_group_run_worker_once(NULL, 0);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_018: [ If handle is NULL, workerIndex is not below the worker count or the group is started then mqtt_client_group_run_worker_once shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_run_worker_once_workerIndex_out_of_range_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(2, TEST_MAX_WAIT_MS);
+
+    // act
+    int result = mqtt_client_group_run_worker_once(handle, 2);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_019: [ mqtt_client_group_run_worker_once shall run the worker on the calling thread once: wait, then apply the queued adds, posts and removes, then call mqtt_client_dowork for the members that have work. ] */
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_022: [ After mqtt_client_dowork the worker shall wait on the socket the getter of the member returns for input if waitRead is true and for output if waitWrite is true, and shall not wait on a socket of -1. ] */
+TEST_FUNCTION(mqtt_client_group_run_worker_once_readable_socket_succeed)
+{
+    // arrange
+    int fds[2];
+    char data = 'x';
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, 0);
+    ASSERT_ARE_EQUAL(int, 0, pipe(fds));
+    g_clients[0].socket = fds[0];
+    set_wait_info(0, UINT32_MAX, true, false);
+    (void)add_client(handle, 0);
+    ASSERT_ARE_EQUAL(int, 1, (int)write(fds[1], &data, 1));
+
+    // act
+    int result = mqtt_client_group_run_worker_once(handle, 0);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, g_clients[0].doworkCount);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_020: [ mqtt_client_group_run_worker_once shall wait until the timer wheel of the worker has timers to expire, without limit if it has none, or until a socket of a member or the eventfd of the worker ends the wait, and then advance the wheel to the current time. ] */
+TEST_FUNCTION(mqtt_client_group_run_worker_once_waits_until_due_succeed)
+{
+    // arrange
+    struct timespec start;
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, 0);
+    set_wait_info(0, TEST_WAIT_MS, false, false);
+    (void)add_client(handle, 0);
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // act
+    int result = mqtt_client_group_run_worker_once(handle, 0);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_TRUE(get_elapsed_ms(&start) >= TEST_WAIT_MS / 2);
+    // The mocked tick counter did not move, so the client is not due yet
+    ASSERT_ARE_EQUAL(size_t, 1, g_clients[0].doworkCount);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_021: [ After the wait mqtt_client_group_run_worker_once shall call mqtt_client_dowork once for every member of the worker whose socket ended the wait, that was woken up, posted to or added, or whose timer expired, and return 0. ] */
+TEST_FUNCTION(mqtt_client_group_run_worker_once_due_member_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, 0);
+    set_wait_info(0, 1000, false, false);
+    (void)add_client(handle, 0);
+    g_current_ms += 1000;
+
+    // act
+    int result = mqtt_client_group_run_worker_once(handle, 0);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, g_clients[0].doworkCount);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_016: [ The worker shall set a wakeup callback on the client that queues the member for mqtt_client_dowork and signals the eventfd of the worker. ] */
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_021: [ After the wait mqtt_client_group_run_worker_once shall call mqtt_client_dowork once for every member of the worker whose socket ended the wait, that was woken up, posted to or added, or whose timer expired, and return 0. ] */
+TEST_FUNCTION(mqtt_client_group_run_worker_once_wakeup_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, 0);
+    (void)add_client(handle, 0);
+    g_clients[0].onWakeup(g_clients[0].wakeupCtx);
+    g_clients[0].onWakeup(g_clients[0].wakeupCtx);
+
+    // act
+    int result = mqtt_client_group_run_worker_once(handle, 0);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, g_clients[0].doworkCount);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_023: [ The member shall be worked again right away when timeoutMs of mqtt_client_get_wait_info is 0, when the timer of its client on the timer wheel of the worker expires, after at most maxWaitMs when it is not 0, and after at most maxWaitMs or 100 milliseconds while its client waits for a socket the worker does not know. ] */
+TEST_FUNCTION(mqtt_client_group_run_worker_once_polls_unknown_socket_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, 0);
+    set_wait_info(0, UINT32_MAX, true, false);
+    (void)add_client(handle, 0);
+    g_current_ms += 100;
+
+    // act
+    int result = mqtt_client_group_run_worker_once(handle, 0);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, g_clients[0].doworkCount);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_023: [ The member shall be worked again right away when timeoutMs of mqtt_client_get_wait_info is 0, when the timer of its client on the timer wheel of the worker expires, after at most maxWaitMs when it is not 0, and after at most maxWaitMs or 100 milliseconds while its client waits for a socket the worker does not know. ] */
+TEST_FUNCTION(mqtt_client_group_run_worker_once_client_without_timer_wheel_polls_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, 0);
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member;
+    set_wait_info(0, TEST_WAIT_MS, false, false);
+    member = mqtt_client_group_add(handle, TEST_CLIENT(0), test_get_socket, &g_clients[0]);
+    ASSERT_IS_NOT_NULL(member);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_timeout(TEST_TIMER_WHEEL(0), 1000));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_advance(TEST_TIMER_WHEEL(0), 1000));
+    STRICT_EXPECTED_CALL(mqtt_client_set_wakeup_callback(TEST_CLIENT(0), IGNORED_ARG, member));
+    STRICT_EXPECTED_CALL(mqtt_client_set_recv_pool(TEST_CLIENT(0), TEST_RECV_POOL_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_client_set_timer_wheel(TEST_CLIENT(0), TEST_TIMER_WHEEL(0), IGNORED_ARG, member)).SetReturn(MU_FAILURE);
+    STRICT_EXPECTED_CALL(mqtt_client_dowork(TEST_CLIENT(0)));
+    STRICT_EXPECTED_CALL(mqtt_client_get_wait_info(TEST_CLIENT(0), IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_current_ms(TEST_TIMER_WHEEL(0)));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_schedule(TEST_TIMER_WHEEL(0), IGNORED_ARG, 1000 + TEST_WAIT_MS, IGNORED_ARG, member));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_group_run_worker_once(handle, 0));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    umock_c_reset_all_calls();
+    g_current_ms += TEST_WAIT_MS;
+
+    // act
+    int result = mqtt_client_group_run_worker_once(handle, 0);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, g_clients[0].doworkCount);
+    ASSERT_IS_NULL(g_clients[0].timerWheel);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_024: [ If any failure is encountered then mqtt_client_group_run_worker_once shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_run_worker_once_tickcounter_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, TEST_MAX_WAIT_MS);
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG)).SetReturn(MU_FAILURE);
+
+    // act
+    int result = mqtt_client_group_run_worker_once(handle, 0);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_025: [ If member or work is NULL then mqtt_client_group_post shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_post_member_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_group_post(NULL, test_work, TEST_WORK_CONTEXT);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_025: [ If member or work is NULL then mqtt_client_group_post shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_post_work_NULL_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, TEST_MAX_WAIT_MS);
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = add_client(handle, 0);
+
+    // act
+    int result = mqtt_client_group_post(member, NULL, TEST_WORK_CONTEXT);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_026: [ mqtt_client_group_post shall queue work and context for the worker of member, signal its eventfd and return 0. ] */
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_027: [ The worker shall call work with the client and context and then call mqtt_client_dowork for the client. ] */
+TEST_FUNCTION(mqtt_client_group_post_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, 0);
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = add_client(handle, 0);
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_group_post(member, test_work, TEST_WORK_CONTEXT);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_workCount);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_group_run_worker_once(handle, 0));
+    ASSERT_ARE_EQUAL(size_t, 1, g_workCount);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_CLIENT(0), g_workClient);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_WORK_CONTEXT, g_workContext);
+    ASSERT_ARE_EQUAL(size_t, 2, g_clients[0].doworkCount);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_028: [ If any failure is encountered then mqtt_client_group_post shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_post_malloc_fail)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, TEST_MAX_WAIT_MS);
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = add_client(handle, 0);
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    int result = mqtt_client_group_post(member, test_work, TEST_WORK_CONTEXT);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_029: [ If member is NULL then mqtt_client_group_remove shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_group_remove_member_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_group_remove(NULL, test_work, TEST_WORK_CONTEXT);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_030: [ mqtt_client_group_remove shall queue the removal of member for its worker, signal its eventfd and return 0. ] */
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_031: [ The worker shall remove the wakeup callback, the receive buffer pool and the timer wheel it set on the client, stop waiting on its socket, call onRemoved with the client and context if onRemoved is not NULL and free the member. ] */
+TEST_FUNCTION(mqtt_client_group_remove_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, TEST_MAX_WAIT_MS);
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = add_client(handle, 0);
+
+    // act
+    int result = mqtt_client_group_remove(member, test_work, TEST_WORK_CONTEXT);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, g_workCount);
+
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_timeout(TEST_TIMER_WHEEL(0), 1000));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_advance(TEST_TIMER_WHEEL(0), 1000));
+    STRICT_EXPECTED_CALL(mqtt_client_set_wakeup_callback(TEST_CLIENT(0), NULL, NULL));
+    STRICT_EXPECTED_CALL(mqtt_client_set_recv_pool(TEST_CLIENT(0), NULL));
+    STRICT_EXPECTED_CALL(mqtt_client_set_timer_wheel(TEST_CLIENT(0), NULL, NULL, NULL));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_cancel(TEST_TIMER_WHEEL(0), IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_group_run_worker_once(handle, 0));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_workCount);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_CLIENT(0), g_workClient);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_WORK_CONTEXT, g_workContext);
+    ASSERT_ARE_EQUAL(size_t, 1, g_clients[0].doworkCount);
+    ASSERT_IS_NULL(g_clients[0].onWakeup);
+    ASSERT_IS_NULL(g_clients[0].recvPool);
+    ASSERT_IS_NULL(g_clients[0].timerWheel);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_GROUP_07_031: [ The worker shall remove the wakeup callback, the receive buffer pool and the timer wheel it set on the client, stop waiting on its socket, call onRemoved with the client and context if onRemoved is not NULL and free the member. ] */
+TEST_FUNCTION(mqtt_client_group_remove_after_wakeup_succeed)
+{
+    // arrange
+    MQTT_CLIENT_GROUP_HANDLE handle = create_group(1, TEST_MAX_WAIT_MS);
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE member = add_client(handle, 0);
+    (void)add_client(handle, 1);
+    g_clients[0].onWakeup(g_clients[0].wakeupCtx);
+
+    // act
+    int result = mqtt_client_group_remove(member, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_group_run_worker_once(handle, 0));
+    ASSERT_ARE_EQUAL(size_t, 1, g_clients[0].doworkCount);
+    ASSERT_IS_NULL(g_clients[0].onWakeup);
+
+    // cleanup
+    mqtt_client_group_destroy(handle);
+}
+
+END_TEST_SUITE(mqtt_client_group_ut)
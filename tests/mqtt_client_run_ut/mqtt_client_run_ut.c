@@ -0,0 +1,567 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#include <time.h>
+#include <unistd.h>
+
+#include "testrunnerswitcher.h"
+#include "umock_c/umock_c.h"
+#include "umock_c/umock_c_negative_tests.h"
+#include "umock_c/umocktypes_charptr.h"
+#include "umock_c/umocktypes_stdint.h"
+#include "umock_c/umocktypes.h"
+#include "umock_c/umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "umock_c/umock_c_prod.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_client_run.h"
+
+static MQTT_CLIENT_HANDLE TEST_CLIENT_HANDLE = (MQTT_CLIENT_HANDLE)0x11;
+static const uint32_t TEST_MAX_WAIT_MS = 1;
+// Long enough that a second wait that was not ended by a left over wakeup is told apart from one that was
+static const uint32_t TEST_WAKEUP_WAIT_MS = 100;
+
+static MQTT_CLIENT_WAIT_INFO g_waitInfo;
+static ON_MQTT_CLIENT_WAKEUP g_onWakeup;
+static void* g_wakeupCtx;
+static int g_socket;
+static size_t g_doworkCount;
+static MQTT_CLIENT_RUN_HANDLE g_stopRun;
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+MU_DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    ASSERT_FAIL("umock_c reported error :%s", MU_ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+}
+
+static int my_mqtt_client_set_wakeup_callback(MQTT_CLIENT_HANDLE handle, ON_MQTT_CLIENT_WAKEUP onWakeup, void* context)
+{
+    (void)handle;
+    g_onWakeup = onWakeup;
+    g_wakeupCtx = context;
+    return 0;
+}
+
+static int my_mqtt_client_get_wait_info(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_WAIT_INFO* waitInfo)
+{
+    (void)handle;
+    *waitInfo = g_waitInfo;
+    return 0;
+}
+
+static void my_mqtt_client_dowork(MQTT_CLIENT_HANDLE handle)
+{
+    (void)handle;
+    g_doworkCount++;
+    if (g_stopRun != NULL)
+    {
+        ASSERT_ARE_EQUAL(int, 0, mqtt_client_run_stop(g_stopRun));
+    }
+}
+
+static int test_get_socket(void* context)
+{
+    (void)context;
+    return g_socket;
+}
+
+static MQTT_CLIENT_RUN_HANDLE create_run(ON_MQTT_CLIENT_RUN_GET_SOCKET getSocket, uint32_t maxWaitMs)
+{
+    MQTT_CLIENT_RUN_OPTIONS options;
+    MQTT_CLIENT_RUN_HANDLE result;
+    options.getSocket = getSocket;
+    options.getSocketContext = NULL;
+    options.maxWaitMs = maxWaitMs;
+    result = mqtt_client_run_create(TEST_CLIENT_HANDLE, &options);
+    ASSERT_IS_NOT_NULL(result);
+    umock_c_reset_all_calls();
+    return result;
+}
+
+// What the mocked mqtt_client_get_wait_info reports
+static void set_wait_info(uint32_t timeoutMs, bool waitRead, bool waitWrite)
+{
+    g_waitInfo.timeoutMs = timeoutMs;
+    g_waitInfo.waitRead = waitRead;
+    g_waitInfo.waitWrite = waitWrite;
+}
+
+BEGIN_TEST_SUITE(mqtt_client_run_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CLIENT_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_CLIENT_WAKEUP, void*);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_set_wakeup_callback, my_mqtt_client_set_wakeup_callback);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_get_wait_info, my_mqtt_client_get_wait_info);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_dowork, my_mqtt_client_dowork);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    set_wait_info(UINT32_MAX, false, false);
+    g_onWakeup = NULL;
+    g_wakeupCtx = NULL;
+    g_socket = -1;
+    g_doworkCount = 0;
+    g_stopRun = NULL;
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_001: [ If client or options is NULL, or options has no getSocket and a maxWaitMs of 0, then mqtt_client_run_create shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_run_create_client_NULL_fail)
+{
+    // arrange
+    MQTT_CLIENT_RUN_OPTIONS options = { test_get_socket, NULL, 0 };
+
+    // act
+    MQTT_CLIENT_RUN_HANDLE handle = mqtt_client_run_create(NULL, &options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_001: [ If client or options is NULL, or options has no getSocket and a maxWaitMs of 0, then mqtt_client_run_create shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_run_create_options_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_CLIENT_RUN_HANDLE handle = mqtt_client_run_create(TEST_CLIENT_HANDLE, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_001: [ If client or options is NULL, or options has no getSocket and a maxWaitMs of 0, then mqtt_client_run_create shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_run_create_no_socket_no_max_wait_fail)
+{
+    // arrange
+    MQTT_CLIENT_RUN_OPTIONS options = { NULL, NULL, 0 };
+
+    // act
+    MQTT_CLIENT_RUN_HANDLE handle = mqtt_client_run_create(TEST_CLIENT_HANDLE, &options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_002: [ mqtt_client_run_create shall create an epoll set and a non-blocking eventfd and add the eventfd to the set for input. ] */
+/* Tests_SRS_MQTT_CLIENT_RUN_07_003: [ mqtt_client_run_create shall set a wakeup callback on client with mqtt_client_set_wakeup_callback that signals the eventfd. ] */
+TEST_FUNCTION(mqtt_client_run_create_succeed)
+{
+    // arrange
+    MQTT_CLIENT_RUN_OPTIONS options = { NULL, NULL, TEST_MAX_WAIT_MS };
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_client_set_wakeup_callback(TEST_CLIENT_HANDLE, IGNORED_ARG, IGNORED_ARG));
+
+    // act
+    MQTT_CLIENT_RUN_HANDLE handle = mqtt_client_run_create(TEST_CLIENT_HANDLE, &options);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NOT_NULL(g_onWakeup);
+    ASSERT_ARE_EQUAL(void_ptr, handle, g_wakeupCtx);
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_004: [ If any failure is encountered then mqtt_client_run_create shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_run_create_malloc_fail)
+{
+    // arrange
+    MQTT_CLIENT_RUN_OPTIONS options = { NULL, NULL, TEST_MAX_WAIT_MS };
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_CLIENT_RUN_HANDLE handle = mqtt_client_run_create(TEST_CLIENT_HANDLE, &options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_004: [ If any failure is encountered then mqtt_client_run_create shall return NULL. ] */
+TEST_FUNCTION(mqtt_client_run_create_set_wakeup_callback_fail)
+{
+    // arrange
+    MQTT_CLIENT_RUN_OPTIONS options = { NULL, NULL, TEST_MAX_WAIT_MS };
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_client_set_wakeup_callback(TEST_CLIENT_HANDLE, IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_CLIENT_RUN_HANDLE handle = mqtt_client_run_create(TEST_CLIENT_HANDLE, &options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_005: [ If handle is NULL then mqtt_client_run_destroy shall do nothing. ] */
+TEST_FUNCTION(mqtt_client_run_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_client_run_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_006: [ mqtt_client_run_destroy shall remove the wakeup callback from the client, close the eventfd and the epoll set and free the run loop. ] */
+TEST_FUNCTION(mqtt_client_run_destroy_succeed)
+{
+    // arrange
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(NULL, TEST_MAX_WAIT_MS);
+    STRICT_EXPECTED_CALL(mqtt_client_set_wakeup_callback(TEST_CLIENT_HANDLE, NULL, NULL));
+    STRICT_EXPECTED_CALL(gballoc_free(handle));
+
+    // act
+    mqtt_client_run_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(g_onWakeup);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_007: [ If handle is NULL then mqtt_client_run_once shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_run_once_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_run_once(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_008: [ mqtt_client_run_once shall get the timeout and the socket events to wait for with mqtt_client_get_wait_info. ] */
+/* Tests_SRS_MQTT_CLIENT_RUN_07_012: [ After the wait mqtt_client_run_once shall call mqtt_client_dowork once and return 0. ] */
+TEST_FUNCTION(mqtt_client_run_once_no_timeout_calls_dowork_succeed)
+{
+    // arrange
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(test_get_socket, 0);
+    set_wait_info(0, true, false);
+    STRICT_EXPECTED_CALL(mqtt_client_get_wait_info(TEST_CLIENT_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_client_dowork(TEST_CLIENT_HANDLE));
+
+    // act
+    int result = mqtt_client_run_once(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_013: [ If any failure is encountered then mqtt_client_run_once shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_run_once_get_wait_info_fail)
+{
+    // arrange
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(test_get_socket, 0);
+    STRICT_EXPECTED_CALL(mqtt_client_get_wait_info(TEST_CLIENT_HANDLE, IGNORED_ARG)).SetReturn(MU_FAILURE);
+
+    // act
+    int result = mqtt_client_run_once(handle);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_009: [ When a socket getter was given, mqtt_client_run_once shall wait on the socket it returns for input if waitRead is true and for output if waitWrite is true, and shall not wait on a socket of -1. ] */
+TEST_FUNCTION(mqtt_client_run_once_readable_socket_ends_wait_succeed)
+{
+    // arrange
+    int fds[2];
+    ASSERT_ARE_EQUAL(int, 0, pipe(fds));
+    ASSERT_ARE_EQUAL(int, 1, (int)write(fds[1], "x", 1));
+    g_socket = fds[0];
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(test_get_socket, 0);
+    set_wait_info(UINT32_MAX, true, false);
+
+    // act
+    int result = mqtt_client_run_once(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, g_doworkCount);
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_009: [ When a socket getter was given, mqtt_client_run_once shall wait on the socket it returns for input if waitRead is true and for output if waitWrite is true, and shall not wait on a socket of -1. ] */
+TEST_FUNCTION(mqtt_client_run_once_writable_socket_ends_wait_succeed)
+{
+    // arrange
+    int fds[2];
+    ASSERT_ARE_EQUAL(int, 0, pipe(fds));
+    g_socket = fds[1];
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(test_get_socket, 0);
+    set_wait_info(UINT32_MAX, false, true);
+
+    // act
+    int result = mqtt_client_run_once(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, g_doworkCount);
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_009: [ When a socket getter was given, mqtt_client_run_once shall wait on the socket it returns for input if waitRead is true and for output if waitWrite is true, and shall not wait on a socket of -1. ] */
+TEST_FUNCTION(mqtt_client_run_once_socket_reopened_between_waits_succeed)
+{
+    // arrange
+    int fds[2];
+    ASSERT_ARE_EQUAL(int, 0, pipe(fds));
+    ASSERT_ARE_EQUAL(int, 1, (int)write(fds[1], "x", 1));
+    g_socket = fds[0];
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(test_get_socket, 0);
+    set_wait_info(UINT32_MAX, true, false);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_run_once(handle));
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+    ASSERT_ARE_EQUAL(int, 0, pipe(fds));
+    ASSERT_ARE_EQUAL(int, 1, (int)write(fds[1], "x", 1));
+    g_socket = fds[0];
+
+    // act
+    int result = mqtt_client_run_once(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, g_doworkCount);
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+    (void)close(fds[0]);
+    (void)close(fds[1]);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_010: [ mqtt_client_run_once shall wait for at most timeoutMs, without limit if it is UINT32_MAX, and for at most maxWaitMs when maxWaitMs is not 0. ] */
+TEST_FUNCTION(mqtt_client_run_once_max_wait_ms_ends_wait_succeed)
+{
+    // arrange
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(NULL, TEST_MAX_WAIT_MS);
+    set_wait_info(UINT32_MAX, true, true);
+
+    // act
+    int result = mqtt_client_run_once(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, g_doworkCount);
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_011: [ A wakeup shall end the wait and shall be cleared before mqtt_client_dowork is called. ] */
+TEST_FUNCTION(mqtt_client_run_once_client_wakeup_ends_wait_succeed)
+{
+    // arrange
+    struct timespec start;
+    struct timespec end;
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(NULL, TEST_WAKEUP_WAIT_MS);
+    g_onWakeup(g_wakeupCtx);
+    g_onWakeup(g_wakeupCtx);
+
+    // act
+    int result = mqtt_client_run_once(handle);
+    ASSERT_ARE_EQUAL(int, 0, clock_gettime(CLOCK_MONOTONIC, &start));
+    int second = mqtt_client_run_once(handle);
+    ASSERT_ARE_EQUAL(int, 0, clock_gettime(CLOCK_MONOTONIC, &end));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, second);
+    ASSERT_ARE_EQUAL(size_t, 2, g_doworkCount);
+    ASSERT_IS_TRUE((end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000 >= TEST_WAKEUP_WAIT_MS / 2);
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_014: [ If handle is NULL then mqtt_client_run shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_run_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_run(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_015: [ mqtt_client_run shall call mqtt_client_run_once until mqtt_client_run_stop is called, then clear the stop request and return 0. ] */
+/* Tests_SRS_MQTT_CLIENT_RUN_07_020: [ mqtt_client_run_stop shall request mqtt_client_run to return and wake it up. ] */
+TEST_FUNCTION(mqtt_client_run_stop_from_dowork_succeed)
+{
+    // arrange
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(test_get_socket, 0);
+    set_wait_info(0, true, false);
+    g_stopRun = handle;
+
+    // act
+    int result = mqtt_client_run(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, g_doworkCount);
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_016: [ If mqtt_client_run_once fails then mqtt_client_run shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_run_get_wait_info_fail)
+{
+    // arrange
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(test_get_socket, 0);
+    STRICT_EXPECTED_CALL(mqtt_client_get_wait_info(TEST_CLIENT_HANDLE, IGNORED_ARG)).SetReturn(MU_FAILURE);
+
+    // act
+    int result = mqtt_client_run(handle);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_017: [ If handle is NULL then mqtt_client_run_wakeup shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_run_wakeup_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_run_wakeup(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_018: [ mqtt_client_run_wakeup shall signal the eventfd and return 0, a wakeup that is already pending is not an error. ] */
+TEST_FUNCTION(mqtt_client_run_wakeup_ends_wait_succeed)
+{
+    // arrange
+    MQTT_CLIENT_RUN_HANDLE handle = create_run(test_get_socket, 0);
+
+    // act
+    int result = mqtt_client_run_wakeup(handle);
+    int second = mqtt_client_run_wakeup(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, second);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_run_once(handle));
+    ASSERT_ARE_EQUAL(size_t, 1, g_doworkCount);
+
+    // cleanup
+    mqtt_client_run_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_RUN_07_019: [ If handle is NULL then mqtt_client_run_stop shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_client_run_stop_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_run_stop(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+END_TEST_SUITE(mqtt_client_run_ut)
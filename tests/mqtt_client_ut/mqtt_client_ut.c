@@ -40,12 +40,20 @@ static void my_gballoc_free(void* ptr)
 #include "azure_c_shared_utility/agenttime.h"
 #include "azure_c_shared_utility/buffer_.h"
 #include "azure_c_shared_utility/strings.h"
-#include "azure_c_shared_utility/threadapi.h"
 
 #include "azure_umqtt_c/mqtt_codec.h"
 #include "azure_umqtt_c/mqtt_message.h"
+#include "azure_umqtt_c/mqtt_session_store.h"
+#include "azure_umqtt_c/mqtt_offline_queue.h"
+#include "azure_umqtt_c/mqtt_topic_trie.h"
+#include "azure_umqtt_c/mqtt_topic_table.h"
+#include "azure_umqtt_c/mqtt_submit_queue.h"
+#include "azure_umqtt_c/mqtt_timer_wheel.h"
+#include "azure_umqtt_c/mqtt_trace_ring.h"
+#include "azure_umqtt_c/mqtt_capture.h"
 #include "azure_c_shared_utility/gballoc.h"
 #include "azure_c_shared_utility/platform.h"
+#include "azure_c_shared_utility/threadapi.h"
 
 #undef ENABLE_MOCKS
 
@@ -74,6 +82,8 @@ extern "C"
 
 TEST_DEFINE_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
 IMPLEMENT_UMOCK_C_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+TEST_DEFINE_ENUM_TYPE(MQTT_TRACE_DIRECTION, MQTT_TRACE_DIRECTION_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(MQTT_TRACE_DIRECTION, MQTT_TRACE_DIRECTION_VALUES);
 
 static const char* TEST_USERNAME = "testuser";
 static const char* TEST_PASSWORD = "testpassword";
@@ -90,18 +100,47 @@ static const char* TEST_UNSUBSCRIPTION_TOPIC[] = { "subTopic1", "subTopic2" };
 static const XIO_HANDLE TEST_IO_HANDLE = (XIO_HANDLE)0x11;
 static const TICK_COUNTER_HANDLE TEST_COUNTER_HANDLE = (TICK_COUNTER_HANDLE)0x12;
 static const MQTTCODEC_HANDLE TEST_MQTTCODEC_HANDLE = (MQTTCODEC_HANDLE)0x13;
+static const MQTT_CODEC_RECV_POOL_HANDLE TEST_RECV_POOL_HANDLE = (MQTT_CODEC_RECV_POOL_HANDLE)0x20;
 static const MQTT_MESSAGE_HANDLE TEST_MESSAGE_HANDLE = (MQTT_MESSAGE_HANDLE)0x14;
+static const MQTT_SESSION_STORE_HANDLE TEST_SESSION_STORE_HANDLE = (MQTT_SESSION_STORE_HANDLE)0x1a;
+static const MQTT_OFFLINE_QUEUE_HANDLE TEST_OFFLINE_QUEUE_HANDLE = (MQTT_OFFLINE_QUEUE_HANDLE)0x1b;
+static const MQTT_TOPIC_TRIE_HANDLE TEST_TOPIC_TRIE_HANDLE = (MQTT_TOPIC_TRIE_HANDLE)0x1c;
+static const MQTT_TOPIC_TABLE_HANDLE TEST_TOPIC_TABLE_HANDLE = (MQTT_TOPIC_TABLE_HANDLE)0x1d;
+static const MQTT_TOPIC_HANDLE TEST_INTERNED_TOPIC = (MQTT_TOPIC_HANDLE)0x1e;
+static const MQTT_SUBMIT_QUEUE_HANDLE TEST_SUBMIT_QUEUE_HANDLE = (MQTT_SUBMIT_QUEUE_HANDLE)0x1f;
+static const MQTT_TIMER_WHEEL_HANDLE TEST_TIMER_WHEEL_HANDLE = (MQTT_TIMER_WHEEL_HANDLE)0x21;
+static void* TEST_DUE_CONTEXT = (void*)0x22;
+static const MQTT_TRACE_RING_HANDLE TEST_TRACE_RING_HANDLE = (MQTT_TRACE_RING_HANDLE)0x23;
+static const MQTT_CAPTURE_HANDLE TEST_CAPTURE_HANDLE = (MQTT_CAPTURE_HANDLE)0x24;
+static const uint8_t TEST_ENCODED_TOPIC[] = { 0x00, 0x0a, 't', 'o', 'p', 'i', 'c', ' ', 'N', 'a', 'm', 'e' };
 static BUFFER_HANDLE TEST_BUFFER_HANDLE = (BUFFER_HANDLE)0x15;
 static const uint16_t TEST_KEEP_ALIVE_INTERVAL = 20;
 static const uint16_t TEST_PACKET_ID = (uint16_t)0x1234;
+#define TEST_MAX_TOPIC_HANDLERS 4
+static const uint32_t TEST_RECONNECT_DELAY_MS = 100;
 static const unsigned char* TEST_BUFFER_U_CHAR = (const unsigned char*)0x19;
 
 static bool g_operationCallbackInvoked;
 static bool g_errorCallbackInvoked;
 static bool g_msgRecvCallbackInvoked;
 static bool g_mqtt_codec_publish_func_fail;
+static size_t g_payloadReleasedCount;
+static IO_SEND_RESULT g_payloadReleasedResult;
 static tickcounter_ms_t g_current_ms;
-ON_PACKET_COMPLETE_CALLBACK g_packetComplete;
+static tickcounter_ms_t g_wheel_ms;
+static ON_MQTT_TOPIC_TRIE_VALUE_DESTROY g_topicValueDestroy;
+static void* g_topicValues[TEST_MAX_TOPIC_HANDLERS];
+static size_t g_topicValueCount;
+static size_t g_topicCallbackCount;
+static MQTT_CLIENT_HANDLE g_topicHandlerClient;
+static int g_topicHandlerChangeResult;
+static size_t g_wakeupCount;
+static void* g_wakeupCtx;
+static bool g_closeAsync;
+static ON_IO_CLOSE_COMPLETE g_closeComplete;
+static void* g_onCloseCtx;
+static MQTT_TRACE_RECORD g_traceRecord;
+ON_PACKET_VIEW_CALLBACK g_packetView;
 ON_IO_OPEN_COMPLETE g_openComplete;
 ON_BYTES_RECEIVED g_bytesRecv;
 ON_IO_ERROR g_ioError;
@@ -119,17 +158,16 @@ typedef struct TEST_COMPLETE_DATA_INSTANCE_TAG
 TEST_MUTEX_HANDLE test_serialize_mutex;
 
 #define TEST_CONTEXT ((const void*)0x4242)
-#define MAX_CLOSE_RETRIES               20
-#define CLOSE_SLEEP_VALUE               2
+#define CLOSE_TIMEOUT_MS                1000
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-    static MQTTCODEC_HANDLE my_mqtt_codec_create(ON_PACKET_COMPLETE_CALLBACK packetComplete, void* callContext)
+    static MQTTCODEC_HANDLE my_mqtt_codec_create_with_view(ON_PACKET_VIEW_CALLBACK packetView, void* callContext)
     {
         (void)callContext;
-        g_packetComplete = packetComplete;
+        g_packetView = packetView;
         return TEST_MQTTCODEC_HANDLE;
     }
 
@@ -163,32 +201,96 @@ extern "C" {
         return 0;
     }
 
-    static BUFFER_HANDLE my_mqtt_codec_publishComplete(uint16_t packetId)
+    static tickcounter_ms_t my_mqtt_timer_wheel_get_current_ms(MQTT_TIMER_WHEEL_HANDLE handle)
+    {
+        (void)handle;
+        return g_wheel_ms;
+    }
+
+    static int my_mqtt_codec_encode_puback(uint16_t packetId, uint8_t* packet)
+    {
+        packet[0] = PUBACK_TYPE;
+        packet[1] = 0x02;
+        packet[2] = (uint8_t)(packetId >> 8);
+        packet[3] = (uint8_t)packetId;
+        return 0;
+    }
+
+    static void my_mqtt_trace_ring_record(MQTT_TRACE_RING_HANDLE handle, const MQTT_TRACE_RECORD* record)
+    {
+        (void)handle;
+        g_traceRecord = *record;
+    }
+
+    static int my_mqtt_codec_encode_pubcomp(uint16_t packetId, uint8_t* packet)
     {
         (void)packetId;
-        BUFFER_HANDLE buffer_result = TEST_BUFFER_HANDLE;
-        if (g_mqtt_codec_publish_func_fail)
-        {
-            buffer_result = NULL;
-        }
-        return buffer_result;
+        (void)packet;
+        return g_mqtt_codec_publish_func_fail ? MU_FAILURE : 0;
     }
 
-    static BUFFER_HANDLE my_mqtt_codec_publishRelease(uint16_t packetId)
+    static int my_mqtt_codec_encode_pubrel(uint16_t packetId, uint8_t* packet)
     {
         (void)packetId;
-        BUFFER_HANDLE buffer_result = TEST_BUFFER_HANDLE;
-        if (g_mqtt_codec_publish_func_fail)
+        (void)packet;
+        return g_mqtt_codec_publish_func_fail ? MU_FAILURE : 0;
+    }
+
+    static int my_mqtt_codec_publish_header(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, size_t payloadLen, uint8_t* headerBuffer, size_t* headerLength, STRING_HANDLE trace_log)
+    {
+        (void)qosValue;
+        (void)duplicateMsg;
+        (void)serverRetain;
+        (void)packetId;
+        (void)topicName;
+        (void)payloadLen;
+        (void)headerBuffer;
+        (void)trace_log;
+        *headerLength = 4;
+        return 0;
+    }
+
+    static int my_mqtt_codec_publish_header_encoded_topic(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const uint8_t* encodedTopic, size_t encodedTopicLen, size_t payloadLen, uint8_t* headerBuffer, size_t* headerLength, STRING_HANDLE trace_log)
+    {
+        (void)qosValue;
+        (void)duplicateMsg;
+        (void)serverRetain;
+        (void)packetId;
+        (void)encodedTopic;
+        (void)encodedTopicLen;
+        (void)payloadLen;
+        (void)headerBuffer;
+        (void)trace_log;
+        *headerLength = 4;
+        return 0;
+    }
+
+    static const uint8_t* my_mqtt_topic_get_encoded(MQTT_TOPIC_HANDLE topic, size_t* encodedLength)
+    {
+        (void)topic;
+        *encodedLength = sizeof(TEST_ENCODED_TOPIC);
+        return TEST_ENCODED_TOPIC;
+    }
+
+    static const char* my_mqtt_topic_get_name(MQTT_TOPIC_HANDLE topic, size_t* nameLength)
+    {
+        (void)topic;
+        if (nameLength != NULL)
         {
-            buffer_result = NULL;
+            *nameLength = strlen(TEST_TOPIC_NAME);
         }
-        return buffer_result;
+        return TEST_TOPIC_NAME;
     }
 
     static int my_xio_close(XIO_HANDLE xio, ON_IO_CLOSE_COMPLETE on_io_close_complete, void* callback_context)
     {
         (void)xio;
-        if (on_io_close_complete != NULL)
+        if (g_closeAsync)
+        {
+            g_closeComplete = on_io_close_complete;
+            g_onCloseCtx = callback_context;
+        }
+        else if (on_io_close_complete != NULL)
         {
             on_io_close_complete(callback_context);
         }
@@ -215,6 +317,17 @@ extern "C" {
         return (MQTT_MESSAGE_HANDLE)my_gballoc_malloc(1);
     }
 
+    static MQTT_MESSAGE_HANDLE my_mqttmessage_create_in_place_n(uint16_t packetId, const char* topicName, size_t topicNameLength, QOS_VALUE qosValue, const uint8_t* appMsg, size_t appMsgLength)
+    {
+        (void)packetId;
+        (void)topicName;
+        (void)topicNameLength;
+        (void)qosValue;
+        (void)appMsg;
+        (void)appMsgLength;
+        return (MQTT_MESSAGE_HANDLE)my_gballoc_malloc(1);
+    }
+
     static MQTT_MESSAGE_HANDLE my_mqttmessage_clone(MQTT_MESSAGE_HANDLE handle)
     {
         (void)handle;
@@ -250,6 +363,52 @@ extern "C" {
         return (STRING_HANDLE)my_gballoc_malloc(1);
     }
 
+    static MQTT_TOPIC_TRIE_HANDLE my_mqtt_topic_trie_create(ON_MQTT_TOPIC_TRIE_VALUE_DESTROY valueDestroy)
+    {
+        g_topicValueDestroy = valueDestroy;
+        g_topicValueCount = 0;
+        return TEST_TOPIC_TRIE_HANDLE;
+    }
+
+    static void my_mqtt_topic_trie_destroy(MQTT_TOPIC_TRIE_HANDLE handle)
+    {
+        (void)handle;
+        while (g_topicValueCount > 0)
+        {
+            g_topicValueDestroy(g_topicValues[--g_topicValueCount]);
+        }
+    }
+
+    static int my_mqtt_topic_trie_insert(MQTT_TOPIC_TRIE_HANDLE handle, const char* topicFilter, void* value)
+    {
+        (void)handle;
+        (void)topicFilter;
+        g_topicValues[g_topicValueCount++] = value;
+        return 0;
+    }
+
+    static int my_mqtt_topic_trie_remove(MQTT_TOPIC_TRIE_HANDLE handle, const char* topicFilter)
+    {
+        (void)handle;
+        (void)topicFilter;
+        g_topicValueDestroy(g_topicValues[--g_topicValueCount]);
+        return 0;
+    }
+
+    // Every stored handler matches
+    static size_t my_mqtt_topic_trie_match(MQTT_TOPIC_TRIE_HANDLE handle, const char* topicName, size_t topicLength, ON_MQTT_TOPIC_TRIE_MATCH onMatch, void* context)
+    {
+        size_t index;
+        (void)handle;
+        (void)topicName;
+        (void)topicLength;
+        for (index = 0; index < g_topicValueCount; index++)
+        {
+            onMatch(context, g_topicValues[index]);
+        }
+        return g_topicValueCount;
+    }
+
     static int TEST_mallocAndStrcpy_s(char** destination, const char* source)
     {
         size_t src_len = strlen(source);
@@ -286,12 +445,29 @@ TEST_SUITE_INITIALIZE(suite_init)
     ASSERT_ARE_EQUAL(int, 0, result);
 
     REGISTER_UMOCK_ALIAS_TYPE(ON_PACKET_COMPLETE_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_PACKET_VIEW_CALLBACK, void*);
     REGISTER_UMOCK_ALIAS_TYPE(TICK_COUNTER_HANDLE, void*);
     REGISTER_UMOCK_ALIAS_TYPE(MQTTCODEC_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CODEC_RECV_POOL_HANDLE, void*);
     REGISTER_UMOCK_ALIAS_TYPE(XIO_HANDLE, void*);
     REGISTER_UMOCK_ALIAS_TYPE(ON_SEND_COMPLETE, void*);
     REGISTER_UMOCK_ALIAS_TYPE(BUFFER_HANDLE, void*);
     REGISTER_UMOCK_ALIAS_TYPE(MQTT_MESSAGE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_SESSION_STORE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_SESSION_RECORD_LOADED, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_SESSION_RECORD_TYPE, int);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_OFFLINE_QUEUE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_TOPIC_TRIE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_TOPIC_TRIE_VALUE_DESTROY, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_TOPIC_TRIE_MATCH, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_TOPIC_TABLE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_TOPIC_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_SUBMIT_QUEUE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_TIMER_WHEEL_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_TRACE_RING_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CAPTURE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_TIMER_EXPIRED, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(tickcounter_ms_t, uint64_t);
     REGISTER_UMOCK_ALIAS_TYPE(ON_IO_OPEN_COMPLETE, void*);
     REGISTER_UMOCK_ALIAS_TYPE(ON_BYTES_RECEIVED, void*);
     REGISTER_UMOCK_ALIAS_TYPE(ON_IO_ERROR, void*);
@@ -299,6 +475,7 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_UMOCK_ALIAS_TYPE(ON_IO_CLOSE_COMPLETE, void*)
 
     REGISTER_TYPE(QOS_VALUE, QOS_VALUE);
+    REGISTER_TYPE(MQTT_TRACE_DIRECTION, MQTT_TRACE_DIRECTION);
 
     REGISTER_GLOBAL_MOCK_HOOK(mallocAndStrcpy_s, TEST_mallocAndStrcpy_s);
 
@@ -312,8 +489,8 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_GLOBAL_MOCK_HOOK(STRING_delete, my_STRING_delete);
     REGISTER_GLOBAL_MOCK_RETURN(STRING_c_str, "Test");
 
-    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_create, my_mqtt_codec_create);
-    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_create, NULL);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_create_with_view, my_mqtt_codec_create_with_view);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_create_with_view, NULL);
 
     REGISTER_GLOBAL_MOCK_HOOK(xio_open, my_xio_open);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(xio_open, MU_FAILURE);
@@ -324,26 +501,38 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_GLOBAL_MOCK_HOOK(tickcounter_get_current_ms, my_tickcounter_get_current_ms);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(tickcounter_get_current_ms, MU_FAILURE);
 
-    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_publishRelease, my_mqtt_codec_publishRelease);
-    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_publishComplete, my_mqtt_codec_publishComplete);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_encode_pubrel, my_mqtt_codec_encode_pubrel);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_encode_pubcomp, my_mqtt_codec_encode_pubcomp);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_encode_puback, my_mqtt_codec_encode_puback);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_trace_ring_record, my_mqtt_trace_ring_record);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_connect, TEST_BUFFER_HANDLE);
 
     REGISTER_GLOBAL_MOCK_RETURN(get_time, time(NULL) );
 
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publish, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_publish_header, my_mqtt_codec_publish_header);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publish, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publish_encoded_topic, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publish_encoded_topic, NULL);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_publish_header_encoded_topic, my_mqtt_codec_publish_header_encoded_topic);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publish_v5, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publish_v5, NULL);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_subscribe, TEST_BUFFER_HANDLE);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_subscribe, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_subscribe_v5, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_subscribe_v5, NULL);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_unsubscribe, TEST_BUFFER_HANDLE);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_unsubscribe, NULL);
-    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_disconnect, TEST_BUFFER_HANDLE);
-    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_disconnect, NULL);
-    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_ping, TEST_BUFFER_HANDLE);
-    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_ping, NULL);
-    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publishAck, TEST_BUFFER_HANDLE);
-    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publishAck, NULL);
-    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publishReceived, TEST_BUFFER_HANDLE);
-    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publishReceived, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_unsubscribe_v5, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_unsubscribe_v5, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_encode_disconnect, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_encode_disconnect, MU_FAILURE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_encode_pingreq, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_encode_pingreq, MU_FAILURE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_encode_puback, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_encode_puback, MU_FAILURE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_encode_pubrec, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_encode_pubrec, MU_FAILURE);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_bytesReceived, 0);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_bytesReceived, MU_FAILURE);
     REGISTER_GLOBAL_MOCK_RETURN(xio_close, 0);
@@ -362,6 +551,8 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqttmessage_create, NULL);
     REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_create_in_place, my_mqttmessage_create_in_place);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqttmessage_create_in_place, NULL);
+    REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_create_in_place_n, my_mqttmessage_create_in_place_n);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqttmessage_create_in_place_n, NULL);
     REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_clone, my_mqttmessage_clone);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqttmessage_clone, NULL);
     REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_getPacketId, TEST_PACKET_ID);
@@ -371,11 +562,53 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_getIsRetained, true);
     REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_setIsDuplicateMsg, 0);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqttmessage_setIsDuplicateMsg, MU_FAILURE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_setPacketId, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqttmessage_setPacketId, MU_FAILURE);
     REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_setIsRetained, 0);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqttmessage_setIsRetained, MU_FAILURE);
     REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_getApplicationMsg, &TEST_APP_PAYLOAD);
     REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_destroy, my_mqttmessage_destroy);
 
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_session_store_save, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_session_store_save, MU_FAILURE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_session_store_remove, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_session_store_remove, MU_FAILURE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_session_store_load, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_session_store_load, MU_FAILURE);
+
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_offline_queue_create, TEST_OFFLINE_QUEUE_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_offline_queue_create, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_offline_queue_push, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_offline_queue_push, MU_FAILURE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_offline_queue_count, 0);
+
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_topic_trie_create, my_mqtt_topic_trie_create);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_topic_trie_create, NULL);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_topic_trie_destroy, my_mqtt_topic_trie_destroy);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_topic_trie_insert, my_mqtt_topic_trie_insert);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_topic_trie_insert, MU_FAILURE);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_topic_trie_remove, my_mqtt_topic_trie_remove);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_topic_trie_remove, MU_FAILURE);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_topic_trie_match, my_mqtt_topic_trie_match);
+
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_topic_table_create, TEST_TOPIC_TABLE_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_topic_table_create, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_topic_table_intern, TEST_INTERNED_TOPIC);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_topic_table_intern, NULL);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_topic_get_encoded, my_mqtt_topic_get_encoded);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_topic_get_name, my_mqtt_topic_get_name);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_topic_set_alias, 0);
+
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_submit_queue_create, TEST_SUBMIT_QUEUE_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_submit_queue_create, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_submit_queue_push, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_submit_queue_push, MU_FAILURE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_submit_queue_pop, NULL);
+
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_timer_wheel_get_current_ms, my_mqtt_timer_wheel_get_current_ms);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_timer_wheel_schedule, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_topic_set_alias, MU_FAILURE);
+
     REGISTER_GLOBAL_MOCK_RETURN(mallocAndStrcpy_s, 0);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mallocAndStrcpy_s, MU_FAILURE);
 }
@@ -394,11 +627,14 @@ TEST_FUNCTION_INITIALIZE(method_init)
     }
 
     g_current_ms = 0;
-    g_packetComplete = NULL;
+    g_wheel_ms = 0;
+    g_packetView = NULL;
     g_operationCallbackInvoked = false;
     g_errorCallbackInvoked = false;
     g_msgRecvCallbackInvoked = false;
     g_mqtt_codec_publish_func_fail = false;
+    g_payloadReleasedCount = 0;
+    g_payloadReleasedResult = IO_SEND_CANCELLED;
     g_openComplete = NULL;
     g_onCompleteCtx = NULL;
     g_sendComplete = NULL;
@@ -407,6 +643,17 @@ TEST_FUNCTION_INITIALIZE(method_init)
     g_ioError = NULL;
     g_bytesRecvCtx = NULL;
     g_ioErrorCtx = NULL;
+    g_topicValueDestroy = NULL;
+    g_topicValueCount = 0;
+    g_topicCallbackCount = 0;
+    g_topicHandlerClient = NULL;
+    g_topicHandlerChangeResult = MU_FAILURE;
+    g_wakeupCount = 0;
+    g_wakeupCtx = NULL;
+    g_closeAsync = false;
+    g_closeComplete = NULL;
+    g_onCloseCtx = NULL;
+    memset(&g_traceRecord, 0, sizeof(g_traceRecord));
 }
 
 TEST_FUNCTION_CLEANUP(method_cleanup)
@@ -431,20 +678,15 @@ static int should_skip_index(size_t current_index, const size_t skip_array[], si
 
 static void setup_publish_callback_mocks(unsigned char* PUBLISH_RESP, size_t length, QOS_VALUE qos_value)
 {
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
-    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, IGNORED_ARG, qos_value, IGNORED_ARG, TEST_APP_PAYLOAD.length));
+    (void)PUBLISH_RESP;
+    (void)length;
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(TEST_PACKET_ID, IGNORED_ARG, 10, qos_value, IGNORED_ARG, TEST_APP_PAYLOAD.length));
     STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
     STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, true));
-    STRICT_EXPECTED_CALL(mqtt_codec_publishReceived(TEST_PACKET_ID));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG)).SetReturn(length);
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG)).SetReturn(PUBLISH_RESP);
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_pubrec(TEST_PACKET_ID, IGNORED_ARG));
     EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
     STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
-    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 }
 
 static void setup_mqtt_clear_options_mocks(MQTT_CLIENT_OPTIONS* mqttOptions)
@@ -477,12 +719,9 @@ static void setup_mqtt_clear_options_mocks(MQTT_CLIENT_OPTIONS* mqttOptions)
 
 static void setup_mqtt_client_disconnect_mocks(MQTT_CLIENT_OPTIONS* mqttOptions)
 {
-    STRICT_EXPECTED_CALL(mqtt_codec_disconnect());
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_disconnect(IGNORED_ARG));
     EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
 
     setup_mqtt_clear_options_mocks(mqttOptions);
 }
@@ -559,6 +798,22 @@ static MQTT_CLIENT_ACK_OPTION TestRecvCallback(MQTT_MESSAGE_HANDLE msgHandle, vo
     return MQTT_CLIENT_ACK_SYNC;
 }
 
+static MQTT_CLIENT_ACK_OPTION TestTopicCallback(MQTT_MESSAGE_HANDLE msgHandle, void* context)
+{
+    (void)msgHandle;
+    g_topicCallbackCount++;
+    return *(const MQTT_CLIENT_ACK_OPTION*)context;
+}
+
+// Removes its own filter, as a handler that only waits for one message would
+static MQTT_CLIENT_ACK_OPTION TestRemovingTopicCallback(MQTT_MESSAGE_HANDLE msgHandle, void* context)
+{
+    (void)msgHandle;
+    g_topicCallbackCount++;
+    g_topicHandlerChangeResult = mqtt_client_set_topic_handler(g_topicHandlerClient, (const char*)context, NULL, NULL);
+    return MQTT_CLIENT_ACK_SYNC;
+}
+
 static void TestOpCallback(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* context)
 {
     (void)handle;
@@ -575,8 +830,13 @@ static void TestOpCallback(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT a
                 const CONNECT_ACK* connack = (CONNECT_ACK*)msgInfo;
                 TEST_COMPLETE_DATA_INSTANCE* testData = (TEST_COMPLETE_DATA_INSTANCE*)context;
                 CONNECT_ACK* validate = (CONNECT_ACK*)testData->msgInfo;
-                if (connack->isSessionPresent == validate->isSessionPresent &&
-                    connack->returnCode == validate->returnCode)
+                if (testData->actionResult == actionResult &&
+                    connack->isSessionPresent == validate->isSessionPresent &&
+                    connack->returnCode == validate->returnCode &&
+                    connack->reasonCode == validate->reasonCode &&
+                    connack->receiveMaximum == validate->receiveMaximum &&
+                    connack->maximumPacketSize == validate->maximumPacketSize &&
+                    connack->topicAliasMaximum == validate->topicAliasMaximum)
                 {
                     g_operationCallbackInvoked = true;
                 }
@@ -593,7 +853,7 @@ static void TestOpCallback(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT a
                 const PUBLISH_ACK* puback = (PUBLISH_ACK*)msgInfo;
                 TEST_COMPLETE_DATA_INSTANCE* testData = (TEST_COMPLETE_DATA_INSTANCE*)context;
                 PUBLISH_ACK* validate = (PUBLISH_ACK*)testData->msgInfo;
-                if (testData->actionResult == actionResult && puback->packetId == validate->packetId)
+                if (testData->actionResult == actionResult && puback->packetId == validate->packetId && puback->reasonCode == validate->reasonCode)
                 {
                     g_operationCallbackInvoked = true;
                 }
@@ -632,7 +892,7 @@ static void TestOpCallback(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT a
                 const UNSUBSCRIBE_ACK* suback = (UNSUBSCRIBE_ACK*)msgInfo;
                 TEST_COMPLETE_DATA_INSTANCE* testData = (TEST_COMPLETE_DATA_INSTANCE*)context;
                 UNSUBSCRIBE_ACK* validate = (UNSUBSCRIBE_ACK*)testData->msgInfo;
-                if (testData->actionResult == actionResult && validate->packetId == suback->packetId)
+                if (testData->actionResult == actionResult && validate->packetId == suback->packetId && validate->reasonCodeCount == suback->reasonCodeCount)
                 {
                     g_operationCallbackInvoked = true;
                 }
@@ -658,6 +918,20 @@ static void TestOpCallback(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT a
     }
 }
 
+static void TestWakeupCallback(void* context)
+{
+    g_wakeupCtx = context;
+    g_wakeupCount++;
+}
+
+static int g_wakeupReplaceResult;
+
+static void TestWakeupReplacingCallback(void* context)
+{
+    g_wakeupCount++;
+    g_wakeupReplaceResult = mqtt_client_set_wakeup_callback((MQTT_CLIENT_HANDLE)context, TestWakeupCallback, NULL);
+}
+
 static void TestErrorCallback(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* context)
 {
     (void)handle;
@@ -674,6 +948,7 @@ static void TestErrorCallback(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR
         case MQTT_CLIENT_COMMUNICATION_ERROR:
         case MQTT_CLIENT_NO_PING_RESPONSE:
         case MQTT_CLIENT_UNKNOWN_ERROR:
+        case MQTT_CLIENT_RECONNECT_FAILED:
         {
             g_errorCallbackInvoked = true;
         }
@@ -681,6 +956,13 @@ static void TestErrorCallback(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR
     }
 }
 
+static void TestPayloadReleasedCallback(void* context, IO_SEND_RESULT send_result)
+{
+    (void)context;
+    g_payloadReleasedCount++;
+    g_payloadReleasedResult = send_result;
+}
+
 static void SetupMqttLibOptions(MQTT_CLIENT_OPTIONS* options, const char* clientId,
     const char* willMsg,
     const char* willTopic,
@@ -709,10 +991,47 @@ static void make_connack(MQTT_CLIENT_HANDLE mqttHandle, MQTT_CLIENT_OPTIONS* mqt
     umock_c_reset_all_calls();
     unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
     size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+}
+
+static void make_connack_v5(MQTT_CLIENT_HANDLE mqttHandle, MQTT_CLIENT_OPTIONS* mqttOptions, const unsigned char* connackResp, size_t length)
+{
+    SetupMqttLibOptions(mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions->protocolVersion = MQTT_PROTOCOL_V5;
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, mqttOptions);
+
+    umock_c_reset_all_calls();
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, connackResp, length);
+    g_operationCallbackInvoked = false;
+    umock_c_reset_all_calls();
+}
+
+// Disconnects with on_mqtt_disconnected_callback through a transport that finishes closing only when g_closeComplete is called
+static MQTT_CLIENT_HANDLE setup_closing_client(void)
+{
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    make_connack(mqttHandle, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    (void)mqtt_client_disconnect(mqttHandle, on_mqtt_disconnected_callback, NULL);
+    g_sendComplete(g_onSendCtx, IO_SEND_OK);
+    g_closeAsync = true;
+    mqtt_client_dowork(mqttHandle);
+    umock_c_reset_all_calls();
+    return mqttHandle;
+}
+
+static MQTT_CLIENT_HANDLE setup_reconnecting_client(const MQTT_CLIENT_RECONNECT_OPTIONS* options, MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_reconnect(mqttHandle, options));
+
+    SetupMqttLibOptions(mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    make_connack(mqttHandle, mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    umock_c_reset_all_calls();
+    return mqttHandle;
 }
 
 /* mqttclient_connect */
@@ -723,7 +1042,7 @@ TEST_FUNCTION(mqtt_client_init_succeeds)
     // arrange
     EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_create());
-    EXPECTED_CALL(mqtt_codec_create(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(mqtt_codec_create_with_view(IGNORED_ARG, IGNORED_ARG));
 
     // act
     MQTT_CLIENT_HANDLE result = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
@@ -745,7 +1064,7 @@ TEST_FUNCTION(mqtt_client_init_fail)
 
     EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_create());
-    EXPECTED_CALL(mqtt_codec_create(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(mqtt_codec_create_with_view(IGNORED_ARG, IGNORED_ARG));
 
     umock_c_negative_tests_snapshot();
 
@@ -853,21 +1172,15 @@ TEST_FUNCTION(mqtt_client_clear_xio_after_connect_and_do_work_succeeds)
     umock_c_reset_all_calls();
     unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
     size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
 
     g_current_ms = TEST_KEEP_ALIVE_INTERVAL * 2 * 1000;
 
     EXPECTED_CALL(xio_dowork(IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mqtt_codec_ping());
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_pingreq(IGNORED_ARG));
     EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
 
     // act
@@ -1109,8 +1422,6 @@ TEST_FUNCTION(mqtt_client_on_bytes_received_bytesReceived_fail_succeeds)
         .SetReturn(MU_FAILURE);
     STRICT_EXPECTED_CALL(mqtt_codec_reset(IGNORED_ARG));
     STRICT_EXPECTED_CALL(xio_close(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG));
-    STRICT_EXPECTED_CALL(xio_dowork(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(ThreadAPI_Sleep(CLOSE_SLEEP_VALUE));
 
     // act
     g_bytesRecv(g_bytesRecvCtx, TEST_BUFFER_U_CHAR, 1);
@@ -1161,9 +1472,6 @@ TEST_FUNCTION(mqtt_client_connect_multiple_completes_one_connect_succeeds)
     setup_mqtt_client_connect_mocks(&mqttOptions);
     STRICT_EXPECTED_CALL(xio_close(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG));
 
-    STRICT_EXPECTED_CALL(xio_dowork(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(ThreadAPI_Sleep(CLOSE_SLEEP_VALUE));
-
     // act
     int result = mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
 
@@ -1221,8 +1529,6 @@ TEST_FUNCTION(mqtt_client_ioerror_succeeds)
     umock_c_reset_all_calls();
 
     STRICT_EXPECTED_CALL(xio_close(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG));
-    STRICT_EXPECTED_CALL(xio_dowork(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(ThreadAPI_Sleep(CLOSE_SLEEP_VALUE));
 
     // act
     g_ioError(g_ioErrorCtx);
@@ -1576,6 +1882,7 @@ TEST_FUNCTION(mqtt_client_publish_mqtt_codec_publish_fail)
     STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
     STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
     STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
     STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
 
     EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG))
@@ -1604,6 +1911,7 @@ TEST_FUNCTION(mqtt_client_publish_xio_send_fails)
     STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
     STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
     STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
     STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
 
     EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
@@ -1634,6 +1942,7 @@ TEST_FUNCTION(mqtt_client_publish_succeeds)
     STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
     STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
     STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
     STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
 
     EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
@@ -1654,152 +1963,482 @@ TEST_FUNCTION(mqtt_client_publish_succeeds)
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_disconnect_handle_NULL_fail)
+/*Codes_SRS_MQTT_CLIENT_07_038: [If handle or msgHandle is NULL, or segments is NULL while segmentCount is not zero, or a segment with a non-zero length has NULL data then mqtt_client_publish_iov shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_handle_NULL_fail)
 {
     // arrange
+    MQTT_PAYLOAD_SEGMENT segments[] = { { (const uint8_t*)"Message", 7 } };
 
     // act
-    int result = mqtt_client_disconnect(NULL, NULL, NULL);
+    int result = mqtt_client_publish_iov(NULL, TEST_MESSAGE_HANDLE, segments, 1, TestPayloadReleasedCallback, NULL);
 
     // assert
     ASSERT_ARE_NOT_EQUAL(int, 0, result);
-
-    // cleanup
+    ASSERT_ARE_EQUAL(size_t, 0, g_payloadReleasedCount);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 }
 
-TEST_FUNCTION(mqtt_client_disconnect_fail)
+/*Codes_SRS_MQTT_CLIENT_07_038: [If handle or msgHandle is NULL, or segments is NULL while segmentCount is not zero, or a segment with a non-zero length has NULL data then mqtt_client_publish_iov shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_segment_data_NULL_fail)
 {
     // arrange
-    int negativeTestsInitResult = umock_c_negative_tests_init();
-    ASSERT_ARE_EQUAL(int, 0, negativeTestsInitResult);
-
-    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_PAYLOAD_SEGMENT segments[] = { { (const uint8_t*)"Message", 7 }, { NULL, 4 } };
     MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
-    make_connack(mqttHandle, &mqttOptions);
     umock_c_reset_all_calls();
 
-    setup_mqtt_client_disconnect_mocks(&mqttOptions);
-
-    umock_c_negative_tests_snapshot();
-
-    size_t calls_cannot_fail[] = { 1, 2, 5, 6, 7, 8, 9, 10 };
-
     // act
-    size_t count = umock_c_negative_tests_call_count();
-    for (size_t index = 0; index < count; index++)
-    {
-        if (should_skip_index(index, calls_cannot_fail, sizeof(calls_cannot_fail)/sizeof(calls_cannot_fail[0])) != 0)
-        {
-            continue;
-        }
+    int result_1 = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, segments, 2, TestPayloadReleasedCallback, NULL);
+    int result_2 = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, NULL, 1, TestPayloadReleasedCallback, NULL);
 
-        umock_c_negative_tests_reset();
-        umock_c_negative_tests_fail_call(index);
-
-        int result = mqtt_client_disconnect(mqttHandle, NULL, NULL);
-
-        // assert
-        ASSERT_ARE_NOT_EQUAL(int, 0, result, "mqtt_client_disconnect failure in test %zu/%zu", index, count);
-    }
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_1);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_2);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
-    umock_c_negative_tests_deinit();
 }
 
-TEST_FUNCTION(mqtt_client_disconnect_succeeds)
+/*Codes_SRS_MQTT_CLIENT_07_039: [If any failure is encountered then mqtt_client_publish_iov shall return a non-zero value and shall not call onPayloadReleased.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_mqtt_codec_publish_header_fail)
 {
     // arrange
-    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
-
+    MQTT_PAYLOAD_SEGMENT segments[] = { { (const uint8_t*)"Message", 7 } };
     MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
-    make_connack(mqttHandle, &mqttOptions);
     umock_c_reset_all_calls();
 
-    setup_mqtt_client_disconnect_mocks(&mqttOptions);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish_header(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, 7, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG))
+        .SetReturn(MU_FAILURE);
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 
     // act
-    int result = mqtt_client_disconnect(mqttHandle, NULL, NULL);
+    int result = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, segments, 1, TestPayloadReleasedCallback, NULL);
 
     // assert
-    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, g_payloadReleasedCount);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/* Tests_SRS_MQTT_CLIENT_07_037: [ if callback is not NULL callback shall be called once the mqtt connection has been disconnected ] */
-TEST_FUNCTION(mqtt_client_disconnect_callback_succeeds)
+/*Codes_SRS_MQTT_CLIENT_07_043: [If a payload segment fails to send after the header was sent then mqtt_client_publish_iov shall call the ON_MQTT_ERROR_CALLBACK with MQTT_CLIENT_COMMUNICATION_ERROR.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_segment_xio_send_fails)
 {
     // arrange
-    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
-
+    MQTT_PAYLOAD_SEGMENT segments[] = { { (const uint8_t*)"Message", 7 } };
     MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
-    make_connack(mqttHandle, &mqttOptions);
-
     umock_c_reset_all_calls();
 
-    setup_mqtt_client_disconnect_mocks(&mqttOptions);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish_header(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, 7, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, 4, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 
     // act
-    int result = mqtt_client_disconnect(mqttHandle, on_mqtt_disconnected_callback, NULL);
+    int result = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, segments, 1, TestPayloadReleasedCallback, NULL);
 
     // assert
-    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(size_t, 0, g_payloadReleasedCount);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_disconnect_send_complete_SEND_OK_succeeds)
+/*Codes_SRS_MQTT_CLIENT_07_040: [mqtt_client_publish_iov shall get the message information from the MQTT_MESSAGE_HANDLE and encode only the PUBLISH header, into a stack buffer unless the topic name does not fit.]*/
+/*Codes_SRS_MQTT_CLIENT_07_041: [mqtt_client_publish_iov shall send the header and then each payload segment to the transport without copying the payload.]*/
+/*Codes_SRS_MQTT_CLIENT_07_042: [Once the transport has completed sending the last segment mqtt_client_publish_iov shall call onPayloadReleased with the send result, after which the caller may reuse the payload memory.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_succeeds)
 {
     // arrange
-    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    const uint8_t* PAYLOAD = (const uint8_t*)"Message to send";
+    MQTT_PAYLOAD_SEGMENT segments[] = { { PAYLOAD, 8 }, { PAYLOAD + 8, 7 } };
     MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
-    make_connack(mqttHandle, &mqttOptions);
-    (void)mqtt_client_disconnect(mqttHandle, NULL, NULL);
     umock_c_reset_all_calls();
 
-    EXPECTED_CALL(xio_close(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish_header(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, 15, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, 4, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, PAYLOAD, 8, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, PAYLOAD + 8, 7, IGNORED_ARG, IGNORED_ARG));
 
     // act
+    int result = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, segments, 2, TestPayloadReleasedCallback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_payloadReleasedCount);
+
+    umock_c_reset_all_calls();
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
     ASSERT_IS_NOT_NULL(g_sendComplete);
     g_sendComplete(g_onSendCtx, IO_SEND_OK);
 
-    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_payloadReleasedCount);
+    ASSERT_ARE_EQUAL(int, IO_SEND_OK, g_payloadReleasedResult);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_disconnect_send_complete_SEND_ERROR_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_167: [mqtt_client_publish_iov shall not send segments with a zero length, and if every segment is empty it shall call onPayloadReleased with IO_SEND_OK once the header is sent.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_zero_length_middle_segment_succeeds)
 {
     // arrange
+    const uint8_t* PAYLOAD = (const uint8_t*)"Message to send";
+    MQTT_PAYLOAD_SEGMENT segments[] = { { PAYLOAD, 8 }, { NULL, 0 }, { PAYLOAD + 8, 7 } };
     MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
 
-    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
-    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish_header(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, 15, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, 4, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, PAYLOAD, 8, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, PAYLOAD + 8, 7, IGNORED_ARG, IGNORED_ARG));
 
-    make_connack(mqttHandle, &mqttOptions);
+    // act
+    int result = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, segments, 3, TestPayloadReleasedCallback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_payloadReleasedCount);
 
-    (void)mqtt_client_disconnect(mqttHandle, NULL, NULL);
     umock_c_reset_all_calls();
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 
-    // act
     ASSERT_IS_NOT_NULL(g_sendComplete);
-    g_sendComplete(g_onSendCtx, IO_SEND_ERROR);
+    g_sendComplete(g_onSendCtx, IO_SEND_OK);
 
-    // assert
-    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_payloadReleasedCount);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Tests_SRS_MQTT_CLIENT_07_023: [If the parameter handle is NULL then mqtt_client_dowork shall do nothing.]*/
-TEST_FUNCTION(mqtt_client_dowork_ping_handle_NULL_fails)
+/*Tests_SRS_MQTT_CLIENT_07_167: [mqtt_client_publish_iov shall not send segments with a zero length, and if every segment is empty it shall call onPayloadReleased with IO_SEND_OK once the header is sent.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_zero_length_last_segment_succeeds)
+{
+    // arrange
+    const uint8_t* PAYLOAD = (const uint8_t*)"Message to send";
+    MQTT_PAYLOAD_SEGMENT segments[] = { { PAYLOAD, 8 }, { PAYLOAD + 8, 7 }, { PAYLOAD + 15, 0 } };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish_header(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, 15, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, 4, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, PAYLOAD, 8, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, PAYLOAD + 8, 7, IGNORED_ARG, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, segments, 3, TestPayloadReleasedCallback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_payloadReleasedCount);
+
+    umock_c_reset_all_calls();
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    ASSERT_IS_NOT_NULL(g_sendComplete);
+    g_sendComplete(g_onSendCtx, IO_SEND_OK);
+
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_payloadReleasedCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_167: [mqtt_client_publish_iov shall not send segments with a zero length, and if every segment is empty it shall call onPayloadReleased with IO_SEND_OK once the header is sent.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_all_segments_empty_succeeds)
+{
+    // arrange
+    MQTT_PAYLOAD_SEGMENT segments[] = { { NULL, 0 }, { (const uint8_t*)"Message", 0 } };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish_header(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, 0, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, 4, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, segments, 2, TestPayloadReleasedCallback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_payloadReleasedCount);
+    ASSERT_ARE_EQUAL(int, IO_SEND_OK, g_payloadReleasedResult);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_159: [If the in-flight window is on and msgHandle is QoS 1 or QoS 2 then mqtt_client_publish_iov shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_inflight_packet_id_in_use_fails)
+{
+    // arrange
+    MQTT_PAYLOAD_SEGMENT segments[] = { { (const uint8_t*)"Message", 7 } };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 2, 0));
+    // Tracked under packet id 1, which the message of the iov publish carries as well
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE)).SetReturn(1);
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, segments, 1, TestPayloadReleasedCallback, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_payloadReleasedCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_160: [When an offline queue is set and the client is not connected, or queued publishes are still waiting, mqtt_client_publish_iov shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_offline_fails)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_PAYLOAD_SEGMENT segments[] = { { (const uint8_t*)"Message", 7 } };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_offline_queue(mqttHandle, &options));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, segments, 1, TestPayloadReleasedCallback, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_payloadReleasedCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_disconnect_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_disconnect(NULL, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+}
+
+TEST_FUNCTION(mqtt_client_disconnect_fail)
+{
+    // arrange
+    int negativeTestsInitResult = umock_c_negative_tests_init();
+    ASSERT_ARE_EQUAL(int, 0, negativeTestsInitResult);
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack(mqttHandle, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    setup_mqtt_client_disconnect_mocks(&mqttOptions);
+
+    umock_c_negative_tests_snapshot();
+
+    size_t calls_cannot_fail[] = { 1, 2, 5, 6, 7, 8, 9, 10 };
+
+    // act
+    size_t count = umock_c_negative_tests_call_count();
+    for (size_t index = 0; index < count; index++)
+    {
+        if (should_skip_index(index, calls_cannot_fail, sizeof(calls_cannot_fail)/sizeof(calls_cannot_fail[0])) != 0)
+        {
+            continue;
+        }
+
+        umock_c_negative_tests_reset();
+        umock_c_negative_tests_fail_call(index);
+
+        int result = mqtt_client_disconnect(mqttHandle, NULL, NULL);
+
+        // assert
+        ASSERT_ARE_NOT_EQUAL(int, 0, result, "mqtt_client_disconnect failure in test %zu/%zu", index, count);
+    }
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+    umock_c_negative_tests_deinit();
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_131: [The client shall encode the PINGREQ, DISCONNECT, PUBACK, PUBREC, PUBREL and PUBCOMP packets it sends into its own stack memory with the mqtt_codec_encode functions instead of allocating a buffer for each.]*/
+TEST_FUNCTION(mqtt_client_disconnect_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack(mqttHandle, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    setup_mqtt_client_disconnect_mocks(&mqttOptions);
+
+    // act
+    int result = mqtt_client_disconnect(mqttHandle, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_07_037: [ if callback is not NULL callback shall be called once the mqtt connection has been disconnected ] */
+TEST_FUNCTION(mqtt_client_disconnect_callback_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack(mqttHandle, &mqttOptions);
+
+    umock_c_reset_all_calls();
+
+    setup_mqtt_client_disconnect_mocks(&mqttOptions);
+
+    // act
+    int result = mqtt_client_disconnect(mqttHandle, on_mqtt_disconnected_callback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_disconnect_send_complete_SEND_OK_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack(mqttHandle, &mqttOptions);
+    (void)mqtt_client_disconnect(mqttHandle, NULL, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_close(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+
+    // act
+    ASSERT_IS_NOT_NULL(g_sendComplete);
+    g_sendComplete(g_onSendCtx, IO_SEND_OK);
+
+    // assert
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_disconnect_send_complete_SEND_ERROR_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    make_connack(mqttHandle, &mqttOptions);
+
+    (void)mqtt_client_disconnect(mqttHandle, NULL, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    ASSERT_IS_NOT_NULL(g_sendComplete);
+    g_sendComplete(g_onSendCtx, IO_SEND_ERROR);
+
+    // assert
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_023: [If the parameter handle is NULL then mqtt_client_dowork shall do nothing.]*/
+TEST_FUNCTION(mqtt_client_dowork_ping_handle_NULL_fails)
 {
     // arrange
 
@@ -1829,21 +2468,15 @@ TEST_FUNCTION(mqtt_client_dowork_ping_succeeds)
     umock_c_reset_all_calls();
     unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
     size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
 
     g_current_ms = TEST_KEEP_ALIVE_INTERVAL * 2 * 1000;
 
     EXPECTED_CALL(xio_dowork(IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mqtt_codec_ping());
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_pingreq(IGNORED_ARG));
     EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
 
     // act
@@ -1871,10 +2504,7 @@ TEST_FUNCTION(mqtt_client_dowork_ping_No_ping_response_succeeds)
     umock_c_reset_all_calls();
     unsigned char CONNACK_RESP[] ={ 0x1, 0x0 };
     size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
 
     g_current_ms = TEST_KEEP_ALIVE_INTERVAL * 2 * 1000;
     mqtt_client_dowork(mqttHandle);
@@ -1884,8 +2514,6 @@ TEST_FUNCTION(mqtt_client_dowork_ping_No_ping_response_succeeds)
     EXPECTED_CALL(xio_dowork(IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
     STRICT_EXPECTED_CALL(xio_close(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG));
-    STRICT_EXPECTED_CALL(xio_dowork(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(ThreadAPI_Sleep(CLOSE_SLEEP_VALUE));
 
     // act
     g_current_ms = TEST_KEEP_ALIVE_INTERVAL * 8 * 1000;
@@ -1917,10 +2545,7 @@ TEST_FUNCTION(mqtt_client_dowork_no_keepalive_no_ping_succeeds)
     umock_c_reset_all_calls();
     unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
     size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
 
     g_current_ms = TEST_KEEP_ALIVE_INTERVAL * 2 * 1000;
 
@@ -1954,10 +2579,7 @@ TEST_FUNCTION(mqtt_client_dowork_no_ping_succeeds)
     umock_c_reset_all_calls();
     unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
     size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
 
     EXPECTED_CALL(xio_dowork(IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
@@ -1988,10 +2610,7 @@ TEST_FUNCTION(mqtt_client_dowork_tickcounter_fails_succeeds)
     umock_c_reset_all_calls();
     unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
     size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
 
     EXPECTED_CALL(xio_dowork(IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2).SetReturn(MU_FAILURE);
@@ -2007,62 +2626,230 @@ TEST_FUNCTION(mqtt_client_dowork_tickcounter_fails_succeeds)
 }
 
 /*Tests_SRS_MQTT_CLIENT_18_001: [If the client is disconnected, mqtt_client_dowork shall do nothing.]*/
-TEST_FUNCTION(mqtt_client_dowork_does_nothing_if_disconnected_1)
+/*Tests_SRS_MQTT_CLIENT_07_044: [If handle is NULL then mqtt_client_set_send_coalescing shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_send_coalescing_handle_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_send_coalescing(NULL, 1024, 10);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_049: [If any failure is encountered then mqtt_client_set_send_coalescing shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_send_coalescing_malloc_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(1024)).SetReturn(NULL);
+
+    // act
+    int result = mqtt_client_set_send_coalescing(mqttHandle, 1024, 10);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_046: [When send coalescing is on and the client is connected, control packets shall be appended to the outbound queue instead of being sent on their own.]*/
+/*Tests_SRS_MQTT_CLIENT_07_048: [mqtt_client_dowork shall send any queued control packets in a single xio_send.]*/
+TEST_FUNCTION(mqtt_client_publish_coalesced_sent_on_dowork_succeeds)
 {
     // arrange
+    unsigned char PUBLISH_PACKET[] = { 0x30, 0x05, 0x00, 0x01, 0x61, 0x48, 0x69 };
+    size_t packetLength = sizeof(PUBLISH_PACKET) / sizeof(PUBLISH_PACKET[0]);
     MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
 
     MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
     SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
 
-    umock_c_reset_all_calls();
-    setup_mqtt_client_connect_mocks(&mqttOptions);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
 
     unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
     size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_send_coalescing(mqttHandle, 1024, 1000));
+    umock_c_reset_all_calls();
+
+    for (size_t index = 0; index < 2; index++)
+    {
+        STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+        STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+        STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+        STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+        STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+        STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+        STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+        EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+        STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(packetLength);
+        STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_PACKET);
+        STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+        STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    }
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, packetLength * 2, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    int result_1 = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+    int result_2 = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result_1);
+    ASSERT_ARE_EQUAL(int, 0, result_2);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_045: [mqtt_client_set_send_coalescing shall send anything already queued and then queue up to maxBytes of control packets for at most maxLatencyMs, a maxBytes of zero turns coalescing off.]*/
+/*Tests_SRS_MQTT_CLIENT_07_047: [The outbound queue shall be sent in a single xio_send once it is full or once its oldest packet has waited maxLatencyMs.]*/
+TEST_FUNCTION(mqtt_client_publish_coalesced_queue_full_sent_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_PACKET[] = { 0x30, 0x05, 0x00, 0x01, 0x61, 0x48, 0x69 };
+    size_t packetLength = sizeof(PUBLISH_PACKET) / sizeof(PUBLISH_PACKET[0]);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
 
     (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
     g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
-
-    mqtt_client_disconnect(mqttHandle, NULL, NULL);
 
-    g_sendComplete(g_onSendCtx, IO_SEND_OK);
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
     umock_c_reset_all_calls();
 
-    STRICT_EXPECTED_CALL(xio_close(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG));
-    STRICT_EXPECTED_CALL(xio_dowork(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(ThreadAPI_Sleep(CLOSE_SLEEP_VALUE));
+    STRICT_EXPECTED_CALL(gballoc_malloc(packetLength));
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(packetLength);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_PACKET);
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, packetLength, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 
     // act
-    mqtt_client_dowork(mqttHandle);
+    int result_1 = mqtt_client_set_send_coalescing(mqttHandle, packetLength, 1000);
+    int result_2 = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+    int result_3 = mqtt_client_set_send_coalescing(mqttHandle, 0, 0);
 
     // assert
+    ASSERT_ARE_EQUAL(int, 0, result_1);
+    ASSERT_ARE_EQUAL(int, 0, result_2);
+    ASSERT_ARE_EQUAL(int, 0, result_3);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/* Tests_SRS_MQTT_CLIENT_18_001: [ If the client is disconnected, mqtt_client_dowork shall do nothing. ] */
-TEST_FUNCTION(mqtt_client_dowork_does_nothing_if_disconnected_2)
+/*Tests_SRS_MQTT_CLIENT_07_050: [If handle is NULL or maxInflight is greater than 65534 then mqtt_client_set_inflight_window shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_inflight_window_handle_NULL_fails)
 {
     // arrange
-    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
 
+    // act
+    int result = mqtt_client_set_inflight_window(NULL, 16, 1000);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_050: [If handle is NULL or maxInflight is greater than 65534 then mqtt_client_set_inflight_window shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_inflight_window_too_large_fails)
+{
+    // arrange
     MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
-    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
     umock_c_reset_all_calls();
 
-    STRICT_EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+    // act
+    int result = mqtt_client_set_inflight_window(mqttHandle, 65535, 1000);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_053: [If any failure is encountered then mqtt_client_set_inflight_window shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_inflight_window_malloc_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
 
     // act
-    int result = mqtt_client_disconnect(mqttHandle, NULL, NULL);
-    mqtt_client_dowork(mqttHandle);
+    int result = mqtt_client_set_inflight_window(mqttHandle, 16, 1000);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_052: [mqtt_client_set_inflight_window shall make the client allocate the packet ids of QoS 1 and QoS 2 publishes and track up to maxInflight of them until they are acknowledged, a maxInflight of zero turns tracking off.]*/
+/*Tests_SRS_MQTT_CLIENT_07_054: [When the in-flight store is on, mqtt_client_publish shall give a QoS 1 or QoS 2 message a free packet id through mqttmessage_setPacketId and keep a copy of the message until it is acknowledged.]*/
+TEST_FUNCTION(mqtt_client_publish_inflight_assigns_packet_id_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_setPacketId(TEST_MESSAGE_HANDLE, 1));
+    STRICT_EXPECTED_CALL(mqttmessage_clone(TEST_MESSAGE_HANDLE));
+
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, 1, TEST_TOPIC_NAME, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
 
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
     ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
@@ -2070,833 +2857,4304 @@ TEST_FUNCTION(mqtt_client_dowork_does_nothing_if_disconnected_2)
     mqtt_client_deinit(mqttHandle);
 }
 
+/*Tests_SRS_MQTT_CLIENT_07_055: [If maxInflight messages are already in flight then mqtt_client_publish shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_publish_inflight_window_full_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    umock_c_reset_all_calls();
 
-/*Test_SRS_MQTT_CLIENT_07_027: [The callbackCtx parameter shall be an unmodified pointer that was passed to the mqtt_client_init function.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_context_NULL_fails)
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_051: [If messages are in flight then mqtt_client_set_inflight_window shall return a non-zero value.]*/
+/*Tests_SRS_MQTT_CLIENT_07_056: [On PUBACK or PUBCOMP the in-flight message with that packet id shall be removed and the packet id freed.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_ACK_releases_inflight_message_succeeds)
 {
     // arrange
-    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
-    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
+    unsigned char PUBLISH_ACK_RESP[] = { 0x00, 0x01 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    int in_flight_result = mqtt_client_set_inflight_window(mqttHandle, 2, 0);
+    umock_c_reset_all_calls();
 
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
 
-    CONNECT_ACK connack = { 0 };
-    connack.isSessionPresent = true;
-    connack.returnCode = CONNECTION_ACCEPTED;
-    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
-    testData.msgInfo = &connack;
+    // act
+    g_packetView(mqttHandle, PUBACK_TYPE, 0, PUBLISH_ACK_RESP, length);
 
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, in_flight_result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 0, 0));
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_057: [On PUBREC the in-flight message shall be released and its PUBREL shall be resent in its place until PUBCOMP is received.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RECEIVE_releases_inflight_message_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x00, 0x01 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
     umock_c_reset_all_calls();
 
+    EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_pubrel(1, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
     // act
-    g_packetComplete(NULL, CONNACK_TYPE, 0, connack_handle);
+    g_packetView(mqttHandle, PUBREC_TYPE, 0, PUBLISH_ACK_RESP, length);
 
     // assert
-    ASSERT_IS_FALSE(g_operationCallbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_NOT_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 0, 0));
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_context_and_handle_NULL_fails)
+/*Tests_SRS_MQTT_CLIENT_07_058: [mqtt_client_dowork shall resend every in-flight message that has waited retryTimeoutMs, with the DUP flag set through mqttmessage_setIsDuplicateMsg, or its PUBREL once PUBREC was received.]*/
+TEST_FUNCTION(mqtt_client_dowork_resends_inflight_message_succeeds)
 {
     // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+
     unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
     size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 4, 100));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    g_current_ms = 100;
+    umock_c_reset_all_calls();
 
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_getApplicationMsg(IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
+    EXPECTED_CALL(mqttmessage_getQosType(IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_getIsRetained(IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_getInternedTopic(IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_getTopicName(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, 1, TEST_TOPIC_NAME, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
 
-    CONNECT_ACK connack = { 0 };
-    connack.isSessionPresent = true;
-    connack.returnCode = CONNECTION_ACCEPTED;
-    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
-    testData.msgInfo = &connack;
+    // act
+    mqtt_client_dowork(mqttHandle);
 
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_059: [If handle is NULL then mqtt_client_set_session_store shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_session_store_handle_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_session_store(NULL, TEST_SESSION_STORE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_060: [If messages are in flight, or sessionStore is not NULL and the in-flight window is off, then mqtt_client_set_session_store shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_session_store_no_inflight_window_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
     umock_c_reset_all_calls();
 
     // act
-    g_packetComplete(NULL, PINGRESP_TYPE, 0, NULL);
+    int result = mqtt_client_set_session_store(mqttHandle, TEST_SESSION_STORE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_061: [mqtt_client_set_session_store shall restore the in-flight messages and received QoS 2 packet ids kept in sessionStore and keep them in it from then on, a NULL sessionStore detaches the current one.]*/
+TEST_FUNCTION(mqtt_client_set_session_store_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 4, 0));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_session_store_load(TEST_SESSION_STORE_HANDLE, IGNORED_ARG, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_set_session_store(mqttHandle, TEST_SESSION_STORE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_session_store(mqttHandle, NULL));
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_062: [If any failure is encountered then mqtt_client_set_session_store shall return a non-zero value and leave no messages in flight.]*/
+TEST_FUNCTION(mqtt_client_set_session_store_load_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 4, 0));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_session_store_load(TEST_SESSION_STORE_HANDLE, IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_set_session_store(mqttHandle, TEST_SESSION_STORE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_063: [When a session store is set, mqtt_client_publish shall store an in-flight message as its encoded PUBLISH packet before sending it.]*/
+TEST_FUNCTION(mqtt_client_publish_session_store_saves_message_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_session_store(mqttHandle, TEST_SESSION_STORE_HANDLE));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_setPacketId(TEST_MESSAGE_HANDLE, 1));
+    STRICT_EXPECTED_CALL(mqttmessage_clone(TEST_MESSAGE_HANDLE));
+
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, 1, TEST_TOPIC_NAME, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_session_store_save(TEST_SESSION_STORE_HANDLE, MQTT_SESSION_RECORD_PUBLISH, 1, TEST_BUFFER_U_CHAR, 11));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_063: [When a session store is set, mqtt_client_publish shall store an in-flight message as its encoded PUBLISH packet before sending it.]*/
+TEST_FUNCTION(mqtt_client_publish_session_store_save_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_session_store(mqttHandle, TEST_SESSION_STORE_HANDLE));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_setPacketId(TEST_MESSAGE_HANDLE, 1));
+    STRICT_EXPECTED_CALL(mqttmessage_clone(TEST_MESSAGE_HANDLE));
+
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, 1, TEST_TOPIC_NAME, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_session_store_save(TEST_SESSION_STORE_HANDLE, MQTT_SESSION_RECORD_PUBLISH, 1, TEST_BUFFER_U_CHAR, 11)).SetReturn(MU_FAILURE);
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_session_store_remove(TEST_SESSION_STORE_HANDLE, MQTT_SESSION_RECORD_PUBLISH, 1));
+    EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_064: [When a session store is set, the stored PUBLISH shall be replaced by a PUBREL record on PUBREC and removed on PUBACK or PUBCOMP.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_ACK_removes_stored_message_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x00, 0x01 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_session_store(mqttHandle, TEST_SESSION_STORE_HANDLE));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_session_store_remove(TEST_SESSION_STORE_HANDLE, MQTT_SESSION_RECORD_PUBLISH, 1));
+    EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBACK_TYPE, 0, PUBLISH_ACK_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_064: [When a session store is set, the stored PUBLISH shall be replaced by a PUBREL record on PUBREC and removed on PUBACK or PUBCOMP.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RECEIVE_stores_release_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x00, 0x01 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_session_store(mqttHandle, TEST_SESSION_STORE_HANDLE));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_session_store_save(TEST_SESSION_STORE_HANDLE, MQTT_SESSION_RECORD_PUBREL, 1, NULL, 0));
+    EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_pubrel(1, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBREC_TYPE, 0, PUBLISH_ACK_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_065: [When a session store is set, an incoming QoS 2 publish shall be stored as a PUBREC record before PUBREC is sent and removed when its PUBREL is received, a publish with a stored PUBREC shall only be acknowledged again and not delivered.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_EXACTLY_ONCE_stored_delivered_once_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    uint8_t flag = 0x0d;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_session_store(mqttHandle, TEST_SESSION_STORE_HANDLE));
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+    g_msgRecvCallbackInvoked = false;
+    umock_c_reset_all_calls();
+
+    setup_publish_callback_mocks(PUBLISH_RESP, length, DELIVER_EXACTLY_ONCE);
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_065: [When a session store is set, an incoming QoS 2 publish shall be stored as a PUBREC record before PUBREC is sent and removed when its PUBREL is received, a publish with a stored PUBREC shall only be acknowledged again and not delivered.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RELEASE_removes_stored_receive_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    unsigned char PUBLISH_REL_RESP[] = { 0x12, 0x34 };
+    uint8_t flag = 0x0d;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_session_store(mqttHandle, TEST_SESSION_STORE_HANDLE));
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, sizeof(PUBLISH_RESP));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_session_store_remove(TEST_SESSION_STORE_HANDLE, MQTT_SESSION_RECORD_PUBREC, TEST_PACKET_ID));
+    EXPECTED_CALL(mqtt_codec_encode_pubcomp(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBREL_TYPE, 0, PUBLISH_REL_RESP, sizeof(PUBLISH_REL_RESP));
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_066: [After a CONNACK accepting the connection or a session restore, mqtt_client_dowork shall resend every in-flight message once whatever retryTimeoutMs is.]*/
+TEST_FUNCTION(mqtt_client_dowork_resends_inflight_message_after_connack_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 4, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_getApplicationMsg(IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
+    EXPECTED_CALL(mqttmessage_getQosType(IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_getIsRetained(IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_getInternedTopic(IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_getTopicName(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, 1, TEST_TOPIC_NAME, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_067: [If handle is NULL then mqtt_client_set_offline_queue shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_offline_queue_handle_NULL_fails)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+
+    // act
+    int result = mqtt_client_set_offline_queue(NULL, &options);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_068: [mqtt_client_set_offline_queue shall create the offline queue from options, a NULL options turns queueing off.]*/
+TEST_FUNCTION(mqtt_client_set_offline_queue_succeeds)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_create(&options));
+
+    // act
+    int result = mqtt_client_set_offline_queue(mqttHandle, &options);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_068: [mqtt_client_set_offline_queue shall create the offline queue from options, a NULL options turns queueing off.]*/
+TEST_FUNCTION(mqtt_client_set_offline_queue_NULL_options_destroys_queue_succeeds)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_offline_queue(mqttHandle, &options));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_count(TEST_OFFLINE_QUEUE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_destroy(TEST_OFFLINE_QUEUE_HANDLE));
+
+    // act
+    int result = mqtt_client_set_offline_queue(mqttHandle, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_073: [If publishes are queued then mqtt_client_set_offline_queue shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_offline_queue_messages_queued_fails)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_offline_queue(mqttHandle, &options));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_count(TEST_OFFLINE_QUEUE_HANDLE)).SetReturn(1);
+
+    // act
+    int result = mqtt_client_set_offline_queue(mqttHandle, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_074: [If any failure is encountered then mqtt_client_set_offline_queue shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_offline_queue_create_fails)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_create(&options)).SetReturn(NULL);
+
+    // act
+    int result = mqtt_client_set_offline_queue(mqttHandle, &options);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_069: [When an offline queue is set and the client is not connected, or queued publishes are still waiting, mqtt_client_publish shall encode the message with mqtt_codec_publish and queue it with mqtt_offline_queue_push.]*/
+TEST_FUNCTION(mqtt_client_publish_offline_queues_message_succeeds)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_offline_queue(mqttHandle, &options));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, TEST_TOPIC_NAME, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_push(TEST_OFFLINE_QUEUE_HANDLE, TEST_BUFFER_HANDLE, DELIVER_AT_LEAST_ONCE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_070: [If the offline queue drops the message then mqtt_client_publish shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_publish_offline_queue_push_fails)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_offline_queue(mqttHandle, &options));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, TEST_TOPIC_NAME, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_push(TEST_OFFLINE_QUEUE_HANDLE, TEST_BUFFER_HANDLE, DELIVER_AT_LEAST_ONCE)).SetReturn(MU_FAILURE);
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_071: [Once connected, mqtt_client_dowork shall send up to drainPerDowork queued publishes in the order they were made, all of them if drainPerDowork is 0.]*/
+TEST_FUNCTION(mqtt_client_dowork_offline_queue_drains_messages_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_PACKET[] = { 0x30, 0x07, 0x00, 0x03, 0x61, 0x2f, 0x62, 0x78, 0x79 };
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    options.drainPerDowork = 1;
+    g_current_ms = (TEST_KEEP_ALIVE_INTERVAL - 5) * 1000;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_offline_queue(mqttHandle, &options));
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_peek(TEST_OFFLINE_QUEUE_HANDLE)).SetReturn(TEST_BUFFER_HANDLE);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_PACKET);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBLISH_PACKET));
+    STRICT_EXPECTED_CALL(xio_send(TEST_IO_HANDLE, PUBLISH_PACKET, sizeof(PUBLISH_PACKET), IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_pop(TEST_OFFLINE_QUEUE_HANDLE));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_072: [When the in-flight store is on, a queued QoS 1 or QoS 2 publish shall get its packet id when it is sent and stay queued while the in-flight window is full.]*/
+TEST_FUNCTION(mqtt_client_dowork_offline_queue_assigns_packet_id_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_PACKET[] = { 0x32, 0x09, 0x00, 0x03, 0x61, 0x2f, 0x62, 0x00, 0x00, 0x78, 0x79 };
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    g_current_ms = (TEST_KEEP_ALIVE_INTERVAL - 5) * 1000;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_offline_queue(mqttHandle, &options));
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_peek(TEST_OFFLINE_QUEUE_HANDLE)).SetReturn(TEST_BUFFER_HANDLE);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_PACKET);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBLISH_PACKET));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(1, IGNORED_ARG, 3, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, 2));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    EXPECTED_CALL(mqttmessage_clone(IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(TEST_IO_HANDLE, PUBLISH_PACKET, sizeof(PUBLISH_PACKET), IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_pop(TEST_OFFLINE_QUEUE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_peek(TEST_OFFLINE_QUEUE_HANDLE)).SetReturn(TEST_BUFFER_HANDLE);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_PACKET);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBLISH_PACKET));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0x00, PUBLISH_PACKET[7]);
+    ASSERT_ARE_EQUAL(int, 0x01, PUBLISH_PACKET[8]);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_165: [When a queued publish is dropped because it can not be sent on this connection, its in-flight entry and packet id shall be released.]*/
+TEST_FUNCTION(mqtt_client_dowork_offline_queue_drop_releases_packet_id_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_PACKET[] = { 0x32, 0x09, 0x00, 0x03, 0x61, 0x2f, 0x62, 0x00, 0x00, 0x78, 0x79 };
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x00 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    g_current_ms = (TEST_KEEP_ALIVE_INTERVAL - 5) * 1000;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_offline_queue(mqttHandle, &options));
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_V5;
+
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_peek(TEST_OFFLINE_QUEUE_HANDLE)).SetReturn(TEST_BUFFER_HANDLE);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_PACKET);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBLISH_PACKET));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(1, IGNORED_ARG, 3, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, 2));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    EXPECTED_CALL(mqttmessage_clone(IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, false, false, 1, IGNORED_ARG, 3, 0, IGNORED_ARG, 2, IGNORED_ARG)).SetReturn(NULL);
+    EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_pop(TEST_OFFLINE_QUEUE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_peek(TEST_OFFLINE_QUEUE_HANDLE)).SetReturn(NULL);
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_075: [If handle is NULL or options has an initialDelayMs of 0 or a maxDelayMs below initialDelayMs then mqtt_client_set_reconnect shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_reconnect_handle_NULL_fails)
+{
+    // arrange
+    MQTT_CLIENT_RECONNECT_OPTIONS options = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS, 0, false };
+
+    // act
+    int result = mqtt_client_set_reconnect(NULL, &options);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_075: [If handle is NULL or options has an initialDelayMs of 0 or a maxDelayMs below initialDelayMs then mqtt_client_set_reconnect shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_reconnect_invalid_delay_fails)
+{
+    // arrange
+    MQTT_CLIENT_RECONNECT_OPTIONS zero_delay = { 0, TEST_RECONNECT_DELAY_MS, 0, false };
+    MQTT_CLIENT_RECONNECT_OPTIONS max_below_initial = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS - 1, 0, false };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int zero_result = mqtt_client_set_reconnect(mqttHandle, &zero_delay);
+    int below_result = mqtt_client_set_reconnect(mqttHandle, &max_below_initial);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, zero_result);
+    ASSERT_ARE_NOT_EQUAL(int, 0, below_result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_076: [mqtt_client_set_reconnect shall make the client reopen its connection on its own after a connection failure, a NULL options turns reconnecting off.]*/
+TEST_FUNCTION(mqtt_client_set_reconnect_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_RECONNECT_OPTIONS options = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS * 8, 0, true };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_set_reconnect(mqttHandle, &options);
+    int off_result = mqtt_client_set_reconnect(mqttHandle, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, off_result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_077: [After a connection failure the client shall wait a random time between zero and initialDelayMs doubled for every failed attempt, capped at maxDelayMs, before it reconnects.]*/
+TEST_FUNCTION(mqtt_client_ioerror_schedules_reconnect_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_RECONNECT_OPTIONS options = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS * 8, 0, false };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = setup_reconnecting_client(&options, &mqttOptions);
+
+    STRICT_EXPECTED_CALL(xio_close(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    g_ioError(g_ioErrorCtx);
+
+    // assert
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_078: [When a reconnect is due mqtt_client_dowork shall reopen the XIO_HANDLE given to mqtt_client_connect, which sends CONNECT again once it is open.]*/
+TEST_FUNCTION(mqtt_client_dowork_reconnect_reopens_xio_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_RECONNECT_OPTIONS options = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS * 8, 0, false };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = setup_reconnecting_client(&options, &mqttOptions);
+    g_ioError(g_ioErrorCtx);
+    g_current_ms += TEST_RECONNECT_DELAY_MS;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_reset(TEST_MQTTCODEC_HANDLE));
+    STRICT_EXPECTED_CALL(xio_open(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_079: [Once maxRetryWindowMs has passed since the connection was lost, the client shall stop reconnecting and call the ON_MQTT_ERROR_CALLBACK with MQTT_CLIENT_RECONNECT_FAILED.]*/
+TEST_FUNCTION(mqtt_client_dowork_reconnect_retry_window_exceeded_fails)
+{
+    // arrange
+    MQTT_CLIENT_RECONNECT_OPTIONS options = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS * 8, TEST_RECONNECT_DELAY_MS, false };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = setup_reconnecting_client(&options, &mqttOptions);
+    g_ioError(g_ioErrorCtx);
+    g_current_ms += TEST_RECONNECT_DELAY_MS;
+    mqtt_client_dowork(mqttHandle);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_ERROR);
+    g_errorCallbackInvoked = false;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(xio_close(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+    g_current_ms += TEST_RECONNECT_DELAY_MS * 8;
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_163: [Before it waits to reconnect, the client shall close a transport that failed to open with xio_close and reopen it only once the close completes or CLOSE_TIMEOUT_MS have passed.]*/
+TEST_FUNCTION(mqtt_client_dowork_reconnect_waits_for_failed_xio_close_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_RECONNECT_OPTIONS options = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS * 8, 0, false };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = setup_reconnecting_client(&options, &mqttOptions);
+    g_ioError(g_ioErrorCtx);
+    g_current_ms += TEST_RECONNECT_DELAY_MS;
+    mqtt_client_dowork(mqttHandle);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_ERROR);
+    g_closeAsync = true;
+    mqtt_client_dowork(mqttHandle);
+    ASSERT_IS_NOT_NULL(g_closeComplete);
+    g_current_ms += TEST_RECONNECT_DELAY_MS * 2;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(xio_dowork(TEST_IO_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // act
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_reset(TEST_MQTTCODEC_HANDLE));
+    STRICT_EXPECTED_CALL(xio_open(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+
+    g_closeComplete(g_onCloseCtx);
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_080: [When resubscribe is set, after a CONNACK without a session present that follows a reconnect, the client shall send one SUBSCRIBE for every subscription acknowledged before.]*/
+/*Tests_SRS_MQTT_CLIENT_07_162: [The client shall send the SUBSCRIBE that restores the subscriptions with a packet id taken from the in-flight window when it is on, and otherwise with one that no SUBSCRIBE waiting for its SUBACK uses.]*/
+TEST_FUNCTION(mqtt_client_reconnect_connack_resubscribes_succeeds)
+{
+    // arrange
+    unsigned char SUBSCRIBE_ACK_RESP[] = { 0x12, 0x34, 0x01, 0x02 };
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0 };
+    MQTT_CLIENT_RECONNECT_OPTIONS options = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS * 8, 0, true };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = setup_reconnecting_client(&options, &mqttOptions);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_subscribe(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2));
+    g_packetView(mqttHandle, SUBACK_TYPE, 0, SUBSCRIBE_ACK_RESP, sizeof(SUBSCRIBE_ACK_RESP));
+    g_ioError(g_ioErrorCtx);
+    g_current_ms += TEST_RECONNECT_DELAY_MS;
+    mqtt_client_dowork(mqttHandle);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_subscribe(UINT16_MAX, IGNORED_ARG, 2, NULL));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, sizeof(CONNACK_RESP));
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_162: [The client shall send the SUBSCRIBE that restores the subscriptions with a packet id taken from the in-flight window when it is on, and otherwise with one that no SUBSCRIBE waiting for its SUBACK uses.]*/
+TEST_FUNCTION(mqtt_client_reconnect_connack_resubscribes_inflight_packet_id_succeeds)
+{
+    // arrange
+    unsigned char SUBSCRIBE_ACK_RESP[] = { 0x12, 0x34, 0x01, 0x02 };
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0 };
+    MQTT_CLIENT_RECONNECT_OPTIONS options = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS * 8, 0, true };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = setup_reconnecting_client(&options, &mqttOptions);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 4, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_subscribe(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2));
+    g_packetView(mqttHandle, SUBACK_TYPE, 0, SUBSCRIBE_ACK_RESP, sizeof(SUBSCRIBE_ACK_RESP));
+    g_ioError(g_ioErrorCtx);
+    g_current_ms += TEST_RECONNECT_DELAY_MS;
+    mqtt_client_dowork(mqttHandle);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_subscribe(1, IGNORED_ARG, 2, NULL));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, sizeof(CONNACK_RESP));
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_164: [If packetId is the packet id of the SUBSCRIBE the client sent to restore the subscriptions and its SUBACK has not come yet then mqtt_client_subscribe and mqtt_client_unsubscribe shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_subscribe_resubscribe_packet_id_in_use_fails)
+{
+    // arrange
+    unsigned char SUBSCRIBE_ACK_RESP[] = { 0x12, 0x34, 0x01, 0x02 };
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0 };
+    MQTT_CLIENT_RECONNECT_OPTIONS options = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS * 8, 0, true };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = setup_reconnecting_client(&options, &mqttOptions);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_subscribe(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2));
+    g_packetView(mqttHandle, SUBACK_TYPE, 0, SUBSCRIBE_ACK_RESP, sizeof(SUBSCRIBE_ACK_RESP));
+    g_ioError(g_ioErrorCtx);
+    g_current_ms += TEST_RECONNECT_DELAY_MS;
+    mqtt_client_dowork(mqttHandle);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, sizeof(CONNACK_RESP));
+    umock_c_reset_all_calls();
+
+    // act
+    int subscribeResult = mqtt_client_subscribe(mqttHandle, UINT16_MAX, TEST_SUBSCRIBE_PAYLOAD, 2);
+    int unsubscribeResult = mqtt_client_unsubscribe(mqttHandle, UINT16_MAX, TEST_UNSUBSCRIPTION_TOPIC, 2);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, subscribeResult);
+    ASSERT_ARE_NOT_EQUAL(int, 0, unsubscribeResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_081: [mqtt_client_disconnect and mqtt_client_clear_xio shall stop reconnecting.]*/
+TEST_FUNCTION(mqtt_client_disconnect_stops_reconnect_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_RECONNECT_OPTIONS options = { TEST_RECONNECT_DELAY_MS, TEST_RECONNECT_DELAY_MS * 8, 0, false };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = setup_reconnecting_client(&options, &mqttOptions);
+    g_ioError(g_ioErrorCtx);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_disconnect(mqttHandle, NULL, NULL));
+    g_current_ms += TEST_RECONNECT_DELAY_MS * 8;
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_082: [If handle or topicFilter is NULL then mqtt_client_set_topic_handler shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_topic_handler_handle_NULL_fail)
+{
+    // arrange
+    MQTT_CLIENT_ACK_OPTION ackOption = MQTT_CLIENT_ACK_SYNC;
+
+    // act
+    int result = mqtt_client_set_topic_handler(NULL, TEST_SUBSCRIPTION_TOPIC, TestTopicCallback, &ackOption);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_082: [If handle or topicFilter is NULL then mqtt_client_set_topic_handler shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_topic_handler_topicFilter_NULL_fail)
+{
+    // arrange
+    MQTT_CLIENT_ACK_OPTION ackOption = MQTT_CLIENT_ACK_SYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_set_topic_handler(mqttHandle, NULL, TestTopicCallback, &ackOption);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_083: [mqtt_client_set_topic_handler shall store handler and context under topicFilter with mqtt_topic_trie_insert, a NULL handler removes the handler of topicFilter.]*/
+TEST_FUNCTION(mqtt_client_set_topic_handler_succeed)
+{
+    // arrange
+    MQTT_CLIENT_ACK_OPTION ackOption = MQTT_CLIENT_ACK_SYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_create(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_insert(TEST_TOPIC_TRIE_HANDLE, TEST_SUBSCRIPTION_TOPIC, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_set_topic_handler(mqttHandle, TEST_SUBSCRIPTION_TOPIC, TestTopicCallback, &ackOption);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_topicValueCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+    ASSERT_ARE_EQUAL(size_t, 0, g_topicValueCount);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_083: [mqtt_client_set_topic_handler shall store handler and context under topicFilter with mqtt_topic_trie_insert, a NULL handler removes the handler of topicFilter.]*/
+TEST_FUNCTION(mqtt_client_set_topic_handler_NULL_handler_removes_succeed)
+{
+    // arrange
+    MQTT_CLIENT_ACK_OPTION ackOption = MQTT_CLIENT_ACK_SYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_topic_handler(mqttHandle, TEST_SUBSCRIPTION_TOPIC, TestTopicCallback, &ackOption));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_remove(TEST_TOPIC_TRIE_HANDLE, TEST_SUBSCRIPTION_TOPIC));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_set_topic_handler(mqttHandle, TEST_SUBSCRIPTION_TOPIC, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_topicValueCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_084: [If topicFilter is not a valid topic filter or any failure is encountered then mqtt_client_set_topic_handler shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_topic_handler_NULL_handler_not_set_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_set_topic_handler(mqttHandle, TEST_SUBSCRIPTION_TOPIC, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_084: [If topicFilter is not a valid topic filter or any failure is encountered then mqtt_client_set_topic_handler shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_topic_handler_create_fail)
+{
+    // arrange
+    MQTT_CLIENT_ACK_OPTION ackOption = MQTT_CLIENT_ACK_SYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_create(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    int result = mqtt_client_set_topic_handler(mqttHandle, TEST_SUBSCRIPTION_TOPIC, TestTopicCallback, &ackOption);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_084: [If topicFilter is not a valid topic filter or any failure is encountered then mqtt_client_set_topic_handler shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_topic_handler_insert_fail)
+{
+    // arrange
+    MQTT_CLIENT_ACK_OPTION ackOption = MQTT_CLIENT_ACK_SYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_create(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_insert(TEST_TOPIC_TRIE_HANDLE, "a/#/b", IGNORED_ARG)).SetReturn(MU_FAILURE);
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_set_topic_handler(mqttHandle, "a/#/b", TestTopicCallback, &ackOption);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_topicValueCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_085: [When topic handlers are set, a received message shall be passed to the handler of every filter matching its topic with mqtt_topic_trie_match, and to the ON_MQTT_MESSAGE_RECV_CALLBACK only if no filter matches.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_topic_handler_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    uint8_t flag = 0x0a;
+    MQTT_CLIENT_ACK_OPTION ackOption = MQTT_CLIENT_ACK_SYNC;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_topic_handler(mqttHandle, "topic Name", TestTopicCallback, &ackOption));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(TEST_PACKET_ID, IGNORED_ARG, 10, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_match(TEST_TOPIC_TRIE_HANDLE, IGNORED_ARG, 10, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_puback(TEST_PACKET_ID, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_topicCallbackCount);
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_161: [When called from a topic handler, mqtt_client_set_topic_handler shall copy topicFilter, return 0 and make the change once the message has been passed to every matching handler.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_topic_handler_removes_itself_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    uint8_t flag = 0x0a;
+    char topicFilter[] = "topic Name";
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_topic_handler(mqttHandle, topicFilter, TestRemovingTopicCallback, topicFilter));
+    g_topicHandlerClient = mqttHandle;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(TEST_PACKET_ID, IGNORED_ARG, 10, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_match(TEST_TOPIC_TRIE_HANDLE, IGNORED_ARG, 10, IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_ARG, "topic Name"));
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_remove(TEST_TOPIC_TRIE_HANDLE, "topic Name"));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_puback(TEST_PACKET_ID, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, g_topicHandlerChangeResult);
+    ASSERT_ARE_EQUAL(size_t, 1, g_topicCallbackCount);
+    ASSERT_ARE_EQUAL(size_t, 0, g_topicValueCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_085: [When topic handlers are set, a received message shall be passed to the handler of every filter matching its topic with mqtt_topic_trie_match, and to the ON_MQTT_MESSAGE_RECV_CALLBACK only if no filter matches.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_no_topic_handler_match_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    uint8_t flag = 0x0a;
+    MQTT_CLIENT_ACK_OPTION ackOption = MQTT_CLIENT_ACK_SYNC;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_topic_handler(mqttHandle, "other/+", TestTopicCallback, &ackOption));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(TEST_PACKET_ID, IGNORED_ARG, 10, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_match(TEST_TOPIC_TRIE_HANDLE, IGNORED_ARG, 10, IGNORED_ARG, IGNORED_ARG)).SetReturn(0);
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_puback(TEST_PACKET_ID, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_topicCallbackCount);
+    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_086: [When several handlers match, the message shall be acknowledged later if any of them returned MQTT_CLIENT_ACK_ASYNC, right away if any returned MQTT_CLIENT_ACK_SYNC and not at all otherwise.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_topic_handlers_ack_async_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    uint8_t flag = 0x0a;
+    MQTT_CLIENT_ACK_OPTION syncOption = MQTT_CLIENT_ACK_SYNC;
+    MQTT_CLIENT_ACK_OPTION asyncOption = MQTT_CLIENT_ACK_ASYNC;
+    MQTT_CLIENT_ACK_OPTION noneOption = MQTT_CLIENT_ACK_NONE;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_topic_handler(mqttHandle, "topic Name", TestTopicCallback, &syncOption));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_topic_handler(mqttHandle, "+", TestTopicCallback, &asyncOption));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_topic_handler(mqttHandle, "#", TestTopicCallback, &noneOption));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(TEST_PACKET_ID, IGNORED_ARG, 10, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_match(TEST_TOPIC_TRIE_HANDLE, IGNORED_ARG, 10, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 3, g_topicCallbackCount);
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_087: [If handle or topicName is NULL then mqtt_client_intern_topic shall return NULL.]*/
+TEST_FUNCTION(mqtt_client_intern_topic_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_client_intern_topic(NULL, TEST_TOPIC_NAME);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_087: [If handle or topicName is NULL then mqtt_client_intern_topic shall return NULL.]*/
+TEST_FUNCTION(mqtt_client_intern_topic_topicName_NULL_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_client_intern_topic(mqttHandle, NULL);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_088: [mqtt_client_intern_topic shall return the topic interned for topicName with mqtt_topic_table_intern, creating the topic table of the client on the first call, or NULL if any failure is encountered.]*/
+TEST_FUNCTION(mqtt_client_intern_topic_succeed)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_topic_table_create());
+    STRICT_EXPECTED_CALL(mqtt_topic_table_intern(TEST_TOPIC_TABLE_HANDLE, TEST_TOPIC_NAME));
+    STRICT_EXPECTED_CALL(mqtt_topic_table_intern(TEST_TOPIC_TABLE_HANDLE, TEST_SUBSCRIPTION_TOPIC));
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_client_intern_topic(mqttHandle, TEST_TOPIC_NAME);
+    MQTT_TOPIC_HANDLE second = mqtt_client_intern_topic(mqttHandle, TEST_SUBSCRIPTION_TOPIC);
+
+    // assert
+    ASSERT_ARE_EQUAL(void_ptr, TEST_INTERNED_TOPIC, result);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_INTERNED_TOPIC, second);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(tickcounter_destroy(TEST_COUNTER_HANDLE));
+    EXPECTED_CALL(mqtt_codec_destroy(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_topic_table_destroy(TEST_TOPIC_TABLE_HANDLE));
+    STRICT_EXPECTED_CALL(gballoc_free(mqttHandle));
+    mqtt_client_deinit(mqttHandle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_088: [mqtt_client_intern_topic shall return the topic interned for topicName with mqtt_topic_table_intern, creating the topic table of the client on the first call, or NULL if any failure is encountered.]*/
+TEST_FUNCTION(mqtt_client_intern_topic_create_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_topic_table_create()).SetReturn(NULL);
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_client_intern_topic(mqttHandle, TEST_TOPIC_NAME);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_088: [mqtt_client_intern_topic shall return the topic interned for topicName with mqtt_topic_table_intern, creating the topic table of the client on the first call, or NULL if any failure is encountered.]*/
+TEST_FUNCTION(mqtt_client_intern_topic_intern_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_topic_table_create());
+    STRICT_EXPECTED_CALL(mqtt_topic_table_intern(TEST_TOPIC_TABLE_HANDLE, "a/+")).SetReturn(NULL);
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_client_intern_topic(mqttHandle, "a/+");
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_099: [If handle is NULL or credit is larger than 65535 then mqtt_client_set_receive_credit shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_receive_credit_handle_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_receive_credit(NULL, 16);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_099: [If handle is NULL or credit is larger than 65535 then mqtt_client_set_receive_credit shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_receive_credit_too_large_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_set_receive_credit(mqttHandle, 65536);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_102: [If any failure is encountered then mqtt_client_set_receive_credit shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_receive_credit_malloc_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    int result = mqtt_client_set_receive_credit(mqttHandle, 16);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+static MQTT_CLIENT_HANDLE receive_async_publish(MQTT_CLIENT_ACK_OPTION* asyncOption)
+{
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_receive_credit(mqttHandle, 1));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_topic_handler(mqttHandle, "topic Name", TestTopicCallback, asyncOption));
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, 0, false, true, DELIVER_AT_MOST_ONCE);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]));
+    g_packetView(mqttHandle, PUBLISH_TYPE, 0x02, PUBLISH_RESP, length);
+    ASSERT_ARE_EQUAL(size_t, 1, g_topicCallbackCount);
+    umock_c_reset_all_calls();
+    return mqttHandle;
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_101: [mqtt_client_set_receive_credit shall limit the received QoS 1 and QoS 2 messages waiting for mqtt_client_send_message_response to credit, 0 removes the limit.]*/
+/*Tests_SRS_MQTT_CLIENT_07_105: [While every receive credit is used, mqtt_client_dowork shall still call xio_dowork and supervise the keep alive, only publishes are held.]*/
+/*Tests_SRS_MQTT_CLIENT_07_106: [A QoS 1 or QoS 2 message answered with MQTT_CLIENT_ACK_ASYNC shall use one receive credit until mqtt_client_send_message_response is called for its packet id.]*/
+TEST_FUNCTION(mqtt_client_dowork_receive_credit_used_still_calls_xio_dowork_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_ACK_OPTION asyncOption = MQTT_CLIENT_ACK_ASYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = receive_async_publish(&asyncOption);
+
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_166: [A PUBLISH received while every receive credit is used, or while earlier publishes are still held, shall be held in order and delivered by mqtt_client_dowork once an acknowledgement returns a credit.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_receive_credit_used_held_until_ack_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x35, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    MQTT_CLIENT_ACK_OPTION asyncOption = MQTT_CLIENT_ACK_ASYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = receive_async_publish(&asyncOption);
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, 0x02, PUBLISH_RESP, length);
+    size_t heldCount = g_topicCallbackCount;
+    (void)memset(PUBLISH_RESP, 0, length);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_send_message_response(mqttHandle, TEST_PACKET_ID, DELIVER_AT_LEAST_ONCE));
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, heldCount);
+    ASSERT_ARE_EQUAL(size_t, 2, g_topicCallbackCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_100: [If received messages are waiting for their acknowledgement then mqtt_client_set_receive_credit shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_receive_credit_acks_outstanding_fails)
+{
+    // arrange
+    MQTT_CLIENT_ACK_OPTION asyncOption = MQTT_CLIENT_ACK_ASYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = receive_async_publish(&asyncOption);
+
+    // act
+    int result = mqtt_client_set_receive_credit(mqttHandle, 0);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_106: [A QoS 1 or QoS 2 message answered with MQTT_CLIENT_ACK_ASYNC shall use one receive credit until mqtt_client_send_message_response is called for its packet id.]*/
+TEST_FUNCTION(mqtt_client_dowork_receive_credit_returned_calls_xio_dowork_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_ACK_OPTION asyncOption = MQTT_CLIENT_ACK_ASYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = receive_async_publish(&asyncOption);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_send_message_response(mqttHandle, TEST_PACKET_ID, DELIVER_AT_LEAST_ONCE));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_107: [A PUBLISH with the DUP flag set for a packet id still waiting for mqtt_client_send_message_response shall not be delivered again, the pending acknowledgement answers both.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_duplicate_awaiting_ack_not_delivered_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    MQTT_CLIENT_ACK_OPTION asyncOption = MQTT_CLIENT_ACK_ASYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = receive_async_publish(&asyncOption);
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(TEST_PACKET_ID, IGNORED_ARG, 10, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, 0x0a, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_topicCallbackCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_108: [If handle is NULL then mqtt_client_enable_submit_queue shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_enable_submit_queue_handle_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_enable_submit_queue(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_109: [mqtt_client_enable_submit_queue shall create the submit queue of the client with mqtt_submit_queue_create once, or return a non-zero value if any failure is encountered.]*/
+TEST_FUNCTION(mqtt_client_enable_submit_queue_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_submit_queue_create());
+
+    // act
+    int result = mqtt_client_enable_submit_queue(mqttHandle);
+    int second = mqtt_client_enable_submit_queue(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, second);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(tickcounter_destroy(TEST_COUNTER_HANDLE));
+    EXPECTED_CALL(mqtt_codec_destroy(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_submit_queue_destroy(TEST_SUBMIT_QUEUE_HANDLE));
+    STRICT_EXPECTED_CALL(gballoc_free(mqttHandle));
+    mqtt_client_deinit(mqttHandle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_109: [mqtt_client_enable_submit_queue shall create the submit queue of the client with mqtt_submit_queue_create once, or return a non-zero value if any failure is encountered.]*/
+TEST_FUNCTION(mqtt_client_enable_submit_queue_create_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_submit_queue_create()).SetReturn(NULL);
+
+    // act
+    int result = mqtt_client_enable_submit_queue(mqttHandle);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_110: [If handle or msgHandle is NULL, or mqtt_client_enable_submit_queue was not called, then mqtt_client_submit_publish shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_submit_publish_handle_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_submit_publish(NULL, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_110: [If handle or msgHandle is NULL, or mqtt_client_enable_submit_queue was not called, then mqtt_client_submit_publish shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_submit_publish_not_enabled_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_submit_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_111: [mqtt_client_submit_publish shall encode the message with mqtt_codec_publish on the calling thread and push the packet with mqtt_submit_queue_push, leaving the packet id to the in-flight store when it is on.]*/
+TEST_FUNCTION(mqtt_client_submit_publish_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_enable_submit_queue(mqttHandle));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, TEST_TOPIC_NAME, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_submit_queue_push(TEST_SUBMIT_QUEUE_HANDLE, TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_submit_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_112: [If any failure is encountered then mqtt_client_submit_publish shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_submit_publish_push_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_enable_submit_queue(mqttHandle));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, TEST_TOPIC_NAME, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_submit_queue_push(TEST_SUBMIT_QUEUE_HANDLE, TEST_BUFFER_HANDLE)).SetReturn(MU_FAILURE);
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_submit_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_113: [mqtt_client_dowork shall move submitted publishes into the offline queue when one is set, and otherwise send them once connected the way queued publishes are sent, up to drainPerDowork of them per call.]*/
+TEST_FUNCTION(mqtt_client_dowork_submit_queue_sends_messages_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_PACKET[] = { 0x30, 0x07, 0x00, 0x03, 0x61, 0x2f, 0x62, 0x78, 0x79 };
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    g_current_ms = (TEST_KEEP_ALIVE_INTERVAL - 5) * 1000;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_enable_submit_queue(mqttHandle));
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_submit_queue_pop(TEST_SUBMIT_QUEUE_HANDLE)).SetReturn(TEST_BUFFER_HANDLE);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_PACKET);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBLISH_PACKET));
+    STRICT_EXPECTED_CALL(xio_send(TEST_IO_HANDLE, PUBLISH_PACKET, sizeof(PUBLISH_PACKET), IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_submit_queue_pop(TEST_SUBMIT_QUEUE_HANDLE));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_113: [mqtt_client_dowork shall move submitted publishes into the offline queue when one is set, and otherwise send them once connected the way queued publishes are sent, up to drainPerDowork of them per call.]*/
+TEST_FUNCTION(mqtt_client_dowork_submit_queue_moves_messages_to_offline_queue_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_PACKET[] = { 0x32, 0x09, 0x00, 0x03, 0x61, 0x2f, 0x62, 0x00, 0x01, 0x78, 0x79 };
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_offline_queue(mqttHandle, &options));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_enable_submit_queue(mqttHandle));
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_submit_queue_pop(TEST_SUBMIT_QUEUE_HANDLE)).SetReturn(TEST_BUFFER_HANDLE);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_PACKET);
+    STRICT_EXPECTED_CALL(mqtt_offline_queue_push(TEST_OFFLINE_QUEUE_HANDLE, TEST_BUFFER_HANDLE, DELIVER_AT_LEAST_ONCE));
+    STRICT_EXPECTED_CALL(mqtt_submit_queue_pop(TEST_SUBMIT_QUEUE_HANDLE));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_114: [After pushing the packet mqtt_client_submit_publish shall call the callback set with mqtt_client_set_wakeup_callback on the calling thread.]*/
+TEST_FUNCTION(mqtt_client_submit_publish_calls_wakeup_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_enable_submit_queue(mqttHandle));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_wakeup_callback(mqttHandle, TestWakeupCallback, NULL));
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_submit_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, g_wakeupCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_115: [If handle is NULL then mqtt_client_set_wakeup_callback shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_wakeup_callback_handle_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_wakeup_callback(NULL, TestWakeupCallback, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_116: [mqtt_client_set_wakeup_callback shall store onWakeup and context, a NULL onWakeup removes the callback.]*/
+TEST_FUNCTION(mqtt_client_set_wakeup_callback_NULL_removes_callback_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_enable_submit_queue(mqttHandle));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_wakeup_callback(mqttHandle, TestWakeupCallback, NULL));
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_set_wakeup_callback(mqttHandle, NULL, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_submit_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, g_wakeupCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_116: [mqtt_client_set_wakeup_callback shall store onWakeup and context, a NULL onWakeup removes the callback.]*/
+/*Tests_SRS_MQTT_CLIENT_07_158: [mqtt_client_set_wakeup_callback shall return only once no call of the previous callback by mqtt_client_submit_publish is still running.]*/
+TEST_FUNCTION(mqtt_client_set_wakeup_callback_replace_uses_new_context_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_enable_submit_queue(mqttHandle));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_wakeup_callback(mqttHandle, TestWakeupCallback, NULL));
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_set_wakeup_callback(mqttHandle, TestWakeupCallback, TEST_DUE_CONTEXT);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_submit_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, g_wakeupCount);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_DUE_CONTEXT, g_wakeupCtx);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_169: [If it is called from the wakeup callback of the same client then mqtt_client_set_wakeup_callback shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_wakeup_callback_from_wakeup_callback_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_enable_submit_queue(mqttHandle));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_wakeup_callback(mqttHandle, TestWakeupReplacingCallback, mqttHandle));
+    g_wakeupReplaceResult = 0;
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_submit_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_NOT_EQUAL(int, 0, g_wakeupReplaceResult);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_wakeup_callback(mqttHandle, TestWakeupCallback, NULL));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_submit_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    ASSERT_ARE_EQUAL(size_t, 2, g_wakeupCount);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_117: [If handle or waitInfo is NULL then mqtt_client_get_wait_info shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_get_wait_info_handle_NULL_fails)
+{
+    // arrange
+    MQTT_CLIENT_WAIT_INFO waitInfo;
+
+    // act
+    int result = mqtt_client_get_wait_info(NULL, &waitInfo);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_117: [If handle or waitInfo is NULL then mqtt_client_get_wait_info shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_get_wait_info_waitInfo_NULL_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_get_wait_info(mqttHandle, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_118: [Without a connection timeoutMs shall be the time left until a pending reconnect is due, or UINT32_MAX, and waitRead and waitWrite shall be false.]*/
+TEST_FUNCTION(mqtt_client_get_wait_info_not_connected_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_WAIT_INFO waitInfo;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_get_wait_info(mqttHandle, &waitInfo);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(uint32_t, UINT32_MAX, waitInfo.timeoutMs);
+    ASSERT_IS_FALSE(waitInfo.waitRead);
+    ASSERT_IS_FALSE(waitInfo.waitWrite);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_119: [With a connection timeoutMs shall be 0 if mqtt_client_dowork has work it can do right away, else the time left until the earliest keep alive ping, ping response timeout or in-flight retry, or UINT32_MAX if none is scheduled.]*/
+/*Tests_SRS_MQTT_CLIENT_07_121: [With a connection waitRead shall be true, and waitWrite shall be true until the connection is open.]*/
+TEST_FUNCTION(mqtt_client_get_wait_info_connected_returns_keep_alive_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    MQTT_CLIENT_WAIT_INFO waitInfo;
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    g_current_ms = 1000;
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+    g_current_ms = 6000;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_get_wait_info(mqttHandle, &waitInfo);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(uint32_t, TEST_KEEP_ALIVE_INTERVAL * 1000 - 5000, waitInfo.timeoutMs);
+    ASSERT_IS_TRUE(waitInfo.waitRead);
+    ASSERT_IS_FALSE(waitInfo.waitWrite);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_121: [With a connection waitRead shall be true, and waitWrite shall be true until the connection is open.]*/
+TEST_FUNCTION(mqtt_client_get_wait_info_opening_waits_for_write_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_WAIT_INFO waitInfo;
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_get_wait_info(mqttHandle, &waitInfo);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(uint32_t, UINT32_MAX, waitInfo.timeoutMs);
+    ASSERT_IS_TRUE(waitInfo.waitRead);
+    ASSERT_IS_TRUE(waitInfo.waitWrite);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_07_135: [While a close is in progress timeoutMs shall be the time left until the close times out, waitRead shall be true and waitWrite shall be false.] */
+TEST_FUNCTION(mqtt_client_get_wait_info_closing_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_WAIT_INFO waitInfo;
+    MQTT_CLIENT_HANDLE mqttHandle = setup_closing_client();
+    g_current_ms = 400;
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_get_wait_info(mqttHandle, &waitInfo);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(uint32_t, CLOSE_TIMEOUT_MS - 400, waitInfo.timeoutMs);
+    ASSERT_IS_TRUE(waitInfo.waitRead);
+    ASSERT_IS_FALSE(waitInfo.waitWrite);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+    g_closeComplete(g_onCloseCtx);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_120: [If any failure is encountered then mqtt_client_get_wait_info shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_get_wait_info_tickcounter_fails)
+{
+    // arrange
+    MQTT_CLIENT_WAIT_INFO waitInfo;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).SetReturn(MU_FAILURE);
+
+    // act
+    int result = mqtt_client_get_wait_info(mqttHandle, &waitInfo);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_122: [If handle is NULL then mqtt_client_set_recv_pool shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_recv_pool_handle_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_recv_pool(NULL, TEST_RECV_POOL_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_123: [mqtt_client_set_recv_pool shall pass pool to mqtt_codec_set_recv_pool of the codec of the client.]*/
+TEST_FUNCTION(mqtt_client_set_recv_pool_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_codec_set_recv_pool(TEST_MQTTCODEC_HANDLE, TEST_RECV_POOL_HANDLE));
+
+    // act
+    int result = mqtt_client_set_recv_pool(mqttHandle, TEST_RECV_POOL_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_124: [If mqtt_codec_set_recv_pool fails then mqtt_client_set_recv_pool shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_recv_pool_codec_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_codec_set_recv_pool(TEST_MQTTCODEC_HANDLE, TEST_RECV_POOL_HANDLE)).SetReturn(MU_FAILURE);
+
+    // act
+    int result = mqtt_client_set_recv_pool(mqttHandle, TEST_RECV_POOL_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_125: [If handle is NULL, or timerWheel is not NULL and onDue is NULL, then mqtt_client_set_timer_wheel shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_timer_wheel_handle_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_timer_wheel(NULL, TEST_TIMER_WHEEL_HANDLE, TestWakeupCallback, TEST_DUE_CONTEXT);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_125: [If handle is NULL, or timerWheel is not NULL and onDue is NULL, then mqtt_client_set_timer_wheel shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_timer_wheel_onDue_NULL_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_set_timer_wheel(mqttHandle, TEST_TIMER_WHEEL_HANDLE, NULL, TEST_DUE_CONTEXT);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_126: [mqtt_client_set_timer_wheel shall read the tick counter of the client once and from then on take the time from mqtt_timer_wheel_get_current_ms, offset to go on from the time of the tick counter.]*/
+/*Tests_SRS_MQTT_CLIENT_07_127: [mqtt_client_set_timer_wheel shall schedule a timer on timerWheel at the earliest keep alive ping, ping response timeout, in-flight retry or pending reconnect that calls onDue with context when it expires, and return 0.]*/
+TEST_FUNCTION(mqtt_client_set_timer_wheel_not_connected_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_current_ms(TEST_TIMER_WHEEL_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_current_ms(TEST_TIMER_WHEEL_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_cancel(TEST_TIMER_WHEEL_HANDLE, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_set_timer_wheel(mqttHandle, TEST_TIMER_WHEEL_HANDLE, TestWakeupCallback, TEST_DUE_CONTEXT);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_126: [mqtt_client_set_timer_wheel shall read the tick counter of the client once and from then on take the time from mqtt_timer_wheel_get_current_ms, offset to go on from the time of the tick counter.]*/
+/*Tests_SRS_MQTT_CLIENT_07_127: [mqtt_client_set_timer_wheel shall schedule a timer on timerWheel at the earliest keep alive ping, ping response timeout, in-flight retry or pending reconnect that calls onDue with context when it expires, and return 0.]*/
+TEST_FUNCTION(mqtt_client_set_timer_wheel_connected_schedules_keep_alive_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    g_current_ms = 1000;
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+    g_current_ms = 6000;
+    g_wheel_ms = 50000;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_current_ms(TEST_TIMER_WHEEL_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_current_ms(TEST_TIMER_WHEEL_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_schedule(TEST_TIMER_WHEEL_HANDLE, IGNORED_ARG, 50000 + TEST_KEEP_ALIVE_INTERVAL * 1000 - 5000, TestWakeupCallback, TEST_DUE_CONTEXT));
+
+    // act
+    int result = mqtt_client_set_timer_wheel(mqttHandle, TEST_TIMER_WHEEL_HANDLE, TestWakeupCallback, TEST_DUE_CONTEXT);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_128: [mqtt_client_set_timer_wheel shall cancel the timer the client has on the wheel set before, and a NULL timerWheel shall make the client read its tick counter again.]*/
+TEST_FUNCTION(mqtt_client_set_timer_wheel_NULL_cancels_timer_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_WAIT_INFO waitInfo;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_timer_wheel(mqttHandle, TEST_TIMER_WHEEL_HANDLE, TestWakeupCallback, TEST_DUE_CONTEXT));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_cancel(TEST_TIMER_WHEEL_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_set_timer_wheel(mqttHandle, NULL, NULL, NULL);
+    (void)mqtt_client_get_wait_info(mqttHandle, &waitInfo);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_129: [If any failure is encountered then mqtt_client_set_timer_wheel shall return a non-zero value and keep the clock and the timer the client had.]*/
+TEST_FUNCTION(mqtt_client_set_timer_wheel_tickcounter_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).SetReturn(MU_FAILURE);
+
+    // act
+    int result = mqtt_client_set_timer_wheel(mqttHandle, TEST_TIMER_WHEEL_HANDLE, TestWakeupCallback, TEST_DUE_CONTEXT);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_126: [mqtt_client_set_timer_wheel shall read the tick counter of the client once and from then on take the time from mqtt_timer_wheel_get_current_ms, offset to go on from the time of the tick counter.]*/
+/*Tests_SRS_MQTT_CLIENT_07_130: [With a timer wheel set mqtt_client_dowork shall move the timer of the client to the earliest keep alive ping, ping response timeout, in-flight retry, close timeout or pending reconnect left after its work, or cancel it if none is scheduled.]*/
+TEST_FUNCTION(mqtt_client_dowork_timer_wheel_moves_timer_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    g_current_ms = 1000;
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+    g_wheel_ms = 50000;
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_timer_wheel(mqttHandle, TEST_TIMER_WHEEL_HANDLE, TestWakeupCallback, TEST_DUE_CONTEXT));
+    g_wheel_ms = 55000;
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_current_ms(TEST_TIMER_WHEEL_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_get_current_ms(TEST_TIMER_WHEEL_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_timer_wheel_schedule(TEST_TIMER_WHEEL_HANDLE, IGNORED_ARG, 50000 + TEST_KEEP_ALIVE_INTERVAL * 1000, TestWakeupCallback, TEST_DUE_CONTEXT));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_089: [If msgHandle was created on an interned topic then mqtt_client_publish shall encode it with mqtt_codec_publish_encoded_topic and the bytes returned by mqtt_topic_get_encoded instead of mqtt_codec_publish.]*/
+TEST_FUNCTION(mqtt_client_publish_interned_topic_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE)).SetReturn(TEST_INTERNED_TOPIC);
+    STRICT_EXPECTED_CALL(mqtt_topic_get_encoded(TEST_INTERNED_TOPIC, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_encoded_topic(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, TEST_ENCODED_TOPIC, sizeof(TEST_ENCODED_TOPIC), IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_089: [If msgHandle was created on an interned topic then mqtt_client_publish shall encode it with mqtt_codec_publish_encoded_topic and the bytes returned by mqtt_topic_get_encoded instead of mqtt_codec_publish.]*/
+TEST_FUNCTION(mqtt_client_publish_interned_topic_codec_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE)).SetReturn(TEST_INTERNED_TOPIC);
+    STRICT_EXPECTED_CALL(mqtt_topic_get_encoded(TEST_INTERNED_TOPIC, IGNORED_ARG));
+    EXPECTED_CALL(mqtt_codec_publish_encoded_topic(DELIVER_AT_MOST_ONCE, true, true, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG))
+        .SetReturn(NULL);
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_090: [If msgHandle was created on an interned topic then mqtt_client_publish_iov shall encode the header with mqtt_codec_publish_header_encoded_topic instead of mqtt_codec_publish_header.]*/
+TEST_FUNCTION(mqtt_client_publish_iov_interned_topic_succeeds)
+{
+    // arrange
+    const uint8_t* PAYLOAD = (const uint8_t*)"Message to send";
+    MQTT_PAYLOAD_SEGMENT segments[] = { { PAYLOAD, 15 } };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE)).SetReturn(TEST_INTERNED_TOPIC);
+    STRICT_EXPECTED_CALL(mqtt_topic_get_encoded(TEST_INTERNED_TOPIC, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_header_encoded_topic(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, TEST_ENCODED_TOPIC, sizeof(TEST_ENCODED_TOPIC), 15, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, 4, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_ARG, PAYLOAD, 15, IGNORED_ARG, IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_publish_iov(mqttHandle, TEST_MESSAGE_HANDLE, segments, 1, TestPayloadReleasedCallback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    g_sendComplete(g_onSendCtx, IO_SEND_OK);
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_dowork_does_nothing_if_disconnected_1)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    umock_c_reset_all_calls();
+    setup_mqtt_client_connect_mocks(&mqttOptions);
+
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+
+    mqtt_client_disconnect(mqttHandle, NULL, NULL);
+
+    g_sendComplete(g_onSendCtx, IO_SEND_OK);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(xio_close(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_18_001: [ If the client is disconnected, mqtt_client_dowork shall do nothing. ] */
+TEST_FUNCTION(mqtt_client_dowork_does_nothing_if_disconnected_2)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(xio_dowork(IGNORED_ARG));
+
+    // act
+    int result = mqtt_client_disconnect(mqttHandle, NULL, NULL);
+    mqtt_client_dowork(mqttHandle);
+
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_07_132: [When the client closes an open connection it shall call xio_close and return without waiting for the transport to finish closing.] */
+TEST_FUNCTION(mqtt_client_dowork_close_does_not_wait_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    make_connack(mqttHandle, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    (void)mqtt_client_disconnect(mqttHandle, on_mqtt_disconnected_callback, NULL);
+    g_sendComplete(g_onSendCtx, IO_SEND_OK);
+    g_closeAsync = true;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(xio_close(TEST_IO_HANDLE, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_IS_NOT_NULL(g_closeComplete);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+    g_closeComplete(g_onCloseCtx);
+}
+
+/* Tests_SRS_MQTT_CLIENT_07_133: [While a close is in progress mqtt_client_dowork shall call xio_dowork on the XIO_HANDLE being closed, and shall not reconnect until the close completes.] */
+/* Tests_SRS_MQTT_CLIENT_07_134: [The client shall call the ON_MQTT_DISCONNECTED_CALLBACK once when the transport reports the close complete, or once CLOSE_TIMEOUT_MS have passed since the close started, whichever comes first.] */
+TEST_FUNCTION(mqtt_client_dowork_close_completes_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = setup_closing_client();
+
+    STRICT_EXPECTED_CALL(xio_dowork(TEST_IO_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(on_mqtt_disconnected_callback(NULL));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+    g_closeComplete(g_onCloseCtx);
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_07_134: [The client shall call the ON_MQTT_DISCONNECTED_CALLBACK once when the transport reports the close complete, or once CLOSE_TIMEOUT_MS have passed since the close started, whichever comes first.] */
+TEST_FUNCTION(mqtt_client_dowork_close_times_out_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = setup_closing_client();
+    g_current_ms = CLOSE_TIMEOUT_MS;
+
+    STRICT_EXPECTED_CALL(xio_dowork(TEST_IO_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(on_mqtt_disconnected_callback(NULL));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+    g_closeComplete(g_onCloseCtx);
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/* Tests_SRS_MQTT_CLIENT_07_156: [If the transport has not reported a close yet, mqtt_client_deinit shall not call the ON_MQTT_DISCONNECTED_CALLBACK and shall leave the client to be freed by the close callback.] */
+TEST_FUNCTION(mqtt_client_deinit_close_pending_frees_on_close_complete_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = setup_closing_client();
+
+    STRICT_EXPECTED_CALL(tickcounter_destroy(TEST_COUNTER_HANDLE));
+    EXPECTED_CALL(mqtt_codec_destroy(IGNORED_ARG));
+
+    // act
+    mqtt_client_deinit(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(gballoc_free(mqttHandle));
+
+    g_closeComplete(g_onCloseCtx);
+
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_07_156: [If the transport has not reported a close yet, mqtt_client_deinit shall not call the ON_MQTT_DISCONNECTED_CALLBACK and shall leave the client to be freed by the close callback.] */
+TEST_FUNCTION(mqtt_client_deinit_close_timed_out_frees_on_close_complete_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = setup_closing_client();
+    g_current_ms = CLOSE_TIMEOUT_MS;
+    mqtt_client_dowork(mqttHandle);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_destroy(TEST_COUNTER_HANDLE));
+    EXPECTED_CALL(mqtt_codec_destroy(IGNORED_ARG));
+
+    // act
+    mqtt_client_deinit(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(gballoc_free(mqttHandle));
+
+    g_closeComplete(g_onCloseCtx);
+
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CLIENT_07_157: [If a close is still in progress mqtt_client_connect shall return a non-zero value without calling xio_open or the ON_MQTT_DISCONNECTED_CALLBACK.] */
+TEST_FUNCTION(mqtt_client_connect_close_pending_fails)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = setup_closing_client();
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+
+    // act
+    int result = mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(on_mqtt_disconnected_callback(NULL));
+    g_closeComplete(g_onCloseCtx);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    mqtt_client_deinit(mqttHandle);
+}
+
+
+/*Test_SRS_MQTT_CLIENT_07_027: [The callbackCtx parameter shall be an unmodified pointer that was passed to the mqtt_client_init function.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_context_NULL_fails)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+
+
+    CONNECT_ACK connack = { 0 };
+    connack.isSessionPresent = true;
+    connack.returnCode = CONNECTION_ACCEPTED;
+    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
+    testData.msgInfo = &connack;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    g_packetView(NULL, CONNACK_TYPE, 0, CONNACK_RESP, length);
+
+    // assert
+    ASSERT_IS_FALSE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_context_and_handle_NULL_fails)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+
+
+    CONNECT_ACK connack = { 0 };
+    connack.isSessionPresent = true;
+    connack.returnCode = CONNECTION_ACCEPTED;
+    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
+    testData.msgInfo = &connack;
+
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    g_packetView(NULL, PINGRESP_TYPE, 0, NULL, 0);
+
+    // assert
+    ASSERT_IS_FALSE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_027: [The callbackCtx parameter shall be an unmodified pointer that was passed to the mqtt_client_init function.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_BUFFER_HANDLE_NULL_fails)
+{
+    // arrange
+    TEST_COMPLETE_DATA_INSTANCE testData;
+
+    CONNECT_ACK connack = { 0 };
+    connack.isSessionPresent = true;
+    connack.returnCode = CONNECTION_ACCEPTED;
+    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
+    testData.msgInfo = &connack;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, NULL, 0);
+
+    // assert
+    ASSERT_IS_FALSE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_028: [If the actionResult parameter is of type CONNECT_ACK then the msgInfo value shall be a CONNECT_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_CONNACK_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+
+    CONNECT_ACK connack = { 0 };
+    connack.isSessionPresent = true;
+    connack.returnCode = CONNECTION_ACCEPTED;
+    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
+    testData.msgInfo = &connack;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+    // act
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_028: [If the actionResult parameter is of type CONNECT_ACK then the msgInfo value shall be a CONNECT_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_CONNACK_auth_reject_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] ={ 0x00, 0x05 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+
+    CONNECT_ACK connack = { 0 };
+    connack.isSessionPresent = false;
+    connack.returnCode = CONN_REFUSED_NOT_AUTHORIZED;
+    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
+    testData.msgInfo = &connack;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+    // act
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_EXACTLY_ONCE_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+
+    uint8_t flag = 0x0d;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    setup_publish_callback_mocks(PUBLISH_RESP, length, DELIVER_EXACTLY_ONCE);
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_EXACTLY_ONCE_fail)
+{
+    // arrange
+    int negativeTestsInitResult = umock_c_negative_tests_init();
+    ASSERT_ARE_EQUAL(int, 0, negativeTestsInitResult);
+
+    unsigned char PUBLISH_RESP[] ={ 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+
+    uint8_t flag = 0x0d;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+    setup_publish_callback_mocks(PUBLISH_RESP, length, DELIVER_EXACTLY_ONCE);
+
+    umock_c_negative_tests_snapshot();
+
+    // act
+    size_t calls_cannot_fail[] = { 4, 5, 8, 9 };
+    size_t count = umock_c_negative_tests_call_count();
+    for (size_t index = 0; index < count; index++)
+    {
+        if (should_skip_index(index, calls_cannot_fail, sizeof(calls_cannot_fail)/sizeof(calls_cannot_fail[0])) != 0)
+        {
+            continue;
+        }
+
+        umock_c_negative_tests_reset();
+        umock_c_negative_tests_fail_call(index);
+
+        g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+        if (index == 0 || index == 1 || index == 2 || index == 3)
+            ASSERT_IS_TRUE(g_errorCallbackInvoked, "IoTHubClient_LL_Create failure in test %zu/%zu", index, count);
+    }
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+    umock_c_negative_tests_deinit();
+}
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+/*Tests_SRS_MQTT_CLIENT_07_131: [The client shall encode the PINGREQ, DISCONNECT, PUBACK, PUBREC, PUBREL and PUBCOMP packets it sends into its own stack memory with the mqtt_codec_encode functions instead of allocating a buffer for each.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_LEAST_ONCE_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+
+    uint8_t flag = 0x0a;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(TEST_PACKET_ID, IGNORED_ARG, 10, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_puback(TEST_PACKET_ID, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_LEAST_ONCE_no_body_succeeds)
+{
+    // arrange
+    // Packet contains a topic name, PacketID, but no body.  This is legal mqtt for AT_LEAST_ONCE PUBLISH.
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+
+    uint8_t flag = 0x0a;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(TEST_PACKET_ID, IGNORED_ARG, 10, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, 0));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_puback(TEST_PACKET_ID, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_MOST_ONCE_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_VALUE[] = { 0x00, 0x04, 0x6d, 0x73, 0x67, 0x41, 0x54, 0x68, 0x69, 0x73, 0x20, 0x69, 0x73, 0x20, 0x74, 0x68, 0x65, 0x20, 0x61, 0x70, 0x70, 0x20, 0x6d, 0x73, 0x67, 0x20, 0x41, 0x2e };
+    size_t length = sizeof(PUBLISH_VALUE) / sizeof(PUBLISH_VALUE[0]);
+
+    uint8_t flag = 0x00;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_VALUE, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(0, IGNORED_ARG, 4, DELIVER_AT_MOST_ONCE, IGNORED_ARG, 22));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_VALUE, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_MOST_ONCE_with_two_zeros_body_data_succeeds)
+{
+    // arrange
+    // This is legal publish.  The 0x00 0x00 would be illegal PacketID if we were using PacketID's, which AT_MOST_ONCE does not.
+    unsigned char PUBLISH_VALUE[] = { 0x00, 0x04, 0x6d, 0x73, 0x67, 0x41, 0x00, 0x00 };
+    size_t length = sizeof(PUBLISH_VALUE) / sizeof(PUBLISH_VALUE[0]);
+
+    uint8_t flag = 0x00;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_VALUE, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(0, IGNORED_ARG, 4, DELIVER_AT_MOST_ONCE, IGNORED_ARG, 2));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_VALUE, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_MOST_ONCE_no_body_succeeds)
+{
+    // arrange
+    // The topic name is the only data sent; no follow on packet ID or body.  This is legaly.
+    unsigned char PUBLISH_VALUE[] = { 0x00, 0x04, 0x6d, 0x73, 0x67, 0x41 };
+    size_t length = sizeof(PUBLISH_VALUE) / sizeof(PUBLISH_VALUE[0]);
+
+    uint8_t flag = 0x00;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_VALUE, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(0, IGNORED_ARG, 4, DELIVER_AT_MOST_ONCE, IGNORED_ARG, 0));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_VALUE, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_ACK_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    PUBLISH_ACK puback = { 0 };
+    puback.packetId = 0x1234;
+
+    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_ACK;
+    testData.msgInfo = &puback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+    // act
+    g_packetView(mqttHandle, PUBACK_TYPE, 0, PUBLISH_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RECEIVE_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    PUBLISH_ACK puback = { 0 };
+    puback.packetId = 0x1234;
+
+    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_RECV;
+    testData.msgInfo = &puback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(mqtt_codec_encode_pubrel(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+
+    // act
+    g_packetView(mqttHandle, PUBREC_TYPE, 0, PUBLISH_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RECEIVE_fails)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    PUBLISH_ACK puback ={ 0 };
+    puback.packetId = 0x1234;
+
+    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_RECV;
+    testData.msgInfo = &puback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(mqtt_codec_encode_pubrel(IGNORED_ARG, IGNORED_ARG));
+
+    // act
+    g_mqtt_codec_publish_func_fail = true;
+    g_packetView(mqttHandle, PUBREC_TYPE, 0, PUBLISH_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RELEASE_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    PUBLISH_ACK puback = { 0 };
+    puback.packetId = 0x1234;
+
+    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_REL;
+    testData.msgInfo = &puback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(mqtt_codec_encode_pubcomp(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+
+    // act
+    g_packetView(mqttHandle, PUBREL_TYPE, 0, PUBLISH_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RELEASE_fails)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] ={ 0x12, 0x34 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    PUBLISH_ACK puback ={ 0 };
+    puback.packetId = 0x1234;
+
+    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_REL;
+    testData.msgInfo = &puback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    make_connack(mqttHandle, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(mqtt_codec_encode_pubcomp(IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(xio_close(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+
+    // act
+    g_mqtt_codec_publish_func_fail = true;
+    g_packetView(mqttHandle, PUBREL_TYPE, 0, PUBLISH_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_COMPLETE_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    PUBLISH_ACK puback = { 0 };
+    puback.packetId = 0x1234;
+
+    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_COMP;
+    testData.msgInfo = &puback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+    // act
+    g_packetView(mqttHandle, PUBCOMP_TYPE, 0, PUBLISH_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_too_long_topic_name_length_fails)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x01}; // Topic length is 1, but there is not a byte following
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+
+    uint8_t flag = 0x0d;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_invalid_topic_name_length_fails)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00 }; // Topic length needs to contain at least two bytes
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+
+    uint8_t flag = 0x0d;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_too_short_packetID_fails)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x01, 0x0A, 0x00 }; // PacketId needed to be 2 bytes, but only 1 (after 0x0A) is supplied.
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+
+    uint8_t flag = 0x0d;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_packetId_is_zero_fails)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x01, 0x0A, 0x00, 0x00 }; // packetId has enough bytes, but it can't be 0
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+
+    uint8_t flag = 0x0d;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+    // act
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+
+/*Test_SRS_MQTT_CLIENT_07_031: [If the actionResult parameter is of type UNSUBACK_TYPE then the msgInfo value shall be a UNSUBSCRIBE_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_SUBACK_succeeds)
+{
+    // arrange
+    const size_t PACKET_RETCODE_COUNT = 4;
+    unsigned char SUBSCRIBE_ACK_RESP[] = { 0x12, 0x34, 0x00, 0x02, 0x01, 0x80 };
+    size_t length = sizeof(SUBSCRIBE_ACK_RESP) / sizeof(SUBSCRIBE_ACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    SUBSCRIBE_ACK suback = { 0 };
+    suback.packetId = 0x1234;
+    suback.qosReturn = (QOS_VALUE*)malloc(sizeof(QOS_VALUE)*PACKET_RETCODE_COUNT);
+    suback.qosCount = PACKET_RETCODE_COUNT;
+    suback.qosReturn[0] = DELIVER_AT_MOST_ONCE;
+    suback.qosReturn[1] = DELIVER_EXACTLY_ONCE;
+    suback.qosReturn[2] = DELIVER_AT_LEAST_ONCE;
+    suback.qosReturn[3] = DELIVER_FAILURE;
+
+    testData.actionResult = MQTT_CLIENT_ON_SUBSCRIBE_ACK;
+    testData.msgInfo = &suback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, SUBACK_TYPE, 0, SUBSCRIBE_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    free(suback.qosReturn);
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Test_SRS_MQTT_CLIENT_07_031: [If the actionResult parameter is of type UNSUBACK_TYPE then the msgInfo value shall be a UNSUBSCRIBE_ACK structure.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_UNSUBACK_succeeds)
+{
+    // arrange
+    unsigned char UNSUBSCRIBE_ACK_RESP[] = { 0x12, 0x34 };
+    size_t length = sizeof(UNSUBSCRIBE_ACK_RESP) / sizeof(UNSUBSCRIBE_ACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    UNSUBSCRIBE_ACK unsuback = { 0 };
+    unsuback.packetId = 0x1234;
+
+    testData.actionResult = MQTT_CLIENT_ON_UNSUBSCRIBE_ACK;
+    testData.msgInfo = &unsuback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+
+    // act
+    g_packetView(mqttHandle, UNSUBACK_TYPE, 0, UNSUBSCRIBE_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_091: [On an MQTT 5 connection the reason codes and properties of CONNACK, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBACK and UNSUBACK shall be read into the acknowledgement passed to the ON_MQTT_OPERATION_CALLBACK, with the CONNACK reason code mapped to the closest CONNECT_RETURN_CODE, and a malformed property block shall raise MQTT_CLIENT_COMMUNICATION_ERROR.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_CONNACK_v5_properties_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x0b, 0x21, 0x00, 0x02, 0x22, 0x00, 0x05, 0x27, 0x00, 0x00, 0x01, 0x00 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+
+    CONNECT_ACK connack = { 0 };
+    connack.isSessionPresent = false;
+    connack.returnCode = CONNECTION_ACCEPTED;
+    connack.receiveMaximum = 2;
+    connack.maximumPacketSize = 256;
+    connack.topicAliasMaximum = 5;
+    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
+    testData.msgInfo = &connack;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_V5;
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    // act
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_IS_FALSE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_091: [On an MQTT 5 connection the reason codes and properties of CONNACK, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBACK and UNSUBACK shall be read into the acknowledgement passed to the ON_MQTT_OPERATION_CALLBACK, with the CONNACK reason code mapped to the closest CONNECT_RETURN_CODE, and a malformed property block shall raise MQTT_CLIENT_COMMUNICATION_ERROR.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_CONNACK_v5_reason_code_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x00, 0x86, 0x00 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+
+    CONNECT_ACK connack = { 0 };
+    connack.isSessionPresent = false;
+    connack.returnCode = CONN_REFUSED_BAD_USERNAME_PASSWORD;
+    connack.reasonCode = 0x86;
+    connack.receiveMaximum = UINT16_MAX;
+    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
+    testData.msgInfo = &connack;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_V5;
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    // act
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_091: [On an MQTT 5 connection the reason codes and properties of CONNACK, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBACK and UNSUBACK shall be read into the acknowledgement passed to the ON_MQTT_OPERATION_CALLBACK, with the CONNACK reason code mapped to the closest CONNECT_RETURN_CODE, and a malformed property block shall raise MQTT_CLIENT_COMMUNICATION_ERROR.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_CONNACK_v5_invalid_properties_fails)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x03, 0x21, 0x00, 0x00 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_V5;
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    // act
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_091: [On an MQTT 5 connection the reason codes and properties of CONNACK, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBACK and UNSUBACK shall be read into the acknowledgement passed to the ON_MQTT_OPERATION_CALLBACK, with the CONNACK reason code mapped to the closest CONNECT_RETURN_CODE, and a malformed property block shall raise MQTT_CLIENT_COMMUNICATION_ERROR.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_ACK_v5_reason_code_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34, 0x10, 0x00 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x00 };
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    PUBLISH_ACK puback = { 0 };
+    puback.packetId = 0x1234;
+    puback.reasonCode = 0x10;
+
+    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_ACK;
+    testData.msgInfo = &puback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
+
+    // act
+    g_packetView(mqttHandle, PUBACK_TYPE, 0, PUBLISH_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_091: [On an MQTT 5 connection the reason codes and properties of CONNACK, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBACK and UNSUBACK shall be read into the acknowledgement passed to the ON_MQTT_OPERATION_CALLBACK, with the CONNACK reason code mapped to the closest CONNECT_RETURN_CODE, and a malformed property block shall raise MQTT_CLIENT_COMMUNICATION_ERROR.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_SUBACK_v5_succeeds)
+{
+    // arrange
+    unsigned char SUBSCRIBE_ACK_RESP[] = { 0x12, 0x34, 0x00, 0x01, 0x80, 0x97 };
+    size_t length = sizeof(SUBSCRIBE_ACK_RESP) / sizeof(SUBSCRIBE_ACK_RESP[0]);
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x00 };
+    QOS_VALUE qosReturn[] = { DELIVER_AT_LEAST_ONCE, DELIVER_FAILURE, DELIVER_FAILURE };
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SUBSCRIBE_ACK suback = { 0 };
+    suback.packetId = 0x1234;
+    suback.qosReturn = qosReturn;
+    suback.qosCount = sizeof(qosReturn) / sizeof(qosReturn[0]);
+
+    testData.actionResult = MQTT_CLIENT_ON_SUBSCRIBE_ACK;
+    testData.msgInfo = &suback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    g_packetView(mqttHandle, SUBACK_TYPE, 0, SUBSCRIBE_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_IS_FALSE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_091: [On an MQTT 5 connection the reason codes and properties of CONNACK, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBACK and UNSUBACK shall be read into the acknowledgement passed to the ON_MQTT_OPERATION_CALLBACK, with the CONNACK reason code mapped to the closest CONNECT_RETURN_CODE, and a malformed property block shall raise MQTT_CLIENT_COMMUNICATION_ERROR.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_UNSUBACK_v5_succeeds)
+{
+    // arrange
+    unsigned char UNSUBSCRIBE_ACK_RESP[] = { 0x12, 0x34, 0x00, 0x00, 0x11 };
+    size_t length = sizeof(UNSUBSCRIBE_ACK_RESP) / sizeof(UNSUBSCRIBE_ACK_RESP[0]);
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x00 };
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    UNSUBSCRIBE_ACK unsuback = { 0 };
+    unsuback.packetId = 0x1234;
+    unsuback.reasonCodeCount = 2;
+
+    testData.actionResult = MQTT_CLIENT_ON_UNSUBSCRIBE_ACK;
+    testData.msgInfo = &unsuback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
+
+    // act
+    g_packetView(mqttHandle, UNSUBACK_TYPE, 0, UNSUBSCRIBE_ACK_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_098: [When the server sends DISCONNECT the client shall consider itself disconnected and call the ON_MQTT_ERROR_CALLBACK with MQTT_CLIENT_CONNECTION_ERROR.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_DISCONNECT_v5_succeeds)
+{
+    // arrange
+    unsigned char DISCONNECT_RESP[] = { 0x8e };
+    size_t length = sizeof(DISCONNECT_RESP) / sizeof(DISCONNECT_RESP[0]);
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x00 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
+
+    // act
+    g_packetView(mqttHandle, DISCONNECT_TYPE, 0, DISCONNECT_RESP, length);
+
+    // assert
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_092: [When mqttOptions->protocolVersion is MQTT_PROTOCOL_V5, mqtt_client_publish, mqtt_client_publish_iov, mqtt_client_subscribe and mqtt_client_unsubscribe shall encode with mqtt_codec_publish_v5, mqtt_codec_publish_header_v5, mqtt_codec_subscribe_v5 and mqtt_codec_unsubscribe_v5.]*/
+TEST_FUNCTION(mqtt_client_publish_v5_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x00 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, TEST_TOPIC_NAME, 10, 0, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_093: [While the server's topic alias maximum allows, a message on an interned topic shall get the next topic alias the first time it is sent on the connection, sent with its topic name, and be sent with the alias alone afterwards.]*/
+TEST_FUNCTION(mqtt_client_publish_v5_new_topic_alias_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x03, 0x22, 0x00, 0x05 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE)).SetReturn(TEST_INTERNED_TOPIC);
+    STRICT_EXPECTED_CALL(mqtt_topic_get_alias(TEST_INTERNED_TOPIC)).SetReturn(0);
+    STRICT_EXPECTED_CALL(mqtt_topic_get_name(TEST_INTERNED_TOPIC, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, TEST_TOPIC_NAME, 10, 1, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqtt_topic_get_alias(TEST_INTERNED_TOPIC)).SetReturn(0);
+    STRICT_EXPECTED_CALL(mqtt_topic_set_alias(TEST_INTERNED_TOPIC, 1));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_093: [While the server's topic alias maximum allows, a message on an interned topic shall get the next topic alias the first time it is sent on the connection, sent with its topic name, and be sent with the alias alone afterwards.]*/
+TEST_FUNCTION(mqtt_client_publish_v5_existing_topic_alias_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x03, 0x22, 0x00, 0x05 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE)).SetReturn(TEST_INTERNED_TOPIC);
+    STRICT_EXPECTED_CALL(mqtt_topic_get_alias(TEST_INTERNED_TOPIC)).SetReturn(1);
+    STRICT_EXPECTED_CALL(mqtt_topic_get_name(TEST_INTERNED_TOPIC, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, NULL, 0, 1, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqtt_topic_get_alias(TEST_INTERNED_TOPIC)).SetReturn(1);
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
 
     // assert
-    ASSERT_IS_FALSE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_027: [The callbackCtx parameter shall be an unmodified pointer that was passed to the mqtt_client_init function.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_BUFFER_HANDLE_NULL_fails)
+/*Tests_SRS_MQTT_CLIENT_07_095: [If the server set a maximum packet size and the PUBLISH packet is larger then mqtt_client_publish and mqtt_client_publish_iov shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_publish_v5_over_maximum_packet_size_fails)
 {
     // arrange
-    TEST_COMPLETE_DATA_INSTANCE testData;
-
-    CONNECT_ACK connack = { 0 };
-    connack.isSessionPresent = true;
-    connack.returnCode = CONNECTION_ACCEPTED;
-    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
-    testData.msgInfo = &connack;
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x05, 0x27, 0x00, 0x00, 0x01, 0x00 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
 
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
-    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, TEST_TOPIC_NAME, 10, 0, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(257);
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
 
     // act
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, NULL);
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
 
     // assert
-    ASSERT_IS_FALSE(g_operationCallbackInvoked);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_028: [If the actionResult parameter is of type CONNECT_ACK then the msgInfo value shall be a CONNECT_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_CONNACK_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_094: [The in-flight window shall be limited to the receive maximum of the server when it is smaller than maxInflight.]*/
+TEST_FUNCTION(mqtt_client_publish_v5_receive_maximum_fails)
 {
     // arrange
-    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
-    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-
-    CONNECT_ACK connack = { 0 };
-    connack.isSessionPresent = true;
-    connack.returnCode = CONNECTION_ACCEPTED;
-    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
-    testData.msgInfo = &connack;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x03, 0x21, 0x00, 0x01 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 4, 0));
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getInternedTopic(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
 
     // act
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
 
     // assert
-    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_028: [If the actionResult parameter is of type CONNECT_ACK then the msgInfo value shall be a CONNECT_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_CONNACK_auth_reject_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_092: [When mqttOptions->protocolVersion is MQTT_PROTOCOL_V5, mqtt_client_publish, mqtt_client_publish_iov, mqtt_client_subscribe and mqtt_client_unsubscribe shall encode with mqtt_codec_publish_v5, mqtt_codec_publish_header_v5, mqtt_codec_subscribe_v5 and mqtt_codec_unsubscribe_v5.]*/
+TEST_FUNCTION(mqtt_client_subscribe_v5_succeeds)
 {
     // arrange
-    unsigned char CONNACK_RESP[] ={ 0x00, 0x05 };
-    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-
-    CONNECT_ACK connack = { 0 };
-    connack.isSessionPresent = false;
-    connack.returnCode = CONN_REFUSED_NOT_AUTHORIZED;
-    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
-    testData.msgInfo = &connack;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
-    umock_c_reset_all_calls();
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x00 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
 
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(mqtt_codec_subscribe_v5(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
 
     // act
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
+    int result = mqtt_client_subscribe(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2);
 
     // assert
-    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_EXACTLY_ONCE_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_092: [When mqttOptions->protocolVersion is MQTT_PROTOCOL_V5, mqtt_client_publish, mqtt_client_publish_iov, mqtt_client_subscribe and mqtt_client_unsubscribe shall encode with mqtt_codec_publish_v5, mqtt_codec_publish_header_v5, mqtt_codec_subscribe_v5 and mqtt_codec_unsubscribe_v5.]*/
+TEST_FUNCTION(mqtt_client_unsubscribe_v5_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
-        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
-    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
-
-    uint8_t flag = 0x0d;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
-    umock_c_reset_all_calls();
+    unsigned char CONNACK_RESP[] = { 0x00, 0x00, 0x00 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions, CONNACK_RESP, sizeof(CONNACK_RESP));
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-    setup_publish_callback_mocks(PUBLISH_RESP, length, DELIVER_EXACTLY_ONCE);
+    STRICT_EXPECTED_CALL(mqtt_codec_unsubscribe_v5(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, NULL));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
 
     // act
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    int result = mqtt_client_unsubscribe(mqttHandle, TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2);
 
     // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_EXACTLY_ONCE_fail)
+/*Tests_SRS_MQTT_CLIENT_07_097: [mqtt_client_set_topic_handler shall store the handler of a $share/<group>/<filter> shared subscription under <filter>.]*/
+TEST_FUNCTION(mqtt_client_set_topic_handler_shared_subscription_succeed)
 {
     // arrange
-    int negativeTestsInitResult = umock_c_negative_tests_init();
-    ASSERT_ARE_EQUAL(int, 0, negativeTestsInitResult);
-
-    unsigned char PUBLISH_RESP[] ={ 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
-        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
-    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
-
-    uint8_t flag = 0x0d;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    MQTT_CLIENT_ACK_OPTION ackOption = MQTT_CLIENT_ACK_SYNC;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-
-    setup_publish_callback_mocks(PUBLISH_RESP, length, DELIVER_EXACTLY_ONCE);
-
-    umock_c_negative_tests_snapshot();
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_create(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_topic_trie_insert(TEST_TOPIC_TRIE_HANDLE, "devices/+/telemetry", IGNORED_ARG));
 
     // act
-    size_t calls_cannot_fail[] = { 0, 1, 7, 8, 11, 12, 13 };
-    size_t count = umock_c_negative_tests_call_count();
-    for (size_t index = 0; index < count; index++)
-    {
-        if (should_skip_index(index, calls_cannot_fail, sizeof(calls_cannot_fail)/sizeof(calls_cannot_fail[0])) != 0)
-        {
-            continue;
-        }
-
-        umock_c_negative_tests_reset();
-        umock_c_negative_tests_fail_call(index);
-
-        g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    int result = mqtt_client_set_topic_handler(mqttHandle, "$share/consumers/devices/+/telemetry", TestTopicCallback, &ackOption);
 
-        if (index == 2 || index == 3 || index == 4 || index == 5 || index == 6)
-            ASSERT_IS_TRUE(g_errorCallbackInvoked, "IoTHubClient_LL_Create failure in test %zu/%zu", index, count);
-    }
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
-    umock_c_negative_tests_deinit();
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_LEAST_ONCE_succeeds)
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PINGRESP_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
-        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
-    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
-
-    uint8_t flag = 0x0a;
+    unsigned char PINGRESP_ACK_RESP[] = { 0x0d, 0x00 };
+    size_t length = sizeof(PINGRESP_ACK_RESP) / sizeof(PINGRESP_ACK_RESP[0]);
 
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
-    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, IGNORED_ARG, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, TEST_APP_PAYLOAD.length));
-    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
-    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
-    STRICT_EXPECTED_CALL(mqtt_codec_publishAck(TEST_PACKET_ID));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
-    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
-    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 
     // act
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    g_packetView(mqttHandle, PINGRESP_TYPE, 0, PINGRESP_ACK_RESP, length);
 
     // assert
-    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_IS_FALSE(g_errorCallbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_LEAST_ONCE_no_body_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_136: [If handle is NULL then mqtt_client_set_trace_ring shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_trace_ring_handle_NULL_fails)
 {
     // arrange
-    // Packet contains a topic name, PacketID, but no body.  This is legal mqtt for AT_LEAST_ONCE PUBLISH.
-    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34 };
-    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
-
-    uint8_t flag = 0x0a;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
-    umock_c_reset_all_calls();
-
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
-    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, IGNORED_ARG, DELIVER_AT_LEAST_ONCE, IGNORED_ARG, 0));
-    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
-    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
-    STRICT_EXPECTED_CALL(mqtt_codec_publishAck(TEST_PACKET_ID));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
-    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
-    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 
     // act
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    int result = mqtt_client_set_trace_ring(NULL, TEST_TRACE_RING_HANDLE);
 
     // assert
-    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-
-    // cleanup
-    mqtt_client_deinit(mqttHandle);
 }
 
-
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_MOST_ONCE_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_139: [mqtt_client_set_trace_ring shall make the client record packets into traceRing, or stop recording if traceRing is NULL, and return 0.]*/
+TEST_FUNCTION(mqtt_client_set_trace_ring_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_VALUE[] = { 0x00, 0x04, 0x6d, 0x73, 0x67, 0x41, 0x54, 0x68, 0x69, 0x73, 0x20, 0x69, 0x73, 0x20, 0x74, 0x68, 0x65, 0x20, 0x61, 0x70, 0x70, 0x20, 0x6d, 0x73, 0x67, 0x20, 0x41, 0x2e };
-    size_t length = sizeof(PUBLISH_VALUE) / sizeof(PUBLISH_VALUE[0]);
-
-    uint8_t flag = 0x00;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_VALUE, TestErrorCallback, NULL);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_VALUE);
-    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(0, IGNORED_ARG, DELIVER_AT_MOST_ONCE, IGNORED_ARG, 22));
-    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, false));
-    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
-    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
-    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
-
     // act
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    int result = mqtt_client_set_trace_ring(mqttHandle, TEST_TRACE_RING_HANDLE);
 
     // assert
-    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_MOST_ONCE_with_two_zeros_body_data_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_139: [mqtt_client_set_trace_ring shall make the client record packets into traceRing, or stop recording if traceRing is NULL, and return 0.]*/
+TEST_FUNCTION(mqtt_client_set_trace_ring_NULL_stops_recording_succeeds)
 {
     // arrange
-    // This is legal publish.  The 0x00 0x00 would be illegal PacketID if we were using PacketID's, which AT_MOST_ONCE does not.
-    unsigned char PUBLISH_VALUE[] = { 0x00, 0x04, 0x6d, 0x73, 0x67, 0x41, 0x00, 0x00 };
-    size_t length = sizeof(PUBLISH_VALUE) / sizeof(PUBLISH_VALUE[0]);
-
-    uint8_t flag = 0x00;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_VALUE, TestErrorCallback, NULL);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_trace_ring(mqttHandle, TEST_TRACE_RING_HANDLE);
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_VALUE);
-    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(0, IGNORED_ARG, DELIVER_AT_MOST_ONCE, IGNORED_ARG, 2));
-    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, false));
-    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
-    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
-    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
-
     // act
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    int result = mqtt_client_set_trace_ring(mqttHandle, NULL);
+    g_packetView(mqttHandle, PINGRESP_TYPE, 0, NULL, 0);
 
     // assert
-    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_MOST_ONCE_no_body_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_137: [Once a trace ring is set the client shall record every control packet it sends or queues with its tick counter time, type, flags, packet id, topic hash and length.]*/
+TEST_FUNCTION(mqtt_client_set_trace_ring_records_sent_packet_succeeds)
 {
     // arrange
-    // The topic name is the only data sent; no follow on packet ID or body.  This is legaly.
-    unsigned char PUBLISH_VALUE[] = { 0x00, 0x04, 0x6d, 0x73, 0x67, 0x41 };
-    size_t length = sizeof(PUBLISH_VALUE) / sizeof(PUBLISH_VALUE[0]);
-
-    uint8_t flag = 0x00;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_VALUE, TestErrorCallback, NULL);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_trace_ring(mqttHandle, TEST_TRACE_RING_HANDLE);
+    g_current_ms = 42;
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_VALUE);
-    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(0, IGNORED_ARG, DELIVER_AT_MOST_ONCE, IGNORED_ARG, 0));
-    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, false));
-    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, false));
-    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
-    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_puback(TEST_PACKET_ID, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqtt_trace_ring_record(TEST_TRACE_RING_HANDLE, IGNORED_ARG));
 
     // act
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    int result = mqtt_client_send_message_response(mqttHandle, TEST_PACKET_ID, DELIVER_AT_LEAST_ONCE);
 
     // assert
-    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(uint64_t, 42, g_traceRecord.timestampMs);
+    ASSERT_ARE_EQUAL(int, MQTT_TRACE_OUTGOING, g_traceRecord.direction);
+    ASSERT_ARE_EQUAL(int, PUBACK_TYPE, g_traceRecord.packetType);
+    ASSERT_ARE_EQUAL(int, 0, g_traceRecord.flags);
+    ASSERT_ARE_EQUAL(int, TEST_PACKET_ID, g_traceRecord.packetId);
+    ASSERT_ARE_EQUAL(uint32_t, 4, g_traceRecord.length);
+    ASSERT_ARE_EQUAL(uint32_t, 0, g_traceRecord.topicHash);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_ACK_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_138: [Once a trace ring is set the client shall record every control packet it receives the same way.]*/
+TEST_FUNCTION(mqtt_client_set_trace_ring_records_received_packet_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
-    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-    PUBLISH_ACK puback = { 0 };
-    puback.packetId = 0x1234;
-
-    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_ACK;
-    testData.msgInfo = &puback;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    unsigned char PINGRESP_ACK_RESP[] = { 0x0d, 0x00 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_trace_ring(mqttHandle, TEST_TRACE_RING_HANDLE);
+    g_current_ms = 42;
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqtt_trace_ring_record(TEST_TRACE_RING_HANDLE, IGNORED_ARG));
 
     // act
-    g_packetComplete(mqttHandle, PUBACK_TYPE, 0, packet_handle);
+    g_packetView(mqttHandle, PINGRESP_TYPE, 0, PINGRESP_ACK_RESP, sizeof(PINGRESP_ACK_RESP));
 
     // assert
-    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_IS_FALSE(g_errorCallbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(uint64_t, 42, g_traceRecord.timestampMs);
+    ASSERT_ARE_EQUAL(int, MQTT_TRACE_INCOMING, g_traceRecord.direction);
+    ASSERT_ARE_EQUAL(int, PINGRESP_TYPE, g_traceRecord.packetType);
+    ASSERT_ARE_EQUAL(int, 0, g_traceRecord.packetId);
+    ASSERT_ARE_EQUAL(uint32_t, 4, g_traceRecord.length);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RECEIVE_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_140: [If handle or options is NULL then mqtt_client_set_raw_trace_options shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_raw_trace_options_handle_NULL_fails)
 {
     // arrange
-    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
-    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-    PUBLISH_ACK puback = { 0 };
-    puback.packetId = 0x1234;
+    MQTT_CLIENT_RAW_TRACE_OPTIONS options = { 64 };
 
-    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_RECV;
-    testData.msgInfo = &puback;
+    // act
+    int result = mqtt_client_set_raw_trace_options(NULL, &options);
 
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
-    umock_c_reset_all_calls();
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
-    EXPECTED_CALL(mqtt_codec_publishRelease(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
-    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+/*Tests_SRS_MQTT_CLIENT_07_140: [If handle or options is NULL then mqtt_client_set_raw_trace_options shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_raw_trace_options_options_NULL_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
 
     // act
-    g_packetComplete(mqttHandle, PUBREC_TYPE, 0, packet_handle);
+    int result = mqtt_client_set_raw_trace_options(mqttHandle, NULL);
 
     // assert
-    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RECEIVE_fails)
+/*Tests_SRS_MQTT_CLIENT_07_141: [mqtt_client_set_raw_trace_options shall make the raw bytes trace log at most maxBytes bytes of a packet, or the whole packet if maxBytes is 0, and return 0.]*/
+TEST_FUNCTION(mqtt_client_set_raw_trace_options_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
-    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-    PUBLISH_ACK puback ={ 0 };
-    puback.packetId = 0x1234;
-
-    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_RECV;
-    testData.msgInfo = &puback;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    MQTT_CLIENT_RAW_TRACE_OPTIONS options = { 64 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
-    EXPECTED_CALL(mqtt_codec_publishRelease(IGNORED_ARG));
-
     // act
-    g_mqtt_codec_publish_func_fail = true;
-    g_packetComplete(mqttHandle, PUBREC_TYPE, 0, packet_handle);
+    int result = mqtt_client_set_raw_trace_options(mqttHandle, &options);
 
     // assert
-    ASSERT_IS_TRUE(g_operationCallbackInvoked);
-    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RELEASE_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_144: [If handle is NULL then mqtt_client_set_capture shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_capture_handle_NULL_fails)
 {
     // arrange
-    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
-    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-    PUBLISH_ACK puback = { 0 };
-    puback.packetId = 0x1234;
 
-    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_REL;
-    testData.msgInfo = &puback;
+    // act
+    int result = mqtt_client_set_capture(NULL, TEST_CAPTURE_HANDLE);
 
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_145: [mqtt_client_set_capture shall make the client write packets to capture, or stop writing if capture is NULL, and return 0.]*/
+TEST_FUNCTION(mqtt_client_set_capture_NULL_stops_writing_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_capture(mqttHandle, TEST_CAPTURE_HANDLE);
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
-    EXPECTED_CALL(mqtt_codec_publishComplete(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_puback(TEST_PACKET_ID, IGNORED_ARG));
     EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
-    g_packetComplete(mqttHandle, PUBREL_TYPE, 0, packet_handle);
+    int result = mqtt_client_set_capture(mqttHandle, NULL);
+    (void)mqtt_client_send_message_response(mqttHandle, TEST_PACKET_ID, DELIVER_AT_LEAST_ONCE);
 
     // assert
-    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RELEASE_fails)
+/*Tests_SRS_MQTT_CLIENT_07_142: [Once a capture is set the client shall write every control packet it sends or queues to the capture with its tick counter time.]*/
+TEST_FUNCTION(mqtt_client_set_capture_writes_sent_packet_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_ACK_RESP[] ={ 0x12, 0x34 };
-    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-    PUBLISH_ACK puback ={ 0 };
-    puback.packetId = 0x1234;
-
-    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_REL;
-    testData.msgInfo = &puback;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
-    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
-    make_connack(mqttHandle, &mqttOptions);
-    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_capture(mqttHandle, TEST_CAPTURE_HANDLE);
+    g_current_ms = 42;
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
-    EXPECTED_CALL(mqtt_codec_publishComplete(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(xio_close(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
-    STRICT_EXPECTED_CALL(xio_dowork(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(ThreadAPI_Sleep(CLOSE_SLEEP_VALUE));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_puback(TEST_PACKET_ID, IGNORED_ARG));
+    EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqtt_capture_begin_packet(TEST_CAPTURE_HANDLE, MQTT_TRACE_OUTGOING, 42, 4));
+    STRICT_EXPECTED_CALL(mqtt_capture_append(TEST_CAPTURE_HANDLE, IGNORED_ARG, 4));
 
     // act
-    g_mqtt_codec_publish_func_fail = true;
-    g_packetComplete(mqttHandle, PUBREL_TYPE, 0, packet_handle);
+    int result = mqtt_client_send_message_response(mqttHandle, TEST_PACKET_ID, DELIVER_AT_LEAST_ONCE);
 
     // assert
-    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_COMPLETE_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_146: [Once a capture is set the client shall write every control packet it receives to the capture the same way.]*/
+TEST_FUNCTION(mqtt_client_set_capture_writes_received_packet_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
-    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-    PUBLISH_ACK puback = { 0 };
-    puback.packetId = 0x1234;
-
-    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_COMP;
-    testData.msgInfo = &puback;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    unsigned char PINGRESP_ACK_RESP[] = { 0x0d, 0x00 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_capture(mqttHandle, TEST_CAPTURE_HANDLE);
+    g_current_ms = 42;
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(mqtt_capture_begin_packet(TEST_CAPTURE_HANDLE, MQTT_TRACE_INCOMING, 42, 4));
+    STRICT_EXPECTED_CALL(mqtt_capture_append(TEST_CAPTURE_HANDLE, IGNORED_ARG, 2));
+    STRICT_EXPECTED_CALL(mqtt_capture_append(TEST_CAPTURE_HANDLE, PINGRESP_ACK_RESP, 2));
 
     // act
-    g_packetComplete(mqttHandle, PUBCOMP_TYPE, 0, packet_handle);
+    g_packetView(mqttHandle, PINGRESP_TYPE, 0, PINGRESP_ACK_RESP, sizeof(PINGRESP_ACK_RESP));
 
     // assert
-    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_IS_FALSE(g_errorCallbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_too_long_topic_name_length_fails)
+/*Tests_SRS_MQTT_CLIENT_07_147: [If handle or stats is NULL then mqtt_client_get_stats shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_get_stats_handle_NULL_fails)
 {
     // arrange
-    unsigned char PUBLISH_RESP[] = { 0x00, 0x01}; // Topic length is 1, but there is not a byte following
-    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    MQTT_CLIENT_STATS stats;
 
-    uint8_t flag = 0x0d;
+    // act
+    int result = mqtt_client_get_stats(NULL, &stats);
 
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
-    umock_c_reset_all_calls();
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
+/*Tests_SRS_MQTT_CLIENT_07_147: [If handle or stats is NULL then mqtt_client_get_stats shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_get_stats_stats_NULL_fails)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
 
     // act
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    int result = mqtt_client_get_stats(mqttHandle, NULL);
 
     // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_TRUE(g_errorCallbackInvoked);
-    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_invalid_topic_name_length_fails)
+/*Tests_SRS_MQTT_CLIENT_07_148: [mqtt_client_get_stats shall copy every counter and histogram of the client into stats and return 0.]*/
+/*Tests_SRS_MQTT_CLIENT_07_149: [The client shall count every control packet it sends or queues by its type, and the bytes it sends or queues.]*/
+TEST_FUNCTION(mqtt_client_get_stats_counts_sent_packet_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_RESP[] = { 0x00 }; // Topic length needs to contain at least two bytes
-    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
-
-    uint8_t flag = 0x0d;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    MQTT_CLIENT_STATS stats;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_send_message_response(mqttHandle, TEST_PACKET_ID, DELIVER_AT_LEAST_ONCE));
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
-
     // act
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    int result = mqtt_client_get_stats(mqttHandle, &stats);
 
     // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_TRUE(g_errorCallbackInvoked);
-    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(uint64_t, 1, stats.packetsSent[PUBACK_TYPE >> 4]);
+    ASSERT_ARE_EQUAL(uint64_t, 0, stats.packetsSent[PUBLISH_TYPE >> 4]);
+    ASSERT_ARE_EQUAL(uint64_t, 4, stats.bytesSent);
+    ASSERT_ARE_EQUAL(uint64_t, 0, stats.bytesReceived);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_too_short_packetID_fails)
+/*Tests_SRS_MQTT_CLIENT_07_150: [The client shall count every control packet it receives by its type, and the bytes the transport hands to it.]*/
+TEST_FUNCTION(mqtt_client_get_stats_counts_received_packet_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_RESP[] = { 0x00, 0x01, 0x0A, 0x00 }; // PacketId needed to be 2 bytes, but only 1 (after 0x0A) is supplied.
-    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
-
-    uint8_t flag = 0x0d;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    MQTT_CLIENT_STATS stats;
+    unsigned char PINGRESP_ACK_RESP[] = { 0x0d, 0x00 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    g_packetView(mqttHandle, PINGRESP_TYPE, 0, PINGRESP_ACK_RESP, sizeof(PINGRESP_ACK_RESP));
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
-    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
-
-
     // act
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    int result = mqtt_client_get_stats(mqttHandle, &stats);
 
     // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_TRUE(g_errorCallbackInvoked);
-    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(uint64_t, 1, stats.packetsReceived[PINGRESP_TYPE >> 4]);
+    ASSERT_ARE_EQUAL(uint64_t, 0, stats.pingreqToPingresp.count);
+    ASSERT_ARE_EQUAL(uint64_t, 0, stats.parseErrors);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_packetId_is_zero_fails)
+/*Tests_SRS_MQTT_CLIENT_07_152: [On a PUBACK, PUBCOMP or SUBACK the client shall add the time since it first sent the PUBLISH or SUBSCRIBE with that packet id to publishToPuback, publishToPubcomp or subscribeToSuback.]*/
+TEST_FUNCTION(mqtt_client_get_stats_records_publish_to_puback_latency_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_RESP[] = { 0x00, 0x01, 0x0A, 0x00, 0x00 }; // packetId has enough bytes, but it can't be 0
-    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
-
-    uint8_t flag = 0x0d;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    MQTT_CLIENT_STATS stats;
+    unsigned char PUBLISH_ACK_RESP[] = { 0x00, 0x01 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_set_inflight_window(mqttHandle, 1, 0));
+    g_current_ms = 10;
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    g_current_ms = 35;
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
-    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG));
+    EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
 
     // act
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    g_packetView(mqttHandle, PUBACK_TYPE, 0, PUBLISH_ACK_RESP, sizeof(PUBLISH_ACK_RESP));
+    int result = mqtt_client_get_stats(mqttHandle, &stats);
 
     // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_TRUE(g_errorCallbackInvoked);
-    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(uint64_t, 1, stats.publishToPuback.count);
+    ASSERT_ARE_EQUAL(uint64_t, 25, stats.publishToPuback.totalMs);
+    ASSERT_ARE_EQUAL(uint64_t, 25, stats.publishToPuback.maxMs);
+    ASSERT_ARE_EQUAL(uint64_t, 1, stats.publishToPuback.buckets[14]);
+    ASSERT_ARE_EQUAL(uint64_t, 25, mqtt_client_get_latency_percentile(&stats.publishToPuback, 99.0));
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-
-/*Test_SRS_MQTT_CLIENT_07_031: [If the actionResult parameter is of type UNSUBACK_TYPE then the msgInfo value shall be a UNSUBSCRIBE_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_SUBACK_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_152: [On a PUBACK, PUBCOMP or SUBACK the client shall add the time since it first sent the PUBLISH or SUBSCRIBE with that packet id to publishToPuback, publishToPubcomp or subscribeToSuback.]*/
+TEST_FUNCTION(mqtt_client_get_stats_packet_ids_sharing_a_slot_both_timed_succeeds)
 {
     // arrange
-    const size_t PACKET_RETCODE_COUNT = 4;
-    unsigned char SUBSCRIBE_ACK_RESP[] = { 0x12, 0x34, 0x00, 0x02, 0x01, 0x80 };
-    size_t length = sizeof(SUBSCRIBE_ACK_RESP) / sizeof(SUBSCRIBE_ACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-    SUBSCRIBE_ACK suback = { 0 };
-    suback.packetId = 0x1234;
-    suback.qosReturn = (QOS_VALUE*)malloc(sizeof(QOS_VALUE)*PACKET_RETCODE_COUNT);
-    suback.qosCount = PACKET_RETCODE_COUNT;
-    suback.qosReturn[0] = DELIVER_AT_MOST_ONCE;
-    suback.qosReturn[1] = DELIVER_EXACTLY_ONCE;
-    suback.qosReturn[2] = DELIVER_AT_LEAST_ONCE;
-    suback.qosReturn[3] = DELIVER_FAILURE;
-
-    testData.actionResult = MQTT_CLIENT_ON_SUBSCRIBE_ACK;
-    testData.msgInfo = &suback;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    MQTT_CLIENT_STATS stats;
+    unsigned char FIRST_ACK_RESP[] = { 0x00, 0x01 };
+    unsigned char SECOND_ACK_RESP[] = { 0x00, 0x81 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    g_current_ms = 10;
+    EXPECTED_CALL(mqttmessage_getPacketId(IGNORED_ARG)).SetReturn(0x0001);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    g_current_ms = 20;
+    EXPECTED_CALL(mqttmessage_getPacketId(IGNORED_ARG)).SetReturn(0x0081);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+    g_current_ms = 35;
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(SUBSCRIBE_ACK_RESP);
-
-    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
-    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
-
     // act
-    g_packetComplete(mqttHandle, SUBACK_TYPE, 0, packet_handle);
+    g_packetView(mqttHandle, PUBACK_TYPE, 0, FIRST_ACK_RESP, sizeof(FIRST_ACK_RESP));
+    g_packetView(mqttHandle, PUBACK_TYPE, 0, SECOND_ACK_RESP, sizeof(SECOND_ACK_RESP));
+    int result = mqtt_client_get_stats(mqttHandle, &stats);
 
     // assert
-    ASSERT_IS_TRUE(g_operationCallbackInvoked);
-    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(uint64_t, 2, stats.publishToPuback.count);
+    ASSERT_ARE_EQUAL(uint64_t, 40, stats.publishToPuback.totalMs);
+    ASSERT_ARE_EQUAL(uint64_t, 0, stats.latencyDropped);
 
     // cleanup
-    free(suback.qosReturn);
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_031: [If the actionResult parameter is of type UNSUBACK_TYPE then the msgInfo value shall be a UNSUBSCRIBE_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_UNSUBACK_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_168: [When more packets wait for their ack than the client can time, the one that has waited longest shall not be measured and shall be counted in latencyDropped.]*/
+TEST_FUNCTION(mqtt_client_get_stats_slots_full_counts_latency_dropped_succeeds)
 {
     // arrange
-    unsigned char UNSUBSCRIBE_ACK_RESP[] = { 0x12, 0x34 };
-    size_t length = sizeof(UNSUBSCRIBE_ACK_RESP) / sizeof(UNSUBSCRIBE_ACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-    UNSUBSCRIBE_ACK unsuback = { 0 };
-    unsuback.packetId = 0x1234;
-
-    testData.actionResult = MQTT_CLIENT_ON_UNSUBSCRIBE_ACK;
-    testData.msgInfo = &unsuback;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
-    umock_c_reset_all_calls();
-
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(UNSUBSCRIBE_ACK_RESP);
+    MQTT_CLIENT_STATS stats;
+    unsigned char OLDEST_ACK_RESP[] = { 0x00, 0x01 };
+    unsigned char NEWEST_ACK_RESP[] = { 0x04, 0x01 };
+    size_t index;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    for (index = 0; index < 9; index++)
+    {
+        g_current_ms = 10 + index;
+        EXPECTED_CALL(mqttmessage_getPacketId(IGNORED_ARG)).SetReturn((uint16_t)(1 + index * 128));
+        ASSERT_ARE_EQUAL(int, 0, mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE));
+        umock_c_reset_all_calls();
+    }
+    g_current_ms = 50;
 
     // act
-    g_packetComplete(mqttHandle, UNSUBACK_TYPE, 0, packet_handle);
+    g_packetView(mqttHandle, PUBACK_TYPE, 0, OLDEST_ACK_RESP, sizeof(OLDEST_ACK_RESP));
+    g_packetView(mqttHandle, PUBACK_TYPE, 0, NEWEST_ACK_RESP, sizeof(NEWEST_ACK_RESP));
+    int result = mqtt_client_get_stats(mqttHandle, &stats);
 
     // assert
-    ASSERT_IS_TRUE(g_operationCallbackInvoked);
-    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(uint64_t, 1, stats.latencyDropped);
+    ASSERT_ARE_EQUAL(uint64_t, 1, stats.publishToPuback.count);
+    ASSERT_ARE_EQUAL(uint64_t, 32, stats.publishToPuback.totalMs);
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PINGRESP_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_154: [If histogram is NULL or holds no latency then mqtt_client_get_latency_percentile shall return 0.]*/
+TEST_FUNCTION(mqtt_client_get_latency_percentile_histogram_NULL_fails)
 {
     // arrange
-    unsigned char PINGRESP_ACK_RESP[] = { 0x0d, 0x00 };
-    size_t length = sizeof(PINGRESP_ACK_RESP) / sizeof(PINGRESP_ACK_RESP[0]);
+    MQTT_CLIENT_LATENCY_HISTOGRAM histogram;
+    memset(&histogram, 0, sizeof(histogram));
 
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
-    umock_c_reset_all_calls();
+    // act
+    uint64_t result = mqtt_client_get_latency_percentile(NULL, 50.0);
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PINGRESP_ACK_RESP);
+    // assert
+    ASSERT_ARE_EQUAL(uint64_t, 0, result);
+    ASSERT_ARE_EQUAL(uint64_t, 0, mqtt_client_get_latency_percentile(&histogram, 50.0));
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_155: [mqtt_client_get_latency_percentile shall return the largest latency of the bucket the percentile falls in, or maxMs if that is less.]*/
+TEST_FUNCTION(mqtt_client_get_latency_percentile_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_LATENCY_HISTOGRAM histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    histogram.buckets[2] = 1;
+    histogram.buckets[14] = 3;
+    histogram.count = 4;
+    histogram.totalMs = 2 + 24 + 25 + 26;
+    histogram.maxMs = 26;
 
     // act
-    g_packetComplete(mqttHandle, PINGRESP_TYPE, 0, packet_handle);
+    uint64_t result = mqtt_client_get_latency_percentile(&histogram, 50.0);
 
     // assert
-    ASSERT_IS_FALSE(g_errorCallbackInvoked);
-    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-
-    // cleanup
-    mqtt_client_deinit(mqttHandle);
+    ASSERT_ARE_EQUAL(uint64_t, 26, result);
+    ASSERT_ARE_EQUAL(uint64_t, 2, mqtt_client_get_latency_percentile(&histogram, 25.0));
+    ASSERT_ARE_EQUAL(uint64_t, 2, mqtt_client_get_latency_percentile(&histogram, 0.0));
+    ASSERT_ARE_EQUAL(uint64_t, 26, mqtt_client_get_latency_percentile(&histogram, 100.0));
 }
 
 TEST_FUNCTION(mqtt_client_set_trace_succeeds)
@@ -2905,6 +7163,10 @@ TEST_FUNCTION(mqtt_client_set_trace_succeeds)
     MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
     umock_c_reset_all_calls();
 
+#if defined(ENABLE_RAW_TRACE) && !defined(NO_LOGGING)
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+#endif
+
     // act
     mqtt_client_set_trace(mqttHandle, true, true);
 
@@ -2938,9 +7200,6 @@ TEST_FUNCTION(mqtt_client_trace_CONNACK_succeeds)
     // act
     unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
     size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
-    BUFFER_HANDLE connack_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
 #ifdef ENABLE_RAW_TRACE
     STRICT_EXPECTED_CALL(get_time(IGNORED_ARG));
 #endif
@@ -2950,7 +7209,7 @@ TEST_FUNCTION(mqtt_client_trace_CONNACK_succeeds)
     STRICT_EXPECTED_CALL(STRING_delete(IGNORED_ARG));
 #endif
 
-    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
+    g_packetView(mqttHandle, CONNACK_TYPE, 0, CONNACK_RESP, length);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
@@ -2973,26 +7232,20 @@ TEST_FUNCTION(mqtt_client_trace_PUBLISH_succeeds)
 
     uint8_t flag = 0x0d;
 
-    BUFFER_HANDLE publish_handle = TEST_BUFFER_HANDLE;
 
     //setup_publish_callback_mocks(PUBLISH_RESP, length, DELIVER_EXACTLY_ONCE);
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
 #ifdef ENABLE_RAW_TRACE
     STRICT_EXPECTED_CALL(get_time(IGNORED_ARG));
 #endif
 
-    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, IGNORED_ARG, DELIVER_EXACTLY_ONCE, IGNORED_ARG, TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place_n(TEST_PACKET_ID, IGNORED_ARG, 10, DELIVER_EXACTLY_ONCE, IGNORED_ARG, TEST_APP_PAYLOAD.length));
     STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_ARG, true));
     STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_ARG, true));
 #ifndef NO_LOGGING
     STRICT_EXPECTED_CALL(get_time(IGNORED_ARG));
     STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_ARG));
 #endif
-    STRICT_EXPECTED_CALL(mqtt_codec_publishReceived(TEST_PACKET_ID)).SetReturn((BUFFER_HANDLE)0x111111);
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG)).SetReturn(length);
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG)).SetReturn(PUBLISH_RESP);
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_pubrec(TEST_PACKET_ID, IGNORED_ARG));
     EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
 #ifdef ENABLE_RAW_TRACE
     STRICT_EXPECTED_CALL(get_time(IGNORED_ARG));
@@ -3003,14 +7256,12 @@ TEST_FUNCTION(mqtt_client_trace_PUBLISH_succeeds)
     STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_ARG));
     STRICT_EXPECTED_CALL(STRING_delete(IGNORED_ARG));
 #endif
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
     STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_ARG));
 #ifndef NO_LOGGING
     STRICT_EXPECTED_CALL(STRING_delete(IGNORED_ARG));
 #endif
-    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 
-    g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
+    g_packetView(mqttHandle, PUBLISH_TYPE, flag, PUBLISH_RESP, length);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
@@ -3035,9 +7286,6 @@ TEST_FUNCTION(mqtt_client_trace_PUBLISH_ACK_succeeds)
     mqtt_client_set_trace(mqttHandle, true, true);
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
 #ifdef ENABLE_RAW_TRACE
     STRICT_EXPECTED_CALL(get_time(IGNORED_ARG));
 #endif
@@ -3048,7 +7296,7 @@ TEST_FUNCTION(mqtt_client_trace_PUBLISH_ACK_succeeds)
 #endif
 
     // act
-    g_packetComplete(mqttHandle, PUBACK_TYPE, 0, packet_handle);
+    g_packetView(mqttHandle, PUBACK_TYPE, 0, PUBLISH_ACK_RESP, length);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
@@ -3074,9 +7322,6 @@ TEST_FUNCTION(mqtt_client_trace_SUBSCRIBE_ACK_succeeds)
     mqtt_client_set_trace(mqttHandle, true, true);
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(SUBSCRIBE_ACK_RESP);
 #ifdef ENABLE_RAW_TRACE
     STRICT_EXPECTED_CALL(get_time(IGNORED_ARG));
 #endif
@@ -3089,7 +7334,7 @@ TEST_FUNCTION(mqtt_client_trace_SUBSCRIBE_ACK_succeeds)
     STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 
     // act
-    g_packetComplete(mqttHandle, SUBACK_TYPE, 0, packet_handle);
+    g_packetView(mqttHandle, SUBACK_TYPE, 0, SUBSCRIBE_ACK_RESP, length);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
@@ -3115,9 +7360,6 @@ TEST_FUNCTION(mqtt_client_trace_UNSUBSCRIBE_ACK_succeeds)
     mqtt_client_set_trace(mqttHandle, true, true);
     umock_c_reset_all_calls();
 
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(UNSUBSCRIBE_ACK_RESP);
 #ifdef ENABLE_RAW_TRACE
     STRICT_EXPECTED_CALL(get_time(IGNORED_ARG));
 #endif
@@ -3128,7 +7370,7 @@ TEST_FUNCTION(mqtt_client_trace_UNSUBSCRIBE_ACK_succeeds)
 #endif
 
     // act
-    g_packetComplete(mqttHandle, UNSUBACK_TYPE, 0, packet_handle);
+    g_packetView(mqttHandle, UNSUBACK_TYPE, 0, UNSUBSCRIBE_ACK_RESP, length);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
@@ -3151,12 +7393,9 @@ TEST_FUNCTION(mqtt_client_send_message_response_PUBACK_succeeds)
  
     umock_c_reset_all_calls();
 
-    STRICT_EXPECTED_CALL(mqtt_codec_publishAck(TEST_PACKET_ID));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_encode_puback(TEST_PACKET_ID, IGNORED_ARG));
     EXPECTED_CALL(xio_send(IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG, IGNORED_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
     int result = mqtt_client_send_message_response(mqttHandle, TEST_PACKET_ID, DELIVER_AT_LEAST_ONCE);
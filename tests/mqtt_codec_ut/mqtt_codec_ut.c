@@ -57,6 +57,9 @@ extern "C"
 
 static bool g_fail_alloc_calls;
 static bool g_callbackInvoked;
+static size_t g_callbackCount;
+static const uint8_t* g_viewData;
+static size_t g_viewLength;
 static CONTROL_PACKET_TYPE g_curr_packet_type;
 static const char* TEST_SUBSCRIPTION_TOPIC = "subTopic";
 static const char* TEST_CLIENT_ID = "single_threaded_test";
@@ -222,6 +225,9 @@ TEST_FUNCTION_INITIALIZE(method_init)
     }
     g_fail_alloc_calls = false;
     g_callbackInvoked = false;
+    g_callbackCount = 0;
+    g_viewData = NULL;
+    g_viewLength = 0;
 
     umock_c_reset_all_calls();
 }
@@ -264,14 +270,37 @@ static void TestOnCompleteCallback(void* context, CONTROL_PACKET_TYPE packet, in
         if (packet == PINGRESP_TYPE)
         {
             g_callbackInvoked = true;
+            g_callbackCount++;
         }
         else if (testData->Length > 0 && testData->dataHeader != NULL)
         {
             if (memcmp(testData->dataHeader, real_BUFFER_u_char(headerData), testData->Length) == 0)
             {
                 g_callbackInvoked = true;
+                g_callbackCount++;
             }
         }
+        else if (testData->Length == 0 && headerData == NULL && packet == g_curr_packet_type)
+        {
+            g_callbackInvoked = true;
+            g_callbackCount++;
+        }
+    }
+}
+
+static void TestOnViewCallback(void* context, CONTROL_PACKET_TYPE packet, int flags, const uint8_t* packetData, size_t packetLength)
+{
+    TEST_COMPLETE_DATA_INSTANCE* testData = (TEST_COMPLETE_DATA_INSTANCE*)context;
+    (void)flags;
+    if (testData != NULL && packet == g_curr_packet_type && packetLength == testData->Length)
+    {
+        if (packetLength == 0 || memcmp(testData->dataHeader, packetData, packetLength) == 0)
+        {
+            g_callbackInvoked = true;
+            g_callbackCount++;
+            g_viewData = packetData;
+            g_viewLength = packetLength;
+        }
     }
 }
 
@@ -291,6 +320,36 @@ TEST_FUNCTION(mqtt_codec_create_succeed)
     mqtt_codec_destroy(handle);
 }
 
+/* Tests_SRS_MQTT_CODEC_07_041: [On success mqtt_codec_create_with_view shall return a MQTTCODEC_HANDLE value that reports complete packets through packetView.] */
+TEST_FUNCTION(mqtt_codec_create_with_view_succeed)
+{
+    // arrange
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, NULL);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    mqtt_codec_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_040: [If a failure is encountered then mqtt_codec_create_with_view shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_create_with_view_fail)
+{
+    // arrange
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
 /* Tests_SRS_MQTT_CODEC_07_004: [mqtt_codec_destroy shall deallocate all memory that has been allocated by this object.] */
 TEST_FUNCTION(mqtt_codec_destroy_succeed)
 {
@@ -520,6 +579,39 @@ TEST_FUNCTION(mqtt_codec_connect_Large_Data_succeeds)
     real_BUFFER_delete(handle);
 }
 
+/* Tests_SRS_MQTT_CODEC_07_059: [If mqttOptions->protocolVersion is MQTT_PROTOCOL_V5 then mqtt_codec_connect shall write protocol level 5, a property block holding the session expiry interval, receive maximum and maximum packet size that are not zero, and an empty will property block before the will topic.] */
+TEST_FUNCTION(mqtt_codec_connect_v5_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, NULL, NULL, 20, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_V5;
+    mqttOptions.sessionExpiryInterval = 60;
+    mqttOptions.receiveMaximum = 10;
+    mqttOptions.maximumPacketSize = 1024;
+
+    const unsigned char CONNECT_VALUE[] = { 0x10, 0x45, 0x00, 0x04, 0x4d, 0x51, 0x54, 0x54, 0x05, 0x06, 0x00, 0x14, 0x0d, 0x11, 0x00, 0x00, \
+        0x00, 0x3c, 0x21, 0x00, 0x0a, 0x27, 0x00, 0x00, 0x04, 0x00, 0x00, 0x14, 0x73, 0x69, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x74, 0x68, 0x72, \
+        0x65, 0x61, 0x64, 0x65, 0x64, 0x5f, 0x74, 0x65, 0x73, 0x74, 0x00, 0x00, 0x0a, 0x57, 0x69, 0x6c, 0x6c, 0x20, 0x54, 0x6f, 0x70, 0x69, \
+        0x63, 0x00, 0x08, 0x57, 0x69, 0x6c, 0x6c, 0x20, 0x4d, 0x73, 0x67 };
+
+    setup_codec_connect_mocks();
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_connect(&mqttOptions, NULL);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(CONNECT_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, CONNECT_VALUE, length));
+
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    real_BUFFER_delete(handle);
+}
+
 /* Tests_SRS_MQTT_CODEC_07_011: [On success mqtt_codec_disconnect shall construct a BUFFER_HANDLE that represents a MQTT DISCONNECT packet.] */
 TEST_FUNCTION(mqtt_codec_disconnect_succeed)
 {
@@ -616,14 +708,11 @@ TEST_FUNCTION(mqtt_codec_publish_topicName_NULL_fail)
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 }
 
-/* Tests_SRS_CONTROL_PACKET_07_052: [mqtt_codec_publish shall constuct the MQTT variable header and shall return a non-zero value on failure.] */
-TEST_FUNCTION(mqtt_codec_publish_construct_BUFFER_enlarge_fail)
+/* Tests_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_publish_BUFFER_new_fails)
 {
     // arrange
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_new()).SetReturn(NULL);
 
     // act
     BUFFER_HANDLE handle = mqtt_codec_publish(DELIVER_AT_MOST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
@@ -634,15 +723,11 @@ TEST_FUNCTION(mqtt_codec_publish_construct_BUFFER_enlarge_fail)
 }
 
 /* Tests_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_publish_BUFFER_enlarge_fails)
+TEST_FUNCTION(mqtt_codec_publish_BUFFER_pre_build_fails)
 {
     // arrange
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
@@ -654,23 +739,12 @@ TEST_FUNCTION(mqtt_codec_publish_BUFFER_enlarge_fails)
 }
 
 /* Tests_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_publish_constructFixedHeader_fails)
+TEST_FUNCTION(mqtt_codec_publish_BUFFER_u_char_fails)
 {
     // arrange
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
-
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG)).SetReturn(NULL);
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
@@ -688,18 +762,9 @@ TEST_FUNCTION(mqtt_codec_publish_msgBuffer_NULL_succeeds)
     const unsigned char PUBLISH_VALUE[] = { 0x38, 0x0c, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65 };
 
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, sizeof(PUBLISH_VALUE)))
+        .IgnoreArgument(1);
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
-
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
@@ -725,20 +790,9 @@ TEST_FUNCTION(mqtt_codec_publish_succeeds)
         0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
 
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, sizeof(PUBLISH_VALUE)))
+        .IgnoreArgument(1);
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
-
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
@@ -764,19 +818,10 @@ TEST_FUNCTION(mqtt_codec_publish_trace_succeeds)
         0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
 
     STRICT_EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, sizeof(PUBLISH_VALUE)))
+        .IgnoreArgument(1);
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
     EXPECTED_CALL(STRING_copy(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
     EXPECTED_CALL(STRING_concat_with_STRING(IGNORED_ARG, IGNORED_ARG));
     EXPECTED_CALL(STRING_delete(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
@@ -803,20 +848,9 @@ TEST_FUNCTION(mqtt_codec_publish_second_succeeds)
     const unsigned char PUBLISH_VALUE[] = { 0x30, 0x1c, 0x00, 0x04, 0x6d, 0x73, 0x67, 0x41, 0x54, 0x68, 0x69, 0x73, 0x20, 0x69, 0x73, 0x20, 0x74, 0x68, 0x65, 0x20, 0x61, 0x70, 0x70, 0x20, 0x6d, 0x73, 0x67, 0x20, 0x41, 0x2e };
 
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, sizeof(PUBLISH_VALUE)))
+        .IgnoreArgument(1);
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
-
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
@@ -834,345 +868,382 @@ TEST_FUNCTION(mqtt_codec_publish_second_succeeds)
     real_BUFFER_delete(handle);
 }
 
-/* Tests_SRS_MQTT_CODEC_07_013: [On success mqtt_codec_publishAck shall return a BUFFER_HANDLE representation of a MQTT PUBACK packet.] */
-TEST_FUNCTION(mqtt_codec_publish_ack_pre_build_fail)
+/* Tests_SRS_MQTT_CODEC_07_049: [mqtt_codec_publish shall compute the Remaining Length first and allocate the exact size of the PUBLISH packet once.] */
+/* Tests_SRS_MQTT_CODEC_07_050: [mqtt_codec_publish shall write the fixed header, topic name, packet id and payload into the packet in a single pass.] */
+TEST_FUNCTION(mqtt_codec_publish_large_payload_single_allocation_succeeds)
 {
     // arrange
+    size_t payloadLen = 256 * 1024;
+    uint8_t* payload = (uint8_t*)my_gballoc_malloc(payloadLen);
+    ASSERT_IS_NOT_NULL(payload);
+    (void)memset(payload, 0x5a, payloadLen);
+    // 1 byte control type, 3 bytes Remaining Length, topic name with length, packet id
+    size_t remainLen = 2 + strlen(TEST_TOPIC_NAME) + 2 + payloadLen;
+    size_t packetLen = 1 + 3 + remainLen;
+
     EXPECTED_CALL(BUFFER_new());
-    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
-        .IgnoreArgument(1)
-        .SetReturn(MU_FAILURE);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, packetLen))
+        .IgnoreArgument(1);
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_publishAck(TEST_PACKET_ID);
+    BUFFER_HANDLE handle = mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, false, false, TEST_PACKET_ID, TEST_TOPIC_NAME, payload, payloadLen, NULL);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NULL(handle);
+    ASSERT_IS_NOT_NULL(handle);
+    unsigned char* data = real_BUFFER_u_char(handle);
+    ASSERT_ARE_EQUAL(int, 0x32, data[0]);
+    ASSERT_ARE_EQUAL(int, (int)((remainLen & 0x7f) | 0x80), data[1]);
+    ASSERT_ARE_EQUAL(int, (int)(((remainLen >> 7) & 0x7f) | 0x80), data[2]);
+    ASSERT_ARE_EQUAL(int, (int)(remainLen >> 14), data[3]);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data + packetLen - payloadLen, payload, payloadLen));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+    my_gballoc_free(payload);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_036: [mqtt_codec_publish shall return NULL if the buffLen variable is greater than the MAX_SEND_SIZE (0xFFFFFF7F).] */
-TEST_FUNCTION(mqtt_codec_publish_over_max_size_fail)
+/* Tests_SRS_MQTT_CODEC_07_051: [If the parameters topicName or headerLength is NULL then mqtt_codec_publish_header shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_publish_header_topicName_NULL_fail)
 {
     // arrange
+    uint8_t header[64];
+    size_t headerLength = sizeof(header);
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, TEST_MESSAGE, OVER_MAX_SEND_SIZE, NULL);
+    int result_1 = mqtt_codec_publish_header(DELIVER_AT_LEAST_ONCE, false, false, TEST_PACKET_ID, NULL, TEST_MESSAGE_LEN, header, &headerLength, NULL);
+    int result_2 = mqtt_codec_publish_header(DELIVER_AT_LEAST_ONCE, false, false, TEST_PACKET_ID, TEST_TOPIC_NAME, TEST_MESSAGE_LEN, header, NULL, NULL);
 
     // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_1);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_2);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NULL(handle);
-
-    // cleanup
-    real_BUFFER_delete(handle);
 }
 
-/* Tests_SRS_MQTT_CODEC_07_014 : [If any error is encountered then mqtt_codec_publishAck shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_publish_ack_succeeds)
+/* Tests_SRS_MQTT_CODEC_07_053: [If headerBuffer is NULL or headerLength is smaller than the header then mqtt_codec_publish_header shall set headerLength to the required size and return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_publish_header_buffer_too_small_fail)
 {
     // arrange
-    unsigned char PUBLISH_ACK_VALUE[] = { 0x40, 0x02, 0x12, 0x34 };
-
-    EXPECTED_CALL(BUFFER_new());
-    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
-        .IgnoreArgument(1);
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    uint8_t header[4];
+    size_t headerLength = sizeof(header);
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_publishAck(TEST_PACKET_ID);
-
-    unsigned char* data = real_BUFFER_u_char(handle);
-    size_t length = BUFFER_length(handle);
+    int result = mqtt_codec_publish_header(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, TEST_MESSAGE_LEN, header, &headerLength, NULL);
 
     // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 16, headerLength);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NOT_NULL(handle);
-    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_ACK_VALUE, length));
+}
 
-    // cleanup
-    real_BUFFER_delete(handle);
+/* Tests_SRS_MQTT_CODEC_07_054: [mqtt_codec_publish_header shall write the fixed header, topic name and packet id of a PUBLISH packet carrying payloadLen bytes into headerBuffer, set headerLength to the number of bytes written and return zero.] */
+TEST_FUNCTION(mqtt_codec_publish_header_succeeds)
+{
+    // arrange
+    const unsigned char PUBLISH_HEADER[] = { 0x3a, 0x1d, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34 };
+    uint8_t header[64];
+    size_t headerLength = sizeof(header);
+
+    // act
+    int result = mqtt_codec_publish_header(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, TEST_MESSAGE_LEN, header, &headerLength, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_HEADER), headerLength);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(header, PUBLISH_HEADER, headerLength));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 }
 
-/* Codes_SRS_MQTT_CODEC_07_016 : [If any error is encountered then mqtt_codec_publishRecieved shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_publish_received_pre_build_fail)
+/* Tests_SRS_MQTT_CODEC_07_055: [If encodedTopic is NULL or does not start with its length as two bytes most significant first then mqtt_codec_publish_encoded_topic shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_publish_encoded_topic_invalid_topic_fail)
 {
     // arrange
-    STRICT_EXPECTED_CALL(BUFFER_new());
-    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
-        .IgnoreArgument(1)
-        .SetReturn(MU_FAILURE);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    const uint8_t ENCODED_TOPIC[] = { 0x00, 0x0b, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65 };
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_publishReceived(TEST_PACKET_ID);
+    BUFFER_HANDLE handle_1 = mqtt_codec_publish_encoded_topic(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, NULL, sizeof(ENCODED_TOPIC), TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
+    BUFFER_HANDLE handle_2 = mqtt_codec_publish_encoded_topic(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, ENCODED_TOPIC, sizeof(ENCODED_TOPIC), TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
+    BUFFER_HANDLE handle_3 = mqtt_codec_publish_encoded_topic(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, ENCODED_TOPIC, 1, TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
 
     // assert
+    ASSERT_IS_NULL(handle_1);
+    ASSERT_IS_NULL(handle_2);
+    ASSERT_IS_NULL(handle_3);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NULL(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_015: [On success mqtt_codec_publishRecieved shall return a BUFFER_HANDLE representation of a MQTT PUBREC packet.] */
-TEST_FUNCTION(mqtt_codec_publish_received_succeeds)
+/* Tests_SRS_MQTT_CODEC_07_056: [mqtt_codec_publish_encoded_topic shall copy encodedTopic into the PUBLISH packet as its topic name and otherwise encode the packet like mqtt_codec_publish.] */
+TEST_FUNCTION(mqtt_codec_publish_encoded_topic_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_ACK_VALUE[] = { 0x50, 0x02, 0x12, 0x34 };
+    const unsigned char PUBLISH_VALUE[] = { 0x3a, 0x1d, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, 0x4d, 0x65, \
+        0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    const uint8_t ENCODED_TOPIC[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65 };
 
     EXPECTED_CALL(BUFFER_new());
-    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, sizeof(PUBLISH_VALUE)))
         .IgnoreArgument(1);
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_publishReceived(TEST_PACKET_ID);
+    BUFFER_HANDLE handle = mqtt_codec_publish_encoded_topic(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, ENCODED_TOPIC, sizeof(ENCODED_TOPIC), TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
 
     unsigned char* data = real_BUFFER_u_char(handle);
     size_t length = BUFFER_length(handle);
 
     // assert
-    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
     ASSERT_IS_NOT_NULL(handle);
-    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_ACK_VALUE, length));
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_VALUE, length));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     real_BUFFER_delete(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_018 : [If any error is encountered then mqtt_codec_publishRelease shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_publish_release_pre_build_fail)
+/* Tests_SRS_MQTT_CODEC_07_056: [mqtt_codec_publish_encoded_topic shall copy encodedTopic into the PUBLISH packet as its topic name and otherwise encode the packet like mqtt_codec_publish.] */
+TEST_FUNCTION(mqtt_codec_publish_encoded_topic_BUFFER_new_fails)
 {
     // arrange
-    EXPECTED_CALL(BUFFER_new());
-    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
-        .IgnoreArgument(1)
-        .SetReturn(MU_FAILURE);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    const uint8_t ENCODED_TOPIC[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65 };
+    EXPECTED_CALL(BUFFER_new()).SetReturn(NULL);
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_publishRelease(TEST_PACKET_ID);
+    BUFFER_HANDLE handle = mqtt_codec_publish_encoded_topic(DELIVER_AT_MOST_ONCE, true, false, TEST_PACKET_ID, ENCODED_TOPIC, sizeof(ENCODED_TOPIC), TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
 
     // assert
-    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
     ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 }
 
-/* Codes_SRS_MQTT_CODEC_07_017: [On success mqtt_codec_publishRelease shall return a BUFFER_HANDLE representation of a MQTT PUBREL packet.] */
-TEST_FUNCTION(mqtt_codec_publish_release_succeeds)
+/* Tests_SRS_MQTT_CODEC_07_057: [If headerLength is NULL, or encodedTopic is NULL or does not start with its length as two bytes most significant first then mqtt_codec_publish_header_encoded_topic shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_publish_header_encoded_topic_invalid_args_fail)
 {
     // arrange
-    unsigned char PUBLISH_ACK_VALUE[] = { 0x62, 0x02, 0x12, 0x34 };
-
-    EXPECTED_CALL(BUFFER_new());
-    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
-        .IgnoreArgument(1);
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    const uint8_t ENCODED_TOPIC[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65 };
+    uint8_t header[64];
+    size_t headerLength = sizeof(header);
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_publishRelease(TEST_PACKET_ID);
-
-    unsigned char* data = real_BUFFER_u_char(handle);
-    size_t length = BUFFER_length(handle);
+    int result_1 = mqtt_codec_publish_header_encoded_topic(DELIVER_AT_LEAST_ONCE, false, false, TEST_PACKET_ID, NULL, sizeof(ENCODED_TOPIC), TEST_MESSAGE_LEN, header, &headerLength, NULL);
+    int result_2 = mqtt_codec_publish_header_encoded_topic(DELIVER_AT_LEAST_ONCE, false, false, TEST_PACKET_ID, ENCODED_TOPIC, sizeof(ENCODED_TOPIC) - 1, TEST_MESSAGE_LEN, header, &headerLength, NULL);
+    int result_3 = mqtt_codec_publish_header_encoded_topic(DELIVER_AT_LEAST_ONCE, false, false, TEST_PACKET_ID, ENCODED_TOPIC, sizeof(ENCODED_TOPIC), TEST_MESSAGE_LEN, header, NULL, NULL);
 
     // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_1);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_2);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_3);
+    ASSERT_ARE_EQUAL(size_t, sizeof(header), headerLength);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NOT_NULL(handle);
-    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_ACK_VALUE, length));
-
-    // cleanup
-    real_BUFFER_delete(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_020 : [If any error is encountered then mqtt_codec_publishComplete shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_publish_complete_pre_build_fail)
+/* Tests_SRS_MQTT_CODEC_07_058: [mqtt_codec_publish_header_encoded_topic shall copy encodedTopic into the header as its topic name and otherwise encode the header like mqtt_codec_publish_header.] */
+TEST_FUNCTION(mqtt_codec_publish_header_encoded_topic_succeeds)
 {
     // arrange
-    EXPECTED_CALL(BUFFER_new());
-    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
-        .IgnoreArgument(1)
-        .SetReturn(MU_FAILURE);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    const unsigned char PUBLISH_HEADER[] = { 0x3a, 0x1d, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34 };
+    const uint8_t ENCODED_TOPIC[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65 };
+    uint8_t header[64];
+    size_t headerLength = sizeof(header);
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_publishComplete(TEST_PACKET_ID);
+    int result = mqtt_codec_publish_header_encoded_topic(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, ENCODED_TOPIC, sizeof(ENCODED_TOPIC), TEST_MESSAGE_LEN, header, &headerLength, NULL);
 
     // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_HEADER), headerLength);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(header, PUBLISH_HEADER, headerLength));
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NULL(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_019: [On success mqtt_codec_publishComplete shall return a BUFFER_HANDLE representation of a MQTT PUBCOMP packet.] */
-TEST_FUNCTION(mqtt_codec_publish_complete_succeeds)
+/* Tests_SRS_MQTT_CODEC_07_060: [If topicName is NULL while topicNameLength is not zero, or topicNameLength is zero while topicAlias is zero, then mqtt_codec_publish_v5 shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_publish_v5_invalid_topic_fail)
+{
+    // act
+    BUFFER_HANDLE handle_1 = mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, NULL, 10, 0, TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
+    BUFFER_HANDLE handle_2 = mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, NULL, 0, 0, TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle_1);
+    ASSERT_IS_NULL(handle_2);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_061: [mqtt_codec_publish_v5 shall encode the packet like mqtt_codec_publish followed by a property block after the packet id that holds the topic alias when topicAlias is not zero.] */
+TEST_FUNCTION(mqtt_codec_publish_v5_succeeds)
 {
     // arrange
-    unsigned char PUBLISH_COMP_VALUE[] = { 0x70, 0x02, 0x12, 0x34 };
+    const unsigned char PUBLISH_VALUE[] = { 0x3a, 0x1e, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, 0x00, 0x4d, \
+        0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
 
     EXPECTED_CALL(BUFFER_new());
-    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, sizeof(PUBLISH_VALUE)))
         .IgnoreArgument(1);
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_publishComplete(TEST_PACKET_ID);
+    BUFFER_HANDLE handle = mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, strlen(TEST_TOPIC_NAME), 0, TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
 
     unsigned char* data = real_BUFFER_u_char(handle);
     size_t length = BUFFER_length(handle);
 
     // assert
-    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
     ASSERT_IS_NOT_NULL(handle);
-    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_COMP_VALUE, length));
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_VALUE, length));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     real_BUFFER_delete(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_023: [If the parameters subscribeList is NULL or if count is 0 then mqtt_codec_subscribe shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_subscribe_subscribeList_NULL_fails)
+/* Tests_SRS_MQTT_CODEC_07_061: [mqtt_codec_publish_v5 shall encode the packet like mqtt_codec_publish followed by a property block after the packet id that holds the topic alias when topicAlias is not zero.] */
+TEST_FUNCTION(mqtt_codec_publish_v5_topic_alias_succeeds)
 {
     // arrange
+    const unsigned char PUBLISH_VALUE[] = { 0x3a, 0x21, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, 0x03, 0x23, \
+        0x00, 0x05, 0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+
+    EXPECTED_CALL(BUFFER_new());
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, sizeof(PUBLISH_VALUE)))
+        .IgnoreArgument(1);
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, NULL, 0, NULL);
+    BUFFER_HANDLE handle = mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, strlen(TEST_TOPIC_NAME), 5, TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
 
     // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_VALUE, length));
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NULL(handle);
+
+    // cleanup
+    real_BUFFER_delete(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_025: [If any error is encountered then mqtt_codec_subscribe shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_subscribe_BUFFER_enlarge_fails)
+/* Tests_SRS_MQTT_CODEC_07_061: [mqtt_codec_publish_v5 shall encode the packet like mqtt_codec_publish followed by a property block after the packet id that holds the topic alias when topicAlias is not zero.] */
+TEST_FUNCTION(mqtt_codec_publish_v5_topic_alias_only_succeeds)
 {
     // arrange
+    const unsigned char PUBLISH_VALUE[] = { 0x30, 0x15, 0x00, 0x00, 0x03, 0x23, 0x00, 0x05, 0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, \
+        0x20, 0x73, 0x65, 0x6e, 0x64 };
+
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, sizeof(PUBLISH_VALUE)))
+        .IgnoreArgument(1);
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, NULL);
+    BUFFER_HANDLE handle = mqtt_codec_publish_v5(DELIVER_AT_MOST_ONCE, false, false, 0, NULL, 0, 5, TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
 
     // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_VALUE, length));
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NULL(handle);
+
+    // cleanup
+    real_BUFFER_delete(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_025: [If any error is encountered then mqtt_codec_subscribe shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_subscribe_addListItemsToSubscribePacket_fails)
+/* Tests_SRS_MQTT_CODEC_07_062: [If headerLength is NULL, topicName is NULL while topicNameLength is not zero, or topicNameLength is zero while topicAlias is zero, then mqtt_codec_publish_header_v5 shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_publish_header_v5_invalid_args_fail)
 {
     // arrange
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    uint8_t header[64];
+    size_t headerLength = sizeof(header);
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, NULL);
+    int result_1 = mqtt_codec_publish_header_v5(DELIVER_AT_LEAST_ONCE, false, false, TEST_PACKET_ID, NULL, 10, 0, TEST_MESSAGE_LEN, header, &headerLength, NULL);
+    int result_2 = mqtt_codec_publish_header_v5(DELIVER_AT_LEAST_ONCE, false, false, TEST_PACKET_ID, NULL, 0, 0, TEST_MESSAGE_LEN, header, &headerLength, NULL);
+    int result_3 = mqtt_codec_publish_header_v5(DELIVER_AT_LEAST_ONCE, false, false, TEST_PACKET_ID, TEST_TOPIC_NAME, strlen(TEST_TOPIC_NAME), 0, TEST_MESSAGE_LEN, header, NULL, NULL);
 
     // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_1);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_2);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_3);
+    ASSERT_ARE_EQUAL(size_t, sizeof(header), headerLength);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NULL(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_025: [If any error is encountered then mqtt_codec_subscribe shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_subscribe_constructFixedHeader_fails)
+/* Tests_SRS_MQTT_CODEC_07_063: [mqtt_codec_publish_header_v5 shall encode the header like mqtt_codec_publish_header with the property block of mqtt_codec_publish_v5.] */
+TEST_FUNCTION(mqtt_codec_publish_header_v5_succeeds)
 {
     // arrange
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    const unsigned char PUBLISH_HEADER[] = { 0x3a, 0x21, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, 0x03, 0x23, 0x00, 0x05 };
+    uint8_t header[64];
+    size_t headerLength = sizeof(header);
 
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    // act
+    int result = mqtt_codec_publish_header_v5(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, strlen(TEST_TOPIC_NAME), 5, TEST_MESSAGE_LEN, header, &headerLength, NULL);
 
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_HEADER), headerLength);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(header, PUBLISH_HEADER, headerLength));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_013: [On success mqtt_codec_publishAck shall return a BUFFER_HANDLE representation of a MQTT PUBACK packet.] */
+TEST_FUNCTION(mqtt_codec_publish_ack_pre_build_fail)
+{
+    // arrange
+    EXPECTED_CALL(BUFFER_new());
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
+        .IgnoreArgument(1)
+        .SetReturn(MU_FAILURE);
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, NULL);
+    BUFFER_HANDLE handle = mqtt_codec_publishAck(TEST_PACKET_ID);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
     ASSERT_IS_NULL(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_026: [mqtt_codec_subscribe shall return a BUFFER_HANDLE that represents a MQTT SUBSCRIBE message.]*/
-/* Codes_SRS_MQTT_CODEC_07_024: [mqtt_codec_subscribe shall iterate through count items in the subscribeList.] */
-TEST_FUNCTION(mqtt_codec_subscribe_succeeds)
+/* Codes_SRS_MQTT_CODEC_07_036: [mqtt_codec_publish shall return NULL if the buffLen variable is greater than the MAX_SEND_SIZE (0xFFFFFF7F).] */
+TEST_FUNCTION(mqtt_codec_publish_over_max_size_fail)
 {
     // arrange
-    unsigned char SUBSCRIBE_VALUE[] = { 0x82, 0x1a, 0x12, 0x34, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x01, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32, 0x02 };
-
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, NULL);
-
-    unsigned char* data = real_BUFFER_u_char(handle);
-    size_t length = BUFFER_length(handle);
+    BUFFER_HANDLE handle = mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, TEST_MESSAGE, OVER_MAX_SEND_SIZE, NULL);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NOT_NULL(handle);
-    ASSERT_ARE_EQUAL(int, 0, memcmp(data, SUBSCRIBE_VALUE, length));
+    ASSERT_IS_NULL(handle);
 
     // cleanup
     real_BUFFER_delete(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_026: [mqtt_codec_subscribe shall return a BUFFER_HANDLE that represents a MQTT SUBSCRIBE message.]*/
-/* Codes_SRS_MQTT_CODEC_07_024: [mqtt_codec_subscribe shall iterate through count items in the subscribeList.] */
-TEST_FUNCTION(mqtt_codec_subscribe_trace_succeeds)
+/* Tests_SRS_MQTT_CODEC_07_014 : [If any error is encountered then mqtt_codec_publishAck shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_publish_ack_succeeds)
 {
     // arrange
-    unsigned char SUBSCRIBE_VALUE[] = { 0x82, 0x1a, 0x12, 0x34, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x01, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32, 0x02 };
+    unsigned char PUBLISH_ACK_VALUE[] = { 0x40, 0x02, 0x12, 0x34 };
 
-    STRICT_EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(STRING_concat(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_new());
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
+        .IgnoreArgument(1);
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
-    EXPECTED_CALL(STRING_concat_with_STRING(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(STRING_delete(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, TEST_TRACE_STRING_HANDLE);
+    BUFFER_HANDLE handle = mqtt_codec_publishAck(TEST_PACKET_ID);
 
     unsigned char* data = real_BUFFER_u_char(handle);
     size_t length = BUFFER_length(handle);
@@ -1180,114 +1251,134 @@ TEST_FUNCTION(mqtt_codec_subscribe_trace_succeeds)
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
     ASSERT_IS_NOT_NULL(handle);
-    ASSERT_ARE_EQUAL(int, 0, memcmp(data, SUBSCRIBE_VALUE, length));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_ACK_VALUE, length));
 
     // cleanup
     real_BUFFER_delete(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_027: [If the parameters unsubscribeList is NULL or if count is 0 then mqtt_codec_unsubscribe shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_unsubscribe_subscribeList_NULL_fails)
+/* Codes_SRS_MQTT_CODEC_07_016 : [If any error is encountered then mqtt_codec_publishRecieved shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_publish_received_pre_build_fail)
 {
     // arrange
+    STRICT_EXPECTED_CALL(BUFFER_new());
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
+        .IgnoreArgument(1)
+        .SetReturn(MU_FAILURE);
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, NULL, 0, NULL);
+    BUFFER_HANDLE handle = mqtt_codec_publishReceived(TEST_PACKET_ID);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
     ASSERT_IS_NULL(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_029: [If any error is encountered then mqtt_codec_unsubscribe shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_unsubscribe_BUFFER_enlarge_fails)
+/* Codes_SRS_MQTT_CODEC_07_015: [On success mqtt_codec_publishRecieved shall return a BUFFER_HANDLE representation of a MQTT PUBREC packet.] */
+TEST_FUNCTION(mqtt_codec_publish_received_succeeds)
 {
     // arrange
+    unsigned char PUBLISH_ACK_VALUE[] = { 0x50, 0x02, 0x12, 0x34 };
+
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
+        .IgnoreArgument(1);
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, NULL);
+    BUFFER_HANDLE handle = mqtt_codec_publishReceived(TEST_PACKET_ID);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NULL(handle);
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_ACK_VALUE, length));
+
+    // cleanup
+    real_BUFFER_delete(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_029: [If any error is encountered then mqtt_codec_unsubscribe shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_unsubscribe_addListItemToUnsubscribePacket_BUFFER_enlarge_fails)
+/* Codes_SRS_MQTT_CODEC_07_018 : [If any error is encountered then mqtt_codec_publishRelease shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_publish_release_pre_build_fail)
 {
     // arrange
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
+        .IgnoreArgument(1)
+        .SetReturn(MU_FAILURE);
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, NULL);
+    BUFFER_HANDLE handle = mqtt_codec_publishRelease(TEST_PACKET_ID);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
     ASSERT_IS_NULL(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_029: [If any error is encountered then mqtt_codec_unsubscribe shall return NULL.] */
-TEST_FUNCTION(mqtt_codec_unsubscribe_constructFixedHeader_fails)
+/* Codes_SRS_MQTT_CODEC_07_017: [On success mqtt_codec_publishRelease shall return a BUFFER_HANDLE representation of a MQTT PUBREL packet.] */
+TEST_FUNCTION(mqtt_codec_publish_release_succeeds)
 {
     // arrange
+    unsigned char PUBLISH_ACK_VALUE[] = { 0x62, 0x02, 0x12, 0x34 };
+
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
+        .IgnoreArgument(1);
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publishRelease(TEST_PACKET_ID);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_ACK_VALUE, length));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_020 : [If any error is encountered then mqtt_codec_publishComplete shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_publish_complete_pre_build_fail)
+{
+    // arrange
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
+        .IgnoreArgument(1)
+        .SetReturn(MU_FAILURE);
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, NULL);
+    BUFFER_HANDLE handle = mqtt_codec_publishComplete(TEST_PACKET_ID);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
     ASSERT_IS_NULL(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_030: [mqtt_codec_unsubscribe shall return a BUFFER_HANDLE that represents a MQTT SUBSCRIBE message.] */
-TEST_FUNCTION(mqtt_codec_unsubscribe_succeeds)
+/* Codes_SRS_MQTT_CODEC_07_019: [On success mqtt_codec_publishComplete shall return a BUFFER_HANDLE representation of a MQTT PUBCOMP packet.] */
+TEST_FUNCTION(mqtt_codec_publish_complete_succeeds)
 {
     // arrange
-    unsigned char UNSUBSCRIBE_VALUE[] = { 0xa2, 0x18, 0x12, 0x34, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32 };
-
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    unsigned char PUBLISH_COMP_VALUE[] = { 0x70, 0x02, 0x12, 0x34 };
 
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 4))
+        .IgnoreArgument(1);
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, NULL);
+    BUFFER_HANDLE handle = mqtt_codec_publishComplete(TEST_PACKET_ID);
 
     unsigned char* data = real_BUFFER_u_char(handle);
     size_t length = BUFFER_length(handle);
@@ -1295,19 +1386,137 @@ TEST_FUNCTION(mqtt_codec_unsubscribe_succeeds)
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
     ASSERT_IS_NOT_NULL(handle);
-    ASSERT_ARE_EQUAL(int, 0, memcmp(data, UNSUBSCRIBE_VALUE, length));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_COMP_VALUE, length));
 
     // cleanup
     real_BUFFER_delete(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_030: [mqtt_codec_unsubscribe shall return a BUFFER_HANDLE that represents a MQTT SUBSCRIBE message.] */
-TEST_FUNCTION(mqtt_codec_unsubscribe_trace_succeeds)
+/* Tests_SRS_MQTT_CODEC_07_073: [ If packet is NULL then mqtt_codec_encode_puback, mqtt_codec_encode_pubrec, mqtt_codec_encode_pubrel and mqtt_codec_encode_pubcomp shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_codec_encode_puback_packet_NULL_fails)
 {
     // arrange
-    unsigned char UNSUBSCRIBE_VALUE[] = { 0xa2, 0x18, 0x12, 0x34, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32 };
 
-    STRICT_EXPECTED_CALL(BUFFER_new());
+    // act
+    int result = mqtt_codec_encode_puback(TEST_PACKET_ID, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_074: [ mqtt_codec_encode_puback, mqtt_codec_encode_pubrec, mqtt_codec_encode_pubrel and mqtt_codec_encode_pubcomp shall write the MQTT_CODEC_PUBLISH_REPLY_SIZE bytes of the PUBACK, PUBREC, PUBREL or PUBCOMP packet for packetId into packet without allocating and return 0. ] */
+TEST_FUNCTION(mqtt_codec_encode_publish_replies_succeed)
+{
+    // arrange
+    const unsigned char PUBLISH_ACK_VALUE[] = { 0x40, 0x02, 0x12, 0x34 };
+    const unsigned char PUBLISH_REC_VALUE[] = { 0x50, 0x02, 0x12, 0x34 };
+    const unsigned char PUBLISH_REL_VALUE[] = { 0x62, 0x02, 0x12, 0x34 };
+    const unsigned char PUBLISH_COMP_VALUE[] = { 0x70, 0x02, 0x12, 0x34 };
+    uint8_t packet[4][MQTT_CODEC_PUBLISH_REPLY_SIZE];
+
+    // act
+    int ackResult = mqtt_codec_encode_puback(TEST_PACKET_ID, packet[0]);
+    int recResult = mqtt_codec_encode_pubrec(TEST_PACKET_ID, packet[1]);
+    int relResult = mqtt_codec_encode_pubrel(TEST_PACKET_ID, packet[2]);
+    int compResult = mqtt_codec_encode_pubcomp(TEST_PACKET_ID, packet[3]);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, ackResult);
+    ASSERT_ARE_EQUAL(int, 0, recResult);
+    ASSERT_ARE_EQUAL(int, 0, relResult);
+    ASSERT_ARE_EQUAL(int, 0, compResult);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(packet[0], PUBLISH_ACK_VALUE, MQTT_CODEC_PUBLISH_REPLY_SIZE));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(packet[1], PUBLISH_REC_VALUE, MQTT_CODEC_PUBLISH_REPLY_SIZE));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(packet[2], PUBLISH_REL_VALUE, MQTT_CODEC_PUBLISH_REPLY_SIZE));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(packet[3], PUBLISH_COMP_VALUE, MQTT_CODEC_PUBLISH_REPLY_SIZE));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_075: [ If packet is NULL then mqtt_codec_encode_pingreq and mqtt_codec_encode_disconnect shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_codec_encode_pingreq_packet_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_codec_encode_pingreq(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_076: [ mqtt_codec_encode_pingreq and mqtt_codec_encode_disconnect shall write the MQTT_CODEC_EMPTY_PACKET_SIZE bytes of the PINGREQ or DISCONNECT packet into packet without allocating and return 0. ] */
+TEST_FUNCTION(mqtt_codec_encode_pingreq_disconnect_succeed)
+{
+    // arrange
+    const unsigned char PING_VALUE[] = { 0xC0, 0x00 };
+    const unsigned char DISCONNECT_VALUE[] = { 0xE0, 0x00 };
+    uint8_t ping[MQTT_CODEC_EMPTY_PACKET_SIZE];
+    uint8_t disconnect[MQTT_CODEC_EMPTY_PACKET_SIZE];
+
+    // act
+    int pingResult = mqtt_codec_encode_pingreq(ping);
+    int disconnectResult = mqtt_codec_encode_disconnect(disconnect);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, pingResult);
+    ASSERT_ARE_EQUAL(int, 0, disconnectResult);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(ping, PING_VALUE, MQTT_CODEC_EMPTY_PACKET_SIZE));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(disconnect, DISCONNECT_VALUE, MQTT_CODEC_EMPTY_PACKET_SIZE));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Codes_SRS_MQTT_CODEC_07_023: [If the parameters subscribeList is NULL or if count is 0 then mqtt_codec_subscribe shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_subscribe_subscribeList_NULL_fails)
+{
+    // arrange
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, NULL, 0, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_025: [If any error is encountered then mqtt_codec_subscribe shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_subscribe_BUFFER_enlarge_fails)
+{
+    // arrange
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_025: [If any error is encountered then mqtt_codec_subscribe shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_subscribe_addListItemsToSubscribePacket_fails)
+{
+    // arrange
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_025: [If any error is encountered then mqtt_codec_subscribe shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_subscribe_constructFixedHeader_fails)
+{
+    // arrange
+    EXPECTED_CALL(BUFFER_new());
     EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
@@ -1316,7 +1525,79 @@ TEST_FUNCTION(mqtt_codec_unsubscribe_trace_succeeds)
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(STRING_copy(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_026: [mqtt_codec_subscribe shall return a BUFFER_HANDLE that represents a MQTT SUBSCRIBE message.]*/
+/* Codes_SRS_MQTT_CODEC_07_024: [mqtt_codec_subscribe shall iterate through count items in the subscribeList.] */
+TEST_FUNCTION(mqtt_codec_subscribe_succeeds)
+{
+    // arrange
+    unsigned char SUBSCRIBE_VALUE[] = { 0x82, 0x1a, 0x12, 0x34, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x01, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32, 0x02 };
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, NULL);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, SUBSCRIBE_VALUE, length));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_026: [mqtt_codec_subscribe shall return a BUFFER_HANDLE that represents a MQTT SUBSCRIBE message.]*/
+/* Codes_SRS_MQTT_CODEC_07_024: [mqtt_codec_subscribe shall iterate through count items in the subscribeList.] */
+TEST_FUNCTION(mqtt_codec_subscribe_trace_succeeds)
+{
+    // arrange
+    unsigned char SUBSCRIBE_VALUE[] = { 0x82, 0x1a, 0x12, 0x34, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x01, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32, 0x02 };
+
+    STRICT_EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(STRING_concat(IGNORED_ARG, IGNORED_ARG));
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
     STRICT_EXPECTED_CALL(BUFFER_new());
     EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
@@ -1328,76 +1609,854 @@ TEST_FUNCTION(mqtt_codec_unsubscribe_trace_succeeds)
     EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
 
     // act
-    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, TEST_TRACE_STRING_HANDLE);
+    BUFFER_HANDLE handle = mqtt_codec_subscribe(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, TEST_TRACE_STRING_HANDLE);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, SUBSCRIBE_VALUE, length));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_064: [mqtt_codec_subscribe_v5 shall encode the packet like mqtt_codec_subscribe with an empty property block after the packet id.] */
+TEST_FUNCTION(mqtt_codec_subscribe_v5_succeeds)
+{
+    // arrange
+    unsigned char SUBSCRIBE_VALUE[] = { 0x82, 0x1b, 0x12, 0x34, 0x00, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x01, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32, 0x02 };
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_subscribe_v5(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, NULL);
 
     unsigned char* data = real_BUFFER_u_char(handle);
     size_t length = BUFFER_length(handle);
 
     // assert
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-    ASSERT_IS_NOT_NULL(handle);
-    ASSERT_ARE_EQUAL(int, 0, memcmp(data, UNSUBSCRIBE_VALUE, length));
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(SUBSCRIBE_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, SUBSCRIBE_VALUE, length));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_027: [If the parameters unsubscribeList is NULL or if count is 0 then mqtt_codec_unsubscribe shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_unsubscribe_subscribeList_NULL_fails)
+{
+    // arrange
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, NULL, 0, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_029: [If any error is encountered then mqtt_codec_unsubscribe shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_unsubscribe_BUFFER_enlarge_fails)
+{
+    // arrange
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_029: [If any error is encountered then mqtt_codec_unsubscribe shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_unsubscribe_addListItemToUnsubscribePacket_BUFFER_enlarge_fails)
+{
+    // arrange
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_029: [If any error is encountered then mqtt_codec_unsubscribe shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_unsubscribe_constructFixedHeader_fails)
+{
+    // arrange
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG)).SetReturn(MU_FAILURE);
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_030: [mqtt_codec_unsubscribe shall return a BUFFER_HANDLE that represents a MQTT SUBSCRIBE message.] */
+TEST_FUNCTION(mqtt_codec_unsubscribe_succeeds)
+{
+    // arrange
+    unsigned char UNSUBSCRIBE_VALUE[] = { 0xa2, 0x18, 0x12, 0x34, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32 };
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, NULL);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, UNSUBSCRIBE_VALUE, length));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_030: [mqtt_codec_unsubscribe shall return a BUFFER_HANDLE that represents a MQTT SUBSCRIBE message.] */
+TEST_FUNCTION(mqtt_codec_unsubscribe_trace_succeeds)
+{
+    // arrange
+    unsigned char UNSUBSCRIBE_VALUE[] = { 0xa2, 0x18, 0x12, 0x34, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32 };
+
+    STRICT_EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(STRING_copy(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(STRING_concat_with_STRING(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(STRING_delete(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_unsubscribe(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, TEST_TRACE_STRING_HANDLE);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, UNSUBSCRIBE_VALUE, length));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_065: [mqtt_codec_unsubscribe_v5 shall encode the packet like mqtt_codec_unsubscribe with an empty property block after the packet id.] */
+TEST_FUNCTION(mqtt_codec_unsubscribe_v5_succeeds)
+{
+    // arrange
+    unsigned char UNSUBSCRIBE_VALUE[] = { 0xa2, 0x19, 0x12, 0x34, 0x00, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32 };
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_prepend(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_unsubscribe_v5(TEST_PACKET_ID, TEST_UNSUBSCRIPTION_TOPIC, 2, NULL);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(UNSUBSCRIBE_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, UNSUBSCRIBE_VALUE, length));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_031: [If the parameters handle or buffer is NULL then mqtt_codec_bytesReceived shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_MQTTCODEC_HANDLE_fails)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x20, 0x2, 0x1, 0x0 };
+
+    // act
+    mqtt_codec_bytesReceived(NULL, CONNACK_RESP, 1);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Codes_SRS_MQTT_CODEC_07_031: [If the parameters handle or buffer is NULL then mqtt_codec_bytesReceived shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_NULL_fails)
+{
+    // arrange
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_codec_bytesReceived(handle, NULL, 1);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_032: [If the parameters size is zero then mqtt_codec_bytesReceived shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_Len_0_fails)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x20, 0x2, 0x1, 0x0 };
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_codec_bytesReceived(handle, CONNACK_RESP, 0);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_BUFFER_pre_build_fails)
+{
+    // arrange
+    int result;
+    g_curr_packet_type = UNSUBACK_TYPE;
+
+    unsigned char UNSUBACK_RESP[] = { 0xB0, 0x5, 0x12, 0x34, 0x01, 0x80, 0x02 };
+    size_t length = sizeof(UNSUBACK_RESP) / sizeof(UNSUBACK_RESP[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = UNSUBACK_RESP + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG).SetReturn(MU_FAILURE));
+
+    // act
+    result = mqtt_codec_bytesReceived(handle, UNSUBACK_RESP, length);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, result, 0);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_BUFFER_new_fails)
+{
+    // arrange
+    int result;
+    g_curr_packet_type = UNSUBACK_TYPE;
+
+    unsigned char UNSUBACK_RESP[] = { 0xB0, 0x5, 0x12, 0x34, 0x01, 0x80, 0x02 };
+    size_t length = sizeof(UNSUBACK_RESP) / sizeof(UNSUBACK_RESP[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = UNSUBACK_RESP + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new().SetReturn(NULL));
+
+    // act
+    result = mqtt_codec_bytesReceived(handle, UNSUBACK_RESP, length);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, result, 0);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_connack_succeed)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x20, 0x2, 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = CONNACK_RESP + FIXED_HEADER_SIZE;
+    testData.Length = 2;
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    g_curr_packet_type = CONNACK_TYPE;
+
+    // act
+    for (size_t index = 0; index < length; index++)
+    {
+        // Send 1 byte at a time
+        mqtt_codec_bytesReceived(handle, CONNACK_RESP+index, 1);
+    }
+
+    // assert
+    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_too_large_fail)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x20, 0xFF, 0xFF, 0xFF, 0x8F, 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = CONNACK_RESP + FIXED_HEADER_SIZE;
+    testData.Length = 2;
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    g_curr_packet_type = CONNACK_TYPE;
+
+    // act
+    int result = mqtt_codec_bytesReceived(handle, CONNACK_RESP, length);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_IS_FALSE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+// Tests that a malformed Remaining Length (four continuation bytes that drive
+// remainLenIndex to its maximum) followed by another segment of continuation
+// bytes does not produce a heap out-of-bounds write into storeRemainLen.
+TEST_FUNCTION(mqtt_codec_bytesReceived_malformed_remaining_length_no_oob_fail)
+{
+    // arrange
+    // Segment 1: PUBLISH type byte + four continuation Remaining-Length bytes.
+    unsigned char MALFORMED_SEG_1[] = { 0x30, 0x80, 0x80, 0x80, 0x80 };
+    // Segment 2: additional continuation bytes that, before the fix, were
+    // written one slot past the 4-byte storeRemainLen array on each iteration.
+    unsigned char MALFORMED_SEG_2[] = { 0x80, 0x80, 0x80, 0x80 };
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    g_curr_packet_type = PUBLISH_TYPE;
+
+    // act
+    int result_seg_1 = mqtt_codec_bytesReceived(handle, MALFORMED_SEG_1, sizeof(MALFORMED_SEG_1) / sizeof(MALFORMED_SEG_1[0]));
+    int result_seg_2 = mqtt_codec_bytesReceived(handle, MALFORMED_SEG_2, sizeof(MALFORMED_SEG_2) / sizeof(MALFORMED_SEG_2[0]));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_seg_1);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_seg_2);
+    ASSERT_IS_FALSE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+TEST_FUNCTION(mqtt_codec_bytesReceived_after_large_buffer_succeed)
+{
+    // arrange
+    unsigned char LARGE_CONNACK_RESP[] = { 0x20, 0xFF, 0xFF, 0xFF, 0x8F, 0x1, 0x0 };
+    unsigned char CONNACK_RESP[] = { 0x20, 0x2, 0x00, 0x05 };
+    size_t large_len = sizeof(LARGE_CONNACK_RESP) / sizeof(LARGE_CONNACK_RESP[0]);
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = CONNACK_RESP + FIXED_HEADER_SIZE;
+    testData.Length = 2;
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    int result = mqtt_codec_bytesReceived(handle, LARGE_CONNACK_RESP, large_len);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    mqtt_codec_reset(handle);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_new());
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    g_curr_packet_type = CONNACK_TYPE;
+
+    // act
+    result = mqtt_codec_bytesReceived(handle, CONNACK_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+TEST_FUNCTION(mqtt_codec_bytesReceived_connack_auth_reject_succeed)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] ={ 0x20, 0x2, 0x00, 0x05 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData ={ 0 };
+    testData.dataHeader = CONNACK_RESP + FIXED_HEADER_SIZE;
+    testData.Length = 2;
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    g_curr_packet_type = CONNACK_TYPE;
+
+    // act
+    int result = mqtt_codec_bytesReceived(handle, CONNACK_RESP, length);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_publish_2_succeed)
+{
+    g_curr_packet_type = PUBLISH_TYPE;
+
+    // arrange
+    unsigned char PUBLISH_RESP_1[] = { 0x30, 0x7f, 0x00, 0x04, 0x6d, 0x73, 0x67, 0x42, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41 };
+    unsigned char PUBLISH_RESP_2[] = { 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41 };
+    unsigned char PUBLISH_RESP_3[] = { 0x41 };
+
+    unsigned char PUBLISH_RESULT[] = { 0x30, 0x7f, 0x00, 0x04, 0x6d, 0x73, 0x67, 0x42, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41 };
+    size_t length = sizeof(PUBLISH_RESULT) / sizeof(PUBLISH_RESULT[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = PUBLISH_RESULT + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+
+    // act
+    mqtt_codec_bytesReceived(handle, PUBLISH_RESP_1, sizeof(PUBLISH_RESP_1) / sizeof(PUBLISH_RESP_1[0]));
+    mqtt_codec_bytesReceived(handle, PUBLISH_RESP_2, sizeof(PUBLISH_RESP_2) / sizeof(PUBLISH_RESP_2[0]));
+    mqtt_codec_bytesReceived(handle, PUBLISH_RESP_3, sizeof(PUBLISH_RESP_3) / sizeof(PUBLISH_RESP_3[0]));
+
+    // assert
+    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_puback_succeed)
+{
+    // arrange
+    unsigned char PUBACK_RESP[] = { 0x40, 0x2, 0x12, 0x34 };
+    size_t length = sizeof(PUBACK_RESP) / sizeof(PUBACK_RESP[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = PUBACK_RESP + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    g_curr_packet_type = PUBACK_TYPE;
+
+    // act
+    for (size_t index = 0; index < length; index++)
+    {
+        // Send 1 byte at a time
+        mqtt_codec_bytesReceived(handle, PUBACK_RESP + index, 1);
+    }
+
+    // assert
+    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_pingresp_succeed)
+{
+    // arrange
+    unsigned char PINGRESP_RESP[] = { 0xD0, 0x0 };
+    size_t length = sizeof(PINGRESP_RESP) / sizeof(PINGRESP_RESP[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    g_curr_packet_type = PINGRESP_TYPE;
+
+    // act
+    for (size_t index = 0; index < length; index++)
+    {
+        // Send 1 byte at a time
+        mqtt_codec_bytesReceived(handle, PINGRESP_RESP + index, 1);
+    }
+
+    // assert
+    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+TEST_FUNCTION(mqtt_codec_bytesReceived_publish_long_message_succeed)
+{
+    // arrange
+    g_curr_packet_type = PUBLISH_TYPE;
+
+    unsigned char PUBLISH[] = {
+        0x32,  0xdc,  0x01,  0x00,  0xd5,  0x64,  0x65,  0x76,  0x69,  0x63,  0x65,  0x73,  0x2f,  0x74,  0x65,  0x73,  0x74,  0x44,  0x65,  0x76,  0x69,
+        0x63,  0x65,  0x2f,  0x6d,  0x65,  0x73,  0x73,  0x61,  0x67,  0x65,  0x73,  0x2f,  0x64,  0x65,  0x76,  0x69,  0x63,  0x65,  0x62,  0x6f,
+        0x75,  0x6e,  0x64,  0x2f,  0x69,  0x6f,  0x74,  0x68,  0x75,  0x62,  0x2d,  0x61,  0x63,  0x6b,  0x3d,  0x66,  0x75,  0x6c,  0x6c,  0x26,
+        0x25,  0x32,  0x34,  0x2e,  0x6d,  0x69,  0x64,  0x3d,  0x37,  0x35,  0x63,  0x65,  0x63,  0x30,  0x62,  0x32,  0x2d,  0x66,  0x30,  0x36,
+        0x39,  0x2d,  0x34,  0x66,  0x32,  0x61,  0x2d,  0x39,  0x38,  0x39,  0x35,  0x2d,  0x66,  0x31,  0x62,  0x35,  0x30,  0x34,  0x36,  0x62,
+        0x31,  0x34,  0x35,  0x63,  0x26,  0x25,  0x32,  0x34,  0x2e,  0x74,  0x6f,  0x3d,  0x25,  0x32,  0x46,  0x64,  0x65,  0x76,  0x69,  0x63,
+        0x65,  0x73,  0x25,  0x32,  0x46,  0x74,  0x65,  0x73,  0x74,  0x44,  0x65,  0x76,  0x69,  0x63,  0x65,  0x25,  0x32,  0x46,  0x6d,  0x65,
+        0x73,  0x73,  0x61,  0x67,  0x65,  0x73,  0x25,  0x32,  0x46,  0x64,  0x65,  0x76,  0x69,  0x63,  0x65,  0x42,  0x6f,  0x75,  0x6e,  0x64,
+        0x26,  0x25,  0x32,  0x34,  0x2e,  0x63,  0x69,  0x64,  0x26,  0x25,  0x32,  0x34,  0x2e,  0x75,  0x69,  0x64,  0x3d,  0x53,  0x79,  0x73,
+        0x74,  0x65,  0x6d,  0x2e,  0x41,  0x72,  0x72,  0x61,  0x79,  0x53,  0x65,  0x67,  0x6d,  0x65,  0x6e,  0x74,  0x25,  0x36,  0x30,  0x31,
+        0x25,  0x35,  0x42,  0x53,  0x79,  0x73,  0x74,  0x65,  0x6d,  0x2e,  0x42,  0x79,  0x74,  0x65,  0x25,  0x35,  0x44,  0x00,  0x0e,  0x4d,
+        0x4c,  0x42
+    };
+    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
+
+    // Need to add 1 because the size if two bytes instead of 1
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = PUBLISH + (FIXED_HEADER_SIZE + 1);
+    testData.Length = length - (FIXED_HEADER_SIZE + 1);
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    // act
+    for (size_t index = 0; index < length; index++)
+    {
+        // Send 1 byte at a time
+        mqtt_codec_bytesReceived(handle, PUBLISH + index, 1);
+    }
+
+    // assert
+    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_publish_succeed)
+{
+    // arrange
+    g_curr_packet_type = PUBLISH_TYPE;
+
+    //                            1    2     3     4     T     o     p     i     c     10    11    d     a     t     a     sp    M     s     g
+    unsigned char PUBLISH[] = { 0x3F, 0x11, 0x00, 0x06, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x12, 0x34, 0x64, 0x61, 0x74, 0x61, 0x20, 0x4d, 0x73, 0x67 };
+    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = PUBLISH + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    // act
+    for (size_t index = 0; index < length; index++)
+    {
+        // Send 1 byte at a time
+        mqtt_codec_bytesReceived(handle, PUBLISH + index, 1);
+    }
+
+    // assert
+    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
-    real_BUFFER_delete(handle);
+    mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_031: [If the parameters handle or buffer is NULL then mqtt_codec_bytesReceived shall return a non-zero value.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_MQTTCODEC_HANDLE_fails)
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_publish_full_succeed)
 {
     // arrange
-    unsigned char CONNACK_RESP[] = { 0x20, 0x2, 0x1, 0x0 };
+    g_curr_packet_type = PUBLISH_TYPE;
+
+    //                            1    2     3     4     T     o     p     i     c     10    11    d     a     t     a     sp    M     s     g
+    unsigned char PUBLISH[] = { 0x3F, 0x11, 0x00, 0x06, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x12, 0x34, 0x64, 0x61, 0x74, 0x61, 0x20, 0x4d, 0x73, 0x67 };
+    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = PUBLISH + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
-    mqtt_codec_bytesReceived(NULL, CONNACK_RESP, 1);
+    mqtt_codec_bytesReceived(handle, PUBLISH, length);
 
     // assert
+    ASSERT_IS_TRUE(g_callbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_031: [If the parameters handle or buffer is NULL then mqtt_codec_bytesReceived shall return a non-zero value.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_NULL_fails)
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_publish_second_succeed)
 {
     // arrange
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    g_curr_packet_type = PUBLISH_TYPE;
+
+    //                            1    2     3     4     T     o     p     i     c     10    11    d     a     t     a     sp    M     s     g
+    unsigned char PUBLISH[] = { 0x30, 0x1e, 0x00, 0x04, 0x6d, 0x73, 0x67, 0x41, 0x00, 0x16, 0x54, 0x68, 0x69, 0x73, 0x20, 0x69, 0x73, 0x20, 0x74, 0x68, 0x65, 0x20, 0x61, 0x70, 0x70, 0x20, 0x6d, 0x73, 0x67, 0x20, 0x41, 0x2e };
+    //unsigned char PUBLISH[] = { 0x3F, 0x11, 0x00, 0x06, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x12, 0x34, 0x64, 0x61, 0x74, 0x61, 0x20, 0x4d, 0x73, 0x67 };
+    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = PUBLISH + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
 
     umock_c_reset_all_calls();
 
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
     // act
-    mqtt_codec_bytesReceived(handle, NULL, 1);
+    for (size_t index = 0; index < length; index++)
+    {
+        // Send 1 byte at a time
+        mqtt_codec_bytesReceived(handle, PUBLISH + index, 1);
+    }
 
     // assert
+    ASSERT_IS_TRUE(g_callbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_032: [If the parameters size is zero then mqtt_codec_bytesReceived shall return a non-zero value.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_Len_0_fails)
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_suback_succeed)
 {
     // arrange
-    unsigned char CONNACK_RESP[] = { 0x20, 0x2, 0x1, 0x0 };
+    g_curr_packet_type = SUBACK_TYPE;
 
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    unsigned char SUBACK_RESP[] = { 0x90, 0x5, 0x12, 0x34, 0x01, 0x80, 0x02 };
+    size_t length = sizeof(SUBACK_RESP) / sizeof(SUBACK_RESP[0]);
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = SUBACK_RESP + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
 
     umock_c_reset_all_calls();
 
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
     // act
-    mqtt_codec_bytesReceived(handle, CONNACK_RESP, 0);
+    for (size_t index = 0; index < length; index++)
+    {
+        // Send 1 byte at a time
+        mqtt_codec_bytesReceived(handle, SUBACK_RESP + index, 1);
+    }
 
     // assert
+    ASSERT_IS_TRUE(g_callbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_BUFFER_pre_build_fails)
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_unsuback_succeed)
 {
     // arrange
-    int result;
     g_curr_packet_type = UNSUBACK_TYPE;
 
     unsigned char UNSUBACK_RESP[] = { 0xB0, 0x5, 0x12, 0x34, 0x01, 0x80, 0x02 };
@@ -1411,83 +2470,94 @@ TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_BUFFER_pre_build_fails)
     umock_c_reset_all_calls();
 
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG).SetReturn(MU_FAILURE));
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
-    result = mqtt_codec_bytesReceived(handle, UNSUBACK_RESP, length);
+    for (size_t index = 0; index < length; index++)
+    {
+        // Send 1 byte at a time
+        mqtt_codec_bytesReceived(handle, UNSUBACK_RESP + index, 1);
+    }
 
     // assert
-    ASSERT_ARE_NOT_EQUAL(int, result, 0);
+    ASSERT_IS_TRUE(g_callbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_BUFFER_new_fails)
+/* Codes_SRS_MQTT_CODEC_07_038: [mqtt_codec_bytesReceived shall copy as many bytes of the variable header and payload as are available in buffer in a single operation, up to the Remaining Length of the packet.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_multiple_packets_single_buffer_succeed)
 {
     // arrange
-    int result;
-    g_curr_packet_type = UNSUBACK_TYPE;
-
-    unsigned char UNSUBACK_RESP[] = { 0xB0, 0x5, 0x12, 0x34, 0x01, 0x80, 0x02 };
-    size_t length = sizeof(UNSUBACK_RESP) / sizeof(UNSUBACK_RESP[0]);
+    unsigned char PUBACK_RESP[] = { 0x40, 0x2, 0x12, 0x34, 0x40, 0x2, 0x12, 0x34, 0x40, 0x2, 0x12, 0x34 };
+    size_t length = sizeof(PUBACK_RESP) / sizeof(PUBACK_RESP[0]);
 
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = UNSUBACK_RESP + FIXED_HEADER_SIZE;
-    testData.Length = length - FIXED_HEADER_SIZE;
+    testData.dataHeader = PUBACK_RESP + FIXED_HEADER_SIZE;
+    testData.Length = 2;
+
     MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
 
     umock_c_reset_all_calls();
 
-    EXPECTED_CALL(BUFFER_new().SetReturn(NULL));
+    for (size_t index = 0; index < 3; index++)
+    {
+        EXPECTED_CALL(BUFFER_new());
+        EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 2));
+        EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+        EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    }
+
+    g_curr_packet_type = PUBACK_TYPE;
 
     // act
-    result = mqtt_codec_bytesReceived(handle, UNSUBACK_RESP, length);
+    int result = mqtt_codec_bytesReceived(handle, PUBACK_RESP, length);
 
     // assert
-    ASSERT_ARE_NOT_EQUAL(int, result, 0);
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 3, g_callbackCount);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
-/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_connack_succeed)
+/* Codes_SRS_MQTT_CODEC_07_038: [mqtt_codec_bytesReceived shall copy as many bytes of the variable header and payload as are available in buffer in a single operation, up to the Remaining Length of the packet.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_packet_split_across_buffers_succeed)
 {
     // arrange
-    unsigned char CONNACK_RESP[] = { 0x20, 0x2, 0x1, 0x0 };
-    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    g_curr_packet_type = PUBLISH_TYPE;
+
+    unsigned char PUBLISH[] = { 0x30, 0x1e, 0x00, 0x04, 0x6d, 0x73, 0x67, 0x41, 0x00, 0x16, 0x54, 0x68, 0x69, 0x73, 0x20, 0x69, 0x73, 0x20, 0x74, 0x68, 0x65, 0x20, 0x61, 0x70, 0x70, 0x20, 0x6d, 0x73, 0x67, 0x20, 0x41, 0x2e };
+    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
+    size_t split = 11;
 
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = CONNACK_RESP + FIXED_HEADER_SIZE;
-    testData.Length = 2;
+    testData.dataHeader = PUBLISH + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
 
     MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
 
     umock_c_reset_all_calls();
 
     EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, length - FIXED_HEADER_SIZE));
     EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
-    g_curr_packet_type = CONNACK_TYPE;
-
     // act
-    for (size_t index = 0; index < length; index++)
-    {
-        // Send 1 byte at a time
-        mqtt_codec_bytesReceived(handle, CONNACK_RESP+index, 1);
-    }
+    int result_1 = mqtt_codec_bytesReceived(handle, PUBLISH, split);
+    bool invoked_after_first = g_callbackInvoked;
+    int result_2 = mqtt_codec_bytesReceived(handle, PUBLISH + split, length - split);
 
     // assert
+    ASSERT_ARE_EQUAL(int, 0, result_1);
+    ASSERT_ARE_EQUAL(int, 0, result_2);
+    ASSERT_IS_FALSE(invoked_after_first);
     ASSERT_IS_TRUE(g_callbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
@@ -1495,61 +2565,65 @@ TEST_FUNCTION(mqtt_codec_bytesReceived_connack_succeed)
     mqtt_codec_destroy(handle);
 }
 
-TEST_FUNCTION(mqtt_codec_bytesReceived_buffer_too_large_fail)
+/* Codes_SRS_MQTT_CODEC_07_039: [If the Remaining Length of a packet is zero then mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function with a NULL headerData as soon as the Remaining Length has been decoded.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_zero_length_packet_succeed)
 {
     // arrange
-    unsigned char CONNACK_RESP[] = { 0x20, 0xFF, 0xFF, 0xFF, 0x8F, 0x1, 0x0 };
-    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    unsigned char DISCONNECT_PACKET[] = { 0xE0, 0x00, 0x40, 0x2, 0x12, 0x34 };
+    size_t length = sizeof(DISCONNECT_PACKET) / sizeof(DISCONNECT_PACKET[0]);
 
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = CONNACK_RESP + FIXED_HEADER_SIZE;
-    testData.Length = 2;
 
     MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
 
     umock_c_reset_all_calls();
 
-    g_curr_packet_type = CONNACK_TYPE;
+    EXPECTED_CALL(BUFFER_delete(NULL));
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, 2));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    g_curr_packet_type = DISCONNECT_TYPE;
 
     // act
-    int result = mqtt_codec_bytesReceived(handle, CONNACK_RESP, length);
+    int result = mqtt_codec_bytesReceived(handle, DISCONNECT_PACKET, length);
 
     // assert
-    ASSERT_ARE_NOT_EQUAL(int, 0, result);
-    ASSERT_IS_FALSE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, g_callbackCount);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-// Tests that a malformed Remaining Length (four continuation bytes that drive
-// remainLenIndex to its maximum) followed by another segment of continuation
-// bytes does not produce a heap out-of-bounds write into storeRemainLen.
-TEST_FUNCTION(mqtt_codec_bytesReceived_malformed_remaining_length_no_oob_fail)
+TEST_FUNCTION(mqtt_codec_bytesReceived_BUFFER_u_char_fails)
 {
     // arrange
-    // Segment 1: PUBLISH type byte + four continuation Remaining-Length bytes.
-    unsigned char MALFORMED_SEG_1[] = { 0x30, 0x80, 0x80, 0x80, 0x80 };
-    // Segment 2: additional continuation bytes that, before the fix, were
-    // written one slot past the 4-byte storeRemainLen array on each iteration.
-    unsigned char MALFORMED_SEG_2[] = { 0x80, 0x80, 0x80, 0x80 };
+    unsigned char PUBACK_RESP[] = { 0x40, 0x2, 0x12, 0x34 };
+    size_t length = sizeof(PUBACK_RESP) / sizeof(PUBACK_RESP[0]);
 
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = PUBACK_RESP + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
 
     MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
 
     umock_c_reset_all_calls();
 
-    g_curr_packet_type = PUBLISH_TYPE;
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG)).SetReturn(NULL);
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+
+    g_curr_packet_type = PUBACK_TYPE;
 
     // act
-    int result_seg_1 = mqtt_codec_bytesReceived(handle, MALFORMED_SEG_1, sizeof(MALFORMED_SEG_1) / sizeof(MALFORMED_SEG_1[0]));
-    int result_seg_2 = mqtt_codec_bytesReceived(handle, MALFORMED_SEG_2, sizeof(MALFORMED_SEG_2) / sizeof(MALFORMED_SEG_2[0]));
+    int result = mqtt_codec_bytesReceived(handle, PUBACK_RESP, length);
 
     // assert
-    ASSERT_ARE_NOT_EQUAL(int, 0, result_seg_1);
-    ASSERT_ARE_NOT_EQUAL(int, 0, result_seg_2);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
     ASSERT_IS_FALSE(g_callbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
@@ -1557,465 +2631,428 @@ TEST_FUNCTION(mqtt_codec_bytesReceived_malformed_remaining_length_no_oob_fail)
     mqtt_codec_destroy(handle);
 }
 
-TEST_FUNCTION(mqtt_codec_bytesReceived_after_large_buffer_succeed)
+/* Codes_SRS_MQTT_CODEC_07_042: [If the complete packet is contained in buffer mqtt_codec_bytesReceived shall call the ON_PACKET_VIEW_CALLBACK function with a pointer into buffer without copying the packet.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_view_contiguous_packet_no_copy_succeed)
 {
     // arrange
-    unsigned char LARGE_CONNACK_RESP[] = { 0x20, 0xFF, 0xFF, 0xFF, 0x8F, 0x1, 0x0 };
-    unsigned char CONNACK_RESP[] = { 0x20, 0x2, 0x00, 0x05 };
-    size_t large_len = sizeof(LARGE_CONNACK_RESP) / sizeof(LARGE_CONNACK_RESP[0]);
-    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    g_curr_packet_type = PUBLISH_TYPE;
+
+    unsigned char PUBLISH[] = { 0x3F, 0x11, 0x00, 0x06, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x12, 0x34, 0x64, 0x61, 0x74, 0x61, 0x20, 0x4d, 0x73, 0x67 };
+    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
 
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = CONNACK_RESP + FIXED_HEADER_SIZE;
-    testData.Length = 2;
+    testData.dataHeader = PUBLISH + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
 
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, &testData);
 
-    int result = mqtt_codec_bytesReceived(handle, LARGE_CONNACK_RESP, large_len);
-    ASSERT_ARE_NOT_EQUAL(int, 0, result);
-    mqtt_codec_reset(handle);
     umock_c_reset_all_calls();
 
-    STRICT_EXPECTED_CALL(BUFFER_new());
-    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    STRICT_EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    STRICT_EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
-
-    g_curr_packet_type = CONNACK_TYPE;
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
-    result = mqtt_codec_bytesReceived(handle, CONNACK_RESP, length);
+    int result = mqtt_codec_bytesReceived(handle, PUBLISH, length);
 
     // assert
     ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(void_ptr, PUBLISH + FIXED_HEADER_SIZE, g_viewData);
+    ASSERT_ARE_EQUAL(size_t, length - FIXED_HEADER_SIZE, g_viewLength);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-TEST_FUNCTION(mqtt_codec_bytesReceived_connack_auth_reject_succeed)
+/* Codes_SRS_MQTT_CODEC_07_038: [mqtt_codec_bytesReceived shall copy as many bytes of the variable header and payload as are available in buffer in a single operation, up to the Remaining Length of the packet.] */
+/* Codes_SRS_MQTT_CODEC_07_043: [If the codec was created with mqtt_codec_create_with_view and a packet has to be assembled, mqtt_codec_bytesReceived shall take the buffer from the receive buffer pool of the codec.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_view_split_packet_assembled_succeed)
 {
     // arrange
-    unsigned char CONNACK_RESP[] ={ 0x20, 0x2, 0x00, 0x05 };
-    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    g_curr_packet_type = PUBLISH_TYPE;
 
-    TEST_COMPLETE_DATA_INSTANCE testData ={ 0 };
-    testData.dataHeader = CONNACK_RESP + FIXED_HEADER_SIZE;
-    testData.Length = 2;
+    unsigned char PUBLISH[] = { 0x3F, 0x11, 0x00, 0x06, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x12, 0x34, 0x64, 0x61, 0x74, 0x61, 0x20, 0x4d, 0x73, 0x67 };
+    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
+    size_t split = 7;
 
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = PUBLISH + FIXED_HEADER_SIZE;
+    testData.Length = length - FIXED_HEADER_SIZE;
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, &testData);
 
     umock_c_reset_all_calls();
 
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
-    g_curr_packet_type = CONNACK_TYPE;
-
     // act
-    int result = mqtt_codec_bytesReceived(handle, CONNACK_RESP, length);
+    int result_1 = mqtt_codec_bytesReceived(handle, PUBLISH, split);
+    int result_2 = mqtt_codec_bytesReceived(handle, PUBLISH + split, length - split);
 
     // assert
-    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, result_1);
+    ASSERT_ARE_EQUAL(int, 0, result_2);
     ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_NOT_EQUAL(void_ptr, PUBLISH + FIXED_HEADER_SIZE, g_viewData);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
-/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_publish_2_succeed)
+/* Codes_SRS_MQTT_CODEC_07_039: [If the Remaining Length of a packet is zero then mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function with a NULL headerData as soon as the Remaining Length has been decoded.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_view_pingresp_succeed)
 {
-    g_curr_packet_type = PUBLISH_TYPE;
-
     // arrange
-    unsigned char PUBLISH_RESP_1[] = { 0x30, 0x7f, 0x00, 0x04, 0x6d, 0x73, 0x67, 0x42, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41 };
-    unsigned char PUBLISH_RESP_2[] = { 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41 };
-    unsigned char PUBLISH_RESP_3[] = { 0x41 };
+    g_curr_packet_type = PINGRESP_TYPE;
 
-    unsigned char PUBLISH_RESULT[] = { 0x30, 0x7f, 0x00, 0x04, 0x6d, 0x73, 0x67, 0x42, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41, 0x41 };
-    size_t length = sizeof(PUBLISH_RESULT) / sizeof(PUBLISH_RESULT[0]);
+    unsigned char PINGRESP_RESP[] = { 0xD0, 0x0 };
+    size_t length = sizeof(PINGRESP_RESP) / sizeof(PINGRESP_RESP[0]);
 
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = PUBLISH_RESULT + FIXED_HEADER_SIZE;
-    testData.Length = length - FIXED_HEADER_SIZE;
 
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, &testData);
 
     umock_c_reset_all_calls();
 
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    for (size_t index = 0; index < testData.Length; index++)
-    {
-        EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-        EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    }
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
-
     // act
-    mqtt_codec_bytesReceived(handle, PUBLISH_RESP_1, sizeof(PUBLISH_RESP_1) / sizeof(PUBLISH_RESP_1[0]));
-    mqtt_codec_bytesReceived(handle, PUBLISH_RESP_2, sizeof(PUBLISH_RESP_2) / sizeof(PUBLISH_RESP_2[0]));
-    mqtt_codec_bytesReceived(handle, PUBLISH_RESP_3, sizeof(PUBLISH_RESP_3) / sizeof(PUBLISH_RESP_3[0]));
+    int result = mqtt_codec_bytesReceived(handle, PINGRESP_RESP, length);
 
     // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_IS_NULL(g_viewData);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
-/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_puback_succeed)
+/* Codes_SRS_MQTT_CODEC_07_044: [Once the callback returns the receive buffer shall be returned to the pool if the idle buffers of the pool stay within the high water mark, otherwise it shall be freed.] */
+/* Codes_SRS_MQTT_CODEC_07_048: [mqtt_codec_get_pool_stats shall report the number of pool hits and misses, the bytes of idle buffers and the peak number of bytes held by the pool.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_view_split_packets_reuse_pool_buffer_succeed)
 {
     // arrange
-    unsigned char PUBACK_RESP[] = { 0x40, 0x2, 0x12, 0x34 };
-    size_t length = sizeof(PUBACK_RESP) / sizeof(PUBACK_RESP[0]);
+    g_curr_packet_type = PUBACK_TYPE;
+
+    unsigned char PUBACK[] = { 0x40, 0x02, 0x12, 0x34 };
+    size_t length = sizeof(PUBACK) / sizeof(PUBACK[0]);
+    MQTT_CODEC_POOL_STATS poolStats;
 
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = PUBACK_RESP + FIXED_HEADER_SIZE;
+    testData.dataHeader = PUBACK + FIXED_HEADER_SIZE;
     testData.Length = length - FIXED_HEADER_SIZE;
 
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, &testData);
+    (void)mqtt_codec_bytesReceived(handle, PUBACK, 3);
+    (void)mqtt_codec_bytesReceived(handle, PUBACK + 3, 1);
 
     umock_c_reset_all_calls();
 
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
-    g_curr_packet_type = PUBACK_TYPE;
-
     // act
-    for (size_t index = 0; index < length; index++)
-    {
-        // Send 1 byte at a time
-        mqtt_codec_bytesReceived(handle, PUBACK_RESP + index, 1);
-    }
+    int result_1 = mqtt_codec_bytesReceived(handle, PUBACK, 3);
+    int result_2 = mqtt_codec_bytesReceived(handle, PUBACK + 3, 1);
 
     // assert
-    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result_1);
+    ASSERT_ARE_EQUAL(int, 0, result_2);
+    ASSERT_ARE_EQUAL(size_t, 2, g_callbackCount);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, mqtt_codec_get_pool_stats(handle, &poolStats));
+    ASSERT_ARE_EQUAL(size_t, 1, poolStats.hits);
+    ASSERT_ARE_EQUAL(size_t, 1, poolStats.misses);
+    ASSERT_ARE_EQUAL(size_t, 64, poolStats.cachedBytes);
+    ASSERT_ARE_EQUAL(size_t, 64, poolStats.peakBytes);
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
-/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_pingresp_succeed)
+/* Codes_SRS_MQTT_CODEC_07_035: [If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_view_pool_malloc_fails)
 {
     // arrange
-    unsigned char PINGRESP_RESP[] = { 0xD0, 0x0 };
-    size_t length = sizeof(PINGRESP_RESP) / sizeof(PINGRESP_RESP[0]);
+    g_curr_packet_type = PUBACK_TYPE;
+
+    unsigned char PUBACK[] = { 0x40, 0x02, 0x12, 0x34 };
 
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = PUBACK + FIXED_HEADER_SIZE;
+    testData.Length = 2;
 
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, &testData);
 
     umock_c_reset_all_calls();
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
-    g_curr_packet_type = PINGRESP_TYPE;
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
 
     // act
-    for (size_t index = 0; index < length; index++)
-    {
-        // Send 1 byte at a time
-        mqtt_codec_bytesReceived(handle, PINGRESP_RESP + index, 1);
-    }
+    int result = mqtt_codec_bytesReceived(handle, PUBACK, 3);
 
     // assert
-    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_IS_FALSE(g_callbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-TEST_FUNCTION(mqtt_codec_bytesReceived_publish_long_message_succeed)
+/* Codes_SRS_MQTT_CODEC_07_046: [mqtt_codec_set_pool_high_water_mark shall store the maximum number of bytes of idle receive buffers the pool keeps and free any idle buffers above it.] */
+TEST_FUNCTION(mqtt_codec_set_pool_high_water_mark_frees_idle_buffers_succeed)
 {
     // arrange
-    size_t i;
-    g_curr_packet_type = PUBLISH_TYPE;
+    g_curr_packet_type = PUBACK_TYPE;
 
-    unsigned char PUBLISH[] = {
-        0x32,  0xdc,  0x01,  0x00,  0xd5,  0x64,  0x65,  0x76,  0x69,  0x63,  0x65,  0x73,  0x2f,  0x74,  0x65,  0x73,  0x74,  0x44,  0x65,  0x76,  0x69,
-        0x63,  0x65,  0x2f,  0x6d,  0x65,  0x73,  0x73,  0x61,  0x67,  0x65,  0x73,  0x2f,  0x64,  0x65,  0x76,  0x69,  0x63,  0x65,  0x62,  0x6f,
-        0x75,  0x6e,  0x64,  0x2f,  0x69,  0x6f,  0x74,  0x68,  0x75,  0x62,  0x2d,  0x61,  0x63,  0x6b,  0x3d,  0x66,  0x75,  0x6c,  0x6c,  0x26,
-        0x25,  0x32,  0x34,  0x2e,  0x6d,  0x69,  0x64,  0x3d,  0x37,  0x35,  0x63,  0x65,  0x63,  0x30,  0x62,  0x32,  0x2d,  0x66,  0x30,  0x36,
-        0x39,  0x2d,  0x34,  0x66,  0x32,  0x61,  0x2d,  0x39,  0x38,  0x39,  0x35,  0x2d,  0x66,  0x31,  0x62,  0x35,  0x30,  0x34,  0x36,  0x62,
-        0x31,  0x34,  0x35,  0x63,  0x26,  0x25,  0x32,  0x34,  0x2e,  0x74,  0x6f,  0x3d,  0x25,  0x32,  0x46,  0x64,  0x65,  0x76,  0x69,  0x63,
-        0x65,  0x73,  0x25,  0x32,  0x46,  0x74,  0x65,  0x73,  0x74,  0x44,  0x65,  0x76,  0x69,  0x63,  0x65,  0x25,  0x32,  0x46,  0x6d,  0x65,
-        0x73,  0x73,  0x61,  0x67,  0x65,  0x73,  0x25,  0x32,  0x46,  0x64,  0x65,  0x76,  0x69,  0x63,  0x65,  0x42,  0x6f,  0x75,  0x6e,  0x64,
-        0x26,  0x25,  0x32,  0x34,  0x2e,  0x63,  0x69,  0x64,  0x26,  0x25,  0x32,  0x34,  0x2e,  0x75,  0x69,  0x64,  0x3d,  0x53,  0x79,  0x73,
-        0x74,  0x65,  0x6d,  0x2e,  0x41,  0x72,  0x72,  0x61,  0x79,  0x53,  0x65,  0x67,  0x6d,  0x65,  0x6e,  0x74,  0x25,  0x36,  0x30,  0x31,
-        0x25,  0x35,  0x42,  0x53,  0x79,  0x73,  0x74,  0x65,  0x6d,  0x2e,  0x42,  0x79,  0x74,  0x65,  0x25,  0x35,  0x44,  0x00,  0x0e,  0x4d,
-        0x4c,  0x42
-    };
-    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
+    unsigned char PUBACK[] = { 0x40, 0x02, 0x12, 0x34 };
+    MQTT_CODEC_POOL_STATS poolStats;
 
-    // Need to add 1 because the size if two bytes instead of 1
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = PUBLISH + (FIXED_HEADER_SIZE + 1);
-    testData.Length = length - (FIXED_HEADER_SIZE + 1);
+    testData.dataHeader = PUBACK + FIXED_HEADER_SIZE;
+    testData.Length = 2;
 
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, &testData);
+    (void)mqtt_codec_bytesReceived(handle, PUBACK, 3);
+    (void)mqtt_codec_bytesReceived(handle, PUBACK + 3, 1);
 
     umock_c_reset_all_calls();
 
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    for (i = 0; i < testData.Length; i++)
-    {
-        EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-        EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    }
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 
     // act
-    for (size_t index = 0; index < length; index++)
-    {
-        // Send 1 byte at a time
-        mqtt_codec_bytesReceived(handle, PUBLISH + index, 1);
-    }
+    int result = mqtt_codec_set_pool_high_water_mark(handle, 0);
 
     // assert
-    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, mqtt_codec_get_pool_stats(handle, &poolStats));
+    ASSERT_ARE_EQUAL(size_t, 0, poolStats.cachedBytes);
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
-/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_publish_succeed)
+/* Codes_SRS_MQTT_CODEC_07_045: [If handle is NULL then mqtt_codec_set_pool_high_water_mark shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_set_pool_high_water_mark_handle_NULL_fails)
 {
     // arrange
-    size_t i;
-    g_curr_packet_type = PUBLISH_TYPE;
 
-    //                            1    2     3     4     T     o     p     i     c     10    11    d     a     t     a     sp    M     s     g
-    unsigned char PUBLISH[] = { 0x3F, 0x11, 0x00, 0x06, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x12, 0x34, 0x64, 0x61, 0x74, 0x61, 0x20, 0x4d, 0x73, 0x67 };
-    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = PUBLISH + FIXED_HEADER_SIZE;
-    testData.Length = length - FIXED_HEADER_SIZE;
+    // act
+    int result = mqtt_codec_set_pool_high_water_mark(NULL, 1024);
 
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
 
+/* Codes_SRS_MQTT_CODEC_07_047: [If handle or poolStats is NULL then mqtt_codec_get_pool_stats shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_get_pool_stats_NULL_param_fails)
+{
+    // arrange
+    MQTT_CODEC_POOL_STATS poolStats;
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, NULL);
     umock_c_reset_all_calls();
 
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    for (i = 0; i < testData.Length; i++)
-    {
-        EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-        EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    }
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
-
     // act
-    for (size_t index = 0; index < length; index++)
-    {
-        // Send 1 byte at a time
-        mqtt_codec_bytesReceived(handle, PUBLISH + index, 1);
-    }
+    int result_1 = mqtt_codec_get_pool_stats(NULL, &poolStats);
+    int result_2 = mqtt_codec_get_pool_stats(handle, NULL);
 
     // assert
-    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_1);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result_2);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_codec_destroy(handle);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
-/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_publish_full_succeed)
+/* Tests_SRS_MQTT_CODEC_07_066: [If a failure is encountered then mqtt_codec_recv_pool_create shall return NULL.] */
+TEST_FUNCTION(mqtt_codec_recv_pool_create_malloc_fails)
 {
     // arrange
-    size_t i;
-    g_curr_packet_type = PUBLISH_TYPE;
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
 
-    //                            1    2     3     4     T     o     p     i     c     10    11    d     a     t     a     sp    M     s     g
-    unsigned char PUBLISH[] = { 0x3F, 0x11, 0x00, 0x06, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x12, 0x34, 0x64, 0x61, 0x74, 0x61, 0x20, 0x4d, 0x73, 0x67 };
-    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
+    // act
+    MQTT_CODEC_RECV_POOL_HANDLE pool = mqtt_codec_recv_pool_create(1024);
 
-    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = PUBLISH + FIXED_HEADER_SIZE;
-    testData.Length = length - FIXED_HEADER_SIZE;
+    // assert
+    ASSERT_IS_NULL(pool);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
 
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+/* Tests_SRS_MQTT_CODEC_07_068: [If pool is NULL then mqtt_codec_recv_pool_destroy shall do nothing.] */
+TEST_FUNCTION(mqtt_codec_recv_pool_destroy_pool_NULL_succeeds)
+{
+    // arrange
 
-    umock_c_reset_all_calls();
+    // act
+    mqtt_codec_recv_pool_destroy(NULL);
 
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    for (i = 0; i < testData.Length; i++)
-    {
-        EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-        EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    }
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_070: [If handle is NULL then mqtt_codec_set_recv_pool shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_set_recv_pool_handle_NULL_fails)
+{
+    // arrange
+    MQTT_CODEC_RECV_POOL_HANDLE pool = mqtt_codec_recv_pool_create(1024);
+    umock_c_reset_all_calls();
 
     // act
-    mqtt_codec_bytesReceived(handle, PUBLISH, length);
+    int result = mqtt_codec_set_recv_pool(NULL, pool);
 
     // assert
-    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
-    mqtt_codec_destroy(handle);
+    mqtt_codec_recv_pool_destroy(pool);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
-/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_publish_second_succeed)
+/* Tests_SRS_MQTT_CODEC_07_072: [The buffer of a packet that is being assembled shall move to the new pool with the codec.] */
+TEST_FUNCTION(mqtt_codec_set_recv_pool_packet_in_progress_moves_buffer_succeeds)
 {
     // arrange
-    size_t i;
-    g_curr_packet_type = PUBLISH_TYPE;
+    g_curr_packet_type = PUBACK_TYPE;
 
-    //                            1    2     3     4     T     o     p     i     c     10    11    d     a     t     a     sp    M     s     g
-    unsigned char PUBLISH[] = { 0x30, 0x1e, 0x00, 0x04, 0x6d, 0x73, 0x67, 0x41, 0x00, 0x16, 0x54, 0x68, 0x69, 0x73, 0x20, 0x69, 0x73, 0x20, 0x74, 0x68, 0x65, 0x20, 0x61, 0x70, 0x70, 0x20, 0x6d, 0x73, 0x67, 0x20, 0x41, 0x2e };
-    //unsigned char PUBLISH[] = { 0x3F, 0x11, 0x00, 0x06, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x12, 0x34, 0x64, 0x61, 0x74, 0x61, 0x20, 0x4d, 0x73, 0x67 };
-    size_t length = sizeof(PUBLISH) / sizeof(PUBLISH[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = PUBLISH + FIXED_HEADER_SIZE;
-    testData.Length = length - FIXED_HEADER_SIZE;
+    unsigned char PUBACK[] = { 0x40, 0x02, 0x12, 0x34 };
 
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+    testData.dataHeader = PUBACK + FIXED_HEADER_SIZE;
+    testData.Length = 2;
 
+    MQTT_CODEC_POOL_STATS poolStats;
+    MQTT_CODEC_RECV_POOL_HANDLE pool = mqtt_codec_recv_pool_create(1024);
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, &testData);
+    (void)mqtt_codec_bytesReceived(handle, PUBACK, 3);
     umock_c_reset_all_calls();
 
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    for (i = 0; i < testData.Length; i++)
-    {
-        EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-        EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    }
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
-    for (size_t index = 0; index < length; index++)
-    {
-        // Send 1 byte at a time
-        mqtt_codec_bytesReceived(handle, PUBLISH + index, 1);
-    }
+    int result = mqtt_codec_set_recv_pool(handle, pool);
+    (void)mqtt_codec_bytesReceived(handle, PUBACK + 3, 1);
 
     // assert
-    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, g_callbackCount);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, mqtt_codec_get_pool_stats(handle, &poolStats));
+    ASSERT_ARE_EQUAL(size_t, 0, poolStats.misses);
+    ASSERT_ARE_EQUAL(size_t, 64, poolStats.cachedBytes);
+    ASSERT_ARE_EQUAL(size_t, 64, poolStats.peakBytes);
 
     // cleanup
     mqtt_codec_destroy(handle);
+    mqtt_codec_recv_pool_destroy(pool);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
-/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_suback_succeed)
+/* Tests_SRS_MQTT_CODEC_07_067: [mqtt_codec_recv_pool_create shall return an empty receive buffer pool that keeps up to highWaterMark bytes of idle buffers.] */
+/* Tests_SRS_MQTT_CODEC_07_071: [mqtt_codec_set_recv_pool shall take receive buffers from pool from then on, or from the pool of the codec if pool is NULL.] */
+TEST_FUNCTION(mqtt_codec_set_recv_pool_shared_between_codecs_succeeds)
 {
     // arrange
-    size_t i;
-    g_curr_packet_type = SUBACK_TYPE;
+    g_curr_packet_type = PUBACK_TYPE;
 
-    unsigned char SUBACK_RESP[] = { 0x90, 0x5, 0x12, 0x34, 0x01, 0x80, 0x02 };
-    size_t length = sizeof(SUBACK_RESP) / sizeof(SUBACK_RESP[0]);
+    unsigned char PUBACK[] = { 0x40, 0x02, 0x12, 0x34 };
+    MQTT_CODEC_POOL_STATS poolStats;
 
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = SUBACK_RESP + FIXED_HEADER_SIZE;
-    testData.Length = length - FIXED_HEADER_SIZE;
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+    testData.dataHeader = PUBACK + FIXED_HEADER_SIZE;
+    testData.Length = 2;
 
+    MQTT_CODEC_RECV_POOL_HANDLE pool = mqtt_codec_recv_pool_create(1024);
+    MQTTCODEC_HANDLE handle_1 = mqtt_codec_create_with_view(TestOnViewCallback, &testData);
+    MQTTCODEC_HANDLE handle_2 = mqtt_codec_create_with_view(TestOnViewCallback, &testData);
     umock_c_reset_all_calls();
 
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    for (i = 0; i < testData.Length; i++)
-    {
-        EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-        EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    }
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
     EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
 
     // act
-    for (size_t index = 0; index < length; index++)
-    {
-        // Send 1 byte at a time
-        mqtt_codec_bytesReceived(handle, SUBACK_RESP + index, 1);
-    }
+    int result_1 = mqtt_codec_set_recv_pool(handle_1, pool);
+    int result_2 = mqtt_codec_set_recv_pool(handle_2, pool);
+    (void)mqtt_codec_bytesReceived(handle_1, PUBACK, 3);
+    (void)mqtt_codec_bytesReceived(handle_1, PUBACK + 3, 1);
+    (void)mqtt_codec_bytesReceived(handle_2, PUBACK, 3);
+    (void)mqtt_codec_bytesReceived(handle_2, PUBACK + 3, 1);
 
     // assert
-    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(int, 0, result_1);
+    ASSERT_ARE_EQUAL(int, 0, result_2);
+    ASSERT_ARE_EQUAL(size_t, 2, g_callbackCount);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, mqtt_codec_get_pool_stats(handle_2, &poolStats));
+    ASSERT_ARE_EQUAL(size_t, 1, poolStats.hits);
+    ASSERT_ARE_EQUAL(size_t, 1, poolStats.misses);
+    ASSERT_ARE_EQUAL(size_t, 64, poolStats.cachedBytes);
+
+    // cleanup
+    mqtt_codec_destroy(handle_1);
+    mqtt_codec_destroy(handle_2);
+    mqtt_codec_recv_pool_destroy(pool);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_071: [mqtt_codec_set_recv_pool shall take receive buffers from pool from then on, or from the pool of the codec if pool is NULL.] */
+TEST_FUNCTION(mqtt_codec_set_recv_pool_NULL_reverts_to_codec_pool_succeeds)
+{
+    // arrange
+    MQTT_CODEC_POOL_STATS poolStats;
+    MQTT_CODEC_RECV_POOL_HANDLE pool = mqtt_codec_recv_pool_create(1024);
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, NULL);
+    (void)mqtt_codec_set_recv_pool(handle, pool);
+    (void)mqtt_codec_set_pool_high_water_mark(handle, 0);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_codec_set_recv_pool(handle, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, mqtt_codec_get_pool_stats(handle, &poolStats));
+    ASSERT_ARE_EQUAL(size_t, 0, poolStats.misses);
 
     // cleanup
     mqtt_codec_destroy(handle);
+    mqtt_codec_recv_pool_destroy(pool);
 }
 
-/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
-/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
-TEST_FUNCTION(mqtt_codec_bytesReceived_unsuback_succeed)
+/* Tests_SRS_MQTT_CODEC_07_069: [mqtt_codec_recv_pool_destroy shall free every idle buffer of pool and pool itself.] */
+TEST_FUNCTION(mqtt_codec_recv_pool_destroy_frees_idle_buffers_succeeds)
 {
     // arrange
-    size_t i;
-    g_curr_packet_type = UNSUBACK_TYPE;
+    g_curr_packet_type = PUBACK_TYPE;
 
-    unsigned char UNSUBACK_RESP[] = { 0xB0, 0x5, 0x12, 0x34, 0x01, 0x80, 0x02 };
-    size_t length = sizeof(UNSUBACK_RESP) / sizeof(UNSUBACK_RESP[0]);
+    unsigned char PUBACK[] = { 0x40, 0x02, 0x12, 0x34 };
 
     TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
-    testData.dataHeader = UNSUBACK_RESP + FIXED_HEADER_SIZE;
-    testData.Length = length - FIXED_HEADER_SIZE;
-    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+    testData.dataHeader = PUBACK + FIXED_HEADER_SIZE;
+    testData.Length = 2;
 
+    MQTT_CODEC_RECV_POOL_HANDLE pool = mqtt_codec_recv_pool_create(1024);
+    MQTTCODEC_HANDLE handle = mqtt_codec_create_with_view(TestOnViewCallback, &testData);
+    (void)mqtt_codec_set_recv_pool(handle, pool);
+    (void)mqtt_codec_bytesReceived(handle, PUBACK, 3);
+    (void)mqtt_codec_bytesReceived(handle, PUBACK + 3, 1);
+    mqtt_codec_destroy(handle);
     umock_c_reset_all_calls();
 
-    EXPECTED_CALL(BUFFER_new());
-    EXPECTED_CALL(BUFFER_pre_build(IGNORED_ARG, IGNORED_ARG));
-    for (i = 0; i < testData.Length; i++)
-    {
-        EXPECTED_CALL(BUFFER_u_char(IGNORED_ARG));
-        EXPECTED_CALL(BUFFER_length(IGNORED_ARG));
-    }
-    EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
 
     // act
-    for (size_t index = 0; index < length; index++)
-    {
-        // Send 1 byte at a time
-        mqtt_codec_bytesReceived(handle, UNSUBACK_RESP + index, 1);
-    }
+    mqtt_codec_recv_pool_destroy(pool);
 
     // assert
-    ASSERT_IS_TRUE(g_callbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-
-    // cleanup
-    mqtt_codec_destroy(handle);
 }
 
 TEST_FUNCTION(mqtt_codec_bytesReceived_pingresp_invalid_fails)
@@ -52,6 +52,7 @@ extern "C" {
 #include "azure_c_shared_utility/crt_abstractions.h"
 #include "azure_c_shared_utility/gballoc.h"
 #include "azure_c_shared_utility/string_token.h"
+#include "azure_umqtt_c/mqtt_topic_table.h"
 
 #undef ENABLE_MOCKS
 
@@ -81,6 +82,17 @@ static const uint8_t TEST_PACKET_ID = (uint8_t)0x12;
 static const char* TEST_TOPIC_NAME = "$subTopic1/subTopic2/subTopic3/?$prop1=value1&$prop2=value2";
 static const uint8_t* TEST_MESSAGE = (const uint8_t *)TEST_MESSAGE_TEXT;
 static const int TEST_MSG_LEN = sizeof(TEST_MESSAGE_TEXT) - 1;
+static MQTT_TOPIC_HANDLE TEST_TOPIC_HANDLE = (MQTT_TOPIC_HANDLE)0x31;
+
+static const char* my_mqtt_topic_get_name(MQTT_TOPIC_HANDLE topic, size_t* nameLength)
+{
+    (void)topic;
+    if (nameLength != NULL)
+    {
+        *nameLength = strlen(TEST_TOPIC_NAME);
+    }
+    return TEST_TOPIC_NAME;
+}
 
 typedef struct TEST_COMPLETE_DATA_INSTANCE_TAG
 {
@@ -112,6 +124,7 @@ TEST_SUITE_INITIALIZE(suite_init)
     ASSERT_ARE_EQUAL(int, 0, umocktypes_bool_register_types());
 
     REGISTER_UMOCK_ALIAS_TYPE(STRING_TOKEN_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_TOPIC_HANDLE, void*);
 
     REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
     REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
@@ -123,6 +136,7 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_GLOBAL_MOCK_HOOK(StringToken_GetLength, real_StringToken_GetLength);
     REGISTER_GLOBAL_MOCK_HOOK(StringToken_Split, real_StringToken_Split);
     REGISTER_GLOBAL_MOCK_HOOK(StringToken_Destroy, real_StringToken_Destroy);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_topic_get_name, my_mqtt_topic_get_name);
 
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(StringToken_GetFirst, NULL);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(StringToken_GetNext, false);
@@ -236,6 +250,130 @@ TEST_FUNCTION(mqttmessage_create_in_place_succeed)
     mqttmessage_destroy(handle);
 }
 
+/* Tests_SRS_MQTTMESSAGE_07_030: [If the parameter topicName is NULL then mqttmessage_create_in_place_n shall return NULL.] */
+TEST_FUNCTION(mqttmessage_create_in_place_n_topic_name_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place_n(TEST_PACKET_ID, NULL, 4, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_031: [mqttmessage_create_in_place_n shall keep a pointer to topicName and appMsg without copying them, the topicName does not need to be NULL terminated.] */
+/* Tests_SRS_MQTTMESSAGE_07_036: [mqttmessage_getTopicNameView shall return the topic name without copying it and store its length in topicNameLength, the returned value may not be NULL terminated.] */
+TEST_FUNCTION(mqttmessage_create_in_place_n_succeed)
+{
+    // arrange
+    size_t topicLength = 0;
+    const char* topicView;
+    const APP_PAYLOAD* payload;
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place_n(TEST_PACKET_ID, TEST_TOPIC_NAME, 10, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    topicView = mqttmessage_getTopicNameView(handle, &topicLength);
+    payload = mqttmessage_getApplicationMsg(handle);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(void_ptr, (void*)TEST_TOPIC_NAME, (void*)topicView);
+    ASSERT_ARE_EQUAL(size_t, 10, topicLength);
+    ASSERT_ARE_EQUAL(void_ptr, (void*)TEST_MESSAGE, (void*)payload->message);
+
+    mqttmessage_destroy(handle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_033: [If the topic name is not NULL terminated mqttmessage_getTopicName shall allocate a NULL terminated copy of it that is freed by mqttmessage_destroy.] */
+TEST_FUNCTION(mqttmessage_getTopicName_in_place_n_terminates_once_succeed)
+{
+    // arrange
+    const char* topicName;
+    const char* secondName;
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place_n(TEST_PACKET_ID, TEST_TOPIC_NAME, 10, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(11));
+
+    // act
+    topicName = mqttmessage_getTopicName(handle);
+    secondName = mqttmessage_getTopicName(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(char_ptr, "$subTopic1", topicName);
+    ASSERT_ARE_EQUAL(void_ptr, (void*)topicName, (void*)secondName);
+
+    umock_c_reset_all_calls();
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    mqttmessage_destroy(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_034: [If allocating the copy fails mqttmessage_getTopicName shall return NULL.] */
+TEST_FUNCTION(mqttmessage_getTopicName_in_place_n_malloc_fail)
+{
+    // arrange
+    const char* topicName;
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place_n(TEST_PACKET_ID, TEST_TOPIC_NAME, 10, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    topicName = mqttmessage_getTopicName(handle);
+
+    // assert
+    ASSERT_IS_NULL(topicName);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    mqttmessage_destroy(handle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_035: [If handle or topicNameLength is NULL then mqttmessage_getTopicNameView shall return NULL.] */
+TEST_FUNCTION(mqttmessage_getTopicNameView_NULL_param_fail)
+{
+    // arrange
+    size_t topicLength;
+
+    // act
+    const char* topicView = mqttmessage_getTopicNameView(NULL, &topicLength);
+
+    // assert
+    ASSERT_IS_NULL(topicView);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(mqttmessage_clone_in_place_n_succeed)
+{
+    // arrange
+    MQTT_MESSAGE_HANDLE cloneHandle;
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place_n(TEST_PACKET_ID, TEST_TOPIC_NAME, 10, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_ARG, "$subTopic1"));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    cloneHandle = mqttmessage_clone(handle);
+
+    // assert
+    ASSERT_IS_NOT_NULL(cloneHandle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(char_ptr, "$subTopic1", mqttmessage_getTopicName(cloneHandle));
+    ASSERT_ARE_EQUAL(size_t, TEST_MSG_LEN, mqttmessage_getApplicationMsg(cloneHandle)->length);
+
+    mqttmessage_destroy(handle);
+    mqttmessage_destroy(cloneHandle);
+}
+
 /* Test_SRS_MQTTMESSAGE_07_006: [mqttmessage_destroyMessage shall free all resources associated with the MQTT_MESSAGE_HANDLE value] */
 TEST_FUNCTION(mqttmessage_destroy_succeed)
 {
@@ -502,6 +640,39 @@ TEST_FUNCTION(mqttmessage_set_and_get_IsRetained_succeed)
     mqttmessage_destroy(handle);
 }
 
+/* Tests_SRS_MQTTMESSAGE_07_037: [If handle is NULL then mqttmessage_setPacketId shall return a non-zero value.] */
+TEST_FUNCTION(mqttmessage_setPacketId_handle_fails)
+{
+    // arrange
+
+    // act
+    int value = mqttmessage_setPacketId(NULL, TEST_PACKET_ID);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_NOT_EQUAL(int, 0, value);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_038: [mqttmessage_setPacketId shall store the packetId value in the MQTT_MESSAGE_HANDLE handle.] */
+TEST_FUNCTION(mqttmessage_set_and_get_PacketId_succeed)
+{
+    // arrange
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create(TEST_PACKET_ID, TEST_TOPIC_NAME, DELIVER_AT_LEAST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    // act
+    int value = mqttmessage_setPacketId(handle, TEST_PACKET_ID + 1);
+
+    uint16_t packetId = mqttmessage_getPacketId(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, value);
+    ASSERT_ARE_EQUAL(int, TEST_PACKET_ID + 1, packetId);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    mqttmessage_destroy(handle);
+}
+
 /* Test_SRS_MQTTMESSAGE_07_020: [If handle is NULL or if msgLen is 0 then mqttmessage_applicationMsg shall return NULL.] */
 TEST_FUNCTION(mqttmessage_getApplicationMsg_handle_fails)
 {
@@ -679,4 +850,297 @@ TEST_FUNCTION(mqttmessage_getTopicLevels_negative_tests)
     umock_c_negative_tests_deinit();
 }
 
+/* Tests_SRS_MQTTMESSAGE_07_039: [If handle or count is NULL, levels is NULL while maxLevels is not 0 or the message has no topic name then mqttmessage_getTopicLevelSpans shall return a non-zero value.] */
+TEST_FUNCTION(mqttmessage_getTopicLevelSpans_NULL_handle_fail)
+{
+    // arrange
+    MQTT_TOPIC_LEVEL levels[4];
+    size_t count;
+
+    // act
+    int result = mqttmessage_getTopicLevelSpans(NULL, levels, 4, &count);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_039: [If handle or count is NULL, levels is NULL while maxLevels is not 0 or the message has no topic name then mqttmessage_getTopicLevelSpans shall return a non-zero value.] */
+TEST_FUNCTION(mqttmessage_getTopicLevelSpans_NULL_count_fail)
+{
+    // arrange
+    MQTT_TOPIC_LEVEL levels[4];
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place(TEST_PACKET_ID, TEST_TOPIC_NAME, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqttmessage_getTopicLevelSpans(handle, levels, 4, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqttmessage_destroy(handle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_039: [If handle or count is NULL, levels is NULL while maxLevels is not 0 or the message has no topic name then mqttmessage_getTopicLevelSpans shall return a non-zero value.] */
+TEST_FUNCTION(mqttmessage_getTopicLevelSpans_NULL_levels_fail)
+{
+    // arrange
+    size_t count;
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place(TEST_PACKET_ID, TEST_TOPIC_NAME, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqttmessage_getTopicLevelSpans(handle, NULL, 4, &count);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqttmessage_destroy(handle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_040: [mqttmessage_getTopicLevelSpans shall store the offset and length of every non-empty "/" separated level of the topic name in levels without allocating memory, and the number of levels in count.] */
+TEST_FUNCTION(mqttmessage_getTopicLevelSpans_succeed)
+{
+    // arrange
+    MQTT_TOPIC_LEVEL levels[8];
+    size_t count;
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place(TEST_PACKET_ID, TEST_TOPIC_NAME, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqttmessage_getTopicLevelSpans(handle, levels, 8, &count);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 4, count);
+    ASSERT_ARE_EQUAL(size_t, 0, levels[0].offset);
+    ASSERT_ARE_EQUAL(size_t, 10, levels[0].length);
+    ASSERT_ARE_EQUAL(size_t, 11, levels[1].offset);
+    ASSERT_ARE_EQUAL(size_t, 9, levels[1].length);
+    ASSERT_ARE_EQUAL(size_t, 21, levels[2].offset);
+    ASSERT_ARE_EQUAL(size_t, 9, levels[2].length);
+    ASSERT_ARE_EQUAL(size_t, 31, levels[3].offset);
+    ASSERT_ARE_EQUAL(size_t, strlen("?$prop1=value1&$prop2=value2"), levels[3].length);
+
+    // cleanup
+    mqttmessage_destroy(handle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_040: [mqttmessage_getTopicLevelSpans shall store the offset and length of every non-empty "/" separated level of the topic name in levels without allocating memory, and the number of levels in count.] */
+TEST_FUNCTION(mqttmessage_getTopicLevelSpans_empty_levels_skipped_succeed)
+{
+    // arrange
+    MQTT_TOPIC_LEVEL levels[4];
+    size_t count;
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place(TEST_PACKET_ID, "/a//bc/", DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqttmessage_getTopicLevelSpans(handle, levels, 4, &count);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 2, count);
+    ASSERT_ARE_EQUAL(size_t, 1, levels[0].offset);
+    ASSERT_ARE_EQUAL(size_t, 1, levels[0].length);
+    ASSERT_ARE_EQUAL(size_t, 4, levels[1].offset);
+    ASSERT_ARE_EQUAL(size_t, 2, levels[1].length);
+
+    // cleanup
+    mqttmessage_destroy(handle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_040: [mqttmessage_getTopicLevelSpans shall store the offset and length of every non-empty "/" separated level of the topic name in levels without allocating memory, and the number of levels in count.] */
+TEST_FUNCTION(mqttmessage_getTopicLevelSpans_topic_view_succeed)
+{
+    // arrange
+    MQTT_TOPIC_LEVEL levels[4];
+    size_t count;
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place_n(TEST_PACKET_ID, TEST_TOPIC_NAME, 20, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqttmessage_getTopicLevelSpans(handle, levels, 4, &count);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 2, count);
+    ASSERT_ARE_EQUAL(size_t, 11, levels[1].offset);
+    ASSERT_ARE_EQUAL(size_t, 9, levels[1].length);
+
+    // cleanup
+    mqttmessage_destroy(handle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_041: [If the topic name has more than maxLevels levels then mqttmessage_getTopicLevelSpans shall store the first maxLevels of them and return a non-zero value.] */
+TEST_FUNCTION(mqttmessage_getTopicLevelSpans_too_many_levels_fail)
+{
+    // arrange
+    MQTT_TOPIC_LEVEL levels[2];
+    size_t count;
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place(TEST_PACKET_ID, TEST_TOPIC_NAME, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqttmessage_getTopicLevelSpans(handle, levels, 2, &count);
+    int countResult = mqttmessage_getTopicLevelSpans(handle, NULL, 0, &count);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_NOT_EQUAL(int, 0, countResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 4, count);
+    ASSERT_ARE_EQUAL(size_t, 11, levels[1].offset);
+    ASSERT_ARE_EQUAL(size_t, 9, levels[1].length);
+
+    // cleanup
+    mqttmessage_destroy(handle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_042: [If topic is NULL then mqttmessage_create_with_topic shall return NULL.] */
+TEST_FUNCTION(mqttmessage_create_with_topic_topic_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_with_topic(TEST_PACKET_ID, NULL, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_043: [mqttmessage_create_with_topic shall keep topic and a pointer to appMsg without copying the topic name or appMsg.] */
+/* Tests_SRS_MQTTMESSAGE_07_047: [mqttmessage_getInternedTopic shall return the topic handle was created with, or NULL if handle was not created with mqttmessage_create_with_topic.] */
+TEST_FUNCTION(mqttmessage_create_with_topic_succeed)
+{
+    // arrange
+    size_t topicNameLength;
+    STRICT_EXPECTED_CALL(mqtt_topic_get_name(TEST_TOPIC_HANDLE, IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_with_topic(TEST_PACKET_ID, TEST_TOPIC_HANDLE, DELIVER_AT_LEAST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(void_ptr, TEST_TOPIC_HANDLE, mqttmessage_getInternedTopic(handle));
+    ASSERT_ARE_EQUAL(void_ptr, TEST_TOPIC_NAME, mqttmessage_getTopicName(handle));
+    ASSERT_ARE_EQUAL(void_ptr, TEST_TOPIC_NAME, mqttmessage_getTopicNameView(handle, &topicNameLength));
+    ASSERT_ARE_EQUAL(size_t, strlen(TEST_TOPIC_NAME), topicNameLength);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_MESSAGE, mqttmessage_getApplicationMsg(handle)->message);
+    ASSERT_ARE_EQUAL(int, (int)DELIVER_AT_LEAST_ONCE, (int)mqttmessage_getQosType(handle));
+
+    // cleanup
+    mqttmessage_destroy(handle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_044: [If any memory allocation fails mqttmessage_create_with_topic shall return NULL.] */
+TEST_FUNCTION(mqttmessage_create_with_topic_malloc_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(mqtt_topic_get_name(TEST_TOPIC_HANDLE, IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_with_topic(TEST_PACKET_ID, TEST_TOPIC_HANDLE, DELIVER_AT_LEAST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_045: [If handle was created with mqttmessage_create_with_topic then mqttmessage_clone shall keep the same topic instead of copying the topic name.] */
+TEST_FUNCTION(mqttmessage_clone_with_topic_succeed)
+{
+    // arrange
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_with_topic(TEST_PACKET_ID, TEST_TOPIC_HANDLE, DELIVER_AT_LEAST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    ASSERT_ARE_EQUAL(int, 0, mqttmessage_setIsRetained(handle, true));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_MESSAGE_HANDLE cloneHandle = mqttmessage_clone(handle);
+
+    // assert
+    ASSERT_IS_NOT_NULL(cloneHandle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(void_ptr, TEST_TOPIC_HANDLE, mqttmessage_getInternedTopic(cloneHandle));
+    ASSERT_ARE_EQUAL(void_ptr, TEST_TOPIC_NAME, mqttmessage_getTopicName(cloneHandle));
+    ASSERT_ARE_EQUAL(int, TEST_PACKET_ID, mqttmessage_getPacketId(cloneHandle));
+    ASSERT_IS_TRUE(mqttmessage_getIsRetained(cloneHandle));
+    const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(cloneHandle);
+    ASSERT_ARE_NOT_EQUAL(void_ptr, TEST_MESSAGE, payload->message);
+    ASSERT_ARE_EQUAL(size_t, (size_t)TEST_MSG_LEN, payload->length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(TEST_MESSAGE, payload->message, TEST_MSG_LEN));
+
+    // cleanup
+    mqttmessage_destroy(handle);
+    mqttmessage_destroy(cloneHandle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_045: [If handle was created with mqttmessage_create_with_topic then mqttmessage_clone shall keep the same topic instead of copying the topic name.] */
+TEST_FUNCTION(mqttmessage_clone_with_topic_malloc_fail)
+{
+    // arrange
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_with_topic(TEST_PACKET_ID, TEST_TOPIC_HANDLE, DELIVER_AT_LEAST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+    EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_MESSAGE_HANDLE cloneHandle = mqttmessage_clone(handle);
+
+    // assert
+    ASSERT_IS_NULL(cloneHandle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqttmessage_destroy(handle);
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_046: [If handle is NULL then mqttmessage_getInternedTopic shall return NULL.] */
+TEST_FUNCTION(mqttmessage_getInternedTopic_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqttmessage_getInternedTopic(NULL);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTTMESSAGE_07_047: [mqttmessage_getInternedTopic shall return the topic handle was created with, or NULL if handle was not created with mqttmessage_create_with_topic.] */
+TEST_FUNCTION(mqttmessage_getInternedTopic_not_interned_succeed)
+{
+    // arrange
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place(TEST_PACKET_ID, TEST_TOPIC_NAME, DELIVER_AT_MOST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqttmessage_getInternedTopic(handle);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqttmessage_destroy(handle);
+}
+
 END_TEST_SUITE(mqtt_message_ut)
@@ -0,0 +1,672 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c/umock_c.h"
+#include "umock_c/umock_c_negative_tests.h"
+#include "umock_c/umocktypes_charptr.h"
+#include "umock_c/umocktypes_stdint.h"
+#include "umock_c/umocktypes.h"
+#include "umock_c/umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/buffer_.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "umock_c/umock_c_prod.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_offline_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern BUFFER_HANDLE real_BUFFER_new(void);
+extern int real_BUFFER_build(BUFFER_HANDLE handle, const unsigned char* source, size_t size);
+extern int real_BUFFER_pre_build(BUFFER_HANDLE handle, size_t size);
+extern void real_BUFFER_delete(BUFFER_HANDLE s);
+extern unsigned char* real_BUFFER_u_char(BUFFER_HANDLE handle);
+extern size_t real_BUFFER_length(BUFFER_HANDLE handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define TEST_PACKET_LENGTH      11
+#define TEST_SPILL_PATH         "mqtt_offline_queue_ut.seg"
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+MU_DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    ASSERT_FAIL("umock_c reported error :%s", MU_ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+}
+
+// PUBLISH packet of TEST_PACKET_LENGTH bytes carrying marker as its last byte
+static BUFFER_HANDLE make_packet(QOS_VALUE qos, unsigned char marker)
+{
+    unsigned char packet[TEST_PACKET_LENGTH] = { 0x30, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x01, 'x', 0x00 };
+    BUFFER_HANDLE result = real_BUFFER_new();
+    ASSERT_IS_NOT_NULL(result);
+    packet[0] |= (unsigned char)(qos << 1);
+    packet[TEST_PACKET_LENGTH - 1] = marker;
+    ASSERT_ARE_EQUAL(int, 0, real_BUFFER_build(result, packet, sizeof(packet)));
+    return result;
+}
+
+static MQTT_OFFLINE_QUEUE_HANDLE create_queue(size_t maxPackets, const char* spillPath, MQTT_OFFLINE_DROP_POLICY dropPolicy)
+{
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_OFFLINE_QUEUE_HANDLE result;
+    options.maxMemoryBytes = maxPackets * TEST_PACKET_LENGTH;
+    options.spillPath = spillPath;
+    options.dropPolicy = dropPolicy;
+    result = mqtt_offline_queue_create(&options);
+    ASSERT_IS_NOT_NULL(result);
+    return result;
+}
+
+static void push_packet(MQTT_OFFLINE_QUEUE_HANDLE handle, QOS_VALUE qos, unsigned char marker)
+{
+    ASSERT_ARE_EQUAL(int, 0, mqtt_offline_queue_push(handle, make_packet(qos, marker), qos));
+}
+
+static unsigned char pop_marker(MQTT_OFFLINE_QUEUE_HANDLE handle)
+{
+    unsigned char result;
+    BUFFER_HANDLE packet = mqtt_offline_queue_peek(handle);
+    ASSERT_IS_NOT_NULL(packet);
+    ASSERT_ARE_EQUAL(size_t, TEST_PACKET_LENGTH, real_BUFFER_length(packet));
+    result = real_BUFFER_u_char(packet)[TEST_PACKET_LENGTH - 1];
+    mqtt_offline_queue_pop(handle);
+    return result;
+}
+
+static bool spill_file_exists(void)
+{
+    FILE* file = fopen(TEST_SPILL_PATH, "rb");
+    if (file != NULL)
+    {
+        (void)fclose(file);
+    }
+    return file != NULL;
+}
+
+BEGIN_TEST_SUITE(mqtt_offline_queue_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(BUFFER_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(QOS_VALUE, int);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+
+    REGISTER_GLOBAL_MOCK_HOOK(BUFFER_new, real_BUFFER_new);
+    REGISTER_GLOBAL_MOCK_HOOK(BUFFER_pre_build, real_BUFFER_pre_build);
+    REGISTER_GLOBAL_MOCK_HOOK(BUFFER_delete, real_BUFFER_delete);
+    REGISTER_GLOBAL_MOCK_HOOK(BUFFER_u_char, real_BUFFER_u_char);
+    REGISTER_GLOBAL_MOCK_HOOK(BUFFER_length, real_BUFFER_length);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    (void)remove(TEST_SPILL_PATH);
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    (void)remove(TEST_SPILL_PATH);
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_001: [If options is NULL, maxMemoryBytes is 0 or dropPolicy is not valid then mqtt_offline_queue_create shall return NULL.] */
+TEST_FUNCTION(mqtt_offline_queue_create_options_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_OFFLINE_QUEUE_HANDLE handle = mqtt_offline_queue_create(NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_001: [If options is NULL, maxMemoryBytes is 0 or dropPolicy is not valid then mqtt_offline_queue_create shall return NULL.] */
+TEST_FUNCTION(mqtt_offline_queue_create_max_memory_0_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    options.dropPolicy = MQTT_OFFLINE_DROP_OLDEST;
+
+    // act
+    MQTT_OFFLINE_QUEUE_HANDLE handle = mqtt_offline_queue_create(&options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_001: [If options is NULL, maxMemoryBytes is 0 or dropPolicy is not valid then mqtt_offline_queue_create shall return NULL.] */
+TEST_FUNCTION(mqtt_offline_queue_create_invalid_drop_policy_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    options.maxMemoryBytes = TEST_PACKET_LENGTH;
+    options.dropPolicy = (MQTT_OFFLINE_DROP_POLICY)42;
+
+    // act
+    MQTT_OFFLINE_QUEUE_HANDLE handle = mqtt_offline_queue_create(&options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_003: [mqtt_offline_queue_create shall return an empty queue, the segment file is only created once a packet spills.] */
+TEST_FUNCTION(mqtt_offline_queue_create_succeed)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    options.maxMemoryBytes = TEST_PACKET_LENGTH;
+    options.spillPath = TEST_SPILL_PATH;
+    options.dropPolicy = MQTT_OFFLINE_DROP_OLDEST;
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(TEST_SPILL_PATH)));
+
+    // act
+    MQTT_OFFLINE_QUEUE_HANDLE handle = mqtt_offline_queue_create(&options);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_offline_queue_count(handle));
+    ASSERT_IS_NULL(mqtt_offline_queue_peek(handle));
+    ASSERT_IS_FALSE(spill_file_exists());
+
+    // cleanup
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_002: [If any failure is encountered then mqtt_offline_queue_create shall return NULL.] */
+TEST_FUNCTION(mqtt_offline_queue_create_path_malloc_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    options.maxMemoryBytes = TEST_PACKET_LENGTH;
+    options.spillPath = TEST_SPILL_PATH;
+    options.dropPolicy = MQTT_OFFLINE_DROP_OLDEST;
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(sizeof(TEST_SPILL_PATH))).SetReturn(NULL);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_OFFLINE_QUEUE_HANDLE handle = mqtt_offline_queue_create(&options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_004: [If handle is NULL then mqtt_offline_queue_destroy shall do nothing.] */
+TEST_FUNCTION(mqtt_offline_queue_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_offline_queue_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_005: [mqtt_offline_queue_destroy shall free every queued packet and delete the segment file.] */
+TEST_FUNCTION(mqtt_offline_queue_destroy_removes_segment_file_succeed)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(1, TEST_SPILL_PATH, MQTT_OFFLINE_DROP_OLDEST);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 1);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 2);
+    ASSERT_IS_TRUE(spill_file_exists());
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_offline_queue_destroy(handle);
+
+    // assert
+    ASSERT_IS_FALSE(spill_file_exists());
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_006: [If handle or packet is NULL or packet is empty then mqtt_offline_queue_push shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_offline_queue_push_handle_NULL_fail)
+{
+    // arrange
+    BUFFER_HANDLE packet = make_packet(DELIVER_AT_LEAST_ONCE, 1);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_offline_queue_push(NULL, packet, DELIVER_AT_LEAST_ONCE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    real_BUFFER_delete(packet);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_006: [If handle or packet is NULL or packet is empty then mqtt_offline_queue_push shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_offline_queue_push_packet_NULL_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(2, NULL, MQTT_OFFLINE_DROP_OLDEST);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_offline_queue_push(handle, NULL, DELIVER_AT_LEAST_ONCE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_offline_queue_count(handle));
+
+    // cleanup
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_007: [mqtt_offline_queue_push shall keep packet in memory while the queued packets fit maxMemoryBytes.] */
+TEST_FUNCTION(mqtt_offline_queue_push_in_memory_succeed)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(2, TEST_SPILL_PATH, MQTT_OFFLINE_DROP_OLDEST);
+    BUFFER_HANDLE packet = make_packet(DELIVER_AT_LEAST_ONCE, 1);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(packet));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(packet));
+
+    // act
+    int result = mqtt_offline_queue_push(handle, packet, DELIVER_AT_LEAST_ONCE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_offline_queue_count(handle));
+    ASSERT_IS_TRUE(packet == mqtt_offline_queue_peek(handle));
+    ASSERT_IS_FALSE(spill_file_exists());
+
+    // cleanup
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_011: [If any failure is encountered then mqtt_offline_queue_push shall return a non-zero value and leave packet to the caller.] */
+TEST_FUNCTION(mqtt_offline_queue_push_malloc_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(2, NULL, MQTT_OFFLINE_DROP_OLDEST);
+    BUFFER_HANDLE packet = make_packet(DELIVER_AT_LEAST_ONCE, 1);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(packet));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    int result = mqtt_offline_queue_push(handle, packet, DELIVER_AT_LEAST_ONCE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_offline_queue_count(handle));
+
+    // cleanup
+    real_BUFFER_delete(packet);
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_008: [Once maxMemoryBytes is reached mqtt_offline_queue_push shall append packet to the segment file at spillPath and free it.] */
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_015: [mqtt_offline_queue_pop shall free the oldest queued packet and move spilled packets back into memory as room allows.] */
+TEST_FUNCTION(mqtt_offline_queue_push_spills_in_order_succeed)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_STATS stats;
+    unsigned char index;
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(2, TEST_SPILL_PATH, MQTT_OFFLINE_DROP_OLDEST);
+    umock_c_reset_all_calls();
+
+    // act
+    for (index = 1; index <= 5; index++)
+    {
+        push_packet(handle, DELIVER_AT_LEAST_ONCE, index);
+    }
+
+    // assert
+    ASSERT_IS_TRUE(spill_file_exists());
+    ASSERT_ARE_EQUAL(int, 0, mqtt_offline_queue_get_stats(handle, &stats));
+    ASSERT_ARE_EQUAL(size_t, 5, stats.count);
+    ASSERT_ARE_EQUAL(size_t, 2 * TEST_PACKET_LENGTH, stats.memoryBytes);
+    ASSERT_ARE_EQUAL(size_t, 3 * (4 + TEST_PACKET_LENGTH), stats.spillBytes);
+    for (index = 1; index <= 5; index++)
+    {
+        ASSERT_ARE_EQUAL(int, index, pop_marker(handle));
+    }
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_offline_queue_count(handle));
+
+    // cleanup
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_009: [When the queue is full mqtt_offline_queue_push shall drop the oldest packet for MQTT_OFFLINE_DROP_OLDEST, the new packet for MQTT_OFFLINE_DROP_NEWEST, or the oldest packet of the lowest QoS not above qos for MQTT_OFFLINE_DROP_LOWEST_QOS, and return a non-zero value if the new packet was dropped.] */
+TEST_FUNCTION(mqtt_offline_queue_push_drop_oldest_succeed)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_STATS stats;
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(2, NULL, MQTT_OFFLINE_DROP_OLDEST);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 1);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 2);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_offline_queue_push(handle, make_packet(DELIVER_AT_LEAST_ONCE, 3), DELIVER_AT_LEAST_ONCE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_offline_queue_get_stats(handle, &stats));
+    ASSERT_ARE_EQUAL(size_t, 1, stats.dropped);
+    ASSERT_ARE_EQUAL(int, 2, pop_marker(handle));
+    ASSERT_ARE_EQUAL(int, 3, pop_marker(handle));
+
+    // cleanup
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_009: [When the queue is full mqtt_offline_queue_push shall drop the oldest packet for MQTT_OFFLINE_DROP_OLDEST, the new packet for MQTT_OFFLINE_DROP_NEWEST, or the oldest packet of the lowest QoS not above qos for MQTT_OFFLINE_DROP_LOWEST_QOS, and return a non-zero value if the new packet was dropped.] */
+TEST_FUNCTION(mqtt_offline_queue_push_drop_newest_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_STATS stats;
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(2, NULL, MQTT_OFFLINE_DROP_NEWEST);
+    BUFFER_HANDLE packet = make_packet(DELIVER_AT_LEAST_ONCE, 3);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 1);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 2);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_offline_queue_push(handle, packet, DELIVER_AT_LEAST_ONCE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_offline_queue_get_stats(handle, &stats));
+    ASSERT_ARE_EQUAL(size_t, 1, stats.dropped);
+    ASSERT_ARE_EQUAL(int, 1, pop_marker(handle));
+    ASSERT_ARE_EQUAL(int, 2, pop_marker(handle));
+
+    // cleanup
+    real_BUFFER_delete(packet);
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_009: [When the queue is full mqtt_offline_queue_push shall drop the oldest packet for MQTT_OFFLINE_DROP_OLDEST, the new packet for MQTT_OFFLINE_DROP_NEWEST, or the oldest packet of the lowest QoS not above qos for MQTT_OFFLINE_DROP_LOWEST_QOS, and return a non-zero value if the new packet was dropped.] */
+TEST_FUNCTION(mqtt_offline_queue_push_drop_lowest_qos_succeed)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(3, NULL, MQTT_OFFLINE_DROP_LOWEST_QOS);
+    BUFFER_HANDLE packet = make_packet(DELIVER_AT_MOST_ONCE, 5);
+    push_packet(handle, DELIVER_EXACTLY_ONCE, 1);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 2);
+    push_packet(handle, DELIVER_AT_MOST_ONCE, 3);
+    umock_c_reset_all_calls();
+
+    // act
+    int result1 = mqtt_offline_queue_push(handle, make_packet(DELIVER_AT_LEAST_ONCE, 4), DELIVER_AT_LEAST_ONCE);
+    int result2 = mqtt_offline_queue_push(handle, packet, DELIVER_AT_MOST_ONCE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result1);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result2);
+    ASSERT_ARE_EQUAL(int, 1, pop_marker(handle));
+    ASSERT_ARE_EQUAL(int, 2, pop_marker(handle));
+    ASSERT_ARE_EQUAL(int, 4, pop_marker(handle));
+
+    // cleanup
+    real_BUFFER_delete(packet);
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_009: [When the queue is full mqtt_offline_queue_push shall drop the oldest packet for MQTT_OFFLINE_DROP_OLDEST, the new packet for MQTT_OFFLINE_DROP_NEWEST, or the oldest packet of the lowest QoS not above qos for MQTT_OFFLINE_DROP_LOWEST_QOS, and return a non-zero value if the new packet was dropped.] */
+TEST_FUNCTION(mqtt_offline_queue_push_drop_lowest_qos_spilled_succeed)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_STATS stats;
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    options.maxMemoryBytes = 2 * TEST_PACKET_LENGTH;
+    options.spillPath = TEST_SPILL_PATH;
+    options.maxSpillBytes = 2 * (4 + TEST_PACKET_LENGTH);
+    options.dropPolicy = MQTT_OFFLINE_DROP_LOWEST_QOS;
+    MQTT_OFFLINE_QUEUE_HANDLE handle = mqtt_offline_queue_create(&options);
+    ASSERT_IS_NOT_NULL(handle);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 1);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 2);
+    push_packet(handle, DELIVER_AT_MOST_ONCE, 3);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 4);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_offline_queue_push(handle, make_packet(DELIVER_AT_LEAST_ONCE, 5), DELIVER_AT_LEAST_ONCE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_offline_queue_get_stats(handle, &stats));
+    ASSERT_ARE_EQUAL(size_t, 1, stats.dropped);
+    ASSERT_ARE_EQUAL(size_t, 4, stats.count);
+    ASSERT_ARE_EQUAL(int, 1, pop_marker(handle));
+    ASSERT_ARE_EQUAL(int, 2, pop_marker(handle));
+    ASSERT_ARE_EQUAL(int, 4, pop_marker(handle));
+    ASSERT_ARE_EQUAL(int, 5, pop_marker(handle));
+
+    // cleanup
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_010: [If packet can never fit the queue then mqtt_offline_queue_push shall drop it and return a non-zero value.] */
+TEST_FUNCTION(mqtt_offline_queue_push_packet_too_large_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_STATS stats;
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_OFFLINE_QUEUE_HANDLE handle;
+    BUFFER_HANDLE packet = make_packet(DELIVER_AT_LEAST_ONCE, 1);
+    options.maxMemoryBytes = TEST_PACKET_LENGTH - 1;
+    options.dropPolicy = MQTT_OFFLINE_DROP_OLDEST;
+    handle = mqtt_offline_queue_create(&options);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(packet));
+
+    // act
+    int result = mqtt_offline_queue_push(handle, packet, DELIVER_AT_LEAST_ONCE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, mqtt_offline_queue_get_stats(handle, &stats));
+    ASSERT_ARE_EQUAL(size_t, 0, stats.count);
+    ASSERT_ARE_EQUAL(size_t, 1, stats.dropped);
+
+    // cleanup
+    real_BUFFER_delete(packet);
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_012: [If handle is NULL then mqtt_offline_queue_peek shall return NULL.] */
+TEST_FUNCTION(mqtt_offline_queue_peek_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    BUFFER_HANDLE result = mqtt_offline_queue_peek(NULL);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_013: [mqtt_offline_queue_peek shall return the oldest queued packet, reading it from the segment file when no packet is in memory.] */
+TEST_FUNCTION(mqtt_offline_queue_peek_reads_segment_file_succeed)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_OFFLINE_QUEUE_HANDLE handle;
+    options.maxMemoryBytes = TEST_PACKET_LENGTH / 2;
+    options.spillPath = TEST_SPILL_PATH;
+    options.dropPolicy = MQTT_OFFLINE_DROP_OLDEST;
+    handle = mqtt_offline_queue_create(&options);
+    push_packet(handle, DELIVER_EXACTLY_ONCE, 7);
+    umock_c_reset_all_calls();
+
+    // act
+    BUFFER_HANDLE result = mqtt_offline_queue_peek(handle);
+
+    // assert
+    ASSERT_IS_NOT_NULL(result);
+    ASSERT_ARE_EQUAL(size_t, TEST_PACKET_LENGTH, real_BUFFER_length(result));
+    ASSERT_ARE_EQUAL(int, 0x34, real_BUFFER_u_char(result)[0]);
+    ASSERT_ARE_EQUAL(int, 7, real_BUFFER_u_char(result)[TEST_PACKET_LENGTH - 1]);
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_offline_queue_count(handle));
+
+    // cleanup
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_014: [If handle is NULL or the queue is empty then mqtt_offline_queue_pop shall do nothing.] */
+TEST_FUNCTION(mqtt_offline_queue_pop_empty_succeed)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(2, NULL, MQTT_OFFLINE_DROP_OLDEST);
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_offline_queue_pop(NULL);
+    mqtt_offline_queue_pop(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_offline_queue_count(handle));
+
+    // cleanup
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_016: [mqtt_offline_queue_count shall return the number of queued packets, or 0 if handle is NULL.] */
+TEST_FUNCTION(mqtt_offline_queue_count_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    size_t result = mqtt_offline_queue_count(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_017: [If handle or stats is NULL then mqtt_offline_queue_get_stats shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_offline_queue_get_stats_stats_NULL_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(2, NULL, MQTT_OFFLINE_DROP_OLDEST);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_offline_queue_get_stats(handle, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_offline_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_OFFLINE_QUEUE_07_018: [mqtt_offline_queue_get_stats shall report the queued packets, the bytes held in memory and in the segment file and the number of dropped packets.] */
+TEST_FUNCTION(mqtt_offline_queue_get_stats_succeed)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_STATS stats;
+    MQTT_OFFLINE_QUEUE_HANDLE handle = create_queue(2, NULL, MQTT_OFFLINE_DROP_OLDEST);
+    push_packet(handle, DELIVER_AT_LEAST_ONCE, 1);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_offline_queue_get_stats(handle, &stats);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, stats.count);
+    ASSERT_ARE_EQUAL(size_t, TEST_PACKET_LENGTH, stats.memoryBytes);
+    ASSERT_ARE_EQUAL(size_t, 0, stats.spillBytes);
+    ASSERT_ARE_EQUAL(size_t, 0, stats.dropped);
+
+    // cleanup
+    mqtt_offline_queue_destroy(handle);
+}
+
+END_TEST_SUITE(mqtt_offline_queue_ut)
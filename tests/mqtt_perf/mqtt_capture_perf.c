@@ -0,0 +1,129 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Raw packet trace cost for a 16 KB PUBLISH: a formatted write per byte, the
+// way the ENABLE_RAW_TRACE trace logged before, against the hex text of the
+// whole packet from a nibble table written once, and against mqtt_capture.
+// Every trace goes to a file so that the cost of the terminal is left out.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "azure_umqtt_c/mqtt_capture.h"
+
+#define BENCH_PACKET_SIZE       (16 * 1024)
+#define BENCH_PACKET_COUNT      256
+#define BENCH_TEXT_FILE         "mqtt_capture_perf.txt"
+#define BENCH_CAPTURE_FILE      "mqtt_capture_perf.cap"
+
+static double run_per_byte(FILE* file, const uint8_t* packet)
+{
+    size_t count;
+    clock_t start = clock();
+    for (count = 0; count < BENCH_PACKET_COUNT; count++)
+    {
+        size_t index;
+        (void)fprintf(file, "-> %s %s: ", "00:00:00", "PUBLISH");
+        for (index = 0; index < BENCH_PACKET_SIZE; index++)
+        {
+            (void)fprintf(file, "0x%02x ", packet[index]);
+        }
+        (void)fprintf(file, " \n");
+    }
+    (void)fflush(file);
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double run_table(FILE* file, const uint8_t* packet, char* text)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    size_t count;
+    clock_t start = clock();
+    for (count = 0; count < BENCH_PACKET_COUNT; count++)
+    {
+        char* target = text;
+        size_t index;
+        for (index = 0; index < BENCH_PACKET_SIZE; index++)
+        {
+            target[0] = '0';
+            target[1] = 'x';
+            target[2] = hexDigits[packet[index] >> 4];
+            target[3] = hexDigits[packet[index] & 0x0F];
+            target[4] = ' ';
+            target += 5;
+        }
+        *target = '\0';
+        (void)fprintf(file, "-> %s %s: %s\n", "00:00:00", "PUBLISH", text);
+    }
+    (void)fflush(file);
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double run_capture(MQTT_CAPTURE_HANDLE capture, const uint8_t* packet, int* failures)
+{
+    size_t count;
+    clock_t start = clock();
+    for (count = 0; count < BENCH_PACKET_COUNT; count++)
+    {
+        if (mqtt_capture_begin_packet(capture, MQTT_TRACE_OUTGOING, count, BENCH_PACKET_SIZE) != 0 ||
+            mqtt_capture_append(capture, packet, BENCH_PACKET_SIZE) != 0)
+        {
+            (*failures)++;
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void)
+{
+    int result = 0;
+    uint8_t* packet = (uint8_t*)malloc(BENCH_PACKET_SIZE);
+    char* text = (char*)malloc(BENCH_PACKET_SIZE * 5 + 1);
+    FILE* file = fopen(BENCH_TEXT_FILE, "w");
+    MQTT_CAPTURE_HANDLE capture = mqtt_capture_create(BENCH_CAPTURE_FILE);
+    if (packet == NULL || text == NULL || file == NULL || capture == NULL)
+    {
+        (void)printf("Failed setting up the benchmark\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        size_t index;
+        int failures = 0;
+        double perByteTime;
+        double tableTime;
+        double captureTime;
+        for (index = 0; index < BENCH_PACKET_SIZE; index++)
+        {
+            packet[index] = (uint8_t)(index * 31);
+        }
+
+        perByteTime = run_per_byte(file, packet);
+        tableTime = run_table(file, packet, text);
+        captureTime = run_capture(capture, packet, &failures);
+        (void)printf("%10s %10s %14s %14s %14s\r\n", "packets", "bytes", "per byte us", "table us", "capture us");
+        (void)printf("%10d %10d %14.1f %14.1f %14.1f\r\n", BENCH_PACKET_COUNT, BENCH_PACKET_SIZE,
+            perByteTime * 1e6 / BENCH_PACKET_COUNT, tableTime * 1e6 / BENCH_PACKET_COUNT, captureTime * 1e6 / BENCH_PACKET_COUNT);
+        if (failures != 0)
+        {
+            (void)printf("%d packets were not captured\r\n", failures);
+            result = __LINE__;
+        }
+    }
+
+    if (capture != NULL)
+    {
+        mqtt_capture_destroy(capture);
+        (void)remove(BENCH_CAPTURE_FILE);
+    }
+    if (file != NULL)
+    {
+        (void)fclose(file);
+        (void)remove(BENCH_TEXT_FILE);
+    }
+    free(text);
+    free(packet);
+    return result;
+}
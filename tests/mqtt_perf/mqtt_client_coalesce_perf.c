@@ -0,0 +1,235 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Outbound send coalescing benchmark for mqtt_client_set_send_coalescing.
+//
+// A connected client publishes small QoS 0 and QoS 1 messages at a simulated
+// 10k messages per second, calling mqtt_client_dowork every 10 ms the way an
+// application loop would.  The transport below is a counting xio: every
+// xio_send stands for one write syscall and at least one TLS record, so the
+// number of calls with and without coalescing is what the table compares.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "azure_c_shared_utility/xio.h"
+#include "azure_umqtt_c/mqtt_client.h"
+
+#define BENCH_SECONDS               10
+#define BENCH_TICK_MS               10
+#define BENCH_PUBLISH_PER_SEC       10000
+#define BENCH_PAYLOAD               "{\"temperature\":21.5}"
+#define BENCH_TOPIC                 "devices/bench-device/messages/events/"
+#define BENCH_TLS_RECORD_SIZE       16384
+
+typedef struct COALESCE_SETTING_TAG
+{
+    size_t maxBytes;
+    uint32_t maxLatencyMs;
+} COALESCE_SETTING;
+
+static const COALESCE_SETTING COALESCE_SETTINGS[] = { { 0, 0 }, { 1460, 10 }, { 4096, 10 }, { 16 * 1024, 10 } };
+static const QOS_VALUE QOS_VALUES[] = { DELIVER_AT_MOST_ONCE, DELIVER_AT_LEAST_ONCE };
+
+typedef struct COUNTING_IO_TAG
+{
+    ON_BYTES_RECEIVED on_bytes_received;
+    void* on_bytes_received_context;
+    size_t sends;
+    size_t records;
+    size_t bytes;
+} COUNTING_IO;
+
+static COUNTING_IO g_counting_io;
+
+static CONCRETE_IO_HANDLE counting_io_create(void* io_create_parameters)
+{
+    (void)io_create_parameters;
+    memset(&g_counting_io, 0, sizeof(g_counting_io));
+    return &g_counting_io;
+}
+
+static void counting_io_destroy(CONCRETE_IO_HANDLE concrete_io)
+{
+    (void)concrete_io;
+}
+
+static int counting_io_open(CONCRETE_IO_HANDLE concrete_io, ON_IO_OPEN_COMPLETE on_io_open_complete, void* on_io_open_complete_context, ON_BYTES_RECEIVED on_bytes_received, void* on_bytes_received_context, ON_IO_ERROR on_io_error, void* on_io_error_context)
+{
+    COUNTING_IO* counting_io = (COUNTING_IO*)concrete_io;
+    (void)on_io_error;
+    (void)on_io_error_context;
+    counting_io->on_bytes_received = on_bytes_received;
+    counting_io->on_bytes_received_context = on_bytes_received_context;
+    on_io_open_complete(on_io_open_complete_context, IO_OPEN_OK);
+    return 0;
+}
+
+static int counting_io_close(CONCRETE_IO_HANDLE concrete_io, ON_IO_CLOSE_COMPLETE on_io_close_complete, void* callback_context)
+{
+    (void)concrete_io;
+    if (on_io_close_complete != NULL)
+    {
+        on_io_close_complete(callback_context);
+    }
+    return 0;
+}
+
+static int counting_io_send(CONCRETE_IO_HANDLE concrete_io, const void* buffer, size_t size, ON_SEND_COMPLETE on_send_complete, void* callback_context)
+{
+    COUNTING_IO* counting_io = (COUNTING_IO*)concrete_io;
+    (void)buffer;
+    counting_io->sends++;
+    counting_io->records += (size + BENCH_TLS_RECORD_SIZE - 1) / BENCH_TLS_RECORD_SIZE;
+    counting_io->bytes += size;
+    if (on_send_complete != NULL)
+    {
+        on_send_complete(callback_context, IO_SEND_OK);
+    }
+    return 0;
+}
+
+static void counting_io_dowork(CONCRETE_IO_HANDLE concrete_io)
+{
+    (void)concrete_io;
+}
+
+static int counting_io_setoption(CONCRETE_IO_HANDLE concrete_io, const char* optionName, const void* value)
+{
+    (void)concrete_io;
+    (void)optionName;
+    (void)value;
+    return 0;
+}
+
+static const IO_INTERFACE_DESCRIPTION counting_io_interface =
+{
+    NULL,
+    counting_io_create,
+    counting_io_destroy,
+    counting_io_open,
+    counting_io_close,
+    counting_io_send,
+    counting_io_dowork,
+    counting_io_setoption
+};
+
+static MQTT_CLIENT_ACK_OPTION on_message_recv(MQTT_MESSAGE_HANDLE msgHandle, void* context)
+{
+    (void)msgHandle;
+    (void)context;
+    return MQTT_CLIENT_ACK_SYNC;
+}
+
+static void on_operation_complete(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx)
+{
+    (void)handle;
+    (void)actionResult;
+    (void)msgInfo;
+    (void)callbackCtx;
+}
+
+static void on_error(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+{
+    (void)handle;
+    (void)callbackCtx;
+    (void)printf("mqtt client error %d\r\n", (int)error);
+}
+
+static int run_publish(const COALESCE_SETTING* setting, QOS_VALUE qos, double* elapsed)
+{
+    int result = 0;
+    XIO_HANDLE xio = xio_create(&counting_io_interface, NULL);
+    MQTT_CLIENT_HANDLE client = mqtt_client_init(on_message_recv, on_operation_complete, NULL, on_error, NULL);
+    if (xio == NULL || client == NULL)
+    {
+        (void)printf("Failed creating the client\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        MQTT_CLIENT_OPTIONS options;
+        unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+
+        memset(&options, 0, sizeof(options));
+        options.clientId = "bench-device";
+        options.keepAliveInterval = 240;
+        options.useCleanSession = true;
+        options.qualityOfServiceValue = DELIVER_AT_MOST_ONCE;
+
+        if (mqtt_client_connect(client, xio, &options) != 0 ||
+            mqtt_client_set_send_coalescing(client, setting->maxBytes, setting->maxLatencyMs) != 0)
+        {
+            (void)printf("Failed connecting the client\r\n");
+            result = __LINE__;
+        }
+        else
+        {
+            size_t tick;
+            size_t publishPerTick = BENCH_PUBLISH_PER_SEC / (1000 / BENCH_TICK_MS);
+            uint16_t packetId = 0;
+            clock_t start;
+
+            g_counting_io.on_bytes_received(g_counting_io.on_bytes_received_context, connack, sizeof(connack));
+            g_counting_io.sends = 0;
+            g_counting_io.records = 0;
+            g_counting_io.bytes = 0;
+
+            start = clock();
+            for (tick = 0; tick < BENCH_SECONDS * (1000 / BENCH_TICK_MS) && result == 0; tick++)
+            {
+                size_t index;
+                for (index = 0; index < publishPerTick; index++)
+                {
+                    MQTT_MESSAGE_HANDLE msg;
+                    packetId = (packetId == UINT16_MAX) ? 1 : (uint16_t)(packetId + 1);
+                    msg = mqttmessage_create_in_place(packetId, BENCH_TOPIC, qos, (const uint8_t*)BENCH_PAYLOAD, sizeof(BENCH_PAYLOAD) - 1);
+                    if (msg == NULL || mqtt_client_publish(client, msg) != 0)
+                    {
+                        (void)printf("Failed publishing message %lu\r\n", (unsigned long)packetId);
+                        result = __LINE__;
+                    }
+                    mqttmessage_destroy(msg);
+                }
+                mqtt_client_dowork(client);
+            }
+            *elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        }
+    }
+    mqtt_client_deinit(client);
+    xio_destroy(xio);
+    return result;
+}
+
+int main(void)
+{
+    int result = 0;
+    size_t qosIndex;
+
+    (void)printf("%4s %10s %10s %10s %10s %12s %10s\r\n", "qos", "max bytes", "latency", "xio_send", "records", "bytes", "ms");
+    for (qosIndex = 0; qosIndex < sizeof(QOS_VALUES) / sizeof(QOS_VALUES[0]) && result == 0; qosIndex++)
+    {
+        size_t settingIndex;
+        size_t baseBytes = 0;
+        for (settingIndex = 0; settingIndex < sizeof(COALESCE_SETTINGS) / sizeof(COALESCE_SETTINGS[0]) && result == 0; settingIndex++)
+        {
+            double elapsed = 0.0;
+            result = run_publish(&COALESCE_SETTINGS[settingIndex], QOS_VALUES[qosIndex], &elapsed);
+            if (settingIndex == 0)
+            {
+                baseBytes = g_counting_io.bytes;
+            }
+            else if (g_counting_io.bytes != baseBytes)
+            {
+                (void)printf("Coalesced stream is %lu bytes, expected %lu\r\n", (unsigned long)g_counting_io.bytes, (unsigned long)baseBytes);
+                result = __LINE__;
+            }
+            (void)printf("%4d %10lu %10lu %10lu %10lu %12lu %10.1f\r\n", (int)QOS_VALUES[qosIndex],
+                (unsigned long)COALESCE_SETTINGS[settingIndex].maxBytes, (unsigned long)COALESCE_SETTINGS[settingIndex].maxLatencyMs,
+                (unsigned long)g_counting_io.sends, (unsigned long)g_counting_io.records, (unsigned long)g_counting_io.bytes, elapsed * 1000.0);
+        }
+    }
+    return result;
+}
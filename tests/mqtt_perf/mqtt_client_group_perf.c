@@ -0,0 +1,434 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Idle cost and input latency of many clients driven by mqtt_client_group against
+// one thread polling all of them.
+//
+// PERF_CLIENTS connected clients are driven by a thread that calls
+// mqtt_client_dowork for every client and then sleeps 10 ms, and by groups of
+// one and four workers.  For each it reports the CPU time the process used over
+// one second with nothing to do and the delay from a packet being written to the
+// socket of a client to its message callback.  The transport of every client
+// reads from its own pipe, which stands in for the socket of a real connection.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "azure_c_shared_utility/xio.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_client_group.h"
+
+#define PERF_CLIENTS                200
+#define PERF_IDLE_MS                1000
+#define PERF_SAMPLES                1000
+#define PERF_SAMPLE_INTERVAL_MS     1
+#define PERF_POLL_INTERVAL_MS       10
+#define PERF_DRAIN_TIMEOUT_MS       1000
+#define PERF_RECV_POOL_BYTES        (64 * 1024)
+
+typedef enum DRIVE_MODE_TAG
+{
+    DRIVE_SLEEP,
+    DRIVE_GROUP_1,
+    DRIVE_GROUP_4
+} DRIVE_MODE;
+
+static const char* const DRIVE_MODE_NAMES[] = { "sleep 10ms", "group x1", "group x4" };
+
+// Only touched by the thread that drives the client
+typedef struct PIPE_IO_TAG
+{
+    int readFd;
+    int writeFd;
+    ON_BYTES_RECEIVED on_bytes_received;
+    void* on_bytes_received_context;
+} PIPE_IO;
+
+typedef struct PERF_CONTEXT_TAG
+{
+    MQTT_CLIENT_HANDLE clients[PERF_CLIENTS];
+    XIO_HANDLE xios[PERF_CLIENTS];
+    PIPE_IO ios[PERF_CLIENTS];
+    MQTT_CLIENT_GROUP_HANDLE group;
+    int sampling;
+    int stop;
+    size_t received;
+    double startUs[PERF_SAMPLES];
+    double latencyUs[PERF_SAMPLES];
+} PERF_CONTEXT;
+
+static PERF_CONTEXT g_perf;
+
+static double now_us(void)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000000.0 + (double)now.tv_nsec / 1000.0;
+}
+
+static uint32_t read_uint32(const unsigned char* data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static void write_uint32(unsigned char* data, uint32_t value)
+{
+    data[0] = (unsigned char)(value >> 24);
+    data[1] = (unsigned char)(value >> 16);
+    data[2] = (unsigned char)(value >> 8);
+    data[3] = (unsigned char)value;
+}
+
+static CONCRETE_IO_HANDLE pipe_io_create(void* io_create_parameters)
+{
+    PIPE_IO* pipe_io = (PIPE_IO*)io_create_parameters;
+    int fds[2];
+    if (pipe(fds) != 0 || fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0)
+    {
+        return NULL;
+    }
+    pipe_io->readFd = fds[0];
+    pipe_io->writeFd = fds[1];
+    return pipe_io;
+}
+
+static void pipe_io_destroy(CONCRETE_IO_HANDLE concrete_io)
+{
+    PIPE_IO* pipe_io = (PIPE_IO*)concrete_io;
+    (void)close(pipe_io->readFd);
+    (void)close(pipe_io->writeFd);
+}
+
+static int pipe_io_open(CONCRETE_IO_HANDLE concrete_io, ON_IO_OPEN_COMPLETE on_io_open_complete, void* on_io_open_complete_context, ON_BYTES_RECEIVED on_bytes_received, void* on_bytes_received_context, ON_IO_ERROR on_io_error, void* on_io_error_context)
+{
+    PIPE_IO* pipe_io = (PIPE_IO*)concrete_io;
+    (void)on_io_error;
+    (void)on_io_error_context;
+    pipe_io->on_bytes_received = on_bytes_received;
+    pipe_io->on_bytes_received_context = on_bytes_received_context;
+    on_io_open_complete(on_io_open_complete_context, IO_OPEN_OK);
+    return 0;
+}
+
+static int pipe_io_close(CONCRETE_IO_HANDLE concrete_io, ON_IO_CLOSE_COMPLETE on_io_close_complete, void* callback_context)
+{
+    (void)concrete_io;
+    if (on_io_close_complete != NULL)
+    {
+        on_io_close_complete(callback_context);
+    }
+    return 0;
+}
+
+static int pipe_io_send(CONCRETE_IO_HANDLE concrete_io, const void* buffer, size_t size, ON_SEND_COMPLETE on_send_complete, void* callback_context)
+{
+    (void)concrete_io;
+    (void)buffer;
+    (void)size;
+    if (on_send_complete != NULL)
+    {
+        on_send_complete(callback_context, IO_SEND_OK);
+    }
+    return 0;
+}
+
+static void pipe_io_dowork(CONCRETE_IO_HANDLE concrete_io)
+{
+    PIPE_IO* pipe_io = (PIPE_IO*)concrete_io;
+    unsigned char buffer[4096];
+    ssize_t length;
+
+    while ((length = read(pipe_io->readFd, buffer, sizeof(buffer))) > 0)
+    {
+        pipe_io->on_bytes_received(pipe_io->on_bytes_received_context, buffer, (size_t)length);
+    }
+}
+
+static int pipe_io_setoption(CONCRETE_IO_HANDLE concrete_io, const char* optionName, const void* value)
+{
+    (void)concrete_io;
+    (void)optionName;
+    (void)value;
+    return 0;
+}
+
+static const IO_INTERFACE_DESCRIPTION pipe_io_interface =
+{
+    NULL,
+    pipe_io_create,
+    pipe_io_destroy,
+    pipe_io_open,
+    pipe_io_close,
+    pipe_io_send,
+    pipe_io_dowork,
+    pipe_io_setoption
+};
+
+static int get_pipe_socket(void* context)
+{
+    return ((PIPE_IO*)context)->readFd;
+}
+
+// Runs on the thread that drives the client, every message carries its sample index
+static MQTT_CLIENT_ACK_OPTION on_message_recv(MQTT_MESSAGE_HANDLE msgHandle, void* context)
+{
+    PERF_CONTEXT* perf = (PERF_CONTEXT*)context;
+    const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(msgHandle);
+    if (payload != NULL && payload->length == 4)
+    {
+        uint32_t sample = read_uint32(payload->message);
+        if (sample < PERF_SAMPLES)
+        {
+            perf->latencyUs[sample] = now_us() - perf->startUs[sample];
+            (void)__atomic_add_fetch(&perf->received, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return MQTT_CLIENT_ACK_NONE;
+}
+
+static void on_operation_complete(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx)
+{
+    (void)handle;
+    (void)actionResult;
+    (void)msgInfo;
+    (void)callbackCtx;
+}
+
+static void on_error(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+{
+    (void)handle;
+    (void)callbackCtx;
+    (void)printf("mqtt client error %d\r\n", (int)error);
+}
+
+// A QoS 0 PUBLISH on topic "t", as the server would send it, to the client the sample falls on
+static int write_sample(PERF_CONTEXT* perf, uint32_t sample)
+{
+    unsigned char packet[] = { 0x30, 0x07, 0x00, 0x01, 't', 0x00, 0x00, 0x00, 0x00 };
+    int writeFd = perf->ios[(sample * 7) % PERF_CLIENTS].writeFd;
+    write_uint32(packet + 5, sample);
+    perf->startUs[sample] = now_us();
+    return write(writeFd, packet, sizeof(packet)) == (ssize_t)sizeof(packet) ? 0 : __LINE__;
+}
+
+// Produces the samples from its own thread and then stops the polling thread
+static int control(void* context)
+{
+    PERF_CONTEXT* perf = (PERF_CONTEXT*)context;
+    int result = 0;
+
+    if (!perf->sampling)
+    {
+        ThreadAPI_Sleep(PERF_IDLE_MS);
+    }
+    else
+    {
+        uint32_t sample;
+        unsigned int waited = 0;
+        for (sample = 0; sample < PERF_SAMPLES && result == 0; sample++)
+        {
+            result = write_sample(perf, sample);
+            ThreadAPI_Sleep(PERF_SAMPLE_INTERVAL_MS);
+        }
+        while (__atomic_load_n(&perf->received, __ATOMIC_ACQUIRE) < PERF_SAMPLES && waited < PERF_DRAIN_TIMEOUT_MS)
+        {
+            ThreadAPI_Sleep(1);
+            waited++;
+        }
+    }
+    __atomic_store_n(&perf->stop, 1, __ATOMIC_RELEASE);
+    return result;
+}
+
+static void drive(PERF_CONTEXT* perf, DRIVE_MODE mode)
+{
+    while (!__atomic_load_n(&perf->stop, __ATOMIC_ACQUIRE))
+    {
+        if (mode == DRIVE_SLEEP)
+        {
+            size_t index;
+            for (index = 0; index < PERF_CLIENTS; index++)
+            {
+                mqtt_client_dowork(perf->clients[index]);
+            }
+        }
+        ThreadAPI_Sleep(PERF_POLL_INTERVAL_MS);
+    }
+}
+
+static int compare_double(const void* left, const void* right)
+{
+    double a = *(const double*)left;
+    double b = *(const double*)right;
+    return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+static int run_scenario(PERF_CONTEXT* perf, DRIVE_MODE mode, int sampling, double* cpuMs, double* medianUs, double* maxUs)
+{
+    int result = 0;
+    THREAD_HANDLE thread;
+    int threadResult = 0;
+    clock_t start;
+
+    perf->sampling = sampling;
+    perf->stop = 0;
+    perf->received = 0;
+
+    start = clock();
+    if (ThreadAPI_Create(&thread, control, perf) != THREADAPI_OK)
+    {
+        (void)printf("Failed starting the control thread\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        // The main thread of the group modes only waits for the control thread
+        drive(perf, mode);
+        (void)ThreadAPI_Join(thread, &threadResult);
+        *cpuMs = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+        if (threadResult != 0)
+        {
+            (void)printf("Failed producing samples at line %d\r\n", threadResult);
+            result = __LINE__;
+        }
+        else if (sampling)
+        {
+            if (__atomic_load_n(&perf->received, __ATOMIC_ACQUIRE) != PERF_SAMPLES)
+            {
+                (void)printf("Received %lu of %d samples\r\n", (unsigned long)perf->received, PERF_SAMPLES);
+                result = __LINE__;
+            }
+            else
+            {
+                qsort(perf->latencyUs, PERF_SAMPLES, sizeof(perf->latencyUs[0]), compare_double);
+                *medianUs = perf->latencyUs[PERF_SAMPLES / 2];
+                *maxUs = perf->latencyUs[PERF_SAMPLES - 1];
+            }
+        }
+    }
+    return result;
+}
+
+static int connect_clients(PERF_CONTEXT* perf)
+{
+    int result = 0;
+    size_t index;
+    MQTT_CLIENT_OPTIONS options;
+    unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+
+    memset(&options, 0, sizeof(options));
+    options.clientId = "perf-device";
+    options.keepAliveInterval = 240;
+    options.useCleanSession = true;
+    options.qualityOfServiceValue = DELIVER_AT_MOST_ONCE;
+
+    for (index = 0; index < PERF_CLIENTS && result == 0; index++)
+    {
+        perf->xios[index] = xio_create(&pipe_io_interface, &perf->ios[index]);
+        perf->clients[index] = mqtt_client_init(on_message_recv, on_operation_complete, perf, on_error, NULL);
+        if (perf->xios[index] == NULL || perf->clients[index] == NULL ||
+            mqtt_client_connect(perf->clients[index], perf->xios[index], &options) != 0)
+        {
+            (void)printf("Failed connecting client %lu\r\n", (unsigned long)index);
+            result = __LINE__;
+        }
+        else
+        {
+            // Read by the first mqtt_client_dowork of whichever thread drives the client
+            result = write(perf->ios[index].writeFd, connack, sizeof(connack)) == (ssize_t)sizeof(connack) ? 0 : __LINE__;
+        }
+    }
+    return result;
+}
+
+static void disconnect_clients(PERF_CONTEXT* perf)
+{
+    size_t index;
+    for (index = 0; index < PERF_CLIENTS; index++)
+    {
+        mqtt_client_deinit(perf->clients[index]);
+        xio_destroy(perf->xios[index]);
+    }
+}
+
+static int create_group(PERF_CONTEXT* perf, size_t workerCount)
+{
+    int result = 0;
+    size_t index;
+    MQTT_CLIENT_GROUP_OPTIONS options;
+
+    options.workerCount = workerCount;
+    options.maxWaitMs = 0;
+    options.recvPoolHighWaterMark = PERF_RECV_POOL_BYTES;
+
+    if ((perf->group = mqtt_client_group_create(&options)) == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        for (index = 0; index < PERF_CLIENTS && result == 0; index++)
+        {
+            if (mqtt_client_group_add(perf->group, perf->clients[index], get_pipe_socket, &perf->ios[index]) == NULL)
+            {
+                result = __LINE__;
+            }
+        }
+        if (result == 0 && mqtt_client_group_start(perf->group) != 0)
+        {
+            result = __LINE__;
+        }
+    }
+    if (result != 0)
+    {
+        (void)printf("Failed creating the client group\r\n");
+    }
+    return result;
+}
+
+static int run_mode(DRIVE_MODE mode)
+{
+    int result;
+    PERF_CONTEXT* perf = &g_perf;
+
+    memset(perf, 0, sizeof(*perf));
+    if ((result = connect_clients(perf)) == 0 &&
+        (mode == DRIVE_SLEEP || (result = create_group(perf, mode == DRIVE_GROUP_1 ? 1 : 4)) == 0))
+    {
+        double idleCpuMs = 0.0;
+        double cpuMs = 0.0;
+        double inputMedianUs = 0.0;
+        double inputMaxUs = 0.0;
+
+        // Lets the clients read their CONNACK before the idle time is measured
+        ThreadAPI_Sleep(2 * PERF_POLL_INTERVAL_MS);
+        if ((result = run_scenario(perf, mode, 0, &idleCpuMs, NULL, NULL)) == 0 &&
+            (result = run_scenario(perf, mode, 1, &cpuMs, &inputMedianUs, &inputMaxUs)) == 0)
+        {
+            (void)printf("%-12s %12.1f %12.1f %12.1f\r\n", DRIVE_MODE_NAMES[mode], idleCpuMs, inputMedianUs, inputMaxUs);
+        }
+    }
+    // Destroying the group stops its workers and hands the clients back
+    mqtt_client_group_destroy(perf->group);
+    disconnect_clients(perf);
+    return result;
+}
+
+int main(void)
+{
+    int result = 0;
+    DRIVE_MODE mode;
+
+    (void)printf("%d clients\r\n", PERF_CLIENTS);
+    (void)printf("%-12s %12s %12s %12s\r\n", "mode", "idle cpu ms", "input p50us", "input maxus");
+    for (mode = DRIVE_SLEEP; mode <= DRIVE_GROUP_4 && result == 0; mode = (DRIVE_MODE)(mode + 1))
+    {
+        result = run_mode(mode);
+    }
+    return result;
+}
@@ -0,0 +1,357 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Stress test for removing clients from mqtt_client_group while other threads submit to them.
+//
+// STRESS_PRODUCERS threads publish through mqtt_client_submit_publish to every client in
+// turn, which calls the wakeup callback the group set on the client.  They pause for a
+// millisecond after every STRESS_BATCH messages so the workers keep up.  Meanwhile the main
+// thread removes each client from the group, works it on its own thread once onRemoved ran
+// and adds it again, STRESS_ROUNDS times.  Every removal frees the member the wakeup
+// callback points at, so a wakeup still running on a producer when it is freed shows up
+// as a use after free.  Build it with -fsanitize=address or -fsanitize=thread.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "azure_c_shared_utility/xio.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_client_group.h"
+
+#define STRESS_CLIENTS              8
+#define STRESS_PRODUCERS            4
+#define STRESS_ROUNDS               500
+#define STRESS_WORKERS              2
+#define STRESS_MAX_WAIT_MS          10
+#define STRESS_REMOVE_TIMEOUT_MS    5000
+#define STRESS_BATCH                64
+#define STRESS_TOPIC                "devices/stress-device/messages/events/"
+
+// Only touched by the thread that drives the client
+typedef struct NULL_IO_TAG
+{
+    ON_BYTES_RECEIVED on_bytes_received;
+    void* on_bytes_received_context;
+    size_t sent;
+} NULL_IO;
+
+typedef struct STRESS_CONTEXT_TAG
+{
+    MQTT_CLIENT_HANDLE clients[STRESS_CLIENTS];
+    XIO_HANDLE xios[STRESS_CLIENTS];
+    NULL_IO ios[STRESS_CLIENTS];
+    MQTT_CLIENT_GROUP_HANDLE group;
+    int removed[STRESS_CLIENTS];
+    int stop;
+    size_t submitted;
+    size_t failures;
+} STRESS_CONTEXT;
+
+static STRESS_CONTEXT g_stress;
+
+static CONCRETE_IO_HANDLE null_io_create(void* io_create_parameters)
+{
+    return io_create_parameters;
+}
+
+static void null_io_destroy(CONCRETE_IO_HANDLE concrete_io)
+{
+    (void)concrete_io;
+}
+
+static int null_io_open(CONCRETE_IO_HANDLE concrete_io, ON_IO_OPEN_COMPLETE on_io_open_complete, void* on_io_open_complete_context, ON_BYTES_RECEIVED on_bytes_received, void* on_bytes_received_context, ON_IO_ERROR on_io_error, void* on_io_error_context)
+{
+    NULL_IO* null_io = (NULL_IO*)concrete_io;
+    (void)on_io_error;
+    (void)on_io_error_context;
+    null_io->on_bytes_received = on_bytes_received;
+    null_io->on_bytes_received_context = on_bytes_received_context;
+    on_io_open_complete(on_io_open_complete_context, IO_OPEN_OK);
+    return 0;
+}
+
+static int null_io_close(CONCRETE_IO_HANDLE concrete_io, ON_IO_CLOSE_COMPLETE on_io_close_complete, void* callback_context)
+{
+    (void)concrete_io;
+    if (on_io_close_complete != NULL)
+    {
+        on_io_close_complete(callback_context);
+    }
+    return 0;
+}
+
+static int null_io_send(CONCRETE_IO_HANDLE concrete_io, const void* buffer, size_t size, ON_SEND_COMPLETE on_send_complete, void* callback_context)
+{
+    NULL_IO* null_io = (NULL_IO*)concrete_io;
+    (void)buffer;
+    null_io->sent += size;
+    if (on_send_complete != NULL)
+    {
+        on_send_complete(callback_context, IO_SEND_OK);
+    }
+    return 0;
+}
+
+static void null_io_dowork(CONCRETE_IO_HANDLE concrete_io)
+{
+    (void)concrete_io;
+}
+
+static int null_io_setoption(CONCRETE_IO_HANDLE concrete_io, const char* optionName, const void* value)
+{
+    (void)concrete_io;
+    (void)optionName;
+    (void)value;
+    return 0;
+}
+
+static const IO_INTERFACE_DESCRIPTION null_io_interface =
+{
+    NULL,
+    null_io_create,
+    null_io_destroy,
+    null_io_open,
+    null_io_close,
+    null_io_send,
+    null_io_dowork,
+    null_io_setoption
+};
+
+static MQTT_CLIENT_ACK_OPTION on_message_recv(MQTT_MESSAGE_HANDLE msgHandle, void* context)
+{
+    (void)msgHandle;
+    (void)context;
+    return MQTT_CLIENT_ACK_NONE;
+}
+
+static void on_operation_complete(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx)
+{
+    (void)handle;
+    (void)actionResult;
+    (void)msgInfo;
+    (void)callbackCtx;
+}
+
+static void on_error(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+{
+    (void)handle;
+    (void)callbackCtx;
+    (void)printf("mqtt client error %d\r\n", (int)error);
+}
+
+// Runs on the worker once it let go of the client
+static void on_removed(MQTT_CLIENT_HANDLE client, void* context)
+{
+    (void)client;
+    __atomic_store_n((int*)context, 1, __ATOMIC_RELEASE);
+}
+
+static int produce(void* context)
+{
+    STRESS_CONTEXT* stress = (STRESS_CONTEXT*)context;
+    size_t index = 0;
+    uint8_t payload[] = { 's', 't', 'r', 'e', 's', 's' };
+
+    while (!__atomic_load_n(&stress->stop, __ATOMIC_ACQUIRE))
+    {
+        MQTT_MESSAGE_HANDLE msg = mqttmessage_create_in_place(1, STRESS_TOPIC, DELIVER_AT_MOST_ONCE, payload, sizeof(payload));
+        if (msg == NULL || mqtt_client_submit_publish(stress->clients[index % STRESS_CLIENTS], msg) != 0)
+        {
+            (void)__atomic_add_fetch(&stress->failures, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            (void)__atomic_add_fetch(&stress->submitted, 1, __ATOMIC_RELAXED);
+        }
+        mqttmessage_destroy(msg);
+        index++;
+        if (index % STRESS_BATCH == 0)
+        {
+            ThreadAPI_Sleep(1);
+        }
+    }
+    return 0;
+}
+
+static int connect_clients(STRESS_CONTEXT* stress)
+{
+    int result = 0;
+    size_t index;
+    MQTT_CLIENT_OPTIONS options;
+    unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+
+    memset(&options, 0, sizeof(options));
+    options.clientId = "stress-device";
+    options.keepAliveInterval = 240;
+    options.useCleanSession = true;
+    options.qualityOfServiceValue = DELIVER_AT_MOST_ONCE;
+
+    for (index = 0; index < STRESS_CLIENTS && result == 0; index++)
+    {
+        stress->xios[index] = xio_create(&null_io_interface, &stress->ios[index]);
+        stress->clients[index] = mqtt_client_init(on_message_recv, on_operation_complete, NULL, on_error, NULL);
+        if (stress->xios[index] == NULL || stress->clients[index] == NULL ||
+            mqtt_client_enable_submit_queue(stress->clients[index]) != 0 ||
+            mqtt_client_connect(stress->clients[index], stress->xios[index], &options) != 0)
+        {
+            (void)printf("Failed connecting client %lu\r\n", (unsigned long)index);
+            result = __LINE__;
+        }
+        else
+        {
+            stress->ios[index].on_bytes_received(stress->ios[index].on_bytes_received_context, connack, sizeof(connack));
+        }
+    }
+    return result;
+}
+
+// Removes the client, works it on this thread once the worker let go of it and adds it again
+static int cycle_client(STRESS_CONTEXT* stress, MQTT_CLIENT_GROUP_MEMBER_HANDLE* member, size_t index)
+{
+    int result = 0;
+    unsigned int waited = 0;
+
+    __atomic_store_n(&stress->removed[index], 0, __ATOMIC_RELAXED);
+    if (mqtt_client_group_remove(*member, on_removed, &stress->removed[index]) != 0)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        while (!__atomic_load_n(&stress->removed[index], __ATOMIC_ACQUIRE) && waited < STRESS_REMOVE_TIMEOUT_MS)
+        {
+            ThreadAPI_Sleep(1);
+            waited++;
+        }
+        if (waited == STRESS_REMOVE_TIMEOUT_MS)
+        {
+            (void)printf("Client %lu was not removed in %d ms\r\n", (unsigned long)index, STRESS_REMOVE_TIMEOUT_MS);
+            result = __LINE__;
+        }
+        else
+        {
+            mqtt_client_dowork(stress->clients[index]);
+            if ((*member = mqtt_client_group_add(stress->group, stress->clients[index], NULL, NULL)) == NULL)
+            {
+                result = __LINE__;
+            }
+        }
+    }
+    return result;
+}
+
+static int run_stress(STRESS_CONTEXT* stress, double* elapsed)
+{
+    int result;
+    MQTT_CLIENT_GROUP_MEMBER_HANDLE members[STRESS_CLIENTS];
+    MQTT_CLIENT_GROUP_OPTIONS options;
+    size_t index;
+
+    options.workerCount = STRESS_WORKERS;
+    options.maxWaitMs = STRESS_MAX_WAIT_MS;
+    options.recvPoolHighWaterMark = 0;
+
+    if ((result = connect_clients(stress)) != 0)
+    {
+        // Reported by connect_clients
+    }
+    else if ((stress->group = mqtt_client_group_create(&options)) == NULL)
+    {
+        (void)printf("Failed creating the client group\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        THREAD_HANDLE threads[STRESS_PRODUCERS];
+        size_t started = 0;
+        clock_t start;
+
+        for (index = 0; index < STRESS_CLIENTS && result == 0; index++)
+        {
+            if ((members[index] = mqtt_client_group_add(stress->group, stress->clients[index], NULL, NULL)) == NULL)
+            {
+                result = __LINE__;
+            }
+        }
+        if (result == 0 && mqtt_client_group_start(stress->group) != 0)
+        {
+            result = __LINE__;
+        }
+
+        start = clock();
+        for (index = 0; index < STRESS_PRODUCERS && result == 0; index++)
+        {
+            if (ThreadAPI_Create(&threads[index], produce, stress) != THREADAPI_OK)
+            {
+                (void)printf("Failed starting producer %lu\r\n", (unsigned long)index);
+                result = __LINE__;
+            }
+            else
+            {
+                started++;
+            }
+        }
+
+        if (result == 0)
+        {
+            size_t round;
+            for (round = 0; round < STRESS_ROUNDS && result == 0; round++)
+            {
+                for (index = 0; index < STRESS_CLIENTS && result == 0; index++)
+                {
+                    result = cycle_client(stress, &members[index], index);
+                }
+            }
+            if (result != 0)
+            {
+                (void)printf("Failed cycling the clients at line %d\r\n", result);
+            }
+        }
+
+        __atomic_store_n(&stress->stop, 1, __ATOMIC_RELEASE);
+        for (index = 0; index < started; index++)
+        {
+            int threadResult;
+            (void)ThreadAPI_Join(threads[index], &threadResult);
+        }
+        *elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        // Destroying the group stops its workers and hands the clients back
+        mqtt_client_group_destroy(stress->group);
+        if (result == 0 && stress->failures != 0)
+        {
+            (void)printf("%lu submits failed\r\n", (unsigned long)stress->failures);
+            result = __LINE__;
+        }
+    }
+
+    for (index = 0; index < STRESS_CLIENTS; index++)
+    {
+        if (stress->clients[index] != NULL)
+        {
+            mqtt_client_deinit(stress->clients[index]);
+        }
+        if (stress->xios[index] != NULL)
+        {
+            xio_destroy(stress->xios[index]);
+        }
+    }
+    return result;
+}
+
+int main(void)
+{
+    int result;
+    double elapsed = 0.0;
+    STRESS_CONTEXT* stress = &g_stress;
+
+    memset(stress, 0, sizeof(*stress));
+    result = run_stress(stress, &elapsed);
+    (void)printf("%10s %10s %10s %12s %10s\r\n", "clients", "producers", "removals", "submits", "ms");
+    (void)printf("%10d %10d %10d %12lu %10.1f\r\n", STRESS_CLIENTS, STRESS_PRODUCERS, STRESS_CLIENTS * STRESS_ROUNDS,
+        (unsigned long)stress->submitted, elapsed * 1000.0);
+    return result;
+}
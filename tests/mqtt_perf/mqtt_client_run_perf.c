@@ -0,0 +1,432 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Idle cost and wakeup latency of mqtt_client_run against polling mqtt_client_dowork.
+//
+// One connected client is driven three ways: calling mqtt_client_dowork in a
+// tight loop the way the sample did, calling it every 10 ms, and
+// mqtt_client_run.  For each it reports the CPU time the process used over one
+// second with nothing to do, and the delay from another thread calling
+// mqtt_client_submit_publish to the packet reaching the transport and from a
+// packet being written to the socket to the message callback.  The transport
+// reads from a pipe, which stands in for the socket of a real connection.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "azure_c_shared_utility/xio.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_client_run.h"
+
+#define PERF_IDLE_MS                1000
+#define PERF_SAMPLES                200
+#define PERF_SAMPLE_INTERVAL_MS     2
+#define PERF_POLL_INTERVAL_MS       10
+#define PERF_DRAIN_TIMEOUT_MS       1000
+#define PERF_TOPIC                  "t"
+
+typedef enum DRIVE_MODE_TAG
+{
+    DRIVE_BUSY,
+    DRIVE_SLEEP,
+    DRIVE_RUN
+} DRIVE_MODE;
+
+static const char* const DRIVE_MODE_NAMES[] = { "busy", "sleep 10ms", "run" };
+
+typedef enum SCENARIO_TAG
+{
+    SCENARIO_IDLE,
+    SCENARIO_SUBMIT,
+    SCENARIO_INPUT
+} SCENARIO;
+
+// Written by the thread that drives the client, read once it stopped
+typedef struct PIPE_IO_TAG
+{
+    int readFd;
+    int writeFd;
+    ON_BYTES_RECEIVED on_bytes_received;
+    void* on_bytes_received_context;
+    size_t doworkCalls;
+} PIPE_IO;
+
+typedef struct PERF_CONTEXT_TAG
+{
+    MQTT_CLIENT_HANDLE client;
+    MQTT_CLIENT_RUN_HANDLE run;
+    PIPE_IO* io;
+    SCENARIO scenario;
+    int stop;
+    size_t received;
+    double startUs[PERF_SAMPLES];
+    double latencyUs[PERF_SAMPLES];
+} PERF_CONTEXT;
+
+static PIPE_IO g_pipe_io;
+static PERF_CONTEXT g_perf;
+
+static double now_us(void)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000000.0 + (double)now.tv_nsec / 1000.0;
+}
+
+static uint32_t read_uint32(const unsigned char* data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static void write_uint32(unsigned char* data, uint32_t value)
+{
+    data[0] = (unsigned char)(value >> 24);
+    data[1] = (unsigned char)(value >> 16);
+    data[2] = (unsigned char)(value >> 8);
+    data[3] = (unsigned char)value;
+}
+
+// Every message carries its sample index as the last four bytes
+static void record_sample(PERF_CONTEXT* perf, const unsigned char* payload)
+{
+    uint32_t sample = read_uint32(payload);
+    if (sample < PERF_SAMPLES)
+    {
+        perf->latencyUs[sample] = now_us() - perf->startUs[sample];
+        (void)__atomic_add_fetch(&perf->received, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static CONCRETE_IO_HANDLE pipe_io_create(void* io_create_parameters)
+{
+    int fds[2];
+    (void)io_create_parameters;
+    memset(&g_pipe_io, 0, sizeof(g_pipe_io));
+    if (pipe(fds) != 0 || fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0)
+    {
+        return NULL;
+    }
+    g_pipe_io.readFd = fds[0];
+    g_pipe_io.writeFd = fds[1];
+    return &g_pipe_io;
+}
+
+static void pipe_io_destroy(CONCRETE_IO_HANDLE concrete_io)
+{
+    PIPE_IO* pipe_io = (PIPE_IO*)concrete_io;
+    (void)close(pipe_io->readFd);
+    (void)close(pipe_io->writeFd);
+}
+
+static int pipe_io_open(CONCRETE_IO_HANDLE concrete_io, ON_IO_OPEN_COMPLETE on_io_open_complete, void* on_io_open_complete_context, ON_BYTES_RECEIVED on_bytes_received, void* on_bytes_received_context, ON_IO_ERROR on_io_error, void* on_io_error_context)
+{
+    PIPE_IO* pipe_io = (PIPE_IO*)concrete_io;
+    (void)on_io_error;
+    (void)on_io_error_context;
+    pipe_io->on_bytes_received = on_bytes_received;
+    pipe_io->on_bytes_received_context = on_bytes_received_context;
+    on_io_open_complete(on_io_open_complete_context, IO_OPEN_OK);
+    return 0;
+}
+
+static int pipe_io_close(CONCRETE_IO_HANDLE concrete_io, ON_IO_CLOSE_COMPLETE on_io_close_complete, void* callback_context)
+{
+    (void)concrete_io;
+    if (on_io_close_complete != NULL)
+    {
+        on_io_close_complete(callback_context);
+    }
+    return 0;
+}
+
+static int pipe_io_send(CONCRETE_IO_HANDLE concrete_io, const void* buffer, size_t size, ON_SEND_COMPLETE on_send_complete, void* callback_context)
+{
+    const unsigned char* data = (const unsigned char*)buffer;
+    (void)concrete_io;
+    if (g_perf.scenario == SCENARIO_SUBMIT && size > 4 && (data[0] & 0xf0) == 0x30)
+    {
+        record_sample(&g_perf, data + size - 4);
+    }
+    if (on_send_complete != NULL)
+    {
+        on_send_complete(callback_context, IO_SEND_OK);
+    }
+    return 0;
+}
+
+static void pipe_io_dowork(CONCRETE_IO_HANDLE concrete_io)
+{
+    PIPE_IO* pipe_io = (PIPE_IO*)concrete_io;
+    unsigned char buffer[4096];
+    ssize_t length;
+
+    pipe_io->doworkCalls++;
+    while ((length = read(pipe_io->readFd, buffer, sizeof(buffer))) > 0)
+    {
+        pipe_io->on_bytes_received(pipe_io->on_bytes_received_context, buffer, (size_t)length);
+    }
+}
+
+static int pipe_io_setoption(CONCRETE_IO_HANDLE concrete_io, const char* optionName, const void* value)
+{
+    (void)concrete_io;
+    (void)optionName;
+    (void)value;
+    return 0;
+}
+
+static const IO_INTERFACE_DESCRIPTION pipe_io_interface =
+{
+    NULL,
+    pipe_io_create,
+    pipe_io_destroy,
+    pipe_io_open,
+    pipe_io_close,
+    pipe_io_send,
+    pipe_io_dowork,
+    pipe_io_setoption
+};
+
+static int get_pipe_socket(void* context)
+{
+    return ((PIPE_IO*)context)->readFd;
+}
+
+static MQTT_CLIENT_ACK_OPTION on_message_recv(MQTT_MESSAGE_HANDLE msgHandle, void* context)
+{
+    const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(msgHandle);
+    (void)context;
+    if (payload != NULL && payload->length == 4)
+    {
+        record_sample(&g_perf, payload->message);
+    }
+    return MQTT_CLIENT_ACK_NONE;
+}
+
+static void on_operation_complete(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx)
+{
+    (void)handle;
+    (void)actionResult;
+    (void)msgInfo;
+    (void)callbackCtx;
+}
+
+static void on_error(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+{
+    (void)handle;
+    (void)callbackCtx;
+    (void)printf("mqtt client error %d\r\n", (int)error);
+}
+
+static int submit_sample(PERF_CONTEXT* perf, uint32_t sample)
+{
+    int result;
+    unsigned char payload[4];
+    MQTT_MESSAGE_HANDLE msg;
+
+    write_uint32(payload, sample);
+    perf->startUs[sample] = now_us();
+    msg = mqttmessage_create_in_place(1, PERF_TOPIC, DELIVER_AT_MOST_ONCE, payload, sizeof(payload));
+    result = (msg == NULL || mqtt_client_submit_publish(perf->client, msg) != 0) ? __LINE__ : 0;
+    mqttmessage_destroy(msg);
+    return result;
+}
+
+// A QoS 0 PUBLISH on PERF_TOPIC, as the server would send it
+static int write_sample(PERF_CONTEXT* perf, uint32_t sample)
+{
+    unsigned char packet[] = { 0x30, 0x07, 0x00, 0x01, 't', 0x00, 0x00, 0x00, 0x00 };
+    write_uint32(packet + 5, sample);
+    perf->startUs[sample] = now_us();
+    return write(perf->io->writeFd, packet, sizeof(packet)) == (ssize_t)sizeof(packet) ? 0 : __LINE__;
+}
+
+// Produces the samples of the scenario from its own thread and then stops the driving thread
+static int control(void* context)
+{
+    PERF_CONTEXT* perf = (PERF_CONTEXT*)context;
+    int result = 0;
+    uint32_t sample;
+
+    if (perf->scenario == SCENARIO_IDLE)
+    {
+        ThreadAPI_Sleep(PERF_IDLE_MS);
+    }
+    else
+    {
+        unsigned int waited = 0;
+        for (sample = 0; sample < PERF_SAMPLES && result == 0; sample++)
+        {
+            result = (perf->scenario == SCENARIO_SUBMIT) ? submit_sample(perf, sample) : write_sample(perf, sample);
+            ThreadAPI_Sleep(PERF_SAMPLE_INTERVAL_MS);
+        }
+        while (__atomic_load_n(&perf->received, __ATOMIC_ACQUIRE) < PERF_SAMPLES && waited < PERF_DRAIN_TIMEOUT_MS)
+        {
+            ThreadAPI_Sleep(1);
+            waited++;
+        }
+    }
+    __atomic_store_n(&perf->stop, 1, __ATOMIC_RELEASE);
+    if (perf->run != NULL)
+    {
+        (void)mqtt_client_run_stop(perf->run);
+    }
+    return result;
+}
+
+static void drive(PERF_CONTEXT* perf, DRIVE_MODE mode)
+{
+    if (mode == DRIVE_RUN)
+    {
+        (void)mqtt_client_run(perf->run);
+    }
+    else
+    {
+        while (!__atomic_load_n(&perf->stop, __ATOMIC_ACQUIRE))
+        {
+            mqtt_client_dowork(perf->client);
+            if (mode == DRIVE_SLEEP)
+            {
+                ThreadAPI_Sleep(PERF_POLL_INTERVAL_MS);
+            }
+        }
+    }
+}
+
+static int compare_double(const void* left, const void* right)
+{
+    double a = *(const double*)left;
+    double b = *(const double*)right;
+    return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+static int run_scenario(PERF_CONTEXT* perf, DRIVE_MODE mode, SCENARIO scenario, double* cpuMs, double* medianUs, double* maxUs)
+{
+    int result = 0;
+    THREAD_HANDLE thread;
+    int threadResult = 0;
+    clock_t start;
+
+    perf->scenario = scenario;
+    perf->stop = 0;
+    perf->received = 0;
+    perf->io->doworkCalls = 0;
+
+    start = clock();
+    if (ThreadAPI_Create(&thread, control, perf) != THREADAPI_OK)
+    {
+        (void)printf("Failed starting the control thread\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        drive(perf, mode);
+        (void)ThreadAPI_Join(thread, &threadResult);
+        *cpuMs = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+        if (threadResult != 0)
+        {
+            (void)printf("Failed producing samples at line %d\r\n", threadResult);
+            result = __LINE__;
+        }
+        else if (scenario != SCENARIO_IDLE)
+        {
+            if (perf->received != PERF_SAMPLES)
+            {
+                (void)printf("Received %lu of %d samples\r\n", (unsigned long)perf->received, PERF_SAMPLES);
+                result = __LINE__;
+            }
+            else
+            {
+                qsort(perf->latencyUs, PERF_SAMPLES, sizeof(perf->latencyUs[0]), compare_double);
+                *medianUs = perf->latencyUs[PERF_SAMPLES / 2];
+                *maxUs = perf->latencyUs[PERF_SAMPLES - 1];
+            }
+        }
+    }
+    return result;
+}
+
+static int run_mode(DRIVE_MODE mode)
+{
+    int result = 0;
+    PERF_CONTEXT* perf = &g_perf;
+    XIO_HANDLE xio = xio_create(&pipe_io_interface, NULL);
+
+    memset(perf, 0, sizeof(*perf));
+    perf->client = mqtt_client_init(on_message_recv, on_operation_complete, NULL, on_error, NULL);
+    perf->io = &g_pipe_io;
+    if (xio == NULL || perf->client == NULL)
+    {
+        (void)printf("Failed creating the client\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        MQTT_CLIENT_OPTIONS options;
+        MQTT_CLIENT_RUN_OPTIONS runOptions;
+        unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+
+        memset(&options, 0, sizeof(options));
+        options.clientId = "perf-device";
+        options.keepAliveInterval = 240;
+        options.useCleanSession = true;
+        options.qualityOfServiceValue = DELIVER_AT_MOST_ONCE;
+
+        runOptions.getSocket = get_pipe_socket;
+        runOptions.getSocketContext = &g_pipe_io;
+        runOptions.maxWaitMs = 0;
+
+        if (mqtt_client_enable_submit_queue(perf->client) != 0 ||
+            mqtt_client_connect(perf->client, xio, &options) != 0 ||
+            (mode == DRIVE_RUN && (perf->run = mqtt_client_run_create(perf->client, &runOptions)) == NULL))
+        {
+            (void)printf("Failed connecting the client\r\n");
+            result = __LINE__;
+        }
+        else
+        {
+            double idleCpuMs = 0.0;
+            double cpuMs = 0.0;
+            double submitMedianUs = 0.0;
+            double submitMaxUs = 0.0;
+            double inputMedianUs = 0.0;
+            double inputMaxUs = 0.0;
+            size_t idleDoworkCalls;
+
+            g_pipe_io.on_bytes_received(g_pipe_io.on_bytes_received_context, connack, sizeof(connack));
+
+            if ((result = run_scenario(perf, mode, SCENARIO_IDLE, &idleCpuMs, NULL, NULL)) == 0)
+            {
+                idleDoworkCalls = g_pipe_io.doworkCalls;
+                if ((result = run_scenario(perf, mode, SCENARIO_SUBMIT, &cpuMs, &submitMedianUs, &submitMaxUs)) == 0 &&
+                    (result = run_scenario(perf, mode, SCENARIO_INPUT, &cpuMs, &inputMedianUs, &inputMaxUs)) == 0)
+                {
+                    (void)printf("%-12s %10.1f %12lu %12.1f %12.1f %12.1f %12.1f\r\n", DRIVE_MODE_NAMES[mode], idleCpuMs, (unsigned long)idleDoworkCalls,
+                        submitMedianUs, submitMaxUs, inputMedianUs, inputMaxUs);
+                }
+            }
+        }
+        mqtt_client_run_destroy(perf->run);
+    }
+    mqtt_client_deinit(perf->client);
+    xio_destroy(xio);
+    return result;
+}
+
+int main(void)
+{
+    int result = 0;
+    DRIVE_MODE mode;
+
+    (void)printf("%-12s %10s %12s %12s %12s %12s %12s\r\n", "mode", "idle cpu ms", "idle doworks", "submit p50us", "submit maxus", "input p50us", "input maxus");
+    for (mode = DRIVE_BUSY; mode <= DRIVE_RUN && result == 0; mode = (DRIVE_MODE)(mode + 1))
+    {
+        result = run_mode(mode);
+    }
+    return result;
+}
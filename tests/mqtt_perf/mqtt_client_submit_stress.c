@@ -0,0 +1,379 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Multi-threaded publish stress test for mqtt_client_submit_publish.
+//
+// Sixteen producer threads publish through the submit queue of one client
+// while the main thread runs mqtt_client_dowork, the way a worker pool
+// feeding a single connection would.  Each payload carries its producer and
+// a sequence number.  The transport below parses every PUBLISH it is handed
+// and checks that no message is lost or repeated and that the messages of
+// each producer arrive in the order they were submitted.  QoS 1 runs go
+// through the in-flight window, acknowledged by PUBACKs fed back on the
+// dowork thread.  ctest runs it with a smaller message count, configure with
+// use_tsan to run it under ThreadSanitizer.
+//
+// Usage: mqtt_client_submit_stress [messages per producer]
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "azure_c_shared_utility/xio.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "azure_umqtt_c/mqtt_client.h"
+
+#define STRESS_PRODUCERS            16
+#define STRESS_MESSAGES             20000
+#define STRESS_INFLIGHT_WINDOW      64
+#define STRESS_MAX_DOWORK_IDLE      100000
+#define STRESS_TOPIC                "devices/stress-device/messages/events/"
+#define STRESS_PAYLOAD_LENGTH       8
+
+typedef struct STRESS_IO_TAG
+{
+    ON_BYTES_RECEIVED on_bytes_received;
+    void* on_bytes_received_context;
+    uint32_t nextSequence[STRESS_PRODUCERS];
+    size_t received;
+    size_t errors;
+    uint16_t pendingAcks[STRESS_INFLIGHT_WINDOW * 2];
+    size_t pendingAckCount;
+} STRESS_IO;
+
+typedef struct PRODUCER_TAG
+{
+    MQTT_CLIENT_HANDLE client;
+    uint32_t index;
+    uint32_t messages;
+    QOS_VALUE qos;
+    size_t failures;
+} PRODUCER;
+
+static STRESS_IO g_stress_io;
+
+static uint32_t read_uint32(const unsigned char* data)
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static void check_publish(STRESS_IO* stress_io, const unsigned char* packet, size_t length)
+{
+    QOS_VALUE qos = (QOS_VALUE)((packet[0] >> 1) & 0x03);
+    size_t topicLength = ((size_t)packet[1] << 8) | packet[2];
+    size_t payloadOffset = 3 + topicLength + ((qos == DELIVER_AT_MOST_ONCE) ? 0 : 2);
+
+    if (payloadOffset + STRESS_PAYLOAD_LENGTH != length)
+    {
+        stress_io->errors++;
+    }
+    else
+    {
+        uint32_t producer = read_uint32(packet + payloadOffset);
+        uint32_t sequence = read_uint32(packet + payloadOffset + 4);
+        if (producer >= STRESS_PRODUCERS || sequence != stress_io->nextSequence[producer])
+        {
+            stress_io->errors++;
+        }
+        else
+        {
+            stress_io->nextSequence[producer]++;
+        }
+        if (qos != DELIVER_AT_MOST_ONCE && stress_io->pendingAckCount < sizeof(stress_io->pendingAcks) / sizeof(stress_io->pendingAcks[0]))
+        {
+            stress_io->pendingAcks[stress_io->pendingAckCount++] = (uint16_t)((packet[3 + topicLength] << 8) | packet[4 + topicLength]);
+        }
+        stress_io->received++;
+    }
+}
+
+static CONCRETE_IO_HANDLE stress_io_create(void* io_create_parameters)
+{
+    (void)io_create_parameters;
+    memset(&g_stress_io, 0, sizeof(g_stress_io));
+    return &g_stress_io;
+}
+
+static void stress_io_destroy(CONCRETE_IO_HANDLE concrete_io)
+{
+    (void)concrete_io;
+}
+
+static int stress_io_open(CONCRETE_IO_HANDLE concrete_io, ON_IO_OPEN_COMPLETE on_io_open_complete, void* on_io_open_complete_context, ON_BYTES_RECEIVED on_bytes_received, void* on_bytes_received_context, ON_IO_ERROR on_io_error, void* on_io_error_context)
+{
+    STRESS_IO* stress_io = (STRESS_IO*)concrete_io;
+    (void)on_io_error;
+    (void)on_io_error_context;
+    stress_io->on_bytes_received = on_bytes_received;
+    stress_io->on_bytes_received_context = on_bytes_received_context;
+    on_io_open_complete(on_io_open_complete_context, IO_OPEN_OK);
+    return 0;
+}
+
+static int stress_io_close(CONCRETE_IO_HANDLE concrete_io, ON_IO_CLOSE_COMPLETE on_io_close_complete, void* callback_context)
+{
+    (void)concrete_io;
+    if (on_io_close_complete != NULL)
+    {
+        on_io_close_complete(callback_context);
+    }
+    return 0;
+}
+
+// Every send holds whole packets, more than one when the client coalesces them
+static int stress_io_send(CONCRETE_IO_HANDLE concrete_io, const void* buffer, size_t size, ON_SEND_COMPLETE on_send_complete, void* callback_context)
+{
+    STRESS_IO* stress_io = (STRESS_IO*)concrete_io;
+    const unsigned char* data = (const unsigned char*)buffer;
+    size_t offset = 0;
+
+    while (offset < size)
+    {
+        size_t remainingLength = 0;
+        size_t multiplier = 1;
+        size_t headerLength = 1;
+        while (offset + headerLength < size)
+        {
+            unsigned char encodedByte = data[offset + headerLength++];
+            remainingLength += (encodedByte & 0x7f) * multiplier;
+            multiplier *= 128;
+            if ((encodedByte & 0x80) == 0)
+            {
+                break;
+            }
+        }
+        if (offset + headerLength + remainingLength > size)
+        {
+            stress_io->errors++;
+            break;
+        }
+        if ((data[offset] & 0xf0) == 0x30)
+        {
+            // Check the PUBLISH as if its length bytes were a single byte
+            unsigned char packet[512];
+            if (remainingLength + 1 > sizeof(packet))
+            {
+                stress_io->errors++;
+            }
+            else
+            {
+                packet[0] = data[offset];
+                memcpy(packet + 1, data + offset + headerLength, remainingLength);
+                check_publish(stress_io, packet, remainingLength + 1);
+            }
+        }
+        offset += headerLength + remainingLength;
+    }
+    if (on_send_complete != NULL)
+    {
+        on_send_complete(callback_context, IO_SEND_OK);
+    }
+    return 0;
+}
+
+static void stress_io_dowork(CONCRETE_IO_HANDLE concrete_io)
+{
+    STRESS_IO* stress_io = (STRESS_IO*)concrete_io;
+    size_t index;
+    for (index = 0; index < stress_io->pendingAckCount; index++)
+    {
+        unsigned char puback[] = { 0x40, 0x02, 0x00, 0x00 };
+        puback[2] = (unsigned char)(stress_io->pendingAcks[index] >> 8);
+        puback[3] = (unsigned char)(stress_io->pendingAcks[index] & 0xff);
+        stress_io->on_bytes_received(stress_io->on_bytes_received_context, puback, sizeof(puback));
+    }
+    stress_io->pendingAckCount = 0;
+}
+
+static int stress_io_setoption(CONCRETE_IO_HANDLE concrete_io, const char* optionName, const void* value)
+{
+    (void)concrete_io;
+    (void)optionName;
+    (void)value;
+    return 0;
+}
+
+static const IO_INTERFACE_DESCRIPTION stress_io_interface =
+{
+    NULL,
+    stress_io_create,
+    stress_io_destroy,
+    stress_io_open,
+    stress_io_close,
+    stress_io_send,
+    stress_io_dowork,
+    stress_io_setoption
+};
+
+static MQTT_CLIENT_ACK_OPTION on_message_recv(MQTT_MESSAGE_HANDLE msgHandle, void* context)
+{
+    (void)msgHandle;
+    (void)context;
+    return MQTT_CLIENT_ACK_SYNC;
+}
+
+static void on_operation_complete(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx)
+{
+    (void)handle;
+    (void)actionResult;
+    (void)msgInfo;
+    (void)callbackCtx;
+}
+
+static void on_error(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+{
+    (void)handle;
+    (void)callbackCtx;
+    (void)printf("mqtt client error %d\r\n", (int)error);
+}
+
+static int produce(void* context)
+{
+    PRODUCER* producer = (PRODUCER*)context;
+    uint32_t sequence;
+
+    for (sequence = 0; sequence < producer->messages; sequence++)
+    {
+        uint8_t payload[STRESS_PAYLOAD_LENGTH];
+        MQTT_MESSAGE_HANDLE msg;
+
+        payload[0] = (uint8_t)(producer->index >> 24);
+        payload[1] = (uint8_t)(producer->index >> 16);
+        payload[2] = (uint8_t)(producer->index >> 8);
+        payload[3] = (uint8_t)producer->index;
+        payload[4] = (uint8_t)(sequence >> 24);
+        payload[5] = (uint8_t)(sequence >> 16);
+        payload[6] = (uint8_t)(sequence >> 8);
+        payload[7] = (uint8_t)sequence;
+        msg = mqttmessage_create_in_place(1, STRESS_TOPIC, producer->qos, payload, sizeof(payload));
+        if (msg == NULL || mqtt_client_submit_publish(producer->client, msg) != 0)
+        {
+            producer->failures++;
+        }
+        mqttmessage_destroy(msg);
+    }
+    return 0;
+}
+
+static int run_stress(QOS_VALUE qos, uint32_t messages, double* elapsed)
+{
+    int result = 0;
+    XIO_HANDLE xio = xio_create(&stress_io_interface, NULL);
+    MQTT_CLIENT_HANDLE client = mqtt_client_init(on_message_recv, on_operation_complete, NULL, on_error, NULL);
+    TICK_COUNTER_HANDLE tickCounter = tickcounter_create();
+    if (xio == NULL || client == NULL || tickCounter == NULL)
+    {
+        (void)printf("Failed creating the client\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        MQTT_CLIENT_OPTIONS options;
+        unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+
+        memset(&options, 0, sizeof(options));
+        options.clientId = "stress-device";
+        options.keepAliveInterval = 240;
+        options.useCleanSession = true;
+        options.qualityOfServiceValue = DELIVER_AT_MOST_ONCE;
+
+        if ((qos != DELIVER_AT_MOST_ONCE && mqtt_client_set_inflight_window(client, STRESS_INFLIGHT_WINDOW, 0) != 0) ||
+            mqtt_client_enable_submit_queue(client) != 0 ||
+            mqtt_client_connect(client, xio, &options) != 0)
+        {
+            (void)printf("Failed connecting the client\r\n");
+            result = __LINE__;
+        }
+        else
+        {
+            PRODUCER producers[STRESS_PRODUCERS];
+            THREAD_HANDLE threads[STRESS_PRODUCERS];
+            size_t started = 0;
+            size_t index;
+            size_t idle = 0;
+            size_t lastReceived = 0;
+            tickcounter_ms_t start = 0;
+            tickcounter_ms_t end = 0;
+
+            g_stress_io.on_bytes_received(g_stress_io.on_bytes_received_context, connack, sizeof(connack));
+
+            // Wall clock time, the CPU time of sixteen threads would overstate it
+            (void)tickcounter_get_current_ms(tickCounter, &start);
+            for (index = 0; index < STRESS_PRODUCERS; index++)
+            {
+                producers[index].client = client;
+                producers[index].index = (uint32_t)index;
+                producers[index].messages = messages;
+                producers[index].qos = qos;
+                producers[index].failures = 0;
+                if (ThreadAPI_Create(&threads[index], produce, &producers[index]) != THREADAPI_OK)
+                {
+                    (void)printf("Failed starting producer %lu\r\n", (unsigned long)index);
+                    result = __LINE__;
+                    break;
+                }
+                started++;
+            }
+
+            // Drain while the producers run and until everything they submitted went out
+            while (g_stress_io.received < started * messages && idle < STRESS_MAX_DOWORK_IDLE)
+            {
+                mqtt_client_dowork(client);
+                idle = (g_stress_io.received == lastReceived) ? idle + 1 : 0;
+                lastReceived = g_stress_io.received;
+            }
+            (void)tickcounter_get_current_ms(tickCounter, &end);
+            *elapsed = (double)(end - start) / 1000.0;
+
+            for (index = 0; index < started; index++)
+            {
+                int threadResult;
+                (void)ThreadAPI_Join(threads[index], &threadResult);
+                if (producers[index].failures != 0)
+                {
+                    (void)printf("Producer %lu failed %lu submits\r\n", (unsigned long)index, (unsigned long)producers[index].failures);
+                    result = __LINE__;
+                }
+            }
+            if (g_stress_io.received != started * messages || g_stress_io.errors != 0)
+            {
+                (void)printf("Received %lu of %lu messages with %lu out of order or malformed\r\n", (unsigned long)g_stress_io.received,
+                    (unsigned long)(started * messages), (unsigned long)g_stress_io.errors);
+                result = __LINE__;
+            }
+        }
+    }
+    if (tickCounter != NULL)
+    {
+        tickcounter_destroy(tickCounter);
+    }
+    mqtt_client_deinit(client);
+    xio_destroy(xio);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int result = 0;
+    QOS_VALUE qos;
+    uint32_t messages = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 10) : STRESS_MESSAGES;
+
+    if (messages == 0)
+    {
+        (void)printf("Usage: mqtt_client_submit_stress [messages per producer]\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        (void)printf("%4s %10s %10s %10s %12s\r\n", "qos", "producers", "messages", "ms", "msg/s");
+        for (qos = DELIVER_AT_MOST_ONCE; qos <= DELIVER_AT_LEAST_ONCE && result == 0; qos = (QOS_VALUE)(qos + 1))
+        {
+            double elapsed = 0.0;
+            result = run_stress(qos, messages, &elapsed);
+            (void)printf("%4d %10d %10lu %10.1f %12.0f\r\n", (int)qos, STRESS_PRODUCERS, (unsigned long)g_stress_io.received, elapsed * 1000.0,
+                (elapsed > 0.0) ? g_stress_io.received / elapsed : 0.0);
+        }
+    }
+    return result;
+}
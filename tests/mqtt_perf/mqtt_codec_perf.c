@@ -0,0 +1,334 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Receive path throughput benchmark for mqtt_codec_bytesReceived.
+//
+// A stream of PUBLISH packets is fed to the codec in fixed size chunks, the way
+// an xio layer hands socket reads to onBytesReceived.  The per-byte state
+// machine that mqtt_codec_bytesReceived used previously is kept below as a
+// reference so both paths are measured against the same input.
+//
+// The send path of acknowledgements is measured as well, allocating a PUBACK
+// with mqtt_codec_publishAck against writing it with mqtt_codec_encode_puback.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "azure_c_shared_utility/buffer_.h"
+#include "azure_umqtt_c/mqtt_codec.h"
+
+#define BENCH_STREAM_BYTES          (32 * 1024 * 1024)
+#define BENCH_TOPIC                 "devices/bench-device/messages/events/"
+#define BENCH_ACK_COUNT             (4 * 1024 * 1024)
+
+static const size_t PAYLOAD_SIZES[] = { 2, 64, 1024, 16 * 1024, 64 * 1024 };
+static const size_t CHUNK_SIZES[] = { 1460, 16 * 1024 };
+
+typedef struct BENCH_RESULT_TAG
+{
+    size_t packets;
+    size_t bytes;
+} BENCH_RESULT;
+
+typedef struct LEGACY_CODEC_TAG
+{
+    CONTROL_PACKET_TYPE currPacket;
+    int inVarHeader;
+    size_t bufferOffset;
+    size_t multiplier;
+    size_t totalLen;
+    BUFFER_HANDLE headerData;
+    BENCH_RESULT* result;
+} LEGACY_CODEC;
+
+static void on_packet_complete(void* context, CONTROL_PACKET_TYPE packet, int flags, BUFFER_HANDLE headerData)
+{
+    BENCH_RESULT* result = (BENCH_RESULT*)context;
+    (void)packet;
+    (void)flags;
+    result->packets++;
+    if (headerData != NULL)
+    {
+        result->bytes += BUFFER_length(headerData);
+    }
+}
+
+static void legacy_complete(LEGACY_CODEC* codec)
+{
+    on_packet_complete(codec->result, codec->currPacket, 0, codec->headerData);
+    BUFFER_delete(codec->headerData);
+    codec->headerData = NULL;
+    codec->currPacket = UNKNOWN_TYPE;
+    codec->inVarHeader = 0;
+}
+
+// Mirrors the per-byte loop: every byte goes through the state switch and every
+// payload byte is stored through BUFFER_u_char plus offset and checked against
+// BUFFER_length.
+static int legacy_bytes_received(LEGACY_CODEC* codec, const unsigned char* buffer, size_t size)
+{
+    int result = 0;
+    size_t index;
+    for (index = 0; index < size && result == 0; index++)
+    {
+        uint8_t iterator = buffer[index];
+        if (!codec->inVarHeader)
+        {
+            if (codec->currPacket == UNKNOWN_TYPE)
+            {
+                codec->currPacket = (CONTROL_PACKET_TYPE)(iterator & 0xf0);
+                codec->multiplier = 1;
+                codec->totalLen = 0;
+            }
+            else
+            {
+                codec->totalLen += (iterator & 127) * codec->multiplier;
+                codec->multiplier *= 128;
+                if ((iterator & 0x80) == 0)
+                {
+                    codec->inVarHeader = 1;
+                    codec->bufferOffset = 0;
+                    codec->headerData = BUFFER_new();
+                    if (codec->headerData == NULL || BUFFER_pre_build(codec->headerData, codec->totalLen) != 0)
+                    {
+                        result = __LINE__;
+                    }
+                }
+            }
+        }
+        else
+        {
+            uint8_t* dataBytes = BUFFER_u_char(codec->headerData);
+            if (dataBytes == NULL)
+            {
+                result = __LINE__;
+            }
+            else
+            {
+                dataBytes += codec->bufferOffset++;
+                *dataBytes = iterator;
+                if (codec->bufferOffset >= BUFFER_length(codec->headerData))
+                {
+                    legacy_complete(codec);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+static size_t encode_publish(unsigned char* target, size_t payloadSize)
+{
+    size_t topicLen = strlen(BENCH_TOPIC);
+    size_t remainLen = 2 + topicLen + 2 + payloadSize;
+    size_t pos = 0;
+    size_t index;
+
+    target[pos++] = 0x32;
+    do
+    {
+        unsigned char encode = (unsigned char)(remainLen % 128);
+        remainLen /= 128;
+        if (remainLen > 0)
+        {
+            encode |= 0x80;
+        }
+        target[pos++] = encode;
+    } while (remainLen > 0);
+
+    target[pos++] = (unsigned char)(topicLen >> 8);
+    target[pos++] = (unsigned char)(topicLen & 0xff);
+    (void)memcpy(target + pos, BENCH_TOPIC, topicLen);
+    pos += topicLen;
+    target[pos++] = 0x12;
+    target[pos++] = 0x34;
+    for (index = 0; index < payloadSize; index++)
+    {
+        target[pos++] = (unsigned char)index;
+    }
+    return pos;
+}
+
+static unsigned char* build_stream(size_t payloadSize, size_t* streamLen)
+{
+    unsigned char* result;
+    unsigned char* packet = (unsigned char*)malloc(payloadSize + 128);
+    if (packet == NULL)
+    {
+        result = NULL;
+    }
+    else
+    {
+        size_t packetLen = encode_publish(packet, payloadSize);
+        size_t count = BENCH_STREAM_BYTES / packetLen;
+        if (count == 0)
+        {
+            count = 1;
+        }
+
+        result = (unsigned char*)malloc(count * packetLen);
+        if (result != NULL)
+        {
+            size_t index;
+            for (index = 0; index < count; index++)
+            {
+                (void)memcpy(result + (index * packetLen), packet, packetLen);
+            }
+            *streamLen = count * packetLen;
+        }
+        free(packet);
+    }
+    return result;
+}
+
+static double run_legacy(const unsigned char* stream, size_t streamLen, size_t chunkSize, BENCH_RESULT* bench)
+{
+    LEGACY_CODEC codec;
+    size_t offset;
+    clock_t start;
+
+    memset(&codec, 0, sizeof(codec));
+    codec.currPacket = UNKNOWN_TYPE;
+    codec.result = bench;
+
+    start = clock();
+    for (offset = 0; offset < streamLen; offset += chunkSize)
+    {
+        size_t length = (streamLen - offset < chunkSize) ? streamLen - offset : chunkSize;
+        if (legacy_bytes_received(&codec, stream + offset, length) != 0)
+        {
+            (void)printf("legacy parser failed at offset %lu\r\n", (unsigned long)offset);
+            break;
+        }
+    }
+    BUFFER_delete(codec.headerData);
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double run_codec(const unsigned char* stream, size_t streamLen, size_t chunkSize, BENCH_RESULT* bench)
+{
+    double result;
+    MQTTCODEC_HANDLE codec = mqtt_codec_create(on_packet_complete, bench);
+    if (codec == NULL)
+    {
+        result = -1.0;
+    }
+    else
+    {
+        size_t offset;
+        clock_t start = clock();
+        for (offset = 0; offset < streamLen; offset += chunkSize)
+        {
+            size_t length = (streamLen - offset < chunkSize) ? streamLen - offset : chunkSize;
+            if (mqtt_codec_bytesReceived(codec, stream + offset, length) != 0)
+            {
+                (void)printf("mqtt_codec_bytesReceived failed at offset %lu\r\n", (unsigned long)offset);
+                break;
+            }
+        }
+        result = (double)(clock() - start) / CLOCKS_PER_SEC;
+        mqtt_codec_destroy(codec);
+    }
+    return result;
+}
+
+// Both ack loops fold the packets into checksum so they cannot be optimized away
+static double run_ack_alloc(uint32_t* checksum)
+{
+    size_t index;
+    clock_t start = clock();
+    for (index = 0; index < BENCH_ACK_COUNT; index++)
+    {
+        BUFFER_HANDLE packet = mqtt_codec_publishAck((uint16_t)index);
+        if (packet == NULL)
+        {
+            (void)printf("mqtt_codec_publishAck failed\r\n");
+            break;
+        }
+        *checksum += (uint32_t)BUFFER_u_char(packet)[0] + BUFFER_u_char(packet)[3];
+        BUFFER_delete(packet);
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double run_ack_encode(uint32_t* checksum)
+{
+    size_t index;
+    uint8_t packet[MQTT_CODEC_PUBLISH_REPLY_SIZE];
+    clock_t start = clock();
+    for (index = 0; index < BENCH_ACK_COUNT; index++)
+    {
+        if (mqtt_codec_encode_puback((uint16_t)index, packet) != 0)
+        {
+            (void)printf("mqtt_codec_encode_puback failed\r\n");
+            break;
+        }
+        *checksum += (uint32_t)packet[0] + packet[3];
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double to_mb_per_sec(size_t bytes, double seconds)
+{
+    return (seconds > 0.0) ? ((double)bytes / (1024.0 * 1024.0)) / seconds : 0.0;
+}
+
+int main(void)
+{
+    int result = 0;
+    size_t payloadIndex;
+
+    (void)printf("%10s %8s %14s %14s %9s\r\n", "payload", "chunk", "per-byte MB/s", "span MB/s", "speedup");
+    for (payloadIndex = 0; payloadIndex < sizeof(PAYLOAD_SIZES) / sizeof(PAYLOAD_SIZES[0]); payloadIndex++)
+    {
+        size_t streamLen = 0;
+        unsigned char* stream = build_stream(PAYLOAD_SIZES[payloadIndex], &streamLen);
+        if (stream == NULL)
+        {
+            (void)printf("Failed allocating the packet stream\r\n");
+            result = __LINE__;
+            break;
+        }
+        else
+        {
+            size_t chunkIndex;
+            for (chunkIndex = 0; chunkIndex < sizeof(CHUNK_SIZES) / sizeof(CHUNK_SIZES[0]); chunkIndex++)
+            {
+                BENCH_RESULT legacy = { 0, 0 };
+                BENCH_RESULT span = { 0, 0 };
+                double legacyTime = run_legacy(stream, streamLen, CHUNK_SIZES[chunkIndex], &legacy);
+                double spanTime = run_codec(stream, streamLen, CHUNK_SIZES[chunkIndex], &span);
+
+                if (legacy.packets != span.packets || legacy.bytes != span.bytes)
+                {
+                    (void)printf("Parsers disagree: %lu/%lu packets\r\n", (unsigned long)legacy.packets, (unsigned long)span.packets);
+                    result = __LINE__;
+                }
+                (void)printf("%10lu %8lu %14.1f %14.1f %8.1fx\r\n", (unsigned long)PAYLOAD_SIZES[payloadIndex], (unsigned long)CHUNK_SIZES[chunkIndex],
+                    to_mb_per_sec(streamLen, legacyTime), to_mb_per_sec(streamLen, spanTime),
+                    (spanTime > 0.0) ? legacyTime / spanTime : 0.0);
+            }
+            free(stream);
+        }
+    }
+
+    if (result == 0)
+    {
+        uint32_t allocChecksum = 0;
+        uint32_t encodeChecksum = 0;
+        double allocTime = run_ack_alloc(&allocChecksum);
+        double encodeTime = run_ack_encode(&encodeChecksum);
+        if (allocChecksum != encodeChecksum)
+        {
+            (void)printf("PUBACK encodings disagree\r\n");
+            result = __LINE__;
+        }
+        (void)printf("\r\n%10s %14s %14s %9s\r\n", "acks", "alloc ns/ack", "encode ns/ack", "speedup");
+        (void)printf("%10lu %14.1f %14.1f %8.1fx\r\n", (unsigned long)BENCH_ACK_COUNT,
+            allocTime * 1e9 / BENCH_ACK_COUNT, encodeTime * 1e9 / BENCH_ACK_COUNT,
+            (encodeTime > 0.0) ? allocTime / encodeTime : 0.0);
+    }
+    return result;
+}
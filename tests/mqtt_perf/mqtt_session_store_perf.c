@@ -0,0 +1,372 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Crash recovery benchmark for mqtt_client_set_session_store.
+//
+// A connected client fills its whole in-flight window with QoS 1 publishes and
+// receives QoS 2 publishes whose PUBREL never arrives, giving 100k session
+// records in total (packet ids are 16 bit, so a single direction can't hold
+// them all).  The process then "crashes": neither the client nor the store is
+// shut down.  A second store opens the same file and a new client restores the
+// session from it and resends everything after CONNACK, the way a restarted
+// process would.  The memory backend row shows the cost of the bookkeeping
+// alone.  Pass a path as the first argument to place the log file.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "azure_c_shared_utility/xio.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_session_store.h"
+
+#define BENCH_OUTBOUND_RECORDS      65534
+#define BENCH_INBOUND_RECORDS       34466
+#define BENCH_PAYLOAD               "{\"temperature\":21.5}"
+#define BENCH_TOPIC                 "devices/bench-device/messages/events/"
+#define BENCH_DEFAULT_PATH          "mqtt_session_store_perf.dat"
+
+typedef struct COUNTING_IO_TAG
+{
+    ON_BYTES_RECEIVED on_bytes_received;
+    void* on_bytes_received_context;
+    size_t sends;
+    size_t bytes;
+} COUNTING_IO;
+
+typedef struct LOAD_COUNT_TAG
+{
+    size_t records;
+    size_t bytes;
+} LOAD_COUNT;
+
+static COUNTING_IO g_counting_io;
+
+static CONCRETE_IO_HANDLE counting_io_create(void* io_create_parameters)
+{
+    (void)io_create_parameters;
+    memset(&g_counting_io, 0, sizeof(g_counting_io));
+    return &g_counting_io;
+}
+
+static void counting_io_destroy(CONCRETE_IO_HANDLE concrete_io)
+{
+    (void)concrete_io;
+}
+
+static int counting_io_open(CONCRETE_IO_HANDLE concrete_io, ON_IO_OPEN_COMPLETE on_io_open_complete, void* on_io_open_complete_context, ON_BYTES_RECEIVED on_bytes_received, void* on_bytes_received_context, ON_IO_ERROR on_io_error, void* on_io_error_context)
+{
+    COUNTING_IO* counting_io = (COUNTING_IO*)concrete_io;
+    (void)on_io_error;
+    (void)on_io_error_context;
+    counting_io->on_bytes_received = on_bytes_received;
+    counting_io->on_bytes_received_context = on_bytes_received_context;
+    on_io_open_complete(on_io_open_complete_context, IO_OPEN_OK);
+    return 0;
+}
+
+static int counting_io_close(CONCRETE_IO_HANDLE concrete_io, ON_IO_CLOSE_COMPLETE on_io_close_complete, void* callback_context)
+{
+    (void)concrete_io;
+    if (on_io_close_complete != NULL)
+    {
+        on_io_close_complete(callback_context);
+    }
+    return 0;
+}
+
+static int counting_io_send(CONCRETE_IO_HANDLE concrete_io, const void* buffer, size_t size, ON_SEND_COMPLETE on_send_complete, void* callback_context)
+{
+    COUNTING_IO* counting_io = (COUNTING_IO*)concrete_io;
+    (void)buffer;
+    counting_io->sends++;
+    counting_io->bytes += size;
+    if (on_send_complete != NULL)
+    {
+        on_send_complete(callback_context, IO_SEND_OK);
+    }
+    return 0;
+}
+
+static void counting_io_dowork(CONCRETE_IO_HANDLE concrete_io)
+{
+    (void)concrete_io;
+}
+
+static int counting_io_setoption(CONCRETE_IO_HANDLE concrete_io, const char* optionName, const void* value)
+{
+    (void)concrete_io;
+    (void)optionName;
+    (void)value;
+    return 0;
+}
+
+static const IO_INTERFACE_DESCRIPTION counting_io_interface =
+{
+    NULL,
+    counting_io_create,
+    counting_io_destroy,
+    counting_io_open,
+    counting_io_close,
+    counting_io_send,
+    counting_io_dowork,
+    counting_io_setoption
+};
+
+static MQTT_CLIENT_ACK_OPTION on_message_recv(MQTT_MESSAGE_HANDLE msgHandle, void* context)
+{
+    (void)msgHandle;
+    (void)context;
+    return MQTT_CLIENT_ACK_SYNC;
+}
+
+static void on_operation_complete(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx)
+{
+    (void)handle;
+    (void)actionResult;
+    (void)msgInfo;
+    (void)callbackCtx;
+}
+
+static void on_error(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+{
+    (void)handle;
+    (void)callbackCtx;
+    (void)printf("mqtt client error %d\r\n", (int)error);
+}
+
+static void on_record_loaded(void* context, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId, const uint8_t* data, size_t length)
+{
+    LOAD_COUNT* count = (LOAD_COUNT*)context;
+    (void)recordType;
+    (void)packetId;
+    (void)data;
+    count->records++;
+    count->bytes += length;
+}
+
+static double elapsed_ms(clock_t start)
+{
+    return (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+static void print_row(const char* backend, const char* phase, size_t records, size_t sends, double ms)
+{
+    (void)printf("%-8s %-16s %10lu %10lu %10.1f\r\n", backend, phase, (unsigned long)records, (unsigned long)sends, ms);
+}
+
+static MQTT_CLIENT_HANDLE create_client(XIO_HANDLE* xio, MQTT_SESSION_STORE_HANDLE store)
+{
+    MQTT_CLIENT_HANDLE result = mqtt_client_init(on_message_recv, on_operation_complete, NULL, on_error, NULL);
+    *xio = xio_create(&counting_io_interface, NULL);
+    if (result == NULL || *xio == NULL ||
+        mqtt_client_set_inflight_window(result, BENCH_OUTBOUND_RECORDS, 0) != 0)
+    {
+        (void)printf("Failed creating the client\r\n");
+        mqtt_client_deinit(result);
+        xio_destroy(*xio);
+        result = NULL;
+    }
+    else if (store != NULL && mqtt_client_set_session_store(result, store) != 0)
+    {
+        (void)printf("Failed setting the session store\r\n");
+        mqtt_client_deinit(result);
+        xio_destroy(*xio);
+        result = NULL;
+    }
+    return result;
+}
+
+static int connect_client(MQTT_CLIENT_HANDLE client, XIO_HANDLE xio)
+{
+    int result;
+    MQTT_CLIENT_OPTIONS options;
+    unsigned char connack[] = { 0x20, 0x02, 0x01, 0x00 };
+
+    memset(&options, 0, sizeof(options));
+    options.clientId = "bench-device";
+    options.keepAliveInterval = 240;
+    options.useCleanSession = false;
+    options.qualityOfServiceValue = DELIVER_AT_MOST_ONCE;
+
+    if (mqtt_client_connect(client, xio, &options) != 0)
+    {
+        (void)printf("Failed connecting the client\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        g_counting_io.on_bytes_received(g_counting_io.on_bytes_received_context, connack, sizeof(connack));
+        g_counting_io.sends = 0;
+        g_counting_io.bytes = 0;
+        result = 0;
+    }
+    return result;
+}
+
+// Publishes until the in-flight window is full and receives QoS 2 publishes that are never released
+static int fill_session(MQTT_CLIENT_HANDLE client, XIO_HANDLE xio)
+{
+    int result = connect_client(client, xio);
+    size_t index;
+
+    for (index = 0; index < BENCH_OUTBOUND_RECORDS && result == 0; index++)
+    {
+        MQTT_MESSAGE_HANDLE msg = mqttmessage_create_in_place(0, BENCH_TOPIC, DELIVER_AT_LEAST_ONCE, (const uint8_t*)BENCH_PAYLOAD, sizeof(BENCH_PAYLOAD) - 1);
+        if (msg == NULL || mqtt_client_publish(client, msg) != 0)
+        {
+            (void)printf("Failed publishing message %lu\r\n", (unsigned long)index);
+            result = __LINE__;
+        }
+        mqttmessage_destroy(msg);
+    }
+
+    for (index = 0; index < BENCH_INBOUND_RECORDS && result == 0; index++)
+    {
+        unsigned char publish[2 + 2 + sizeof(BENCH_TOPIC) - 1 + 2 + sizeof(BENCH_PAYLOAD) - 1];
+        size_t topicLength = sizeof(BENCH_TOPIC) - 1;
+        size_t offset = 0;
+        uint16_t packetId = (uint16_t)(index + 1);
+
+        publish[offset++] = 0x34;
+        publish[offset++] = (unsigned char)(sizeof(publish) - 2);
+        publish[offset++] = (unsigned char)(topicLength >> 8);
+        publish[offset++] = (unsigned char)(topicLength & 0xff);
+        (void)memcpy(publish + offset, BENCH_TOPIC, topicLength);
+        offset += topicLength;
+        publish[offset++] = (unsigned char)(packetId >> 8);
+        publish[offset++] = (unsigned char)(packetId & 0xff);
+        (void)memcpy(publish + offset, BENCH_PAYLOAD, sizeof(BENCH_PAYLOAD) - 1);
+        g_counting_io.on_bytes_received(g_counting_io.on_bytes_received_context, publish, sizeof(publish));
+    }
+    return result;
+}
+
+static int run_memory(void)
+{
+    int result;
+    MQTT_SESSION_STORE_HANDLE store = mqtt_session_store_create(mqtt_session_store_memory_get_interface_description(), NULL);
+    XIO_HANDLE xio = NULL;
+    MQTT_CLIENT_HANDLE client = (store == NULL) ? NULL : create_client(&xio, store);
+    if (client == NULL)
+    {
+        result = __LINE__;
+    }
+    else
+    {
+        clock_t start = clock();
+        result = fill_session(client, xio);
+        print_row("memory", "save", BENCH_OUTBOUND_RECORDS + BENCH_INBOUND_RECORDS, g_counting_io.sends, elapsed_ms(start));
+        mqtt_client_deinit(client);
+        xio_destroy(xio);
+    }
+    mqtt_session_store_destroy(store);
+    return result;
+}
+
+static int run_file(const char* path)
+{
+    int result;
+    MQTT_SESSION_STORE_FILE_OPTIONS options;
+    MQTT_SESSION_STORE_HANDLE crashedStore;
+    XIO_HANDLE crashedXio = NULL;
+    MQTT_CLIENT_HANDLE crashedClient = NULL;
+
+    memset(&options, 0, sizeof(options));
+    options.path = path;
+
+    if ((crashedStore = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options)) == NULL ||
+        mqtt_session_store_clear(crashedStore) != 0 ||
+        (crashedClient = create_client(&crashedXio, crashedStore)) == NULL)
+    {
+        (void)printf("Failed opening %s\r\n", path);
+        result = __LINE__;
+    }
+    else
+    {
+        clock_t start = clock();
+        if ((result = fill_session(crashedClient, crashedXio)) == 0)
+        {
+            MQTT_SESSION_STORE_HANDLE store;
+            print_row("file", "save", BENCH_OUTBOUND_RECORDS + BENCH_INBOUND_RECORDS, g_counting_io.sends, elapsed_ms(start));
+
+            // The crashed client and store are left as they are, the second store only sees what reached the file
+            start = clock();
+            if ((store = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options)) == NULL)
+            {
+                (void)printf("Failed reopening %s\r\n", path);
+                result = __LINE__;
+            }
+            else
+            {
+                LOAD_COUNT count = { 0, 0 };
+                XIO_HANDLE xio = NULL;
+                MQTT_CLIENT_HANDLE client;
+
+                if (mqtt_session_store_load(store, on_record_loaded, &count) != 0)
+                {
+                    (void)printf("Failed loading %s\r\n", path);
+                    result = __LINE__;
+                }
+                else if (count.records != BENCH_OUTBOUND_RECORDS + BENCH_INBOUND_RECORDS)
+                {
+                    (void)printf("Loaded %lu records, expected %lu\r\n", (unsigned long)count.records, (unsigned long)(BENCH_OUTBOUND_RECORDS + BENCH_INBOUND_RECORDS));
+                    result = __LINE__;
+                }
+                print_row("file", "reopen + load", count.records, 0, elapsed_ms(start));
+
+                start = clock();
+                if (result == 0 && (client = create_client(&xio, store)) != NULL)
+                {
+                    print_row("file", "client restore", count.records, 0, elapsed_ms(start));
+
+                    start = clock();
+                    if ((result = connect_client(client, xio)) == 0)
+                    {
+                        mqtt_client_dowork(client);
+                        if (g_counting_io.sends < BENCH_OUTBOUND_RECORDS)
+                        {
+                            (void)printf("Resent %lu messages, expected %lu\r\n", (unsigned long)g_counting_io.sends, (unsigned long)BENCH_OUTBOUND_RECORDS);
+                            result = __LINE__;
+                        }
+                        print_row("file", "resend", BENCH_OUTBOUND_RECORDS, g_counting_io.sends, elapsed_ms(start));
+                    }
+                    mqtt_client_deinit(client);
+                    xio_destroy(xio);
+                }
+                else if (result == 0)
+                {
+                    result = __LINE__;
+                }
+                (void)mqtt_session_store_clear(store);
+                mqtt_session_store_destroy(store);
+            }
+        }
+    }
+    mqtt_client_deinit(crashedClient);
+    xio_destroy(crashedXio);
+    mqtt_session_store_destroy(crashedStore);
+    (void)remove(path);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    int result;
+    const char* path = (argc > 1) ? argv[1] : BENCH_DEFAULT_PATH;
+
+    (void)printf("%-8s %-16s %10s %10s %10s\r\n", "backend", "phase", "records", "xio_send", "ms");
+    if ((result = run_memory()) == 0)
+    {
+        if (mqtt_session_store_file_get_interface_description() == NULL)
+        {
+            (void)printf("The file backend is not available on this platform\r\n");
+        }
+        else
+        {
+            result = run_file(path);
+        }
+    }
+    return result;
+}
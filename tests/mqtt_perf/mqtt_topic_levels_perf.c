@@ -0,0 +1,146 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Topic splitting benchmark for mqttmessage_getTopicLevelSpans.
+//
+// Routing code split the topic of every received message with
+// mqttmessage_getTopicLevels, which allocates the level array and one string
+// per level that the caller then frees.  Both functions are run on the deep
+// topics IoT Hub sends, C2D messages with their URL encoded property bag,
+// twin responses and direct method requests.  Each row checks that the two
+// agree on every level before printing the time per message.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "azure_umqtt_c/mqtt_message.h"
+
+#define BENCH_ITERATIONS            1000000
+#define BENCH_MAX_LEVELS            16
+
+static const char* BENCH_TOPICS[] =
+{
+    "devices/dev-00042/messages/devicebound/%24.to=%2Fdevices%2Fdev-00042%2Fmessages%2FdeviceBound&%24.mid=6f1c2d8e-53a4-4a0b-9b7e-2f5c1e0d9a11&iothub-ack=full",
+    "devices/dev-00042/modules/filter/messages/devicebound/%24.to=%2Fdevices%2Fdev-00042%2Fmodules%2Ffilter%2Fmessages%2FdeviceBound&%24.ct=application%2Fjson",
+    "$iothub/twin/res/200/?$rid=42&$version=7",
+    "$iothub/methods/POST/reboot/?$rid=1"
+};
+
+static int check_levels(MQTT_MESSAGE_HANDLE message, const char* topic)
+{
+    int result = 0;
+    char** levels;
+    size_t count;
+    MQTT_TOPIC_LEVEL spans[BENCH_MAX_LEVELS];
+    size_t spanCount;
+
+    if (mqttmessage_getTopicLevels(message, &levels, &count) != 0 ||
+        mqttmessage_getTopicLevelSpans(message, spans, BENCH_MAX_LEVELS, &spanCount) != 0)
+    {
+        (void)printf("Failed splitting %s\r\n", topic);
+        result = __LINE__;
+    }
+    else
+    {
+        size_t index;
+        if (count != spanCount)
+        {
+            result = __LINE__;
+        }
+        for (index = 0; index < count; index++)
+        {
+            if (result == 0 && (strlen(levels[index]) != spans[index].length || memcmp(levels[index], topic + spans[index].offset, spans[index].length) != 0))
+            {
+                result = __LINE__;
+            }
+            free(levels[index]);
+        }
+        free(levels);
+        if (result != 0)
+        {
+            (void)printf("Levels differ for %s\r\n", topic);
+        }
+    }
+    return result;
+}
+
+static double run_allocating(MQTT_MESSAGE_HANDLE message, size_t* checksum)
+{
+    clock_t start = clock();
+    size_t iteration;
+    for (iteration = 0; iteration < BENCH_ITERATIONS; iteration++)
+    {
+        char** levels;
+        size_t count;
+        if (mqttmessage_getTopicLevels(message, &levels, &count) == 0)
+        {
+            *checksum += count + strlen(levels[count - 1]);
+            while (count > 0)
+            {
+                free(levels[--count]);
+            }
+            free(levels);
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double run_spans(MQTT_MESSAGE_HANDLE message, size_t* checksum)
+{
+    clock_t start = clock();
+    size_t iteration;
+    for (iteration = 0; iteration < BENCH_ITERATIONS; iteration++)
+    {
+        MQTT_TOPIC_LEVEL spans[BENCH_MAX_LEVELS];
+        size_t count;
+        if (mqttmessage_getTopicLevelSpans(message, spans, BENCH_MAX_LEVELS, &count) == 0)
+        {
+            *checksum += count + spans[count - 1].length;
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void)
+{
+    int result = 0;
+    size_t topicIndex;
+
+    (void)printf("%6s %6s %8s %12s %12s %9s\r\n", "topic", "levels", "allocs", "split ns", "spans ns", "speedup");
+    for (topicIndex = 0; topicIndex < sizeof(BENCH_TOPICS) / sizeof(BENCH_TOPICS[0]) && result == 0; topicIndex++)
+    {
+        const char* topic = BENCH_TOPICS[topicIndex];
+        MQTT_MESSAGE_HANDLE message = mqttmessage_create_in_place_n(1, topic, strlen(topic), DELIVER_AT_LEAST_ONCE, (const uint8_t*)"{}", 2);
+        if (message == NULL)
+        {
+            (void)printf("Failed creating the message\r\n");
+            result = __LINE__;
+        }
+        else
+        {
+            if ((result = check_levels(message, topic)) == 0)
+            {
+                size_t allocatingChecksum = 0;
+                size_t spansChecksum = 0;
+                size_t levelCount;
+                double allocatingTime = run_allocating(message, &allocatingChecksum);
+                double spansTime = run_spans(message, &spansChecksum);
+
+                (void)mqttmessage_getTopicLevelSpans(message, NULL, 0, &levelCount);
+                if (allocatingChecksum != spansChecksum)
+                {
+                    (void)printf("Checksums differ\r\n");
+                    result = __LINE__;
+                }
+                // The array plus one string per level
+                (void)printf("%6lu %6lu %8lu %12.1f %12.1f %8.1fx\r\n", (unsigned long)topicIndex, (unsigned long)levelCount, (unsigned long)(levelCount + 1),
+                    allocatingTime * 1e9 / BENCH_ITERATIONS, spansTime * 1e9 / BENCH_ITERATIONS,
+                    (spansTime > 0.0) ? allocatingTime / spansTime : 0.0);
+            }
+            mqttmessage_destroy(message);
+        }
+    }
+    return result;
+}
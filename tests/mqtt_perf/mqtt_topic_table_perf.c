@@ -0,0 +1,161 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Repeated publish benchmark for mqtt_topic_table.
+//
+// A device that sends telemetry built every message with mqttmessage_create,
+// which copies the topic name, and mqtt_codec_publish then measured and wrote
+// the name again into each packet.  The interned path creates the message on a
+// topic from the table and copies its stored encoding into the packet.  Both
+// are run on the topics IoT Hub devices publish to, and the packets they build
+// are compared before the time per message is printed.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "azure_c_shared_utility/buffer_.h"
+#include "azure_umqtt_c/mqtt_codec.h"
+#include "azure_umqtt_c/mqtt_message.h"
+#include "azure_umqtt_c/mqtt_topic_table.h"
+
+#define BENCH_ITERATIONS            1000000
+
+static const char* BENCH_TOPICS[] =
+{
+    "devices/dev-00042/messages/events/",
+    "devices/dev-00042/modules/filter/messages/events/%24.ct=application%2Fjson&%24.ce=utf-8&sensor=temperature",
+    "$iothub/twin/PATCH/properties/reported/?$rid=42"
+};
+
+static const uint8_t BENCH_PAYLOAD[] = "{\"temperature\":21.5,\"humidity\":40}";
+
+static BUFFER_HANDLE publish_copied(const char* topic)
+{
+    BUFFER_HANDLE result = NULL;
+    MQTT_MESSAGE_HANDLE message = mqttmessage_create(1, topic, DELIVER_AT_LEAST_ONCE, BENCH_PAYLOAD, sizeof(BENCH_PAYLOAD) - 1);
+    if (message != NULL)
+    {
+        const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(message);
+        result = mqtt_codec_publish(mqttmessage_getQosType(message), mqttmessage_getIsDuplicateMsg(message), mqttmessage_getIsRetained(message),
+            mqttmessage_getPacketId(message), mqttmessage_getTopicName(message), payload->message, payload->length, NULL);
+        mqttmessage_destroy(message);
+    }
+    return result;
+}
+
+static BUFFER_HANDLE publish_interned(MQTT_TOPIC_HANDLE topic)
+{
+    BUFFER_HANDLE result = NULL;
+    MQTT_MESSAGE_HANDLE message = mqttmessage_create_with_topic(1, topic, DELIVER_AT_LEAST_ONCE, BENCH_PAYLOAD, sizeof(BENCH_PAYLOAD) - 1);
+    if (message != NULL)
+    {
+        const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(message);
+        size_t encodedLength;
+        const uint8_t* encodedTopic = mqtt_topic_get_encoded(mqttmessage_getInternedTopic(message), &encodedLength);
+        result = mqtt_codec_publish_encoded_topic(mqttmessage_getQosType(message), mqttmessage_getIsDuplicateMsg(message), mqttmessage_getIsRetained(message),
+            mqttmessage_getPacketId(message), encodedTopic, encodedLength, payload->message, payload->length, NULL);
+        mqttmessage_destroy(message);
+    }
+    return result;
+}
+
+static int check_packets(const char* topicName, MQTT_TOPIC_HANDLE topic)
+{
+    int result = 0;
+    BUFFER_HANDLE copied = publish_copied(topicName);
+    BUFFER_HANDLE interned = publish_interned(topic);
+
+    if (copied == NULL || interned == NULL)
+    {
+        (void)printf("Failed encoding %s\r\n", topicName);
+        result = __LINE__;
+    }
+    else if (BUFFER_length(copied) != BUFFER_length(interned) || memcmp(BUFFER_u_char(copied), BUFFER_u_char(interned), BUFFER_length(copied)) != 0)
+    {
+        (void)printf("Packets differ for %s\r\n", topicName);
+        result = __LINE__;
+    }
+    BUFFER_delete(copied);
+    BUFFER_delete(interned);
+    return result;
+}
+
+static double run_copied(const char* topicName, size_t* checksum)
+{
+    clock_t start = clock();
+    size_t iteration;
+    for (iteration = 0; iteration < BENCH_ITERATIONS; iteration++)
+    {
+        BUFFER_HANDLE packet = publish_copied(topicName);
+        if (packet != NULL)
+        {
+            *checksum += BUFFER_length(packet);
+            BUFFER_delete(packet);
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double run_interned(MQTT_TOPIC_HANDLE topic, size_t* checksum)
+{
+    clock_t start = clock();
+    size_t iteration;
+    for (iteration = 0; iteration < BENCH_ITERATIONS; iteration++)
+    {
+        BUFFER_HANDLE packet = publish_interned(topic);
+        if (packet != NULL)
+        {
+            *checksum += BUFFER_length(packet);
+            BUFFER_delete(packet);
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(void)
+{
+    int result = 0;
+    MQTT_TOPIC_TABLE_HANDLE table = mqtt_topic_table_create();
+
+    if (table == NULL)
+    {
+        (void)printf("Failed creating the topic table\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        size_t topicIndex;
+
+        (void)printf("%6s %6s %12s %12s %9s\r\n", "topic", "length", "copied ns", "interned ns", "speedup");
+        for (topicIndex = 0; topicIndex < sizeof(BENCH_TOPICS) / sizeof(BENCH_TOPICS[0]) && result == 0; topicIndex++)
+        {
+            const char* topicName = BENCH_TOPICS[topicIndex];
+            MQTT_TOPIC_HANDLE topic = mqtt_topic_table_intern(table, topicName);
+            if (topic == NULL)
+            {
+                (void)printf("Failed interning %s\r\n", topicName);
+                result = __LINE__;
+            }
+            else if ((result = check_packets(topicName, topic)) == 0)
+            {
+                size_t copiedChecksum = 0;
+                size_t internedChecksum = 0;
+                double copiedTime = run_copied(topicName, &copiedChecksum);
+                double internedTime = run_interned(topic, &internedChecksum);
+
+                if (copiedChecksum != internedChecksum)
+                {
+                    (void)printf("Checksums differ\r\n");
+                    result = __LINE__;
+                }
+                (void)printf("%6lu %6lu %12.1f %12.1f %8.1fx\r\n", (unsigned long)topicIndex, (unsigned long)strlen(topicName),
+                    copiedTime * 1e9 / BENCH_ITERATIONS, internedTime * 1e9 / BENCH_ITERATIONS,
+                    (internedTime > 0.0) ? copiedTime / internedTime : 0.0);
+            }
+        }
+        mqtt_topic_table_destroy(table);
+    }
+    return result;
+}
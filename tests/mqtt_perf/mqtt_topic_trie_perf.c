@@ -0,0 +1,267 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Inbound dispatch benchmark for mqtt_topic_trie.
+//
+// An application with many subscriptions used to match every received topic
+// against each of its filters in turn.  That loop is kept below as the
+// reference and both are fed the same topics, about half of which match some
+// filter.  The filters mix exact topics, + at different levels and trailing #,
+// so the trie has to follow wildcard branches as well as exact children.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "azure_umqtt_c/mqtt_topic_trie.h"
+
+#define BENCH_TOPIC_COUNT           200000
+#define BENCH_TOPIC_SIZE            96
+
+static const size_t FILTER_COUNTS[] = { 100, 1000, 10000 };
+
+typedef struct MATCH_COUNT_TAG
+{
+    size_t matches;
+    size_t checksum;
+} MATCH_COUNT;
+
+static void make_filter(char* filter, size_t index)
+{
+    switch (index % 4)
+    {
+        case 0:
+            (void)sprintf(filter, "devices/dev-%05lu/messages/devicebound/#", (unsigned long)index);
+            break;
+        case 1:
+            (void)sprintf(filter, "devices/dev-%05lu/twin/res/+", (unsigned long)index);
+            break;
+        case 2:
+            (void)sprintf(filter, "devices/+/modules/mod-%05lu/inputs", (unsigned long)index);
+            break;
+        default:
+            (void)sprintf(filter, "fleet/site-%03lu/+/sensor-%05lu", (unsigned long)(index % 100), (unsigned long)index);
+            break;
+    }
+}
+
+// Every other topic is aimed at an existing filter, the rest at filters that were never added
+static void make_topic(char* topic, size_t filterCount, size_t index)
+{
+    size_t target = (size_t)rand() % filterCount;
+    if (index % 2 == 1)
+    {
+        target += filterCount;
+    }
+    switch (target % 4)
+    {
+        case 0:
+            (void)sprintf(topic, "devices/dev-%05lu/messages/devicebound/%%24.to=cmd", (unsigned long)target);
+            break;
+        case 1:
+            (void)sprintf(topic, "devices/dev-%05lu/twin/res/200", (unsigned long)target);
+            break;
+        case 2:
+            (void)sprintf(topic, "devices/dev-%05lu/modules/mod-%05lu/inputs", (unsigned long)(target / 2), (unsigned long)target);
+            break;
+        default:
+            (void)sprintf(topic, "fleet/site-%03lu/line-7/sensor-%05lu", (unsigned long)(target % 100), (unsigned long)target);
+            break;
+    }
+}
+
+// Matches one filter the way application code did before, level by level with no shared state
+static bool linear_filter_matches(const char* filter, const char* topic, size_t topicLength)
+{
+    const char* topicEnd = topic + topicLength;
+    bool result;
+
+    if (topicLength > 0 && topic[0] == '$' && (filter[0] == '+' || filter[0] == '#'))
+    {
+        result = false;
+    }
+    else
+    {
+        for (;;)
+        {
+            const char* filterSeparator;
+            const char* topicSeparator;
+            size_t filterLevel;
+            size_t topicLevel;
+
+            if (filter[0] == '#')
+            {
+                result = true;
+                break;
+            }
+            filterSeparator = strchr(filter, '/');
+            topicSeparator = (const char*)memchr(topic, '/', (size_t)(topicEnd - topic));
+            filterLevel = (filterSeparator == NULL) ? strlen(filter) : (size_t)(filterSeparator - filter);
+            topicLevel = (topicSeparator == NULL) ? (size_t)(topicEnd - topic) : (size_t)(topicSeparator - topic);
+            if (!(filterLevel == 1 && filter[0] == '+') && (filterLevel != topicLevel || memcmp(filter, topic, filterLevel) != 0))
+            {
+                result = false;
+                break;
+            }
+            if (topicSeparator == NULL)
+            {
+                // "a/#" also matches "a"
+                result = (filterSeparator == NULL) || (strcmp(filterSeparator + 1, "#") == 0);
+                break;
+            }
+            if (filterSeparator == NULL)
+            {
+                result = false;
+                break;
+            }
+            filter = filterSeparator + 1;
+            topic = topicSeparator + 1;
+        }
+    }
+    return result;
+}
+
+static void on_match(void* context, void* value)
+{
+    MATCH_COUNT* count = (MATCH_COUNT*)context;
+    count->matches++;
+    count->checksum += (size_t)(uintptr_t)value;
+}
+
+static double run_linear(char** filters, size_t filterCount, char** topics, MATCH_COUNT* count)
+{
+    clock_t start = clock();
+    size_t topicIndex;
+    for (topicIndex = 0; topicIndex < BENCH_TOPIC_COUNT; topicIndex++)
+    {
+        size_t topicLength = strlen(topics[topicIndex]);
+        size_t filterIndex;
+        for (filterIndex = 0; filterIndex < filterCount; filterIndex++)
+        {
+            if (linear_filter_matches(filters[filterIndex], topics[topicIndex], topicLength))
+            {
+                on_match(count, (void*)(uintptr_t)(filterIndex + 1));
+            }
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double run_trie(MQTT_TOPIC_TRIE_HANDLE trie, char** topics, MATCH_COUNT* count)
+{
+    clock_t start = clock();
+    size_t topicIndex;
+    for (topicIndex = 0; topicIndex < BENCH_TOPIC_COUNT; topicIndex++)
+    {
+        (void)mqtt_topic_trie_match(trie, topics[topicIndex], strlen(topics[topicIndex]), on_match, count);
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static char** alloc_strings(size_t count)
+{
+    char** result = (char**)malloc(count * sizeof(char*));
+    if (result != NULL)
+    {
+        size_t index;
+        char* block = (char*)malloc(count * BENCH_TOPIC_SIZE);
+        if (block == NULL)
+        {
+            free(result);
+            result = NULL;
+        }
+        else
+        {
+            for (index = 0; index < count; index++)
+            {
+                result[index] = block + index * BENCH_TOPIC_SIZE;
+            }
+        }
+    }
+    return result;
+}
+
+static void free_strings(char** strings)
+{
+    if (strings != NULL)
+    {
+        free(strings[0]);
+        free(strings);
+    }
+}
+
+static int run_filter_count(size_t filterCount)
+{
+    int result = 0;
+    char** filters = alloc_strings(filterCount);
+    char** topics = alloc_strings(BENCH_TOPIC_COUNT);
+    MQTT_TOPIC_TRIE_HANDLE trie = mqtt_topic_trie_create(NULL);
+
+    if (filters == NULL || topics == NULL || trie == NULL)
+    {
+        (void)printf("Failed allocating the benchmark data\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        size_t index;
+        clock_t start = clock();
+        double buildTime;
+
+        for (index = 0; index < filterCount && result == 0; index++)
+        {
+            make_filter(filters[index], index);
+            if (mqtt_topic_trie_insert(trie, filters[index], (void*)(uintptr_t)(index + 1)) != 0)
+            {
+                (void)printf("Failed inserting %s\r\n", filters[index]);
+                result = __LINE__;
+            }
+        }
+        buildTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        if (result == 0)
+        {
+            MATCH_COUNT linear = { 0, 0 };
+            MATCH_COUNT trieCount = { 0, 0 };
+            double linearTime;
+            double trieTime;
+
+            srand(42);
+            for (index = 0; index < BENCH_TOPIC_COUNT; index++)
+            {
+                make_topic(topics[index], filterCount, index);
+            }
+
+            linearTime = run_linear(filters, filterCount, topics, &linear);
+            trieTime = run_trie(trie, topics, &trieCount);
+            if (linear.matches != trieCount.matches || linear.checksum != trieCount.checksum)
+            {
+                (void)printf("Matchers disagree: %lu/%lu matches\r\n", (unsigned long)linear.matches, (unsigned long)trieCount.matches);
+                result = __LINE__;
+            }
+            (void)printf("%8lu %10lu %10.1f %14.1f %14.1f %8.1fx\r\n", (unsigned long)filterCount, (unsigned long)trieCount.matches, buildTime * 1000.0,
+                linearTime * 1e9 / BENCH_TOPIC_COUNT, trieTime * 1e9 / BENCH_TOPIC_COUNT,
+                (trieTime > 0.0) ? linearTime / trieTime : 0.0);
+        }
+    }
+
+    mqtt_topic_trie_destroy(trie);
+    free_strings(topics);
+    free_strings(filters);
+    return result;
+}
+
+int main(void)
+{
+    int result = 0;
+    size_t countIndex;
+
+    (void)printf("%8s %10s %10s %14s %14s %9s\r\n", "filters", "matches", "build ms", "linear ns/msg", "trie ns/msg", "speedup");
+    for (countIndex = 0; countIndex < sizeof(FILTER_COUNTS) / sizeof(FILTER_COUNTS[0]) && result == 0; countIndex++)
+    {
+        result = run_filter_count(FILTER_COUNTS[countIndex]);
+    }
+    return result;
+}
@@ -0,0 +1,228 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+// Packet trace cost of mqtt_trace_ring_record against a formatted text trace line.
+//
+// The text reference formats the fields of a PUBLISH and the wall clock time
+// into a stack buffer the way the text trace of the client does, without its
+// STRING_HANDLE allocations or the logging call, so it is a lower bound for
+// mqtt_client_set_trace.  The ring is then recorded into from several threads
+// at once while a reader copies it out and checks that no record it gets is
+// torn.  Build it with -fsanitize=thread to check for data races.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_umqtt_c/mqttconst.h"
+#include "azure_umqtt_c/mqtt_trace_ring.h"
+
+#define BENCH_RECORD_COUNT          (4 * 1024 * 1024)
+#define BENCH_RING_CAPACITY         4096
+#define BENCH_WRITERS               4
+#define BENCH_WRITER_RECORDS        (1024 * 1024)
+#define BENCH_READ_COUNT            256
+#define BENCH_TOPIC                 "devices/bench-device/messages/events/"
+
+typedef struct WRITER_TAG
+{
+    MQTT_TRACE_RING_HANDLE ring;
+    uint32_t index;
+} WRITER;
+
+typedef struct READER_TAG
+{
+    MQTT_TRACE_RING_HANDLE ring;
+    int stop;
+    size_t reads;
+    size_t records;
+    size_t torn;
+} READER;
+
+// Every field but the timestamp is derived from the packet id and the writer, so a torn record shows
+static MQTT_TRACE_RECORD make_record(uint32_t writer, uint32_t sequence)
+{
+    MQTT_TRACE_RECORD result;
+    (void)memset(&result, 0, sizeof(result));
+    result.timestampMs = sequence;
+    result.packetId = (uint16_t)sequence;
+    result.topicHash = writer * 0x9E3779B9u ^ result.packetId;
+    result.length = (uint32_t)result.packetId + writer;
+    result.packetType = PUBLISH_TYPE;
+    result.flags = (uint8_t)writer;
+    result.direction = (uint8_t)(sequence & 1);
+    return result;
+}
+
+static bool is_consistent(const MQTT_TRACE_RECORD* record)
+{
+    uint32_t writer = record->flags;
+    return writer < BENCH_WRITERS && record->packetType == PUBLISH_TYPE && record->packetId == (uint16_t)record->timestampMs &&
+        record->topicHash == (writer * 0x9E3779B9u ^ record->packetId) && record->length == (uint32_t)record->packetId + writer &&
+        record->direction == (record->timestampMs & 1);
+}
+
+static double run_text(uint32_t* checksum)
+{
+    size_t index;
+    char line[256];
+    clock_t start = clock();
+    for (index = 0; index < BENCH_RECORD_COUNT; index++)
+    {
+        char timeResult[32];
+        time_t now = time(NULL);
+        struct tm* localTime = localtime(&now);
+        if (localTime == NULL || strftime(timeResult, sizeof(timeResult), "%H:%M:%S", localTime) == 0)
+        {
+            timeResult[0] = '\0';
+        }
+        int length = snprintf(line, sizeof(line), "-> %s PUBLISH | IS_DUP: %s | RETAIN: %d | QOS: %s | TOPIC_NAME: %s | PACKET_ID: %d | PAYLOAD_LEN: %lu",
+            timeResult, "false", 0, "DELIVER_AT_LEAST_ONCE", BENCH_TOPIC, (int)(uint16_t)index, (unsigned long)64);
+        *checksum += (uint32_t)length + (uint8_t)line[length / 2];
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double run_ring(MQTT_TRACE_RING_HANDLE ring, uint32_t* checksum)
+{
+    size_t index;
+    MQTT_TRACE_RECORD last;
+    clock_t start = clock();
+    for (index = 0; index < BENCH_RECORD_COUNT; index++)
+    {
+        MQTT_TRACE_RECORD record = make_record(0, (uint32_t)index);
+        mqtt_trace_ring_record(ring, &record);
+    }
+    double result = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if (mqtt_trace_ring_read(ring, &last, 1) == 1)
+    {
+        *checksum += last.length;
+    }
+    return result;
+}
+
+static int write_records(void* context)
+{
+    WRITER* writer = (WRITER*)context;
+    uint32_t sequence;
+    for (sequence = 0; sequence < BENCH_WRITER_RECORDS; sequence++)
+    {
+        MQTT_TRACE_RECORD record = make_record(writer->index, sequence);
+        mqtt_trace_ring_record(writer->ring, &record);
+    }
+    return 0;
+}
+
+static int read_records(void* context)
+{
+    READER* reader = (READER*)context;
+    MQTT_TRACE_RECORD records[BENCH_READ_COUNT];
+    while (!__atomic_load_n(&reader->stop, __ATOMIC_ACQUIRE))
+    {
+        size_t count = mqtt_trace_ring_read(reader->ring, records, BENCH_READ_COUNT);
+        size_t index;
+        for (index = 0; index < count; index++)
+        {
+            if (!is_consistent(&records[index]))
+            {
+                reader->torn++;
+            }
+        }
+        reader->reads++;
+        reader->records += count;
+    }
+    return 0;
+}
+
+static int run_concurrent(MQTT_TRACE_RING_HANDLE ring, double* elapsed, READER* reader)
+{
+    int result = 0;
+    WRITER writers[BENCH_WRITERS];
+    THREAD_HANDLE threads[BENCH_WRITERS];
+    THREAD_HANDLE readerThread;
+    size_t started = 0;
+    size_t index;
+    clock_t start;
+    int threadResult;
+
+    reader->ring = ring;
+    if (ThreadAPI_Create(&readerThread, read_records, reader) != THREADAPI_OK)
+    {
+        (void)printf("Failed starting the reader\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        start = clock();
+        for (index = 0; index < BENCH_WRITERS; index++)
+        {
+            writers[index].ring = ring;
+            writers[index].index = (uint32_t)index;
+            if (ThreadAPI_Create(&threads[index], write_records, &writers[index]) != THREADAPI_OK)
+            {
+                (void)printf("Failed starting writer %lu\r\n", (unsigned long)index);
+                result = __LINE__;
+                break;
+            }
+            started++;
+        }
+        for (index = 0; index < started; index++)
+        {
+            (void)ThreadAPI_Join(threads[index], &threadResult);
+        }
+        // clock() counts the time of every thread of the process, the reader included
+        *elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        __atomic_store_n(&reader->stop, 1, __ATOMIC_RELEASE);
+        (void)ThreadAPI_Join(readerThread, &threadResult);
+    }
+    return result;
+}
+
+int main(void)
+{
+    int result = 0;
+    MQTT_TRACE_RING_HANDLE ring = mqtt_trace_ring_create(BENCH_RING_CAPACITY);
+    if (ring == NULL)
+    {
+        (void)printf("Failed creating the trace ring\r\n");
+        result = __LINE__;
+    }
+    else
+    {
+        uint32_t textChecksum = 0;
+        uint32_t ringChecksum = 0;
+        double textTime = run_text(&textChecksum);
+        double ringTime = run_ring(ring, &ringChecksum);
+        (void)printf("%10s %14s %14s %9s %10s\r\n", "packets", "text ns/pkt", "ring ns/pkt", "speedup", "checksum");
+        (void)printf("%10lu %14.1f %14.1f %8.1fx %10lu\r\n", (unsigned long)BENCH_RECORD_COUNT,
+            textTime * 1e9 / BENCH_RECORD_COUNT, ringTime * 1e9 / BENCH_RECORD_COUNT,
+            (ringTime > 0.0) ? textTime / ringTime : 0.0, (unsigned long)(textChecksum ^ ringChecksum));
+        mqtt_trace_ring_destroy(ring);
+
+        if ((ring = mqtt_trace_ring_create(BENCH_RING_CAPACITY)) == NULL)
+        {
+            (void)printf("Failed creating the trace ring\r\n");
+            result = __LINE__;
+        }
+        else
+        {
+            READER reader;
+            double elapsed = 0.0;
+            (void)memset(&reader, 0, sizeof(reader));
+            result = run_concurrent(ring, &elapsed, &reader);
+            (void)printf("\r\n%10s %14s %10s %10s %12s %6s\r\n", "writers", "cpu ns/pkt", "dropped", "reads", "records read", "torn");
+            (void)printf("%10d %14.1f %10lu %10lu %12lu %6lu\r\n", BENCH_WRITERS, elapsed * 1e9 / ((double)BENCH_WRITERS * BENCH_WRITER_RECORDS),
+                (unsigned long)mqtt_trace_ring_get_dropped(ring), (unsigned long)reader.reads, (unsigned long)reader.records, (unsigned long)reader.torn);
+            if (reader.torn != 0)
+            {
+                result = __LINE__;
+            }
+            mqtt_trace_ring_destroy(ring);
+        }
+    }
+    return result;
+}
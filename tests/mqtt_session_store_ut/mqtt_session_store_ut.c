@@ -0,0 +1,656 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c/umock_c.h"
+#include "umock_c/umock_c_negative_tests.h"
+#include "umock_c/umocktypes_charptr.h"
+#include "umock_c/umocktypes_stdint.h"
+#include "umock_c/umocktypes_bool.h"
+#include "umock_c/umocktypes.h"
+#include "umock_c/umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "umock_c/umock_c_prod.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_session_store.h"
+
+#define ENABLE_MOCKS
+
+MOCKABLE_FUNCTION(, CONCRETE_SESSION_STORE_HANDLE, test_store_create, const void*, parameters);
+MOCKABLE_FUNCTION(, void, test_store_destroy, CONCRETE_SESSION_STORE_HANDLE, concrete_store);
+MOCKABLE_FUNCTION(, int, test_store_save, CONCRETE_SESSION_STORE_HANDLE, concrete_store, MQTT_SESSION_RECORD_TYPE, recordType, uint16_t, packetId, const uint8_t*, data, size_t, length);
+MOCKABLE_FUNCTION(, int, test_store_remove, CONCRETE_SESSION_STORE_HANDLE, concrete_store, MQTT_SESSION_RECORD_TYPE, recordType, uint16_t, packetId);
+MOCKABLE_FUNCTION(, int, test_store_load, CONCRETE_SESSION_STORE_HANDLE, concrete_store, ON_SESSION_RECORD_LOADED, onRecordLoaded, void*, context);
+MOCKABLE_FUNCTION(, int, test_store_clear, CONCRETE_SESSION_STORE_HANDLE, concrete_store);
+
+#undef ENABLE_MOCKS
+
+#define TEST_MAX_RECORDS    8
+#define TEST_STORE_PATH     "mqtt_session_store_ut.db"
+#define TEST_STORE_TEMP_PATH TEST_STORE_PATH ".tmp"
+
+static const CONCRETE_SESSION_STORE_HANDLE TEST_CONCRETE_STORE = (CONCRETE_SESSION_STORE_HANDLE)0x4242;
+static const uint8_t TEST_RECORD_DATA[] = { 0x32, 0x09, 0x00, 0x03, 'a', '/', 'b', 0x00, 0x01, 'x', 'y' };
+
+static const MQTT_SESSION_STORE_INTERFACE_DESCRIPTION TEST_STORE_INTERFACE =
+{
+    test_store_create,
+    test_store_destroy,
+    test_store_save,
+    test_store_remove,
+    test_store_load,
+    test_store_clear
+};
+
+typedef struct TEST_LOADED_RECORD_TAG
+{
+    MQTT_SESSION_RECORD_TYPE recordType;
+    uint16_t packetId;
+    size_t length;
+    uint8_t firstByte;
+} TEST_LOADED_RECORD;
+
+static TEST_LOADED_RECORD g_loaded[TEST_MAX_RECORDS];
+static size_t g_loadedCount;
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+MU_DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    ASSERT_FAIL("umock_c reported error :%s", MU_ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+}
+
+static void on_record_loaded(void* context, MQTT_SESSION_RECORD_TYPE recordType, uint16_t packetId, const uint8_t* data, size_t length)
+{
+    (void)context;
+    if (g_loadedCount < TEST_MAX_RECORDS)
+    {
+        g_loaded[g_loadedCount].recordType = recordType;
+        g_loaded[g_loadedCount].packetId = packetId;
+        g_loaded[g_loadedCount].length = length;
+        g_loaded[g_loadedCount].firstByte = (length > 0) ? data[0] : 0;
+    }
+    g_loadedCount++;
+}
+
+static size_t load_records(MQTT_SESSION_STORE_HANDLE handle)
+{
+    g_loadedCount = 0;
+    ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_load(handle, on_record_loaded, NULL));
+    return g_loadedCount;
+}
+
+static void save_test_records(MQTT_SESSION_STORE_HANDLE handle)
+{
+    ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 1, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA)));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 2, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA)));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBREC, 2, NULL, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBREL, 1, NULL, 0));
+}
+
+static void assert_test_records(MQTT_SESSION_STORE_HANDLE handle)
+{
+    ASSERT_ARE_EQUAL(size_t, 3, load_records(handle));
+    ASSERT_ARE_EQUAL(int, MQTT_SESSION_RECORD_PUBLISH, g_loaded[0].recordType);
+    ASSERT_ARE_EQUAL(int, 2, g_loaded[0].packetId);
+    ASSERT_ARE_EQUAL(size_t, sizeof(TEST_RECORD_DATA), g_loaded[0].length);
+    ASSERT_ARE_EQUAL(int, TEST_RECORD_DATA[0], g_loaded[0].firstByte);
+    ASSERT_ARE_EQUAL(int, MQTT_SESSION_RECORD_PUBREC, g_loaded[1].recordType);
+    ASSERT_ARE_EQUAL(int, 2, g_loaded[1].packetId);
+    ASSERT_ARE_EQUAL(int, MQTT_SESSION_RECORD_PUBREL, g_loaded[2].recordType);
+    ASSERT_ARE_EQUAL(int, 1, g_loaded[2].packetId);
+    ASSERT_ARE_EQUAL(size_t, 0, g_loaded[2].length);
+}
+
+BEGIN_TEST_SUITE(mqtt_session_store_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(CONCRETE_SESSION_STORE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_SESSION_RECORD_LOADED, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_SESSION_RECORD_TYPE, int);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+    REGISTER_GLOBAL_MOCK_RETURN(test_store_create, TEST_CONCRETE_STORE);
+    REGISTER_GLOBAL_MOCK_RETURN(test_store_save, 0);
+    REGISTER_GLOBAL_MOCK_RETURN(test_store_remove, 0);
+    REGISTER_GLOBAL_MOCK_RETURN(test_store_load, 0);
+    REGISTER_GLOBAL_MOCK_RETURN(test_store_clear, 0);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    g_loadedCount = 0;
+    (void)remove(TEST_STORE_PATH);
+    (void)remove(TEST_STORE_TEMP_PATH);
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    (void)remove(TEST_STORE_PATH);
+    (void)remove(TEST_STORE_TEMP_PATH);
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_001: [If interfaceDescription is NULL or any of its functions is NULL then mqtt_session_store_create shall return NULL.] */
+TEST_FUNCTION(mqtt_session_store_create_interface_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(NULL, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_001: [If interfaceDescription is NULL or any of its functions is NULL then mqtt_session_store_create shall return NULL.] */
+TEST_FUNCTION(mqtt_session_store_create_interface_function_NULL_fail)
+{
+    // arrange
+    MQTT_SESSION_STORE_INTERFACE_DESCRIPTION interfaceDescription = TEST_STORE_INTERFACE;
+    interfaceDescription.concrete_store_load = NULL;
+
+    // act
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(&interfaceDescription, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_003: [mqtt_session_store_create shall create the backend by calling concrete_store_create with parameters.] */
+TEST_FUNCTION(mqtt_session_store_create_succeed)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(test_store_create(TEST_RECORD_DATA));
+
+    // act
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(&TEST_STORE_INTERFACE, TEST_RECORD_DATA);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_002: [If any failure is encountered then mqtt_session_store_create shall return NULL.] */
+TEST_FUNCTION(mqtt_session_store_create_concrete_create_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(test_store_create(NULL)).SetReturn(NULL);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(&TEST_STORE_INTERFACE, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_002: [If any failure is encountered then mqtt_session_store_create shall return NULL.] */
+TEST_FUNCTION(mqtt_session_store_create_malloc_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(&TEST_STORE_INTERFACE, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_004: [If handle is NULL then mqtt_session_store_destroy shall do nothing.] */
+TEST_FUNCTION(mqtt_session_store_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_session_store_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_005: [mqtt_session_store_destroy shall destroy the backend and free the handle, stored records are kept by persistent backends.] */
+TEST_FUNCTION(mqtt_session_store_destroy_succeed)
+{
+    // arrange
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(&TEST_STORE_INTERFACE, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(test_store_destroy(TEST_CONCRETE_STORE));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    mqtt_session_store_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_006: [If handle is NULL, recordType is not valid, packetId is 0 or data is NULL while length is not 0 then mqtt_session_store_save shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_session_store_save_invalid_parameters_fail)
+{
+    // arrange
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(&TEST_STORE_INTERFACE, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result1 = mqtt_session_store_save(NULL, MQTT_SESSION_RECORD_PUBLISH, 1, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA));
+    int result2 = mqtt_session_store_save(handle, (MQTT_SESSION_RECORD_TYPE)0, 1, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA));
+    int result3 = mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 0, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA));
+    int result4 = mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 1, NULL, sizeof(TEST_RECORD_DATA));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result1);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result2);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result3);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result4);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_007: [mqtt_session_store_save shall store the record through concrete_store_save, replacing the record of the same packet id.] */
+TEST_FUNCTION(mqtt_session_store_save_succeed)
+{
+    // arrange
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(&TEST_STORE_INTERFACE, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(test_store_save(TEST_CONCRETE_STORE, MQTT_SESSION_RECORD_PUBLISH, 1, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA)));
+
+    // act
+    int result = mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 1, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_008: [If handle is NULL or recordType is not valid then mqtt_session_store_remove shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_session_store_remove_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_session_store_remove(NULL, MQTT_SESSION_RECORD_PUBLISH, 1);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_009: [mqtt_session_store_remove shall remove the record of packetId through concrete_store_remove, removing a missing record succeeds.] */
+TEST_FUNCTION(mqtt_session_store_remove_succeed)
+{
+    // arrange
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(&TEST_STORE_INTERFACE, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(test_store_remove(TEST_CONCRETE_STORE, MQTT_SESSION_RECORD_PUBREC, 7));
+
+    // act
+    int result = mqtt_session_store_remove(handle, MQTT_SESSION_RECORD_PUBREC, 7);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_010: [If handle or onRecordLoaded is NULL then mqtt_session_store_load shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_session_store_load_callback_NULL_fail)
+{
+    // arrange
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(&TEST_STORE_INTERFACE, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result1 = mqtt_session_store_load(NULL, on_record_loaded, NULL);
+    int result2 = mqtt_session_store_load(handle, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result1);
+    ASSERT_ARE_NOT_EQUAL(int, 0, result2);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_012: [If handle is NULL then mqtt_session_store_clear shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_session_store_clear_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_session_store_clear(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_011: [mqtt_session_store_load shall call onRecordLoaded for every stored record in the order they were saved.] */
+/* Tests_SRS_MQTT_SESSION_STORE_07_014: [mqtt_session_store_memory_get_interface_description shall return the interface of the in-memory backend.] */
+TEST_FUNCTION(mqtt_session_store_memory_load_in_save_order_succeed)
+{
+    // arrange
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(mqtt_session_store_memory_get_interface_description(), NULL);
+    ASSERT_IS_NOT_NULL(handle);
+
+    // act
+    save_test_records(handle);
+
+    // assert
+    assert_test_records(handle);
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_009: [mqtt_session_store_remove shall remove the record of packetId through concrete_store_remove, removing a missing record succeeds.] */
+/* Tests_SRS_MQTT_SESSION_STORE_07_013: [mqtt_session_store_clear shall remove every stored record through concrete_store_clear.] */
+TEST_FUNCTION(mqtt_session_store_memory_remove_and_clear_succeed)
+{
+    // arrange
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(mqtt_session_store_memory_get_interface_description(), NULL);
+    save_test_records(handle);
+
+    // act
+    int result1 = mqtt_session_store_remove(handle, MQTT_SESSION_RECORD_PUBREC, 2);
+    int result2 = mqtt_session_store_remove(handle, MQTT_SESSION_RECORD_PUBREC, 9);
+    size_t countAfterRemove = load_records(handle);
+    int result3 = mqtt_session_store_clear(handle);
+    size_t countAfterClear = load_records(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result1);
+    ASSERT_ARE_EQUAL(int, 0, result2);
+    ASSERT_ARE_EQUAL(size_t, 2, countAfterRemove);
+    ASSERT_ARE_EQUAL(int, 0, result3);
+    ASSERT_ARE_EQUAL(size_t, 0, countAfterClear);
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+#ifndef _WIN32
+/* Tests_SRS_MQTT_SESSION_STORE_07_015: [mqtt_session_store_file_get_interface_description shall return the interface of the memory mapped file backend.] */
+/* Tests_SRS_MQTT_SESSION_STORE_07_005: [mqtt_session_store_destroy shall destroy the backend and free the handle, stored records are kept by persistent backends.] */
+TEST_FUNCTION(mqtt_session_store_file_records_survive_reopen_succeed)
+{
+    // arrange
+    MQTT_SESSION_STORE_FILE_OPTIONS options = { TEST_STORE_PATH, 0, false };
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+    ASSERT_IS_NOT_NULL(handle);
+    save_test_records(handle);
+    mqtt_session_store_destroy(handle);
+
+    // act
+    handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    assert_test_records(handle);
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_002: [If any failure is encountered then mqtt_session_store_create shall return NULL.] */
+TEST_FUNCTION(mqtt_session_store_file_options_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_017: [The file backend shall fail to create when path names a file that is not empty and does not start with the store header, leaving the file untouched.] */
+TEST_FUNCTION(mqtt_session_store_file_foreign_file_fail)
+{
+    // arrange
+    static const char FOREIGN_CONTENT[] = "not a session store";
+    MQTT_SESSION_STORE_FILE_OPTIONS options = { TEST_STORE_PATH, 0, false };
+    long fileSize;
+    FILE* file = fopen(TEST_STORE_PATH, "wb");
+    ASSERT_IS_NOT_NULL(file);
+    ASSERT_ARE_NOT_EQUAL(int, EOF, fputs(FOREIGN_CONTENT, file));
+    (void)fclose(file);
+
+    // act
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+
+    file = fopen(TEST_STORE_PATH, "rb");
+    ASSERT_IS_NOT_NULL(file);
+    (void)fseek(file, 0, SEEK_END);
+    fileSize = ftell(file);
+    (void)fclose(file);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(int, (int)(sizeof(FOREIGN_CONTENT) - 1), (int)fileSize);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_011: [mqtt_session_store_load shall call onRecordLoaded for every stored record in the order they were saved.] */
+TEST_FUNCTION(mqtt_session_store_file_torn_record_dropped_succeed)
+{
+    // arrange
+    MQTT_SESSION_STORE_FILE_OPTIONS options = { TEST_STORE_PATH, 0, false };
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+    save_test_records(handle);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 3, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA)));
+    mqtt_session_store_destroy(handle);
+
+    // Flip a payload byte of the last record as if the crash hit while writing it
+    FILE* file = fopen(TEST_STORE_PATH, "r+b");
+    ASSERT_IS_NOT_NULL(file);
+    // 16 byte file header, two 16 + 11 byte records padded to 32, two 16 byte records without data, then the last record header
+    ASSERT_ARE_EQUAL(int, 0, fseek(file, 16 + (2 * 32) + (2 * 16) + 16, SEEK_SET));
+    ASSERT_ARE_NOT_EQUAL(int, EOF, fputc(0xff, file));
+    (void)fclose(file);
+
+    // act
+    handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+    size_t loaded = load_records(handle);
+    int result = mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 4, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA));
+    mqtt_session_store_destroy(handle);
+    handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 3, loaded);
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 4, load_records(handle));
+    ASSERT_ARE_EQUAL(int, 4, g_loaded[3].packetId);
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_011: [mqtt_session_store_load shall call onRecordLoaded for every stored record in the order they were saved.] */
+TEST_FUNCTION(mqtt_session_store_file_records_after_torn_record_dropped_succeed)
+{
+    // arrange
+    MQTT_SESSION_STORE_FILE_OPTIONS options = { TEST_STORE_PATH, 0, false };
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 1, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA)));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 2, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA)));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 3, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA)));
+    mqtt_session_store_destroy(handle);
+
+    // Flip a payload byte of the middle record, the valid record after it must not come back
+    FILE* file = fopen(TEST_STORE_PATH, "r+b");
+    ASSERT_IS_NOT_NULL(file);
+    // 16 byte file header, one 16 + 11 byte record padded to 32, then the middle record header
+    ASSERT_ARE_EQUAL(int, 0, fseek(file, 16 + 32 + 16, SEEK_SET));
+    ASSERT_ARE_NOT_EQUAL(int, EOF, fputc(0xff, file));
+    (void)fclose(file);
+
+    // act
+    handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+    size_t loaded = load_records(handle);
+    // Takes the place of the torn record, so the record after it would follow on the next scan
+    int result = mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 4, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA));
+    mqtt_session_store_destroy(handle);
+    handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, loaded);
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, load_records(handle));
+    ASSERT_ARE_EQUAL(int, 1, g_loaded[0].packetId);
+    ASSERT_ARE_EQUAL(int, 4, g_loaded[1].packetId);
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_007: [mqtt_session_store_save shall store the record through concrete_store_save, replacing the record of the same packet id.] */
+TEST_FUNCTION(mqtt_session_store_file_compaction_stale_temp_file_succeed)
+{
+    // arrange
+    MQTT_SESSION_STORE_FILE_OPTIONS options = { TEST_STORE_PATH, 64, false };
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+    uint16_t packetId;
+    for (packetId = 10; packetId < 15; packetId++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, packetId, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA)));
+    }
+    mqtt_session_store_destroy(handle);
+    // Leave a full log behind as the temp file of a compaction that crashed
+    ASSERT_ARE_EQUAL(int, 0, rename(TEST_STORE_PATH, TEST_STORE_TEMP_PATH));
+    handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+
+    // act
+    // The third save leaves 64 stale bytes against 32 live ones and compacts into the temp file
+    for (packetId = 0; packetId < 3; packetId++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, 1, TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA)));
+    }
+    mqtt_session_store_destroy(handle);
+    handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, load_records(handle));
+    ASSERT_ARE_EQUAL(int, 1, g_loaded[0].packetId);
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SESSION_STORE_07_007: [mqtt_session_store_save shall store the record through concrete_store_save, replacing the record of the same packet id.] */
+TEST_FUNCTION(mqtt_session_store_file_compaction_keeps_live_records_succeed)
+{
+    // arrange
+    MQTT_SESSION_STORE_FILE_OPTIONS options = { TEST_STORE_PATH, 4096, false };
+    MQTT_SESSION_STORE_HANDLE handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+    long fileSize;
+    uint16_t packetId;
+
+    // act
+    for (packetId = 1; packetId <= 4000; packetId++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_save(handle, MQTT_SESSION_RECORD_PUBLISH, (uint16_t)((packetId % 4) + 1), TEST_RECORD_DATA, sizeof(TEST_RECORD_DATA)));
+    }
+    ASSERT_ARE_EQUAL(int, 0, mqtt_session_store_remove(handle, MQTT_SESSION_RECORD_PUBLISH, 1));
+    mqtt_session_store_destroy(handle);
+    handle = mqtt_session_store_create(mqtt_session_store_file_get_interface_description(), &options);
+
+    FILE* file = fopen(TEST_STORE_PATH, "rb");
+    ASSERT_IS_NOT_NULL(file);
+    (void)fseek(file, 0, SEEK_END);
+    fileSize = ftell(file);
+    (void)fclose(file);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 3, load_records(handle));
+    ASSERT_ARE_EQUAL(int, 2, g_loaded[0].packetId);
+    ASSERT_ARE_EQUAL(int, 3, g_loaded[1].packetId);
+    ASSERT_ARE_EQUAL(int, 4, g_loaded[2].packetId);
+    // 4000 records of 32 bytes would need more than the initial 64 KB
+    ASSERT_IS_TRUE(fileSize <= 64 * 1024);
+
+    // cleanup
+    mqtt_session_store_destroy(handle);
+}
+#endif
+
+END_TEST_SUITE(mqtt_session_store_ut)
@@ -0,0 +1,376 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c/umock_c.h"
+#include "umock_c/umock_c_negative_tests.h"
+#include "umock_c/umocktypes_charptr.h"
+#include "umock_c/umocktypes_stdint.h"
+#include "umock_c/umocktypes.h"
+#include "umock_c/umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/buffer_.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "umock_c/umock_c_prod.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_submit_queue.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern BUFFER_HANDLE real_BUFFER_new(void);
+extern int real_BUFFER_build(BUFFER_HANDLE handle, const unsigned char* source, size_t size);
+extern void real_BUFFER_delete(BUFFER_HANDLE s);
+extern unsigned char* real_BUFFER_u_char(BUFFER_HANDLE handle);
+extern size_t real_BUFFER_length(BUFFER_HANDLE handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+MU_DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    ASSERT_FAIL("umock_c reported error :%s", MU_ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+}
+
+// One byte packet holding marker, enough to tell packets apart
+static BUFFER_HANDLE make_packet(unsigned char marker)
+{
+    BUFFER_HANDLE result = real_BUFFER_new();
+    ASSERT_IS_NOT_NULL(result);
+    ASSERT_ARE_EQUAL(int, 0, real_BUFFER_build(result, &marker, 1));
+    return result;
+}
+
+static void push_packet(MQTT_SUBMIT_QUEUE_HANDLE handle, unsigned char marker)
+{
+    ASSERT_ARE_EQUAL(int, 0, mqtt_submit_queue_push(handle, make_packet(marker)));
+}
+
+static unsigned char pop_marker(MQTT_SUBMIT_QUEUE_HANDLE handle)
+{
+    unsigned char result;
+    BUFFER_HANDLE packet = mqtt_submit_queue_pop(handle);
+    ASSERT_IS_NOT_NULL(packet);
+    ASSERT_ARE_EQUAL(size_t, 1, real_BUFFER_length(packet));
+    result = real_BUFFER_u_char(packet)[0];
+    real_BUFFER_delete(packet);
+    return result;
+}
+
+BEGIN_TEST_SUITE(mqtt_submit_queue_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(BUFFER_HANDLE, void*);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+
+    REGISTER_GLOBAL_MOCK_HOOK(BUFFER_delete, real_BUFFER_delete);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_002: [mqtt_submit_queue_create shall return an empty queue.] */
+TEST_FUNCTION(mqtt_submit_queue_create_succeed)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_SUBMIT_QUEUE_HANDLE handle = mqtt_submit_queue_create();
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(mqtt_submit_queue_pop(handle));
+
+    // cleanup
+    mqtt_submit_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_001: [If any failure is encountered then mqtt_submit_queue_create shall return NULL.] */
+TEST_FUNCTION(mqtt_submit_queue_create_malloc_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_SUBMIT_QUEUE_HANDLE handle = mqtt_submit_queue_create();
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_003: [If handle is NULL then mqtt_submit_queue_destroy shall do nothing.] */
+TEST_FUNCTION(mqtt_submit_queue_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_submit_queue_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_004: [mqtt_submit_queue_destroy shall free every queued packet.] */
+TEST_FUNCTION(mqtt_submit_queue_destroy_frees_packets_succeed)
+{
+    // arrange
+    MQTT_SUBMIT_QUEUE_HANDLE handle = mqtt_submit_queue_create();
+    ASSERT_IS_NOT_NULL(handle);
+    push_packet(handle, 1);
+    push_packet(handle, 2);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(handle));
+
+    // act
+    mqtt_submit_queue_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_005: [If handle or packet is NULL then mqtt_submit_queue_push shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_submit_queue_push_handle_NULL_fail)
+{
+    // arrange
+    BUFFER_HANDLE packet = make_packet(1);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_submit_queue_push(NULL, packet);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    real_BUFFER_delete(packet);
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_005: [If handle or packet is NULL then mqtt_submit_queue_push shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_submit_queue_push_packet_NULL_fail)
+{
+    // arrange
+    MQTT_SUBMIT_QUEUE_HANDLE handle = mqtt_submit_queue_create();
+    ASSERT_IS_NOT_NULL(handle);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_submit_queue_push(handle, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_submit_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_006: [If any failure is encountered then mqtt_submit_queue_push shall return a non-zero value and leave packet to the caller.] */
+TEST_FUNCTION(mqtt_submit_queue_push_malloc_fail)
+{
+    // arrange
+    MQTT_SUBMIT_QUEUE_HANDLE handle = mqtt_submit_queue_create();
+    BUFFER_HANDLE packet = make_packet(1);
+    ASSERT_IS_NOT_NULL(handle);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    int result = mqtt_submit_queue_push(handle, packet);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(mqtt_submit_queue_pop(handle));
+
+    // cleanup
+    real_BUFFER_delete(packet);
+    mqtt_submit_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_007: [mqtt_submit_queue_push shall append packet without taking a lock, from any number of threads at once.] */
+TEST_FUNCTION(mqtt_submit_queue_push_succeed)
+{
+    // arrange
+    MQTT_SUBMIT_QUEUE_HANDLE handle = mqtt_submit_queue_create();
+    BUFFER_HANDLE packet = make_packet(1);
+    ASSERT_IS_NOT_NULL(handle);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    int result = mqtt_submit_queue_push(handle, packet);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_TRUE(packet == mqtt_submit_queue_pop(handle));
+
+    // cleanup
+    real_BUFFER_delete(packet);
+    mqtt_submit_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_008: [If handle is NULL then mqtt_submit_queue_pop shall return NULL.] */
+TEST_FUNCTION(mqtt_submit_queue_pop_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    BUFFER_HANDLE result = mqtt_submit_queue_pop(NULL);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_009: [mqtt_submit_queue_pop shall remove and return the oldest packet, keeping the order in which each thread pushed its packets.] */
+TEST_FUNCTION(mqtt_submit_queue_pop_in_order_succeed)
+{
+    // arrange
+    MQTT_SUBMIT_QUEUE_HANDLE handle = mqtt_submit_queue_create();
+    ASSERT_IS_NOT_NULL(handle);
+    push_packet(handle, 1);
+    push_packet(handle, 2);
+    push_packet(handle, 3);
+    umock_c_reset_all_calls();
+
+    // act
+    unsigned char first = pop_marker(handle);
+    unsigned char second = pop_marker(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 1, (int)first);
+    ASSERT_ARE_EQUAL(int, 2, (int)second);
+
+    // cleanup
+    mqtt_submit_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_009: [mqtt_submit_queue_pop shall remove and return the oldest packet, keeping the order in which each thread pushed its packets.] */
+TEST_FUNCTION(mqtt_submit_queue_pop_interleaved_with_push_succeed)
+{
+    // arrange
+    MQTT_SUBMIT_QUEUE_HANDLE handle = mqtt_submit_queue_create();
+    ASSERT_IS_NOT_NULL(handle);
+    push_packet(handle, 1);
+
+    // act
+    unsigned char first = pop_marker(handle);
+    push_packet(handle, 2);
+    push_packet(handle, 3);
+    unsigned char second = pop_marker(handle);
+    push_packet(handle, 4);
+    unsigned char third = pop_marker(handle);
+    unsigned char fourth = pop_marker(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 1, (int)first);
+    ASSERT_ARE_EQUAL(int, 2, (int)second);
+    ASSERT_ARE_EQUAL(int, 3, (int)third);
+    ASSERT_ARE_EQUAL(int, 4, (int)fourth);
+    ASSERT_IS_NULL(mqtt_submit_queue_pop(handle));
+
+    // cleanup
+    mqtt_submit_queue_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_SUBMIT_QUEUE_07_010: [If no packet is ready, including while a push that came first is still linking its packet, mqtt_submit_queue_pop shall return NULL.] */
+TEST_FUNCTION(mqtt_submit_queue_pop_empty_succeed)
+{
+    // arrange
+    MQTT_SUBMIT_QUEUE_HANDLE handle = mqtt_submit_queue_create();
+    ASSERT_IS_NOT_NULL(handle);
+    push_packet(handle, 1);
+    (void)pop_marker(handle);
+    umock_c_reset_all_calls();
+
+    // act
+    BUFFER_HANDLE result = mqtt_submit_queue_pop(handle);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_submit_queue_destroy(handle);
+}
+
+END_TEST_SUITE(mqtt_submit_queue_ut)
@@ -0,0 +1,559 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c/umock_c.h"
+#include "umock_c/umock_c_negative_tests.h"
+#include "umock_c/umocktypes_charptr.h"
+#include "umock_c/umocktypes_stdint.h"
+#include "umock_c/umocktypes.h"
+#include "umock_c/umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "umock_c/umock_c_prod.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_timer_wheel.h"
+
+#define TEST_TIMER_COUNT    4
+
+static const tickcounter_ms_t TEST_START_MS = 1000;
+
+static MQTT_TIMER g_timers[TEST_TIMER_COUNT];
+static tickcounter_ms_t g_expiredAtMs[TEST_TIMER_COUNT];
+static size_t g_expiredCount[TEST_TIMER_COUNT];
+static size_t g_expiredOrder[TEST_TIMER_COUNT];
+static size_t g_totalExpired;
+static MQTT_TIMER_WHEEL_HANDLE g_wheel;
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+MU_DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    ASSERT_FAIL("umock_c reported error :%s", MU_ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+}
+
+static void on_timer_expired(void* context)
+{
+    size_t index = (size_t)(uintptr_t)context;
+    g_expiredAtMs[index] = mqtt_timer_wheel_get_current_ms(g_wheel);
+    g_expiredCount[index]++;
+    g_expiredOrder[index] = g_totalExpired++;
+}
+
+// Schedules timer 1 for right away from the callback of timer 0
+static void on_timer_expired_reschedule(void* context)
+{
+    on_timer_expired(context);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_timer_wheel_schedule(g_wheel, &g_timers[1], TEST_START_MS, on_timer_expired, (void*)(uintptr_t)1));
+}
+
+// Cancels timer 1 from the callback of timer 0
+static void on_timer_expired_cancel(void* context)
+{
+    on_timer_expired(context);
+    mqtt_timer_wheel_cancel(g_wheel, &g_timers[1]);
+}
+
+static void schedule_timer(size_t index, tickcounter_ms_t dueMs)
+{
+    ASSERT_ARE_EQUAL(int, 0, mqtt_timer_wheel_schedule(g_wheel, &g_timers[index], dueMs, on_timer_expired, (void*)(uintptr_t)index));
+}
+
+// Advances in steps of stepMs until the timer expires and returns the time it expired at
+static tickcounter_ms_t advance_until_expired(size_t index, tickcounter_ms_t stepMs, tickcounter_ms_t limitMs)
+{
+    tickcounter_ms_t currentMs = mqtt_timer_wheel_get_current_ms(g_wheel);
+    while (g_expiredCount[index] == 0 && currentMs < limitMs)
+    {
+        currentMs += stepMs;
+        (void)mqtt_timer_wheel_advance(g_wheel, currentMs);
+    }
+    ASSERT_ARE_EQUAL(size_t, 1, g_expiredCount[index]);
+    return g_expiredAtMs[index];
+}
+
+BEGIN_TEST_SUITE(mqtt_timer_wheel_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    size_t index;
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    for (index = 0; index < TEST_TIMER_COUNT; index++)
+    {
+        memset(&g_timers[index], 0, sizeof(MQTT_TIMER));
+        g_expiredAtMs[index] = 0;
+        g_expiredCount[index] = 0;
+        g_expiredOrder[index] = 0;
+    }
+    g_totalExpired = 0;
+    g_wheel = mqtt_timer_wheel_create(TEST_START_MS);
+    ASSERT_IS_NOT_NULL(g_wheel);
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    mqtt_timer_wheel_destroy(g_wheel);
+    g_wheel = NULL;
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_002: [mqtt_timer_wheel_create shall return an empty wheel whose current time is currentMs.] */
+TEST_FUNCTION(mqtt_timer_wheel_create_succeed)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_TIMER_WHEEL_HANDLE handle = mqtt_timer_wheel_create(TEST_START_MS);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(uint64_t, TEST_START_MS, mqtt_timer_wheel_get_current_ms(handle));
+    ASSERT_ARE_EQUAL(uint32_t, UINT32_MAX, mqtt_timer_wheel_get_timeout(handle, TEST_START_MS));
+
+    // cleanup
+    mqtt_timer_wheel_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_001: [If any failure is encountered then mqtt_timer_wheel_create shall return NULL.] */
+TEST_FUNCTION(mqtt_timer_wheel_create_malloc_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_TIMER_WHEEL_HANDLE handle = mqtt_timer_wheel_create(TEST_START_MS);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_003: [If handle is NULL then mqtt_timer_wheel_destroy shall do nothing.] */
+TEST_FUNCTION(mqtt_timer_wheel_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_timer_wheel_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_004: [mqtt_timer_wheel_destroy shall unschedule every timer still on the wheel without calling it and free the wheel.] */
+TEST_FUNCTION(mqtt_timer_wheel_destroy_unschedules_timers_succeed)
+{
+    // arrange
+    schedule_timer(0, TEST_START_MS + 10);
+    schedule_timer(1, TEST_START_MS + 100000);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    mqtt_timer_wheel_destroy(g_wheel);
+    g_wheel = NULL;
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(g_timers[0].next);
+    ASSERT_IS_NULL(g_timers[1].next);
+    ASSERT_ARE_EQUAL(size_t, 0, g_totalExpired);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_005: [If handle, timer or onExpired is NULL then mqtt_timer_wheel_schedule shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_timer_wheel_schedule_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_timer_wheel_schedule(NULL, &g_timers[0], TEST_START_MS, on_timer_expired, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_005: [If handle, timer or onExpired is NULL then mqtt_timer_wheel_schedule shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_timer_wheel_schedule_timer_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_timer_wheel_schedule(g_wheel, NULL, TEST_START_MS, on_timer_expired, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_005: [If handle, timer or onExpired is NULL then mqtt_timer_wheel_schedule shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_timer_wheel_schedule_onExpired_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_timer_wheel_schedule(g_wheel, &g_timers[0], TEST_START_MS, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NULL(g_timers[0].next);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_006: [mqtt_timer_wheel_schedule shall schedule timer to call onExpired with context once the wheel is advanced to dueMs, moving it if it is already scheduled, and return 0.] */
+TEST_FUNCTION(mqtt_timer_wheel_schedule_succeed)
+{
+    // arrange
+
+    // act
+    int result = mqtt_timer_wheel_schedule(g_wheel, &g_timers[2], TEST_START_MS + 5, on_timer_expired, (void*)(uintptr_t)2);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 4));
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 5));
+    ASSERT_ARE_EQUAL(size_t, 1, g_expiredCount[2]);
+    ASSERT_ARE_EQUAL(uint64_t, TEST_START_MS + 5, g_expiredAtMs[2]);
+    ASSERT_IS_NULL(g_timers[2].next);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_006: [mqtt_timer_wheel_schedule shall schedule timer to call onExpired with context once the wheel is advanced to dueMs, moving it if it is already scheduled, and return 0.] */
+TEST_FUNCTION(mqtt_timer_wheel_schedule_scheduled_timer_moves_succeed)
+{
+    // arrange
+    schedule_timer(0, TEST_START_MS + 5);
+
+    // act
+    schedule_timer(0, TEST_START_MS + 5000);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 4999));
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 5000));
+    ASSERT_ARE_EQUAL(size_t, 1, g_expiredCount[0]);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_007: [A timer whose dueMs is not after the current time of the wheel shall expire on the next mqtt_timer_wheel_advance.] */
+TEST_FUNCTION(mqtt_timer_wheel_schedule_already_due_succeed)
+{
+    // arrange
+    schedule_timer(0, TEST_START_MS - 10);
+    schedule_timer(1, TEST_START_MS);
+
+    // act
+    uint32_t timeout = mqtt_timer_wheel_get_timeout(g_wheel, TEST_START_MS);
+    size_t expired = mqtt_timer_wheel_advance(g_wheel, TEST_START_MS);
+
+    // assert
+    ASSERT_ARE_EQUAL(uint32_t, 0, timeout);
+    ASSERT_ARE_EQUAL(size_t, 2, expired);
+    ASSERT_ARE_EQUAL(size_t, 0, g_expiredOrder[0]);
+    ASSERT_ARE_EQUAL(size_t, 1, g_expiredOrder[1]);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_008: [mqtt_timer_wheel_schedule shall place timer in the first of 4 levels of 64 slots that reaches dueMs, where a slot of level n spans 64^n milliseconds, and a timer beyond the last level in its farthest slot.] */
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_013: [When the wheel reaches the start of a slot of a higher level mqtt_timer_wheel_advance shall place the timers of that slot again.] */
+TEST_FUNCTION(mqtt_timer_wheel_advance_expires_to_the_millisecond_on_every_level_succeed)
+{
+    // arrange
+    const tickcounter_ms_t dueMs[TEST_TIMER_COUNT] = { TEST_START_MS + 63, TEST_START_MS + 4000, TEST_START_MS + 250001, TEST_START_MS + 16000003 };
+    size_t index;
+    for (index = 0; index < TEST_TIMER_COUNT; index++)
+    {
+        schedule_timer(index, dueMs[index]);
+    }
+
+    // act
+    for (index = 0; index < TEST_TIMER_COUNT; index++)
+    {
+        (void)advance_until_expired(index, 1, dueMs[index]);
+    }
+
+    // assert
+    for (index = 0; index < TEST_TIMER_COUNT; index++)
+    {
+        ASSERT_ARE_EQUAL(uint64_t, dueMs[index], g_expiredAtMs[index]);
+        ASSERT_ARE_EQUAL(size_t, index, g_expiredOrder[index]);
+    }
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_008: [mqtt_timer_wheel_schedule shall place timer in the first of 4 levels of 64 slots that reaches dueMs, where a slot of level n spans 64^n milliseconds, and a timer beyond the last level in its farthest slot.] */
+TEST_FUNCTION(mqtt_timer_wheel_advance_beyond_last_level_succeed)
+{
+    // arrange
+    const tickcounter_ms_t dueMs = TEST_START_MS + 65535000;
+    schedule_timer(0, dueMs);
+
+    // act
+    size_t early = mqtt_timer_wheel_advance(g_wheel, dueMs - 1);
+    size_t due = mqtt_timer_wheel_advance(g_wheel, dueMs);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, early);
+    ASSERT_ARE_EQUAL(size_t, 1, due);
+    ASSERT_ARE_EQUAL(size_t, 1, g_expiredCount[0]);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_009: [If handle or timer is NULL, or timer is not scheduled, then mqtt_timer_wheel_cancel shall do nothing.] */
+TEST_FUNCTION(mqtt_timer_wheel_cancel_not_scheduled_succeed)
+{
+    // arrange
+    schedule_timer(0, TEST_START_MS + 5);
+
+    // act
+    mqtt_timer_wheel_cancel(NULL, &g_timers[0]);
+    mqtt_timer_wheel_cancel(g_wheel, NULL);
+    mqtt_timer_wheel_cancel(g_wheel, &g_timers[1]);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 5));
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_010: [mqtt_timer_wheel_cancel shall unschedule timer without calling it.] */
+TEST_FUNCTION(mqtt_timer_wheel_cancel_succeed)
+{
+    // arrange
+    schedule_timer(0, TEST_START_MS + 5);
+    schedule_timer(1, TEST_START_MS + 5);
+    schedule_timer(2, TEST_START_MS + 100000);
+
+    // act
+    mqtt_timer_wheel_cancel(g_wheel, &g_timers[0]);
+    mqtt_timer_wheel_cancel(g_wheel, &g_timers[2]);
+
+    // assert
+    ASSERT_IS_NULL(g_timers[0].next);
+    ASSERT_IS_NULL(g_timers[2].next);
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 200000));
+    ASSERT_ARE_EQUAL(size_t, 0, g_expiredCount[0]);
+    ASSERT_ARE_EQUAL(size_t, 1, g_expiredCount[1]);
+    ASSERT_ARE_EQUAL(size_t, 0, g_expiredCount[2]);
+    ASSERT_ARE_EQUAL(uint32_t, UINT32_MAX, mqtt_timer_wheel_get_timeout(g_wheel, TEST_START_MS + 200000));
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_011: [If handle is NULL then mqtt_timer_wheel_advance shall return 0.] */
+TEST_FUNCTION(mqtt_timer_wheel_advance_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    size_t result = mqtt_timer_wheel_advance(NULL, TEST_START_MS);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_012: [mqtt_timer_wheel_advance shall unschedule and call onExpired with its context for every timer whose dueMs is not after currentMs, and return the number of timers that expired.] */
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_015: [Timers shall expire in the order of their dueMs, timers that were scheduled when they were already due first.] */
+TEST_FUNCTION(mqtt_timer_wheel_advance_expires_due_timers_in_order_succeed)
+{
+    // arrange
+    schedule_timer(0, TEST_START_MS + 300000);
+    schedule_timer(1, TEST_START_MS + 70);
+    schedule_timer(2, TEST_START_MS + 2);
+    schedule_timer(3, TEST_START_MS + 300001);
+
+    // act
+    size_t result = mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 300000);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 3, result);
+    ASSERT_ARE_EQUAL(size_t, 2, g_expiredOrder[0]);
+    ASSERT_ARE_EQUAL(size_t, 1, g_expiredOrder[1]);
+    ASSERT_ARE_EQUAL(size_t, 0, g_expiredOrder[2]);
+    ASSERT_ARE_EQUAL(size_t, 0, g_expiredCount[3]);
+    ASSERT_IS_NOT_NULL(g_timers[3].next);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_012: [mqtt_timer_wheel_advance shall unschedule and call onExpired with its context for every timer whose dueMs is not after currentMs, and return the number of timers that expired.] */
+TEST_FUNCTION(mqtt_timer_wheel_advance_callback_schedules_due_timer_succeed)
+{
+    // arrange
+    ASSERT_ARE_EQUAL(int, 0, mqtt_timer_wheel_schedule(g_wheel, &g_timers[0], TEST_START_MS + 1, on_timer_expired_reschedule, (void*)(uintptr_t)0));
+
+    // act
+    size_t first = mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 1);
+    size_t second = mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 1);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, first);
+    ASSERT_ARE_EQUAL(size_t, 1, second);
+    ASSERT_ARE_EQUAL(size_t, 1, g_expiredCount[1]);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_012: [mqtt_timer_wheel_advance shall unschedule and call onExpired with its context for every timer whose dueMs is not after currentMs, and return the number of timers that expired.] */
+TEST_FUNCTION(mqtt_timer_wheel_advance_callback_cancels_expiring_timer_succeed)
+{
+    // arrange
+    ASSERT_ARE_EQUAL(int, 0, mqtt_timer_wheel_schedule(g_wheel, &g_timers[0], TEST_START_MS + 3, on_timer_expired_cancel, (void*)(uintptr_t)0));
+    schedule_timer(1, TEST_START_MS + 3);
+
+    // act
+    size_t result = mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 3);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, result);
+    ASSERT_ARE_EQUAL(size_t, 0, g_expiredCount[1]);
+    ASSERT_IS_NULL(g_timers[1].next);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_014: [mqtt_timer_wheel_advance shall set the current time of the wheel to currentMs, a currentMs before the current time leaves it unchanged.] */
+TEST_FUNCTION(mqtt_timer_wheel_advance_sets_current_time_succeed)
+{
+    // arrange
+
+    // act
+    (void)mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 500);
+    (void)mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 100);
+
+    // assert
+    ASSERT_ARE_EQUAL(uint64_t, TEST_START_MS + 500, mqtt_timer_wheel_get_current_ms(g_wheel));
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_016: [If handle is NULL then mqtt_timer_wheel_get_timeout shall return UINT32_MAX.] */
+TEST_FUNCTION(mqtt_timer_wheel_get_timeout_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    uint32_t result = mqtt_timer_wheel_get_timeout(NULL, TEST_START_MS);
+
+    // assert
+    ASSERT_ARE_EQUAL(uint32_t, UINT32_MAX, result);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_017: [mqtt_timer_wheel_get_timeout shall return the milliseconds from currentMs until mqtt_timer_wheel_advance has timers to expire or to place again, 0 once it has, or UINT32_MAX if no timer is scheduled.] */
+TEST_FUNCTION(mqtt_timer_wheel_get_timeout_succeed)
+{
+    // arrange
+    schedule_timer(0, TEST_START_MS + 40);
+
+    // act
+    uint32_t before = mqtt_timer_wheel_get_timeout(g_wheel, TEST_START_MS + 10);
+    uint32_t due = mqtt_timer_wheel_get_timeout(g_wheel, TEST_START_MS + 40);
+    uint32_t late = mqtt_timer_wheel_get_timeout(g_wheel, TEST_START_MS + 45);
+
+    // assert
+    ASSERT_ARE_EQUAL(uint32_t, 30, before);
+    ASSERT_ARE_EQUAL(uint32_t, 0, due);
+    ASSERT_ARE_EQUAL(uint32_t, 0, late);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_017: [mqtt_timer_wheel_get_timeout shall return the milliseconds from currentMs until mqtt_timer_wheel_advance has timers to expire or to place again, 0 once it has, or UINT32_MAX if no timer is scheduled.] */
+TEST_FUNCTION(mqtt_timer_wheel_get_timeout_never_after_due_succeed)
+{
+    // arrange
+    const tickcounter_ms_t dueMs = TEST_START_MS + 240000;
+    tickcounter_ms_t currentMs = TEST_START_MS;
+    size_t wakeups = 0;
+    schedule_timer(0, dueMs);
+
+    // act
+    while (g_expiredCount[0] == 0)
+    {
+        uint32_t timeout = mqtt_timer_wheel_get_timeout(g_wheel, currentMs);
+        ASSERT_ARE_NOT_EQUAL(uint32_t, UINT32_MAX, timeout);
+        currentMs += timeout;
+        ASSERT_IS_TRUE(currentMs <= dueMs);
+        (void)mqtt_timer_wheel_advance(g_wheel, currentMs);
+        wakeups++;
+    }
+
+    // assert
+    ASSERT_ARE_EQUAL(uint64_t, dueMs, g_expiredAtMs[0]);
+    // One wakeup per level the timer moves down, not one per slot
+    ASSERT_IS_TRUE(wakeups <= 3);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_018: [If handle is NULL then mqtt_timer_wheel_get_current_ms shall return 0.] */
+TEST_FUNCTION(mqtt_timer_wheel_get_current_ms_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    tickcounter_ms_t result = mqtt_timer_wheel_get_current_ms(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(uint64_t, 0, result);
+}
+
+/* Tests_SRS_MQTT_TIMER_WHEEL_07_019: [mqtt_timer_wheel_get_current_ms shall return the current time of the wheel.] */
+TEST_FUNCTION(mqtt_timer_wheel_get_current_ms_succeed)
+{
+    // arrange
+    (void)mqtt_timer_wheel_advance(g_wheel, TEST_START_MS + 77);
+
+    // act
+    tickcounter_ms_t result = mqtt_timer_wheel_get_current_ms(g_wheel);
+
+    // assert
+    ASSERT_ARE_EQUAL(uint64_t, TEST_START_MS + 77, result);
+}
+
+END_TEST_SUITE(mqtt_timer_wheel_ut)
@@ -0,0 +1,488 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c/umock_c.h"
+#include "umock_c/umock_c_negative_tests.h"
+#include "umock_c/umocktypes_charptr.h"
+#include "umock_c/umocktypes_stdint.h"
+#include "umock_c/umocktypes.h"
+#include "umock_c/umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "umock_c/umock_c_prod.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_topic_table.h"
+
+#define TEST_TOPIC_NAME         "devices/dev-1/messages/events/"
+#define TEST_OTHER_TOPIC_NAME   "devices/dev-2/messages/events/"
+#define TEST_MANY_TOPICS        100
+#define TEST_TOPIC_SIZE         32
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+MU_DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    ASSERT_FAIL("umock_c reported error :%s", MU_ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+}
+
+BEGIN_TEST_SUITE(mqtt_topic_table_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_charptr_register_types());
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_001: [mqtt_topic_table_create shall return an empty table.] */
+TEST_FUNCTION(mqtt_topic_table_create_succeed)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_topic_table_count(handle));
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_002: [If any failure is encountered then mqtt_topic_table_create shall return NULL.] */
+TEST_FUNCTION(mqtt_topic_table_create_malloc_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_003: [mqtt_topic_table_destroy shall free every interned topic and the table.] */
+TEST_FUNCTION(mqtt_topic_table_destroy_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    ASSERT_IS_NOT_NULL(mqtt_topic_table_intern(handle, "a/b"));
+    ASSERT_IS_NOT_NULL(mqtt_topic_table_intern(handle, "a/c"));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    mqtt_topic_table_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_004: [If handle or topicName is NULL, or topicName is empty, longer than 65535 bytes or contains a wildcard then mqtt_topic_table_intern shall return NULL.] */
+TEST_FUNCTION(mqtt_topic_table_intern_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_topic_table_intern(NULL, TEST_TOPIC_NAME);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_004: [If handle or topicName is NULL, or topicName is empty, longer than 65535 bytes or contains a wildcard then mqtt_topic_table_intern shall return NULL.] */
+TEST_FUNCTION(mqtt_topic_table_intern_invalid_topic_fail)
+{
+    // arrange
+    const char* invalidTopics[] = { "", "a/+/b", "a/#", "+", "#" };
+    size_t index;
+    char* longTopic = (char*)malloc(0x10000 + 1);
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    ASSERT_IS_NOT_NULL(longTopic);
+    (void)memset(longTopic, 'a', 0x10000);
+    longTopic[0x10000] = '\0';
+    umock_c_reset_all_calls();
+
+    // act
+    MQTT_TOPIC_HANDLE nullResult = mqtt_topic_table_intern(handle, NULL);
+    MQTT_TOPIC_HANDLE longResult = mqtt_topic_table_intern(handle, longTopic);
+
+    // assert
+    ASSERT_IS_NULL(nullResult);
+    ASSERT_IS_NULL(longResult);
+    for (index = 0; index < sizeof(invalidTopics) / sizeof(invalidTopics[0]); index++)
+    {
+        ASSERT_IS_NULL(mqtt_topic_table_intern(handle, invalidTopics[index]));
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_topic_table_count(handle));
+
+    // cleanup
+    free(longTopic);
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_006: [Otherwise mqtt_topic_table_intern shall add a topic holding topicName and its encoding, the name length as two bytes most significant first followed by the name.] */
+TEST_FUNCTION(mqtt_topic_table_intern_succeed)
+{
+    // arrange
+    size_t nameLength;
+    size_t encodedLength;
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_topic_table_intern(handle, TEST_TOPIC_NAME);
+
+    // assert
+    ASSERT_IS_NOT_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_topic_table_count(handle));
+    ASSERT_ARE_EQUAL(char_ptr, TEST_TOPIC_NAME, mqtt_topic_get_name(result, &nameLength));
+    ASSERT_ARE_EQUAL(size_t, strlen(TEST_TOPIC_NAME), nameLength);
+    const uint8_t* encoded = mqtt_topic_get_encoded(result, &encodedLength);
+    ASSERT_IS_NOT_NULL(encoded);
+    ASSERT_ARE_EQUAL(size_t, strlen(TEST_TOPIC_NAME) + 2, encodedLength);
+    ASSERT_ARE_EQUAL(int, 0, encoded[0]);
+    ASSERT_ARE_EQUAL(int, (int)strlen(TEST_TOPIC_NAME), encoded[1]);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(encoded + 2, TEST_TOPIC_NAME, strlen(TEST_TOPIC_NAME)));
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_006: [Otherwise mqtt_topic_table_intern shall add a topic holding topicName and its encoding, the name length as two bytes most significant first followed by the name.] */
+TEST_FUNCTION(mqtt_topic_table_intern_long_topic_succeed)
+{
+    // arrange
+    char longTopic[301];
+    size_t encodedLength;
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    (void)memset(longTopic, 'x', 300);
+    longTopic[300] = '\0';
+    umock_c_reset_all_calls();
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_topic_table_intern(handle, longTopic);
+
+    // assert
+    ASSERT_IS_NOT_NULL(result);
+    const uint8_t* encoded = mqtt_topic_get_encoded(result, &encodedLength);
+    ASSERT_ARE_EQUAL(size_t, 302, encodedLength);
+    ASSERT_ARE_EQUAL(int, 0x01, encoded[0]);
+    ASSERT_ARE_EQUAL(int, 0x2C, encoded[1]);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(encoded + 2, longTopic, 300));
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_005: [If topicName was interned before then mqtt_topic_table_intern shall return the same topic.] */
+TEST_FUNCTION(mqtt_topic_table_intern_same_name_succeed)
+{
+    // arrange
+    char copy[] = TEST_TOPIC_NAME;
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    MQTT_TOPIC_HANDLE first = mqtt_topic_table_intern(handle, TEST_TOPIC_NAME);
+    umock_c_reset_all_calls();
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_topic_table_intern(handle, copy);
+
+    // assert
+    ASSERT_IS_NOT_NULL(first);
+    ASSERT_ARE_EQUAL(void_ptr, first, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_topic_table_count(handle));
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_005: [If topicName was interned before then mqtt_topic_table_intern shall return the same topic.] */
+TEST_FUNCTION(mqtt_topic_table_intern_many_topics_succeed)
+{
+    // arrange
+    MQTT_TOPIC_HANDLE topics[TEST_MANY_TOPICS];
+    char topicName[TEST_TOPIC_SIZE];
+    size_t index;
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    umock_c_reset_all_calls();
+
+    // act
+    for (index = 0; index < TEST_MANY_TOPICS; index++)
+    {
+        (void)sprintf(topicName, "devices/dev-%lu/events", (unsigned long)index);
+        topics[index] = mqtt_topic_table_intern(handle, topicName);
+        ASSERT_IS_NOT_NULL(topics[index]);
+    }
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, TEST_MANY_TOPICS, mqtt_topic_table_count(handle));
+    for (index = 0; index < TEST_MANY_TOPICS; index++)
+    {
+        (void)sprintf(topicName, "devices/dev-%lu/events", (unsigned long)index);
+        ASSERT_ARE_EQUAL(void_ptr, topics[index], mqtt_topic_table_intern(handle, topicName));
+        ASSERT_ARE_EQUAL(char_ptr, topicName, mqtt_topic_get_name(topics[index], NULL));
+    }
+    ASSERT_ARE_EQUAL(size_t, TEST_MANY_TOPICS, mqtt_topic_table_count(handle));
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_007: [If any failure is encountered then mqtt_topic_table_intern shall return NULL.] */
+TEST_FUNCTION(mqtt_topic_table_intern_malloc_fail)
+{
+    // arrange
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_topic_table_intern(handle, TEST_TOPIC_NAME);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_topic_table_count(handle));
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_007: [If any failure is encountered then mqtt_topic_table_intern shall return NULL.] */
+TEST_FUNCTION(mqtt_topic_table_intern_slots_malloc_fail)
+{
+    // arrange
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_TOPIC_HANDLE result = mqtt_topic_table_intern(handle, TEST_TOPIC_NAME);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_topic_table_count(handle));
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_008: [mqtt_topic_table_count shall return the number of interned topics, 0 if handle is NULL.] */
+TEST_FUNCTION(mqtt_topic_table_count_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    size_t result = mqtt_topic_table_count(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_009: [If topic is NULL then mqtt_topic_get_name shall return NULL.] */
+TEST_FUNCTION(mqtt_topic_get_name_topic_NULL_fail)
+{
+    // arrange
+    size_t nameLength;
+
+    // act
+    const char* result = mqtt_topic_get_name(NULL, &nameLength);
+
+    // assert
+    ASSERT_IS_NULL(result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_010: [mqtt_topic_get_name shall return the zero terminated topic name and store its length in nameLength if nameLength is not NULL.] */
+TEST_FUNCTION(mqtt_topic_get_name_length_NULL_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    MQTT_TOPIC_HANDLE topic = mqtt_topic_table_intern(handle, TEST_TOPIC_NAME);
+    umock_c_reset_all_calls();
+
+    // act
+    const char* result = mqtt_topic_get_name(topic, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, TEST_TOPIC_NAME, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_011: [If topic or encodedLength is NULL then mqtt_topic_get_encoded shall return NULL.] */
+TEST_FUNCTION(mqtt_topic_get_encoded_NULL_fail)
+{
+    // arrange
+    size_t encodedLength;
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    MQTT_TOPIC_HANDLE topic = mqtt_topic_table_intern(handle, TEST_TOPIC_NAME);
+    umock_c_reset_all_calls();
+
+    // act
+    const uint8_t* topicNullResult = mqtt_topic_get_encoded(NULL, &encodedLength);
+    const uint8_t* lengthNullResult = mqtt_topic_get_encoded(topic, NULL);
+
+    // assert
+    ASSERT_IS_NULL(topicNullResult);
+    ASSERT_IS_NULL(lengthNullResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_013: [mqtt_topic_get_alias shall return the alias last set on topic, 0 if topic is NULL or has no alias.] */
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_015: [mqtt_topic_set_alias shall store alias on topic and return zero.] */
+TEST_FUNCTION(mqtt_topic_set_alias_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    MQTT_TOPIC_HANDLE topic = mqtt_topic_table_intern(handle, TEST_TOPIC_NAME);
+    umock_c_reset_all_calls();
+
+    // act
+    uint16_t initialAlias = mqtt_topic_get_alias(topic);
+    int result = mqtt_topic_set_alias(topic, 7);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, (int)initialAlias);
+    ASSERT_ARE_EQUAL(int, 7, (int)mqtt_topic_get_alias(topic));
+    ASSERT_ARE_EQUAL(int, 0, (int)mqtt_topic_get_alias(NULL));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_014: [If topic is NULL then mqtt_topic_set_alias shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_topic_set_alias_topic_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_topic_set_alias(NULL, 7);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TOPIC_TABLE_07_016: [mqtt_topic_table_clear_aliases shall set the alias of every topic in the table to 0.] */
+TEST_FUNCTION(mqtt_topic_table_clear_aliases_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TABLE_HANDLE handle = mqtt_topic_table_create();
+    MQTT_TOPIC_HANDLE topic = mqtt_topic_table_intern(handle, TEST_TOPIC_NAME);
+    MQTT_TOPIC_HANDLE otherTopic = mqtt_topic_table_intern(handle, TEST_OTHER_TOPIC_NAME);
+    (void)mqtt_topic_set_alias(topic, 1);
+    (void)mqtt_topic_set_alias(otherTopic, 2);
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_topic_table_clear_aliases(handle);
+    mqtt_topic_table_clear_aliases(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, (int)mqtt_topic_get_alias(topic));
+    ASSERT_ARE_EQUAL(int, 0, (int)mqtt_topic_get_alias(otherTopic));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_table_destroy(handle);
+}
+
+END_TEST_SUITE(mqtt_topic_table_ut)
@@ -0,0 +1,589 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c/umock_c.h"
+#include "umock_c/umock_c_negative_tests.h"
+#include "umock_c/umocktypes_charptr.h"
+#include "umock_c/umocktypes_stdint.h"
+#include "umock_c/umocktypes.h"
+#include "umock_c/umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "umock_c/umock_c_prod.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_topic_trie.h"
+
+#define TEST_MAX_MATCHES        16
+#define TEST_MANY_FILTERS       1000
+
+static void* TEST_VALUE_1 = (void*)0x11;
+static void* TEST_VALUE_2 = (void*)0x12;
+static void* TEST_VALUE_3 = (void*)0x13;
+
+static void* g_matches[TEST_MAX_MATCHES];
+static size_t g_matchCount;
+static void* g_destroyed[TEST_MAX_MATCHES];
+static size_t g_destroyedCount;
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+MU_DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    ASSERT_FAIL("umock_c reported error :%s", MU_ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+}
+
+static void on_value_destroy(void* value)
+{
+    if (g_destroyedCount < TEST_MAX_MATCHES)
+    {
+        g_destroyed[g_destroyedCount] = value;
+    }
+    g_destroyedCount++;
+}
+
+static void on_match(void* context, void* value)
+{
+    (void)context;
+    if (g_matchCount < TEST_MAX_MATCHES)
+    {
+        g_matches[g_matchCount] = value;
+    }
+    g_matchCount++;
+}
+
+static MQTT_TOPIC_TRIE_HANDLE create_trie_with(const char* topicFilter, void* value)
+{
+    MQTT_TOPIC_TRIE_HANDLE result = mqtt_topic_trie_create(on_value_destroy);
+    ASSERT_IS_NOT_NULL(result);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(result, topicFilter, value));
+    umock_c_reset_all_calls();
+    return result;
+}
+
+static size_t match_topic(MQTT_TOPIC_TRIE_HANDLE handle, const char* topicName)
+{
+    g_matchCount = 0;
+    return mqtt_topic_trie_match(handle, topicName, strlen(topicName), on_match, NULL);
+}
+
+static bool was_matched(void* value)
+{
+    size_t index;
+    bool result = false;
+    for (index = 0; index < g_matchCount && index < TEST_MAX_MATCHES; index++)
+    {
+        if (g_matches[index] == value)
+        {
+            result = true;
+        }
+    }
+    return result;
+}
+
+BEGIN_TEST_SUITE(mqtt_topic_trie_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_charptr_register_types());
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    g_matchCount = 0;
+    g_destroyedCount = 0;
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_001: [mqtt_topic_trie_create shall return an empty trie.] */
+TEST_FUNCTION(mqtt_topic_trie_create_succeed)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_TOPIC_TRIE_HANDLE handle = mqtt_topic_trie_create(on_value_destroy);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_topic_trie_count(handle));
+    ASSERT_ARE_EQUAL(size_t, 0, match_topic(handle, "a/b"));
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_002: [If any failure is encountered then mqtt_topic_trie_create shall return NULL.] */
+TEST_FUNCTION(mqtt_topic_trie_create_malloc_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_TOPIC_TRIE_HANDLE handle = mqtt_topic_trie_create(on_value_destroy);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_002: [If any failure is encountered then mqtt_topic_trie_create shall return NULL.] */
+TEST_FUNCTION(mqtt_topic_trie_create_root_malloc_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_TOPIC_TRIE_HANDLE handle = mqtt_topic_trie_create(on_value_destroy);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_003: [If handle or topicFilter is NULL, or topicFilter is not a valid MQTT topic filter then mqtt_topic_trie_insert shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_topic_trie_insert_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_topic_trie_insert(NULL, "a/b", TEST_VALUE_1);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_003: [If handle or topicFilter is NULL, or topicFilter is not a valid MQTT topic filter then mqtt_topic_trie_insert shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_topic_trie_insert_invalid_filter_fail)
+{
+    // arrange
+    const char* invalidFilters[] = { "", "a/#/b", "a/b#", "#a", "a+", "a/+b/c", "++", "##" };
+    size_t index;
+    MQTT_TOPIC_TRIE_HANDLE handle = mqtt_topic_trie_create(on_value_destroy);
+    umock_c_reset_all_calls();
+
+    // act
+    int nullResult = mqtt_topic_trie_insert(handle, NULL, TEST_VALUE_1);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, nullResult);
+    for (index = 0; index < sizeof(invalidFilters) / sizeof(invalidFilters[0]); index++)
+    {
+        ASSERT_ARE_NOT_EQUAL(int, 0, mqtt_topic_trie_insert(handle, invalidFilters[index], TEST_VALUE_1));
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_topic_trie_count(handle));
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_004: [mqtt_topic_trie_insert shall store value under topicFilter, replacing and destroying the value stored before for the same filter.] */
+TEST_FUNCTION(mqtt_topic_trie_insert_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = mqtt_topic_trie_create(on_value_destroy);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    int result = mqtt_topic_trie_insert(handle, "a/b", TEST_VALUE_1);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_topic_trie_count(handle));
+    ASSERT_ARE_EQUAL(size_t, 1, match_topic(handle, "a/b"));
+    ASSERT_ARE_EQUAL(void_ptr, TEST_VALUE_1, g_matches[0]);
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_004: [mqtt_topic_trie_insert shall store value under topicFilter, replacing and destroying the value stored before for the same filter.] */
+TEST_FUNCTION(mqtt_topic_trie_insert_replaces_value_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = create_trie_with("a/+", TEST_VALUE_1);
+
+    // act
+    int result = mqtt_topic_trie_insert(handle, "a/+", TEST_VALUE_2);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_destroyedCount);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_VALUE_1, g_destroyed[0]);
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_topic_trie_count(handle));
+    ASSERT_ARE_EQUAL(size_t, 1, match_topic(handle, "a/b"));
+    ASSERT_ARE_EQUAL(void_ptr, TEST_VALUE_2, g_matches[0]);
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_005: [If any failure is encountered then mqtt_topic_trie_insert shall return a non-zero value and not take ownership of value.] */
+TEST_FUNCTION(mqtt_topic_trie_insert_malloc_fail)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = mqtt_topic_trie_create(on_value_destroy);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    int result = mqtt_topic_trie_insert(handle, "a/b", TEST_VALUE_1);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_destroyedCount);
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_topic_trie_count(handle));
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_006: [If handle or topicFilter is NULL or no value is stored under topicFilter then mqtt_topic_trie_remove shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_topic_trie_remove_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_topic_trie_remove(NULL, "a/b");
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_006: [If handle or topicFilter is NULL or no value is stored under topicFilter then mqtt_topic_trie_remove shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_topic_trie_remove_not_found_fail)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = create_trie_with("a/b/c", TEST_VALUE_1);
+
+    // act
+    int prefixResult = mqtt_topic_trie_remove(handle, "a/b");
+    int wildcardResult = mqtt_topic_trie_remove(handle, "a/+/c");
+    int missingResult = mqtt_topic_trie_remove(handle, "x");
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, prefixResult);
+    ASSERT_ARE_NOT_EQUAL(int, 0, wildcardResult);
+    ASSERT_ARE_NOT_EQUAL(int, 0, missingResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_destroyedCount);
+    ASSERT_ARE_EQUAL(size_t, 1, match_topic(handle, "a/b/c"));
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_007: [mqtt_topic_trie_remove shall destroy the value stored under topicFilter and free the levels no other filter uses.] */
+TEST_FUNCTION(mqtt_topic_trie_remove_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = create_trie_with("a/b", TEST_VALUE_1);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(handle, "a/b/#", TEST_VALUE_2));
+    umock_c_reset_all_calls();
+
+    // only the # level goes, a/b still holds a value
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    int result = mqtt_topic_trie_remove(handle, "a/b/#");
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_destroyedCount);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_VALUE_2, g_destroyed[0]);
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_topic_trie_count(handle));
+    ASSERT_ARE_EQUAL(size_t, 0, match_topic(handle, "a/b/c"));
+    ASSERT_ARE_EQUAL(size_t, 1, match_topic(handle, "a/b"));
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_008: [If handle, topicName or onMatch is NULL then mqtt_topic_trie_match shall return 0.] */
+TEST_FUNCTION(mqtt_topic_trie_match_NULL_parameters_fail)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = create_trie_with("#", TEST_VALUE_1);
+
+    // act
+    size_t handleResult = mqtt_topic_trie_match(NULL, "a", 1, on_match, NULL);
+    size_t topicResult = mqtt_topic_trie_match(handle, NULL, 1, on_match, NULL);
+    size_t callbackResult = mqtt_topic_trie_match(handle, "a", 1, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, handleResult);
+    ASSERT_ARE_EQUAL(size_t, 0, topicResult);
+    ASSERT_ARE_EQUAL(size_t, 0, callbackResult);
+    ASSERT_ARE_EQUAL(size_t, 0, g_matchCount);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_009: [mqtt_topic_trie_match shall call onMatch once for every filter matching topicName, where + matches one level and # the parent level and any number of levels below it, and return the number of matches.] */
+TEST_FUNCTION(mqtt_topic_trie_match_single_level_wildcard_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = create_trie_with("a/+/c", TEST_VALUE_1);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(handle, "+", TEST_VALUE_2));
+    umock_c_reset_all_calls();
+
+    // act
+    size_t matchResult = match_topic(handle, "a/b/c");
+    size_t emptyLevelResult = match_topic(handle, "a//c");
+    size_t deeperResult = match_topic(handle, "a/b/c/d");
+    size_t shorterResult = match_topic(handle, "a/c");
+    size_t topLevelResult = match_topic(handle, "a");
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, matchResult);
+    ASSERT_ARE_EQUAL(size_t, 1, emptyLevelResult);
+    ASSERT_ARE_EQUAL(size_t, 0, deeperResult);
+    ASSERT_ARE_EQUAL(size_t, 0, shorterResult);
+    ASSERT_ARE_EQUAL(size_t, 1, topLevelResult);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_VALUE_2, g_matches[0]);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_009: [mqtt_topic_trie_match shall call onMatch once for every filter matching topicName, where + matches one level and # the parent level and any number of levels below it, and return the number of matches.] */
+TEST_FUNCTION(mqtt_topic_trie_match_multi_level_wildcard_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = create_trie_with("a/#", TEST_VALUE_1);
+
+    // act
+    size_t parentResult = match_topic(handle, "a");
+    size_t childResult = match_topic(handle, "a/b");
+    size_t deepResult = match_topic(handle, "a/b/c/d");
+    size_t otherResult = match_topic(handle, "b/a");
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, parentResult);
+    ASSERT_ARE_EQUAL(size_t, 1, childResult);
+    ASSERT_ARE_EQUAL(size_t, 1, deepResult);
+    ASSERT_ARE_EQUAL(size_t, 0, otherResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_009: [mqtt_topic_trie_match shall call onMatch once for every filter matching topicName, where + matches one level and # the parent level and any number of levels below it, and return the number of matches.] */
+TEST_FUNCTION(mqtt_topic_trie_match_overlapping_filters_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = create_trie_with("a/b", TEST_VALUE_1);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(handle, "a/+", TEST_VALUE_2));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(handle, "#", TEST_VALUE_3));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(handle, "a/c", (void*)0x14));
+    umock_c_reset_all_calls();
+
+    // act
+    size_t result = match_topic(handle, "a/b");
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 3, result);
+    ASSERT_ARE_EQUAL(size_t, 3, g_matchCount);
+    ASSERT_IS_TRUE(was_matched(TEST_VALUE_1));
+    ASSERT_IS_TRUE(was_matched(TEST_VALUE_2));
+    ASSERT_IS_TRUE(was_matched(TEST_VALUE_3));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_009: [mqtt_topic_trie_match shall call onMatch once for every filter matching topicName, where + matches one level and # the parent level and any number of levels below it, and return the number of matches.] */
+TEST_FUNCTION(mqtt_topic_trie_match_topic_not_zero_terminated_succeed)
+{
+    // arrange
+    const char topicName[] = { 'a', '/', 'b', 'c', 'd' };
+    MQTT_TOPIC_TRIE_HANDLE handle = create_trie_with("a/b", TEST_VALUE_1);
+
+    // act
+    size_t result = mqtt_topic_trie_match(handle, topicName, 3, on_match, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_009: [mqtt_topic_trie_match shall call onMatch once for every filter matching topicName, where + matches one level and # the parent level and any number of levels below it, and return the number of matches.] */
+TEST_FUNCTION(mqtt_topic_trie_match_many_filters_succeed)
+{
+    // arrange
+    char topicFilter[32];
+    size_t index;
+    MQTT_TOPIC_TRIE_HANDLE handle = mqtt_topic_trie_create(NULL);
+    for (index = 0; index < TEST_MANY_FILTERS; index++)
+    {
+        (void)sprintf(topicFilter, "devices/%lu/cmd", (unsigned long)index);
+        ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(handle, topicFilter, (void*)(uintptr_t)(index + 1)));
+    }
+    for (index = 0; index < TEST_MANY_FILTERS; index += 2)
+    {
+        (void)sprintf(topicFilter, "devices/%lu/cmd", (unsigned long)index);
+        ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_remove(handle, topicFilter));
+    }
+    umock_c_reset_all_calls();
+
+    // act
+    // assert
+    ASSERT_ARE_EQUAL(size_t, TEST_MANY_FILTERS / 2, mqtt_topic_trie_count(handle));
+    for (index = 0; index < TEST_MANY_FILTERS; index++)
+    {
+        (void)sprintf(topicFilter, "devices/%lu/cmd", (unsigned long)index);
+        ASSERT_ARE_EQUAL(size_t, index % 2, match_topic(handle, topicFilter));
+        if (index % 2 == 1)
+        {
+            ASSERT_ARE_EQUAL(void_ptr, (void*)(uintptr_t)(index + 1), g_matches[0]);
+        }
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_010: [Filters starting with a wildcard shall not match topic names starting with $.] */
+TEST_FUNCTION(mqtt_topic_trie_match_system_topic_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = create_trie_with("#", TEST_VALUE_1);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(handle, "+/info", TEST_VALUE_2));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(handle, "$SYS/#", TEST_VALUE_3));
+    umock_c_reset_all_calls();
+
+    // act
+    size_t result = match_topic(handle, "$SYS/info");
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, result);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_VALUE_3, g_matches[0]);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_topic_trie_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_011: [mqtt_topic_trie_destroy shall destroy every stored value with valueDestroy and free the trie.] */
+TEST_FUNCTION(mqtt_topic_trie_destroy_destroys_values_succeed)
+{
+    // arrange
+    MQTT_TOPIC_TRIE_HANDLE handle = create_trie_with("a/b", TEST_VALUE_1);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(handle, "a/+", TEST_VALUE_2));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_topic_trie_insert(handle, "a/#", TEST_VALUE_3));
+
+    // act
+    mqtt_topic_trie_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 3, g_destroyedCount);
+}
+
+/* Tests_SRS_MQTT_TOPIC_TRIE_07_012: [mqtt_topic_trie_count shall return the number of stored filters, 0 if handle is NULL.] */
+TEST_FUNCTION(mqtt_topic_trie_count_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    size_t result = mqtt_topic_trie_count(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+END_TEST_SUITE(mqtt_topic_trie_ut)
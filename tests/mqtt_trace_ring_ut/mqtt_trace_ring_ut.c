@@ -0,0 +1,526 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c/umock_c.h"
+#include "umock_c/umock_c_negative_tests.h"
+#include "umock_c/umocktypes_charptr.h"
+#include "umock_c/umocktypes_stdint.h"
+#include "umock_c/umocktypes.h"
+#include "umock_c/umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "umock_c/umock_c_prod.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_trace_ring.h"
+
+#define TEST_TRACE_PATH         "mqtt_trace_ring_ut.trc"
+#define TEST_CAPACITY           4
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+MU_DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    ASSERT_FAIL("umock_c reported error :%s", MU_ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+}
+
+// Every field is derived from index so records can be told apart
+static MQTT_TRACE_RECORD make_record(uint16_t index)
+{
+    MQTT_TRACE_RECORD result;
+    memset(&result, 0, sizeof(result));
+    result.timestampMs = 0x100000000ULL + index;
+    result.topicHash = 0x811C9DC5u ^ index;
+    result.length = 1000u + index;
+    result.packetId = index;
+    result.packetType = 0x30;
+    result.flags = 0x2;
+    result.direction = (uint8_t)((index % 2 == 0) ? MQTT_TRACE_OUTGOING : MQTT_TRACE_INCOMING);
+    return result;
+}
+
+static void record_range(MQTT_TRACE_RING_HANDLE handle, uint16_t first, uint16_t count)
+{
+    uint16_t index;
+    for (index = first; index < first + count; index++)
+    {
+        MQTT_TRACE_RECORD record = make_record(index);
+        mqtt_trace_ring_record(handle, &record);
+    }
+}
+
+static void assert_record(uint16_t index, const MQTT_TRACE_RECORD* record)
+{
+    MQTT_TRACE_RECORD expected = make_record(index);
+    ASSERT_ARE_EQUAL(uint64_t, expected.timestampMs, record->timestampMs);
+    ASSERT_ARE_EQUAL(uint32_t, expected.topicHash, record->topicHash);
+    ASSERT_ARE_EQUAL(uint32_t, expected.length, record->length);
+    ASSERT_ARE_EQUAL(uint16_t, expected.packetId, record->packetId);
+    ASSERT_ARE_EQUAL(uint8_t, expected.packetType, record->packetType);
+    ASSERT_ARE_EQUAL(uint8_t, expected.flags, record->flags);
+    ASSERT_ARE_EQUAL(uint8_t, expected.direction, record->direction);
+}
+
+static void write_file(const char* content, size_t length)
+{
+    FILE* file = fopen(TEST_TRACE_PATH, "wb");
+    ASSERT_IS_NOT_NULL(file);
+    ASSERT_ARE_EQUAL(size_t, length, fwrite(content, 1, length, file));
+    (void)fclose(file);
+}
+
+BEGIN_TEST_SUITE(mqtt_trace_ring_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    (void)remove(TEST_TRACE_PATH);
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    (void)remove(TEST_TRACE_PATH);
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_001: [If capacity is 0 then mqtt_trace_ring_create shall return NULL.] */
+TEST_FUNCTION(mqtt_trace_ring_create_capacity_0_fail)
+{
+    // arrange
+
+    // act
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(0);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_003: [mqtt_trace_ring_create shall return an empty ring keeping capacity records rounded up to a power of two.] */
+TEST_FUNCTION(mqtt_trace_ring_create_succeed)
+{
+    // arrange
+    MQTT_TRACE_RECORD records[TEST_CAPACITY];
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+
+    // act
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY - 1);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_trace_ring_read(handle, records, TEST_CAPACITY));
+    record_range(handle, 0, TEST_CAPACITY + 1);
+    ASSERT_ARE_EQUAL(size_t, TEST_CAPACITY, mqtt_trace_ring_read(handle, records, TEST_CAPACITY));
+    assert_record(1, &records[0]);
+
+    // cleanup
+    mqtt_trace_ring_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_002: [If any failure is encountered then mqtt_trace_ring_create shall return NULL.] */
+TEST_FUNCTION(mqtt_trace_ring_create_slots_malloc_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+
+    // act
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_002: [If any failure is encountered then mqtt_trace_ring_create shall return NULL.] */
+TEST_FUNCTION(mqtt_trace_ring_create_ring_malloc_fail)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(gballoc_malloc(IGNORED_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_004: [If handle is NULL then mqtt_trace_ring_destroy shall do nothing.] */
+TEST_FUNCTION(mqtt_trace_ring_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_trace_ring_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_005: [mqtt_trace_ring_destroy shall free the ring and its records.] */
+TEST_FUNCTION(mqtt_trace_ring_destroy_succeed)
+{
+    // arrange
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+    record_range(handle, 0, 2);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(gballoc_free(IGNORED_ARG));
+    STRICT_EXPECTED_CALL(gballoc_free(handle));
+
+    // act
+    mqtt_trace_ring_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_006: [If handle or record is NULL then mqtt_trace_ring_record shall do nothing.] */
+TEST_FUNCTION(mqtt_trace_ring_record_NULL_succeed)
+{
+    // arrange
+    MQTT_TRACE_RECORD records[TEST_CAPACITY];
+    MQTT_TRACE_RECORD record = make_record(1);
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_trace_ring_record(NULL, &record);
+    mqtt_trace_ring_record(handle, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_trace_ring_read(handle, records, TEST_CAPACITY));
+
+    // cleanup
+    mqtt_trace_ring_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_007: [mqtt_trace_ring_record shall copy record over the oldest record without taking a lock or allocating, from any number of threads at once.] */
+TEST_FUNCTION(mqtt_trace_ring_record_succeed)
+{
+    // arrange
+    MQTT_TRACE_RECORD records[TEST_CAPACITY];
+    MQTT_TRACE_RECORD record = make_record(7);
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_trace_ring_record(handle, &record);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_trace_ring_read(handle, records, TEST_CAPACITY));
+    assert_record(7, &records[0]);
+
+    // cleanup
+    mqtt_trace_ring_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_007: [mqtt_trace_ring_record shall copy record over the oldest record without taking a lock or allocating, from any number of threads at once.] */
+TEST_FUNCTION(mqtt_trace_ring_record_full_overwrites_oldest_succeed)
+{
+    // arrange
+    size_t index;
+    MQTT_TRACE_RECORD records[TEST_CAPACITY];
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+    umock_c_reset_all_calls();
+
+    // act
+    record_range(handle, 0, 3 * TEST_CAPACITY + 2);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, TEST_CAPACITY, mqtt_trace_ring_read(handle, records, TEST_CAPACITY));
+    for (index = 0; index < TEST_CAPACITY; index++)
+    {
+        assert_record((uint16_t)(2 * TEST_CAPACITY + 2 + index), &records[index]);
+    }
+    ASSERT_ARE_EQUAL(uint64_t, 0, mqtt_trace_ring_get_dropped(handle));
+
+    // cleanup
+    mqtt_trace_ring_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_009: [If handle or records is NULL then mqtt_trace_ring_read shall return 0.] */
+TEST_FUNCTION(mqtt_trace_ring_read_NULL_fail)
+{
+    // arrange
+    MQTT_TRACE_RECORD records[TEST_CAPACITY];
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+    record_range(handle, 0, 2);
+    umock_c_reset_all_calls();
+
+    // act
+    size_t handleResult = mqtt_trace_ring_read(NULL, records, TEST_CAPACITY);
+    size_t recordsResult = mqtt_trace_ring_read(handle, NULL, TEST_CAPACITY);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, handleResult);
+    ASSERT_ARE_EQUAL(size_t, 0, recordsResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_trace_ring_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_010: [mqtt_trace_ring_read shall copy up to count of the most recent records, oldest first, skipping records that are still being written, and return how many it copied.] */
+TEST_FUNCTION(mqtt_trace_ring_read_count_returns_most_recent_succeed)
+{
+    // arrange
+    MQTT_TRACE_RECORD records[TEST_CAPACITY];
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+    record_range(handle, 0, 3);
+    umock_c_reset_all_calls();
+
+    // act
+    size_t result = mqtt_trace_ring_read(handle, records, 2);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 2, result);
+    assert_record(1, &records[0]);
+    assert_record(2, &records[1]);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_trace_ring_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_011: [If handle is NULL then mqtt_trace_ring_get_dropped shall return 0.] */
+TEST_FUNCTION(mqtt_trace_ring_get_dropped_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    uint64_t result = mqtt_trace_ring_get_dropped(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(uint64_t, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_013: [If handle or path is NULL then mqtt_trace_ring_save shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_trace_ring_save_NULL_fail)
+{
+    // arrange
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+    umock_c_reset_all_calls();
+
+    // act
+    int handleResult = mqtt_trace_ring_save(NULL, TEST_TRACE_PATH);
+    int pathResult = mqtt_trace_ring_save(handle, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, handleResult);
+    ASSERT_ARE_NOT_EQUAL(int, 0, pathResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_trace_ring_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_014: [mqtt_trace_ring_save shall write the records the ring holds, oldest first, and the dropped count to path in a little endian format that does not depend on the platform.] */
+/* Tests_SRS_MQTT_TRACE_RING_07_017: [mqtt_trace_ring_load shall return a ring holding the records of the file in their order and its dropped count.] */
+TEST_FUNCTION(mqtt_trace_ring_save_load_succeed)
+{
+    // arrange
+    size_t index;
+    MQTT_TRACE_RECORD records[TEST_CAPACITY];
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+    record_range(handle, 0, TEST_CAPACITY + 1);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_trace_ring_save(handle, TEST_TRACE_PATH);
+    MQTT_TRACE_RING_HANDLE loaded = mqtt_trace_ring_load(TEST_TRACE_PATH);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_NOT_NULL(loaded);
+    ASSERT_ARE_EQUAL(size_t, TEST_CAPACITY, mqtt_trace_ring_read(loaded, records, TEST_CAPACITY));
+    for (index = 0; index < TEST_CAPACITY; index++)
+    {
+        assert_record((uint16_t)(index + 1), &records[index]);
+    }
+    ASSERT_ARE_EQUAL(uint64_t, 0, mqtt_trace_ring_get_dropped(loaded));
+
+    // cleanup
+    mqtt_trace_ring_destroy(loaded);
+    mqtt_trace_ring_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_014: [mqtt_trace_ring_save shall write the records the ring holds, oldest first, and the dropped count to path in a little endian format that does not depend on the platform.] */
+TEST_FUNCTION(mqtt_trace_ring_save_format_succeed)
+{
+    // arrange
+    static const unsigned char expected[] =
+    {
+        'M', 'Q', 'T', 'T', 'T', 'R', 'C', '1', 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x05, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0xC0, 0x9D, 0x1C, 0x81, 0xED, 0x03, 0x00, 0x00,
+        0x05, 0x00, 0x30, 0x02, 0x01, 0x00, 0x00, 0x00
+    };
+    unsigned char content[sizeof(expected) + 1];
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+    record_range(handle, 5, 1);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_trace_ring_save(handle, TEST_TRACE_PATH);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    FILE* file = fopen(TEST_TRACE_PATH, "rb");
+    ASSERT_IS_NOT_NULL(file);
+    size_t length = fread(content, 1, sizeof(content), file);
+    (void)fclose(file);
+    ASSERT_ARE_EQUAL(size_t, sizeof(expected), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(expected, content, sizeof(expected)));
+
+    // cleanup
+    mqtt_trace_ring_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_015: [If any failure is encountered then mqtt_trace_ring_save shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_trace_ring_save_open_fail)
+{
+    // arrange
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_create(TEST_CAPACITY);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_trace_ring_save(handle, "mqtt_trace_ring_ut_missing/trace.trc");
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+    mqtt_trace_ring_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_016: [If path is NULL then mqtt_trace_ring_load shall return NULL.] */
+TEST_FUNCTION(mqtt_trace_ring_load_path_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_load(NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_018: [If the file cannot be read, is not a trace file or any other failure is encountered then mqtt_trace_ring_load shall return NULL.] */
+TEST_FUNCTION(mqtt_trace_ring_load_missing_file_fail)
+{
+    // arrange
+
+    // act
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_load(TEST_TRACE_PATH);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_018: [If the file cannot be read, is not a trace file or any other failure is encountered then mqtt_trace_ring_load shall return NULL.] */
+TEST_FUNCTION(mqtt_trace_ring_load_not_trace_file_fail)
+{
+    // arrange
+    static const char content[] = "not a trace file, long enough for a header";
+    write_file(content, sizeof(content));
+
+    // act
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_load(TEST_TRACE_PATH);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_TRACE_RING_07_018: [If the file cannot be read, is not a trace file or any other failure is encountered then mqtt_trace_ring_load shall return NULL.] */
+TEST_FUNCTION(mqtt_trace_ring_load_truncated_fail)
+{
+    // arrange
+    static const char content[] =
+    {
+        'M', 'Q', 'T', 'T', 'T', 'R', 'C', '1', 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03
+    };
+    write_file(content, sizeof(content));
+
+    // act
+    MQTT_TRACE_RING_HANDLE handle = mqtt_trace_ring_load(TEST_TRACE_PATH);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+}
+
+END_TEST_SUITE(mqtt_trace_ring_ut)